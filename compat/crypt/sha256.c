@@ -40,6 +40,29 @@
 #include "config.h"
 #include "sha256.h"
 
+/*
+ * Use the SHA extensions of the CPU when it has them, checked at runtime
+ * so the same binary works on CPUs without them.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define SHA256_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && \
+    (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO) || \
+    (defined(__linux__) && defined(__GNUC__) && !defined(__clang__)))
+#define SHA256_ARMV8
+#include <arm_neon.h>
+#if !defined(__ARM_FEATURE_SHA2) && !defined(__ARM_FEATURE_CRYPTO)
+#define SHA256_ARMV8_RUNTIME
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
 #if BYTE_ORDER == BIG_ENDIAN
 
 /* Copy a vector of big-endian uint32_t into a vector of bytes */
@@ -110,7 +133,7 @@ be32dec_vect(uint32_t *dst, const unsigned char *src, size_t len)
  * the 512-bit input block to produce a new state.
  */
 static void
-SHA256_Transform(uint32_t * state, const unsigned char block[64])
+SHA256_Transform_portable(uint32_t * state, const unsigned char block[64])
 {
 	uint32_t W[64];
 	uint32_t S[8];
@@ -196,6 +219,185 @@ SHA256_Transform(uint32_t * state, const unsigned char block[64])
 		state[i] += S[i];
 }
 
+#if defined(SHA256_SHANI) || defined(SHA256_ARMV8)
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+#endif
+
+#ifdef SHA256_SHANI
+/*
+ * Each pass does four rounds, two per sha256rnds2.
+ * The message schedule for four passes on is worked out alongside.
+ */
+__attribute__((target("sha,sse4.1")))
+static void
+SHA256_Transform_shani(uint32_t * state, const unsigned char block[64])
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+	    0x0405060700010203ULL);
+	__m128i abef, cdgh, abef_save, cdgh_save, msg, tmp, m[4];
+	int i;
+
+	/* The state is kept as ABEF and CDGH */
+	tmp = _mm_shuffle_epi32(
+	    _mm_loadu_si128((const __m128i *)(const void *)&state[0]), 0xB1);
+	cdgh = _mm_shuffle_epi32(
+	    _mm_loadu_si128((const __m128i *)(const void *)&state[4]), 0x1B);
+	abef = _mm_alignr_epi8(tmp, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+	abef_save = abef;
+	cdgh_save = cdgh;
+
+	for (i = 0; i < 4; i++)
+		m[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+		    (const __m128i *)(const void *)(block + i * 16)), bswap);
+
+	for (i = 0; i < 16; i++) {
+		msg = _mm_add_epi32(m[i % 4],
+		    _mm_loadu_si128((const __m128i *)(const void *)&K[i * 4]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+		if (i >= 3 && i < 15) {
+			tmp = _mm_alignr_epi8(m[i % 4], m[(i + 3) % 4], 4);
+			m[(i + 1) % 4] = _mm_add_epi32(m[(i + 1) % 4], tmp);
+			m[(i + 1) % 4] =
+			    _mm_sha256msg2_epu32(m[(i + 1) % 4], m[i % 4]);
+		}
+		msg = _mm_shuffle_epi32(msg, 0x0E);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+		if (i >= 1 && i < 13)
+			m[(i + 3) % 4] =
+			    _mm_sha256msg1_epu32(m[(i + 3) % 4], m[i % 4]);
+	}
+
+	abef = _mm_add_epi32(abef, abef_save);
+	cdgh = _mm_add_epi32(cdgh, cdgh_save);
+
+	/* Back to ABCD and EFGH */
+	tmp = _mm_shuffle_epi32(abef, 0x1B);
+	cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+	_mm_storeu_si128((__m128i *)(void *)&state[0],
+	    _mm_blend_epi16(tmp, cdgh, 0xF0));
+	_mm_storeu_si128((__m128i *)(void *)&state[4],
+	    _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+static int
+SHA256_Supported_shani(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+	    !(ecx & bit_SSE4_1))
+		return 0;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return ebx & (1U << 29) ? 1 : 0;	/* SHA */
+}
+#endif
+
+#ifdef SHA256_ARMV8
+/* Each pass does four rounds and works out the schedule for four on. */
+#ifdef SHA256_ARMV8_RUNTIME
+__attribute__((target("+crypto")))
+#endif
+static void
+SHA256_Transform_armv8(uint32_t * state, const unsigned char block[64])
+{
+	uint32x4_t abcd, efgh, abcd_save, efgh_save, prev, tmp, m[4];
+	int i;
+
+	abcd = abcd_save = vld1q_u32(&state[0]);
+	efgh = efgh_save = vld1q_u32(&state[4]);
+
+	for (i = 0; i < 4; i++)
+		m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(block + i * 16)));
+
+	for (i = 0; i < 16; i++) {
+		tmp = vaddq_u32(m[i % 4], vld1q_u32(&K[i * 4]));
+		if (i < 12)
+			m[i % 4] = vsha256su0q_u32(m[i % 4], m[(i + 1) % 4]);
+		prev = abcd;
+		abcd = vsha256hq_u32(abcd, efgh, tmp);
+		efgh = vsha256h2q_u32(efgh, prev, tmp);
+		if (i < 12)
+			m[i % 4] = vsha256su1q_u32(m[i % 4],
+			    m[(i + 2) % 4], m[(i + 3) % 4]);
+	}
+
+	vst1q_u32(&state[0], vaddq_u32(abcd, abcd_save));
+	vst1q_u32(&state[4], vaddq_u32(efgh, efgh_save));
+}
+
+static int
+SHA256_Supported_armv8(void)
+{
+
+#ifdef SHA256_ARMV8_RUNTIME
+	return getauxval(AT_HWCAP) & HWCAP_SHA2 ? 1 : 0;
+#else
+	return 1;
+#endif
+}
+#endif
+
+static const struct sha256_impl {
+	const char *name;
+	void (*transform)(uint32_t *, const unsigned char[64]);
+	int (*supported)(void);
+} sha256_impls[] = {
+#ifdef SHA256_SHANI
+	{ "sha-ni", SHA256_Transform_shani, SHA256_Supported_shani },
+#endif
+#ifdef SHA256_ARMV8
+	{ "armv8", SHA256_Transform_armv8, SHA256_Supported_armv8 },
+#endif
+	{ "portable", SHA256_Transform_portable, NULL },
+};
+
+static const struct sha256_impl *sha256_impl;
+
+/*
+ * Select the named implementation, or the best one for this CPU if NULL.
+ * Returns the name of the one in use or NULL if the named one
+ * is not supported here.
+ */
+const char *
+SHA256_Select(const char *name)
+{
+	const struct sha256_impl *impl;
+	size_t i;
+
+	for (i = 0; i < sizeof(sha256_impls) / sizeof(sha256_impls[0]); i++) {
+		impl = &sha256_impls[i];
+		if (name != NULL && strcmp(name, impl->name) != 0)
+			continue;
+		if (impl->supported != NULL && !impl->supported()) {
+			if (name != NULL)
+				return NULL;
+			continue;
+		}
+		sha256_impl = impl;
+		return impl->name;
+	}
+	return NULL;
+}
+
 static unsigned char PAD[64] = {
 	0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -230,6 +432,9 @@ void
 SHA256_Init(SHA256_CTX * ctx)
 {
 
+	if (sha256_impl == NULL)
+		SHA256_Select(NULL);
+
 	/* Zero bits processed so far */
 	ctx->count = 0;
 
@@ -269,13 +474,13 @@ SHA256_Update(SHA256_CTX * ctx, const void *in, size_t len)
 
 	/* Finish the current block */
 	memcpy(&ctx->buf[r], src, 64 - r);
-	SHA256_Transform(ctx->state, ctx->buf);
+	sha256_impl->transform(ctx->state, ctx->buf);
 	src += 64 - r;
 	len -= 64 - r;
 
 	/* Perform complete blocks */
 	while (len >= 64) {
-		SHA256_Transform(ctx->state, src);
+		sha256_impl->transform(ctx->state, src);
 		src += 64;
 		len -= 64;
 	}
@@ -43,4 +43,8 @@ void	SHA256_Init(SHA256_CTX *);
 void	SHA256_Update(SHA256_CTX *, const void *, size_t);
 void	SHA256_Final(unsigned char [32], SHA256_CTX *);
 
+/* The transform used is picked for the CPU, this can change it. */
+#define	SHA256_HAVE_SELECT
+const char *SHA256_Select(const char *);
+
 #endif
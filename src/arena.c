@@ -0,0 +1,147 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - per interface arenas
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/*
+ * Each object is preceded by a tag holding its size including the tag,
+ * so a freed object can be matched to a later request.
+ * Once freed, the first word of the object links the free list.
+ * Chunks are linked through a tag at their start.
+ * The union also keeps every object suitably aligned.
+ */
+union arena_tag {
+	size_t size;
+	union arena_tag *next;
+	long double ld;
+	long long ll;
+	void *p;
+};
+
+#define	TAG_ROUNDUP(len) \
+	(((len) + sizeof(union arena_tag) - 1) / sizeof(union arena_tag) * \
+	sizeof(union arena_tag))
+
+static union arena_tag *
+arena_grow(struct arena *a, size_t need)
+{
+	union arena_tag *c;
+	size_t len, i;
+	bool own;
+
+	len = ARENA_MINCHUNK;
+	for (i = 0; i < a->a_nchunks && len < ARENA_CHUNKSIZE; i++)
+		len <<= 1;
+	while (len < ARENA_CHUNKSIZE && need > len - sizeof(*c))
+		len <<= 1;
+	/* Anything too big to share a chunk gets one to itself and
+	 * the space left in the newest chunk is kept. */
+	own = need > len - sizeof(*c);
+	if (own)
+		len = sizeof(*c) + need;
+	c = malloc(len);
+	if (c == NULL)
+		return NULL;
+	c->next = a->a_chunks;
+	a->a_chunks = c;
+	a->a_nchunks++;
+	a->a_bytes += len;
+	if (!own) {
+		a->a_next = (char *)(c + 1) + need;
+		a->a_left = len - sizeof(*c) - need;
+	}
+	return c + 1;
+}
+
+/* Returns a zeroed object, or NULL with errno set. */
+void *
+arena_get(struct arena *a, size_t size)
+{
+	union arena_tag *t, **tp;
+	size_t need;
+
+	need = sizeof(*t) + TAG_ROUNDUP(size == 0 ? 1 : size);
+	for (tp = &a->a_free; (t = *tp) != NULL; tp = &t[1].next) {
+		if (t->size == need) {
+			*tp = t[1].next;
+			a->a_nfree--;
+			goto found;
+		}
+	}
+
+	if (a->a_left >= need) {
+		t = (union arena_tag *)(void *)a->a_next;
+		a->a_next += need;
+		a->a_left -= need;
+	} else if ((t = arena_grow(a, need)) == NULL)
+		return NULL;
+	t->size = need;
+
+found:
+	if (++a->a_inuse > a->a_maxinuse)
+		a->a_maxinuse = a->a_inuse;
+	a->a_gets++;
+	memset(t + 1, 0, need - sizeof(*t));
+	return t + 1;
+}
+
+void
+arena_put(struct arena *a, void *obj)
+{
+	union arena_tag *t;
+
+	if (obj == NULL)
+		return;
+
+	t = (union arena_tag *)obj - 1;
+	assert(a->a_inuse != 0);
+	a->a_inuse--;
+	t[1].next = a->a_free;
+	a->a_free = t;
+	a->a_nfree++;
+}
+
+void
+arena_dispose(struct arena *a)
+{
+	union arena_tag *c;
+
+	while ((c = a->a_chunks) != NULL) {
+		a->a_chunks = c->next;
+		free(c);
+	}
+	a->a_free = NULL;
+	a->a_next = NULL;
+	a->a_left = a->a_nchunks = a->a_bytes = 0;
+	a->a_nfree = a->a_inuse = 0;
+}
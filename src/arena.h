@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - per interface arenas
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * An arena hands out objects of any size for one interface, carved
+ * from chunks so its protocol states sit together.
+ * The first chunk is ARENA_MINCHUNK bytes and each one after is double
+ * the last up to ARENA_CHUNKSIZE, so interfaces we only watch stay
+ * small.
+ * A freed object is kept for the next one of the same size, which is
+ * what a protocol restarting on the interface asks for.
+ * Disposing of the arena frees every chunk in one go.
+ */
+#define	ARENA_MINCHUNK	512
+#define	ARENA_CHUNKSIZE	4096
+
+union arena_tag;
+
+struct arena {
+	union arena_tag *a_chunks;
+	union arena_tag *a_free;
+	char *a_next;		/* unused space in the newest chunk */
+	size_t a_left;
+	size_t a_nchunks;
+	size_t a_bytes;		/* held in chunks */
+	size_t a_nfree;
+	size_t a_inuse;
+	size_t a_maxinuse;
+	unsigned long long a_gets;
+};
+
+void *arena_get(struct arena *, size_t);
+void arena_put(struct arena *, void *);
+void arena_dispose(struct arena *);
+
+#endif
@@ -36,6 +36,7 @@
 #include <netinet/if_ether.h>
 
 #include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -56,6 +57,52 @@
 #include "privsep.h"
 
 #if defined(ARP)
+/*
+ * Each ARP state is also kept in ctx->arp_states by address and then
+ * interface, so matching received ARP and finding other announcements
+ * of an address don't walk every state of every interface.
+ */
+struct arp_key {
+	const struct in_addr *addr;
+	const struct interface *ifp;
+};
+
+static int
+arp_compare(const struct in_addr *addr1, const struct interface *ifp1,
+    const struct in_addr *addr2, const struct interface *ifp2)
+{
+
+	if (addr1->s_addr != addr2->s_addr)
+		return addr1->s_addr < addr2->s_addr ? -1 : 1;
+	if (ifp1 == ifp2)
+		return 0;
+	return (uintptr_t)ifp1 < (uintptr_t)ifp2 ? -1 : 1;
+}
+
+static int
+arp_compare_nodes(__unused void *context, const void *n1, const void *n2)
+{
+	const struct arp_state *a1 = n1, *a2 = n2;
+
+	return arp_compare(&a1->addr, a1->iface, &a2->addr, a2->iface);
+}
+
+static int
+arp_compare_key(__unused void *context, const void *n, const void *key)
+{
+	const struct arp_state *astate = n;
+	const struct arp_key *k = key;
+
+	return arp_compare(&astate->addr, astate->iface, k->addr, k->ifp);
+}
+
+const rb_tree_ops_t arp_state_ops = {
+	.rbto_compare_nodes = arp_compare_nodes,
+	.rbto_compare_key = arp_compare_key,
+	.rbto_node_offset = offsetof(struct arp_state, tree),
+	.rbto_context = NULL
+};
+
 #define ARP_LEN								\
 	(FRAMEHDRLEN_MAX +						\
 	 sizeof(struct arphdr) + (2 * sizeof(uint32_t)) + (2 * HWADDR_LEN))
@@ -70,12 +117,13 @@ static ssize_t
 arp_request(const struct arp_state *astate,
     const struct in_addr *sip)
 {
-	const struct interface *ifp = astate->iface;
+	struct interface *ifp = astate->iface;
 	const struct in_addr *tip = &astate->addr;
 	uint8_t arp_buffer[ARP_LEN];
 	struct arphdr ar;
 	size_t len;
 	uint8_t *p;
+	ssize_t r;
 
 	ar.ar_hrd = htons(ifp->hwtype);
 	ar.ar_pro = htons(ETHERTYPE_IP);
@@ -108,11 +156,15 @@ arp_request(const struct arp_state *astate,
 
 #ifdef PRIVSEP
 	if (ifp->ctx->options & DHCPCD_PRIVSEP)
-		return ps_bpf_sendarp(ifp, tip, arp_buffer, len);
+		r = ps_bpf_sendarp(ifp, tip, arp_buffer, len);
+	else
 #endif
 	/* Note that well formed ethernet will add extra padding
 	 * to ensure that the packet is at least 60 bytes (64 including FCS). */
-	return bpf_send(astate->bpf, ETHERTYPE_ARP, arp_buffer, len);
+	r = bpf_send(ARP_CSTATE(ifp)->bpf, ETHERTYPE_ARP, arp_buffer, len);
+	if (r != -1)
+		STATS_COUNT(ifp, CNTP_ARP, CNT_SENT);
+	return r;
 
 eexit:
 	errno = ENOBUFS;
@@ -229,8 +281,7 @@ arp_packet(struct interface *ifp, uint8_t *data, size_t len,
 	const struct interface *ifn;
 	struct arphdr ar;
 	struct arp_msg arm;
-	const struct iarp_state *state;
-	struct arp_state *astate, *astaten;
+	struct arp_state *astate;
 	uint8_t *hw_s, *hw_t;
 
 	/* Copy the frame header source and destination out */
@@ -251,6 +302,7 @@ arp_packet(struct interface *ifp, uint8_t *data, size_t len,
 	/* We must have a full ARP header */
 	if (len < sizeof(ar))
 		return;
+	STATS_COUNT(ifp, CNTP_ARP, CNT_RECV);
 	memcpy(&ar, data, sizeof(ar));
 
 	if (!arp_validate(ifp, &ar)) {
@@ -286,48 +338,84 @@ arp_packet(struct interface *ifp, uint8_t *data, size_t len,
 
 	/* Match the ARP probe to our states.
 	 * Ignore Unicast Poll, RFC1122. */
-	state = ARP_CSTATE(ifp);
-	if (state == NULL)
+	if (ARP_CSTATE(ifp) == NULL)
 		return;
-	TAILQ_FOREACH_SAFE(astate, &state->arp_states, next, astaten) {
-		if (IN_ARE_ADDR_EQUAL(&arm.sip, &astate->addr) ||
-		    (IN_IS_ADDR_UNSPECIFIED(&arm.sip) &&
-		    IN_ARE_ADDR_EQUAL(&arm.tip, &astate->addr) &&
-		    bpf_flags & BPF_BCAST))
-			arp_found(astate, &arm);
-	}
+	astate = arp_find(ifp, &arm.sip);
+	if (astate == NULL && IN_IS_ADDR_UNSPECIFIED(&arm.sip) &&
+	    bpf_flags & BPF_BCAST)
+		astate = arp_find(ifp, &arm.tip);
+	if (astate != NULL)
+		arp_found(astate, &arm);
 }
 
 static void
 arp_read(void *arg)
 {
-	struct arp_state *astate = arg;
-	struct bpf *bpf = astate->bpf;
-	struct interface *ifp = astate->iface;
-	uint8_t buf[ARP_LEN];
+	struct interface *ifp = arg;
+	struct iarp_state *state = ARP_STATE(ifp);
+	struct bpf *bpf = state->bpf;
+	void *frame;
 	ssize_t bytes;
-	struct in_addr addr = astate->addr;
 
 	/* Some RAW mechanisms are generic file descriptors, not sockets.
 	 * This means we have no kernel call to just get one packet,
 	 * so we have to process the entire buffer. */
 	bpf->bpf_flags &= ~BPF_EOF;
 	while (!(bpf->bpf_flags & BPF_EOF)) {
-		bytes = bpf_read(bpf, buf, sizeof(buf));
+		bytes = bpf_read(bpf, &frame);
 		if (bytes == -1) {
 			logerr("%s: %s", __func__, ifp->name);
-			arp_free(astate);
+			arp_drop(ifp);
 			return;
 		}
-		arp_packet(ifp, buf, (size_t)bytes, bpf->bpf_flags);
-		/* Check we still have a state after processing. */
-		if ((astate = arp_find(ifp, &addr)) == NULL)
+		if (bytes == 0)
 			break;
-		if ((bpf = astate->bpf) == NULL)
+		arp_packet(ifp, frame, (size_t)bytes, bpf->bpf_flags);
+		/* Check we still have the socket after processing. */
+		if ((state = ARP_STATE(ifp)) == NULL || state->bpf != bpf)
 			break;
 	}
 }
 
+/*
+ * Open a socket to filter ARP for every address in the interface's
+ * ARP states and swap it for the old one.
+ * This is only done when an address is added or removed.
+ * The filter is locked once attached, so it cannot be replaced.
+ */
+static int
+arp_open(struct interface *ifp)
+{
+	struct iarp_state *state = ARP_STATE(ifp);
+	struct eloop *eloop = ifp->ctx->eloop;
+	struct bpf *bpf, *obpf;
+	void *frame;
+	ssize_t bytes;
+
+	if ((bpf = bpf_open(ifp, bpf_arp, NULL)) == NULL)
+		return -1;
+	obpf = state->bpf;
+	state->bpf = bpf;
+	if (obpf != NULL)
+		eloop_event_delete(eloop, obpf->bpf_fd);
+	eloop_event_add(eloop, bpf->bpf_fd, arp_read, ifp);
+	if (obpf == NULL)
+		return 0;
+
+	/* The new socket won't see what the old one has yet to give us.
+	 * Processing it can free states and so reopen the socket again,
+	 * or free the interface's ARP state, so don't touch state. */
+	obpf->bpf_flags &= ~BPF_EOF;
+	while (!(obpf->bpf_flags & BPF_EOF)) {
+		bytes = bpf_read(obpf, &frame);
+		if (bytes == -1 || bytes == 0)
+			break;
+		arp_packet(ifp, frame, (size_t)bytes, obpf->bpf_flags);
+	}
+	bpf_close(obpf);
+	return 0;
+}
+
 static void
 arp_probed(void *arg)
 {
@@ -375,18 +463,13 @@ arp_probe(struct arp_state *astate)
 struct arp_state *
 arp_find(struct interface *ifp, const struct in_addr *addr)
 {
-	struct iarp_state *state;
+	struct arp_key key = { .addr = addr, .ifp = ifp };
 	struct arp_state *astate;
 
-	if ((state = ARP_STATE(ifp)) == NULL)
-		goto out;
-	TAILQ_FOREACH(astate, &state->arp_states, next) {
-		if (astate->addr.s_addr == addr->s_addr && astate->iface == ifp)
-			return astate;
-	}
-out:
-	errno = ESRCH;
-	return NULL;
+	astate = rb_tree_find_node(&ifp->ctx->arp_states, &key);
+	if (astate == NULL)
+		errno = ESRCH;
+	return astate;
 }
 
 static void
@@ -446,33 +529,31 @@ skip_request:
 static void
 arp_announce(struct arp_state *astate)
 {
-	struct iarp_state *state;
-	struct interface *ifp;
-	struct arp_state *a2;
+	struct dhcpcd_ctx *ctx = astate->iface->ctx;
+	struct arp_key key = { .addr = &astate->addr, .ifp = NULL };
+	struct arp_state *a2, *a2n;
 	int r;
 
-	/* Cancel any other ARP announcements for this address. */
-	TAILQ_FOREACH(ifp, astate->iface->ctx->ifaces, next) {
-		state = ARP_STATE(ifp);
-		if (state == NULL)
+	/* Cancel any other ARP announcements for this address.
+	 * A NULL interface sorts first, so this finds the first state
+	 * for the address on any interface. */
+	for (a2 = rb_tree_find_node_geq(&ctx->arp_states, &key);
+	    a2 != NULL && a2->addr.s_addr == astate->addr.s_addr;
+	    a2 = a2n)
+	{
+		/* Announcing may free the state. */
+		a2n = RB_TREE_NEXT(&ctx->arp_states, a2);
+		if (a2 == astate)
 			continue;
-		TAILQ_FOREACH(a2, &state->arp_states, next) {
-			if (astate == a2 ||
-			    a2->addr.s_addr != astate->addr.s_addr)
-				continue;
-			r = eloop_timeout_delete(a2->iface->ctx->eloop,
-			    a2->claims < ANNOUNCE_NUM
-			    ? arp_announce1 : arp_announced,
-			    a2);
-			if (r == -1)
-				logerr(__func__);
-			else if (r != 0) {
-				logdebugx("%s: ARP announcement "
-				    "of %s cancelled",
-				    a2->iface->name,
-				    inet_ntoa(a2->addr));
-				arp_announced(a2);
-			}
+		r = eloop_timeout_delete(ctx->eloop,
+		    a2->claims < ANNOUNCE_NUM ? arp_announce1 : arp_announced,
+		    a2);
+		if (r == -1)
+			logerr(__func__);
+		else if (r != 0) {
+			logdebugx("%s: ARP announcement of %s cancelled",
+			    a2->iface->name, inet_ntoa(a2->addr));
+			arp_announced(a2);
 		}
 	}
 
@@ -532,19 +613,21 @@ arp_new(struct interface *ifp, const struct in_addr *addr)
 	struct arp_state *astate;
 
 	if ((state = ARP_STATE(ifp)) == NULL) {
-	        ifp->if_data[IF_DATA_ARP] = malloc(sizeof(*state));
+	        ifp->if_data[IF_DATA_ARP] =
+	            arena_get(&ifp->arena, sizeof(*state));
 		state = ARP_STATE(ifp);
 		if (state == NULL) {
 			logerr(__func__);
 			return NULL;
 		}
 		TAILQ_INIT(&state->arp_states);
+		state->bpf = NULL;
 	} else {
 		if ((astate = arp_find(ifp, addr)) != NULL)
 			return astate;
 	}
 
-	if ((astate = calloc(1, sizeof(*astate))) == NULL) {
+	if ((astate = arena_get(&ifp->arena, sizeof(*astate))) == NULL) {
 		logerr(__func__);
 		return NULL;
 	}
@@ -555,25 +638,24 @@ arp_new(struct interface *ifp, const struct in_addr *addr)
 	if (IN_PRIVSEP(ifp->ctx)) {
 		if (ps_bpf_openarp(ifp, addr) == -1) {
 			logerr(__func__);
-			free(astate);
+			arena_put(&ifp->arena, astate);
 			return NULL;
 		}
-	} else
-#endif
-	{
-		astate->bpf = bpf_open(ifp, bpf_arp, addr);
-		if (astate->bpf == NULL) {
-			logerr(__func__);
-			free(astate);
-			return NULL;
-		}
-		eloop_event_add(ifp->ctx->eloop, astate->bpf->bpf_fd,
-		    arp_read, astate);
 	}
-
+#endif
 
 	state = ARP_STATE(ifp);
 	TAILQ_INSERT_TAIL(&state->arp_states, astate, next);
+	rb_tree_insert_node(&ifp->ctx->arp_states, astate);
+
+	/* The socket filters for the new address as well. */
+	if (!IN_PRIVSEP(ifp->ctx) && arp_open(ifp) == -1) {
+		logerr(__func__);
+		TAILQ_REMOVE(&state->arp_states, astate, next);
+		rb_tree_remove_node(&ifp->ctx->arp_states, astate);
+		arena_put(&ifp->arena, astate);
+		return NULL;
+	}
 	return astate;
 }
 
@@ -593,6 +675,7 @@ arp_free(struct arp_state *astate)
 
 	state =	ARP_STATE(ifp);
 	TAILQ_REMOVE(&state->arp_states, astate, next);
+	rb_tree_remove_node(&ctx->arp_states, astate);
 	if (astate->free_cb)
 		astate->free_cb(astate);
 
@@ -600,17 +683,20 @@ arp_free(struct arp_state *astate)
 	if (IN_PRIVSEP(ctx) && ps_bpf_closearp(ifp, &astate->addr) == -1)
 		logerr(__func__);
 #endif
-	if (astate->bpf != NULL) {
-		eloop_event_delete(ctx->eloop, astate->bpf->bpf_fd);
-		bpf_close(astate->bpf);
-	}
 
-	free(astate);
+	arena_put(&ifp->arena, astate);
 
 	if (TAILQ_FIRST(&state->arp_states) == NULL) {
-		free(state);
+		if (state->bpf != NULL) {
+			eloop_event_delete(ctx->eloop, state->bpf->bpf_fd);
+			bpf_close(state->bpf);
+		}
+		arena_put(&ifp->arena, state);
 		ifp->if_data[IF_DATA_ARP] = NULL;
-	}
+	} else if (state->bpf != NULL && arp_open(ifp) == -1)
+		/* The old socket still works, it just lets through
+		 * ARP for the address as well. */
+		logerr(__func__);
 }
 
 void
@@ -67,9 +67,9 @@ struct arp_msg {
 
 struct arp_state {
 	TAILQ_ENTRY(arp_state) next;
+	rb_node_t tree;		/* node in ctx->arp_states */
 	struct interface *iface;
 	struct in_addr addr;
-	struct bpf *bpf;
 
 	int probes;
 	int claims;
@@ -85,6 +85,7 @@ TAILQ_HEAD(arp_statehead, arp_state);
 
 struct iarp_state {
 	struct arp_statehead arp_states;
+	struct bpf *bpf;	/* filters for every address in arp_states */
 };
 
 #define ARP_STATE(ifp)							       \
@@ -93,6 +94,7 @@ struct iarp_state {
 	((const struct iarp_state *)(ifp)->if_data[IF_DATA_ARP])
 
 #ifdef ARP
+extern const rb_tree_ops_t arp_state_ops;
 void arp_packet(struct interface *, uint8_t *, size_t, unsigned int);
 struct arp_state *arp_new(struct interface *, const struct in_addr *);
 void arp_probe(struct arp_state *);
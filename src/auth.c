@@ -46,8 +46,8 @@
 #include "dhcpcd.h"
 #include "privsep-root.h"
 
-#ifdef HAVE_HMAC_H
-#include <hmac.h>
+#if defined(HAVE_MD5_H) && !defined(DEPGEN)
+#include <md5.h>
 #endif
 
 #ifdef __sun
@@ -74,24 +74,99 @@
 #endif  /* ntohll */
 
 #define HMAC_LENGTH	16
+#define HMAC_IPAD	0x36
+#define HMAC_OPAD	0x5C
+
+#ifndef MD5_BLOCK_LENGTH
+#define	MD5_BLOCK_LENGTH	64
+#endif
+
+/*
+ * HMAC-MD5 (RFC 2104) state with the padded key already hashed in.
+ * A token's key does not change, so this is worked out the first time
+ * the token is used and each message then only costs its own hashing.
+ */
+struct auth_hmac {
+	MD5_CTX ictx;
+	MD5_CTX octx;
+};
+
+static struct auth_hmac *
+auth_hmac_new(const struct token *t)
+{
+	struct auth_hmac *ah;
+	uint8_t ipad[MD5_BLOCK_LENGTH], opad[MD5_BLOCK_LENGTH];
+	uint8_t digest[MD5_DIGEST_LENGTH];
+	const uint8_t *k = t->key;
+	size_t klen = t->key_len, i;
+	MD5_CTX ctx;
+
+	if ((ah = malloc(sizeof(*ah))) == NULL)
+		return NULL;
+
+	/* Keys longer than a block are hashed down first */
+	if (klen > sizeof(ipad)) {
+		MD5Init(&ctx);
+		MD5Update(&ctx, k, (unsigned int)klen);
+		MD5Final(digest, &ctx);
+		k = digest;
+		klen = sizeof(digest);
+	}
+
+	for (i = 0; i < sizeof(ipad); i++) {
+		ipad[i] = (uint8_t)((i < klen ? k[i] : 0) ^ HMAC_IPAD);
+		opad[i] = (uint8_t)((i < klen ? k[i] : 0) ^ HMAC_OPAD);
+	}
+	MD5Init(&ah->ictx);
+	MD5Update(&ah->ictx, ipad, (unsigned int)sizeof(ipad));
+	MD5Init(&ah->octx);
+	MD5Update(&ah->octx, opad, (unsigned int)sizeof(opad));
+	return ah;
+}
+
+static int
+auth_hmac_md5(const struct token *t, const void *text, size_t tlen,
+    uint8_t digest[HMAC_LENGTH])
+{
+	MD5_CTX ctx;
+
+	if (t->hmac == NULL) {
+		struct token *tt = UNCONST(t);
+
+		if ((tt->hmac = auth_hmac_new(t)) == NULL)
+			return -1;
+	}
+
+	ctx = t->hmac->ictx;
+	MD5Update(&ctx, text, (unsigned int)tlen);
+	MD5Final(digest, &ctx);
+	ctx = t->hmac->octx;
+	MD5Update(&ctx, digest, HMAC_LENGTH);
+	MD5Final(digest, &ctx);
+	return 0;
+}
+
+void
+dhcp_auth_token_free(struct token *t)
+{
+
+	if (t == NULL)
+		return;
+	free(t->hmac);
+	free(t->key);
+	free(t->realm);
+	free(t);
+}
 
 void
 dhcp_auth_reset(struct authstate *state)
 {
 
 	state->replay = 0;
-	if (state->token) {
-		free(state->token->key);
-		free(state->token->realm);
-		free(state->token);
-		state->token = NULL;
-	}
-	if (state->reconf) {
-		free(state->reconf->key);
-		free(state->reconf->realm);
-		free(state->reconf);
-		state->reconf = NULL;
-	}
+	dhcp_auth_token_free(state->token);
+	state->token = NULL;
+	dhcp_auth_token_free(state->reconf);
+	state->reconf = NULL;
 }
 
 /*
@@ -256,8 +331,12 @@ dhcp_auth_validate(struct authstate *state, const struct auth *auth,
 					state->reconf->realm = NULL;
 					state->reconf->realm_len = 0;
 					state->reconf->key_len = 16;
+					state->reconf->hmac = NULL;
 				}
 				memcpy(state->reconf->key, d, 16);
+				/* A new key needs new HMAC state */
+				free(state->reconf->hmac);
+				state->reconf->hmac = NULL;
 			} else {
 				errno = EINVAL;
 				return NULL;
@@ -265,10 +344,8 @@ dhcp_auth_validate(struct authstate *state, const struct auth *auth,
 			if (state->reconf == NULL)
 				errno = ENOENT;
 			/* Free the old token so we log acceptance */
-			if (state->token) {
-				free(state->token);
-				state->token = NULL;
-			}
+			dhcp_auth_token_free(state->token);
+			state->token = NULL;
 			/* Nothing to validate, just accepting the key */
 			return state->reconf;
 		case 2:
@@ -353,8 +430,10 @@ gottoken:
 	memset(hmac_code, 0, sizeof(hmac_code));
 	switch (algorithm) {
 	case AUTH_ALG_HMAC_MD5:
-		hmac("md5", t->key, t->key_len, mm, mlen,
-		     hmac_code, sizeof(hmac_code));
+		if (auth_hmac_md5(t, mm, mlen, hmac_code) == -1) {
+			free(mm);
+			return NULL;
+		}
 		break;
 	default:
 		errno = ENOSYS;
@@ -377,6 +456,7 @@ finish:
 		state->token = malloc(sizeof(*state->token));
 		if (state->token) {
 			state->token->secretid = t->secretid;
+			state->token->hmac = NULL;
 			state->token->key = malloc(t->key_len);
 			if (state->token->key) {
 				state->token->key_len = t->key_len;
@@ -528,7 +608,7 @@ dhcp_auth_encode(struct dhcpcd_ctx *ctx, struct auth *auth,
 	time_t now;
 	uint8_t hops, *p, *m, *data;
 	uint32_t giaddr, secretid;
-	bool auth_info;
+	bool auth_info, hashed = true;
 
 	/* Ignore the token argument given to us - always send using the
 	 * configured token. */
@@ -719,8 +799,10 @@ dhcp_auth_encode(struct dhcpcd_ctx *ctx, struct auth *auth,
 	/* Create our hash and write it out */
 	switch(auth->algorithm) {
 	case AUTH_ALG_HMAC_MD5:
-		hmac("md5", t->key, t->key_len, m, mlen,
-		     hmac_code, sizeof(hmac_code));
+		if (auth_hmac_md5(t, m, mlen, hmac_code) == -1) {
+			hashed = false;
+			break;
+		}
 		memcpy(data, hmac_code, sizeof(hmac_code));
 		break;
 	}
@@ -733,6 +815,9 @@ dhcp_auth_encode(struct dhcpcd_ctx *ctx, struct auth *auth,
 		memcpy(p, &giaddr, sizeof(giaddr));
 	}
 
+	if (!hashed)
+		return -1;
+
 	/* Done! */
 	return (int)(dlen - sizeof(hmac_code)); /* should be zero */
 }
@@ -51,6 +51,7 @@
 
 #define AUTH_RDM_MONOTONIC	0
 
+struct auth_hmac;
 struct token {
 	TAILQ_ENTRY(token) next;
 	uint32_t secretid;
@@ -59,6 +60,7 @@ struct token {
 	size_t key_len;
 	unsigned char *key;
 	time_t expire;
+	struct auth_hmac *hmac;		/* keyed HMAC state, made on use */
 };
 
 TAILQ_HEAD(token_head, token);
@@ -83,6 +85,7 @@ struct authstate {
 	struct token *reconf;
 };
 
+void dhcp_auth_token_free(struct token *);
 void dhcp_auth_reset(struct authstate *);
 
 const struct token * dhcp_auth_validate(struct authstate *,
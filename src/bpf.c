@@ -27,6 +27,7 @@
  */
 
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 
 #include <arpa/inet.h>
@@ -54,30 +55,11 @@
 #include "arp.h"
 #include "bpf.h"
 #include "dhcp.h"
+#include "eloop.h"
 #include "if.h"
+#include "if-options.h"
 #include "logerr.h"
-
-/* BPF helper macros */
-#ifdef __linux__
-#define	BPF_WHOLEPACKET		0x7fffffff /* work around buggy LPF filters */
-#else
-#define	BPF_WHOLEPACKET		~0U
-#endif
-
-/* Macros to update the BPF structure */
-#define	BPF_SET_STMT(insn, c, v) {				\
-	(insn)->code = (c);					\
-	(insn)->jt = 0;						\
-	(insn)->jf = 0;						\
-	(insn)->k = (uint32_t)(v);				\
-}
-
-#define	BPF_SET_JUMP(insn, c, v, t, f) {			\
-	(insn)->code = (c);					\
-	(insn)->jt = (t);					\
-	(insn)->jf = (f);					\
-	(insn)->k = (uint32_t)(v);				\
-}
+#include "privsep.h"
 
 size_t
 bpf_frame_header_len(const struct interface *ifp)
@@ -236,13 +218,14 @@ eexit:
 /* BPF requires that we read the entire buffer.
  * So we pass the buffer in the API so we can loop on >1 packet. */
 ssize_t
-bpf_read(struct bpf *bpf, void *data, size_t len)
+bpf_read(struct bpf *bpf, void **frame)
 {
 	ssize_t bytes;
 	struct bpf_hdr packet;
-	const char *payload;
+	char *payload;
 
 	bpf->bpf_flags &= ~BPF_EOF;
+	*frame = bpf->bpf_buffer;
 	for (;;) {
 		if (bpf->bpf_len == 0) {
 			bytes = read(bpf->bpf_fd, bpf->bpf_buffer,
@@ -261,21 +244,21 @@ bpf_read(struct bpf *bpf, void *data, size_t len)
 			bpf->bpf_pos = 0;
 		}
 		bytes = -1;
-		payload = (const char *)bpf->bpf_buffer + bpf->bpf_pos;
+		payload = (char *)bpf->bpf_buffer + bpf->bpf_pos;
 		memcpy(&packet, payload, sizeof(packet));
 		if (bpf->bpf_pos + packet.bh_caplen + packet.bh_hdrlen >
 		    bpf->bpf_len)
 			goto next; /* Packet beyond buffer, drop. */
 		payload += packet.bh_hdrlen;
-		if (packet.bh_caplen > len)
-			bytes = (ssize_t)len;
-		else
-			bytes = (ssize_t)packet.bh_caplen;
+		bytes = (ssize_t)packet.bh_caplen;
+		bpf->bpf_time.tv_sec = (time_t)packet.bh_tstamp.tv_sec;
+		bpf->bpf_time.tv_nsec =
+		    (long)packet.bh_tstamp.tv_usec * NSEC_PER_USEC;
 		if (bpf_frame_bcast(bpf->bpf_ifp, payload) == 0)
 			bpf->bpf_flags |= BPF_BCAST;
 		else
 			bpf->bpf_flags &= ~BPF_BCAST;
-		memcpy(data, payload, (size_t)bytes);
+		*frame = payload;
 next:
 		bpf->bpf_pos += BPF_WORDALIGN(packet.bh_hdrlen +
 		    packet.bh_caplen);
@@ -309,6 +292,19 @@ bpf_wattach(int fd, void *filter, unsigned int filter_len)
 	return ioctl(fd, BIOCSETWF, &pf);
 }
 #endif
+
+/* Stop the filters from being changed. */
+int
+bpf_lock(int fd)
+{
+
+#ifdef BIOCSETWF
+	return ioctl(fd, BIOCLOCK);
+#else
+	UNUSED(fd);
+	return 0;
+#endif
+}
 #endif
 
 #ifndef __sun
@@ -336,19 +332,78 @@ bpf_send(const struct bpf *bpf, uint16_t protocol,
 	}
 	iov[1].iov_base = UNCONST(data);
 	iov[1].iov_len = len;
+#ifdef __linux__
+	if (bpf->bpf_master != NULL)
+		return bpf_send_view(bpf, protocol, iov, 2);
+#endif
 	return writev(bpf->bpf_fd, iov, 2);
 }
 #endif
 
+/* If a frame from the buffer is still being processed, only close
+ * the descriptor and leave the reader to free the rest. */
 void
 bpf_close(struct bpf *bpf)
 {
 
-	close(bpf->bpf_fd);
+#ifdef __linux__
+	if (bpf->bpf_master != NULL)
+		bpf_close_view(bpf, bpf->bpf_ifp->ctx);
+	if (bpf->bpf_ifmap != -1) {
+		close(bpf->bpf_ifmap);
+		bpf->bpf_ifmap = -1;
+	}
+	if (bpf->bpf_xidmap != -1) {
+		close(bpf->bpf_xidmap);
+		bpf->bpf_xidmap = -1;
+	}
+#endif
+	if (bpf->bpf_fd != -1) {
+		close(bpf->bpf_fd);
+		bpf->bpf_fd = -1;
+	}
+	if (bpf->bpf_flags & BPF_READING) {
+		bpf->bpf_flags |= BPF_CLOSED | BPF_EOF;
+		return;
+	}
+#ifdef __linux__
+	if (bpf->bpf_ring != NULL)
+		munmap(bpf->bpf_ring, bpf->bpf_ring_size);
+#endif
 	free(bpf->bpf_buffer);
 	free(bpf);
 }
 
+/* A view of a shared socket has no descriptor to wait on,
+ * the shared socket calls back instead. */
+int
+bpf_event_add(struct bpf *bpf, struct eloop *eloop,
+    void (*cb)(void *), void *cb_arg)
+{
+
+#ifdef __linux__
+	if (bpf->bpf_master != NULL) {
+		bpf->bpf_cb = cb;
+		bpf->bpf_cb_arg = cb_arg;
+		return 0;
+	}
+#endif
+	return eloop_event_add(eloop, bpf->bpf_fd, cb, cb_arg);
+}
+
+void
+bpf_event_delete(struct bpf *bpf, struct eloop *eloop)
+{
+
+#ifdef __linux__
+	if (bpf->bpf_master != NULL) {
+		bpf->bpf_cb = NULL;
+		return;
+	}
+#endif
+	eloop_event_delete(eloop, bpf->bpf_fd);
+}
+
 #ifdef ARP
 #define BPF_CMP_HWADDR_LEN	((((HWADDR_LEN / 4) + 2) * 2) + 1)
 static unsigned int
@@ -478,20 +533,80 @@ static const struct bpf_insn bpf_arp_filter [] = {
 };
 #define BPF_ARP_FILTER_LEN	__arraycount(bpf_arp_filter)
 
-/* One address is two checks of two statements. */
-#define BPF_NADDRS		1
-#define BPF_ARP_ADDRS_LEN	5 + ((BPF_NADDRS * 2) * 2)
+/*
+ * The addresses are checked by a binary search over them sorted,
+ * so the kernel does a handful of compares however many there are.
+ * Up to BPF_ARP_LEAF addresses are compared one by one, each being
+ * a compare and a return.
+ * Otherwise the addresses are split at the middle one, costing a compare
+ * to choose the half and a jump over each half.
+ */
+#define	BPF_ARP_LEAF		4
+
+static unsigned int
+bpf_arp_search_len(size_t naddrs)
+{
+	size_t mid;
 
-#define BPF_ARP_LEN		BPF_ARP_ETHER_LEN + BPF_ARP_FILTER_LEN + \
-				BPF_CMP_HWADDR_LEN + BPF_ARP_ADDRS_LEN
+	if (naddrs <= BPF_ARP_LEAF)
+		return (unsigned int)naddrs * 2;
+	mid = naddrs / 2;
+	return 3 + bpf_arp_search_len(mid) + bpf_arp_search_len(naddrs - mid);
+}
+
+/* The address to check is in A, a match returns arp_len and
+ * anything else carries on after the search. */
+static struct bpf_insn *
+bpf_arp_search(struct bpf_insn *bp, const uint32_t *addrs, size_t naddrs,
+    uint16_t arp_len)
+{
+	size_t i, mid;
+
+	if (naddrs <= BPF_ARP_LEAF) {
+		for (i = 0; i < naddrs; i++) {
+			BPF_SET_JUMP(bp, BPF_JMP + BPF_JEQ + BPF_K,
+			    addrs[i], 0, 1);
+			bp++;
+			BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
+			bp++;
+		}
+		return bp;
+	}
+
+	mid = naddrs / 2;
+	BPF_SET_JUMP(bp, BPF_JMP + BPF_JGE + BPF_K, addrs[mid], 0, 1);
+	bp++;
+	BPF_SET_STMT(bp, BPF_JMP + BPF_JA,
+	    bpf_arp_search_len(mid) + 1);
+	bp++;
+	bp = bpf_arp_search(bp, addrs, mid, arp_len);
+	BPF_SET_STMT(bp, BPF_JMP + BPF_JA,
+	    bpf_arp_search_len(naddrs - mid));
+	bp++;
+	return bpf_arp_search(bp, addrs + mid, naddrs - mid, arp_len);
+}
+
+/* The frame checks and two searches, plus the last return. */
+#define	BPF_ARP_LEN(naddrs)	(BPF_ARP_ETHER_LEN + BPF_ARP_FILTER_LEN + \
+				BPF_CMP_HWADDR_LEN + \
+				(bpf_arp_search_len((naddrs)) * 2) + 6)
+
+#ifndef BPF_MAXINSNS
+#define	BPF_MAXINSNS		512
+#endif
 
 static int
-bpf_arp_rw(const struct bpf *bpf, const struct in_addr *ia, bool recv)
+bpf_arp_rw(const struct bpf *bpf, const uint32_t *addrs, size_t naddrs,
+    bool recv)
 {
 	const struct interface *ifp = bpf->bpf_ifp;
-	struct bpf_insn buf[BPF_ARP_LEN + 1];
-	struct bpf_insn *bp;
+	struct bpf_insn *buf, *bp;
 	uint16_t arp_len;
+	int r;
+
+	buf = malloc(sizeof(*buf) * BPF_ARP_LEN(naddrs));
+	if (buf == NULL)
+		return -1;
 
 	bp = buf;
 	/* Check frame header. */
@@ -502,6 +617,7 @@ bpf_arp_rw(const struct bpf *bpf, const struct in_addr *ia, bool recv)
 		arp_len = sizeof(struct ether_header)+sizeof(struct ether_arp);
 		break;
 	default:
+		free(buf);
 		errno = EINVAL;
 		return -1;
 	}
@@ -514,14 +630,19 @@ bpf_arp_rw(const struct bpf *bpf, const struct in_addr *ia, bool recv)
 	bp += bpf_cmp_hwaddr(bp, BPF_CMP_HWADDR_LEN, sizeof(struct arphdr),
 	                     !recv, ifp->hwaddr, ifp->hwlen);
 
+	/* Too many addresses for the kernel, so let them all through
+	 * and arp_packet will sort them out. */
+	if (naddrs == 0) {
+		BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
+		bp++;
+		goto attach;
+	}
+
 	/* Match sender protocol address */
 	BPF_SET_STMT(bp, BPF_LD + BPF_W + BPF_IND,
 	    sizeof(struct arphdr) + ifp->hwlen);
 	bp++;
-	BPF_SET_JUMP(bp, BPF_JMP + BPF_JEQ + BPF_K, htonl(ia->s_addr), 0, 1);
-	bp++;
-	BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
-	bp++;
+	bp = bpf_arp_search(bp, addrs, naddrs, arp_len);
 
 	/* If we didn't match sender, then we're only interested in
 	 * ARP probes to us, so check the null host sender. */
@@ -534,36 +655,87 @@ bpf_arp_rw(const struct bpf *bpf, const struct in_addr *ia, bool recv)
 	BPF_SET_STMT(bp, BPF_LD + BPF_W + BPF_IND, (sizeof(struct arphdr) +
 	    (size_t)(ifp->hwlen * 2) + sizeof(in_addr_t)));
 	bp++;
-	BPF_SET_JUMP(bp, BPF_JMP + BPF_JEQ + BPF_K, htonl(ia->s_addr), 0, 1);
-	bp++;
-	BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
-	bp++;
+	bp = bpf_arp_search(bp, addrs, naddrs, arp_len);
 
 	/* No match, drop it */
 	BPF_SET_STMT(bp, BPF_RET + BPF_K, 0);
 	bp++;
 
+attach:
 #ifdef BIOCSETWF
 	if (!recv)
-		return bpf_wattach(bpf->bpf_fd, buf, (unsigned int)(bp - buf));
+		r = bpf_wattach(bpf->bpf_fd, buf, (unsigned int)(bp - buf));
+	else
 #endif
+	r = bpf_attach(bpf->bpf_fd, buf, (unsigned int)(bp - buf));
+	free(buf);
+	return r;
+}
 
-	return bpf_attach(bpf->bpf_fd, buf, (unsigned int)(bp - buf));
+static int
+bpf_arp_addrcmp(const void *a, const void *b)
+{
+	uint32_t a1 = *(const uint32_t *)a, a2 = *(const uint32_t *)b;
+
+	if (a1 == a2)
+		return 0;
+	return a1 < a2 ? -1 : 1;
 }
 
+/*
+ * Filter ARP for ia, or if NULL for every address the interface
+ * has an ARP state for.
+ * The addresses are compared in host order as BPF loads them so.
+ */
 int
 bpf_arp(const struct bpf *bpf, const struct in_addr *ia)
 {
+	const struct iarp_state *state;
+	const struct arp_state *astate;
+	uint32_t addr, *addrs;
+	size_t naddrs;
+	int r;
+
+	if (ia != NULL) {
+		addr = ntohl(ia->s_addr);
+		addrs = &addr;
+		naddrs = 1;
+	} else {
+		naddrs = 0;
+		state = ARP_CSTATE(bpf->bpf_ifp);
+		if (state != NULL) {
+			TAILQ_FOREACH(astate, &state->arp_states, next)
+				naddrs++;
+		}
+		if (naddrs == 0) {
+			errno = ENOENT;
+			return -1;
+		}
+		addrs = malloc(sizeof(*addrs) * naddrs);
+		if (addrs == NULL)
+			return -1;
+		naddrs = 0;
+		TAILQ_FOREACH(astate, &state->arp_states, next)
+			addrs[naddrs++] = ntohl(astate->addr.s_addr);
+		qsort(addrs, naddrs, sizeof(*addrs), bpf_arp_addrcmp);
+	}
+
+	if (BPF_ARP_LEN(naddrs) > BPF_MAXINSNS) {
+		logdebugx("%s: ARP filter cannot hold %zu addresses",
+		    bpf->bpf_ifp->name, naddrs);
+		naddrs = 0;
+	}
 
+	r = bpf_arp_rw(bpf, addrs, naddrs, true);
 #ifdef BIOCSETWF
-	if (bpf_arp_rw(bpf, ia, true) == -1 ||
-	    bpf_arp_rw(bpf, ia, false) == -1 ||
-	    ioctl(bpf->bpf_fd, BIOCLOCK) == -1)
-		return -1;
-	return 0;
-#else
-	return bpf_arp_rw(bpf, ia, true);
+	if (r != -1)
+		r = bpf_arp_rw(bpf, addrs, naddrs, false);
 #endif
+	if (addrs != &addr)
+		free(addrs);
+	if (r == -1)
+		return -1;
+	return bpf_lock(bpf->bpf_fd);
 }
 #endif
 
@@ -636,6 +808,24 @@ static const struct bpf_insn bpf_bootp_write[] = {
 				BPF_BOOTP_BASE_LEN + BPF_BOOTP_READ_LEN + \
 				BPF_BOOTP_XID_LEN + BPF_BOOTP_CHADDR_LEN + 4
 
+/*
+ * With xidfilter, replies for other clients are dropped in the kernel.
+ * The filter is then installed again each time the xid changes, so it
+ * cannot be locked.
+ * BPF helpers for privilege separation don't know the xid.
+ * A view of a shared socket has its xids matched by the eBPF maps
+ * of the socket instead, if it has them.
+ */
+static bool
+bpf_bootp_xid(const struct bpf *bpf)
+{
+	const struct interface *ifp = bpf->bpf_ifp;
+
+	if (ifp == NULL || IN_PRIVSEP(ifp->ctx))
+		return false;
+	return ifp->options->xidfilter && D_CSTATE(ifp) != NULL;
+}
+
 static int
 bpf_bootp_rw(const struct bpf *bpf, bool read)
 {
@@ -643,8 +833,9 @@ bpf_bootp_rw(const struct bpf *bpf, bool read)
 	struct bpf_insn *bp;
 
 	bp = buf;
-	/* Check frame header. */
-	switch(bpf->bpf_ifp->hwtype) {
+	/* Check frame header.
+	 * A shared socket has no interface and only serves Ethernet. */
+	switch(bpf->bpf_ifp != NULL ? bpf->bpf_ifp->hwtype : ARPHRD_ETHER) {
 #ifdef ARPHRD_NONE
 	case ARPHRD_NONE:
 		memcpy(bp, bpf_bootp_none, sizeof(bpf_bootp_none));
@@ -682,6 +873,24 @@ bpf_bootp_rw(const struct bpf *bpf, bool read)
 	memcpy(bp, bpf_bootp_read, sizeof(bpf_bootp_read));
 	bp += BPF_BOOTP_READ_LEN;
 
+	if (bpf_bootp_xid(bpf)) {
+		const struct dhcp_state *state = D_CSTATE(bpf->bpf_ifp);
+
+		/* Make sure it's for our current transaction. */
+		BPF_SET_STMT(bp, BPF_LD + BPF_W + BPF_IND,
+		    sizeof(struct udphdr) + offsetof(struct bootp, xid));
+		bp++;
+		if (state->race_xid != 0) {
+			BPF_SET_JUMP(bp, BPF_JMP + BPF_JEQ + BPF_K,
+			    state->race_xid, 2, 0);
+			bp++;
+		}
+		BPF_SET_JUMP(bp, BPF_JMP + BPF_JEQ + BPF_K, state->xid, 1, 0);
+		bp++;
+		BPF_SET_STMT(bp, BPF_RET + BPF_K, 0);
+		bp++;
+	}
+
 	/* All passed, return the packet. */
 	BPF_SET_STMT(bp, BPF_RET + BPF_K, BPF_WHOLEPACKET);
 	bp++;
@@ -693,12 +902,29 @@ int
 bpf_bootp(const struct bpf *bpf, __unused const struct in_addr *ia)
 {
 
+#ifdef __linux__
+	/* A view shares the filter of its socket, so only update
+	 * what it matches for us. */
+	if (bpf->bpf_master != NULL) {
+		const struct dhcp_state *state = D_CSTATE(bpf->bpf_ifp);
+		uint32_t xids[2];
+		size_t nxids = 0;
+		bool xidfilter = bpf_bootp_xid(bpf);
+
+		if (xidfilter) {
+			xids[nxids++] = state->xid;
+			if (state->race_xid != 0)
+				xids[nxids++] = state->race_xid;
+		}
+		return bpf_filter_view(UNCONST(bpf), xidfilter, xids, nxids);
+	}
+#endif
+
+	if (bpf_bootp_rw(bpf, true) == -1)
+		return -1;
 #ifdef BIOCSETWF
-	if (bpf_bootp_rw(bpf, true) == -1 ||
-	    bpf_bootp_rw(bpf, false) == -1 ||
-	    ioctl(bpf->bpf_fd, BIOCLOCK) == -1)
+	if (bpf_bootp_rw(bpf, false) == -1)
 		return -1;
-	return 0;
 #else
 #ifdef PRIVSEP
 #if defined(__sun) /* Solaris cannot send via BPF. */
@@ -708,6 +934,8 @@ bpf_bootp(const struct bpf *bpf, __unused const struct in_addr *ia)
 #warning A compromised PF_PACKET socket can be used as a raw socket
 #endif
 #endif
-	return bpf_bootp_rw(bpf, true);
 #endif
+	if (bpf_bootp_xid(bpf))
+		return 0;
+	return bpf_lock(bpf->bpf_fd);
 }
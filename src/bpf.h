@@ -32,6 +32,31 @@
 #define	BPF_EOF			0x01U
 #define	BPF_PARTIALCSUM		0x02U
 #define	BPF_BCAST		0x04U
+#define	BPF_READING		0x08U
+#define	BPF_CLOSED		0x10U
+#define	BPF_CSUMVALID		0x20U
+
+/* BPF helper macros */
+#ifdef __linux__
+#define	BPF_WHOLEPACKET		0x7fffffff /* work around buggy LPF filters */
+#else
+#define	BPF_WHOLEPACKET		~0U
+#endif
+
+/* Macros to update the BPF structure */
+#define	BPF_SET_STMT(insn, c, v) {				\
+	(insn)->code = (c);					\
+	(insn)->jt = 0;						\
+	(insn)->jf = 0;						\
+	(insn)->k = (uint32_t)(v);				\
+}
+
+#define	BPF_SET_JUMP(insn, c, v, t, f) {			\
+	(insn)->code = (c);					\
+	(insn)->jt = (t);					\
+	(insn)->jf = (f);					\
+	(insn)->k = (uint32_t)(v);				\
+}
 
 /*
  * Even though we program the BPF filter should we trust it?
@@ -54,6 +79,8 @@
 
 #include "dhcpcd.h"
 
+struct eloop;
+
 struct bpf {
 	const struct interface *bpf_ifp;
 	int bpf_fd;
@@ -62,6 +89,32 @@ struct bpf {
 	size_t bpf_size;
 	size_t bpf_len;
 	size_t bpf_pos;
+	struct timespec bpf_time;	/* kernel time the frame arrived */
+#ifdef __linux__
+	/* PACKET_MMAP receive ring, if the kernel has TPACKET_V3. */
+	void *bpf_ring;
+	size_t bpf_ring_size;
+	unsigned int bpf_ring_nblocks;
+	unsigned int bpf_ring_block;
+	uint32_t bpf_ring_npkts;
+	size_t bpf_ring_pos;
+
+	/* shared_bpf: views of one socket, looked up by ifindex. */
+	struct bpf *bpf_master;		/* socket a view reads from */
+	rb_tree_t bpf_views;		/* views of this socket */
+	rb_node_t bpf_tree;
+	unsigned int bpf_ifindex;
+	void (*bpf_cb)(void *);
+	void *bpf_cb_arg;
+	void *bpf_frame;		/* frame waiting for the view */
+	size_t bpf_frame_len;
+
+	/* shared_bpf with eBPF: maps of the socket, xids of a view. */
+	int bpf_ifmap;			/* ifindex -> BPF_VIEW_* */
+	int bpf_xidmap;			/* xid -> views using it */
+	uint32_t bpf_xids[2];
+	size_t bpf_nxids;
+#endif
 };
 
 extern const char *bpf_name;
@@ -73,9 +126,19 @@ struct bpf * bpf_open(const struct interface *,
     int (*)(const struct bpf *, const struct in_addr *),
     const struct in_addr *);
 void bpf_close(struct bpf *);
+int bpf_event_add(struct bpf *, struct eloop *, void (*)(void *), void *);
+void bpf_event_delete(struct bpf *, struct eloop *);
+#ifdef __linux__
+struct iovec;
+int bpf_open_shared(struct dhcpcd_ctx *);
+void bpf_close_view(struct bpf *, struct dhcpcd_ctx *);
+int bpf_filter_view(struct bpf *, bool, const uint32_t *, size_t);
+ssize_t bpf_send_view(const struct bpf *, uint16_t, struct iovec *, int);
+#endif
 int bpf_attach(int, void *, unsigned int);
+int bpf_lock(int);
 ssize_t bpf_send(const struct bpf *, uint16_t, const void *, size_t);
-ssize_t bpf_read(struct bpf *, void *, size_t);
+ssize_t bpf_read(struct bpf *, void **);
 int bpf_arp(const struct bpf *, const struct in_addr *);
 int bpf_bootp(const struct bpf *, const struct in_addr *);
 #endif
@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Internet checksum for dhcpcd
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "cksum.h"
+
+/*
+ * RFC 1071 one's complement sum.
+ * Because 2^16 is 1 modulo 2^16 - 1, summing native 32-bit words into a
+ * 64-bit accumulator and folding at the end gives the same result as
+ * summing 16-bit words, without any carry handling in the loop.
+ * Words are loaded with memcpy as packets are not always aligned and the
+ * compiler is free to vectorise the unrolled loop.
+ *
+ * If isum is not NULL it holds a running partial sum, so a checksum can
+ * be built over several buffers. Each buffer apart from the last must
+ * have an even length.
+ */
+uint16_t
+in_cksum(const void *data, size_t len, uint32_t *isum)
+{
+	const uint8_t *p = data;
+	uint64_t sum = isum != NULL ? *isum : 0;
+	uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	uint32_t w0, w1, w2, w3;
+	uint16_t h;
+
+	for (; len >= sizeof(w0) * 4; len -= sizeof(w0) * 4) {
+		memcpy(&w0, p, sizeof(w0));
+		memcpy(&w1, p + sizeof(w0), sizeof(w1));
+		memcpy(&w2, p + sizeof(w0) * 2, sizeof(w2));
+		memcpy(&w3, p + sizeof(w0) * 3, sizeof(w3));
+		s0 += w0;
+		s1 += w1;
+		s2 += w2;
+		s3 += w3;
+		p += sizeof(w0) * 4;
+	}
+	sum += s0 + s1 + s2 + s3;
+
+	for (; len >= sizeof(w0); len -= sizeof(w0)) {
+		memcpy(&w0, p, sizeof(w0));
+		sum += w0;
+		p += sizeof(w0);
+	}
+
+	if (len >= sizeof(h)) {
+		memcpy(&h, p, sizeof(h));
+		sum += h;
+		p += sizeof(h);
+		len -= sizeof(h);
+	}
+
+	/* A trailing byte is padded with a zero byte. */
+	if (len == 1) {
+		uint8_t b[2] = { *p, 0 };
+
+		memcpy(&h, b, sizeof(h));
+		sum += h;
+	}
+
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	if (isum != NULL)
+		*isum = (uint32_t)sum;
+
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	return (uint16_t)~sum;
+}
+
+/*
+ * RFC 1624 incremental update of a checksum when one 16-bit word
+ * changes from old to new, HC' = ~(~HC + ~m + m').
+ * The words must be given in the same byte order as they are in the packet.
+ */
+uint16_t
+in_cksum_update(uint16_t cksum, uint16_t old, uint16_t new)
+{
+	uint32_t sum;
+
+	sum = (uint16_t)~cksum;
+	sum += (uint16_t)~old;
+	sum += new;
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	return (uint16_t)~sum;
+}
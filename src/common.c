@@ -32,6 +32,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -137,6 +138,47 @@ writefile(const char *file, mode_t mode, const void *data, size_t len)
 	return bytes;
 }
 
+/* Writes a new file and renames it over the old one,
+ * so nothing ever reads a file half written.
+ * Unless mtime is 0 the file is given it as its modification time. */
+ssize_t
+writefile_atomic(const char *file, mode_t mode, const void *data, size_t len,
+    time_t mtime)
+{
+	struct timespec ts[2] = {
+	    { .tv_nsec = UTIME_OMIT },
+	    { .tv_sec = mtime },
+	};
+	char tmp[PATH_MAX];
+	int fd, serrno;
+	ssize_t bytes;
+
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.new", file) >= sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, mode);
+	if (fd == -1)
+		return -1;
+	bytes = write(fd, data, len);
+	if (bytes != -1 && (size_t)bytes != len) {
+		errno = ENOSPC;
+		bytes = -1;
+	}
+	if (bytes != -1 && mtime != 0 && futimens(fd, ts) == -1)
+		bytes = -1;
+	serrno = errno;
+	close(fd);
+	if (bytes == -1 || rename(tmp, file) == -1) {
+		if (bytes != -1)
+			serrno = errno;
+		unlink(tmp);
+		errno = serrno;
+		return -1;
+	}
+	return bytes;
+}
+
 int
 filemtime(const char *file, time_t *time)
 {
@@ -33,6 +33,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,12 +48,59 @@
 #include "if.h"
 #include "logerr.h"
 #include "privsep.h"
+#include "script.h"
+
+#define	CONTROL_PROTOLEN	16
 
 #ifndef SUN_LEN
 #define SUN_LEN(su) \
             (sizeof(*(su)) - sizeof((su)->sun_path) + strlen((su)->sun_path))
 #endif
 
+static void
+control_buf_unref(struct fd_data *fdp)
+{
+
+	if (fdp->data_buf == NULL)
+		return;
+	if (--fdp->data_buf->fb_refs == 0)
+		free(fdp->data_buf);
+	fdp->data_buf = NULL;
+}
+
+static inline void *
+control_data(const struct fd_data *fdp)
+{
+
+	return fdp->data_buf != NULL ? fdp->data_buf->fb_data : fdp->data;
+}
+
+static inline size_t
+control_datalen(const struct fd_data *fdp)
+{
+
+	if (fdp->data_flags & FD_SENDLEN)
+		return sizeof(fdp->data_len) + fdp->data_len;
+	return fdp->data_len;
+}
+
+static void
+control_queue_remove(struct fd_list *fd, struct fd_data *fdp)
+{
+
+	TAILQ_REMOVE(&fd->queue, fdp, next);
+	fd->queue_len--;
+	fd->queue_bytes -= control_datalen(fdp);
+	control_buf_unref(fdp);
+#ifdef CTL_FREE_LIST
+	TAILQ_INSERT_TAIL(&fd->free_queue, fdp, next);
+#else
+	if (fdp->data_size != 0)
+		free(fdp->data);
+	free(fdp);
+#endif
+}
+
 static void
 control_queue_free(struct fd_list *fd)
 {
@@ -60,10 +108,12 @@ control_queue_free(struct fd_list *fd)
 
 	while ((fdp = TAILQ_FIRST(&fd->queue))) {
 		TAILQ_REMOVE(&fd->queue, fdp, next);
+		control_buf_unref(fdp);
 		if (fdp->data_size != 0)
 			free(fdp->data);
 		free(fdp);
 	}
+	fd->queue_len = fd->queue_bytes = fd->queue_off = 0;
 
 #ifdef CTL_FREE_LIST
 	while ((fdp = TAILQ_FIRST(&fd->free_queue))) {
@@ -75,6 +125,485 @@ control_queue_free(struct fd_list *fd)
 #endif
 }
 
+/*
+ * A binary listener is sent for each event only what has changed since
+ * the last event from the same interface and protocol.
+ * Both events are sorted by name so they can be merged.
+ */
+struct control_hist {
+	TAILQ_ENTRY(control_hist) next;
+	char ch_ifname[IF_NAMESIZE];
+	char ch_protocol[CONTROL_PROTOLEN];
+	char *ch_buf;
+	char **ch_env;
+	size_t ch_nenv;
+	bool ch_clear;		/* events were dropped */
+};
+TAILQ_HEAD(control_hist_head, control_hist);
+
+struct control_sub {
+	char *cs_buf;		/* the filters */
+	char **cs_filters;
+	size_t cs_nfilters;
+	struct control_hist_head cs_hist;
+};
+
+static void
+control_sub_free(struct control_sub *cs)
+{
+	struct control_hist *ch;
+
+	if (cs == NULL)
+		return;
+	while ((ch = TAILQ_FIRST(&cs->cs_hist)) != NULL) {
+		TAILQ_REMOVE(&cs->cs_hist, ch, next);
+		free(ch->ch_buf);
+		free(ch->ch_env);
+		free(ch);
+	}
+	free(cs->cs_buf);
+	free(cs->cs_filters);
+	free(cs);
+}
+
+static struct control_hist *
+control_sub_hist(struct control_sub *cs, const char *ifname,
+    const char *protocol)
+{
+	struct control_hist *ch;
+
+	TAILQ_FOREACH(ch, &cs->cs_hist, next) {
+		if (strcmp(ch->ch_ifname, ifname) == 0 &&
+		    strcmp(ch->ch_protocol, protocol) == 0)
+			break;
+	}
+	return ch;
+}
+
+/* The interface and protocol of an event. */
+static bool
+control_envkey(const char *data, size_t len, char *ifname, char *protocol)
+{
+	const char *p, *ep = data + len;
+	unsigned int found = 0;
+
+	for (p = data; p < ep && found != 3; p += strlen(p) + 1) {
+		if (strncmp(p, "interface=", 10) == 0) {
+			strlcpy(ifname, p + 10, IF_NAMESIZE);
+			found |= 1;
+		} else if (strncmp(p, "protocol=", 9) == 0) {
+			strlcpy(protocol, p + 9, CONTROL_PROTOLEN);
+			found |= 2;
+		}
+	}
+	return found == 3;
+}
+
+static bool
+control_tlvkey(const char *data, size_t len, char *ifname, char *protocol)
+{
+	const uint16_t types[] = { CT_INTERFACE, CT_PROTOCOL };
+	char *dst[] = { ifname, protocol };
+	const size_t dstlen[] = { IF_NAMESIZE, CONTROL_PROTOLEN };
+	struct control_tlv ct;
+	size_t i;
+
+	for (i = 0; i < __arraycount(types); i++) {
+		if (len < sizeof(ct))
+			return false;
+		memcpy(&ct, data, sizeof(ct));
+		data += sizeof(ct);
+		len -= sizeof(ct);
+		if (ct.ct_type != types[i] || ct.ct_len > len ||
+		    ct.ct_len >= dstlen[i])
+			return false;
+		memcpy(dst[i], data, ct.ct_len);
+		dst[i][ct.ct_len] = '\0';
+		data += ct.ct_len;
+		len -= ct.ct_len;
+	}
+	return true;
+}
+
+static bool
+control_datakey(const struct fd_list *fd, const struct fd_data *d,
+    char *ifname, char *protocol)
+{
+
+	if (fd->sub != NULL)
+		return control_tlvkey(control_data(d), d->data_len,
+		    ifname, protocol);
+	return control_envkey(control_data(d), d->data_len, ifname, protocol);
+}
+
+/*
+ * Drop a queued event.
+ * The events after it for a binary listener only make sense with it,
+ * so they are dropped too and the next one is sent whole.
+ */
+static void
+control_queue_drop(struct fd_list *fd, struct fd_data *d)
+{
+	char ifname[IF_NAMESIZE], protocol[CONTROL_PROTOLEN];
+	char ifname2[IF_NAMESIZE], protocol2[CONTROL_PROTOLEN];
+	struct fd_data *dn;
+	struct control_hist *ch;
+
+	if (fd->sub == NULL ||
+	    !control_datakey(fd, d, ifname, protocol))
+	{
+		control_queue_remove(fd, d);
+		fd->queue_drops++;
+		return;
+	}
+
+	for (; d != NULL; d = dn) {
+		dn = TAILQ_NEXT(d, next);
+		if (control_datakey(fd, d, ifname2, protocol2) &&
+		    strcmp(ifname, ifname2) == 0 &&
+		    strcmp(protocol, protocol2) == 0)
+		{
+			control_queue_remove(fd, d);
+			fd->queue_drops++;
+		}
+	}
+
+	ch = control_sub_hist(fd->sub, ifname, protocol);
+	if (ch != NULL) {
+		free(ch->ch_buf);
+		free(ch->ch_env);
+		ch->ch_buf = NULL;
+		ch->ch_env = NULL;
+		ch->ch_nenv = 0;
+		ch->ch_clear = true;
+	}
+}
+
+/* The first queued event which has not been partly written. */
+static struct fd_data *
+control_queue_first(struct fd_list *fd)
+{
+	struct fd_data *d;
+
+	d = TAILQ_FIRST(&fd->queue);
+	if (d != NULL && fd->queue_off != 0)
+		d = TAILQ_NEXT(d, next);
+	return d;
+}
+
+/* Make room in a listener's queue for an event of about len bytes. */
+static void
+control_queue_room(struct fd_list *fd, const char *ifname,
+    const char *protocol, size_t len)
+{
+	char ifname2[IF_NAMESIZE], protocol2[CONTROL_PROTOLEN];
+	struct fd_data *d, *dn;
+
+	if (fd->queue_limit == 0)
+		return;
+	if (fd->flags & FD_SENDLEN)
+		len += sizeof(size_t);
+#define	QUEUE_FULL(fd, len)						      \
+	((fd)->queue_bytes + (len) > (fd)->queue_limit ||		      \
+	(fd)->queue_len >= CONTROL_QUEUE_MAX)
+
+	if (!QUEUE_FULL(fd, len))
+		return;
+
+	if (fd->flags & FD_COALESCE && ifname != NULL) {
+		for (d = control_queue_first(fd); d != NULL; d = dn) {
+			dn = TAILQ_NEXT(d, next);
+			if (!control_datakey(fd, d, ifname2, protocol2) ||
+			    strcmp(ifname, ifname2) != 0 ||
+			    strcmp(protocol, protocol2) != 0)
+				continue;
+			control_queue_drop(fd, d);
+			/* This has dropped the rest for the key. */
+			if (fd->sub != NULL)
+				break;
+		}
+	}
+
+	while (QUEUE_FULL(fd, len) &&
+	    (d = control_queue_first(fd)) != NULL)
+		control_queue_drop(fd, d);
+#undef QUEUE_FULL
+}
+
+static const char *
+control_filter(const char *filter, const char *key)
+{
+	size_t len = strlen(key);
+
+	if (strncmp(filter, key, len) != 0 || filter[len] != '=')
+		return NULL;
+	return filter + len + 1;
+}
+
+static bool
+control_family(const char *family, const char *protocol)
+{
+
+	if (strcmp(family, "inet") == 0)
+		return strcmp(protocol, "dhcp") == 0 ||
+		    strcmp(protocol, "ipv4ll") == 0;
+	if (strcmp(family, "inet6") == 0)
+		return strcmp(protocol, "ra") == 0 ||
+		    strcmp(protocol, "dhcp6") == 0 ||
+		    strcmp(protocol, "static6") == 0;
+	return strcmp(family, protocol) == 0;
+}
+
+/* Each kind of filter given must have one that matches. */
+static bool
+control_sub_match(const struct control_sub *cs,
+    const char *ifname, const char *protocol, const char *reason)
+{
+	static const char *keys[] = { "interface", "family", "reason" };
+	const char *vals[] = { ifname, protocol, reason }, *v;
+	size_t i, j;
+	bool given, match;
+
+	for (i = 0; i < __arraycount(keys); i++) {
+		given = match = false;
+		for (j = 0; j < cs->cs_nfilters && !match; j++) {
+			if ((v = control_filter(cs->cs_filters[j],
+			    keys[i])) == NULL)
+				continue;
+			given = true;
+			if (i == 1)
+				match = control_family(v, vals[i]);
+			else
+				match = strcmp(v, vals[i]) == 0;
+		}
+		if (given && !match)
+			return false;
+	}
+	return true;
+}
+
+/* Compare the names of two env strings. */
+static int
+control_envcmp(const void *a, const void *b)
+{
+	const char *sa = *(const char * const *)a;
+	const char *sb = *(const char * const *)b;
+	int ca, cb;
+
+	for (;; sa++, sb++) {
+		ca = *sa == '=' ? '\0' : (unsigned char)*sa;
+		cb = *sb == '=' ? '\0' : (unsigned char)*sb;
+		if (ca != cb || ca == '\0')
+			return ca - cb;
+	}
+}
+
+static int
+control_tlv(char **buf, size_t *len, size_t *size,
+    uint16_t type, const char *data, size_t dlen)
+{
+	struct control_tlv ct;
+	size_t nlen;
+	char *nbuf;
+
+	if (dlen > UINT16_MAX) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	nlen = *len + sizeof(ct) + dlen;
+	if (nlen > *size) {
+		nbuf = realloc(*buf, nlen + BUFSIZ);
+		if (nbuf == NULL)
+			return -1;
+		*buf = nbuf;
+		*size = nlen + BUFSIZ;
+	}
+	ct.ct_type = type;
+	ct.ct_len = (uint16_t)dlen;
+	memcpy(*buf + *len, &ct, sizeof(ct));
+	if (dlen != 0)
+		memcpy(*buf + *len + sizeof(ct), data, dlen);
+	*len = nlen;
+	return 0;
+}
+
+/* Returns 1 if queued, 0 if filtered out. */
+static int
+control_queueevent(struct fd_list *fd, const char *data, size_t data_len)
+{
+	struct control_sub *cs = fd->sub;
+	struct control_hist *ch;
+	const char *ifname = NULL, *protocol = NULL, *reason = NULL;
+	const char *p, *ep = data + data_len, *name;
+	char *buf = NULL, **env = NULL, *out = NULL;
+	size_t nenv = 0, i, j, len = 0, size = 0;
+	int r, cmp;
+
+	for (p = data; p < ep; p += strlen(p) + 1) {
+		if (strncmp(p, "interface=", 10) == 0)
+			ifname = p + 10;
+		else if (strncmp(p, "protocol=", 9) == 0)
+			protocol = p + 9;
+		else if (strncmp(p, "reason=", 7) == 0)
+			reason = p + 7;
+		else
+			nenv++;
+	}
+	if (ifname == NULL || protocol == NULL || reason == NULL)
+		return 0;
+	if (!control_sub_match(cs, ifname, protocol, reason))
+		return 0;
+
+	control_queue_room(fd, ifname, protocol, data_len);
+	if ((ch = control_sub_hist(cs, ifname, protocol)) == NULL) {
+		if ((ch = calloc(1, sizeof(*ch))) == NULL)
+			return -1;
+		strlcpy(ch->ch_ifname, ifname, sizeof(ch->ch_ifname));
+		strlcpy(ch->ch_protocol, protocol, sizeof(ch->ch_protocol));
+		TAILQ_INSERT_TAIL(&cs->cs_hist, ch, next);
+	}
+
+	if ((buf = malloc(data_len)) == NULL ||
+	    (env = reallocarray(NULL, nenv + 1, sizeof(*env))) == NULL)
+		goto err;
+	memcpy(buf, data, data_len);
+	for (p = buf, i = 0; p < buf + data_len; p += strlen(p) + 1) {
+		if (strncmp(p, "interface=", 10) != 0 &&
+		    strncmp(p, "protocol=", 9) != 0 &&
+		    strncmp(p, "reason=", 7) != 0)
+			env[i++] = UNCONST(p);
+	}
+	qsort(env, nenv, sizeof(*env), control_envcmp);
+
+	if (control_tlv(&out, &len, &size, CT_INTERFACE,
+	    ifname, strlen(ifname)) == -1 ||
+	    control_tlv(&out, &len, &size, CT_PROTOCOL,
+	    protocol, strlen(protocol)) == -1 ||
+	    control_tlv(&out, &len, &size, CT_REASON,
+	    reason, strlen(reason)) == -1)
+		goto err;
+	if (ch->ch_clear) {
+		if (control_tlv(&out, &len, &size, CT_CLEAR, NULL, 0) == -1)
+			goto err;
+		ch->ch_clear = false;
+	}
+
+	for (i = j = 0; i < nenv || j < ch->ch_nenv;) {
+		if (i == nenv)
+			cmp = 1;
+		else if (j == ch->ch_nenv)
+			cmp = -1;
+		else
+			cmp = control_envcmp(&env[i], &ch->ch_env[j]);
+		if (cmp > 0) {
+			name = ch->ch_env[j++];
+			r = control_tlv(&out, &len, &size, CT_UNSET,
+			    name, strcspn(name, "="));
+		} else {
+			if (cmp == 0 && strcmp(env[i], ch->ch_env[j++]) == 0) {
+				i++;
+				continue;
+			}
+			r = control_tlv(&out, &len, &size, CT_SET,
+			    env[i], strlen(env[i]));
+			i++;
+		}
+		if (r == -1)
+			goto err;
+	}
+
+	free(ch->ch_buf);
+	free(ch->ch_env);
+	ch->ch_buf = buf;
+	ch->ch_env = env;
+	ch->ch_nenv = nenv;
+
+	r = control_queue(fd, out, len);
+	free(out);
+	return r == -1 ? -1 : 1;
+
+err:
+	free(buf);
+	free(env);
+	free(out);
+	return -1;
+}
+
+static bool
+control_isfilter(const char *arg)
+{
+
+	return control_filter(arg, "interface") != NULL ||
+	    control_filter(arg, "family") != NULL ||
+	    control_filter(arg, "reason") != NULL;
+}
+
+int
+control_listen(struct fd_list *fd, int argc, char **argv)
+{
+	struct control_sub *cs = NULL;
+	size_t len = 0, nfilters = 0, limit = CONTROL_QUEUE_BYTES;
+	unsigned int flags = 0;
+	const char *v;
+	char *p;
+	int i, first, err;
+
+	first = argc > 1 && strcmp(argv[1], "--binary") == 0 ? 2 : 1;
+	for (i = first; i < argc; i++) {
+		if ((v = control_filter(argv[i], "limit")) != NULL) {
+			limit = (size_t)strtou(v, NULL, 0, 0, SIZE_MAX, &err);
+			if (err != 0) {
+				logerrx("%s: invalid limit %s", __func__, v);
+				errno = EINVAL;
+				return -1;
+			}
+		} else if ((v = control_filter(argv[i], "policy")) != NULL) {
+			if (strcmp(v, "drop") == 0)
+				flags &= ~FD_COALESCE;
+			else if (strcmp(v, "coalesce") == 0)
+				flags |= FD_COALESCE;
+			else {
+				logerrx("%s: unknown policy %s", __func__, v);
+				errno = EINVAL;
+				return -1;
+			}
+		} else if (first == 2 && control_isfilter(argv[i])) {
+			len += strlen(argv[i]) + 1;
+			nfilters++;
+		} else {
+			logerrx("%s: unknown argument %s", __func__, argv[i]);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	if (first == 2) {
+		if ((cs = calloc(1, sizeof(*cs))) == NULL)
+			return -1;
+		TAILQ_INIT(&cs->cs_hist);
+		if (nfilters != 0 &&
+		    ((cs->cs_buf = malloc(len)) == NULL ||
+		    (cs->cs_filters = reallocarray(NULL,
+		    nfilters, sizeof(char *))) == NULL))
+		{
+			control_sub_free(cs);
+			return -1;
+		}
+		for (i = 2, p = cs->cs_buf; i < argc; i++) {
+			if (!control_isfilter(argv[i]))
+				continue;
+			cs->cs_filters[cs->cs_nfilters++] = p;
+			p = stpcpy(p, argv[i]) + 1;
+		}
+		control_sub_free(fd->sub);
+		fd->sub = cs;
+	}
+
+	fd->queue_limit = limit;
+	fd->flags = (fd->flags & ~FD_COALESCE) | flags | FD_LISTEN;
+	return 0;
+}
+
 void
 control_free(struct fd_list *fd)
 {
@@ -87,6 +616,8 @@ control_free(struct fd_list *fd)
 	eloop_event_remove_writecb(fd->ctx->eloop, fd->fd);
 	TAILQ_REMOVE(&fd->ctx->control_fds, fd, next);
 	control_queue_free(fd);
+	control_sub_free(fd->sub);
+	free(fd->dump);
 	free(fd);
 }
 
@@ -126,7 +657,9 @@ control_handle_data(void *arg)
 
 		fd->flags |= FD_SENDLEN;
 		err = ps_ctl_handleargs(fd, buffer, (size_t)bytes);
-		fd->flags &= ~FD_SENDLEN;
+		/* Listeners are sent each event framed. */
+		if (!(fd->flags & FD_LISTEN))
+			fd->flags &= ~FD_SENDLEN;
 		if (err == -1) {
 			logerr(__func__);
 			return;
@@ -210,6 +743,10 @@ control_new(struct dhcpcd_ctx *ctx, int fd, unsigned int flags)
 	l->ctx = ctx;
 	l->fd = fd;
 	l->flags = flags;
+	l->sub = NULL;
+	l->dump = NULL;
+	l->queue_len = l->queue_bytes = l->queue_off = l->queue_limit = 0;
+	l->queue_sent = l->queue_drops = 0;
 	TAILQ_INIT(&l->queue);
 #ifdef CTL_FREE_LIST
 	TAILQ_INIT(&l->free_queue);
@@ -414,7 +951,7 @@ control_stop(struct dhcpcd_ctx *ctx)
 	if (IN_PRIVSEP_SE(ctx)) {
 		if (ps_root_unlink(ctx, ctx->control_sock) == -1)
 			retval = -1;
-		if (ctx->options & DHCPCD_MASTER &&
+		if (ctx->options & DHCPCD_MASTER && ctx->shard == 0 &&
 		    control_unlink(ctx, UNPRIVSOCKET) == -1)
 			retval = -1;
 		return retval;
@@ -483,50 +1020,69 @@ control_send(struct dhcpcd_ctx *ctx, int argc, char * const *argv)
 	return write(ctx->control_fd, buffer, len);
 }
 
+static int control_dumpnext(struct fd_list *);
+
 static void
 control_writeone(void *arg)
 {
-	struct fd_list *fd;
-	struct iovec iov[2];
-	int iov_len;
+	struct fd_list *fd = arg;
+	struct iovec iov[CONTROL_WRITE_MAX * 2], *iovp;
+	int iov_len = 0, n = 0;
 	struct fd_data *data;
+	size_t off;
+	ssize_t len;
+
+	TAILQ_FOREACH(data, &fd->queue, next) {
+		if (n++ == CONTROL_WRITE_MAX)
+			break;
+		if (data->data_flags & FD_SENDLEN) {
+			iov[iov_len].iov_base = &data->data_len;
+			iov[iov_len++].iov_len = sizeof(data->data_len);
+		}
+		iov[iov_len].iov_base = control_data(data);
+		iov[iov_len++].iov_len = data->data_len;
+	}
 
-	fd = arg;
-	data = TAILQ_FIRST(&fd->queue);
-
-	if (data->data_flags & FD_SENDLEN) {
-		iov[0].iov_base = &data->data_len;
-		iov[0].iov_len = sizeof(size_t);
-		iov[1].iov_base = data->data;
-		iov[1].iov_len = data->data_len;
-		iov_len = 2;
-	} else {
-		iov[0].iov_base = data->data;
-		iov[0].iov_len = data->data_len;
-		iov_len = 1;
+	/* Skip what was written of the first last time. */
+	iovp = iov;
+	for (off = fd->queue_off; off != 0; iovp++, iov_len--) {
+		if (off < iovp->iov_len) {
+			iovp->iov_base = (char *)iovp->iov_base + off;
+			iovp->iov_len -= off;
+			break;
+		}
+		off -= iovp->iov_len;
 	}
 
-	if (writev(fd->fd, iov, iov_len) == -1) {
+	len = writev(fd->fd, iovp, iov_len);
+	if (len == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
 		logerr("%s: write", __func__);
 		control_delete(fd);
 		return;
 	}
 
-	TAILQ_REMOVE(&fd->queue, data, next);
-#ifdef CTL_FREE_LIST
-	TAILQ_INSERT_TAIL(&fd->free_queue, data, next);
-#else
-	if (data->data_size != 0)
-		free(data->data);
-	free(data);
-#endif
+	off = fd->queue_off + (size_t)len;
+	while ((data = TAILQ_FIRST(&fd->queue)) != NULL &&
+	    off >= control_datalen(data))
+	{
+		off -= control_datalen(data);
+		control_queue_remove(fd, data);
+		fd->queue_sent++;
+	}
+	fd->queue_off = off;
+
+	if (TAILQ_FIRST(&fd->queue) == NULL && fd->dump != NULL &&
+	    control_dumpnext(fd) == -1)
+		logerr(__func__);
 
 	if (TAILQ_FIRST(&fd->queue) != NULL)
 		return;
 
 	eloop_event_remove_writecb(fd->ctx->eloop, fd->fd);
 #ifdef PRIVSEP
-	if (IN_PRIVSEP_SE(fd->ctx) && !(fd->flags & FD_LISTEN)) {
+	if (IN_PRIVSEP_SE(fd->ctx) && !(fd->flags & (FD_LISTEN | FD_DUMP))) {
 		if (ps_ctl_sendeof(fd) == -1)
 			logerr(__func__);
 		control_free(fd);
@@ -534,16 +1090,11 @@ control_writeone(void *arg)
 #endif
 }
 
-int
-control_queue(struct fd_list *fd, void *data, size_t data_len)
+static struct fd_data *
+control_queue_get(struct fd_list *fd, size_t data_len)
 {
 	struct fd_data *d;
 
-	if (data_len == 0) {
-		errno = EINVAL;
-		return -1;
-	}
-
 #ifdef CTL_FREE_LIST
 	struct fd_data *df;
 
@@ -555,16 +1106,42 @@ control_queue(struct fd_list *fd, void *data, size_t data_len)
 				break;
 		}
 	}
-	if (d != NULL)
+	if (d != NULL) {
 		TAILQ_REMOVE(&fd->free_queue, d, next);
-	else
+		return d;
+	}
+#else
+	UNUSED(fd);
+	UNUSED(data_len);
 #endif
-	{
-		d = calloc(1, sizeof(*d));
-		if (d == NULL)
-			return -1;
+	return calloc(1, sizeof(*d));
+}
+
+static void
+control_queue_add(struct fd_list *fd, struct fd_data *d, size_t data_len)
+{
+
+	d->data_len = data_len;
+	d->data_flags = fd->flags & FD_SENDLEN;
+	TAILQ_INSERT_TAIL(&fd->queue, d, next);
+	fd->queue_len++;
+	fd->queue_bytes += control_datalen(d);
+	eloop_event_add_w(fd->ctx->eloop, fd->fd, control_writeone, fd);
+}
+
+int
+control_queue(struct fd_list *fd, void *data, size_t data_len)
+{
+	struct fd_data *d;
+
+	if (data_len == 0) {
+		errno = EINVAL;
+		return -1;
 	}
 
+	if ((d = control_queue_get(fd, data_len)) == NULL)
+		return -1;
+
 	if (d->data_size == 0)
 		d->data = NULL;
 	if (d->data_size < data_len) {
@@ -578,10 +1155,211 @@ control_queue(struct fd_list *fd, void *data, size_t data_len)
 		d->data_size = data_len;
 	}
 	memcpy(d->data, data, data_len);
-	d->data_len = data_len;
-	d->data_flags = fd->flags & FD_SENDLEN;
+	control_queue_add(fd, d, data_len);
+	return 0;
+}
 
-	TAILQ_INSERT_TAIL(&fd->queue, d, next);
-	eloop_event_add_w(fd->ctx->eloop, fd->fd, control_writeone, fd);
+/* The length of zero which ends a --dumpstate. */
+int
+control_queue_end(struct fd_list *fd)
+{
+	struct fd_data *d;
+
+	if ((d = control_queue_get(fd, 0)) == NULL)
+		return -1;
+	control_queue_add(fd, d, 0);
 	return 0;
 }
+
+/*
+ * Queue data for every listener.
+ * They all share one copy, which is freed once the last has sent it.
+ * Returns the number of listeners queued for.
+ */
+int
+control_queuelisteners(struct dhcpcd_ctx *ctx, void *data, size_t data_len)
+{
+	struct fd_list *fd;
+	struct fd_data *d;
+	struct fd_buf *fb = NULL;
+	char ifname[IF_NAMESIZE], protocol[CONTROL_PROTOLEN];
+	bool key;
+	int n = 0;
+
+	if (data_len == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	key = control_envkey(data, data_len, ifname, protocol);
+
+	TAILQ_FOREACH(fd, &ctx->control_fds, next) {
+		if (!(fd->flags & FD_LISTEN))
+			continue;
+		if (fd->sub != NULL) {
+			switch (control_queueevent(fd, data, data_len)) {
+			case -1:
+				logerr(__func__);
+				break;
+			case 1:
+				n++;
+				break;
+			}
+			continue;
+		}
+		if (fb == NULL) {
+			fb = malloc(sizeof(*fb) + data_len);
+			if (fb == NULL)
+				return -1;
+			/* Our own reference keeps it until all are queued. */
+			fb->fb_refs = 1;
+			fb->fb_len = data_len;
+			memcpy(fb->fb_data, data, data_len);
+		}
+		control_queue_room(fd, key ? ifname : NULL,
+		    key ? protocol : NULL, data_len);
+		/* Any buffer of its own is kept for when it's reused. */
+		if ((d = control_queue_get(fd, 0)) == NULL) {
+			logerr(__func__);
+			continue;
+		}
+		d->data_buf = fb;
+		fb->fb_refs++;
+		control_queue_add(fd, d, fb->fb_len);
+		n++;
+	}
+
+	if (fb != NULL && --fb->fb_refs == 0)
+		free(fb);
+	return n;
+}
+
+/* Queue the state of the next interface to dump, or the end. */
+static int
+control_dumpnext(struct fd_list *fd)
+{
+	struct dhcpcd_ctx *ctx = fd->ctx;
+	struct fd_dump *fdd = fd->dump;
+	struct interface *ifp;
+
+	ctx->options |= DHCPCD_DUMPLEASE;
+	while (TAILQ_FIRST(&fd->queue) == NULL &&
+	    fdd->fdd_next < fdd->fdd_len)
+	{
+		ifp = if_find(ctx->ifaces, fdd->fdd_ifname[fdd->fdd_next++]);
+		if (ifp == NULL || !ifp->active)
+			continue;
+		if (send_interface(fd, ifp, fdd->fdd_af) == -1)
+			logerr("%s: %s", __func__, ifp->name);
+	}
+	ctx->options &= ~DHCPCD_DUMPLEASE;
+
+	if (TAILQ_FIRST(&fd->queue) != NULL)
+		return 0;
+
+	free(fd->dump);
+	fd->dump = NULL;
+	return control_queue_end(fd);
+}
+
+int
+control_dump(struct fd_list *fd, int argc, char **argv)
+{
+	struct dhcpcd_ctx *ctx = fd->ctx;
+	struct fd_dump *fdd;
+	struct interface *ifp;
+	size_t n = 0;
+	int i, af = AF_UNSPEC;
+
+	if (fd->dump != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-4") == 0)
+			af = AF_INET;
+		else if (strcmp(argv[i], "-6") == 0)
+			af = AF_INET6;
+		else
+			n++;
+	}
+	if (n == 0) {
+		TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+			if (ifp->active)
+				n++;
+		}
+	}
+
+	fdd = malloc(sizeof(*fdd) + n * sizeof(fdd->fdd_ifname[0]));
+	if (fdd == NULL)
+		return -1;
+	fdd->fdd_af = af;
+	fdd->fdd_next = fdd->fdd_len = 0;
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-4") != 0 && strcmp(argv[i], "-6") != 0)
+			strlcpy(fdd->fdd_ifname[fdd->fdd_len++], argv[i],
+			    sizeof(fdd->fdd_ifname[0]));
+	}
+	if (fdd->fdd_len == 0) {
+		/* Names rather than pointers as the list can change
+		 * while we are dumping it. */
+		TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+			if (ifp->active)
+				strlcpy(fdd->fdd_ifname[fdd->fdd_len++],
+				    ifp->name, sizeof(fdd->fdd_ifname[0]));
+		}
+	}
+
+	fd->dump = fdd;
+	/* Anything queued already is sent first. */
+	if (TAILQ_FIRST(&fd->queue) != NULL)
+		return 0;
+	return control_dumpnext(fd);
+}
+
+#define	STATS_LINE	80
+int
+control_stats(struct fd_list *fd)
+{
+	struct dhcpcd_ctx *ctx = fd->ctx;
+	struct fd_list *l;
+	size_t n = 1, one = 1;
+	char *buf, *p;
+	const char *type;
+	int len, err;
+
+	TAILQ_FOREACH(l, &ctx->control_fds, next)
+		n++;
+	if ((buf = malloc(n * STATS_LINE)) == NULL)
+		return -1;
+
+	p = buf;
+	len = snprintf(p, STATS_LINE, "%-4s %-6s %6s %10s %10s %12s %10s",
+	    "fd", "type", "queued", "bytes", "limit", "sent", "drops");
+	p += len + 1;
+	TAILQ_FOREACH(l, &ctx->control_fds, next) {
+		if (l->sub != NULL)
+			type = "binary";
+		else if (l->flags & FD_LISTEN)
+			type = "listen";
+		else
+			type = "client";
+		len = snprintf(p, STATS_LINE,
+		    "%-4d %-6s %6zu %10zu %10zu %12llu %10llu",
+		    l->fd, type, l->queue_len, l->queue_bytes, l->queue_limit,
+		    l->queue_sent, l->queue_drops);
+		if (len < 0 || len >= STATS_LINE)
+			len = STATS_LINE - 1;
+		p += len + 1;
+	}
+
+	/* Sent as a single dump entry of lines so it reads back like a
+	 * lease. */
+	if (write(fd->fd, &one, sizeof(one)) != sizeof(one))
+		err = -1;
+	else
+		err = control_queue(fd, buf, (size_t)(p - buf));
+	free(buf);
+	return err;
+}
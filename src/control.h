@@ -30,6 +30,7 @@
 #define CONTROL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "dhcpcd.h"
 
@@ -39,8 +40,18 @@
 #undef	CTL_FREE_LIST
 #endif
 
-/* Limit queue size per fd */
+/* Limit queue size per listener */
 #define CONTROL_QUEUE_MAX	100
+#define CONTROL_QUEUE_BYTES	(256 * 1024)
+/* Messages written at once */
+#define CONTROL_WRITE_MAX	16
+
+/* An event shared by every listener it is queued for. */
+struct fd_buf {
+	unsigned int fb_refs;
+	size_t fb_len;
+	char fb_data[];
+};
 
 struct fd_data {
 	TAILQ_ENTRY(fd_data) next;
@@ -48,9 +59,25 @@ struct fd_data {
 	size_t data_size;
 	size_t data_len;
 	unsigned int data_flags;
+	struct fd_buf *data_buf;	/* sent instead of data if set */
 };
 TAILQ_HEAD(fd_data_head, fd_data);
 
+struct control_sub;
+
+/*
+ * --dumpstate [-4|-6] [interface] [...] is answered with the same records
+ * as --dumplease, each framed by its length, followed by a length of zero.
+ * Each interface is only rendered once the last has been sent,
+ * so dumping thousands of interfaces does not queue them all at once.
+ */
+struct fd_dump {
+	int fdd_af;
+	size_t fdd_next;
+	size_t fdd_len;
+	char fdd_ifname[][IF_NAMESIZE];
+};
+
 struct fd_list {
 	TAILQ_ENTRY(fd_list) next;
 	struct dhcpcd_ctx *ctx;
@@ -60,12 +87,53 @@ struct fd_list {
 #ifdef CTL_FREE_LIST
 	struct fd_data_head free_queue;
 #endif
+	struct control_sub *sub;	/* binary listener */
+	struct fd_dump *dump;		/* --dumpstate in progress */
+	size_t queue_len;		/* messages queued */
+	size_t queue_bytes;		/* and their size framed */
+	size_t queue_off;		/* written of the first */
+	size_t queue_limit;		/* bytes, 0 for none */
+	unsigned long long queue_sent;
+	unsigned long long queue_drops;
 };
 TAILQ_HEAD(fd_list_head, fd_list);
 
 #define	FD_LISTEN	0x01U
 #define	FD_UNPRIV	0x02U
 #define	FD_SENDLEN	0x04U
+#define	FD_DUMP		0x08U	/* privsep proxy is relaying a dump */
+#define	FD_COALESCE	0x10U	/* drop older events for the same key */
+
+/*
+ * --listen [limit=BYTES] [policy=drop|coalesce] starts a listener.
+ * Once its queue is over the limit the oldest events are dropped,
+ * or with coalesce the older events for the same interface and protocol
+ * are dropped first.
+ *
+ * A listener started with --listen --binary [interface=NAME]
+ * [family=inet|inet6|link] [reason=REASON] [...] is sent each event
+ * it matches as a series of TLVs in host byte order.
+ * The limit and policy can be given as well.
+ * Each filter may be given more than once, and one of each kind given
+ * must match.
+ * An event starts with its interface, protocol and reason,
+ * then has a CT_SET for each variable which is new or has changed since
+ * the last event for the interface and protocol and a CT_UNSET for each
+ * variable which has gone.
+ * If events for the interface and protocol were dropped, a CT_CLEAR
+ * follows the reason and every variable is then set.
+ */
+struct control_tlv {
+	uint16_t ct_type;
+	uint16_t ct_len;	/* of the data following, not NUL terminated */
+};
+
+#define	CT_INTERFACE	1
+#define	CT_PROTOCOL	2
+#define	CT_REASON	3
+#define	CT_SET		4	/* name=value */
+#define	CT_UNSET	5	/* name */
+#define	CT_CLEAR	6	/* events were dropped, forget all variables */
 
 int control_start(struct dhcpcd_ctx *, const char *, sa_family_t);
 int control_stop(struct dhcpcd_ctx *);
@@ -75,5 +143,10 @@ struct fd_list *control_new(struct dhcpcd_ctx *, int, unsigned int);
 void control_free(struct fd_list *);
 void control_delete(struct fd_list *);
 int control_queue(struct fd_list *, void *, size_t);
+int control_queue_end(struct fd_list *);
+int control_queuelisteners(struct dhcpcd_ctx *, void *, size_t);
+int control_listen(struct fd_list *, int, char **);
+int control_dump(struct fd_list *, int, char **);
+int control_stats(struct fd_list *);
 void control_recvdata(struct fd_list *fd, char *, size_t);
 #endif
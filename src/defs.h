@@ -56,6 +56,12 @@
 #ifndef LEASEFILE6
 # define LEASEFILE6		LEASEFILE "6"
 #endif
+#ifndef LEASEDB
+# define LEASEDB		DBDIR "/leases.db"
+#endif
+#ifndef SNAPSHOTFILE
+# define SNAPSHOTFILE		DBDIR "/%s.snapshot"
+#endif
 #ifndef PIDFILE
 # define PIDFILE		RUNDIR "/%s%s%spid"
 #endif
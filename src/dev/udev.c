@@ -35,6 +35,7 @@
 #endif
 
 #include <libudev.h>
+#include <poll.h>
 #include <string.h>
 
 #include "../common.h"
@@ -74,18 +75,11 @@ udev_initialised(const char *ifname)
 	return r;
 }
 
-static int
-udev_handle_device(void *ctx)
+static void
+udev_handle_device1(void *ctx, struct udev_device *device)
 {
-	struct udev_device *device;
 	const char *subsystem, *ifname, *action;
 
-	device = udev_monitor_receive_device(monitor);
-	if (device == NULL) {
-		logerrx("libudev: received NULL device");
-		return -1;
-	}
-
 	subsystem = udev_device_get_subsystem(device);
 	ifname = udev_device_get_sysname(device);
 	action = udev_device_get_action(device);
@@ -100,6 +94,31 @@ udev_handle_device(void *ctx)
 	}
 
 	udev_device_unref(device);
+}
+
+/* Drain every event waiting so that dhcpcd can discover all the
+ * interfaces they announce in one pass. */
+static int
+udev_handle_device(void *ctx)
+{
+	struct udev_device *device;
+	struct pollfd pfd;
+
+	device = udev_monitor_receive_device(monitor);
+	if (device == NULL) {
+		logerrx("libudev: received NULL device");
+		return -1;
+	}
+	udev_handle_device1(ctx, device);
+
+	pfd.fd = udev_monitor_get_fd(monitor);
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 0) == 1 && pfd.revents & POLLIN) {
+		device = udev_monitor_receive_device(monitor);
+		if (device == NULL)
+			break;
+		udev_handle_device1(ctx, device);
+	}
 	return 1;
 }
 
@@ -34,6 +34,7 @@
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "config.h"
@@ -41,8 +42,11 @@
 #include "common.h"
 #include "dhcp-common.h"
 #include "dhcp.h"
+#include "eloop.h"
 #include "if.h"
 #include "ipv6.h"
+#include "leasedb.h"
+#include "leasewb.h"
 #include "logerr.h"
 #include "script.h"
 
@@ -136,25 +140,93 @@ dhcp_print_option_encoding(const struct dhcp_opt *opt, int cols)
 	putchar('\n');
 }
 
+static struct dhcp_optmap *
+dhcp_optmap_build(struct dhcp_opt *opts, size_t opts_len)
+{
+	struct dhcp_optmap *om;
+	struct dhcp_opt *opt;
+	size_t size, i, slot;
+
+	/* At most half full, so DHCP gets a table
+	 * indexed directly by the option code. */
+	for (size = 16; size < opts_len * 2; size <<= 1)
+		;
+	om = calloc(1, sizeof(*om) + size * sizeof(om->om_map[0]));
+	if (om == NULL)
+		return NULL;
+	om->om_opts = opts;
+	om->om_opts_len = opts_len;
+	om->om_mask = size - 1;
+
+	for (i = 0, opt = opts; i < opts_len; i++, opt++) {
+		for (slot = opt->option & om->om_mask;
+		    om->om_map[slot] != NULL;
+		    slot = (slot + 1) & om->om_mask)
+		{
+			if (om->om_map[slot]->option == opt->option)
+				break;
+		}
+		/* Like a search of the list, the first one wins. */
+		if (om->om_map[slot] == NULL)
+			om->om_map[slot] = opt;
+	}
+	return om;
+}
+
+struct dhcp_opt *
+dhcp_optmap_find(struct dhcp_optmap **omp, struct dhcp_opt *opts,
+    size_t opts_len, uint32_t code)
+{
+	struct dhcp_optmap *om = *omp;
+	struct dhcp_opt *opt;
+	size_t i, slot;
+
+	if (opts_len == 0)
+		return NULL;
+	if (om == NULL || om->om_opts != opts || om->om_opts_len != opts_len) {
+		free(om);
+		if ((om = *omp = dhcp_optmap_build(opts, opts_len)) == NULL) {
+			for (i = 0, opt = opts; i < opts_len; i++, opt++) {
+				if (opt->option == code)
+					return opt;
+			}
+			return NULL;
+		}
+	}
+
+	for (slot = code & om->om_mask;
+	    (opt = om->om_map[slot]) != NULL;
+	    slot = (slot + 1) & om->om_mask)
+	{
+		if (opt->option == code)
+			return opt;
+	}
+	return NULL;
+}
+
+void
+dhcp_optmap_free(struct dhcp_optmap **omp)
+{
+
+	free(*omp);
+	*omp = NULL;
+}
+
 struct dhcp_opt *
 vivso_find(uint32_t iana_en, const void *arg)
 {
 	const struct interface *ifp;
-	size_t i;
 	struct dhcp_opt *opt;
 
 	ifp = arg;
-	for (i = 0, opt = ifp->options->vivso_override;
-	    i < ifp->options->vivso_override_len;
-	    i++, opt++)
-		if (opt->option == iana_en)
-			return opt;
-	for (i = 0, opt = ifp->ctx->vivso;
-	    i < ifp->ctx->vivso_len;
-	    i++, opt++)
-		if (opt->option == iana_en)
-			return opt;
-	return NULL;
+	load_definitions(ifp->ctx, DEFS_VIVSO);
+	opt = dhcp_optmap_find(&ifp->options->vivso_overmap,
+	    ifp->options->vivso_override, ifp->options->vivso_override_len,
+	    iana_en);
+	if (opt != NULL)
+		return opt;
+	return dhcp_optmap_find(&ifp->ctx->vivso_map,
+	    ifp->ctx->vivso, ifp->ctx->vivso_len, iana_en);
 }
 
 ssize_t
@@ -307,13 +379,15 @@ encode_rfc1035(const char *src, uint8_t *dst)
 /* Decode an RFC1035 DNS search order option into a space
  * separated string. Returns length of string (including
  * terminating zero) or zero on error. out may be NULL
- * to just determine output length. */
+ * to just determine output length.
+ * Compression pointers must point backwards, so the work done
+ * is bounded by the hop limit and the output length. */
 ssize_t
 decode_rfc1035(char *out, size_t len, const uint8_t *p, size_t pl)
 {
 	const char *start;
 	size_t start_len, l, d_len, o_len;
-	const uint8_t *r, *q = p, *e;
+	const uint8_t *r, *q = p, *e, *lp;
 	int hops;
 	uint8_t ltype;
 
@@ -326,6 +400,7 @@ decode_rfc1035(char *out, size_t len, const uint8_t *p, size_t pl)
 		r = NULL;
 		d_len = 0;
 		hops = 0;
+		lp = q;
 		/* Check we are inside our length again in-case
 		 * the name isn't fully qualified (ie, not terminated) */
 		while (q < e && (l = (size_t)*q++)) {
@@ -352,11 +427,14 @@ decode_rfc1035(char *out, size_t len, const uint8_t *p, size_t pl)
 					errno = ERANGE;
 					return -1;
 				}
-				q = p + l;
-				if (q >= e) {
+				/* A pointer is to a prior occurrence, so must
+				 * be before the labels it was reached from.
+				 * Then following pointers can never loop. */
+				if (l >= (size_t)(lp - p)) {
 					errno = ERANGE;
 					return -1;
 				}
+				q = lp = p + l;
 			} else {
 				/* straightforward name segment, add with '.' */
 				if (q + l > e) {
@@ -368,6 +446,11 @@ decode_rfc1035(char *out, size_t len, const uint8_t *p, size_t pl)
 					return -1;
 				}
 				d_len += l + 1;
+				/* Don't count the trailing NUL */
+				if (d_len > NS_MAXDNAME + 1) {
+					errno = E2BIG;
+					return -1;
+				}
 				if (out) {
 					if (l + 1 > len) {
 						errno = ENOBUFS;
@@ -383,11 +466,6 @@ decode_rfc1035(char *out, size_t len, const uint8_t *p, size_t pl)
 			}
 		}
 
-		/* Don't count the trailing NUL */
-		if (d_len > NS_MAXDNAME + 1) {
-			errno = E2BIG;
-			return -1;
-		}
 		o_len += d_len;
 
 		/* change last dot to space */
@@ -484,19 +562,103 @@ valid_domainname(char *lbl, int type)
  * PS_SAFE has all non ascii and non printables changes to escaped octal.
  */
 static const char hexchrs[] = "0123456789abcdef";
+
+/* Does print_string() have to do more than copy c? */
+static bool
+print_string_special(int type, uint8_t c)
+{
+
+	if (type & OT_BINHEX)
+		return true;
+	if (type & OT_ASCII && !isascii(c))
+		return true;
+	if (!(type & (OT_ASCII | OT_RAW | OT_ESCSTRING | OT_ESCFILE)) &&
+	    !isascii(c) && !isprint(c))
+		return true;
+	if (type & (OT_ESCSTRING | OT_ESCFILE) &&
+	    (c == '\\' || !isascii(c) || !isprint(c)))
+		return true;
+	if (type & OT_ESCFILE && (c == '/' || c == ' '))
+		return true;
+	return false;
+}
+
+/* Bit tricks on a word of bytes, true if any byte is less than n
+ * or is b. Good for n up to 128. */
+#define	PS_ONES			(~0UL / 0xff)
+#define	PS_HIGHS		(PS_ONES * 0x80)
+#define	PS_HASLESS(x, n)	(((x) - PS_ONES * (n)) & ~(x) & PS_HIGHS)
+#define	PS_HASBYTE(x, b)	PS_HASLESS((x) ^ (PS_ONES * (b)), 1)
+
+/*
+ * The length of the run at the start of data which is copied as it is.
+ * Words with no byte print_string_special() could pick are skipped
+ * whole: in ASCII only bytes above 0x7f, controls, DEL and a few
+ * others are ever special.
+ */
+static size_t
+print_string_run(int type, const uint8_t *data, size_t dl)
+{
+	const uint8_t *p = data, *e = data + dl;
+	unsigned long x, m;
+	size_t i;
+
+	if (type & OT_BINHEX)
+		return 0;
+
+	for (; (size_t)(e - p) >= sizeof(x); p += sizeof(x)) {
+		memcpy(&x, p, sizeof(x));
+		m = x & PS_HIGHS;
+		if (type & (OT_ESCSTRING | OT_ESCFILE))
+			m |= PS_HASLESS(x, 0x20) | PS_HASBYTE(x, 0x7f) |
+			    PS_HASBYTE(x, '\\');
+		if (type & OT_ESCFILE)
+			m |= PS_HASBYTE(x, '/') | PS_HASBYTE(x, ' ');
+		if (m == 0)
+			continue;
+		for (i = 0; i < sizeof(x); i++) {
+			if (print_string_special(type, p[i]))
+				return (size_t)(p + i - data);
+		}
+	}
+	for (; p < e; p++) {
+		if (print_string_special(type, *p))
+			break;
+	}
+	return (size_t)(p - data);
+}
+
 ssize_t
 print_string(char *dst, size_t len, int type, const uint8_t *data, size_t dl)
 {
 	char *odst;
 	uint8_t c;
 	const uint8_t *e;
-	size_t bytes;
+	size_t bytes, run;
 
 	odst = dst;
 	bytes = 0;
 	e = data + dl;
 
 	while (data < e) {
+		/* Copy what needs no escaping in one go. */
+		run = print_string_run(type, data, (size_t)(e - data));
+		if (run != 0) {
+			if (dst) {
+				if (len < run) {
+					errno = ENOBUFS;
+					return -1;
+				}
+				memcpy(dst, data, run);
+				dst += run;
+				len -= run;
+			}
+			bytes += run;
+			data += run;
+			if (data == e)
+				break;
+		}
+
 		c = *data++;
 		if (type & OT_BINHEX) {
 			if (dst) {
@@ -658,16 +820,29 @@ print_option(FILE *fp, const char *prefix, const struct dhcp_opt *opt,
 		goto done;
 
 	if (opt->type & OT_RFC1035) {
-		char domain[NS_MAXDNAME];
+		char sdomain[NS_MAXDNAME], *domain = sdomain;
 
-		sl = decode_rfc1035(domain, sizeof(domain), data, dl);
-		if (sl == -1)
-			goto err;
-		if (sl == 0)
-			goto done;
-		if (valid_domainname(domain, opt->type) == -1)
+		sl = decode_rfc1035(domain, sizeof(sdomain), data, dl);
+		/* A search list can hold more than one name will. */
+		if (sl == -1 && errno == ENOBUFS) {
+			sl = decode_rfc1035(NULL, 0, data, dl);
+			if (sl == -1 || (domain = malloc((size_t)sl + 1)) == NULL)
+				goto err;
+			sl = decode_rfc1035(domain, (size_t)sl + 1, data, dl);
+		}
+		if (sl == -1 || sl == 0 ||
+		    valid_domainname(domain, opt->type) == -1)
+		{
+			if (domain != sdomain)
+				free(domain);
+			if (sl == 0)
+				goto done;
 			goto err;
-		return efprintf(fp, "%s", domain);
+		}
+		sl = efprintf(fp, "%s", domain);
+		if (domain != sdomain)
+			free(domain);
+		return sl;
 	}
 
 #ifdef INET
@@ -679,11 +854,22 @@ print_option(FILE *fp, const char *prefix, const struct dhcp_opt *opt,
 #endif
 
 	if (opt->type & OT_STRING) {
-		char buf[1024];
+		char sbuf[1024], *buf = sbuf;
+		size_t buflen;
 
-		if (print_string(buf, sizeof(buf), opt->type, data, dl) == -1)
+		/* Sized for the worst case, so it is only printed once. */
+		buflen = PRINT_STRING_SIZE(opt->type, dl);
+		if (buflen > sizeof(sbuf) && (buf = malloc(buflen)) == NULL)
+			goto err;
+		if (print_string(buf, buflen, opt->type, data, dl) == -1) {
+			if (buf != sbuf)
+				free(buf);
 			goto err;
-		return efprintf(fp, "%s", buf);
+		}
+		sl = efprintf(fp, "%s", buf);
+		if (buf != sbuf)
+			free(buf);
+		return sl;
 	}
 
 	if (opt->type & OT_FLAG)
@@ -938,7 +1124,9 @@ dhcp_zero_index(struct dhcp_opt *opt)
 	size_t i;
 	struct dhcp_opt *o;
 
-	opt->index = 0;
+	/* Avoid dirtying the pages of the built in tables. */
+	if (opt->index != 0)
+		opt->index = 0;
 	for (i = 0, o = opt->embopts; i < opt->embopts_len; i++, o++)
 		dhcp_zero_index(o);
 	for (i = 0, o = opt->encopts; i < opt->encopts_len; i++, o++)
@@ -949,14 +1137,16 @@ ssize_t
 dhcp_readfile(struct dhcpcd_ctx *ctx, const char *file, void *data, size_t len)
 {
 
+	if (leasewb_handles(ctx, file))
+		return leasewb_read(ctx, file, data, len);
 #ifdef PRIVSEP
 	if (ctx->options & DHCPCD_PRIVSEP &&
 	    !(ctx->options & DHCPCD_PRIVSEPROOT))
 		return ps_root_readfile(ctx, file, data, len);
-#else
-	UNUSED(ctx);
 #endif
 
+	if (leasedb_handles(ctx, file))
+		return leasedb_read(ctx, file, data, len);
 	return readfile(file, data, len);
 }
 
@@ -965,14 +1155,27 @@ dhcp_writefile(struct dhcpcd_ctx *ctx, const char *file, mode_t mode,
     const void *data, size_t len)
 {
 
+	return dhcp_writefile_mtime(ctx, file, mode, data, len, 0);
+}
+
+/* As dhcp_writefile, but our own files are given mtime, unless 0,
+ * as when they were last modified. */
+ssize_t
+dhcp_writefile_mtime(struct dhcpcd_ctx *ctx, const char *file, mode_t mode,
+    const void *data, size_t len, time_t mtime)
+{
+
 #ifdef PRIVSEP
 	if (ctx->options & DHCPCD_PRIVSEP &&
 	    !(ctx->options & DHCPCD_PRIVSEPROOT))
-		return ps_root_writefile(ctx, file, mode, data, len);
-#else
-	UNUSED(ctx);
+		return ps_root_writefile(ctx, file, mode, data, len, mtime);
 #endif
 
+	if (leasedb_handles(ctx, file))
+		return leasedb_write(ctx, file, data, len, mtime);
+	/* Our own files are only ever replaced whole. */
+	if (strncmp(file, DBDIR "/", sizeof(DBDIR)) == 0)
+		return writefile_atomic(file, mode, data, len, mtime);
 	return writefile(file, mode, data, len);
 }
 
@@ -980,14 +1183,16 @@ int
 dhcp_filemtime(struct dhcpcd_ctx *ctx, const char *file, time_t *time)
 {
 
+	if (leasewb_handles(ctx, file))
+		return leasewb_mtime(ctx, file, time);
 #ifdef PRIVSEP
 	if (ctx->options & DHCPCD_PRIVSEP &&
 	    !(ctx->options & DHCPCD_PRIVSEPROOT))
 		return (int)ps_root_filemtime(ctx, file, time);
-#else
-	UNUSED(ctx);
 #endif
 
+	if (leasedb_handles(ctx, file))
+		return leasedb_mtime(ctx, file, time);
 	return filemtime(file, time);
 }
 
@@ -995,14 +1200,15 @@ int
 dhcp_unlink(struct dhcpcd_ctx *ctx, const char *file)
 {
 
+	leasewb_unlink(ctx, file);
 #ifdef PRIVSEP
 	if (ctx->options & DHCPCD_PRIVSEP &&
 	    !(ctx->options & DHCPCD_PRIVSEPROOT))
 		return (int)ps_root_unlink(ctx, file);
-#else
-	UNUSED(ctx);
 #endif
 
+	if (leasedb_handles(ctx, file))
+		return leasedb_unlink(ctx, file);
 	return unlink(file);
 }
 
@@ -1027,3 +1233,211 @@ dhcp_read_hwaddr_aton(struct dhcpcd_ctx *ctx, uint8_t **data, const char *file)
 	hwaddr_aton(*data, buf);
 	return len;
 }
+
+/* Brings a renew or rebind time forward by a random amount, up to
+ * pct percent of it, so clients given the same lease drift apart. */
+uint32_t
+dhcp_spread(uint32_t t, unsigned int pct)
+{
+	uint32_t r;
+
+	if (pct == 0 || t == UINT32_MAX)
+		return t;
+	r = (uint32_t)((uint64_t)t * pct / 100);
+	if (r == 0)
+		return t;
+	return t - arc4random_uniform(r + 1);
+}
+
+/* The kernel receive timestamp of a message, NULL if it has none. */
+const struct timespec *
+dhcp_rxtime(struct msghdr *msg, struct timespec *ts)
+{
+#ifdef SO_RXTIME
+	struct cmsghdr *cm;
+#ifndef SCM_TIMESTAMPNS
+	struct timeval tv;
+#endif
+
+	for (cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
+		if (cm->cmsg_level != SOL_SOCKET)
+			continue;
+#ifdef SCM_TIMESTAMPNS
+		if (cm->cmsg_type == SCM_TIMESTAMPNS &&
+		    cm->cmsg_len >= CMSG_LEN(sizeof(*ts)))
+		{
+			memcpy(ts, CMSG_DATA(cm), sizeof(*ts));
+			return ts;
+		}
+#else
+		if (cm->cmsg_type == SCM_TIMESTAMP &&
+		    cm->cmsg_len >= CMSG_LEN(sizeof(tv)))
+		{
+			memcpy(&tv, CMSG_DATA(cm), sizeof(tv));
+			ts->tv_sec = tv.tv_sec;
+			ts->tv_nsec = (long)tv.tv_usec * NSEC_PER_USEC;
+			return ts;
+		}
+#endif
+	}
+#else
+	UNUSED(msg);
+	UNUSED(ts);
+#endif
+	return NULL;
+}
+
+static time_t
+srv_uptime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/* usecs from the last transmission to when, or now if NULL. */
+static long long
+srv_elapsed(const struct srv_stats *ss, const struct timespec *when)
+{
+	struct timespec now;
+
+	if (when == NULL) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		when = &now;
+	}
+	return (long long)(when->tv_sec - ss->ss_sent.tv_sec) * USEC_PER_SEC +
+	    (when->tv_nsec - ss->ss_sent.tv_nsec) / NSEC_PER_USEC;
+}
+
+static const struct srv_stat *
+srv_find(const struct srv_stats *ss, const void *id, size_t len)
+{
+	const struct srv_stat *s;
+
+	for (s = ss->ss_srv; s < ss->ss_srv + SRV_MAX; s++) {
+		if (s->ss_idlen == len && memcmp(s->ss_id, id, len) == 0)
+			return s;
+	}
+	return NULL;
+}
+
+/* Finds the server, replacing the one heard of longest ago if new. */
+static struct srv_stat *
+srv_add(struct srv_stats *ss, const void *id, size_t len)
+{
+	struct srv_stat *s, *old;
+
+	if (len == 0 || len > SRV_ID_LEN)
+		return NULL;
+	if ((s = UNCONST(srv_find(ss, id, len))) != NULL) {
+		s->ss_seen = srv_uptime();
+		return s;
+	}
+
+	old = ss->ss_srv;
+	for (s = ss->ss_srv; s < ss->ss_srv + SRV_MAX; s++) {
+		if (s->ss_idlen == 0) {
+			old = s;
+			break;
+		}
+		if (s->ss_seen < old->ss_seen)
+			old = s;
+	}
+	if (ss->ss_pending == (unsigned int)(old - ss->ss_srv) + 1)
+		ss->ss_pending = 0;
+	memset(old, 0, sizeof(*old));
+	memcpy(old->ss_id, id, len);
+	old->ss_idlen = (uint8_t)len;
+	old->ss_seen = srv_uptime();
+	return old;
+}
+
+/* A message was sent, to the server id if it was for one.
+ * Whichever server the last one was for did not answer it. */
+void
+srv_sent(struct srv_stats *ss, const void *id, size_t len, bool retrans)
+{
+	struct srv_stat *s;
+
+	if (ss->ss_pending != 0) {
+		s = &ss->ss_srv[ss->ss_pending - 1];
+		s->ss_failed++;
+		s->ss_missed++;
+	}
+	s = id != NULL ? srv_add(ss, id, len) : NULL;
+	ss->ss_pending = s != NULL ? (unsigned int)(s - ss->ss_srv) + 1 : 0;
+	ss->ss_retrans = retrans;
+	clock_gettime(CLOCK_REALTIME, &ss->ss_sent);
+}
+
+/* A server answered the last message, received at rx or now if NULL.
+ * Round trips follow RFC 6298, skipping retransmissions (Karn). */
+void
+srv_recv(struct srv_stats *ss, const void *id, size_t len,
+    const struct timespec *rx)
+{
+	struct srv_stat *s;
+	long long rtt, delta;
+
+	if ((s = srv_add(ss, id, len)) == NULL)
+		return;
+	s->ss_replies++;
+	if (ss->ss_pending == (unsigned int)(s - ss->ss_srv) + 1) {
+		ss->ss_pending = 0;
+		s->ss_missed = 0;
+	}
+	if (ss->ss_retrans || !timespecisset(&ss->ss_sent))
+		return;
+
+	rtt = srv_elapsed(ss, rx);
+	if (rtt <= 0 || rtt > SRV_RTT_MAX * USEC_PER_SEC)
+		return;
+	if (s->ss_srtt == 0) {
+		s->ss_srtt = (uint32_t)rtt;
+		s->ss_rttvar = (uint32_t)rtt / 2;
+		return;
+	}
+	delta = rtt - s->ss_srtt;
+	if (delta < 0)
+		delta = -delta;
+	s->ss_rttvar = (uint32_t)((3 * (long long)s->ss_rttvar + delta) / 4);
+	s->ss_srtt = (uint32_t)((7 * (long long)s->ss_srtt + rtt) / 8);
+	if (s->ss_srtt == 0)
+		s->ss_srtt = 1;
+}
+
+/* With fastest_server, msecs to hold a reply from an unhealthy server
+ * for a healthy one which should answer by then, 0 to take it now. */
+unsigned int
+srv_hold(const struct srv_stats *ss, const void *id, size_t len,
+    const struct timespec *rx)
+{
+	const struct srv_stat *s, *t, *best = NULL;
+	long long wait, elapsed;
+
+	s = srv_find(ss, id, len);
+	if (s == NULL || s->ss_missed < SRV_FAILMAX)
+		return 0;
+	for (t = ss->ss_srv; t < ss->ss_srv + SRV_MAX; t++) {
+		if (t == s || t->ss_idlen == 0 || t->ss_srtt == 0 ||
+		    t->ss_missed >= SRV_FAILMAX)
+			continue;
+		if (best == NULL || t->ss_srtt < best->ss_srtt)
+			best = t;
+	}
+	if (best == NULL)
+		return 0;
+
+	/* It should have answered within its retransmission timeout. */
+	wait = best->ss_srtt + 4 * (long long)best->ss_rttvar;
+	if (wait > SRV_HOLD_MAX * USEC_PER_MSEC)
+		wait = SRV_HOLD_MAX * USEC_PER_MSEC;
+	elapsed = srv_elapsed(ss, rx);
+	if (elapsed < 0)
+		elapsed = 0;
+	if (elapsed >= wait)
+		return 0;
+	return (unsigned int)((wait - elapsed + USEC_PER_MSEC - 1) /
+	    USEC_PER_MSEC);
+}
@@ -29,13 +29,47 @@
 #ifndef DHCPCOMMON_H
 #define	DHCPCOMMON_H
 
+#include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
 #include <arpa/nameser.h> /* after normal includes for sunos */
 
+/*
+ * How quickly and reliably each server answers, see --stats servers.
+ * Times are CLOCK_REALTIME to compare with kernel receive timestamps.
+ * Defined ahead of dhcpcd.h as dhcp.h and dhcp6.h embed them.
+ */
+#ifndef SRV_MAX
+#define	SRV_MAX			4	/* servers remembered per protocol */
+#endif
+#define	SRV_ID_LEN		130	/* DUID_LEN, the longest server id */
+#define	SRV_FAILMAX		2	/* missed in a row to be unhealthy */
+#define	SRV_RTT_MAX		64	/* seconds, a longer sample is bogus */
+#define	SRV_HOLD_MAX		1000	/* msecs to wait for a healthy one */
+
+struct srv_stat {
+	uint8_t ss_id[SRV_ID_LEN];	/* server id, a DUID for DHCPv6 */
+	uint8_t ss_idlen;		/* 0 if the slot is free */
+	uint32_t ss_srtt;		/* smoothed round trip usecs, 0 if none */
+	uint32_t ss_rttvar;
+	uint32_t ss_replies;
+	uint32_t ss_failed;		/* requests to it left unanswered */
+	uint32_t ss_missed;		/* of those, since it last answered */
+	time_t ss_seen;			/* uptime when last heard of */
+};
+
+struct srv_stats {
+	struct srv_stat ss_srv[SRV_MAX];
+	struct timespec ss_sent;	/* the last transmission */
+	bool ss_retrans;		/* it was resent so no RTT sample */
+	unsigned int ss_pending;	/* 1 + server it was for, 0 if none */
+};
+
 #include "common.h"
 #include "dhcpcd.h"
 
@@ -93,7 +127,7 @@ struct dhcp_opt {
 	uint32_t option; /* Also used for IANA Enterpise Number */
 	int type;
 	size_t len;
-	char *var;
+	const char *var;
 
 	int index; /* Index counter for many instances of the same option */
 	char bitflags[8];
@@ -108,6 +142,19 @@ struct dhcp_opt {
 	size_t encopts_len;
 };
 
+/* Option definitions by code.
+ * Built on first use and again if the definitions are replaced. */
+struct dhcp_optmap {
+	const struct dhcp_opt *om_opts;
+	size_t om_opts_len;
+	size_t om_mask;
+	struct dhcp_opt *om_map[];
+};
+
+struct dhcp_opt *dhcp_optmap_find(struct dhcp_optmap **,
+    struct dhcp_opt *, size_t, uint32_t);
+void dhcp_optmap_free(struct dhcp_optmap **);
+
 const char *dhcp_get_hostname(char *, size_t, const struct if_options *);
 struct dhcp_opt *vivso_find(uint32_t, const void *);
 
@@ -127,6 +174,10 @@ int make_option_mask(const struct dhcp_opt *, size_t,
 size_t encode_rfc1035(const char *src, uint8_t *dst);
 ssize_t decode_rfc1035(char *, size_t, const uint8_t *, size_t);
 ssize_t print_string(char *, size_t, int, const uint8_t *, size_t);
+/* The most print_string() writes for dl bytes of type, NUL included. */
+#define	PRINT_STRING_SIZE(type, dl)					\
+	((dl) * ((type) & (OT_ESCSTRING | OT_ESCFILE) ? 4 :		\
+	    (type) & OT_BINHEX ? 2 : 1) + 1)
 int dhcp_set_leasefile(char *, size_t, int, const struct interface *);
 
 void dhcp_envoption(struct dhcpcd_ctx *,
@@ -140,7 +191,25 @@ void dhcp_zero_index(struct dhcp_opt *);
 ssize_t dhcp_readfile(struct dhcpcd_ctx *, const char *, void *, size_t);
 ssize_t dhcp_writefile(struct dhcpcd_ctx *, const char *, mode_t,
     const void *, size_t);
+ssize_t dhcp_writefile_mtime(struct dhcpcd_ctx *, const char *, mode_t,
+    const void *, size_t, time_t);
 int dhcp_filemtime(struct dhcpcd_ctx *, const char *, time_t *);
 int dhcp_unlink(struct dhcpcd_ctx *, const char *);
 size_t dhcp_read_hwaddr_aton(struct dhcpcd_ctx *, uint8_t **, const char *);
+uint32_t dhcp_spread(uint32_t, unsigned int);
+
+/* Kernel receive timestamps of DHCP and DHCPv6 messages. */
+#if defined(SO_TIMESTAMPNS)
+#define	SO_RXTIME		SO_TIMESTAMPNS
+#elif defined(SO_TIMESTAMP)
+#define	SO_RXTIME		SO_TIMESTAMP
+#endif
+#define	RXTIME_CMSG_SPACE	CMSG_SPACE(sizeof(struct timespec))
+const struct timespec *dhcp_rxtime(struct msghdr *, struct timespec *);
+
+void srv_sent(struct srv_stats *, const void *, size_t, bool);
+void srv_recv(struct srv_stats *, const void *, size_t,
+    const struct timespec *);
+unsigned int srv_hold(const struct srv_stats *, const void *, size_t,
+    const struct timespec *);
 #endif
@@ -61,6 +61,7 @@
 #include "config.h"
 #include "arp.h"
 #include "bpf.h"
+#include "cksum.h"
 #include "common.h"
 #include "dhcp.h"
 #include "dhcpcd.h"
@@ -70,10 +71,13 @@
 #include "if.h"
 #include "ipv4.h"
 #include "ipv4ll.h"
+#include "leasewb.h"
 #include "logerr.h"
 #include "privsep.h"
+#include "probe.h"
 #include "sa.h"
 #include "script.h"
+#include "snapshot.h"
 
 #define DAD		"Duplicate address detected"
 #define DHCP_MIN_LEASE	20
@@ -98,6 +102,14 @@
 #define IP_RECVPKTINFO IP_PKTINFO
 #endif
 
+/* Every change of state goes through here so it can be traced. */
+#define	DHCP_SETSTATE(ifp, state, s)					\
+	do {								\
+		PROBE3(dhcp_state, (const char *)(ifp)->name,		\
+		    (state)->state, (s));				\
+		(state)->state = (s);					\
+	} while (/* CONSTCOND */ 0)
+
 /* Assert the correct structure size for on wire */
 __CTASSERT(sizeof(struct ip)		== 20);
 __CTASSERT(sizeof(struct udphdr)	== 8);
@@ -136,7 +148,7 @@ static void dhcp_start1(void *);
 static void dhcp_arp_found(struct arp_state *, const struct arp_msg *);
 #endif
 static void dhcp_handledhcp(struct interface *, struct bootp *, size_t,
-    const struct in_addr *);
+    const struct in_addr *, const struct timespec *);
 static void dhcp_handleifudp(void *);
 static int dhcp_initstate(struct interface *);
 
@@ -167,67 +179,77 @@ dhcp_printoptions(const struct dhcpcd_ctx *ctx,
 	}
 }
 
-static const uint8_t *
-get_option(struct dhcpcd_ctx *ctx,
-    const struct bootp *bootp, size_t bootp_len,
-    unsigned int opt, size_t *opt_len)
-{
+/* Offsets of every option in a DHCP message, built by one walk over
+ * the option area and reused until a different message is looked at.
+ * Split options (RFC3396) are concatenated into ctx->opt_buffer. */
+struct dhcp_optindex {
+	const struct bootp *bootp;
+	size_t bootp_len;
+	int error;
+	struct {
+		const uint8_t *data;
+		size_t len;
+	} opts[UINT8_MAX + 1];
+};
+
+struct dhcp_optwalk {
+	const struct bootp *bootp;
 	const uint8_t *p, *e;
-	uint8_t l, o, ol, overl, *bp;
-	const uint8_t *op;
-	size_t bl;
+	uint8_t overl;
+};
 
-	if (bootp == NULL || bootp_len < DHCP_MIN_LEN) {
-		errno = EINVAL;
-		return NULL;
-	}
+static void
+dhcp_optwalk_init(struct dhcp_optwalk *w,
+    const struct bootp *bootp, size_t bootp_len)
+{
 
-	/* Check we have the magic cookie */
-	if (!IS_DHCP(bootp)) {
-		errno = ENOTSUP;
-		return NULL;
-	}
+	w->bootp = bootp;
+	w->p = bootp->vend + 4; /* options after the 4 byte cookie */
+	w->e = (const uint8_t *)bootp + bootp_len;
+	w->overl = 0;
+}
 
-	p = bootp->vend + 4; /* options after the 4 byte cookie */
-	e = (const uint8_t *)bootp + bootp_len;
-	ol = o = overl = 0;
-	bp = NULL;
-	op = NULL;
-	bl = 0;
-	while (p < e) {
-		o = *p++;
+/* Returns 1 for an option, 0 at the end or -1 on a truncated option. */
+static int
+dhcp_optwalk_next(struct dhcp_optwalk *w,
+    uint8_t *opt, const uint8_t **data, uint8_t *len)
+{
+	uint8_t o, l;
+
+	while (w->p < w->e) {
+		o = *w->p++;
 		switch (o) {
 		case DHO_PAD:
 			/* No length to read */
 			continue;
 		case DHO_END:
-			if (overl & 1) {
+			if (w->overl & 1) {
 				/* bit 1 set means parse boot file */
-				overl = (uint8_t)(overl & ~1);
-				p = bootp->file;
-				e = p + sizeof(bootp->file);
-			} else if (overl & 2) {
+				w->overl = (uint8_t)(w->overl & ~1);
+				w->p = w->bootp->file;
+				w->e = w->p + sizeof(w->bootp->file);
+			} else if (w->overl & 2) {
 				/* bit 2 set means parse server name */
-				overl = (uint8_t)(overl & ~2);
-				p = bootp->sname;
-				e = p + sizeof(bootp->sname);
+				w->overl = (uint8_t)(w->overl & ~2);
+				w->p = w->bootp->sname;
+				w->e = w->p + sizeof(w->bootp->sname);
 			} else
-				goto exit;
+				return 0;
 			/* No length to read */
 			continue;
 		}
 
 		/* Check we can read the length */
-		if (p == e) {
+		if (w->p == w->e) {
 			errno = EINVAL;
-			return NULL;
+			return -1;
 		}
-		l = *p++;
+		l = *w->p++;
 
 		/* Check we can read the option data, if present */
-		if (p + l > e) {
+		if (w->p + l > w->e) {
 			errno = EINVAL;
-			return NULL;
+			return -1;
 		}
 
 		if (o == DHO_OPTSOVERLOADED) {
@@ -235,52 +257,137 @@ get_option(struct dhcpcd_ctx *ctx,
 			 * the last bit as well as the value.
 			 * This is valid because only the first two bits
 			 * actually mean anything in RFC2132 Section 9.3 */
-			if (l == 1 && !overl)
-				overl = 0x80 | p[0];
+			if (l == 1 && !w->overl)
+				w->overl = 0x80 | w->p[0];
 		}
 
-		if (o == opt) {
-			if (op) {
-				/* We must concatonate the options. */
-				if (bl + l > ctx->opt_buffer_len) {
-					size_t pos;
-					uint8_t *nb;
-
-					if (bp)
-						pos = (size_t)
-						    (bp - ctx->opt_buffer);
-					else
-						pos = 0;
-					nb = realloc(ctx->opt_buffer, bl + l);
-					if (nb == NULL)
-						return NULL;
-					ctx->opt_buffer = nb;
-					ctx->opt_buffer_len = bl + l;
-					bp = ctx->opt_buffer + pos;
-				}
-				if (bp == NULL)
-					bp = ctx->opt_buffer;
-				memcpy(bp, op, ol);
-				bp += ol;
-			}
-			ol = l;
-			op = p;
-			bl += ol;
+		*opt = o;
+		*data = w->p;
+		*len = l;
+		w->p += l;
+		return 1;
+	}
+	return 0;
+}
+
+static int
+dhcp_optindex_build(struct dhcpcd_ctx *ctx, struct dhcp_optindex *idx,
+    const struct bootp *bootp, size_t bootp_len)
+{
+	struct dhcp_optwalk w;
+	uint8_t o, l, split[UINT8_MAX + 1];
+	const uint8_t *d;
+	size_t pos[UINT8_MAX + 1], bl;
+	bool has_split;
+	int r, i;
+
+	memset(idx->opts, 0, sizeof(idx->opts));
+	memset(split, 0, sizeof(split));
+	has_split = false;
+	idx->bootp = bootp;
+	idx->bootp_len = bootp_len;
+	idx->error = 0;
+
+	dhcp_optwalk_init(&w, bootp, bootp_len);
+	while ((r = dhcp_optwalk_next(&w, &o, &d, &l)) == 1) {
+		if (idx->opts[o].data == NULL)
+			idx->opts[o].data = d;
+		else {
+			split[o] = 1;
+			has_split = true;
 		}
-		p += l;
+		idx->opts[o].len += l;
 	}
+	if (r == -1) {
+		idx->error = errno;
+		return 0;
+	}
+	if (!has_split)
+		return 0;
 
-exit:
+	/* We must concatonate the options. */
+	for (bl = 0, i = 0; i <= UINT8_MAX; i++) {
+		if (!split[i])
+			continue;
+		pos[i] = bl;
+		bl += idx->opts[i].len;
+	}
+	if (bl > ctx->opt_buffer_len) {
+		uint8_t *nb;
+
+		nb = realloc(ctx->opt_buffer, bl);
+		if (nb == NULL) {
+			idx->bootp = NULL;
+			return -1;
+		}
+		ctx->opt_buffer = nb;
+		ctx->opt_buffer_len = bl;
+	}
+	for (i = 0; i <= UINT8_MAX; i++) {
+		if (split[i])
+			idx->opts[i].data = ctx->opt_buffer + pos[i];
+	}
+
+	dhcp_optwalk_init(&w, bootp, bootp_len);
+	while (dhcp_optwalk_next(&w, &o, &d, &l) == 1) {
+		if (!split[o])
+			continue;
+		memcpy(ctx->opt_buffer + pos[o], d, l);
+		pos[o] += l;
+	}
+	return 0;
+}
+
+/* The index is keyed on the message address, so it must be forgotten
+ * whenever a message is freed or its buffer is reused. */
+static void
+dhcp_optindex_clear(struct dhcpcd_ctx *ctx)
+{
+
+	if (ctx->opt_index != NULL)
+		ctx->opt_index->bootp = NULL;
+}
+
+static const uint8_t *
+get_option(struct dhcpcd_ctx *ctx,
+    const struct bootp *bootp, size_t bootp_len,
+    unsigned int opt, size_t *opt_len)
+{
+	struct dhcp_optindex *idx;
+
+	if (bootp == NULL || bootp_len < DHCP_MIN_LEN) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Check we have the magic cookie */
+	if (!IS_DHCP(bootp)) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+
+	if (ctx->opt_index == NULL) {
+		ctx->opt_index = malloc(sizeof(*ctx->opt_index));
+		if (ctx->opt_index == NULL)
+			return NULL;
+		ctx->opt_index->bootp = NULL;
+	}
+	idx = ctx->opt_index;
+	if ((idx->bootp != bootp || idx->bootp_len != bootp_len) &&
+	    dhcp_optindex_build(ctx, idx, bootp, bootp_len) == -1)
+		return NULL;
+
+	if (idx->error != 0) {
+		errno = idx->error;
+		return NULL;
+	}
+	if (opt > UINT8_MAX || idx->opts[opt].data == NULL) {
+		errno = ENOENT;
+		return NULL;
+	}
 	if (opt_len)
-		*opt_len = bl;
-	if (bp) {
-		memcpy(bp, op, ol);
-		return (const uint8_t *)ctx->opt_buffer;
-	}
-	if (op)
-		return op;
-	errno = ENOENT;
-	return NULL;
+		*opt_len = idx->opts[opt].len;
+	return idx->opts[opt].data;
 }
 
 static int
@@ -733,9 +840,78 @@ dhcp_message_add_addr(struct bootp *bootp,
 	return 0;
 }
 
+static uint16_t
+dhcp_message_secs(const struct dhcp_state *state)
+{
+	struct timespec tv;
+	unsigned long long secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &tv);
+	secs = eloop_timespec_diff(&tv, &state->started, NULL);
+	if (secs > UINT16_MAX)
+		return htons((uint16_t)UINT16_MAX);
+	return htons((uint16_t)secs);
+}
+
+/*
+ * Messages are built straight into the packet they are sent in.
+ * When an exchange is over its buffer is kept for the next one, so
+ * renewing many interfaces re-uses a few buffers rather than
+ * allocating two a message and copying between them.
+ */
+static struct bootp_pkt *
+dhcp_pktget(struct dhcpcd_ctx *ctx, size_t len, size_t *size)
+{
+	struct bootp_pkt *udpp;
+	size_t i;
+
+	/* Last given back first, it's the most likely to be cached. */
+	for (i = ctx->dhcp_npkts; i-- > 0; ) {
+		if (ctx->dhcp_pktsizes[i] < len)
+			continue;
+		udpp = ctx->dhcp_pkts[i];
+		*size = ctx->dhcp_pktsizes[i];
+		ctx->dhcp_npkts--;
+		ctx->dhcp_pkts[i] = ctx->dhcp_pkts[ctx->dhcp_npkts];
+		ctx->dhcp_pktsizes[i] = ctx->dhcp_pktsizes[ctx->dhcp_npkts];
+		memset(udpp, 0, len);
+		return udpp;
+	}
+
+	if ((udpp = calloc(1, len)) != NULL)
+		*size = len;
+	return udpp;
+}
+
+static void
+dhcp_pktput(struct dhcpcd_ctx *ctx, struct bootp_pkt *udpp, size_t size)
+{
+
+	if (udpp == NULL)
+		return;
+	if (ctx->dhcp_npkts == DHCP_PKTKEEP) {
+		free(udpp);
+		return;
+	}
+	ctx->dhcp_pkts[ctx->dhcp_npkts] = udpp;
+	ctx->dhcp_pktsizes[ctx->dhcp_npkts] = size;
+	ctx->dhcp_npkts++;
+}
+
+static void
+dhcp_pktfreeall(struct dhcpcd_ctx *ctx)
+{
+
+	while (ctx->dhcp_npkts != 0)
+		free(ctx->dhcp_pkts[--ctx->dhcp_npkts]);
+}
+
+/* The IP and UDP headers are left zeroed in front of the message. */
 static ssize_t
-make_message(struct bootp **bootpm, const struct interface *ifp, uint8_t type)
+make_message(struct bootp_pkt **udppm, size_t *sizep,
+    const struct interface *ifp, uint8_t type)
 {
+	struct bootp_pkt *udpp;
 	struct bootp *bootp;
 	uint8_t *lp, *p, *e;
 	uint8_t *n_params = NULL;
@@ -763,14 +939,19 @@ make_message(struct bootp **bootpm, const struct interface *ifp, uint8_t type)
 	}
 
 	if (ifo->options & DHCPCD_BOOTP)
-		bootp = calloc(1, sizeof (*bootp));
+		len = sizeof(*bootp);
+	else if (mtu == -1)
+		return -1;
 	else
 		/* Make the maximal message we could send */
-		bootp = calloc(1, (size_t)(mtu - IP_UDP_SIZE));
+		len = (size_t)(mtu - IP_UDP_SIZE);
 
-	if (bootp == NULL)
+	udpp = dhcp_pktget(ifp->ctx, offsetof(struct bootp_pkt, bootp) + len,
+	    sizep);
+	if (udpp == NULL)
 		return -1;
-	*bootpm = bootp;
+	*udppm = udpp;
+	bootp = &udpp->bootp;
 
 	if (state->addr != NULL &&
 	    (type == DHCP_INFORM || type == DHCP_RELEASE ||
@@ -793,17 +974,8 @@ make_message(struct bootp **bootpm, const struct interface *ifp, uint8_t type)
 	    type != DHCP_RELEASE)
 		bootp->flags = htons(BROADCAST_FLAG);
 
-	if (type != DHCP_DECLINE && type != DHCP_RELEASE) {
-		struct timespec tv;
-		unsigned long long secs;
-
-		clock_gettime(CLOCK_MONOTONIC, &tv);
-		secs = eloop_timespec_diff(&tv, &state->started, NULL);
-		if (secs > UINT16_MAX)
-			bootp->secs = htons((uint16_t)UINT16_MAX);
-		else
-			bootp->secs = htons((uint16_t)secs);
-	}
+	if (type != DHCP_DECLINE && type != DHCP_RELEASE)
+		bootp->secs = dhcp_message_secs(state);
 
 	bootp->xid = htonl(state->xid);
 
@@ -881,6 +1053,10 @@ make_message(struct bootp **bootpm, const struct interface *ifp, uint8_t type)
 
 	if (type == DHCP_DISCOVER && ifo->options & DHCPCD_REQUEST)
 		PUT_ADDR(DHO_IPADDRESS, &ifo->req_addr);
+	else if (type == DHCP_DISCOVER && state->state == DHS_REBOOT &&
+	    lease->addr.s_addr != INADDR_ANY)
+		/* Ask for our old address while racing INIT-REBOOT. */
+		PUT_ADDR(DHO_IPADDRESS, &lease->addr);
 
 	if (DHCP_DIR(type)) {
 		if (type != DHCP_INFORM) {
@@ -1090,8 +1266,7 @@ make_message(struct bootp **bootpm, const struct interface *ifp, uint8_t type)
 				if (vivco->len + 2 + *lp > 255) {
 					logerrx("%s: VIVCO option too big",
 					    ifp->name);
-					free(bootp);
-					return -1;
+					goto fail;
 				}
 				*p++ = (uint8_t)vivco->len;
 				memcpy(p, vivco->data, vivco->len);
@@ -1137,7 +1312,9 @@ make_message(struct bootp **bootpm, const struct interface *ifp, uint8_t type)
 
 toobig:
 	logerrx("%s: DHCP message too big", ifp->name);
-	free(bootp);
+fail:
+	dhcp_pktput(ifp->ctx, udpp, *sizep);
+	*udppm = NULL;
 	return -1;
 }
 
@@ -1159,6 +1336,7 @@ read_lease(struct interface *ifp, struct bootp **bootp)
 
 	/* Safety */
 	*bootp = NULL;
+	dhcp_optindex_clear(ifp->ctx);
 
 	if (state->leasefile[0] == '\0') {
 		logdebugx("reading standard input");
@@ -1219,6 +1397,8 @@ read_lease(struct interface *ifp, struct bootp **bootp)
 #endif
 
 out:
+	/* buf is about to go out of scope. */
+	dhcp_optindex_clear(ifp->ctx);
 	*bootp = malloc(bytes);
 	if (*bootp == NULL) {
 		logerr(__func__);
@@ -1229,19 +1409,11 @@ out:
 }
 
 static const struct dhcp_opt *
-dhcp_getoverride(const struct if_options *ifo, unsigned int o)
+dhcp_getoverride(struct if_options *ifo, unsigned int o)
 {
-	size_t i;
-	const struct dhcp_opt *opt;
 
-	for (i = 0, opt = ifo->dhcp_override;
-	    i < ifo->dhcp_override_len;
-	    i++, opt++)
-	{
-		if (opt->option == o)
-			return opt;
-	}
-	return NULL;
+	return dhcp_optmap_find(&ifo->dhcp_overmap,
+	    ifo->dhcp_override, ifo->dhcp_override_len, o);
 }
 
 static const uint8_t *
@@ -1249,8 +1421,6 @@ dhcp_getoption(struct dhcpcd_ctx *ctx,
     size_t *os, unsigned int *code, size_t *len,
     const uint8_t *od, size_t ol, struct dhcp_opt **oopt)
 {
-	size_t i;
-	struct dhcp_opt *opt;
 
 	if (od) {
 		if (ol < 2) {
@@ -1266,14 +1436,8 @@ dhcp_getoption(struct dhcpcd_ctx *ctx,
 		}
 	}
 
-	*oopt = NULL;
-	for (i = 0, opt = ctx->dhcp_opts; i < ctx->dhcp_opts_len; i++, opt++) {
-		if (opt->option == *code) {
-			*oopt = opt;
-			break;
-		}
-	}
-
+	*oopt = dhcp_optmap_find(&ctx->dhcp_optmap,
+	    ctx->dhcp_opts, ctx->dhcp_opts_len, *code);
 	return od;
 }
 
@@ -1281,7 +1445,7 @@ ssize_t
 dhcp_env(FILE *fenv, const char *prefix, const struct interface *ifp,
     const struct bootp *bootp, size_t bootp_len)
 {
-	const struct if_options *ifo;
+	struct if_options *ifo;
 	const uint8_t *p;
 	struct in_addr addr;
 	struct in_addr net;
@@ -1292,6 +1456,7 @@ dhcp_env(FILE *fenv, const char *prefix, const struct interface *ifp,
 	uint8_t overl = 0;
 	uint32_t en;
 
+	load_definitions(ifp->ctx, DEFS_DHCP);
 	ifo = ifp->options;
 	if (get_option_uint8(ifp->ctx, &overl, bootp, bootp_len,
 	    DHO_OPTSOVERLOADED) == -1)
@@ -1471,53 +1636,98 @@ dhcp_fallback(void *arg)
 	dhcpcd_startinterface(iface);
 }
 
+static int
+dhcp_compare_xid(__unused void *context, const void *node1, const void *node2)
+{
+	const struct dhcp_state *s1 = node1, *s2 = node2;
+
+	if (s1->xid_key < s2->xid_key)
+		return -1;
+	return s1->xid_key == s2->xid_key ? 0 : 1;
+}
+
+static int
+dhcp_compare_xidkey(__unused void *context, const void *node, const void *key)
+{
+	const struct dhcp_state *state = node;
+	uint32_t xid = *(const uint32_t *)key;
+
+	if (state->xid_key < xid)
+		return -1;
+	return state->xid_key == xid ? 0 : 1;
+}
+
+const rb_tree_ops_t dhcp_xid_ops = {
+	.rbto_compare_nodes = dhcp_compare_xid,
+	.rbto_compare_key = dhcp_compare_xidkey,
+	.rbto_node_offset = offsetof(struct dhcp_state, xid_tree),
+	.rbto_context = NULL
+};
+
+static void
+dhcp_unindex_xid(struct interface *ifp)
+{
+	struct dhcp_state *state = D_STATE(ifp);
+
+	if (!state->xid_indexed)
+		return;
+	rb_tree_remove_node(&ifp->ctx->dhcp_xids, state);
+	state->xid_indexed = false;
+}
+
+/* Set the xid and file it so inbound messages can find us.
+ * A duplicate xid is not filed and so won't match redirects. */
+static void
+dhcp_set_xid(struct interface *ifp, uint32_t xid)
+{
+	struct dhcp_state *state = D_STATE(ifp);
+
+	dhcp_unindex_xid(ifp);
+	state->xid = state->xid_key = xid;
+	if (rb_tree_insert_node(&ifp->ctx->dhcp_xids, state) == state)
+		state->xid_indexed = true;
+
+	/* As the xid changes, re-apply the filter.
+	 * This is optional as replies can no longer be redirected
+	 * to interfaces sharing a hardware address. */
+	if (state->bpf != NULL && ifp->options->xidfilter) {
+		if (bpf_bootp(state->bpf, NULL) == -1)
+			logerr(__func__); /* try to continue */
+	}
+}
+
 static void
 dhcp_new_xid(struct interface *ifp)
 {
 	struct dhcp_state *state;
-	const struct interface *ifp1;
 	const struct dhcp_state *state1;
+	uint32_t xid;
 
 	state = D_STATE(ifp);
 	if (ifp->options->options & DHCPCD_XID_HWADDR &&
-	    ifp->hwlen >= sizeof(state->xid))
+	    ifp->hwlen >= sizeof(xid))
 		/* The lower bits are probably more unique on the network */
-		memcpy(&state->xid,
-		    (ifp->hwaddr + ifp->hwlen) - sizeof(state->xid),
-		    sizeof(state->xid));
+		memcpy(&xid, (ifp->hwaddr + ifp->hwlen) - sizeof(xid),
+		    sizeof(xid));
 	else {
 again:
-		state->xid = arc4random();
+		xid = arc4random();
 	}
 
 	/* Ensure it's unique */
-	TAILQ_FOREACH(ifp1, ifp->ctx->ifaces, next) {
-		if (ifp == ifp1)
-			continue;
-		if ((state1 = D_CSTATE(ifp1)) == NULL)
-			continue;
-		if (state1->xid == state->xid)
-			break;
-	}
-	if (ifp1 != NULL) {
+	state1 = rb_tree_find_node(&ifp->ctx->dhcp_xids, &xid);
+	if (state1 != NULL && state1 != state) {
 		if (ifp->options->options & DHCPCD_XID_HWADDR &&
-		    ifp->hwlen >= sizeof(state->xid))
+		    ifp->hwlen >= sizeof(xid))
 		{
 			logerrx("%s: duplicate xid on %s",
-			    ifp->name, ifp1->name);
-			    return;
+			    ifp->name, state1->ifp->name);
+			dhcp_set_xid(ifp, xid);
+			return;
 		}
 		goto again;
 	}
-
-	/* We can't do this when sharing leases across interfaes */
-#if 0
-	/* As the XID changes, re-apply the filter. */
-	if (state->bpf_fd != -1) {
-		if (bpf_bootp(ifp, state->bpf_fd) == -1)
-			logerr(__func__); /* try to continue */
-	}
-#endif
+	dhcp_set_xid(ifp, xid);
 }
 
 static void
@@ -1532,7 +1742,7 @@ dhcp_closebpf(struct interface *ifp)
 #endif
 
 	if (state->bpf != NULL) {
-		eloop_event_delete(ctx->eloop, state->bpf->bpf_fd);
+		bpf_event_delete(state->bpf, ctx->eloop);
 		bpf_close(state->bpf);
 		state->bpf = NULL;
 	}
@@ -1596,6 +1806,10 @@ dhcp_openudp(struct in_addr *ia)
 	if (setsockopt(s, SOL_SOCKET, SO_RERROR, &n, sizeof(n)) == -1)
 		goto errexit;
 #endif
+#ifdef SO_RXTIME
+	if (setsockopt(s, SOL_SOCKET, SO_RXTIME, &n, sizeof(n)) == -1)
+		goto errexit;
+#endif
 
 	memset(&sin, 0, sizeof(sin));
 	sin.sin_family = AF_INET;
@@ -1612,39 +1826,17 @@ errexit:
 	return -1;
 }
 
-static uint16_t
-in_cksum(const void *data, size_t len, uint32_t *isum)
-{
-	const uint16_t *word = data;
-	uint32_t sum = isum != NULL ? *isum : 0;
-
-	for (; len > 1; len -= sizeof(*word))
-		sum += *word++;
-
-	if (len == 1)
-		sum += htons((uint16_t)(*(const uint8_t *)word << 8));
-
-	if (isum != NULL)
-		*isum = sum;
-
-	sum = (sum >> 16) + (sum & 0xffff);
-	sum += (sum >> 16);
-
-	return (uint16_t)~sum;
-}
-
-static struct bootp_pkt *
-dhcp_makeudppacket(size_t *sz, const uint8_t *data, size_t length,
+/* Write the IP and UDP headers in front of the BOOTP message
+ * already in udpp. */
+static size_t
+dhcp_filludppacket(struct bootp_pkt *udpp, size_t length,
 	struct in_addr source, struct in_addr dest)
 {
-	struct bootp_pkt *udpp;
-	struct ip *ip;
-	struct udphdr *udp;
+	struct ip *ip = &udpp->ip;
+	struct udphdr *udp = &udpp->udp;
 
-	if ((udpp = calloc(1, sizeof(*ip) + sizeof(*udp) + length)) == NULL)
-		return NULL;
-	ip = &udpp->ip;
-	udp = &udpp->udp;
+	memset(ip, 0, sizeof(*ip));
+	memset(udp, 0, sizeof(*udp));
 
 	/* OK, this is important :)
 	 * We copy the data to our packet and then create a small part of the
@@ -1655,8 +1847,6 @@ dhcp_makeudppacket(size_t *sz, const uint8_t *data, size_t length,
 	 * If we don't do the ordering like so then the udp checksum will be
 	 * broken, so find another way of doing it! */
 
-	memcpy(&udpp->bootp, data, length);
-
 	ip->ip_p = IPPROTO_UDP;
 	ip->ip_src.s_addr = source.s_addr;
 	if (dest.s_addr == 0)
@@ -1679,8 +1869,15 @@ dhcp_makeudppacket(size_t *sz, const uint8_t *data, size_t length,
 	if (ip->ip_sum == 0)
 		ip->ip_sum = 0xffff; /* RFC 768 */
 
-	*sz = sizeof(*ip) + sizeof(*udp) + length;
-	return udpp;
+	return sizeof(*ip) + sizeof(*udp) + length;
+}
+
+static void
+dhcp_message_clear(struct dhcp_state *state)
+{
+
+	dhcp_pktput(state->ifp->ctx, state->send_pkt, state->send_size);
+	state->send_pkt = NULL;
 }
 
 static ssize_t
@@ -1718,7 +1915,8 @@ dhcp_sendudp(struct interface *ifp, struct in_addr *to, void *data, size_t len)
 	return sendmsg(ctx->udp_wfd, &msg, 0);
 }
 
-static void
+/* Returns true if the message was sent rather than deferred or lost. */
+static bool
 send_message(struct interface *ifp, uint8_t type,
     void (*callback)(void *))
 {
@@ -1726,24 +1924,35 @@ send_message(struct interface *ifp, uint8_t type,
 	struct if_options *ifo = ifp->options;
 	struct bootp *bootp;
 	struct bootp_pkt *udp;
-	size_t len, ulen;
+	size_t len, ulen, size = 0;
 	ssize_t r;
 	struct in_addr from, to;
 	unsigned int RT;
+	uint16_t osecs = 0;
+	bool cache, retrans = false, sent = false;
 
 	if (callback == NULL) {
 		/* No carrier? Don't bother sending the packet. */
 		if (!if_is_link_up(ifp))
-			return;
+			return false;
 		logdebugx("%s: sending %s with xid 0x%x",
 		    ifp->name,
 		    ifo->options & DHCPCD_BOOTP ? "BOOTP" : get_dhcp_op(type),
 		    state->xid);
 		RT = 0; /* bogus gcc warning */
 	} else {
+		/* Before the interval grows. */
+		if (if_is_link_up(ifp) &&
+		    (RT = dhcpcd_pace(ifp->ctx)) != 0)
+		{
+			eloop_timeout_add_msec(ifp->ctx->eloop,
+			    RT, callback, ifp);
+			return false;
+		}
 		if (state->interval == 0)
 			state->interval = 4;
 		else {
+			retrans = true;
 			state->interval *= 2;
 			if (state->interval > 64)
 				state->interval = 64;
@@ -1760,11 +1969,47 @@ send_message(struct interface *ifp, uint8_t type,
 		    state->xid,
 		    (float)RT / MSEC_PER_SEC);
 	}
+	if (type == DHCP_DISCOVER)
+		dhcpcd_phase(ifp->ctx, ifp, PHASE_DISCOVER);
+	else if (type == DHCP_REQUEST)
+		dhcpcd_phase(ifp->ctx, ifp, PHASE_REQUEST);
 
-	r = make_message(&bootp, ifp, type);
-	if (r == -1)
-		goto fail;
-	len = (size_t)r;
+	/* Retransmissions resend the same message with only secs updated.
+	 * A new xid, message type or callback starts a new exchange
+	 * which could change the content, so the message is built again.
+	 * Authenticated messages always change. */
+	cache = callback != NULL;
+#ifdef AUTH
+	if (ifo->auth.options & DHCPCD_AUTH_SEND)
+		cache = false;
+#endif
+	if (cache && state->send_pkt != NULL &&
+	    state->send_type == type &&
+	    state->send_xid == state->xid &&
+	    state->send_cb == callback)
+	{
+		udp = state->send_pkt;
+		len = state->send_len;
+		osecs = udp->bootp.secs;
+		udp->bootp.secs = dhcp_message_secs(state);
+	} else {
+		/* Only a message taking its place drops the cached one. */
+		if (cache)
+			dhcp_message_clear(state);
+		r = make_message(&udp, &size, ifp, type);
+		if (r == -1)
+			goto fail;
+		len = (size_t)r;
+		if (cache) {
+			state->send_pkt = udp;
+			state->send_size = size;
+			state->send_len = len;
+			state->send_type = type;
+			state->send_xid = state->xid;
+			state->send_cb = callback;
+		}
+	}
+	bootp = &udp->bootp;
 
 	if (!(state->added & (STATE_FAKE | STATE_EXPIRED)) &&
 	    state->addr != NULL &&
@@ -1793,26 +2038,40 @@ send_message(struct interface *ifp, uint8_t type,
 	 */
 	if (to.s_addr != INADDR_BROADCAST) {
 		if (dhcp_sendudp(ifp, &to, bootp, len) != -1)
-			goto out;
+			goto sent;
 		logerr("%s: dhcp_sendudp", ifp->name);
 	}
 
 	if (dhcp_openbpf(ifp) == -1)
 		goto out;
 
-	udp = dhcp_makeudppacket(&ulen, (uint8_t *)bootp, len, from, to);
-	if (udp == NULL) {
-		logerr("%s: dhcp_makeudppacket", ifp->name);
-		r = 0;
+	/* A retransmission to the same addresses only changes secs and
+	 * the IP id, so patch the checksums rather than sum it all again. */
+	if (udp == state->send_pkt && udp->ip.ip_v == IPVERSION &&
+	    udp->ip.ip_src.s_addr == from.s_addr &&
+	    udp->ip.ip_dst.s_addr ==
+	    (to.s_addr == 0 ? INADDR_BROADCAST : to.s_addr))
+	{
+		uint16_t oid = udp->ip.ip_id;
+
+		if (udp->udp.uh_sum != 0) {
+			udp->udp.uh_sum = in_cksum_update(udp->udp.uh_sum,
+			    osecs, udp->bootp.secs);
+			if (udp->udp.uh_sum == 0)
+				udp->udp.uh_sum = 0xffff; /* RFC 768 */
+		}
+		udp->ip.ip_id = (uint16_t)arc4random_uniform(UINT16_MAX);
+		udp->ip.ip_sum = in_cksum_update(udp->ip.ip_sum,
+		    oid, udp->ip.ip_id);
+		ulen = sizeof(udp->ip) + sizeof(udp->udp) + len;
+	} else
+		ulen = dhcp_filludppacket(udp, len, from, to);
 #ifdef PRIVSEP
-	} else if (ifp->ctx->options & DHCPCD_PRIVSEP) {
+	if (ifp->ctx->options & DHCPCD_PRIVSEP)
 		r = ps_bpf_sendbootp(ifp, udp, ulen);
-		free(udp);
+	else
 #endif
-	} else {
 		r = bpf_send(state->bpf, ETHERTYPE_IP, udp, ulen);
-		free(udp);
-	}
 	/* If we failed to send a raw packet this normally means
 	 * we don't have the ability to work beneath the IP layer
 	 * for this interface.
@@ -1833,16 +2092,33 @@ send_message(struct interface *ifp, uint8_t type,
 			    NULL, ifp);
 			callback = NULL;
 		}
+		goto out;
 	}
 
+sent:
+	sent = true;
+	PROBE4(dhcp_send, (const char *)ifp->name, type, state->xid, len);
+	STATS_COUNT(ifp, CNTP_DHCP, CNT_SENT);
+	if (retrans)
+		STATS_COUNT(ifp, CNTP_DHCP, CNT_RETRANS);
+	/* Requests and renewals are for the server of the lease. */
+	if (callback != NULL)
+		srv_sent(&state->srvs,
+		    (state->state == DHS_REQUEST ||
+		    state->state == DHS_RENEW) &&
+		    state->lease.server.s_addr != INADDR_ANY ?
+		    &state->lease.server : NULL,
+		    sizeof(state->lease.server), retrans);
 out:
-	free(bootp);
+	if (udp != state->send_pkt)
+		dhcp_pktput(ifp->ctx, udp, size);
 
 fail:
 	/* Even if we fail to send a packet we should continue as we are
 	 * as our failure timeouts will change out codepath when needed. */
 	if (callback != NULL)
 		eloop_timeout_add_msec(ifp->ctx->eloop, RT, callback, ifp);
+	return sent;
 }
 
 static void
@@ -1866,6 +2142,26 @@ send_request(void *arg)
 	send_message((struct interface *)arg, DHCP_REQUEST, send_request);
 }
 
+/* INIT-REBOOT, with a DISCOVER racing it if asked.
+ * The DISCOVER shares the REQUEST backoff, and so its pacing, but has
+ * its own xid so that a NAK always belongs to the INIT-REBOOT. */
+static void
+send_reboot(void *arg)
+{
+	struct interface *ifp = arg;
+	struct dhcp_state *state = D_STATE(ifp);
+	uint32_t xid;
+
+	if (!send_message(ifp, DHCP_REQUEST, send_reboot) ||
+	    state->race_xid == 0 || state->state != DHS_REBOOT)
+		return;
+
+	xid = state->xid;
+	state->xid = state->race_xid;
+	send_message(ifp, DHCP_DISCOVER, NULL);
+	state->xid = xid;
+}
+
 static void
 send_renew(void *arg)
 {
@@ -1887,7 +2183,7 @@ dhcp_discover(void *arg)
 	struct dhcp_state *state = D_STATE(ifp);
 	struct if_options *ifo = ifp->options;
 
-	state->state = DHS_DISCOVER;
+	DHCP_SETSTATE(ifp, state, DHS_DISCOVER);
 	dhcp_new_xid(ifp);
 	eloop_timeout_delete(ifp->ctx->eloop, NULL, ifp);
 	if (!(state->added & STATE_EXPIRED)) {
@@ -1915,10 +2211,32 @@ dhcp_request(void *arg)
 	struct interface *ifp = arg;
 	struct dhcp_state *state = D_STATE(ifp);
 
-	state->state = DHS_REQUEST;
+	DHCP_SETSTATE(ifp, state, DHS_REQUEST);
 	send_request(ifp);
 }
 
+/* With fastest_server, an offer from a server which has stopped
+ * answering requests is held briefly for one from a healthy server. */
+static bool
+dhcp_holdoffer(struct interface *ifp, const struct timespec *rxtime)
+{
+	struct dhcp_state *state = D_STATE(ifp);
+	unsigned int hold;
+
+	eloop_timeout_delete(ifp->ctx->eloop, dhcp_request, ifp);
+	if (!ifp->options->fastest_server ||
+	    state->lease.server.s_addr == INADDR_ANY)
+		return false;
+	hold = srv_hold(&state->srvs, &state->lease.server,
+	    sizeof(state->lease.server), rxtime);
+	if (hold == 0)
+		return false;
+	logdebugx("%s: holding offer from %s for %u ms",
+	    ifp->name, inet_ntoa(state->lease.server), hold);
+	eloop_timeout_add_msec(ifp->ctx->eloop, hold, dhcp_request, ifp);
+	return true;
+}
+
 static void
 dhcp_expire(void *arg)
 {
@@ -1962,12 +2280,12 @@ dhcp_startrenew(void *arg)
 		return;
 
 	/* Remove the timeout as the renew may have been forced. */
-	eloop_timeout_delete(ifp->ctx->eloop, dhcp_startrenew, ifp);
+	eloop_timer_cancel(ifp->ctx->eloop, &state->renew_timer);
 
 	lease = &state->lease;
 	logdebugx("%s: renewing lease of %s", ifp->name,
 	    inet_ntoa(lease->addr));
-	state->state = DHS_RENEW;
+	DHCP_SETSTATE(ifp, state, DHS_RENEW);
 	dhcp_new_xid(ifp);
 	state->interval = 0;
 	send_renew(ifp);
@@ -1990,7 +2308,7 @@ dhcp_rebind(void *arg)
 	logwarnx("%s: failed to renew DHCP, rebinding", ifp->name);
 	logdebugx("%s: expire in %"PRIu32" seconds",
 	    ifp->name, lease->leasetime - lease->rebindtime);
-	state->state = DHS_REBIND;
+	DHCP_SETSTATE(ifp, state, DHS_REBIND);
 	eloop_timeout_delete(ifp->ctx->eloop, send_renew, ifp);
 	state->lease.server.s_addr = INADDR_ANY;
 	state->interval = 0;
@@ -2011,6 +2329,7 @@ dhcp_finish_dad(struct interface *ifp, struct in_addr *ia)
 		return;
 
 	logdebugx("%s: DAD completed for %s", ifp->name, inet_ntoa(*ia));
+	dhcpcd_phase(ifp->ctx, ifp, PHASE_ARP);
 	if (!(ifp->options->options & DHCPCD_INFORM))
 		dhcp_bind(ifp);
 #ifndef IN_IFF_DUPLICATED
@@ -2229,6 +2548,8 @@ dhcp_bind(struct interface *ifp)
 	struct dhcp_lease *lease = &state->lease;
 	uint8_t old_state;
 
+	/* The exchange is over, let another interface have the buffer. */
+	dhcp_message_clear(state);
 	state->reason = NULL;
 	/* If we don't have an offer, we are re-binding a lease on preference,
 	 * normally when two interfaces have a lease matching IP addresses. */
@@ -2254,7 +2575,9 @@ dhcp_bind(struct interface *ifp)
 		lease->leasetime = DHCP_INFINITE_LIFETIME;
 		state->reason = "INFORM";
 	} else {
-		if (lease->frominfo)
+		if (state->adopted)
+			state->reason = "REBOOT";
+		else if (lease->frominfo)
 			state->reason = "TIMEOUT";
 		if (lease->leasetime == DHCP_INFINITE_LIFETIME) {
 			lease->renewaltime =
@@ -2288,6 +2611,26 @@ dhcp_bind(struct interface *ifp)
 				    "rebind time, forcing to %"PRIu32" seconds",
 				    ifp->name, lease->renewaltime);
 			}
+			if (ifp->options->renew_spread != 0) {
+				lease->rebindtime = dhcp_spread(
+				    lease->rebindtime,
+				    ifp->options->renew_spread);
+				lease->renewaltime = dhcp_spread(
+				    lease->renewaltime,
+				    ifp->options->renew_spread);
+				if (lease->renewaltime > lease->rebindtime)
+					lease->renewaltime = lease->rebindtime;
+			}
+			if (state->adopted) {
+				uint32_t age = state->adopted_age;
+
+				/* Due to renew now if that has passed. */
+				lease->leasetime -= age;
+				lease->rebindtime = lease->rebindtime > age ?
+				    lease->rebindtime - age : 0;
+				lease->renewaltime = lease->renewaltime > age ?
+				    lease->renewaltime - age : 0;
+			}
 			if (state->state == DHS_RENEW && state->addr &&
 			    lease->addr.s_addr == state->addr->addr.s_addr &&
 			    !(state->added & STATE_FAKE))
@@ -2324,24 +2667,27 @@ dhcp_bind(struct interface *ifp)
 	if (lease->leasetime == DHCP_INFINITE_LIFETIME)
 		lease->renewaltime = lease->rebindtime = lease->leasetime;
 	else {
-		eloop_timeout_add_sec(ctx->eloop,
-		    lease->renewaltime, dhcp_startrenew, ifp);
-		eloop_timeout_add_sec(ctx->eloop,
-		    lease->rebindtime, dhcp_rebind, ifp);
+		/* Renew and rebind are not time critical, so let them
+		 * share a wakeup with anything else due around then. */
+		eloop_timer_add_sec_slack(ctx->eloop, &state->renew_timer,
+		    lease->renewaltime, DHCP_TIMER_SLACK, dhcp_startrenew, ifp);
+		eloop_timeout_add_sec_slack(ctx->eloop,
+		    lease->rebindtime, DHCP_TIMER_SLACK, dhcp_rebind, ifp);
 		eloop_timeout_add_sec(ctx->eloop,
 		    lease->leasetime, dhcp_expire, ifp);
 		logdebugx("%s: renew in %"PRIu32" seconds, rebind in %"PRIu32
 		    " seconds",
 		    ifp->name, lease->renewaltime, lease->rebindtime);
 	}
-	state->state = DHS_BOUND;
+	DHCP_SETSTATE(ifp, state, DHS_BOUND);
+	state->adopted = false;
+	clock_gettime(CLOCK_MONOTONIC, &state->bound);
 	if (!state->lease.frominfo &&
 	    !(ifo->options & (DHCPCD_INFORM | DHCPCD_STATIC))) {
-		logdebugx("%s: writing lease: %s",
-		    ifp->name, state->leasefile);
-		if (dhcp_writefile(ifp->ctx, state->leasefile, 0640,
-		    state->new, state->new_len) == -1)
-			logerr("dhcp_writefile: %s", state->leasefile);
+		if (leasewb_write(ifp, state->leasefile,
+		    state->new, state->new_len, offsetof(struct bootp, flags),
+		    lease->leasetime, lease->renewaltime) == -1)
+			logerr("leasewb_write: %s", state->leasefile);
 	}
 
 	old_state = state->added;
@@ -2352,6 +2698,7 @@ dhcp_bind(struct interface *ifp)
 
 	/* Add the address */
 	ipv4_applyaddr(ifp);
+	dhcpcd_phase(ctx, ifp, PHASE_BOUND);
 
 	/* If not in master mode, open an address specific socket. */
 	if (ctx->options & DHCPCD_MASTER ||
@@ -2384,12 +2731,13 @@ dhcp_bind(struct interface *ifp)
 }
 
 static size_t
-dhcp_message_new(struct bootp **bootp,
+dhcp_message_new(struct dhcpcd_ctx *ctx, struct bootp **bootp,
     const struct in_addr *addr, const struct in_addr *mask)
 {
 	uint8_t *p;
 	uint32_t cookie;
 
+	dhcp_optindex_clear(ctx);
 	if ((*bootp = calloc(1, sizeof(**bootp))) == NULL)
 		return 0;
 
@@ -2429,7 +2777,7 @@ dhcp_arp_address(struct interface *ifp)
 	ia = ipv4_iffindaddr(ifp, &addr, NULL);
 #ifdef IN_IFF_NOTUSEABLE
 	if (ia == NULL || ia->addr_flags & IN_IFF_NOTUSEABLE) {
-		state->state = DHS_PROBE;
+		DHCP_SETSTATE(ifp, state, DHS_PROBE);
 		if (ia == NULL) {
 			struct dhcp_lease l;
 
@@ -2457,7 +2805,7 @@ dhcp_arp_address(struct interface *ifp)
 			return -1;
 
 		if (ia == NULL) {
-			state->state = DHS_PROBE;
+			DHCP_SETSTATE(ifp, state, DHS_PROBE);
 			get_lease(ifp, &l, state->offer, state->offer_len);
 			loginfox("%s: probing address %s/%d",
 			    ifp->name, inet_ntoa(l.addr), inet_ntocidr(l.mask));
@@ -2522,7 +2870,7 @@ dhcp_static(struct interface *ifp)
 		return;
 	}
 
-	state->offer_len = dhcp_message_new(&state->offer,
+	state->offer_len = dhcp_message_new(ifp->ctx, &state->offer,
 	    ia ? &ia->addr : &ifo->req_addr,
 	    ia ? &ia->mask : &ifo->req_mask);
 	if (state->offer_len)
@@ -2543,7 +2891,7 @@ dhcp_inform(struct interface *ifp)
 	state = D_STATE(ifp);
 	ifo = ifp->options;
 
-	state->state = DHS_INFORM;
+	DHCP_SETSTATE(ifp, state, DHS_INFORM);
 	free(state->offer);
 	state->offer = NULL;
 	state->offer_len = 0;
@@ -2572,8 +2920,8 @@ dhcp_inform(struct interface *ifp)
 			if (ia != NULL)
 				/* Netmask must be different, delete it. */
 				ipv4_deladdr(ia, 1);
-			state->offer_len = dhcp_message_new(&state->offer,
-			    &ifo->req_addr, &ifo->req_mask);
+			state->offer_len = dhcp_message_new(ifp->ctx,
+			    &state->offer, &ifo->req_addr, &ifo->req_mask);
 #ifdef ARP
 			if (dhcp_arp_address(ifp) != 1)
 				return;
@@ -2585,7 +2933,7 @@ dhcp_inform(struct interface *ifp)
 	}
 
 	state->addr = ia;
-	state->offer_len = dhcp_message_new(&state->offer,
+	state->offer_len = dhcp_message_new(ifp->ctx, &state->offer,
 	    &ia->addr, &ia->mask);
 	if (state->offer_len) {
 		dhcp_new_xid(ifp);
@@ -2602,6 +2950,7 @@ dhcp_reboot_newopts(struct interface *ifp, unsigned long long oldopts)
 
 	if (state == NULL || state->state == DHS_NONE)
 		return;
+	dhcp_message_clear(state);
 	ifo = ifp->options;
 	if ((ifo->options & (DHCPCD_INFORM | DHCPCD_STATIC) &&
 		(state->addr == NULL ||
@@ -2654,7 +3003,7 @@ dhcp_reboot(struct interface *ifp)
 	if (state == NULL || state->state == DHS_NONE)
 		return;
 	ifo = ifp->options;
-	state->state = DHS_REBOOT;
+	DHCP_SETSTATE(ifp, state, DHS_REBOOT);
 	state->interval = 0;
 
 	if (ifo->options & DHCPCD_LINK && !if_is_link_up(ifp)) {
@@ -2700,6 +3049,13 @@ dhcp_reboot(struct interface *ifp)
 		arp_ifannounceaddr(ifp, &state->lease.addr);
 #endif
 
+	state->race_xid = 0;
+	if (ifo->options & DHCPCD_PARALLEL_REBOOT &&
+	    !(ifo->options & DHCPCD_XID_HWADDR))
+	{
+		dhcp_new_xid(ifp);
+		state->race_xid = state->xid;
+	}
 	dhcp_new_xid(ifp);
 	state->lease.server.s_addr = INADDR_ANY;
 	eloop_timeout_delete(ifp->ctx->eloop, NULL, ifp);
@@ -2720,7 +3076,26 @@ dhcp_reboot(struct interface *ifp)
 
 	/* Don't bother ARP checking as the server could NAK us first.
 	 * Don't call dhcp_request as that would change the state */
-	send_request(ifp);
+	send_reboot(ifp);
+}
+
+/* The last run left the address of this lease on the interface and the
+ * lease hasn't expired, so carry on using it until it's due to renew. */
+static void
+dhcp_adopt(struct interface *ifp, uint32_t age)
+{
+	struct dhcp_state *state = D_STATE(ifp);
+
+	loginfox("%s: adopting %s from the last run",
+	    ifp->name, inet_ntoa(state->lease.addr));
+	/* Drop the fake copy so the offer is bound in its place. */
+	free(state->new);
+	state->new = NULL;
+	state->new_len = 0;
+	state->added = STATE_ADDED;
+	state->adopted = true;
+	state->adopted_age = age;
+	dhcp_bind(ifp);
 }
 
 void
@@ -2739,6 +3114,7 @@ dhcp_drop(struct interface *ifp, const char *reason)
 		return;
 	}
 
+	dhcp_message_clear(state);
 #ifdef ARP
 	if (state->addr != NULL)
 		arp_freeaddr(ifp, &state->addr->addr);
@@ -2754,7 +3130,7 @@ dhcp_drop(struct interface *ifp, const char *reason)
 		 * re-enter so guard by setting the state. */
 		if (state->state == DHS_RELEASE)
 			return;
-		state->state = DHS_RELEASE;
+		DHCP_SETSTATE(ifp, state, DHS_RELEASE);
 
 		dhcp_unlink(ifp->ctx, state->leasefile);
 		if (if_is_link_up(ifp) &&
@@ -2795,7 +3171,7 @@ dhcp_drop(struct interface *ifp, const char *reason)
 	 * up by a new BPF state. */
 	dhcp_close(ifp);
 
-	state->state = DHS_NONE;
+	DHCP_SETSTATE(ifp, state, DHS_NONE);
 	free(state->offer);
 	state->offer = NULL;
 	state->offer_len = 0;
@@ -2859,7 +3235,7 @@ log_dhcp(int loglevel, const char *msg,
 			size_t al, tmpl;
 
 			al = strlen(a);
-			tmpl = (al * 4) + 1;
+			tmpl = PRINT_STRING_SIZE(OT_STRING, al);
 			tmp = malloc(tmpl);
 			if (tmp == NULL) {
 				logerr(__func__);
@@ -2914,33 +3290,31 @@ log_dhcp(int loglevel, const char *msg,
  * Try and re-direct it here. */
 static void
 dhcp_redirect_dhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
-    const struct in_addr *from)
+    const struct in_addr *from, const struct timespec *rxtime)
 {
 	struct interface *ifn;
 	const struct dhcp_state *state;
 	uint32_t xid;
 
 	xid = ntohl(bootp->xid);
-	TAILQ_FOREACH(ifn, ifp->ctx->ifaces, next) {
-		if (ifn == ifp)
-			continue;
-		state = D_CSTATE(ifn);
-		if (state == NULL || state->state == DHS_NONE)
-			continue;
-		if (state->xid != xid)
-			continue;
-		if (ifn->hwlen <= sizeof(bootp->chaddr) &&
-		    memcmp(bootp->chaddr, ifn->hwaddr, ifn->hwlen))
-			continue;
-		logdebugx("%s: redirecting DHCP message to %s",
-		    ifp->name, ifn->name);
-		dhcp_handledhcp(ifn, bootp, bootp_len, from);
-	}
+	state = rb_tree_find_node(&ifp->ctx->dhcp_xids, &xid);
+	if (state == NULL || state->state == DHS_NONE)
+		return;
+	ifn = state->ifp;
+	if (ifn == ifp)
+		return;
+	if (ifn->hwlen <= sizeof(bootp->chaddr) &&
+	    memcmp(bootp->chaddr, ifn->hwaddr, ifn->hwlen))
+		return;
+	logdebugx("%s: redirecting DHCP message to %s", ifp->name, ifn->name);
+	dhcp_optindex_clear(ifp->ctx);
+	dhcp_handledhcp(ifn, bootp, bootp_len, from, rxtime);
+	dhcp_optindex_clear(ifp->ctx);
 }
 
 static void
 dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
-    const struct in_addr *from)
+    const struct in_addr *from, const struct timespec *rxtime)
 {
 	struct dhcp_state *state = D_STATE(ifp);
 	struct if_options *ifo = ifp->options;
@@ -2949,7 +3323,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 	struct in_addr addr;
 	unsigned int i;
 	char *msg;
-	bool bootp_copied;
+	bool bootp_copied, raced;
 	uint32_t v6only_time = 0;
 	bool use_v6only = false;
 #ifdef AUTH
@@ -2975,12 +3349,16 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 		return;
 	}
 
-	if (state->xid != ntohl(bootp->xid)) {
+	/* Replies to a DISCOVER racing INIT-REBOOT carry their own xid. */
+	raced = state->state == DHS_REBOOT && state->race_xid != 0 &&
+	    state->race_xid == ntohl(bootp->xid);
+	if (state->xid != ntohl(bootp->xid) && !raced) {
 		if (IS_STATE_ACTIVE(state))
 			logdebugx("%s: wrong xid 0x%x (expecting 0x%x) from %s",
 			    ifp->name, ntohl(bootp->xid), state->xid,
 			    inet_ntoa(*from));
-		dhcp_redirect_dhcp(ifp, bootp, bootp_len, from);
+		STATS_COUNT(ifp, CNTP_DHCP, CNT_XID);
+		dhcp_redirect_dhcp(ifp, bootp, bootp_len, from, rxtime);
 		return;
 	}
 
@@ -2995,7 +3373,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 			    hwaddr_ntoa(bootp->chaddr, sizeof(bootp->chaddr),
 				    buf, sizeof(buf)));
 		}
-		dhcp_redirect_dhcp(ifp, bootp, bootp_len, from);
+		dhcp_redirect_dhcp(ifp, bootp, bootp_len, from, rxtime);
 		return;
 	}
 
@@ -3027,6 +3405,16 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 		    ifp->name);
 		return;
 	}
+	PROBE3(dhcp_handle, (const char *)ifp->name, type, state->state);
+
+	if (raced && !(type == DHCP_OFFER ||
+	    (type == DHCP_ACK &&
+	    has_option_mask(ifo->requestmask, DHO_RAPIDCOMMIT) &&
+	    get_option(ifp->ctx, bootp, bootp_len, DHO_RAPIDCOMMIT, NULL))))
+	{
+		LOGDHCP(LOG_DEBUG, "ignoring racing reply");
+		return;
+	}
 
 #ifdef AUTH
 	/* Authenticate the message */
@@ -3038,6 +3426,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 		    auth, auth_len) == NULL)
 		{
 			LOGDHCP0(LOG_ERR, "authentication failed");
+			STATS_COUNT(ifp, CNTP_DHCP, CNT_AUTH);
 			return;
 		}
 		if (state->auth.token)
@@ -3048,6 +3437,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 	} else if (ifo->auth.options & DHCPCD_AUTH_SEND) {
 		if (ifo->auth.options & DHCPCD_AUTH_REQUIRE) {
 			LOGDHCP0(LOG_ERR, "no authentication");
+			STATS_COUNT(ifp, CNTP_DHCP, CNT_AUTH);
 			return;
 		}
 		LOGDHCP0(LOG_WARNING, "no authentication");
@@ -3099,6 +3489,14 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 		return;
 	}
 
+	/* Time the server if this answers what we last sent. */
+	if ((state->state == DHS_DISCOVER || raced ?
+	    type == DHCP_OFFER || type == DHCP_ACK :
+	    type == DHCP_ACK || type == DHCP_NAK) &&
+	    get_option_addr(ifp->ctx, &addr, bootp, bootp_len,
+	    DHO_SERVERID) == 0)
+		srv_recv(&state->srvs, &addr, sizeof(addr), rxtime);
+
 	/* reset the message counter */
 	state->interval = 0;
 
@@ -3260,6 +3658,17 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 	}
 #endif
 
+	/* The DISCOVER won the race, so cancel INIT-REBOOT and carry on
+	 * as if we had been soliciting all along. */
+	if (raced) {
+		eloop_timeout_delete(ifp->ctx->eloop, send_reboot, ifp);
+		eloop_timeout_delete(ifp->ctx->eloop, dhcp_expire, ifp);
+		eloop_timeout_delete(ifp->ctx->eloop, dhcp_lastlease, ifp);
+		dhcp_set_xid(ifp, state->race_xid);
+		state->race_xid = 0;
+		DHCP_SETSTATE(ifp, state, DHS_DISCOVER);
+	}
+
 	bootp_copied = false;
 	if ((type == 0 || type == DHCP_OFFER) && state->state == DHS_DISCOVER) {
 		lease->frominfo = 0;
@@ -3276,11 +3685,12 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 		    get_option(ifp->ctx, bootp, bootp_len,
 		    DHO_RAPIDCOMMIT, NULL))
 		{
-			state->state = DHS_REQUEST;
+			DHCP_SETSTATE(ifp, state, DHS_REQUEST);
 			goto rapidcommit;
 		}
 
 		LOGDHCP(LOG_INFO, "offered");
+		dhcpcd_phase(ifp->ctx, ifp, PHASE_OFFER);
 		if (state->offer_len < bootp_len) {
 			free(state->offer);
 			if ((state->offer = malloc(bootp_len)) == NULL) {
@@ -3289,6 +3699,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 				return;
 			}
 		}
+		dhcp_optindex_clear(ifp->ctx);
 		state->offer_len = bootp_len;
 		memcpy(state->offer, bootp, bootp_len);
 		bootp_copied = true;
@@ -3315,7 +3726,8 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 			 * It also seems that some MS DHCP servers actually
 			 * ignore DECLINE if no REQUEST, ie we decline a
 			 * DISCOVER. */
-			dhcp_request(ifp);
+			if (!dhcp_holdoffer(ifp, rxtime))
+				dhcp_request(ifp);
 			return;
 		}
 	}
@@ -3338,7 +3750,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 			    DHO_RAPIDCOMMIT) &&
 			    get_option(ifp->ctx, bootp, bootp_len,
 			    DHO_RAPIDCOMMIT, NULL))
-				state->state = DHS_REQUEST;
+				DHCP_SETSTATE(ifp, state, DHS_REQUEST);
 			else {
 				LOGDHCP(LOG_DEBUG, "ignoring ack of");
 				return;
@@ -3346,6 +3758,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 		}
 
 rapidcommit:
+		dhcpcd_phase(ifp->ctx, ifp, PHASE_ACK);
 		if (!(ifo->options & DHCPCD_INFORM))
 			LOGDHCP(LOG_DEBUG, "acknowledged");
 		else
@@ -3367,6 +3780,7 @@ rapidcommit:
 				return;
 			}
 		}
+		dhcp_optindex_clear(ifp->ctx);
 		state->offer_len = bootp_len;
 		memcpy(state->offer, bootp, bootp_len);
 	}
@@ -3460,7 +3874,9 @@ checksums_valid(void *packet,
 	if (in_cksum(ip, ip_hlen, NULL) != 0)
 		return false;
 
-	if (flags & BPF_PARTIALCSUM)
+	/* The UDP checksum is either not filled in yet or the
+	 * kernel has already verified it. */
+	if (flags & (BPF_PARTIALCSUM | BPF_CSUMVALID))
 		return true;
 
 	udpp = (char *)ip + ip_hlen;
@@ -3491,8 +3907,12 @@ checksums_valid(void *packet,
 
 static void
 dhcp_handlebootp(struct interface *ifp, struct bootp *bootp, size_t len,
-    struct in_addr *from)
+    struct in_addr *from, const struct timespec *rxtime)
 {
+	union {
+		struct bootp bootp;
+		uint8_t buf[DHCP_MIN_LEN];
+	} shortbuf;
 	size_t v;
 
 	if (len < offsetof(struct bootp, vend)) {
@@ -3509,19 +3929,25 @@ dhcp_handlebootp(struct interface *ifp, struct bootp *bootp, size_t len,
 	}
 
 	/* To make our IS_DHCP macro easy, ensure the vendor
-	 * area has at least 4 octets. */
+	 * area has at least 4 octets.
+	 * Pad a copy as the message may be inside the BPF buffer. */
 	v = len - offsetof(struct bootp, vend);
-	while (v < 4) {
-		bootp->vend[v++] = '\0';
-		len++;
+	if (v < 4) {
+		memset(&shortbuf, 0, sizeof(shortbuf));
+		memcpy(shortbuf.buf, bootp, len);
+		bootp = &shortbuf.bootp;
+		len = DHCP_MIN_LEN;
 	}
 
-	dhcp_handledhcp(ifp, bootp, len, from);
+	/* The received message lives in a reused buffer. */
+	dhcp_optindex_clear(ifp->ctx);
+	dhcp_handledhcp(ifp, bootp, len, from, rxtime);
+	dhcp_optindex_clear(ifp->ctx);
 }
 
 void
 dhcp_packet(struct interface *ifp, uint8_t *data, size_t len,
-    unsigned int bpf_flags)
+    unsigned int bpf_flags, const struct timespec *rxtime)
 {
 	struct bootp *bootp;
 	struct in_addr from;
@@ -3560,8 +3986,12 @@ dhcp_packet(struct interface *ifp, uint8_t *data, size_t len,
 			return;
 		}
 		len -= fl;
-		/* Move the data to avoid alignment errors. */
-		memmove(data, data + fl, len);
+		/* The frame may still be in the BPF buffer.
+		 * Only move the data if needed to avoid alignment errors. */
+		if (((uintptr_t)(data + fl) & (sizeof(uint32_t) - 1)) == 0)
+			data += fl;
+		else
+			memmove(data, data + fl, len);
 	}
 
 	/* Validate filter. */
@@ -3572,9 +4002,12 @@ dhcp_packet(struct interface *ifp, uint8_t *data, size_t len,
 		return;
 	}
 
+	STATS_COUNT(ifp, CNTP_DHCP, CNT_RECV);
+	PROBE2(dhcp_packet, (const char *)ifp->name, len);
 	if (!checksums_valid(data, &from, bpf_flags)) {
 		logerrx("%s: checksum failure from %s",
 		    ifp->name, inet_ntoa(from));
+		STATS_COUNT(ifp, CNTP_DHCP, CNT_CKSUM);
 		return;
 	}
 
@@ -3586,21 +4019,24 @@ dhcp_packet(struct interface *ifp, uint8_t *data, size_t len,
 	 * dhcpcd can work fine without the vendor area being sent.
 	 */
 	bootp = get_udp_data(data, &udp_len);
-	dhcp_handlebootp(ifp, bootp, udp_len, &from);
+	dhcp_handlebootp(ifp, bootp, udp_len, &from, rxtime);
 }
 
 static void
 dhcp_readbpf(void *arg)
 {
 	struct interface *ifp = arg;
-	uint8_t buf[FRAMELEN_MAX];
+	void *frame;
 	ssize_t bytes;
 	struct dhcp_state *state = D_STATE(ifp);
 	struct bpf *bpf = state->bpf;
 
-	bpf->bpf_flags &= ~BPF_EOF;
+	/* The frame is handled inside the BPF buffer, so stop
+	 * bpf_close() from freeing it while we are still reading. */
+	bpf->bpf_flags &= ~(BPF_EOF | BPF_CLOSED);
+	bpf->bpf_flags |= BPF_READING;
 	while (!(bpf->bpf_flags & BPF_EOF)) {
-		bytes = bpf_read(bpf, buf, sizeof(buf));
+		bytes = bpf_read(bpf, &frame);
 		if (bytes == -1) {
 			if (state->state != DHS_NONE) {
 				logerr("%s: %s", __func__, ifp->name);
@@ -3608,13 +4044,19 @@ dhcp_readbpf(void *arg)
 			}
 			break;
 		}
-		dhcp_packet(ifp, buf, (size_t)bytes, bpf->bpf_flags);
+		if (bytes == 0)
+			break;
+		dhcp_packet(ifp, frame, (size_t)bytes, bpf->bpf_flags,
+		    timespecisset(&bpf->bpf_time) ? &bpf->bpf_time : NULL);
 		/* Check we still have a state after processing. */
 		if ((state = D_STATE(ifp)) == NULL)
 			break;
-		if ((bpf = state->bpf) == NULL)
+		if (state->bpf != bpf)
 			break;
 	}
+	bpf->bpf_flags &= ~BPF_READING;
+	if (bpf->bpf_flags & BPF_CLOSED)
+		bpf_close(bpf);
 }
 
 void
@@ -3624,17 +4066,20 @@ dhcp_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg)
 	struct iovec *iov = &msg->msg_iov[0];
 	struct interface *ifp;
 	const struct dhcp_state *state;
+	struct timespec ts;
+	const struct timespec *rxtime = dhcp_rxtime(msg, &ts);
 
 	ifp = if_findifpfromcmsg(ctx, msg, NULL);
 	if (ifp == NULL) {
 		logerr(__func__);
+		STATS_COUNT(ctx, CNTP_DHCP, CNT_NOIF);
 		return;
 	}
 	state = D_CSTATE(ifp);
 	if (state == NULL) {
 		/* Try re-directing it to another interface. */
 		dhcp_redirect_dhcp(ifp, (struct bootp *)iov->iov_base,
-		    iov->iov_len, &from->sin_addr);
+		    iov->iov_len, &from->sin_addr, rxtime);
 		return;
 	}
 
@@ -3656,8 +4101,9 @@ dhcp_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg)
 	}
 #endif
 
+	STATS_COUNT(ifp, CNTP_DHCP, CNT_RECV);
 	dhcp_handlebootp(ifp, iov->iov_base, iov->iov_len,
-	    &from->sin_addr);
+	    &from->sin_addr, rxtime);
 }
 
 static void
@@ -3676,9 +4122,11 @@ dhcp_readudp(struct dhcpcd_ctx *ctx, struct interface *ifp)
 	union {
 		struct cmsghdr hdr;
 #ifdef IP_RECVIF
-		uint8_t buf[CMSG_SPACE(sizeof(struct sockaddr_dl))];
+		uint8_t buf[CMSG_SPACE(sizeof(struct sockaddr_dl)) +
+		    RXTIME_CMSG_SPACE];
 #else
-		uint8_t buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+		uint8_t buf[CMSG_SPACE(sizeof(struct in_pktinfo)) +
+		    RXTIME_CMSG_SPACE];
 #endif
 	} cmsgbuf = { .buf = { 0 } };
 	struct msghdr msg = {
@@ -3753,8 +4201,7 @@ dhcp_openbpf(struct interface *ifp)
 		return -1;
 	}
 
-	eloop_event_add(ifp->ctx->eloop,
-	    state->bpf->bpf_fd, dhcp_readbpf, ifp);
+	bpf_event_add(state->bpf, ifp->ctx->eloop, dhcp_readbpf, ifp);
 	return 0;
 }
 
@@ -3769,12 +4216,14 @@ dhcp_free(struct interface *ifp)
 	arp_drop(ifp);
 #endif
 	if (state) {
-		state->state = DHS_NONE;
+		DHCP_SETSTATE(ifp, state, DHS_NONE);
+		dhcp_unindex_xid(ifp);
 		free(state->old);
 		free(state->new);
 		free(state->offer);
 		free(state->clientid);
-		free(state);
+		dhcp_message_clear(state);
+		arena_put(&ifp->arena, state);
 	}
 
 	ctx = ifp->ctx;
@@ -3800,6 +4249,10 @@ dhcp_free(struct interface *ifp)
 
 		free(ctx->opt_buffer);
 		ctx->opt_buffer = NULL;
+		ctx->opt_buffer_len = 0;
+		free(ctx->opt_index);
+		ctx->opt_index = NULL;
+		dhcp_pktfreeall(ctx);
 	}
 }
 
@@ -3812,12 +4265,13 @@ dhcp_initstate(struct interface *ifp)
 	if (state != NULL)
 		return 0;
 
-	ifp->if_data[IF_DATA_DHCP] = calloc(1, sizeof(*state));
+	ifp->if_data[IF_DATA_DHCP] = arena_get(&ifp->arena, sizeof(*state));
 	state = D_STATE(ifp);
 	if (state == NULL)
 		return -1;
 
 	state->state = DHS_NONE;
+	state->ifp = ifp;
 	/* 0 is a valid fd, so init to -1 */
 	state->udp_rfd = -1;
 #ifdef ARPING
@@ -3838,9 +4292,10 @@ dhcp_init(struct interface *ifp)
 		return -1;
 
 	state = D_STATE(ifp);
-	state->state = DHS_INIT;
+	DHCP_SETSTATE(ifp, state, DHS_INIT);
 	state->reason = "PREINIT";
 	state->nakoff = 0;
+	dhcp_message_clear(state);
 	dhcp_set_leasefile(state->leasefile, sizeof(state->leasefile),
 	    AF_INET, ifp);
 
@@ -4007,6 +4462,7 @@ dhcp_start1(void *arg)
 			}
 		}
 	}
+	l = 0;
 	if (state->offer) {
 		struct ipv4_addr *ia;
 		time_t mtime;
@@ -4020,6 +4476,7 @@ dhcp_start1(void *arg)
 			/* We still have the IP address from the last lease.
 			 * Fake add the address and routes from it so the lease
 			 * can be cleaned up. */
+			dhcp_optindex_clear(ifp->ctx);
 			state->new = malloc(state->offer_len);
 			if (state->new) {
 				memcpy(state->new,
@@ -4089,8 +4546,12 @@ dhcp_start1(void *arg)
 	    !IS_DHCP(state->offer) ||
 	    ifo->options & DHCPCD_ANONYMOUS)
 		dhcp_discover(ifp);
+	else if (state->added & STATE_FAKE &&
+	    snapshot_owned(ifp, AF_INET, &state->lease.addr))
+		dhcp_adopt(ifp, l);
 	else
 		dhcp_reboot(ifp);
+	snapshot_forget(ifp, AF_INET);
 }
 
 void
@@ -4103,6 +4564,7 @@ dhcp_start(struct interface *ifp)
 
 	if (!(ifp->options->options & DHCPCD_IPV4))
 		return;
+	load_definitions(ifp->ctx, DEFS_DHCP);
 
 	/* If we haven't been given a netmask for our requested address,
 	 * set it now. */
@@ -4135,9 +4597,11 @@ dhcp_start(struct interface *ifp)
 	if (ifp->options->options & DHCPCD_LASTLEASE_EXTEND)
 		ifp->options->options |= DHCPCD_ARP;
 
-	/* No point in delaying a static configuration */
+	/* No point in delaying a static configuration
+	 * or carrying on with what the last run left. */
 	if (ifp->options->options & DHCPCD_STATIC ||
-	    !(ifp->options->options & DHCPCD_INITIAL_DELAY))
+	    !(ifp->options->options & DHCPCD_INITIAL_DELAY) ||
+	    snapshot_owned(ifp, AF_INET, NULL))
 	{
 		dhcp_start1(ifp);
 		return;
@@ -4153,6 +4617,7 @@ dhcp_start(struct interface *ifp)
 #endif
 	delay = MSEC_PER_SEC +
 		(arc4random_uniform(MSEC_PER_SEC * 2) - MSEC_PER_SEC);
+	delay = dhcpcd_startdelay(ifp->ctx, delay);
 	logdebugx("%s: delaying IPv4 for %0.1f seconds",
 	    ifp->name, (float)delay / MSEC_PER_SEC);
 
@@ -4232,7 +4697,8 @@ dhcp_handleifa(int cmd, struct ipv4_addr *ia, pid_t pid)
 
 	free(state->old);
 	state->old = state->new;
-	state->new_len = dhcp_message_new(&state->new, &ia->addr, &ia->mask);
+	state->new_len = dhcp_message_new(ifp->ctx, &state->new,
+	    &ia->addr, &ia->mask);
 	if (state->new == NULL)
 		return ia;
 	if (ifp->flags & IFF_POINTOPOINT) {
@@ -4244,7 +4710,7 @@ dhcp_handleifa(int cmd, struct ipv4_addr *ia, pid_t pid)
 	rt_build(ifp->ctx, AF_INET);
 	script_runreason(ifp, state->reason);
 	if (ifo->options & DHCPCD_INFORM) {
-		state->state = DHS_INFORM;
+		DHCP_SETSTATE(ifp, state, DHS_INFORM);
 		dhcp_new_xid(ifp);
 		state->lease.server.s_addr = INADDR_ANY;
 		state->addr = ia;
@@ -4260,7 +4726,8 @@ dhcp_dump(struct interface *ifp)
 {
 	struct dhcp_state *state;
 
-	ifp->if_data[IF_DATA_DHCP] = state = calloc(1, sizeof(*state));
+	ifp->if_data[IF_DATA_DHCP] = state =
+	    arena_get(&ifp->arena, sizeof(*state));
 	if (state == NULL) {
 		logerr(__func__);
 		return -1;
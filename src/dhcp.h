@@ -85,6 +85,9 @@
 #  define DHCP_MAX_DELAY	1
 #endif
 
+/* Milliseconds renew and rebind may be coalesced with other timers. */
+#define DHCP_TIMER_SLACK	1000
+
 /* DHCP options */
 enum DHO {
 	DHO_PAD                    = 0,
@@ -223,17 +226,35 @@ struct dhcp_state {
 	unsigned int interval;
 	unsigned int nakoff;
 	uint32_t xid;
+	uint32_t race_xid;	/* DISCOVER racing INIT-REBOOT */
+	struct interface *ifp;
+	rb_node_t xid_tree;	/* node in ctx->dhcp_xids */
+	uint32_t xid_key;	/* xid we are filed under */
+	bool xid_indexed;
 	int socket;
 
 	struct bpf *bpf;
 	int udp_rfd;
 	struct ipv4_addr *addr;
 	uint8_t added;
+	unsigned long long renew_timer;
 
 	char leasefile[sizeof(LEASEFILE) + IF_NAMESIZE + (IF_SSIDLEN * 4)];
 	struct timespec started;
+	struct timespec bound;
+	bool adopted;		/* lease carried on from the last run */
+	uint32_t adopted_age;	/* and how long it had run for */
 	unsigned char *clientid;
 	struct authstate auth;
+
+	/* The last message sent, kept for its retransmissions. */
+	struct bootp_pkt *send_pkt;
+	size_t send_size;	/* of the buffer, see dhcp_pktget() */
+	size_t send_len;
+	void (*send_cb)(void *);
+	uint32_t send_xid;
+	uint8_t send_type;
+	struct srv_stats srvs;	/* how each server answers */
 #ifdef ARPING
 	ssize_t arping_index;
 #endif
@@ -259,7 +280,8 @@ ssize_t print_rfc3361(FILE *, const uint8_t *, size_t);
 ssize_t print_rfc3442(FILE *, const uint8_t *, size_t);
 
 int dhcp_openudp(struct in_addr *);
-void dhcp_packet(struct interface *, uint8_t *, size_t, unsigned int);
+void dhcp_packet(struct interface *, uint8_t *, size_t, unsigned int,
+    const struct timespec *);
 void dhcp_recvmsg(struct dhcpcd_ctx *, struct msghdr *);
 void dhcp_printoptions(const struct dhcpcd_ctx *,
     const struct dhcp_opt *, size_t);
@@ -278,6 +300,7 @@ void dhcp_renew(struct interface *);
 void dhcp_bind(struct interface *);
 void dhcp_reboot_newopts(struct interface *, unsigned long long);
 void dhcp_close(struct interface *);
+extern const rb_tree_ops_t dhcp_xid_ops;
 void dhcp_free(struct interface *);
 int dhcp_dump(struct interface *);
 #endif /* INET */
@@ -55,8 +55,10 @@
 #include "if.h"
 #include "if-options.h"
 #include "ipv6nd.h"
+#include "leasewb.h"
 #include "logerr.h"
 #include "privsep.h"
+#include "probe.h"
 #include "script.h"
 
 #ifdef HAVE_SYS_BITOPS_H
@@ -368,14 +370,143 @@ dhcp6_findmoption(void *data, size_t data_len, uint16_t code,
 	return dhcp6_findoption(d, data_len, code, len);
 }
 
+/*
+ * A parsed view of a DHCPv6 message, built by one walk over it.
+ * Options are stored in message order and the options nested in IAs,
+ * IA addresses and IA prefixes follow the option holding them, so the
+ * IA parsing can look up nested options without walking them again.
+ * The entries live in the context, so only one view may be in use.
+ */
+struct dhcp6_optent {
+	uint8_t *data;
+	uint16_t code;
+	uint16_t len;
+	size_t end;		/* index after the last nested option */
+};
+
+struct dhcp6_optview {
+	struct dhcp6_optent *opts;
+	size_t len;
+	int error;		/* EINVAL if a top level option overran */
+};
+
+/* Length of the fixed part before any nested options. */
+static size_t
+dhcp6_optnested(uint16_t code)
+{
+
+	switch (code) {
+	case D6_OPTION_IA_NA:	/* FALLTHROUGH */
+	case D6_OPTION_IA_PD:
+		return sizeof(struct dhcp6_ia_na);
+	case D6_OPTION_IA_TA:
+		return sizeof(struct dhcp6_ia_ta);
+	case D6_OPTION_IA_ADDR:
+		return sizeof(struct dhcp6_ia_addr);
+	case D6_OPTION_IAPREFIX:
+		return sizeof(struct dhcp6_pd_addr);
+	default:
+		return 0;
+	}
+}
+
+static int
+dhcp6_optview_walk(struct dhcpcd_ctx *ctx, struct dhcp6_optview *v,
+    uint8_t *d, size_t l, bool top)
+{
+	struct dhcp6_option o;
+	struct dhcp6_optent *ent;
+	size_t i, nl;
+
+	while (l != 0) {
+		if (l < sizeof(o))
+			goto overflow;
+		memcpy(&o, d, sizeof(o));
+		d += sizeof(o);
+		l -= sizeof(o);
+		o.len = ntohs(o.len);
+		if (l < o.len)
+			goto overflow;
+
+		if (v->len == ctx->dhcp6_optents_len) {
+			size_t n = v->len == 0 ? 16 : v->len * 2;
+
+			ent = reallocarray(ctx->dhcp6_optents, n, sizeof(*ent));
+			if (ent == NULL)
+				return -1;
+			ctx->dhcp6_optents = v->opts = ent;
+			ctx->dhcp6_optents_len = n;
+		}
+		i = v->len++;
+		ent = &v->opts[i];
+		ent->data = d;
+		ent->code = ntohs(o.code);
+		ent->len = o.len;
+		nl = dhcp6_optnested(ent->code);
+		if (nl != 0 && o.len >= nl &&
+		    dhcp6_optview_walk(ctx, v, d + nl, o.len - nl, false) == -1)
+			return -1;
+		v->opts[i].end = v->len;
+		d += o.len;
+		l -= o.len;
+	}
+	return 0;
+
+overflow:
+	/* Stop here, but keep what we found. */
+	if (top)
+		v->error = EINVAL;
+	return 0;
+}
+
+static int
+dhcp6_optview_build(struct dhcpcd_ctx *ctx, struct dhcp6_optview *v,
+    struct dhcp6_message *m, size_t len)
+{
+
+	v->opts = ctx->dhcp6_optents;
+	v->len = 0;
+	v->error = 0;
+	if (len < sizeof(*m)) {
+		v->error = EINVAL;
+		return 0;
+	}
+	return dhcp6_optview_walk(ctx, v, (uint8_t *)m + sizeof(*m),
+	    len - sizeof(*m), true);
+}
+
+/* Find the next option with code, or any option if code is 0,
+ * held by parent or at the top level if parent is NULL.
+ * prev is the last option returned or NULL to start. */
+static const struct dhcp6_optent *
+dhcp6_optview_find(const struct dhcp6_optview *v,
+    const struct dhcp6_optent *parent, const struct dhcp6_optent *prev,
+    uint16_t code)
+{
+	const struct dhcp6_optent *o, *end;
+
+	if (parent == NULL) {
+		o = v->opts;
+		end = v->opts + v->len;
+	} else {
+		o = parent + 1;
+		end = v->opts + parent->end;
+	}
+	if (prev != NULL)
+		o = v->opts + prev->end;
+	for (; o < end; o = v->opts + o->end) {
+		if (code == 0 || o->code == code)
+			return o;
+	}
+	return NULL;
+}
+
 static const uint8_t *
 dhcp6_getoption(struct dhcpcd_ctx *ctx,
     size_t *os, unsigned int *code, size_t *len,
     const uint8_t *od, size_t ol, struct dhcp_opt **oopt)
 {
 	struct dhcp6_option o;
-	size_t i;
-	struct dhcp_opt *opt;
 
 	if (od != NULL) {
 		*os = sizeof(o);
@@ -392,16 +523,8 @@ dhcp6_getoption(struct dhcpcd_ctx *ctx,
 		*code = ntohs(o.code);
 	}
 
-	*oopt = NULL;
-	for (i = 0, opt = ctx->dhcp6_opts;
-	    i < ctx->dhcp6_opts_len; i++, opt++)
-	{
-		if (opt->option == *code) {
-			*oopt = opt;
-			break;
-		}
-	}
-
+	*oopt = dhcp_optmap_find(&ctx->dhcp6_optmap,
+	    ctx->dhcp6_opts, ctx->dhcp6_opts_len, *code);
 	if (od != NULL)
 		return od + sizeof(o);
 	return NULL;
@@ -529,7 +652,8 @@ dhcp6_delegateaddr(struct in6_addr *addr, struct interface *ifp,
 
 	state = D6_STATE(ifp);
 	if (state == NULL) {
-		ifp->if_data[IF_DATA_DHCP6] = calloc(1, sizeof(*state));
+		ifp->if_data[IF_DATA_DHCP6] =
+		    arena_get(&ifp->arena, sizeof(*state));
 		state = D6_STATE(ifp);
 		if (state == NULL) {
 			logerr(__func__);
@@ -633,12 +757,12 @@ dhcp6_makemessage(struct interface *ifp)
 	struct dhcp6_message *m;
 	struct dhcp6_option o;
 	uint8_t *p, *si, *unicast, IA;
-	size_t n, l, len, ml, hl;
+	size_t l, len, ml, hl;
 	uint8_t type;
 	uint16_t si_len, uni_len, n_options;
 	uint8_t *o_lenp;
 	struct if_options *ifo;
-	const struct dhcp_opt *opt, *opt2;
+	const struct dhcp_opt *opt;
 	const struct ipv6_addr *ap;
 	char hbuf[HOSTNAME_MAX_LEN + 1];
 	const char *hostname;
@@ -682,16 +806,12 @@ dhcp6_makemessage(struct interface *ifp)
 		    l < ifp->ctx->dhcp6_opts_len;
 		    l++, opt++)
 		{
-			for (n = 0, opt2 = ifo->dhcp6_override;
-			    n < ifo->dhcp6_override_len;
-			    n++, opt2++)
-			{
-				if (opt->option == opt2->option)
-					break;
-			}
-			if (n < ifo->dhcp6_override_len)
+			if (dhcp_optmap_find(&ifo->dhcp6_overmap,
+			    ifo->dhcp6_override, ifo->dhcp6_override_len,
+			    opt->option) != NULL)
 				continue;
-			if (!DHC_REQOPT(opt, ifo->requestmask6, ifo->nomask6))
+			if (!DHC_REQOPT(opt, ifo->masks->requestmask6,
+			    ifo->masks->nomask6))
 				continue;
 			n_options++;
 			len += sizeof(o.len);
@@ -701,7 +821,8 @@ dhcp6_makemessage(struct interface *ifp)
 		    l < ifo->dhcp6_override_len;
 		    l++, opt++)
 		{
-			if (!DHC_REQOPT(opt, ifo->requestmask6, ifo->nomask6))
+			if (!DHC_REQOPT(opt, ifo->masks->requestmask6,
+			    ifo->masks->nomask6))
 				continue;
 			n_options++;
 			len += sizeof(o.len);
@@ -719,14 +840,14 @@ dhcp6_makemessage(struct interface *ifp)
 			len += sizeof(o) + 1 + hl;
 		}
 
-		if (!has_option_mask(ifo->nomask6, D6_OPTION_MUDURL) &&
+		if (!has_option_mask(ifo->masks->nomask6, D6_OPTION_MUDURL) &&
 		    ifo->mudurl[0])
 			len += sizeof(o) + ifo->mudurl[0];
 
 #ifdef AUTH
 		if ((ifo->auth.options & DHCPCD_AUTH_SENDREQUIRE) !=
 		    DHCPCD_AUTH_SENDREQUIRE &&
-		    DHC_REQ(ifo->requestmask6, ifo->nomask6,
+		    DHC_REQ(ifo->masks->requestmask6, ifo->masks->nomask6,
 		    D6_OPTION_RECONF_ACCEPT))
 			len += sizeof(o); /* Reconfigure Accept */
 #endif
@@ -742,9 +863,9 @@ dhcp6_makemessage(struct interface *ifp)
 		len += sizeof(o) + ifp->ctx->duid_len;
 	}
 
-	if (!has_option_mask(ifo->nomask6, D6_OPTION_USER_CLASS))
+	if (!has_option_mask(ifo->masks->nomask6, D6_OPTION_USER_CLASS))
 		len += dhcp6_makeuser(NULL, ifp);
-	if (!has_option_mask(ifo->nomask6, D6_OPTION_VENDOR_CLASS))
+	if (!has_option_mask(ifo->masks->nomask6, D6_OPTION_VENDOR_CLASS))
 		len += dhcp6_makevendor(NULL, ifp);
 
 	/* IA */
@@ -814,7 +935,8 @@ dhcp6_makemessage(struct interface *ifp)
 
 	if (state->state == DH6S_DISCOVER &&
 	    !(ifp->ctx->options & DHCPCD_TEST) &&
-	    DHC_REQ(ifo->requestmask6, ifo->nomask6, D6_OPTION_RAPID_COMMIT))
+	    DHC_REQ(ifo->masks->requestmask6, ifo->masks->nomask6,
+	    D6_OPTION_RAPID_COMMIT))
 		len += sizeof(o);
 
 	if (m == NULL) {
@@ -857,7 +979,7 @@ dhcp6_makemessage(struct interface *ifp)
 	case DH6S_REQUEST: /* FALLTHROUGH */
 	case DH6S_RENEW:   /* FALLTHROUGH */
 	case DH6S_RELEASE:
-		if (has_option_mask(ifo->nomask6, D6_OPTION_UNICAST)) {
+		if (has_option_mask(ifo->masks->nomask6, D6_OPTION_UNICAST)) {
 			unicast = NULL;
 			break;
 		}
@@ -868,11 +990,11 @@ dhcp6_makemessage(struct interface *ifp)
 		break;
 	}
 
-	/* In non master mode we listen and send from fixed addresses.
+	/* Without the shared socket we listen on fixed addresses.
 	 * We should try and match an address we have to unicast to,
 	 * but for now this is the safest policy. */
-	if (unicast != NULL && !(ifp->ctx->options & DHCPCD_MASTER)) {
-		logdebugx("%s: ignoring unicast option as not master",
+	if (unicast != NULL && !DHCP6_SHARED(ifp->ctx)) {
+		logdebugx("%s: ignoring unicast option as not shared",
 		    ifp->name);
 		unicast = NULL;
 	}
@@ -984,6 +1106,7 @@ dhcp6_makemessage(struct interface *ifp)
 				if (ap->prefix_exclude_len) {
 					uint8_t exb[16], *ep, u8;
 					const uint8_t *pp;
+					size_t n;
 
 					n = (size_t)((ap->prefix_exclude_len -
 					    ap->prefix_len - 1) / NBBY) + 1;
@@ -1036,17 +1159,13 @@ dhcp6_makemessage(struct interface *ifp)
 		    l++, opt++)
 		{
 #ifndef SMALL
-			for (n = 0, opt2 = ifo->dhcp6_override;
-			    n < ifo->dhcp6_override_len;
-			    n++, opt2++)
-			{
-				if (opt->option == opt2->option)
-					break;
-			}
-			if (n < ifo->dhcp6_override_len)
-			    continue;
+			if (dhcp_optmap_find(&ifo->dhcp6_overmap,
+			    ifo->dhcp6_override, ifo->dhcp6_override_len,
+			    opt->option) != NULL)
+				continue;
 #endif
-			if (!DHC_REQOPT(opt, ifo->requestmask6, ifo->nomask6))
+			if (!DHC_REQOPT(opt, ifo->masks->requestmask6,
+			    ifo->masks->nomask6))
 				continue;
 			o.code = htons((uint16_t)opt->option);
 			memcpy(p, &o.code, sizeof(o.code));
@@ -1058,7 +1177,8 @@ dhcp6_makemessage(struct interface *ifp)
 		    l < ifo->dhcp6_override_len;
 		    l++, opt++)
 		{
-			if (!DHC_REQOPT(opt, ifo->requestmask6, ifo->nomask6))
+			if (!DHC_REQOPT(opt, ifo->masks->requestmask6,
+			    ifo->masks->nomask6))
 				continue;
 			o.code = htons((uint16_t)opt->option);
 			memcpy(p, &o.code, sizeof(o.code));
@@ -1081,12 +1201,13 @@ dhcp6_makemessage(struct interface *ifp)
 
 	if (state->state == DH6S_DISCOVER &&
 	    !(ifp->ctx->options & DHCPCD_TEST) &&
-	    DHC_REQ(ifo->requestmask6, ifo->nomask6, D6_OPTION_RAPID_COMMIT))
+	    DHC_REQ(ifo->masks->requestmask6, ifo->masks->nomask6,
+	    D6_OPTION_RAPID_COMMIT))
 		COPYIN1(D6_OPTION_RAPID_COMMIT, 0);
 
-	if (!has_option_mask(ifo->nomask6, D6_OPTION_USER_CLASS))
+	if (!has_option_mask(ifo->masks->nomask6, D6_OPTION_USER_CLASS))
 		p += dhcp6_makeuser(p, ifp);
-	if (!has_option_mask(ifo->nomask6, D6_OPTION_VENDOR_CLASS))
+	if (!has_option_mask(ifo->masks->nomask6, D6_OPTION_VENDOR_CLASS))
 		p += dhcp6_makevendor(p, ifp);
 
 	if (state->send->type != DHCP6_RELEASE &&
@@ -1117,7 +1238,7 @@ dhcp6_makemessage(struct interface *ifp)
 			memcpy(o_lenp, &o.len, sizeof(o.len));
 		}
 
-		if (!has_option_mask(ifo->nomask6, D6_OPTION_MUDURL) &&
+		if (!has_option_mask(ifo->masks->nomask6, D6_OPTION_MUDURL) &&
 		    ifo->mudurl[0])
 			COPYIN(D6_OPTION_MUDURL,
 			    ifo->mudurl + 1, ifo->mudurl[0]);
@@ -1125,7 +1246,7 @@ dhcp6_makemessage(struct interface *ifp)
 #ifdef AUTH
 		if ((ifo->auth.options & DHCPCD_AUTH_SENDREQUIRE) !=
 		    DHCPCD_AUTH_SENDREQUIRE &&
-		    DHC_REQ(ifo->requestmask6, ifo->nomask6,
+		    DHC_REQ(ifo->masks->requestmask6, ifo->masks->nomask6,
 		    D6_OPTION_RECONF_ACCEPT))
 			COPYIN1(D6_OPTION_RECONF_ACCEPT, 0);
 #endif
@@ -1236,10 +1357,20 @@ dhcp6_sendmessage(struct interface *ifp, void (*callback)(void *))
 	    .msg_iov = iov, .msg_iovlen = __arraycount(iov),
 	};
 	char uaddr[INET6_ADDRSTRLEN];
+	const uint8_t *srvid = NULL;
+	uint16_t srvid_len = 0;
 
 	if (!callback && !if_is_link_up(ifp))
 		return 0;
 
+	/* The initial delay (IMD) already spreads out the first message. */
+	if (callback && state->IMD == 0 && if_is_link_up(ifp) &&
+	    (RT = dhcpcd_pace(ctx)) != 0)
+	{
+		eloop_timeout_add_msec(ctx->eloop, RT, callback, ifp);
+		return 0;
+	}
+
 	if (!IN6_IS_ADDR_UNSPECIFIED(&state->unicast)) {
 		switch (state->send->type) {
 		case DHCP6_SOLICIT:	/* FALLTHROUGH */
@@ -1297,6 +1428,8 @@ dhcp6_sendmessage(struct interface *ifp, void (*callback)(void *))
 		RT = state->RT
 		    + (unsigned int)((float)state->RT
 		    * ((float)lr / DHCP6_RAND_DIV));
+		if (state->IMD != 0)
+			RT = dhcpcd_startdelay(ctx, RT);
 
 		if (if_is_link_up(ifp))
 			logdebugx("%s: %s %s (xid 0x%02x%02x%02x)%s%s,"
@@ -1354,8 +1487,10 @@ dhcp6_sendmessage(struct interface *ifp, void (*callback)(void *))
 
 #ifdef PRIVSEP
 	if (IN_PRIVSEP(ifp->ctx)) {
-		if (ps_inet_senddhcp6(ifp, &msg) == -1)
+		if (ps_inet_senddhcp6(ifp, &msg) == -1) {
 			logerr(__func__);
+			goto next;
+		}
 		goto sent;
 	}
 #endif
@@ -1366,11 +1501,24 @@ dhcp6_sendmessage(struct interface *ifp, void (*callback)(void *))
 		 * would be rate limited by the protocol.
 		 * Generally the error is ENOBUFS when struggling to
 		 * associate with an access point. */
+		goto next;
 	}
 
 #ifdef PRIVSEP
 sent:
 #endif
+	STATS_COUNT(ifp, CNTP_DHCP6, CNT_SENT);
+	if (callback != NULL && state->RTC != 0)
+		STATS_COUNT(ifp, CNTP_DHCP6, CNT_RETRANS);
+	/* Requests and renewals are for the server of the lease. */
+	if (callback != NULL) {
+		if (state->send->type == DHCP6_REQUEST ||
+		    state->send->type == DHCP6_RENEW)
+			srvid = dhcp6_findmoption(state->send, state->send_len,
+			    D6_OPTION_SERVERID, &srvid_len);
+		srv_sent(&state->srvs, srvid, srvid_len, state->RTC != 0);
+	}
+next:
 	state->RTC++;
 	if (callback) {
 		state->RT = RT * 2;
@@ -1999,29 +2147,27 @@ dhcp6_startrelease(struct interface *ifp)
 
 static int
 dhcp6_checkstatusok(const struct interface *ifp,
-    struct dhcp6_message *m, uint8_t *p, size_t len)
+    const struct dhcp6_optview *v, const struct dhcp6_optent *parent)
 {
 	struct dhcp6_state *state;
+	const struct dhcp6_optent *ent;
 	uint8_t *opt;
 	uint16_t opt_len, code;
 	size_t mlen;
-	void * (*f)(void *, size_t, uint16_t, uint16_t *), *farg;
 	char buf[32], *sbuf;
 	const char *status;
 	int loglevel;
 
 	state = D6_STATE(ifp);
-	f = p ? dhcp6_findoption : dhcp6_findmoption;
-	if (p)
-		farg = p;
-	else
-		farg = m;
-	if ((opt = f(farg, len, D6_OPTION_STATUS_CODE, &opt_len)) == NULL) {
+	ent = dhcp6_optview_find(v, parent, NULL, D6_OPTION_STATUS_CODE);
+	if (ent == NULL) {
 		//logdebugx("%s: no status", ifp->name);
 		state->lerror = 0;
 		errno = ESRCH;
 		return 0;
 	}
+	opt = ent->data;
+	opt_len = ent->len;
 
 	if (opt_len < sizeof(code)) {
 		logerrx("%s: status truncated", ifp->name);
@@ -2104,28 +2250,25 @@ dhcp6_findaddr(struct dhcpcd_ctx *ctx, const struct in6_addr *addr,
 
 static int
 dhcp6_findna(struct interface *ifp, uint16_t ot, const uint8_t *iaid,
-    uint8_t *d, size_t l, const struct timespec *acquired)
+    const struct dhcp6_optview *v, const struct dhcp6_optent *iap,
+    const struct timespec *acquired)
 {
 	struct dhcp6_state *state;
-	uint8_t *o, *nd;
-	uint16_t ol;
+	const struct dhcp6_optent *ent;
 	struct ipv6_addr *a;
 	int i;
 	struct dhcp6_ia_addr ia;
 
 	i = 0;
 	state = D6_STATE(ifp);
-	while ((o = dhcp6_findoption(d, l, D6_OPTION_IA_ADDR, &ol))) {
-		/* Set d and l first to ensure we find the next option. */
-		nd = o + ol;
-		l -= (size_t)(nd - d);
-		d = nd;
-		if (ol < sizeof(ia)) {
+	ent = NULL;
+	while ((ent = dhcp6_optview_find(v, iap, ent, D6_OPTION_IA_ADDR))) {
+		if (ent->len < sizeof(ia)) {
 			errno = EINVAL;
 			logerrx("%s: IA Address option truncated", ifp->name);
 			continue;
 		}
-		memcpy(&ia, o, sizeof(ia));
+		memcpy(&ia, ent->data, sizeof(ia));
 		ia.pltime = ntohl(ia.pltime);
 		ia.vltime = ntohl(ia.vltime);
 		/* RFC 3315 22.6 */
@@ -2178,10 +2321,12 @@ dhcp6_findna(struct interface *ifp, uint16_t ot, const uint8_t *iaid,
 #ifndef SMALL
 static int
 dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
-    uint8_t *d, size_t l, const struct timespec *acquired)
+    const struct dhcp6_optview *v, const struct dhcp6_optent *iap,
+    const struct timespec *acquired)
 {
 	struct dhcp6_state *state;
-	uint8_t *o, *nd;
+	const struct dhcp6_optent *ent, *ex;
+	uint8_t *o;
 	struct ipv6_addr *a;
 	int i;
 	uint8_t nb, *pw;
@@ -2191,18 +2336,15 @@ dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
 
 	i = 0;
 	state = D6_STATE(ifp);
-	while ((o = dhcp6_findoption(d, l, D6_OPTION_IAPREFIX, &ol))) {
-		/* Set d and l first to ensure we find the next option. */
-		nd = o + ol;
-		l -= (size_t)(nd - d);
-		d = nd;
-		if (ol < sizeof(pdp)) {
+	ent = NULL;
+	while ((ent = dhcp6_optview_find(v, iap, ent, D6_OPTION_IAPREFIX))) {
+		if (ent->len < sizeof(pdp)) {
 			errno = EINVAL;
 			logerrx("%s: IA Prefix option truncated", ifp->name);
 			continue;
 		}
 
-		memcpy(&pdp, o, sizeof(pdp));
+		memcpy(&pdp, ent->data, sizeof(pdp));
 		pdp.pltime = ntohl(pdp.pltime);
 		pdp.vltime = ntohl(pdp.vltime);
 		/* RFC 3315 22.6 */
@@ -2214,9 +2356,6 @@ dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
 			continue;
 		}
 
-		o += sizeof(pdp);
-		ol = (uint16_t)(ol - sizeof(pdp));
-
 		/* pdp.prefix is not aligned so copy it out. */
 		memcpy(&pdp_prefix, &pdp.prefix, sizeof(pdp_prefix));
 		TAILQ_FOREACH(a, &state->addrs, next) {
@@ -2256,9 +2395,11 @@ dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
 
 		a->prefix_exclude_len = 0;
 		memset(&a->prefix_exclude, 0, sizeof(a->prefix_exclude));
-		o = dhcp6_findoption(o, ol, D6_OPTION_PD_EXCLUDE, &ol);
-		if (o == NULL)
+		ex = dhcp6_optview_find(v, ent, NULL, D6_OPTION_PD_EXCLUDE);
+		if (ex == NULL)
 			continue;
+		o = ex->data;
+		ol = ex->len;
 
 		/* RFC 6603 4.2 says option length MUST be between 2 and 17.
 		 * This allows 1 octet for prefix length and 16 for the
@@ -2300,13 +2441,12 @@ dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
 #endif
 
 static int
-dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
+dhcp6_findia(struct interface *ifp, const struct dhcp6_optview *v,
     const char *sfrom, const struct timespec *acquired)
 {
 	struct dhcp6_state *state;
 	const struct if_options *ifo;
-	struct dhcp6_option o;
-	uint8_t *d, *p;
+	const struct dhcp6_optent *o;
 	struct dhcp6_ia_na ia;
 	int i, e, error;
 	size_t j;
@@ -2316,13 +2456,6 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 	struct ipv6_addr *ap;
 	struct if_ia *ifia;
 
-	if (l < sizeof(*m)) {
-		/* Should be impossible with guards at packet in
-		 * and reading leases */
-		errno = EINVAL;
-		return -1;
-	}
-
 	ifo = ifp->options;
 	i = e = 0;
 	state = D6_STATE(ifp);
@@ -2331,22 +2464,13 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 			ap->flags |= IPV6_AF_STALE;
 	}
 
-	d = (uint8_t *)m + sizeof(*m);
-	l -= sizeof(*m);
-	while (l > sizeof(o)) {
-		memcpy(&o, d, sizeof(o));
-		o.len = ntohs(o.len);
-		if (o.len > l || sizeof(o) + o.len > l) {
-			errno = EINVAL;
-			logerrx("%s: option overflow", ifp->name);
-			break;
-		}
-		p = d + sizeof(o);
-		d = p + o.len;
-		l -= sizeof(o) + o.len;
-
-		o.code = ntohs(o.code);
-		switch(o.code) {
+	if (v->error != 0)
+		logerrx("%s: option overflow", ifp->name);
+	for (o = dhcp6_optview_find(v, NULL, NULL, 0);
+	    o != NULL;
+	    o = dhcp6_optview_find(v, NULL, o, 0))
+	{
+		switch(o->code) {
 		case D6_OPTION_IA_TA:
 			nl = 4;
 			break;
@@ -2357,19 +2481,17 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 		default:
 			continue;
 		}
-		if (o.len < nl) {
+		if (o->len < nl) {
 			errno = EINVAL;
 			logerrx("%s: IA option truncated", ifp->name);
 			continue;
 		}
 
-		memcpy(&ia, p, nl);
-		p += nl;
-		o.len = (uint16_t)(o.len - nl);
+		memcpy(&ia, o->data, nl);
 
 		for (j = 0; j < ifo->ia_len; j++) {
 			ifia = &ifo->ia[j];
-			if (ifia->ia_type == o.code &&
+			if (ifia->ia_type == o->code &&
 			    memcmp(ifia->iaid, ia.iaid, sizeof(ia.iaid)) == 0)
 				break;
 		}
@@ -2383,7 +2505,7 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 			continue;
 		}
 
-		if (o.code != D6_OPTION_IA_TA) {
+		if (o->code != D6_OPTION_IA_TA) {
 			ia.t1 = ntohl(ia.t1);
 			ia.t2 = ntohl(ia.t2);
 			/* RFC 3315 22.4 */
@@ -2397,16 +2519,15 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 			}
 		} else
 			ia.t1 = ia.t2 = 0; /* appease gcc */
-		if ((error = dhcp6_checkstatusok(ifp, NULL, p, o.len)) != 0) {
+		if ((error = dhcp6_checkstatusok(ifp, v, o)) != 0) {
 			if (error == D6_STATUS_NOBINDING)
 				state->has_no_binding = true;
 			e = 1;
 			continue;
 		}
-		if (o.code == D6_OPTION_IA_PD) {
+		if (o->code == D6_OPTION_IA_PD) {
 #ifndef SMALL
-			if (dhcp6_findpd(ifp, ia.iaid, p, o.len,
-					 acquired) == 0)
+			if (dhcp6_findpd(ifp, ia.iaid, v, o, acquired) == 0)
 			{
 				logwarnx("%s: %s: DHCPv6 REPLY missing Prefix",
 				    ifp->name, sfrom);
@@ -2414,7 +2535,7 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 			}
 #endif
 		} else {
-			if (dhcp6_findna(ifp, o.code, ia.iaid, p, o.len,
+			if (dhcp6_findna(ifp, o->code, ia.iaid, v, o,
 					 acquired) == 0)
 			{
 				logwarnx("%s: %s: DHCPv6 REPLY missing "
@@ -2423,7 +2544,7 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 				continue;
 			}
 		}
-		if (o.code != D6_OPTION_IA_TA) {
+		if (o->code != D6_OPTION_IA_TA) {
 			if (ia.t1 != 0 &&
 			    (ia.t1 < state->renew || state->renew == 0))
 				state->renew = ia.t1;
@@ -2527,6 +2648,7 @@ dhcp6_validatelease(struct interface *ifp,
     const char *sfrom, const struct timespec *acquired)
 {
 	struct dhcp6_state *state;
+	struct dhcp6_optview v;
 	int nia, ok_errno;
 	struct timespec aq;
 
@@ -2536,8 +2658,12 @@ dhcp6_validatelease(struct interface *ifp,
 	}
 
 	state = D6_STATE(ifp);
+	if (dhcp6_optview_build(ifp->ctx, &v, m, len) == -1) {
+		logerr(__func__);
+		return -1;
+	}
 	errno = 0;
-	if (dhcp6_checkstatusok(ifp, m, NULL, len) != 0)
+	if (dhcp6_checkstatusok(ifp, &v, NULL) != 0)
 		return -1;
 	ok_errno = errno;
 
@@ -2548,7 +2674,7 @@ dhcp6_validatelease(struct interface *ifp,
 		acquired = &aq;
 	}
 	state->has_no_binding = false;
-	nia = dhcp6_findia(ifp, m, len, sfrom, acquired);
+	nia = dhcp6_findia(ifp, &v, sfrom, acquired);
 	if (nia == 0) {
 		if (state->state != DH6S_CONFIRM && ok_errno != 0) {
 			logerrx("%s: no useable IA found in lease", ifp->name);
@@ -2561,8 +2687,13 @@ dhcp6_validatelease(struct interface *ifp,
 		 * have rejected it earlier. */
 		assert(state->new != NULL && state->new_len != 0);
 		state->has_no_binding = false;
-		nia = dhcp6_findia(ifp, state->new, state->new_len,
-		    sfrom, acquired);
+		if (dhcp6_optview_build(ifp->ctx, &v,
+		    state->new, state->new_len) == -1)
+		{
+			logerr(__func__);
+			return -1;
+		}
+		nia = dhcp6_findia(ifp, &v, sfrom, acquired);
 	}
 	return nia;
 }
@@ -2854,102 +2985,304 @@ dhcp6_find_delegates(__unused struct interface *ifp)
 	return 0;
 }
 #else
+/*
+ * Every configured ia_pd sla is filed under the downstream interface
+ * name it delegates to and under the interface doing the delegating.
+ * This lets a REPLY walk just the slas of its own IA_PD and lets a
+ * downstream interface find its delegators without scanning every
+ * interface and sla.
+ * The index points into interface options so free_options() and new
+ * DHCPv6 states mark it stale; it is rebuilt on next use.
+ */
+struct dhcp6_pdent {
+	rb_node_t down_tree;
+	rb_node_t up_tree;
+	struct interface *ifp;	/* delegating interface */
+	struct if_ia *ia;
+	const struct if_sla *sla;
+	size_t seq;
+};
+
+struct dhcp6_pdkey {
+	const struct interface *ifp;
+	const char *ifname;
+	size_t seq;
+};
+
+static int
+dhcp6_pdcmp(const struct interface *ifp1, const char *name1, size_t seq1,
+    const struct interface *ifp2, const char *name2, size_t seq2)
+{
+	int r;
+
+	if (ifp1 != ifp2)
+		return (uintptr_t)ifp1 < (uintptr_t)ifp2 ? -1 : 1;
+	if ((r = strcmp(name1, name2)) != 0)
+		return r;
+	if (seq1 < seq2)
+		return -1;
+	return seq1 == seq2 ? 0 : 1;
+}
+
+static int
+dhcp6_pddown_nodes(__unused void *context, const void *n1, const void *n2)
+{
+	const struct dhcp6_pdent *pe1 = n1, *pe2 = n2;
+
+	return dhcp6_pdcmp(NULL, pe1->sla->ifname, pe1->seq,
+	    NULL, pe2->sla->ifname, pe2->seq);
+}
+
+static int
+dhcp6_pddown_key(__unused void *context, const void *n, const void *key)
+{
+	const struct dhcp6_pdent *pe = n;
+	const struct dhcp6_pdkey *k = key;
+
+	return dhcp6_pdcmp(NULL, pe->sla->ifname, pe->seq,
+	    NULL, k->ifname, k->seq);
+}
+
+static const rb_tree_ops_t dhcp6_pddown_ops = {
+	.rbto_compare_nodes = dhcp6_pddown_nodes,
+	.rbto_compare_key = dhcp6_pddown_key,
+	.rbto_node_offset = offsetof(struct dhcp6_pdent, down_tree),
+	.rbto_context = NULL
+};
+
+static int
+dhcp6_pdup_nodes(__unused void *context, const void *n1, const void *n2)
+{
+	const struct dhcp6_pdent *pe1 = n1, *pe2 = n2;
+
+	return dhcp6_pdcmp(pe1->ifp, pe1->sla->ifname, pe1->seq,
+	    pe2->ifp, pe2->sla->ifname, pe2->seq);
+}
+
+static int
+dhcp6_pdup_key(__unused void *context, const void *n, const void *key)
+{
+	const struct dhcp6_pdent *pe = n;
+	const struct dhcp6_pdkey *k = key;
+
+	return dhcp6_pdcmp(pe->ifp, pe->sla->ifname, pe->seq,
+	    k->ifp, k->ifname, k->seq);
+}
+
+static const rb_tree_ops_t dhcp6_pdup_ops = {
+	.rbto_compare_nodes = dhcp6_pdup_nodes,
+	.rbto_compare_key = dhcp6_pdup_key,
+	.rbto_node_offset = offsetof(struct dhcp6_pdent, up_tree),
+	.rbto_context = NULL
+};
+
+static void
+dhcp6_pdindex(struct dhcpcd_ctx *ctx)
+{
+	struct interface *ifp;
+	struct if_options *ifo;
+	struct if_ia *ia;
+	struct dhcp6_pdent *pe;
+	size_t i, j, n;
+
+	if (ctx->dhcp6_pdvalid)
+		return;
+
+	rb_tree_init(&ctx->dhcp6_pddown, &dhcp6_pddown_ops);
+	rb_tree_init(&ctx->dhcp6_pdup, &dhcp6_pdup_ops);
+
+	n = 0;
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		if ((ifo = ifp->options) == NULL)
+			continue;
+		for (i = 0; i < ifo->ia_len; i++) {
+			if (ifo->ia[i].ia_type == D6_OPTION_IA_PD)
+				n += ifo->ia[i].sla_len;
+		}
+	}
+	if (n > ctx->dhcp6_pdents_len) {
+		pe = reallocarray(ctx->dhcp6_pdents, n, sizeof(*pe));
+		if (pe == NULL) {
+			logerr(__func__);
+			return;
+		}
+		ctx->dhcp6_pdents = pe;
+		ctx->dhcp6_pdents_len = n;
+	}
+
+	n = 0;
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		if ((ifo = ifp->options) == NULL)
+			continue;
+		for (i = 0; i < ifo->ia_len; i++) {
+			ia = &ifo->ia[i];
+			if (ia->ia_type != D6_OPTION_IA_PD)
+				continue;
+			for (j = 0; j < ia->sla_len; j++) {
+				pe = &ctx->dhcp6_pdents[n];
+				pe->ifp = ifp;
+				pe->ia = ia;
+				pe->sla = &ia->sla[j];
+				pe->seq = ++n;
+				rb_tree_insert_node(&ctx->dhcp6_pddown, pe);
+				rb_tree_insert_node(&ctx->dhcp6_pdup, pe);
+			}
+		}
+	}
+	ctx->dhcp6_pdvalid = true;
+}
+
+/* Returns the first sla ifp delegates to ifname, or NULL. */
+static struct dhcp6_pdent *
+dhcp6_pdfirst(struct dhcpcd_ctx *ctx, struct interface *ifp,
+    const char *ifname)
+{
+	struct dhcp6_pdkey key = { .ifp = ifp, .ifname = ifname, .seq = 0 };
+	struct dhcp6_pdent *pe;
+
+	pe = rb_tree_find_node_geq(&ctx->dhcp6_pdup, &key);
+	if (pe == NULL || pe->ifp != ifp || strcmp(pe->sla->ifname, ifname))
+		return NULL;
+	return pe;
+}
+
+static bool
+dhcp6_pdcarrier(struct interface *ifd)
+{
+
+	if (if_is_link_up(ifd))
+		return true;
+	logdebugx("%s: has no carrier, cannot delegate addresses", ifd->name);
+	return false;
+}
+
+/* Delegate the prefixes on ifp to ifd, starting at the sla pe. */
+static void
+dhcp6_delegate_ifd(struct interface *ifp, struct interface *ifd,
+    struct dhcp6_pdent *pe)
+{
+	struct if_options *ifo = ifp->options;
+	struct dhcp6_state *state = D6_STATE(ifp);
+	rb_tree_t *tree = &ifp->ctx->dhcp6_pdup;
+	struct dhcp6_pdent *p;
+	struct ipv6_addr *ap;
+	struct if_ia *ia;
+	size_t i, k = 0;
+	int carrier = -1;
+
+	if (!ifd->active)
+		return;
+
+	TAILQ_FOREACH(ap, &state->addrs, next) {
+		if (!(ap->flags & IPV6_AF_DELEGATEDPFX))
+			continue;
+		for (i = 0; i < ifo->ia_len; i++) {
+			ia = &ifo->ia[i];
+			/* no SLA configured, so lets automate it */
+			if (ia->ia_type != D6_OPTION_IA_PD ||
+			    ia->sla_len != 0 ||
+			    memcmp(ia->iaid, ap->iaid, sizeof(ia->iaid)))
+				continue;
+			if (carrier == -1)
+				carrier = dhcp6_pdcarrier(ifd);
+			if (carrier == 0)
+				return;
+			if (dhcp6_ifdelegateaddr(ifd, ap, NULL, ia))
+				k++;
+		}
+		for (p = pe;
+		    p != NULL && p->ifp == ifp &&
+		    strcmp(p->sla->ifname, ifd->name) == 0;
+		    p = RB_TREE_NEXT(tree, p))
+		{
+			if (memcmp(p->ia->iaid, ap->iaid, sizeof(ap->iaid)))
+				continue;
+			if (carrier == -1)
+				carrier = dhcp6_pdcarrier(ifd);
+			if (carrier == 0)
+				return;
+			if (dhcp6_ifdelegateaddr(ifd, ap, p->sla, p->ia))
+				k++;
+		}
+	}
+
+	if (k != 0) {
+		state = D6_STATE(ifd);
+		ipv6_addaddrs(&state->addrs);
+		state->delegated = true;
+	}
+}
+
 static void
 dhcp6_delegate_prefix(struct interface *ifp)
 {
+	struct dhcpcd_ctx *ctx = ifp->ctx;
 	struct if_options *ifo;
 	struct dhcp6_state *state;
 	struct ipv6_addr *ap;
-	size_t i, j, k;
-	struct if_ia *ia;
-	struct if_sla *sla;
+	struct dhcp6_pdkey key = { .ifp = ifp, .ifname = "", .seq = 0 };
+	struct dhcp6_pdent *pe, *next;
 	struct interface *ifd;
-	bool carrier_warned;
+	size_t i;
+	bool automate;
 
 	ifo = ifp->options;
 	state = D6_STATE(ifp);
 
-	/* Clear the logged flag. */
 	TAILQ_FOREACH(ap, &state->addrs, next) {
-		ap->flags &= ~IPV6_AF_DELEGATEDLOG;
+		if (!(ap->flags & IPV6_AF_DELEGATEDPFX))
+			continue;
+		logmessage(ap->flags & IPV6_AF_NEW ? LOG_INFO : LOG_DEBUG,
+		    "%s: delegated prefix %s", ifp->name, ap->saddr);
+		ap->flags &= ~IPV6_AF_NEW;
 	}
 
-	TAILQ_FOREACH(ifd, ifp->ctx->ifaces, next) {
-		if (!ifd->active)
-			continue;
-		k = 0;
-		carrier_warned = false;
-		TAILQ_FOREACH(ap, &state->addrs, next) {
-			if (!(ap->flags & IPV6_AF_DELEGATEDPFX))
-				continue;
-			if (!(ap->flags & IPV6_AF_DELEGATEDLOG)) {
-				int loglevel;
+	dhcp6_pdindex(ctx);
 
-				if (ap->flags & IPV6_AF_NEW)
-					loglevel = LOG_INFO;
-				else
-					loglevel = LOG_DEBUG;
-				/* We only want to log this the once as we loop
-				 * through many interfaces first. */
-				ap->flags |= IPV6_AF_DELEGATEDLOG;
-				logmessage(loglevel, "%s: delegated prefix %s",
-				    ifp->name, ap->saddr);
-				ap->flags &= ~IPV6_AF_NEW;
-			}
-			for (i = 0; i < ifo->ia_len; i++) {
-				ia = &ifo->ia[i];
-				if (ia->ia_type != D6_OPTION_IA_PD)
-					continue;
-				if (memcmp(ia->iaid, ap->iaid,
-				    sizeof(ia->iaid)))
-					continue;
-				if (ia->sla_len == 0) {
-					/* no SLA configured, so lets
-					 * automate it */
-					if (!if_is_link_up(ifd)) {
-						logdebugx(
-						    "%s: has no carrier, cannot"
-						    " delegate addresses",
-						    ifd->name);
-						carrier_warned = true;
-						break;
-					}
-					if (dhcp6_ifdelegateaddr(ifd, ap,
-					    NULL, ia))
-						k++;
-				}
-				for (j = 0; j < ia->sla_len; j++) {
-					sla = &ia->sla[j];
-					if (strcmp(ifd->name, sla->ifname))
-						continue;
-					if (!if_is_link_up(ifd)) {
-						logdebugx(
-						    "%s: has no carrier, cannot"
-						    " delegate addresses",
-						    ifd->name);
-						carrier_warned = true;
-						break;
-					}
-					if (dhcp6_ifdelegateaddr(ifd, ap,
-					    sla, ia))
-						k++;
-				}
-				if (carrier_warned)
-					break;
-			}
-			if (carrier_warned)
-				break;
-		}
-		if (k && !carrier_warned) {
-			struct dhcp6_state *s = D6_STATE(ifd);
+	/* An ia_pd without any sla delegates to every interface,
+	 * otherwise only the interfaces named by our slas. */
+	automate = false;
+	for (i = 0; i < ifo->ia_len; i++) {
+		if (ifo->ia[i].ia_type == D6_OPTION_IA_PD &&
+		    ifo->ia[i].sla_len == 0)
+			automate = true;
+	}
 
-			ipv6_addaddrs(&s->addrs);
-			dhcp6_script_try_run(ifd, 1);
+	/* Send the addresses for all downstream interfaces together. */
+	ipv6_batchaddrs(ctx);
+	if (automate) {
+		TAILQ_FOREACH(ifd, ctx->ifaces, next) {
+			dhcp6_delegate_ifd(ifp, ifd,
+			    dhcp6_pdfirst(ctx, ifp, ifd->name));
+		}
+	} else {
+		pe = rb_tree_find_node_geq(&ctx->dhcp6_pdup, &key);
+		while (pe != NULL && pe->ifp == ifp) {
+			/* Find the first sla for the next interface. */
+			for (next = pe;
+			    next != NULL && next->ifp == ifp &&
+			    strcmp(next->sla->ifname, pe->sla->ifname) == 0;
+			    next = RB_TREE_NEXT(&ctx->dhcp6_pdup, next))
+				;
+			ifd = if_findnamectx(ctx, pe->sla->ifname);
+			if (ifd != NULL)
+				dhcp6_delegate_ifd(ifp, ifd, pe);
+			pe = next;
 		}
 	}
+	ipv6_commitaddrs(ctx);
+
+	/* Only now does the kernel have them, so the script can run. */
+	TAILQ_FOREACH(ifd, ctx->ifaces, next) {
+		state = D6_STATE(ifd);
+		if (state == NULL || !state->delegated)
+			continue;
+		state->delegated = false;
+		dhcp6_script_try_run(ifd, 1);
+	}
 
 	/* Now all addresses have been added, rebuild the routing table. */
-	rt_build(ifp->ctx, AF_INET6);
+	rt_build(ctx, AF_INET6);
 }
 
 static void
@@ -2962,49 +3295,38 @@ dhcp6_find_delegates1(void *arg)
 size_t
 dhcp6_find_delegates(struct interface *ifp)
 {
-	struct if_options *ifo;
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct dhcp6_pdkey key = { .ifname = ifp->name, .seq = 0 };
 	struct dhcp6_state *state;
 	struct ipv6_addr *ap;
-	size_t i, j, k;
-	struct if_ia *ia;
-	struct if_sla *sla;
-	struct interface *ifd;
+	struct dhcp6_pdent *pe;
+	size_t k;
+
+	dhcp6_pdindex(ctx);
 
 	k = 0;
-	TAILQ_FOREACH(ifd, ifp->ctx->ifaces, next) {
-		ifo = ifd->options;
-		state = D6_STATE(ifd);
+	for (pe = rb_tree_find_node_geq(&ctx->dhcp6_pddown, &key);
+	    pe != NULL && strcmp(pe->sla->ifname, ifp->name) == 0;
+	    pe = RB_TREE_NEXT(&ctx->dhcp6_pddown, pe))
+	{
+		state = D6_STATE(pe->ifp);
 		if (state == NULL || state->state != DH6S_BOUND)
 			continue;
 		TAILQ_FOREACH(ap, &state->addrs, next) {
 			if (!(ap->flags & IPV6_AF_DELEGATEDPFX))
 				continue;
-			for (i = 0; i < ifo->ia_len; i++) {
-				ia = &ifo->ia[i];
-				if (ia->ia_type != D6_OPTION_IA_PD)
-					continue;
-				if (memcmp(ia->iaid, ap->iaid,
-				    sizeof(ia->iaid)))
-					continue;
-				for (j = 0; j < ia->sla_len; j++) {
-					sla = &ia->sla[j];
-					if (strcmp(ifp->name, sla->ifname))
-						continue;
-					if (ipv6_linklocal(ifp) == NULL) {
-						logdebugx(
-						    "%s: delaying adding"
-						    " delegated addresses for"
-						    " LL address",
-						    ifp->name);
-						ipv6_addlinklocalcallback(ifp,
-						    dhcp6_find_delegates1, ifp);
-						return 1;
-					}
-					if (dhcp6_ifdelegateaddr(ifp, ap,
-					    sla, ia))
-					    k++;
-				}
+			if (memcmp(pe->ia->iaid, ap->iaid, sizeof(ap->iaid)))
+				continue;
+			if (ipv6_linklocal(ifp) == NULL) {
+				logdebugx("%s: delaying adding"
+				    " delegated addresses for LL address",
+				    ifp->name);
+				ipv6_addlinklocalcallback(ifp,
+				    dhcp6_find_delegates1, ifp);
+				return 1;
 			}
+			if (dhcp6_ifdelegateaddr(ifp, ap, pe->sla, pe->ia))
+				k++;
 		}
 	}
 
@@ -3013,7 +3335,7 @@ dhcp6_find_delegates(struct interface *ifp)
 		state = D6_STATE(ifp);
 		state->state = DH6S_DELEGATED;
 		ipv6_addaddrs(&state->addrs);
-		rt_build(ifp->ctx, AF_INET6);
+		rt_build(ctx, AF_INET6);
 		dhcp6_script_try_run(ifp, 1);
 	}
 	return k;
@@ -3131,6 +3453,14 @@ dhcp6_bind(struct interface *ifp, const char *op, const char *sfrom)
 			state->renew = (uint32_t)(state->lowpl * 0.5);
 		if (state->rebind == 0 && state->lowpl != ND6_INFINITE_LIFETIME)
 			state->rebind = (uint32_t)(state->lowpl * 0.8);
+		if (ifp->options->renew_spread != 0) {
+			state->rebind = dhcp_spread(state->rebind,
+			    ifp->options->renew_spread);
+			state->renew = dhcp_spread(state->renew,
+			    ifp->options->renew_spread);
+			if (state->renew > state->rebind && state->rebind != 0)
+				state->renew = state->rebind;
+		}
 		break;
 	default:
 		state->reason = "UNKNOWN6";
@@ -3198,6 +3528,7 @@ dhcp6_bind(struct interface *ifp, const char *op, const char *sfrom)
 		ipv6_addaddrs(&state->addrs);
 		if (!timedout)
 			dhcp6_deprecateaddrs(&state->addrs);
+		dhcpcd_phase(ifp->ctx, ifp, PHASE_DHCP6);
 
 		if (state->state == DH6S_INFORMED)
 			logmessage(loglevel, "%s: refresh in %"PRIu32" seconds",
@@ -3216,13 +3547,14 @@ dhcp6_bind(struct interface *ifp, const char *op, const char *sfrom)
 		else
 			logmessage(loglevel, "%s: expire in %"PRIu32" seconds",
 			    ifp->name, state->expire);
+		rt_release(ifp, AF_INET6, RTDF_DHCP);
 		rt_build(ifp->ctx, AF_INET6);
 		if (!confirmed && !timedout) {
-			logdebugx("%s: writing lease: %s",
-			    ifp->name, state->leasefile);
-			if (dhcp_writefile(ifp->ctx, state->leasefile, 0640,
-			    state->new, state->new_len) == -1)
-				logerr("dhcp_writefile: %s",state->leasefile);
+			if (leasewb_write(ifp, state->leasefile,
+			    state->new, state->new_len,
+			    sizeof(struct dhcp6_message),
+			    state->expire, state->renew) == -1)
+				logerr("leasewb_write: %s", state->leasefile);
 		}
 #ifndef SMALL
 		dhcp6_delegate_prefix(ifp);
@@ -3238,14 +3570,47 @@ dhcp6_bind(struct interface *ifp, const char *op, const char *sfrom)
 	}
 }
 
+static void
+dhcp6_requestheld(void *arg)
+{
+
+	dhcp6_startrequest(arg);
+}
+
+/* As dhcp_holdoffer(), for the ADVERTISE just received. */
+static bool
+dhcp6_holdadvert(struct interface *ifp, const struct timespec *rxtime)
+{
+	struct dhcp6_state *state = D6_STATE(ifp);
+	const uint8_t *o;
+	uint16_t ol;
+	unsigned int hold;
+
+	eloop_timeout_delete(ifp->ctx->eloop, dhcp6_requestheld, ifp);
+	if (!ifp->options->fastest_server)
+		return false;
+	o = dhcp6_findmoption(state->recv, state->recv_len,
+	    D6_OPTION_SERVERID, &ol);
+	if (o == NULL)
+		return false;
+	hold = srv_hold(&state->srvs, o, ol, rxtime);
+	if (hold == 0)
+		return false;
+	logdebugx("%s: holding ADV for %u ms", ifp->name, hold);
+	eloop_timeout_delete(ifp->ctx->eloop, dhcp6_senddiscover, ifp);
+	eloop_timeout_add_msec(ifp->ctx->eloop, hold, dhcp6_requestheld, ifp);
+	return true;
+}
+
 static void
 dhcp6_recvif(struct interface *ifp, const char *sfrom,
-    struct dhcp6_message *r, size_t len)
+    struct dhcp6_message *r, size_t len, const struct timespec *rxtime)
 {
 	struct dhcpcd_ctx *ctx;
 	size_t i;
 	const char *op;
 	struct dhcp6_state *state;
+	struct dhcp6_optview v;
 	uint8_t *o;
 	uint16_t ol;
 	const struct dhcp_opt *opt;
@@ -3263,6 +3628,8 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 		    ifp->name);
 		return;
 	}
+	PROBE4(dhcp6_recv, (const char *)ifp->name,
+	    r->type, state->state, len);
 
 	/* We're already bound and this message is for another machine */
 	/* XXX DELEGATED? */
@@ -3284,14 +3651,14 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 	    i < ctx->dhcp6_opts_len;
 	    i++, opt++)
 	{
-		if (has_option_mask(ifo->requiremask6, opt->option) &&
+		if (has_option_mask(ifo->masks->requiremask6, opt->option) &&
 		    !dhcp6_findmoption(r, len, (uint16_t)opt->option, NULL))
 		{
 			logwarnx("%s: reject DHCPv6 (no option %s) from %s",
 			    ifp->name, opt->var, sfrom);
 			return;
 		}
-		if (has_option_mask(ifo->rejectmask6, opt->option) &&
+		if (has_option_mask(ifo->masks->rejectmask6, opt->option) &&
 		    dhcp6_findmoption(r, len, (uint16_t)opt->option, NULL))
 		{
 			logwarnx("%s: reject DHCPv6 (option %s) from %s",
@@ -3309,6 +3676,7 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 		{
 			logerr("%s: authentication failed from %s",
 			    ifp->name, sfrom);
+			STATS_COUNT(ifp, CNTP_DHCP6, CNT_AUTH);
 			return;
 		}
 		if (state->auth.token)
@@ -3320,6 +3688,7 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 		if (ifo->auth.options & DHCPCD_AUTH_REQUIRE) {
 			logerrx("%s: no authentication from %s",
 			    ifp->name, sfrom);
+			STATS_COUNT(ifp, CNTP_DHCP6, CNT_AUTH);
 			return;
 		}
 		logwarnx("%s: no authentication from %s", ifp->name, sfrom);
@@ -3332,7 +3701,11 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 	case DHCP6_REPLY:
 		switch(state->state) {
 		case DH6S_INFORM:
-			if (dhcp6_checkstatusok(ifp, r, NULL, len) != 0)
+			if (dhcp6_optview_build(ifp->ctx, &v, r, len) == -1) {
+				logerr(__func__);
+				return;
+			}
+			if (dhcp6_checkstatusok(ifp, &v, NULL) != 0)
 				return;
 			break;
 		case DH6S_CONFIRM:
@@ -3345,7 +3718,7 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 		case DH6S_DISCOVER:
 			/* Only accept REPLY in DISCOVER for RAPID_COMMIT.
 			 * Normally we get an ADVERTISE for a DISCOVER. */
-			if (!has_option_mask(ifo->requestmask6,
+			if (!has_option_mask(ifo->masks->requestmask6,
 			    D6_OPTION_RAPID_COMMIT) ||
 			    !dhcp6_findmoption(r, len, D6_OPTION_RAPID_COMMIT,
 					      NULL))
@@ -3450,8 +3823,10 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 #endif
 			logerrx("%s: unauthenticated %s from %s",
 			    ifp->name, op, sfrom);
-			if (ifo->auth.options & DHCPCD_AUTH_REQUIRE)
+			if (ifo->auth.options & DHCPCD_AUTH_REQUIRE) {
+				STATS_COUNT(ifp, CNTP_DHCP6, CNT_AUTH);
 				return;
+			}
 #ifdef AUTH
 		}
 		loginfox("%s: %s from %s", ifp->name, op, sfrom);
@@ -3516,6 +3891,11 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 	memcpy(state->recv, r, len);
 	state->recv_len = len;
 
+	/* Time the server, this answers what we last sent. */
+	o = dhcp6_findmoption(r, len, D6_OPTION_SERVERID, &ol);
+	if (o != NULL)
+		srv_recv(&state->srvs, o, ol, rxtime);
+
 	if (r->type == DHCP6_ADVERTISE) {
 		struct ipv6_addr *ia;
 
@@ -3533,7 +3913,8 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 		else
 			loginfox("%s: ADV %s from %s",
 			    ifp->name, ia->saddr, sfrom);
-		dhcp6_startrequest(ifp);
+		if (!dhcp6_holdadvert(ifp, rxtime))
+			dhcp6_startrequest(ifp);
 		return;
 	}
 
@@ -3552,6 +3933,8 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 	const struct dhcp6_state *state;
 	uint8_t *o;
 	uint16_t ol;
+	struct timespec ts;
+	const struct timespec *rxtime = dhcp_rxtime(msg, &ts);
 
 	inet_ntop(AF_INET6, &from->sin6_addr, sfrom, sizeof(sfrom));
 	if (len < sizeof(struct dhcp6_message)) {
@@ -3565,9 +3948,11 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 		ifp = if_findifpfromcmsg(ctx, msg, NULL);
 		if (ifp == NULL) {
 			logerr(__func__);
+			STATS_COUNT(ctx, CNTP_DHCP6, CNT_NOIF);
 			return;
 		}
 	}
+	STATS_COUNT(ifp, CNTP_DHCP6, CNT_RECV);
 
 	r = (struct dhcp6_message *)msg->msg_iov[0].iov_base;
 
@@ -3632,6 +4017,7 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 				    state->send->xid[1],
 				    state->send->xid[2],
 				    sfrom);
+			STATS_COUNT(ifp, CNTP_DHCP6, CNT_XID);
 			return;
 		}
 		logdebugx("%s: redirecting DHCP6 message to %s",
@@ -3676,7 +4062,7 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 #endif
 
 recvif:
-	dhcp6_recvif(ifp, sfrom, r, len);
+	dhcp6_recvif(ifp, sfrom, r, len, rxtime);
 }
 
 static void
@@ -3692,18 +4078,17 @@ dhcp6_recv(struct dhcpcd_ctx *ctx, struct ipv6_addr *ia)
 	};
 	union {
 		struct cmsghdr hdr;
-		uint8_t buf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+		uint8_t buf[CMSG_SPACE(sizeof(struct in6_pktinfo)) +
+		    RXTIME_CMSG_SPACE];
 	} cmsgbuf = { .buf = { 0 } };
 	struct msghdr msg = {
 	    .msg_name = &from, .msg_namelen = sizeof(from),
 	    .msg_iov = &iov, .msg_iovlen = 1,
 	    .msg_control = cmsgbuf.buf, .msg_controllen = sizeof(cmsgbuf.buf),
 	};
-	int s;
 	ssize_t bytes;
 
-	s = ia != NULL ? ia->dhcp6_fd : ctx->dhcp6_rfd;
-	bytes = recvmsg(s, &msg, 0);
+	bytes = recvmsg(ia->dhcp6_fd, &msg, 0);
 	if (bytes == -1) {
 		logerr(__func__);
 		return;
@@ -3725,8 +4110,25 @@ static void
 dhcp6_recvctx(void *arg)
 {
 	struct dhcpcd_ctx *ctx = arg;
+	int i, n;
 
-	dhcp6_recv(ctx, NULL);
+	if (ctx->dhcp6_msgs == NULL) {
+		/* Maximum UDP message size */
+		ctx->dhcp6_msgs = if_msgbatch_new(UDPLEN_MAX);
+		if (ctx->dhcp6_msgs == NULL) {
+			logerr(__func__);
+			return;
+		}
+	}
+
+	n = if_recvmsgs(ctx->dhcp6_rfd, ctx->dhcp6_msgs);
+	if (n == -1) {
+		logerr(__func__);
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		dhcp6_recvmsg(ctx, IF_MSGBATCH_MSG(ctx->dhcp6_msgs, i), NULL);
 }
 
 int
@@ -3787,6 +4189,11 @@ dhcp6_openudp(unsigned int ifindex, struct in6_addr *ia)
 	if (setsockopt(s, SOL_SOCKET, SO_RERROR, &n, sizeof(n)) == -1)
 		goto errexit;
 #endif
+#ifdef SO_RXTIME
+	n = 1;
+	if (setsockopt(s, SOL_SOCKET, SO_RXTIME, &n, sizeof(n)) == -1)
+		goto errexit;
+#endif
 
 	return s;
 
@@ -3829,6 +4236,20 @@ dhcp6_activateinterfaces(struct interface *ifp)
 }
 #endif
 
+/* The masks may be shared, so only take a copy when we change them. */
+static void
+dhcp6_setreqopt(struct if_options *ifo, uint16_t opt, bool on)
+{
+
+	if ((has_option_mask(ifo->masks->requestmask6, opt) != 0) == on ||
+	    if_optmasks_unshare(ifo) == -1)
+		return;
+	if (on)
+		add_option_mask(ifo->masks->requestmask6, opt);
+	else
+		del_option_mask(ifo->masks->requestmask6, opt);
+}
+
 static void
 dhcp6_start1(void *arg)
 {
@@ -3839,7 +4260,7 @@ dhcp6_start1(void *arg)
 	size_t i;
 	const struct dhcp_compat *dhc;
 
-	if ((ctx->options & (DHCPCD_MASTER|DHCPCD_PRIVSEP)) == DHCPCD_MASTER &&
+	if (!(ctx->options & DHCPCD_PRIVSEP) && DHCP6_SHARED(ctx) &&
 	    ctx->dhcp6_rfd == -1)
 	{
 		ctx->dhcp6_rfd = dhcp6_openudp(0, NULL);
@@ -3861,33 +4282,34 @@ dhcp6_start1(void *arg)
 	state = D6_STATE(ifp);
 	/* If no DHCPv6 options are configured,
 	   match configured DHCPv4 options to DHCPv6 equivalents. */
-	for (i = 0; i < sizeof(ifo->requestmask6); i++) {
-		if (ifo->requestmask6[i] != '\0')
+	for (i = 0; i < sizeof(ifo->masks->requestmask6); i++) {
+		if (ifo->masks->requestmask6[i] != '\0')
 			break;
 	}
-	if (i == sizeof(ifo->requestmask6)) {
+	if (i == sizeof(ifo->masks->requestmask6)) {
 		for (dhc = dhcp_compats; dhc->dhcp_opt; dhc++) {
 			if (DHC_REQ(ifo->requestmask, ifo->nomask, dhc->dhcp_opt))
-				add_option_mask(ifo->requestmask6,
-				    dhc->dhcp6_opt);
+				dhcp6_setreqopt(ifo, dhc->dhcp6_opt, true);
 		}
 		if (ifo->fqdn != FQDN_DISABLE || ifo->options & DHCPCD_HOSTNAME)
-			add_option_mask(ifo->requestmask6, D6_OPTION_FQDN);
+			dhcp6_setreqopt(ifo, D6_OPTION_FQDN, true);
 	}
 
 #ifndef SMALL
 	/* Rapid commit won't work with Prefix Delegation Exclusion */
 	if (dhcp6_findselfsla(ifp))
-		del_option_mask(ifo->requestmask6, D6_OPTION_RAPID_COMMIT);
+		dhcp6_setreqopt(ifo, D6_OPTION_RAPID_COMMIT, false);
 #endif
 
-	if (state->state == DH6S_INFORM) {
-		add_option_mask(ifo->requestmask6, D6_OPTION_INFO_REFRESH_TIME);
+	dhcp6_setreqopt(ifo, D6_OPTION_INFO_REFRESH_TIME,
+	    state->state == DH6S_INFORM);
+	/* Other interfaces may have made the same changes. */
+	if_optmasks_share(ctx, ifo, ifp->name);
+
+	if (state->state == DH6S_INFORM)
 		dhcp6_startinform(ifp);
-	} else {
-		del_option_mask(ifo->requestmask6, D6_OPTION_INFO_REFRESH_TIME);
+	else
 		dhcp6_startinit(ifp);
-	}
 
 #ifndef SMALL
 	dhcp6_activateinterfaces(ifp);
@@ -3899,6 +4321,7 @@ dhcp6_start(struct interface *ifp, enum DH6S init_state)
 {
 	struct dhcp6_state *state;
 
+	load_definitions(ifp->ctx, DEFS_DHCP6);
 	state = D6_STATE(ifp);
 	if (state != NULL) {
 		switch (init_state) {
@@ -3949,10 +4372,13 @@ dhcp6_start(struct interface *ifp, enum DH6S init_state)
 	if (!(ifp->options->options & DHCPCD_DHCP6))
 		return 0;
 
-	ifp->if_data[IF_DATA_DHCP6] = calloc(1, sizeof(*state));
+	ifp->if_data[IF_DATA_DHCP6] = arena_get(&ifp->arena, sizeof(*state));
 	state = D6_STATE(ifp);
 	if (state == NULL)
 		return -1;
+#ifndef SMALL
+	ifp->ctx->dhcp6_pdvalid = false;
+#endif
 
 	state->sol_max_rt = SOL_MAX_RT;
 	state->inf_max_rt = INF_MAX_RT;
@@ -4067,7 +4493,7 @@ dhcp6_freedrop(struct interface *ifp, int drop, const char *reason)
 		free(state->old);
 		free(state->send);
 		free(state->recv);
-		free(state);
+		arena_put(&ifp->arena, state);
 		ifp->if_data[IF_DATA_DHCP6] = NULL;
 	}
 
@@ -4085,6 +4511,17 @@ dhcp6_freedrop(struct interface *ifp, int drop, const char *reason)
 		close(ctx->dhcp6_rfd);
 		ctx->dhcp6_rfd = -1;
 	}
+	if (ifp == NULL) {
+		free(ctx->dhcp6_optents);
+		ctx->dhcp6_optents = NULL;
+		ctx->dhcp6_optents_len = 0;
+#ifndef SMALL
+		free(ctx->dhcp6_pdents);
+		ctx->dhcp6_pdents = NULL;
+		ctx->dhcp6_pdents_len = 0;
+		ctx->dhcp6_pdvalid = false;
+#endif
+	}
 }
 
 void
@@ -4142,11 +4579,11 @@ dhcp6_handleifa(int cmd, struct ipv6_addr *ia, pid_t pid)
 	struct dhcp6_state *state;
 	struct interface *ifp = ia->iface;
 
-	/* If not running in master mode, listen to this address */
+	/* Without the shared socket, listen to this address */
 	if (cmd == RTM_NEWADDR &&
 	    !(ia->addr_flags & IN6_IFF_NOTUSEABLE) &&
 	    ifp->active == IF_ACTIVE_USER &&
-	    !(ifp->ctx->options & DHCPCD_MASTER) &&
+	    !DHCP6_SHARED(ifp->ctx) &&
 	    ifp->options->options & DHCPCD_DHCP6)
 	{
 #ifdef PRIVSEP
@@ -4171,24 +4608,17 @@ dhcp6_handleifa(int cmd, struct ipv6_addr *ia, pid_t pid)
 }
 
 ssize_t
-dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
+dhcp6_optenv(FILE *fp, const char *prefix, const struct interface *ifp,
     const struct dhcp6_message *m, size_t len)
 {
-	const struct if_options *ifo;
+	struct if_options *ifo;
 	struct dhcp_opt *opt, *vo;
-	const uint8_t *p;
-	struct dhcp6_option o;
+	struct dhcp6_optview v;
+	const struct dhcp6_optent *o;
 	size_t i;
 	char *pfx;
 	uint32_t en;
-	const struct dhcpcd_ctx *ctx;
-#ifndef SMALL
-	const struct dhcp6_state *state;
-	const struct ipv6_addr *ap;
-#endif
-
-	if (m == NULL)
-		goto delegated;
+	struct dhcpcd_ctx *ctx;
 
 	if (len < sizeof(*m)) {
 		/* Should be impossible with guards at packet in
@@ -4218,63 +4648,62 @@ dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
 
 	/* Unlike DHCP, DHCPv6 options *may* occur more than once.
 	 * There is also no provision for option concatenation unlike DHCP. */
-	p = (const uint8_t *)m + sizeof(*m);
-	len -= sizeof(*m);
-	for (; len != 0; p += o.len, len -= o.len) {
-		if (len < sizeof(o)) {
-			errno = EINVAL;
-			break;
-		}
-		memcpy(&o, p, sizeof(o));
-		p += sizeof(o);
-		len -= sizeof(o);
-		o.len = ntohs(o.len);
-		if (len < o.len) {
-			errno =	EINVAL;
-			break;
-		}
-		o.code = ntohs(o.code);
-		if (has_option_mask(ifo->nomask6, o.code))
+	if (dhcp6_optview_build(ctx, &v, UNCONST(m), len) == -1) {
+		free(pfx);
+		return -1;
+	}
+	if (v.error != 0)
+		errno = v.error;
+	for (o = dhcp6_optview_find(&v, NULL, NULL, 0);
+	    o != NULL;
+	    o = dhcp6_optview_find(&v, NULL, o, 0))
+	{
+		if (has_option_mask(ifo->masks->nomask6, o->code))
 			continue;
-		for (i = 0, opt = ifo->dhcp6_override;
-		    i < ifo->dhcp6_override_len;
-		    i++, opt++)
-			if (opt->option == o.code)
-				break;
-		if (i == ifo->dhcp6_override_len &&
-		    o.code == D6_OPTION_VENDOR_OPTS &&
-		    o.len > sizeof(en))
+		opt = dhcp_optmap_find(&ifo->dhcp6_overmap,
+		    ifo->dhcp6_override, ifo->dhcp6_override_len, o->code);
+		if (opt == NULL &&
+		    o->code == D6_OPTION_VENDOR_OPTS &&
+		    o->len > sizeof(en))
 		{
-			memcpy(&en, p, sizeof(en));
+			memcpy(&en, o->data, sizeof(en));
 			en = ntohl(en);
 			vo = vivso_find(en, ifp);
 		} else
 			vo = NULL;
-		if (i == ifo->dhcp6_override_len) {
-			for (i = 0, opt = ctx->dhcp6_opts;
-			    i < ctx->dhcp6_opts_len;
-			    i++, opt++)
-				if (opt->option == o.code)
-					break;
-			if (i == ctx->dhcp6_opts_len)
-				opt = NULL;
-		}
+		if (opt == NULL)
+			opt = dhcp_optmap_find(&ctx->dhcp6_optmap,
+			    ctx->dhcp6_opts, ctx->dhcp6_opts_len, o->code);
 		if (opt) {
 			dhcp_envoption(ifp->ctx,
 			    fp, pfx, ifp->name,
-			    opt, dhcp6_getoption, p, o.len);
+			    opt, dhcp6_getoption, o->data, o->len);
 		}
 		if (vo) {
 			dhcp_envoption(ifp->ctx,
 			    fp, pfx, ifp->name,
 			    vo, dhcp6_getoption,
-			    p + sizeof(en),
-			    o.len - sizeof(en));
+			    o->data + sizeof(en),
+			    o->len - sizeof(en));
 		}
 	}
 	free(pfx);
+	return 1;
+}
+
+ssize_t
+dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
+    const struct dhcp6_message *m, size_t len)
+{
+#ifndef SMALL
+	const struct dhcp6_state *state;
+	const struct ipv6_addr *ap;
+#endif
+
+	load_definitions(ifp->ctx, DEFS_DHCP6);
+	if (m != NULL && dhcp6_optenv(fp, prefix, ifp, m, len) == -1)
+		return -1;
 
-delegated:
 #ifndef SMALL
         /* Needed for Delegated Prefixes */
 	state = D6_CSTATE(ifp);
@@ -4310,7 +4739,8 @@ dhcp6_dump(struct interface *ifp)
 {
 	struct dhcp6_state *state;
 
-	ifp->if_data[IF_DATA_DHCP6] = state = calloc(1, sizeof(*state));
+	ifp->if_data[IF_DATA_DHCP6] = state =
+	    arena_get(&ifp->arena, sizeof(*state));
 	if (state == NULL) {
 		logerr(__func__);
 		return -1;
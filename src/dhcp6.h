@@ -213,6 +213,8 @@ struct dhcp6_state {
 	uint16_t lerror; /* Last error received from DHCPv6 reply. */
 	bool has_no_binding;
 	bool failed; /* Entered the failed state - used to rate limit log. */
+	bool delegated; /* Delegated addresses added, script not yet tried */
+	struct srv_stats srvs;	/* how each server answers */
 #ifdef AUTH
 	struct authstate auth;
 #endif
@@ -226,6 +228,10 @@ struct dhcp6_state {
 	(D6_CSTATE((ifp)) &&						       \
 	D6_CSTATE((ifp))->reason && dhcp6_dadcompleted((ifp)))
 
+/* One unbound socket receives for every interface, else one per address. */
+#define DHCP6_SHARED(ctx)						       \
+	((ctx)->options & DHCPCD_MASTER || (ctx)->dhcp6_shared)
+
 int dhcp6_openraw(void);
 int dhcp6_openudp(unsigned int, struct in6_addr *);
 void dhcp6_recvmsg(struct dhcpcd_ctx *, struct msghdr *, struct ipv6_addr *);
@@ -239,6 +245,8 @@ size_t dhcp6_find_delegates(struct interface *);
 int dhcp6_start(struct interface *, enum DH6S);
 void dhcp6_reboot(struct interface *);
 void dhcp6_renew(struct interface *);
+ssize_t dhcp6_optenv(FILE *, const char *, const struct interface *,
+    const struct dhcp6_message *, size_t);
 ssize_t dhcp6_env(FILE *, const char *, const struct interface *,
     const struct dhcp6_message *, size_t);
 void dhcp6_free(struct interface *);
@@ -68,9 +68,14 @@ static const char dhcpcd_copyright[] = "Copyright (c) 2006-2020 Roy Marples";
 #include "ipv4ll.h"
 #include "ipv6.h"
 #include "ipv6nd.h"
+#include "leasedb.h"
+#include "leasewb.h"
 #include "logerr.h"
+#include "netconf.h"
 #include "privsep.h"
 #include "script.h"
+#include "shard.h"
+#include "snapshot.h"
 
 #ifdef HAVE_CAPSICUM
 #include <sys/capsicum.h>
@@ -121,6 +126,8 @@ printf("usage: "PACKAGE"\t[-146ABbDdEGgHJKLMNPpqTV]\n"
 	"       "PACKAGE"\t-n, --rebind [interface]\n"
 	"       "PACKAGE"\t-k, --release [interface]\n"
 	"       "PACKAGE"\t-U, --dumplease interface\n"
+	"       "PACKAGE"\t--stats eloop | memory | control | log[:count] |\n"
+	"\t\tstartup | usage | counters[:reset] | servers\n"
 	"       "PACKAGE"\t--version\n"
 	"       "PACKAGE"\t-x, --exit [interface]\n");
 }
@@ -128,7 +135,6 @@ printf("usage: "PACKAGE"\t[-146ABbDdEGgHJKLMNPpqTV]\n"
 static void
 free_globals(struct dhcpcd_ctx *ctx)
 {
-	struct dhcp_opt *opt;
 
 	if (ctx->ifac) {
 		for (; ctx->ifac > 0; ctx->ifac--)
@@ -148,45 +154,8 @@ free_globals(struct dhcpcd_ctx *ctx)
 		free(ctx->ifcv);
 		ctx->ifcv = NULL;
 	}
-
-#ifdef INET
-	if (ctx->dhcp_opts) {
-		for (opt = ctx->dhcp_opts;
-		    ctx->dhcp_opts_len > 0;
-		    opt++, ctx->dhcp_opts_len--)
-			free_dhcp_opt_embenc(opt);
-		free(ctx->dhcp_opts);
-		ctx->dhcp_opts = NULL;
-	}
-#endif
-#ifdef INET6
-	if (ctx->nd_opts) {
-		for (opt = ctx->nd_opts;
-		    ctx->nd_opts_len > 0;
-		    opt++, ctx->nd_opts_len--)
-			free_dhcp_opt_embenc(opt);
-		free(ctx->nd_opts);
-		ctx->nd_opts = NULL;
-	}
-#ifdef DHCP6
-	if (ctx->dhcp6_opts) {
-		for (opt = ctx->dhcp6_opts;
-		    ctx->dhcp6_opts_len > 0;
-		    opt++, ctx->dhcp6_opts_len--)
-			free_dhcp_opt_embenc(opt);
-		free(ctx->dhcp6_opts);
-		ctx->dhcp6_opts = NULL;
-	}
-#endif
-#endif
-	if (ctx->vivso) {
-		for (opt = ctx->vivso;
-		    ctx->vivso_len > 0;
-		    opt++, ctx->vivso_len--)
-			free_dhcp_opt_embenc(opt);
-		free(ctx->vivso);
-		ctx->vivso = NULL;
-	}
+	free_config(ctx);
+	free_definitions(ctx);
 }
 
 static void
@@ -408,6 +377,36 @@ dhcpcd_drop(struct interface *ifp, int stop)
 #endif
 }
 
+/* Drop only the protocols whose options changed. */
+static void
+dhcpcd_dropchanged(struct interface *ifp, unsigned int changed)
+{
+
+	if (IFO_CHANGED(changed, IFO_DIGEST_ANY)) {
+		dhcpcd_drop(ifp, 0);
+		return;
+	}
+#ifdef DHCP6
+	if (IFO_CHANGED(changed, IFO_DIGEST_DHCP6))
+		dhcp6_drop(ifp, "EXPIRE6");
+#endif
+#ifdef INET6
+	if (IFO_CHANGED(changed, IFO_DIGEST_IPV6ND))
+		ipv6nd_drop(ifp);
+#endif
+	if (IFO_CHANGED(changed, IFO_DIGEST_DHCP)) {
+#ifdef IPV4LL
+		ipv4ll_drop(ifp);
+#endif
+#ifdef INET
+		dhcp_drop(ifp, "EXPIRE");
+#endif
+#ifdef ARP
+		arp_drop(ifp);
+#endif
+	}
+}
+
 static void
 stop_interface(struct interface *ifp, const char *reason)
 {
@@ -452,8 +451,11 @@ configure_interface1(struct interface *ifp)
 			ifo->options |= DHCPCD_STATIC;
 	}
 
-	if (ifo->metric != -1)
+	if (ifo->metric != -1 && ifp->metric != (unsigned int)ifo->metric) {
+		/* Routes are keyed by interface metric. */
+		rt_kroutes_flush(ifp->ctx, AF_UNSPEC);
 		ifp->metric = (unsigned int)ifo->metric;
+	}
 
 #ifdef INET6
 	/* We want to setup INET6 on the interface as soon as possible. */
@@ -576,16 +578,14 @@ configure_interface1(struct interface *ifp)
 		ifo->options |= DHCPCD_LASTLEASE_EXTEND;
 }
 
-int
-dhcpcd_selectprofile(struct interface *ifp, const char *profile)
+static void
+dhcpcd_pssid(const struct interface *ifp, char *pssid, size_t len)
 {
-	struct if_options *ifo;
-	char pssid[PROFILE_LEN];
 
 	if (ifp->ssid_len) {
 		ssize_t r;
 
-		r = print_string(pssid, sizeof(pssid), OT_ESCSTRING,
+		r = print_string(pssid, len, OT_ESCSTRING,
 		    ifp->ssid, ifp->ssid_len);
 		if (r == -1) {
 			logerr(__func__);
@@ -593,6 +593,15 @@ dhcpcd_selectprofile(struct interface *ifp, const char *profile)
 		}
 	} else
 		pssid[0] = '\0';
+}
+
+int
+dhcpcd_selectprofile(struct interface *ifp, const char *profile)
+{
+	struct if_options *ifo;
+	char pssid[PROFILE_LEN];
+
+	dhcpcd_pssid(ifp, pssid, sizeof(pssid));
 	ifo = read_config(ifp->ctx, ifp->name, pssid, profile);
 	if (ifo == NULL) {
 		logdebugx("%s: no profile %s", ifp->name, profile);
@@ -606,6 +615,7 @@ dhcpcd_selectprofile(struct interface *ifp, const char *profile)
 
 	free_options(ifp->ctx, ifp->options);
 	ifp->options = ifo;
+	script_freeenv(ifp);
 	if (profile) {
 		add_options(ifp->ctx, ifp->name, ifp->options,
 		    ifp->ctx->argc, ifp->ctx->argv);
@@ -619,8 +629,14 @@ configure_interface(struct interface *ifp, int argc, char **argv,
     unsigned long long options)
 {
 	time_t old;
+	uint32_t digest[IFO_DIGEST_MAX];
+	unsigned int changed;
 
-	old = ifp->options ? ifp->options->mtime : 0;
+	if (ifp->options != NULL) {
+		old = ifp->options->mtime;
+		memcpy(digest, ifp->options->digest, sizeof(digest));
+	} else
+		old = 0;
 	dhcpcd_selectprofile(ifp, NULL);
 	if (ifp->options == NULL) {
 		/* dhcpcd cannot continue with this interface. */
@@ -631,11 +647,15 @@ configure_interface(struct interface *ifp, int argc, char **argv,
 	ifp->options->options |= options;
 	configure_interface1(ifp);
 
-	/* If the mtime has changed drop any old lease */
-	if (old != 0 && ifp->options->mtime != old) {
+	/* If the mtime has changed drop any old lease the changes
+	 * are for. */
+	if (old != 0 && ifp->options->mtime != old &&
+	    (changed = if_options_changed(digest, ifp->options->digest) &
+	    IFO_CHANGED_RESTART) != 0)
+	{
 		logwarnx("%s: config file changed, expiring leases",
 		    ifp->name);
-		dhcpcd_drop(ifp, 0);
+		dhcpcd_dropchanged(ifp, changed);
 	}
 }
 
@@ -650,8 +670,9 @@ dhcpcd_initstate2(struct interface *ifp, unsigned long long options)
 			return;
 		}
 		ifo->options |= options;
-		free(ifp->options);
+		free_options(ifp->ctx, ifp->options);
 		ifp->options = ifo;
+		script_freeenv(ifp);
 	} else
 		ifo = ifp->options;
 
@@ -695,8 +716,8 @@ dhcpcd_reportssid(struct interface *ifp)
 	loginfox("%s: connected to Access Point: %s", ifp->name, pssid);
 }
 
-void
-dhcpcd_handlecarrier(struct interface *ifp, int carrier, unsigned int flags)
+static void
+dhcpcd_handlecarrier1(struct interface *ifp, int carrier, unsigned int flags)
 {
 	bool was_link_up = if_is_link_up(ifp);
 
@@ -704,6 +725,10 @@ dhcpcd_handlecarrier(struct interface *ifp, int carrier, unsigned int flags)
 	ifp->flags = flags;
 
 	if (!if_is_link_up(ifp)) {
+		/* The kernel may drop routes on link down without
+		 * telling us, so learn them again. */
+		if (was_link_up)
+			rt_kroutes_flush(ifp->ctx, AF_UNSPEC);
 		if (!was_link_up || !ifp->active)
 			return;
 		loginfox("%s: carrier lost", ifp->name);
@@ -748,6 +773,7 @@ dhcpcd_handlecarrier(struct interface *ifp, int carrier, unsigned int flags)
 		return;
 
 	if (ifp->active) {
+		dhcpcd_phase(ifp->ctx, ifp, PHASE_CARRIER);
 		if (carrier == LINK_UNKNOWN)
 			loginfox("%s: carrier unknown, assuming up", ifp->name);
 		else
@@ -802,6 +828,60 @@ dhcpcd_handlecarrier(struct interface *ifp, int carrier, unsigned int flags)
 	dhcpcd_startinterface(ifp);
 }
 
+static void
+dhcpcd_carriersettled(void *arg)
+{
+	struct interface *ifp = arg;
+
+	dhcpcd_handlecarrier1(ifp, ifp->carrier_next, ifp->flags_next);
+}
+
+/*
+ * With carrier_debounce, a change of link must last a while before we
+ * act on it, so a flapping link does not restart everything each time.
+ * Going back to how it was within the wait is as if nothing happened.
+ */
+void
+dhcpcd_handlecarrier(struct interface *ifp, int carrier, unsigned int flags)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct if_options *ifo = ifp->options;
+	unsigned int wait;
+	bool is_link_up;
+
+	if (!ifp->active || ifo == NULL ||
+	    (ifo->carrier_down == 0 && ifo->carrier_up == 0))
+		goto handle;
+
+	is_link_up = flags & IFF_UP &&
+	    (carrier != LINK_DOWN || !(ifo->options & DHCPCD_LINK));
+	if (is_link_up == if_is_link_up(ifp)) {
+		if (eloop_timer_pending(ctx->eloop, ifp->carrier_timer)) {
+			eloop_timer_cancel(ctx->eloop, &ifp->carrier_timer);
+			logdebugx("%s: carrier flap ignored", ifp->name);
+		}
+		goto handle;
+	}
+
+	wait = is_link_up ? ifo->carrier_up : ifo->carrier_down;
+	if (wait == 0)
+		goto handle;
+	ifp->carrier_next = carrier;
+	ifp->flags_next = flags;
+	/* Timed from the first change, so a flapping link settles. */
+	if (eloop_timer_pending(ctx->eloop, ifp->carrier_timer))
+		return;
+	logdebugx("%s: carrier %s, waiting %u ms", ifp->name,
+	    is_link_up ? "back" : "lost", wait);
+	if (eloop_timer_add_msec(ctx->eloop, &ifp->carrier_timer, wait,
+	    dhcpcd_carriersettled, ifp) != -1)
+		return;
+	logerr(__func__);
+
+handle:
+	dhcpcd_handlecarrier1(ifp, carrier, flags);
+}
+
 static void
 warn_iaid_conflict(struct interface *ifp, uint16_t ia_type, uint8_t *iaid)
 {
@@ -836,7 +916,7 @@ warn_iaid_conflict(struct interface *ifp, uint16_t ia_type, uint8_t *iaid)
 		    ifp->name, ifn->name);
 }
 
-static void
+void
 dhcpcd_initduid(struct dhcpcd_ctx *ctx, struct interface *ifp)
 {
 	char buf[DUID_LEN * 3];
@@ -852,6 +932,24 @@ dhcpcd_initduid(struct dhcpcd_ctx *ctx, struct interface *ifp)
 	    hwaddr_ntoa(ctx->duid, ctx->duid_len, buf, sizeof(buf)));
 }
 
+#ifdef DHCP6
+static void
+dhcpcd_startdhcp6(struct interface *ifp)
+{
+	struct if_options *ifo = ifp->options;
+	enum DH6S d6_state;
+
+	if (ifo->options & DHCPCD_IA_FORCED)
+		d6_state = DH6S_INIT;
+	else if (ifo->options & DHCPCD_INFORM6)
+		d6_state = DH6S_INFORM;
+	else
+		d6_state = DH6S_CONFIRM;
+	if (dhcp6_start(ifp, d6_state) == -1)
+		logerr("%s: dhcp6_start", ifp->name);
+}
+#endif
+
 void
 dhcpcd_startinterface(void *arg)
 {
@@ -862,6 +960,8 @@ dhcpcd_startinterface(void *arg)
 		loginfox("%s: waiting for carrier", ifp->name);
 		return;
 	}
+	dhcpcd_phase(ifp->ctx, ifp, PHASE_CARRIER);
+	snapshot_load(ifp);
 
 	if (ifo->options & (DHCPCD_DUID | DHCPCD_IPV6) &&
 	    !(ifo->options & DHCPCD_ANONYMOUS))
@@ -915,20 +1015,9 @@ dhcpcd_startinterface(void *arg)
 		if (ifp->active)
 			dhcp6_find_delegates(ifp);
 
-		if (ifo->options & DHCPCD_DHCP6) {
-			if (ifp->active == IF_ACTIVE_USER) {
-				enum DH6S d6_state;
-
-				if (ifo->options & DHCPCD_IA_FORCED)
-					d6_state = DH6S_INIT;
-				else if (ifo->options & DHCPCD_INFORM6)
-					d6_state = DH6S_INFORM;
-				else
-					d6_state = DH6S_CONFIRM;
-				if (dhcp6_start(ifp, d6_state) == -1)
-					logerr("%s: dhcp6_start", ifp->name);
-			}
-		}
+		if (ifo->options & DHCPCD_DHCP6 &&
+		    ifp->active == IF_ACTIVE_USER)
+			dhcpcd_startdhcp6(ifp);
 #endif
 	}
 #endif
@@ -943,12 +1032,12 @@ dhcpcd_startinterface(void *arg)
 }
 
 static void
-dhcpcd_prestartinterface(void *arg)
+dhcpcd_upinterface(struct interface *ifp)
 {
-	struct interface *ifp = arg;
 	struct dhcpcd_ctx *ctx = ifp->ctx;
 	bool anondown;
 
+	dhcpcd_phase(ctx, ifp, PHASE_PRESTART);
 	if (ifp->carrier <= LINK_DOWN &&
 	    ifp->options->options & DHCPCD_ANONYMOUS &&
 	    ifp->flags & IFF_UP)
@@ -968,10 +1057,39 @@ dhcpcd_prestartinterface(void *arg)
 		if (if_up(ifp) == -1)
 			logerr(__func__);
 	}
+}
 
+static void
+dhcpcd_prestartinterface(void *arg)
+{
+	struct interface *ifp = arg;
+
+	dhcpcd_upinterface(ifp);
 	dhcpcd_startinterface(ifp);
 }
 
+/*
+ * Bring every interface up before starting any of them so their links
+ * come up together.
+ * Interfaces already up start on the carrier from the discovery dump;
+ * the rest start when the kernel reports carrier.
+ */
+static void
+dhcpcd_prestartinterfaces(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct interface *ifp;
+
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		if (ifp->active)
+			dhcpcd_upinterface(ifp);
+	}
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		if (ifp->active)
+			dhcpcd_startinterface(ifp);
+	}
+}
+
 static void
 run_preinit(struct interface *ifp)
 {
@@ -1004,17 +1122,182 @@ dhcpcd_activateinterface(struct interface *ifp, unsigned long long options)
 	}
 }
 
+static void
+dhcpcd_linkfilter(struct dhcpcd_ctx *ctx)
+{
+
+	if (if_linkfilter(ctx) == -1)
+		logerr("%s: if_linkfilter", __func__);
+}
+
+/* Merge a discovered interface into ours.
+ * Returns true if it was not known before. */
+static bool
+dhcpcd_mergeinterface(struct dhcpcd_ctx *ctx, struct if_head *ifs,
+    struct interface *ifp)
+{
+	struct interface *iff;
+
+	/* Check if we already have the interface */
+	iff = if_find(ctx->ifaces, ifp->name);
+
+	if (iff != NULL) {
+		if (iff->active)
+			logdebugx("%s: interface updated", iff->name);
+		/* The flags and hwaddr could have changed */
+		iff->flags = ifp->flags;
+		iff->hwlen = ifp->hwlen;
+		if (ifp->hwlen != 0)
+			memcpy(iff->hwaddr, ifp->hwaddr, iff->hwlen);
+		return false;
+	}
+
+	TAILQ_REMOVE(ifs, ifp, next);
+	TAILQ_INSERT_TAIL(ctx->ifaces, ifp, next);
+	if_indexctx(ifp);
+	if (ifp->active) {
+		logdebugx("%s: interface added", ifp->name);
+		dhcpcd_initstate(ifp, 0);
+		run_preinit(ifp);
+	}
+	return true;
+}
+
+static void
+dhcpcd_freediscovered(struct dhcpcd_ctx *ctx, struct if_head *ifs,
+    struct ifaddrs **ifaddrs)
+{
+	struct interface *ifp;
+
+	if_freeifaddrs(ctx, ifaddrs);
+	while ((ifp = TAILQ_FIRST(ifs))) {
+		TAILQ_REMOVE(ifs, ifp, next);
+		if_free(ifp);
+	}
+	free(ifs);
+}
+
+static int
+dhcpcd_ifqfind(struct dhcpcd_ctx *ctx, const char *ifname)
+{
+	int i;
+
+	for (i = 0; i < ctx->ifqc; i++) {
+		if (strcmp(ctx->ifqv[i], ifname) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static void
+dhcpcd_ifqfree(struct dhcpcd_ctx *ctx)
+{
+
+	for (; ctx->ifqc > 0; ctx->ifqc--)
+		free(ctx->ifqv[ctx->ifqc - 1]);
+	free(ctx->ifqv);
+	ctx->ifqv = NULL;
+}
+
+/* Discover every interface which arrived since the last pass in one go.
+ * A burst of new interfaces, such as a container host creating hundreds
+ * of veth pairs, then costs one walk of the kernel list rather than
+ * one per interface. */
+static void
+dhcpcd_handleifqueue(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct ifaddrs *ifaddrs;
+	struct if_head *ifs;
+	struct interface *ifp, *ifn;
+	bool added;
+	int i;
+
+	if (ctx->ifqc == 0)
+		return;
+
+	ifs = if_discover(ctx, &ifaddrs, 0, NULL);
+	if (ifs == NULL) {
+		logerr(__func__);
+		dhcpcd_ifqfree(ctx);
+		return;
+	}
+
+	added = false;
+	TAILQ_FOREACH_SAFE(ifp, ifs, next, ifn) {
+		if (dhcpcd_ifqfind(ctx, ifp->name) == -1) {
+			TAILQ_REMOVE(ifs, ifp, next);
+			if_free(ifp);
+		} else if (dhcpcd_mergeinterface(ctx, ifs, ifp))
+			added = true;
+	}
+	if (added)
+		dhcpcd_linkfilter(ctx);
+
+	if_learnaddrs(ctx, ifs, &ifaddrs);
+	/* An interface quickly added and then removed won't be found. */
+	for (i = 0; i < ctx->ifqc; i++) {
+		ifp = if_find(ctx->ifaces, ctx->ifqv[i]);
+		if (ifp != NULL && ifp->active)
+			dhcpcd_prestartinterface(ifp);
+	}
+
+	dhcpcd_freediscovered(ctx, ifs, &ifaddrs);
+	dhcpcd_ifqfree(ctx);
+}
+
+static int
+dhcpcd_ifqueue(struct dhcpcd_ctx *ctx, const char *ifname)
+{
+	char **ifqv, *name;
+
+	if (dhcpcd_ifqfind(ctx, ifname) != -1)
+		return 1;
+
+	ifqv = reallocarray(ctx->ifqv, (size_t)ctx->ifqc + 1, sizeof(*ifqv));
+	if (ifqv == NULL)
+		return -1;
+	ctx->ifqv = ifqv;
+	if ((name = strdup(ifname)) == NULL)
+		return -1;
+	ctx->ifqv[ctx->ifqc++] = name;
+
+	/* Let every event already waiting join this pass. */
+	if (ctx->ifqc == 1 &&
+	    eloop_timeout_add_sec(ctx->eloop, 0,
+	    dhcpcd_handleifqueue, ctx) == -1)
+	{
+		dhcpcd_ifqfree(ctx);
+		return -1;
+	}
+	return 1;
+}
+
+static void
+dhcpcd_ifqdrop(struct dhcpcd_ctx *ctx, const char *ifname)
+{
+	int i;
+
+	if ((i = dhcpcd_ifqfind(ctx, ifname)) == -1)
+		return;
+	free(ctx->ifqv[i]);
+	ctx->ifqv[i] = ctx->ifqv[--ctx->ifqc];
+	if (ctx->ifqc == 0)
+		eloop_timeout_delete(ctx->eloop, dhcpcd_handleifqueue, ctx);
+}
+
 int
 dhcpcd_handleinterface(void *arg, int action, const char *ifname)
 {
 	struct dhcpcd_ctx *ctx = arg;
 	struct ifaddrs *ifaddrs;
 	struct if_head *ifs;
-	struct interface *ifp, *iff;
+	struct interface *ifp;
 	const char * const argv[] = { ifname };
 	int e;
 
 	if (action == -1) {
+		dhcpcd_ifqdrop(ctx, ifname);
 		ifp = if_find(ctx->ifaces, ifname);
 		if (ifp == NULL) {
 			errno = ESRCH;
@@ -1026,9 +1309,14 @@ dhcpcd_handleinterface(void *arg, int action, const char *ifname)
 		}
 		TAILQ_REMOVE(ctx->ifaces, ifp, next);
 		if_free(ifp);
+		dhcpcd_linkfilter(ctx);
 		return 0;
 	}
 
+	/* New interfaces are discovered together. */
+	if (action > 0)
+		return dhcpcd_ifqueue(ctx, ifname);
+
 	ifs = if_discover(ctx, &ifaddrs, -1, UNCONST(argv));
 	if (ifs == NULL) {
 		logerr(__func__);
@@ -1041,46 +1329,13 @@ dhcpcd_handleinterface(void *arg, int action, const char *ifname)
 		 * and then removed. */
 		errno = ENOENT;
 		e = -1;
-		goto out;
-	}
-	e = 1;
-
-	/* Check if we already have the interface */
-	iff = if_find(ctx->ifaces, ifp->name);
-
-	if (iff != NULL) {
-		if (iff->active)
-			logdebugx("%s: interface updated", iff->name);
-		/* The flags and hwaddr could have changed */
-		iff->flags = ifp->flags;
-		iff->hwlen = ifp->hwlen;
-		if (ifp->hwlen != 0)
-			memcpy(iff->hwaddr, ifp->hwaddr, iff->hwlen);
 	} else {
-		TAILQ_REMOVE(ifs, ifp, next);
-		TAILQ_INSERT_TAIL(ctx->ifaces, ifp, next);
-		if (ifp->active) {
-			logdebugx("%s: interface added", ifp->name);
-			dhcpcd_initstate(ifp, 0);
-			run_preinit(ifp);
-		}
-		iff = ifp;
-	}
-
-	if (action > 0) {
-		if_learnaddrs(ctx, ifs, &ifaddrs);
-		if (iff->active)
-			dhcpcd_prestartinterface(iff);
-	}
-
-out:
-	/* Free our discovered list */
-	while ((ifp = TAILQ_FIRST(ifs))) {
-		TAILQ_REMOVE(ifs, ifp, next);
-		if_free(ifp);
+		if (dhcpcd_mergeinterface(ctx, ifs, ifp))
+			dhcpcd_linkfilter(ctx);
+		e = 1;
 	}
-	free(ifs);
 
+	dhcpcd_freediscovered(ctx, ifs, &ifaddrs);
 	return e;
 }
 
@@ -1099,20 +1354,30 @@ dhcpcd_handlelink(void *arg)
 	}
 }
 
+/* Apply the link changes we missed from the rediscovered ifp0. */
 static void
-dhcpcd_checkcarrier(void *arg)
+dhcpcd_checklink(void *arg)
 {
 	struct interface *ifp0 = arg, *ifp;
 
 	ifp = if_find(ifp0->ctx->ifaces, ifp0->name);
-	if (ifp == NULL || ifp->carrier == ifp0->carrier)
-		return;
-
-	dhcpcd_handlecarrier(ifp, ifp0->carrier, ifp0->flags);
+	if (ifp != NULL) {
+		if (ifp->hwtype != ifp0->hwtype ||
+		    ifp->hwlen != ifp0->hwlen ||
+		    memcmp(ifp->hwaddr, ifp0->hwaddr, ifp0->hwlen) != 0)
+			dhcpcd_handlehwaddr(ifp, ifp0->hwtype,
+			    ifp0->hwaddr, ifp0->hwlen);
+		if (ifp->carrier != ifp0->carrier)
+			dhcpcd_handlecarrier(ifp, ifp0->carrier,
+			    ifp0->flags);
+	}
 	if_free(ifp0);
 }
 
 #ifndef SMALL
+/* Each overflow doubles the buffer, up to this. */
+#define	LINK_RCVBUF_MAX		(8 * 1024 * 1024)
+
 static void
 dhcpcd_setlinkrcvbuf(struct dhcpcd_ctx *ctx)
 {
@@ -1125,6 +1390,12 @@ dhcpcd_setlinkrcvbuf(struct dhcpcd_ctx *ctx)
 	    ctx->link_rcvbuf);
 
 	socklen = sizeof(ctx->link_rcvbuf);
+#ifdef SO_RCVBUFFORCE
+	/* Go past the system limit if we are allowed to. */
+	if (setsockopt(ctx->link_fd, SOL_SOCKET,
+	    SO_RCVBUFFORCE, &ctx->link_rcvbuf, socklen) == 0)
+		return;
+#endif
 	if (setsockopt(ctx->link_fd, SOL_SOCKET,
 	    SO_RCVBUF, &ctx->link_rcvbuf, socklen) == -1)
 		logerr(__func__);
@@ -1164,6 +1435,18 @@ dhcpcd_linkoverflow(struct dhcpcd_ctx *ctx)
 	logerrx("route socket overflowed (rcvbuflen %d)"
 	    " - learning interface state", rcvbuflen);
 
+#ifndef SMALL
+	/* Make room for the next burst so recovery gets rarer. */
+	if (rcvbuflen > 0 && rcvbuflen < LINK_RCVBUF_MAX) {
+		ctx->link_rcvbuf = rcvbuflen < LINK_RCVBUF_MAX / 2 ?
+		    rcvbuflen * 2 : LINK_RCVBUF_MAX;
+		dhcpcd_setlinkrcvbuf(ctx);
+	}
+#endif
+
+	/* We missed route changes as well. */
+	rt_kroutes_flush(ctx, AF_UNSPEC);
+
 	/* Drain the socket.
 	 * We cannot open a new one due to privsep. */
 	rcnt = 0;
@@ -1195,13 +1478,14 @@ dhcpcd_linkoverflow(struct dhcpcd_ctx *ctx)
 		ifp1 = if_find(ctx->ifaces, ifp->name);
 		if (ifp1 != NULL) {
 			/* If the interface already exists,
-			 * check carrier state.
-			 * dhcpcd_checkcarrier will free ifp. */
+			 * check carrier state and hardware address.
+			 * dhcpcd_checklink will free ifp. */
 			eloop_timeout_add_sec(ctx->eloop, 0,
-			    dhcpcd_checkcarrier, ifp);
+			    dhcpcd_checklink, ifp);
 			continue;
 		}
 		TAILQ_INSERT_TAIL(ctx->ifaces, ifp, next);
+		if_indexctx(ifp);
 		if (ifp->active) {
 			dhcpcd_initstate(ifp, 0);
 			eloop_timeout_add_sec(ctx->eloop, 0,
@@ -1209,11 +1493,15 @@ dhcpcd_linkoverflow(struct dhcpcd_ctx *ctx)
 		}
 	}
 	free(ifaces);
+	dhcpcd_linkfilter(ctx);
 
 	/* Update address state. */
 	if_markaddrsstale(ctx->ifaces);
 	if_learnaddrs(ctx, ctx->ifaces, &ifaddrs);
 	if_deletestaleaddrs(ctx->ifaces);
+
+	/* Put back any of our routes removed while we weren't looking. */
+	rt_resync(ctx);
 }
 
 void
@@ -1241,212 +1529,1058 @@ dhcpcd_handlehwaddr(struct interface *ifp,
 	    (hwlen == 0 || memcmp(ifp->hwaddr, hwaddr, hwlen) == 0))
 		return;
 
-	loginfox("%s: new hardware address: %s", ifp->name,
-	    hwaddr_ntoa(hwaddr, hwlen, buf, sizeof(buf)));
-	ifp->hwlen = hwlen;
-	if (hwaddr != NULL)
-		memcpy(ifp->hwaddr, hwaddr, hwlen);
+	loginfox("%s: new hardware address: %s", ifp->name,
+	    hwaddr_ntoa(hwaddr, hwlen, buf, sizeof(buf)));
+	ifp->hwlen = hwlen;
+	if (hwaddr != NULL)
+		memcpy(ifp->hwaddr, hwaddr, hwlen);
+}
+
+/* What reading the configuration again would change, leaving the
+ * options we have alone. */
+static unsigned int
+dhcpcd_optschanged(struct interface *ifp, int argc, char **argv)
+{
+	struct if_options *ifo;
+	char pssid[PROFILE_LEN];
+	unsigned int changed;
+
+	dhcpcd_pssid(ifp, pssid, sizeof(pssid));
+	if ((ifo = read_config(ifp->ctx, ifp->name, pssid, NULL)) == NULL)
+		return IFO_CHANGED_ANY;
+	add_options(ifp->ctx, ifp->name, ifo, argc, argv);
+	changed = if_options_changed(ifp->options->digest, ifo->digest);
+	free_options(ifp->ctx, ifo);
+	return changed;
+}
+
+/* Start again just the protocols whose options changed. */
+static void
+dhcpcd_restartchanged(struct interface *ifp, unsigned int changed)
+{
+	struct if_options *ifo = ifp->options;
+
+	if (ifp->active != IF_ACTIVE_USER ||
+	    (ifo->options & DHCPCD_LINK && !if_is_link_up(ifp)))
+		return;
+
+#ifdef INET6
+	if (IFO_CHANGED(changed, IFO_DIGEST_IPV6ND) &&
+	    (ifo->options & (DHCPCD_IPV6 | DHCPCD_IPV6RS)) ==
+	    (DHCPCD_IPV6 | DHCPCD_IPV6RS))
+		ipv6nd_startrs(ifp);
+#endif
+#ifdef DHCP6
+	if (IFO_CHANGED(changed, IFO_DIGEST_DHCP6) &&
+	    (ifo->options & (DHCPCD_IPV6 | DHCPCD_DHCP6)) ==
+	    (DHCPCD_IPV6 | DHCPCD_DHCP6))
+		dhcpcd_startdhcp6(ifp);
+#endif
+#ifdef INET
+	if (IFO_CHANGED(changed, IFO_DIGEST_DHCP) &&
+	    ifo->options & DHCPCD_IPV4 && ipv4_getstate(ifp) != NULL)
+		dhcp_start(ifp);
+#endif
+}
+
+static void
+if_reboot(struct interface *ifp, int argc, char **argv, bool force)
+{
+	unsigned int changed;
+#ifdef INET
+	unsigned long long oldopts;
+#endif
+
+	changed = force ? IFO_CHANGED_ANY :
+	    dhcpcd_optschanged(ifp, argc, argv);
+	if (changed == 0) {
+		logdebugx("%s: configuration unchanged", ifp->name);
+		return;
+	}
+	if (!(changed & IFO_CHANGED_RESTART)) {
+		/* Nothing to restart, but use the new options. */
+		logdebugx("%s: configuration updated", ifp->name);
+		configure_interface(ifp, argc, argv, 0);
+		return;
+	}
+
+#ifdef INET
+	oldopts = ifp->options->options;
+#endif
+	script_runreason(ifp, "RECONFIGURE");
+	dhcpcd_initstate1(ifp, argc, argv, 0);
+#ifdef INET
+	if (IFO_CHANGED(changed, IFO_DIGEST_ANY) ||
+	    IFO_CHANGED(changed, IFO_DIGEST_DHCP))
+		dhcp_reboot_newopts(ifp, oldopts);
+#endif
+#ifdef DHCP6
+	if (IFO_CHANGED(changed, IFO_DIGEST_ANY) ||
+	    IFO_CHANGED(changed, IFO_DIGEST_DHCP6))
+		dhcp6_reboot(ifp);
+#endif
+	if (IFO_CHANGED(changed, IFO_DIGEST_ANY))
+		dhcpcd_prestartinterface(ifp);
+	else
+		dhcpcd_restartchanged(ifp, changed);
+}
+
+static void
+reload_config(struct dhcpcd_ctx *ctx)
+{
+	struct if_options *ifo;
+
+	free_globals(ctx);
+	if ((ifo = read_config(ctx, NULL, NULL, NULL)) == NULL)
+		return;
+	add_options(ctx, NULL, ifo, ctx->argc, ctx->argv);
+	/* We need to preserve these options. */
+	if (ctx->options & DHCPCD_STARTED)
+		ifo->options |= DHCPCD_STARTED;
+	if (ctx->options & DHCPCD_MASTER)
+		ifo->options |= DHCPCD_MASTER;
+	if (ctx->options & DHCPCD_DAEMONISED)
+		ifo->options |= DHCPCD_DAEMONISED;
+	if (ctx->options & DHCPCD_PRIVSEP)
+		ifo->options |= DHCPCD_PRIVSEP;
+	ctx->options = ifo->options;
+	free_options(ctx, ifo);
+}
+
+/* Unless forced, an interface whose options have not changed is
+ * left alone. */
+static void
+reconf_reboot(struct dhcpcd_ctx *ctx, int action, int argc, char **argv,
+    int oi, bool force)
+{
+	int i;
+	struct interface *ifp;
+
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		for (i = oi; i < argc; i++) {
+			if (strcmp(ifp->name, argv[i]) == 0)
+				break;
+		}
+		if (oi != argc && i == argc)
+			continue;
+		if (ifp->active == IF_ACTIVE_USER) {
+			if (action)
+				if_reboot(ifp, argc, argv, force);
+#ifdef INET
+			else
+				ipv4_applyaddr(ifp);
+#endif
+		} else if (i != argc) {
+			ifp->active = IF_ACTIVE_USER;
+			dhcpcd_initstate1(ifp, argc, argv, 0);
+			run_preinit(ifp);
+			dhcpcd_prestartinterface(ifp);
+		}
+	}
+}
+
+static void
+stop_all_interfaces(struct dhcpcd_ctx *ctx, unsigned long long opts)
+{
+	struct interface *ifp;
+
+	ctx->options |= DHCPCD_EXITING;
+	if (ctx->ifaces == NULL)
+		return;
+
+	/* Drop the last interface first */
+	TAILQ_FOREACH_REVERSE(ifp, ctx->ifaces, if_head, next) {
+		if (!ifp->active)
+			continue;
+		ifp->options->options |= opts;
+		if (ifp->options->options & DHCPCD_RELEASE)
+			ifp->options->options &= ~DHCPCD_PERSISTENT;
+		/* Note what we leave behind before stopping as that
+		 * forgets it. */
+		if (ifp->options->options & DHCPCD_PERSISTENT)
+			snapshot_write(ifp);
+		else
+			snapshot_unlink(ifp);
+		ifp->options->options |= DHCPCD_EXITING;
+		stop_interface(ifp, NULL);
+	}
+}
+
+static void
+dhcpcd_ifrenew(struct interface *ifp)
+{
+
+	if (!ifp->active)
+		return;
+
+	if (ifp->options->options & DHCPCD_LINK && !if_is_link_up(ifp))
+		return;
+
+#ifdef INET
+	dhcp_renew(ifp);
+#endif
+#ifdef INET6
+#define DHCPCD_RARENEW (DHCPCD_IPV6 | DHCPCD_IPV6RS)
+	if ((ifp->options->options & DHCPCD_RARENEW) == DHCPCD_RARENEW)
+		ipv6nd_startrs(ifp);
+#endif
+#ifdef DHCP6
+	dhcp6_renew(ifp);
+#endif
+}
+
+static void
+dhcpcd_renew(struct dhcpcd_ctx *ctx)
+{
+	struct interface *ifp;
+
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		dhcpcd_ifrenew(ifp);
+	}
+}
+
+#ifdef USE_SIGNALS
+#define sigmsg "received %s, %s"
+static void
+dhcpcd_signal_cb(int sig, void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	unsigned long long opts;
+	int exit_code, status;
+	pid_t pid;
+
+	if (ctx->options & DHCPCD_DUMPLEASE) {
+		eloop_exit(ctx->eloop, EXIT_FAILURE);
+		return;
+	}
+
+	if (sig != SIGCHLD && ctx->options & DHCPCD_FORKED) {
+		if (sig != SIGHUP &&
+		    write(ctx->fork_fd, &sig, sizeof(sig)) == -1)
+			logerr("%s: write", __func__);
+		return;
+	}
+
+	/* The workers act on it and we stop once they have. */
+	if (sig != SIGCHLD && ctx->shard_mgr != NULL) {
+		shard_signal(ctx, sig);
+		return;
+	}
+
+	opts = 0;
+	exit_code = EXIT_FAILURE;
+	switch (sig) {
+	case SIGINT:
+		loginfox(sigmsg, "SIGINT", "stopping");
+		break;
+	case SIGTERM:
+		loginfox(sigmsg, "SIGTERM", "stopping");
+		exit_code = EXIT_SUCCESS;
+		break;
+	case SIGALRM:
+		loginfox(sigmsg, "SIGALRM", "releasing");
+		opts |= DHCPCD_RELEASE;
+		exit_code = EXIT_SUCCESS;
+		break;
+	case SIGHUP:
+		loginfox(sigmsg, "SIGHUP", "rebinding");
+		reload_config(ctx);
+		/* Preserve any options passed on the commandline
+		 * when we were started. */
+		reconf_reboot(ctx, 1, ctx->argc, ctx->argv,
+		    ctx->argc - ctx->ifc, false);
+		return;
+	case SIGUSR1:
+		loginfox(sigmsg, "SIGUSR1", "renewing");
+		dhcpcd_renew(ctx);
+		return;
+	case SIGUSR2:
+		loginfox(sigmsg, "SIGUSR2", "reopening log");
+#ifdef PRIVSEP
+		if (IN_PRIVSEP(ctx)) {
+			if (ps_root_logreopen(ctx) == -1)
+				logerr("ps_root_logreopen");
+			return;
+		}
+#endif
+		if (logopen(ctx->logfile) == -1)
+			logerr("logopen");
+		return;
+	case SIGCHLD:
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+			script_reap(ctx, pid, status);
+		return;
+	default:
+		logerrx("received signal %d but don't know what to do with it",
+		    sig);
+		return;
+	}
+
+	if (!(ctx->options & DHCPCD_TEST))
+		stop_all_interfaces(ctx, opts);
+	eloop_exit(ctx->eloop, exit_code);
+}
+#endif
+
+static int
+dhcpcd_eloop_stat_cmp(const void *a, const void *b)
+{
+	const struct eloop_stat *sa = *(const struct eloop_stat * const *)a;
+	const struct eloop_stat *sb = *(const struct eloop_stat * const *)b;
+
+	/* Most time spent first. */
+	if (sa->total_ns != sb->total_ns)
+		return sa->total_ns < sb->total_ns ? 1 : -1;
+	return 0;
+}
+
+/* Sent as a single dump entry of lines so it reads back like a lease. */
+#define	STATS_LINE	128
+static int
+dhcpcd_eloop_stats(struct dhcpcd_ctx *ctx, struct fd_list *fd)
+{
+	const struct eloop_stat *stats, **sorted;
+	size_t i, n, len, one = 1;
+	char *buf, *p, addr[32];
+	const char *name;
+	int l, err;
+
+	n = eloop_stats(ctx->eloop, &stats);
+	sorted = reallocarray(NULL, n == 0 ? 1 : n, sizeof(*sorted));
+	if (sorted == NULL)
+		return -1;
+	for (i = 0; i < n; i++)
+		sorted[i] = &stats[i];
+	qsort(sorted, n, sizeof(*sorted), dhcpcd_eloop_stat_cmp);
+
+	len = (n + 1) * STATS_LINE;
+	if ((buf = malloc(len)) == NULL) {
+		free(sorted);
+		return -1;
+	}
+	p = buf;
+	l = snprintf(p, STATS_LINE, "%-32s %10s %12s %10s",
+	    "callback", "calls", "total_us", "max_us");
+	p += l + 1;
+	for (i = 0; i < n; i++) {
+		name = sorted[i]->name;
+		if (name == NULL) {
+			snprintf(addr, sizeof(addr), "%p",
+			    (void *)(uintptr_t)sorted[i]->callback);
+			name = addr;
+		}
+		l = snprintf(p, STATS_LINE, "%-32.64s %10llu %12llu %10llu",
+		    name, sorted[i]->count,
+		    sorted[i]->total_ns / NSEC_PER_USEC,
+		    sorted[i]->max_ns / NSEC_PER_USEC);
+		if (l < 0 || l >= STATS_LINE)
+			l = STATS_LINE - 1;
+		p += l + 1;
+	}
+	free(sorted);
+
+	if (write(fd->fd, &one, sizeof(one)) != sizeof(one))
+		err = -1;
+	else
+		err = control_queue(fd, buf, (size_t)(p - buf));
+	free(buf);
+	return err;
+}
+
+static int
+dhcpcd_pool_stats(struct dhcpcd_ctx *ctx, struct fd_list *fd)
+{
+	const struct pool *pools[] = {
+		&ctx->rt_pool,
+#ifdef INET
+		&ctx->ia4_pool,
+		&ctx->ipv4_lpm.l_pool,
+#endif
+#ifdef INET6
+		&ctx->ia6_pool,
+		&ctx->ipv6_lpm.l_pool,
+#endif
+	};
+	const struct pool *p;
+	const struct interface *ifp;
+	struct arena a = { .a_chunks = NULL };
+	char buf[(__arraycount(pools) + 2) * STATS_LINE], *bp = buf;
+	size_t i, one = 1;
+	int l;
+
+	l = snprintf(bp, STATS_LINE, "%-16s %6s %8s %8s %8s %10s %12s",
+	    "pool", "size", "inuse", "peak", "free", "bytes", "gets");
+	bp += l + 1;
+	for (i = 0; i < __arraycount(pools); i++) {
+		p = pools[i];
+		l = snprintf(bp, STATS_LINE,
+		    "%-16s %6zu %8zu %8zu %8zu %10zu %12llu",
+		    p->p_name, p->p_size, p->p_inuse, p->p_maxinuse,
+		    p->p_nchunks * p->p_perchunk - p->p_inuse,
+		    p->p_nchunks * POOL_CHUNKSIZE, p->p_gets);
+		if (l < 0 || l >= STATS_LINE)
+			l = STATS_LINE - 1;
+		bp += l + 1;
+	}
+
+	/* The interface arenas are summed as one. */
+	if (ctx->ifaces != NULL) {
+		TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+			a.a_inuse += ifp->arena.a_inuse;
+			a.a_maxinuse += ifp->arena.a_maxinuse;
+			a.a_nfree += ifp->arena.a_nfree;
+			a.a_bytes += ifp->arena.a_bytes;
+			a.a_gets += ifp->arena.a_gets;
+		}
+	}
+	l = snprintf(bp, STATS_LINE, "%-16s %6s %8zu %8zu %8zu %10zu %12llu",
+	    "if_arena", "-", a.a_inuse, a.a_maxinuse, a.a_nfree, a.a_bytes,
+	    a.a_gets);
+	if (l < 0 || l >= STATS_LINE)
+		l = STATS_LINE - 1;
+	bp += l + 1;
+
+	if (write(fd->fd, &one, sizeof(one)) != sizeof(one))
+		return -1;
+	return control_queue(fd, buf, (size_t)(bp - buf));
+}
+
+/* What the definitions and their embedded and encapsulated
+ * definitions take. */
+static size_t
+dhcpcd_optsize(const struct dhcp_opt *opts, size_t len, size_t *count)
+{
+	size_t i, bytes = len * sizeof(*opts);
+
+	*count += len;
+	for (i = 0; i < len; i++) {
+		if (opts[i].var != NULL)
+			bytes += strlen(opts[i].var) + 1;
+		bytes += dhcpcd_optsize(opts[i].embopts, opts[i].embopts_len,
+		    count);
+		bytes += dhcpcd_optsize(opts[i].encopts, opts[i].encopts_len,
+		    count);
+	}
+	return bytes;
+}
+
+struct dhcpcd_usage {
+	char *u_p;
+	size_t u_count;
+	size_t u_bytes;
+};
+
+static void
+dhcpcd_usage_line(struct dhcpcd_usage *u, const char *ifname,
+    const char *what, size_t count, size_t bytes)
+{
+	int l;
+
+	if (count == 0 && bytes == 0)
+		return;
+	l = snprintf(u->u_p, STATS_LINE, "%-16s %-12s %8zu %10zu",
+	    ifname, what, count, bytes);
+	if (l < 0 || l >= STATS_LINE)
+		l = STATS_LINE - 1;
+	u->u_p += l + 1;
+	u->u_count += count;
+	u->u_bytes += bytes;
+}
+
+#define	USAGE_IFLINES	8	/* most lines an interface can have */
+#define	USAGE_LINES	12	/* and the rest */
+
+/*
+ * Nothing is counted as it is allocated, instead what each interface
+ * and subsystem holds is worked out from the structures themselves
+ * when asked.  So this costs nothing until someone looks.
+ */
+static int
+dhcpcd_usage_stats(struct dhcpcd_ctx *ctx, struct fd_list *fd)
+{
+	const struct interface *ifp;
+	struct rt *rt;
+	struct dhcpcd_usage u = { .u_p = NULL };
+	size_t nifaces = 0, n, bytes, one = 1;
+	char *buf;
+	int l, err;
+#ifdef INET
+	size_t i;
+	const struct ipv4_state *i4s;
+	const struct ipv4_addr *ia4;
+	const struct dhcp_state *ds;
+#endif
+#ifdef INET6
+	const struct ipv6_state *i6s;
+	const struct ipv6_addr *ia6;
+	const struct ra *rap;
+#endif
+#ifdef DHCP6
+	const struct dhcp6_state *d6s;
+#endif
+	const struct fd_list *cfd;
+#ifdef PRIVSEP
+	const struct ps_queue *pq;
+	const struct ps_ring *pr;
+	const struct ps_process *psp;
+#endif
+
+	if (ctx->ifaces != NULL) {
+		TAILQ_FOREACH(ifp, ctx->ifaces, next)
+			nifaces++;
+	}
+	n = 2 + nifaces * USAGE_IFLINES + USAGE_LINES;
+	if ((buf = malloc(n * STATS_LINE)) == NULL)
+		return -1;
+	u.u_p = buf;
+	l = snprintf(u.u_p, STATS_LINE, "%-16s %-12s %8s %10s",
+	    "interface", "subsystem", "count", "bytes");
+	u.u_p += l + 1;
+
+	for (ifp = nifaces != 0 ? TAILQ_FIRST(ctx->ifaces) : NULL;
+	    ifp != NULL;
+	    ifp = TAILQ_NEXT(ifp, next))
+	{
+		dhcpcd_usage_line(&u, ifp->name, "interface", 1,
+		    sizeof(*ifp) + (ifp->options != NULL ?
+		    sizeof(*ifp->options) : 0));
+		dhcpcd_usage_line(&u, ifp->name, "states",
+		    ifp->arena.a_inuse, ifp->arena.a_bytes);
+
+		n = bytes = 0;
+		RB_TREE_FOREACH(rt, &ctx->routes) {
+			if (rt->rt_ifp == ifp) {
+				n++;
+				bytes += sizeof(*rt);
+			}
+		}
+		dhcpcd_usage_line(&u, ifp->name, "routes", n, bytes);
+
+#ifdef INET
+		n = bytes = 0;
+		if ((i4s = IPV4_CSTATE(ifp)) != NULL) {
+			TAILQ_FOREACH(ia4, &i4s->addrs, next) {
+				n++;
+				bytes += sizeof(*ia4);
+			}
+		}
+		dhcpcd_usage_line(&u, ifp->name, "ipv4", n, bytes);
+
+		n = bytes = 0;
+		if ((ds = D_CSTATE(ifp)) != NULL) {
+			n = (size_t)((ds->send_pkt != NULL) +
+			    (ds->offer != NULL) + (ds->new != NULL) +
+			    (ds->old != NULL));
+			bytes = (ds->send_pkt != NULL ? ds->send_size : 0) +
+			    ds->offer_len + ds->new_len + ds->old_len;
+		}
+		dhcpcd_usage_line(&u, ifp->name, "dhcp", n, bytes);
+#endif
+#ifdef INET6
+		n = bytes = 0;
+		if ((i6s = IPV6_CSTATE(ifp)) != NULL) {
+			TAILQ_FOREACH(ia6, &i6s->addrs, next) {
+				n++;
+				bytes += sizeof(*ia6);
+			}
+		}
+		dhcpcd_usage_line(&u, ifp->name, "ipv6", n, bytes);
+
+		n = bytes = 0;
+		if (ctx->ra_routers != NULL) {
+			TAILQ_FOREACH(rap, ctx->ra_routers, next) {
+				if (rap->iface != ifp)
+					continue;
+				n++;
+				bytes += sizeof(*rap) + rap->data_len;
+				TAILQ_FOREACH(ia6, &rap->addrs, next)
+					bytes += sizeof(*ia6);
+			}
+		}
+		dhcpcd_usage_line(&u, ifp->name, "ra", n, bytes);
+#endif
+#ifdef DHCP6
+		n = bytes = 0;
+		if ((d6s = D6_CSTATE(ifp)) != NULL) {
+			n = (size_t)((d6s->send != NULL) +
+			    (d6s->recv != NULL) + (d6s->new != NULL) +
+			    (d6s->old != NULL));
+			bytes = d6s->send_len + d6s->recv_len +
+			    d6s->new_len + d6s->old_len;
+			TAILQ_FOREACH(ia6, &d6s->addrs, next)
+				bytes += sizeof(*ia6);
+		}
+		dhcpcd_usage_line(&u, ifp->name, "dhcp6", n, bytes);
+#endif
+	}
+
+	n = 0;
+	bytes = 0;
+#ifdef INET
+	bytes += dhcpcd_optsize(ctx->dhcp_opts, ctx->dhcp_opts_len, &n);
+#endif
+#ifdef INET6
+	bytes += dhcpcd_optsize(ctx->nd_opts, ctx->nd_opts_len, &n);
+#endif
+#ifdef DHCP6
+	bytes += dhcpcd_optsize(ctx->dhcp6_opts, ctx->dhcp6_opts_len, &n);
+#endif
+	bytes += dhcpcd_optsize(ctx->vivso, ctx->vivso_len, &n);
+	dhcpcd_usage_line(&u, "-", "definitions", n, bytes);
+
+	n = bytes = 0;
+	RB_TREE_FOREACH(rt, &ctx->kroutes) {
+		n++;
+		bytes += sizeof(*rt);
+	}
+	dhcpcd_usage_line(&u, "-", "kroutes", n, bytes);
+
+	n = bytes = 0;
+	TAILQ_FOREACH(cfd, &ctx->control_fds, next) {
+		n += cfd->queue_len;
+		bytes += sizeof(*cfd) + cfd->queue_bytes;
+	}
+	dhcpcd_usage_line(&u, "-", "control", n, bytes);
+
+	n = (size_t)((ctx->ctl_buf != NULL) + (ctx->script_buf != NULL));
+	bytes = ctx->ctl_buflen + ctx->script_buflen;
+#ifdef INET
+	n += ctx->opt_buffer != NULL;
+	bytes += ctx->opt_buffer_len;
+	n += ctx->dhcp_npkts;
+	for (i = 0; i < ctx->dhcp_npkts; i++)
+		bytes += ctx->dhcp_pktsizes[i];
+#endif
+	dhcpcd_usage_line(&u, "-", "buffers", n, bytes);
+
+#ifdef PRIVSEP
+	n = bytes = 0;
+	TAILQ_FOREACH(psp, &ctx->ps_processes, next) {
+		n++;
+		bytes += sizeof(*psp);
+	}
+	dhcpcd_usage_line(&u, "-", "ps_process", n, bytes);
+
+	n = bytes = 0;
+	TAILQ_FOREACH(pq, &ctx->ps_queues, next) {
+		n += pq->pq_count;
+		bytes += sizeof(*pq);
+	}
+	bytes += ctx->ps_control_bufsize;
+	dhcpcd_usage_line(&u, "-", "ps_buffers", n, bytes);
+
+	/* Each ring is shared with the process at the other end. */
+	n = bytes = 0;
+	TAILQ_FOREACH(pr, &ctx->ps_rings, next) {
+		n++;
+		bytes += sizeof(*pr) + PS_RING_SIZE * 2;
+	}
+	dhcpcd_usage_line(&u, "-", "ps_rings", n, bytes);
+#endif
+
+	l = snprintf(u.u_p, STATS_LINE, "%-16s %-12s %8zu %10zu",
+	    "total", "-", u.u_count, u.u_bytes);
+	if (l < 0 || l >= STATS_LINE)
+		l = STATS_LINE - 1;
+	u.u_p += l + 1;
+
+	if (write(fd->fd, &one, sizeof(one)) != sizeof(one))
+		err = -1;
+	else
+		err = control_queue(fd, buf, (size_t)(u.u_p - buf));
+	free(buf);
+	return err;
+}
+
+/* log[:count] */
+static int
+dhcpcd_log_parse(const char *arg, size_t *count)
+{
+	int e;
+
+	if (strncmp(arg, "log", 3) != 0)
+		return -1;
+	if (arg[3] == '\0') {
+		*count = 0;
+		return 0;
+	}
+	if (arg[3] != ':')
+		return -1;
+	*count = (size_t)strtou(arg + 4, NULL, 0, 1, LOGERR_NDUMP, &e);
+	return e == 0 ? 0 : -1;
+}
+
+static int
+dhcpcd_log_stats(struct fd_list *fd, size_t count)
+{
+	char *buf;
+	size_t len, buflen, one = 1;
+	int err;
+
+	if (count == 0)
+		count = LOGERR_NDUMP;
+	buflen = count * LOGERR_DUMPLINE;
+	if ((buf = malloc(buflen)) == NULL)
+		return -1;
+	len = logdump(buf, buflen, count);
+	if (len == 0)
+		buf[len++] = '\0';
+
+	if (write(fd->fd, &one, sizeof(one)) != sizeof(one))
+		err = -1;
+	else
+		err = control_queue(fd, buf, len);
+	free(buf);
+	return err;
+}
+
+static const char * const dhcpcd_phase_names[PHASE_MAX] = {
+	"config", "ifdiscover", "privsep",
+	"prestart", "carrier",
+	"discover", "offer", "request", "ack", "arp", "bound",
+	"rs", "ra", "dad", "dhcp6",
+};
+
+/* Log where the time went once the interface has a usable address. */
+static void
+dhcpcd_phaselog(const struct interface *ifp)
+{
+	const struct dhcpcd_ctx *ctx = ifp->ctx;
+	char buf[PHASE_MAX * 24], *p = buf;
+	const uint32_t *phases;
+	size_t i, len = sizeof(buf);
+	int l;
+
+	*p = '\0';
+	for (i = 0; i < PHASE_MAX; i++) {
+		phases = i < PHASE_PRESTART ? ctx->phases : ifp->phases;
+		if (phases[i] == 0)
+			continue;
+		l = snprintf(p, len, " %s %u", dhcpcd_phase_names[i],
+		    (phases[i] - 1) / (NSEC_PER_MSEC / NSEC_PER_USEC));
+		if (l < 0 || (size_t)l >= len)
+			break;
+		p += l;
+		len -= (size_t)l;
+	}
+	loginfox("%s: startup ms:%s", ifp->name, buf);
+}
+
+/* Record the time to first reach phase, for ifp or dhcpcd if NULL. */
+void
+dhcpcd_phase(struct dhcpcd_ctx *ctx, struct interface *ifp,
+    enum dhcpcd_phase phase)
+{
+	uint32_t *phases = ifp != NULL ? ifp->phases : ctx->phases;
+	struct timespec now;
+	unsigned long long us;
+	unsigned int nsecs;
+	bool usable;
+
+	if (phases[phase] != 0)
+		return;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		return;
+	us = eloop_timespec_diff(&now, &ctx->started, &nsecs);
+	us = us * (NSEC_PER_SEC / NSEC_PER_USEC) + nsecs / NSEC_PER_USEC;
+	/* Zero means not reached */
+	phases[phase] = us >= UINT32_MAX ? UINT32_MAX : (uint32_t)us + 1;
+
+	if (ifp == NULL || !ifp->options->log_startup)
+		return;
+	usable = phase == PHASE_BOUND || phase == PHASE_DAD ||
+	    phase == PHASE_DHCP6;
+	if (usable &&
+	    (phase == PHASE_BOUND || phases[PHASE_BOUND] == 0) &&
+	    (phase == PHASE_DAD || phases[PHASE_DAD] == 0) &&
+	    (phase == PHASE_DHCP6 || phases[PHASE_DHCP6] == 0))
+		dhcpcd_phaselog(ifp);
 }
 
-static void
-if_reboot(struct interface *ifp, int argc, char **argv)
+/*
+ * Returns delay, in milliseconds, pushed back behind the first
+ * transmissions already queued so that no more than START_RATE go out
+ * a second however many interfaces start together.
+ * The caller's random delay is kept on top so they stay spread.
+ */
+unsigned int
+dhcpcd_startdelay(struct dhcpcd_ctx *ctx, unsigned int delay)
 {
-#ifdef INET
-	unsigned long long oldopts;
-
-	oldopts = ifp->options->options;
-#endif
-	script_runreason(ifp, "RECONFIGURE");
-	dhcpcd_initstate1(ifp, argc, argv, 0);
-#ifdef INET
-	dhcp_reboot_newopts(ifp, oldopts);
-#endif
-#ifdef DHCP6
-	dhcp6_reboot(ifp);
-#endif
-	dhcpcd_prestartinterface(ifp);
+	struct timespec now;
+	unsigned long long ms;
+	unsigned int nsecs;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		return delay;
+	ms = eloop_timespec_diff(&now, &ctx->started, &nsecs);
+	ms = ms * MSEC_PER_SEC + nsecs / NSEC_PER_MSEC;
+	if (ctx->start_next < ms)
+		ctx->start_next = ms;
+	ms = ctx->start_next - ms + delay;
+	ctx->start_next += MSEC_PER_SEC / START_RATE;
+	return ms > UINT_MAX ? UINT_MAX : (unsigned int)ms;
 }
 
-static void
-reload_config(struct dhcpcd_ctx *ctx)
+/*
+ * Token bucket shared by every interface so that a mass event cannot
+ * make them all retransmit, renew or rebind at once.
+ * Returns 0 if a message can be sent now, otherwise the msecs to wait
+ * before trying again.
+ * DHCP, DHCPv6 and Router Solicitation all ask before sending and if
+ * told to wait just call themselves again later, so a deferred message
+ * goes out as it would have done without counting as a retransmission.
+ */
+unsigned int
+dhcpcd_pace(struct dhcpcd_ctx *ctx)
 {
-	struct if_options *ifo;
+	struct timespec now;
+	unsigned long long ms, tokens;
+	unsigned int nsecs;
 
-	free_globals(ctx);
-	if ((ifo = read_config(ctx, NULL, NULL, NULL)) == NULL)
-		return;
-	add_options(ctx, NULL, ifo, ctx->argc, ctx->argv);
-	/* We need to preserve these options. */
-	if (ctx->options & DHCPCD_STARTED)
-		ifo->options |= DHCPCD_STARTED;
-	if (ctx->options & DHCPCD_MASTER)
-		ifo->options |= DHCPCD_MASTER;
-	if (ctx->options & DHCPCD_DAEMONISED)
-		ifo->options |= DHCPCD_DAEMONISED;
-	if (ctx->options & DHCPCD_PRIVSEP)
-		ifo->options |= DHCPCD_PRIVSEP;
-	ctx->options = ifo->options;
-	free_options(ctx, ifo);
+	if (ctx->tx_rate == 0)
+		return 0;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		return 0;
+	ms = eloop_timespec_diff(&now, &ctx->started, &nsecs);
+	ms = ms * MSEC_PER_SEC + nsecs / NSEC_PER_MSEC;
+
+	/* A rate of messages a second is the same in thousandths a msec. */
+	tokens = ctx->tx_tokens + (ms - ctx->tx_last) * ctx->tx_rate;
+	if (tokens > ctx->tx_burst * 1000ULL)
+		tokens = ctx->tx_burst * 1000ULL;
+	ctx->tx_last = ms;
+	if (tokens >= 1000) {
+		ctx->tx_tokens = (unsigned int)(tokens - 1000);
+		return 0;
+	}
+	ctx->tx_tokens = (unsigned int)tokens;
+	return (unsigned int)((1000 - tokens + ctx->tx_rate - 1) /
+	    ctx->tx_rate);
 }
 
-static void
-reconf_reboot(struct dhcpcd_ctx *ctx, int action, int argc, char **argv, int oi)
+static int
+dhcpcd_startup_stats(struct dhcpcd_ctx *ctx, struct fd_list *fd)
 {
-	int i;
 	struct interface *ifp;
-
-	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
-		for (i = oi; i < argc; i++) {
-			if (strcmp(ifp->name, argv[i]) == 0)
-				break;
-		}
-		if (oi != argc && i == argc)
-			continue;
-		if (ifp->active == IF_ACTIVE_USER) {
-			if (action)
-				if_reboot(ifp, argc, argv);
-#ifdef INET
-			else
-				ipv4_applyaddr(ifp);
-#endif
-		} else if (i != argc) {
-			ifp->active = IF_ACTIVE_USER;
-			dhcpcd_initstate1(ifp, argc, argv, 0);
-			run_preinit(ifp);
-			dhcpcd_prestartinterface(ifp);
+	size_t nlines, i, one = 1;
+	char *buf, *p;
+	const char *name;
+	const uint32_t *phases;
+	int l, err;
+
+	nlines = 1 + PHASE_PRESTART;
+	TAILQ_FOREACH(ifp, ctx->ifaces, next)
+		nlines += PHASE_MAX - PHASE_PRESTART;
+	if ((buf = malloc(nlines * STATS_LINE)) == NULL)
+		return -1;
+	p = buf;
+	l = snprintf(p, STATS_LINE, "%-16s %-12s %12s",
+	    "interface", "phase", "elapsed_us");
+	p += l + 1;
+
+	ifp = NULL;
+	for (;;) {
+		name = ifp != NULL ? ifp->name : "-";
+		phases = ifp != NULL ? ifp->phases : ctx->phases;
+		for (i = ifp != NULL ? PHASE_PRESTART : 0;
+		    i < (ifp != NULL ? PHASE_MAX : PHASE_PRESTART);
+		    i++)
+		{
+			if (phases[i] == 0)
+				continue;
+			l = snprintf(p, STATS_LINE, "%-16s %-12s %12u",
+			    name, dhcpcd_phase_names[i], phases[i] - 1);
+			if (l < 0 || l >= STATS_LINE)
+				l = STATS_LINE - 1;
+			p += l + 1;
 		}
+		ifp = ifp == NULL ?
+		    TAILQ_FIRST(ctx->ifaces) : TAILQ_NEXT(ifp, next);
+		if (ifp == NULL)
+			break;
 	}
+
+	if (write(fd->fd, &one, sizeof(one)) != sizeof(one))
+		err = -1;
+	else
+		err = control_queue(fd, buf, (size_t)(p - buf));
+	free(buf);
+	return err;
 }
 
-static void
-stop_all_interfaces(struct dhcpcd_ctx *ctx, unsigned long long opts)
+static const char * const dhcpcd_proto_names[CNTP_MAX] = {
+	"dhcp", "dhcp6", "nd", "arp", "link",
+};
+
+static int
+dhcpcd_counter_line(char *p, const char *name, const char *proto,
+    const uint32_t *c)
 {
-	struct interface *ifp;
+	int l;
+
+	l = snprintf(p, STATS_LINE,
+	    "%-16s %-5s %10u %10u %8u %6u %6u %6u %6u %8u",
+	    name, proto, c[CNT_RECV], c[CNT_SENT], c[CNT_RETRANS],
+	    c[CNT_CKSUM], c[CNT_XID], c[CNT_AUTH], c[CNT_NOIF],
+	    c[CNT_SCRIPT]);
+	if (l < 0 || l >= STATS_LINE)
+		l = STATS_LINE - 1;
+	return l + 1;
+}
 
-	ctx->options |= DHCPCD_EXITING;
-	if (ctx->ifaces == NULL)
-		return;
+/* Protocols with nothing counted are left out. */
+static bool
+dhcpcd_counter_zero(const uint32_t *c)
+{
+	size_t i;
 
-	/* Drop the last interface first */
-	TAILQ_FOREACH_REVERSE(ifp, ctx->ifaces, if_head, next) {
-		if (!ifp->active)
-			continue;
-		ifp->options->options |= opts;
-		if (ifp->options->options & DHCPCD_RELEASE)
-			ifp->options->options &= ~DHCPCD_PERSISTENT;
-		ifp->options->options |= DHCPCD_EXITING;
-		stop_interface(ifp, NULL);
+	for (i = 0; i < CNT_MAX; i++) {
+		if (c[i] != 0)
+			return false;
 	}
+	return true;
 }
 
-static void
-dhcpcd_ifrenew(struct interface *ifp)
+static int
+dhcpcd_counter_stats(struct dhcpcd_ctx *ctx, struct fd_list *fd, bool reset)
 {
+	struct interface *ifp;
+	size_t nlines, i, one = 1;
+	char *buf, *p;
+	int l, err;
 
-	if (!ifp->active)
-		return;
+	/* Zeroing them changes what others see. */
+	if (reset && fd->flags & FD_UNPRIV) {
+		errno = EPERM;
+		return -1;
+	}
 
-	if (ifp->options->options & DHCPCD_LINK && !if_is_link_up(ifp))
-		return;
+	nlines = 1 + CNTP_MAX;
+	TAILQ_FOREACH(ifp, ctx->ifaces, next)
+		nlines += CNTP_MAX;
+	if ((buf = malloc(nlines * STATS_LINE)) == NULL)
+		return -1;
+	p = buf;
+	l = snprintf(p, STATS_LINE,
+	    "%-16s %-5s %10s %10s %8s %6s %6s %6s %6s %8s",
+	    "interface", "proto", "recv", "sent", "retrans",
+	    "cksum", "xid", "auth", "noif", "script");
+	p += l + 1;
+
+	for (i = 0; i < CNTP_MAX; i++) {
+		if (!dhcpcd_counter_zero(ctx->counters[i]))
+			p += dhcpcd_counter_line(p, "-",
+			    dhcpcd_proto_names[i], ctx->counters[i]);
+	}
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		for (i = 0; i < CNTP_MAX; i++) {
+			if (!dhcpcd_counter_zero(ifp->counters[i]))
+				p += dhcpcd_counter_line(p, ifp->name,
+				    dhcpcd_proto_names[i], ifp->counters[i]);
+		}
+	}
 
-#ifdef INET
-	dhcp_renew(ifp);
-#endif
-#ifdef INET6
-#define DHCPCD_RARENEW (DHCPCD_IPV6 | DHCPCD_IPV6RS)
-	if ((ifp->options->options & DHCPCD_RARENEW) == DHCPCD_RARENEW)
-		ipv6nd_startrs(ifp);
-#endif
-#ifdef DHCP6
-	dhcp6_renew(ifp);
-#endif
+	if (write(fd->fd, &one, sizeof(one)) != sizeof(one))
+		err = -1;
+	else
+		err = control_queue(fd, buf, (size_t)(p - buf));
+	free(buf);
+
+	if (reset && err != -1) {
+		memset(ctx->counters, 0, sizeof(ctx->counters));
+		TAILQ_FOREACH(ifp, ctx->ifaces, next)
+			memset(ifp->counters, 0, sizeof(ifp->counters));
+	}
+	return err;
 }
 
-static void
-dhcpcd_renew(struct dhcpcd_ctx *ctx)
+#if defined(INET) || defined(DHCP6)
+static int
+dhcpcd_server_line(char *p, const char *name, const char *proto,
+    const struct srv_stat *s, time_t now)
 {
-	struct interface *ifp;
+	char rtt[32], id[SRV_ID_LEN * 3];
+	int l;
 
-	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
-		dhcpcd_ifrenew(ifp);
-	}
+#ifdef INET
+	if (strcmp(proto, "dhcp") == 0 && s->ss_idlen == sizeof(in_addr_t))
+		inet_ntop(AF_INET, s->ss_id, id, sizeof(id));
+	else
+#endif
+		hwaddr_ntoa(s->ss_id, s->ss_idlen, id, sizeof(id));
+	if (s->ss_srtt == 0)
+		strlcpy(rtt, "-", sizeof(rtt));
+	else
+		snprintf(rtt, sizeof(rtt), "%u.%03u/%u.%03u",
+		    s->ss_srtt / USEC_PER_MSEC, s->ss_srtt % USEC_PER_MSEC,
+		    s->ss_rttvar / USEC_PER_MSEC, s->ss_rttvar % USEC_PER_MSEC);
+
+	l = snprintf(p, STATS_LINE,
+	    "%-16s %-5s %16s %8u %8u %8u %8lld %s",
+	    name, proto, rtt, s->ss_replies, s->ss_failed, s->ss_missed,
+	    (long long)(now - s->ss_seen), id);
+	if (l < 0 || l >= STATS_LINE)
+		l = STATS_LINE - 1;
+	return l + 1;
 }
+#endif
 
-#ifdef USE_SIGNALS
-#define sigmsg "received %s, %s"
-static void
-dhcpcd_signal_cb(int sig, void *arg)
+static int
+dhcpcd_server_stats(struct dhcpcd_ctx *ctx, struct fd_list *fd)
 {
-	struct dhcpcd_ctx *ctx = arg;
-	unsigned long long opts;
-	int exit_code;
+	struct interface *ifp;
+	size_t nlines = 1, one = 1;
+	char *buf, *p;
+	int l, err;
+#if defined(INET) || defined(DHCP6)
+	const struct srv_stats *ss;
+	const struct srv_stat *s;
+	struct timespec now;
 
-	if (ctx->options & DHCPCD_DUMPLEASE) {
-		eloop_exit(ctx->eloop, EXIT_FAILURE);
-		return;
-	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
 
-	if (sig != SIGCHLD && ctx->options & DHCPCD_FORKED) {
-		if (sig != SIGHUP &&
-		    write(ctx->fork_fd, &sig, sizeof(sig)) == -1)
-			logerr("%s: write", __func__);
-		return;
-	}
+	/* At most SRV_MAX servers per protocol on each interface. */
+	TAILQ_FOREACH(ifp, ctx->ifaces, next)
+		nlines += SRV_MAX * 2;
+	if ((buf = malloc(nlines * STATS_LINE)) == NULL)
+		return -1;
+	p = buf;
+	l = snprintf(p, STATS_LINE, "%-16s %-5s %16s %8s %8s %8s %8s %s",
+	    "interface", "proto", "srtt/rttvar ms", "replies", "failed",
+	    "missed", "seen", "server");
+	p += l + 1;
 
-	opts = 0;
-	exit_code = EXIT_FAILURE;
-	switch (sig) {
-	case SIGINT:
-		loginfox(sigmsg, "SIGINT", "stopping");
-		break;
-	case SIGTERM:
-		loginfox(sigmsg, "SIGTERM", "stopping");
-		exit_code = EXIT_SUCCESS;
-		break;
-	case SIGALRM:
-		loginfox(sigmsg, "SIGALRM", "releasing");
-		opts |= DHCPCD_RELEASE;
-		exit_code = EXIT_SUCCESS;
-		break;
-	case SIGHUP:
-		loginfox(sigmsg, "SIGHUP", "rebinding");
-		reload_config(ctx);
-		/* Preserve any options passed on the commandline
-		 * when we were started. */
-		reconf_reboot(ctx, 1, ctx->argc, ctx->argv,
-		    ctx->argc - ctx->ifc);
-		return;
-	case SIGUSR1:
-		loginfox(sigmsg, "SIGUSR1", "renewing");
-		dhcpcd_renew(ctx);
-		return;
-	case SIGUSR2:
-		loginfox(sigmsg, "SIGUSR2", "reopening log");
-#ifdef PRIVSEP
-		if (IN_PRIVSEP(ctx)) {
-			if (ps_root_logreopen(ctx) == -1)
-				logerr("ps_root_logreopen");
-			return;
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+#ifdef INET
+		if (D_CSTATE(ifp) != NULL) {
+			ss = &D_CSTATE(ifp)->srvs;
+			for (s = ss->ss_srv; s < ss->ss_srv + SRV_MAX; s++) {
+				if (s->ss_idlen != 0)
+					p += dhcpcd_server_line(p, ifp->name,
+					    "dhcp", s, now.tv_sec);
+			}
+		}
+#endif
+#ifdef DHCP6
+		if (D6_CSTATE(ifp) != NULL) {
+			ss = &D6_CSTATE(ifp)->srvs;
+			for (s = ss->ss_srv; s < ss->ss_srv + SRV_MAX; s++) {
+				if (s->ss_idlen != 0)
+					p += dhcpcd_server_line(p, ifp->name,
+					    "dhcp6", s, now.tv_sec);
+			}
 		}
 #endif
-		if (logopen(ctx->logfile) == -1)
-			logerr("logopen");
-		return;
-	case SIGCHLD:
-		while (waitpid(-1, NULL, WNOHANG) > 0)
-			;
-		return;
-	default:
-		logerrx("received signal %d but don't know what to do with it",
-		    sig);
-		return;
 	}
 
-	if (!(ctx->options & DHCPCD_TEST))
-		stop_all_interfaces(ctx, opts);
-	eloop_exit(ctx->eloop, exit_code);
+	if (write(fd->fd, &one, sizeof(one)) != sizeof(one))
+		err = -1;
+	else
+		err = control_queue(fd, buf, (size_t)(p - buf));
+	free(buf);
+	return err;
 }
-#endif
 
 int
 dhcpcd_handleargs(struct dhcpcd_ctx *ctx, struct fd_list *fd,
@@ -1454,8 +2588,8 @@ dhcpcd_handleargs(struct dhcpcd_ctx *ctx, struct fd_list *fd,
 {
 	struct interface *ifp;
 	unsigned long long opts;
-	int opt, oi, do_reboot, do_renew, af = AF_UNSPEC;
-	size_t len, l, nifaces;
+	int opt, oi, do_reboot, do_renew, do_stats, af = AF_UNSPEC;
+	size_t len, l, nifaces, logcount = 0;
 	char *tmp, *p;
 
 	/* Special commands for our control socket
@@ -1469,12 +2603,15 @@ dhcpcd_handleargs(struct dhcpcd_ctx *ctx, struct fd_list *fd,
 	} else if (strcmp(*argv, "--getconfigfile") == 0) {
 		return control_queue(fd, UNCONST(fd->ctx->cffile),
 		    strlen(fd->ctx->cffile) + 1);
+	} else if (ctx->shard_mgr != NULL) {
+		return shard_handleargs(ctx, fd, argc, argv);
 	} else if (strcmp(*argv, "--getinterfaces") == 0) {
 		optind = argc = 0;
 		goto dumplease;
+	} else if (strcmp(*argv, "--dumpstate") == 0) {
+		return control_dump(fd, argc, argv);
 	} else if (strcmp(*argv, "--listen") == 0) {
-		fd->flags |= FD_LISTEN;
-		return 0;
+		return control_listen(fd, argc, argv);
 	}
 
 	/* Log the command */
@@ -1499,7 +2636,7 @@ dhcpcd_handleargs(struct dhcpcd_ctx *ctx, struct fd_list *fd,
 	optind = 0;
 	oi = 0;
 	opts = 0;
-	do_reboot = do_renew = 0;
+	do_reboot = do_renew = do_stats = 0;
 	while ((opt = getopt_long(argc, argv, IF_OPTS, cf_options, &oi)) != -1)
 	{
 		switch (opt) {
@@ -1524,6 +2661,30 @@ dhcpcd_handleargs(struct dhcpcd_ctx *ctx, struct fd_list *fd,
 		case 'U':
 			opts |= DHCPCD_DUMPLEASE;
 			break;
+		case O_STATS:
+			if (strcmp(optarg, "eloop") == 0)
+				do_stats = 1;
+			else if (strcmp(optarg, "memory") == 0)
+				do_stats = 2;
+			else if (strcmp(optarg, "control") == 0)
+				do_stats = 3;
+			else if (dhcpcd_log_parse(optarg, &logcount) == 0)
+				do_stats = 4;
+			else if (strcmp(optarg, "startup") == 0)
+				do_stats = 5;
+			else if (strcmp(optarg, "usage") == 0)
+				do_stats = 6;
+			else if (strcmp(optarg, "counters") == 0)
+				do_stats = 7;
+			else if (strcmp(optarg, "counters:reset") == 0)
+				do_stats = 8;
+			else if (strcmp(optarg, "servers") == 0)
+				do_stats = 9;
+			else {
+				errno = EINVAL;
+				return -1;
+			}
+			break;
 		case '4':
 			af = AF_INET;
 			break;
@@ -1533,6 +2694,23 @@ dhcpcd_handleargs(struct dhcpcd_ctx *ctx, struct fd_list *fd,
 		}
 	}
 
+	if (do_stats == 1)
+		return dhcpcd_eloop_stats(ctx, fd);
+	if (do_stats == 2)
+		return dhcpcd_pool_stats(ctx, fd);
+	if (do_stats == 3)
+		return control_stats(fd);
+	if (do_stats == 4)
+		return dhcpcd_log_stats(fd, logcount);
+	if (do_stats == 5)
+		return dhcpcd_startup_stats(ctx, fd);
+	if (do_stats == 6)
+		return dhcpcd_usage_stats(ctx, fd);
+	if (do_stats == 7 || do_stats == 8)
+		return dhcpcd_counter_stats(ctx, fd, do_stats == 8);
+	if (do_stats == 9)
+		return dhcpcd_server_stats(ctx, fd);
+
 	if (opts & DHCPCD_DUMPLEASE) {
 		ctx->options |= DHCPCD_DUMPLEASE;
 dumplease:
@@ -1612,7 +2790,8 @@ dumperr:
 
 	reload_config(ctx);
 	/* XXX: Respect initial commandline options? */
-	reconf_reboot(ctx, do_reboot, argc, argv, optind - 1);
+	/* Rebind the interfaces asked for even if nothing changed. */
+	reconf_reboot(ctx, do_reboot, argc, argv, optind - 1, optind != argc);
 	return 0;
 }
 
@@ -1753,6 +2932,15 @@ dhcpcd_fork_cb(void *arg)
 		dhcpcd_signal_cb(exit_code, ctx);
 }
 
+/* Write out log messages before waiting for more to do. */
+static void
+dhcpcd_logflush(void *arg)
+{
+
+	UNUSED(arg);
+	logflush();
+}
+
 static void
 dhcpcd_stderr_cb(void *arg)
 {
@@ -1782,6 +2970,7 @@ main(int argc, char **argv, char **envp)
 	int opt, oi = 0, i;
 	unsigned int logopts, t;
 	ssize_t len;
+	size_t logcount;
 #if defined(USE_SIGNALS) || !defined(THERE_IS_NO_FORK)
 	pid_t pid;
 	int fork_fd[2], stderr_fd[2];
@@ -1836,10 +3025,18 @@ main(int argc, char **argv, char **envp)
 	}
 
 	memset(&ctx, 0, sizeof(ctx));
+	clock_gettime(CLOCK_MONOTONIC, &ctx.started);
 
 	ifo = NULL;
 	ctx.cffile = CONFIG;
 	ctx.script = UNCONST(dhcpcd_default_script);
+	TAILQ_INIT(&ctx.script_jobs);
+	TAILQ_INIT(&ctx.optmasks);
+	ctx.script_max = 1;
+	ctx.tx_rate = TRANSMIT_RATE;
+	ctx.tx_burst = TRANSMIT_BURST;
+	ctx.tx_tokens = TRANSMIT_BURST * 1000;
+	ctx.script_wfd = ctx.shard_fd = -1;
 	ctx.control_fd = ctx.control_unpriv_fd = ctx.link_fd = -1;
 	ctx.pf_inet_fd = -1;
 #ifdef PF_LINK
@@ -1943,6 +3140,23 @@ main(int argc, char **argv, char **envp)
 		case 'U':
 			i = 3;
 			break;
+		case O_STATS:
+			if (strcmp(optarg, "eloop") != 0 &&
+			    strcmp(optarg, "memory") != 0 &&
+			    strcmp(optarg, "control") != 0 &&
+			    strcmp(optarg, "startup") != 0 &&
+			    strcmp(optarg, "usage") != 0 &&
+			    strcmp(optarg, "counters") != 0 &&
+			    strcmp(optarg, "counters:reset") != 0 &&
+			    strcmp(optarg, "servers") != 0 &&
+			    dhcpcd_log_parse(optarg, &logcount) == -1)
+			{
+				logerrx("unknown stats: %s", optarg);
+				goto exit_failure;
+			}
+			/* Read back just like a lease dump. */
+			i = 3;
+			break;
 		case 'V':
 			i = 2;
 			break;
@@ -1963,6 +3177,17 @@ main(int argc, char **argv, char **envp)
 	ctx.ifv = argv + optind;
 
 	rt_init(&ctx);
+#ifdef INET
+	pool_init(&ctx.ia4_pool, "ipv4_addr", sizeof(struct ipv4_addr));
+	lpm_init(&ctx.ipv4_lpm, "ipv4_lpm", 32,
+	    offsetof(struct ipv4_addr, lpm));
+#endif
+#ifdef INET6
+	pool_init(&ctx.ia6_pool, "ipv6_addr", sizeof(struct ipv6_addr));
+	lpm_init(&ctx.ipv6_lpm, "ipv6_lpm", 128,
+	    offsetof(struct ipv6_addr, lpm));
+#endif
+	if_ctxinit(&ctx);
 
 	ifo = read_config(&ctx, NULL, NULL, NULL);
 	if (ifo == NULL) {
@@ -1978,6 +3203,7 @@ main(int argc, char **argv, char **envp)
 			usage();
 		goto exit_failure;
 	}
+	dhcpcd_phase(&ctx, NULL, PHASE_CONFIG);
 	if (i == 2) {
 		printf("Interface options:\n");
 		if (optind == argc - 1) {
@@ -1987,6 +3213,7 @@ main(int argc, char **argv, char **envp)
 				goto exit_failure;
 			add_options(&ctx, NULL, ifo, argc, argv);
 		}
+		load_definitions(&ctx, DEFS_ALL);
 		if_printoptions();
 #ifdef INET
 		if (family == 0 || family == AF_INET) {
@@ -2254,6 +3481,10 @@ printpidfile:
 		logerr("fork");
 		goto exit_failure;
 	case 0:
+		if (eloop_forked(ctx.eloop) == -1) {
+			logerr("%s: eloop_forked", __func__);
+			goto exit_failure;
+		}
 		ctx.fork_fd = fork_fd[1];
 		close(fork_fd[0]);
 #ifdef PRIVSEP_RIGHTS
@@ -2291,6 +3522,10 @@ printpidfile:
 			logerr("fork");
 			goto exit_failure;
 		case 0:
+			if (eloop_forked(ctx.eloop) == -1) {
+				logerr("%s: eloop_forked", __func__);
+				goto exit_failure;
+			}
 			break;
 		default:
 			ctx.options |= DHCPCD_FORKED; /* A lie */
@@ -2342,6 +3577,24 @@ printpidfile:
 #endif
 		goto exit_failure;
 	}
+
+	if (ctx.shards != 0 && ctx.options & DHCPCD_MASTER &&
+	    !(ctx.options & DHCPCD_TEST))
+	{
+		/* The manager has no addresses to wait for. */
+		ctx.options |= DHCPCD_NOWAITIP;
+		dhcpcd_daemonise(&ctx);
+		switch (shard_start(&ctx, ifo, family)) {
+		case -1:
+			logerr("%s: shard_start", __func__);
+#ifdef PRIVSEP
+			ctx.options &= ~DHCPCD_PRIVSEP;
+#endif
+			goto exit_failure;
+		case 0:
+			goto run_loop;
+		}
+	}
 #endif
 
 	os_init();
@@ -2357,12 +3610,14 @@ printpidfile:
 		logerr("ps_start");
 		goto exit_failure;
 	}
+	if (IN_PRIVSEP(&ctx))
+		dhcpcd_phase(&ctx, NULL, PHASE_PRIVSEP);
 	if (ctx.options & DHCPCD_FORKED)
 		goto run_loop;
 #endif
 
 	if (!(ctx.options & DHCPCD_TEST)) {
-		if (control_start(&ctx,
+		if (control_start(&ctx, ctx.shard != 0 ? ctx.shard_name :
 		    ctx.options & DHCPCD_MASTER ?
 		    NULL : argv[optind], family) == -1)
 		{
@@ -2419,6 +3674,11 @@ printpidfile:
 		logerr("%s: if_discover", __func__);
 		goto exit_failure;
 	}
+	dhcpcd_phase(&ctx, NULL, PHASE_IFDISCOVER);
+	TAILQ_FOREACH(ifp, ctx.ifaces, next) {
+		if_indexctx(ifp);
+	}
+	dhcpcd_linkfilter(&ctx);
 	for (i = 0; i < ctx.ifc; i++) {
 		if ((ifp = if_find(ctx.ifaces, ctx.ifv[i])) == NULL)
 			logerrx("%s: interface not found",
@@ -2498,14 +3758,13 @@ printpidfile:
 	free_options(&ctx, ifo);
 	ifo = NULL;
 
-	TAILQ_FOREACH(ifp, ctx.ifaces, next) {
-		if (ifp->active)
-			eloop_timeout_add_sec(ctx.eloop, 0,
-			    dhcpcd_prestartinterface, ifp);
-	}
+	eloop_timeout_add_sec(ctx.eloop, 0, dhcpcd_prestartinterfaces, &ctx);
 
 run_loop:
+	eloop_idle_set_cb(ctx.eloop, dhcpcd_logflush, NULL);
+	logsetasync(true);
 	i = eloop_start(ctx.eloop, &ctx.sigset);
+	logsetasync(false);
 	if (i < 0) {
 		logerr("%s: eloop_start", __func__);
 		goto exit_failure;
@@ -2520,16 +3779,13 @@ exit_failure:
 	i = EXIT_FAILURE;
 
 exit1:
+	/* Let the STOPPED and any other queued scripts run. */
+	script_drain(&ctx);
 	if (control_stop(&ctx) == -1)
 		logerr("%s: control_stop", __func__);
-	if (ifaddrs != NULL) {
-#ifdef PRIVSEP_GETIFADDRS
-		if (IN_PRIVSEP(&ctx))
-			free(ifaddrs);
-		else
-#endif
-			freeifaddrs(ifaddrs);
-	}
+	shard_free(&ctx);
+	if_freeifaddrs(&ctx, &ifaddrs);
+	leasewb_flush(&ctx);
 	/* ps_stop will clear DHCPCD_PRIVSEP but we need to
 	 * remember it to avoid attemping to remove the pidfile */
 	oi = ctx.options & DHCPCD_PRIVSEP ? 1 : 0;
@@ -2554,20 +3810,35 @@ exit1:
 	free(ctx.script_env);
 	rt_dispose(&ctx);
 	free(ctx.duid);
+	leasedb_free(&ctx);
+	leasewb_free(&ctx);
+	netconf_free(&ctx);
 	if (ctx.link_fd != -1) {
 		eloop_event_delete(ctx.eloop, ctx.link_fd);
 		close(ctx.link_fd);
 	}
 	if_closesockets(&ctx);
+	dhcpcd_ifqfree(&ctx);
 	free_globals(&ctx);
 #ifdef INET6
 	ipv6_ctxfree(&ctx);
+#endif
+	/* Everything taken from these has been freed by now. */
+#ifdef INET
+	lpm_dispose(&ctx.ipv4_lpm);
+	pool_dispose(&ctx.ia4_pool);
+#endif
+#ifdef INET6
+	lpm_dispose(&ctx.ipv6_lpm);
+	pool_dispose(&ctx.ia6_pool);
 #endif
 #ifdef PLUGIN_DEV
 	dev_stop(&ctx);
 #endif
 #ifdef PRIVSEP
 	eloop_free(ctx.ps_eloop);
+	free(ctx.ps_mtimefile);
+	free(ctx.ps_control_buf);
 #endif
 	eloop_free(ctx.eloop);
 	if (ctx.script != dhcpcd_default_script)
@@ -40,8 +40,11 @@
 #endif
 
 #include "defs.h"
+#include "arena.h"
 #include "control.h"
 #include "if-options.h"
+#include "lpm.h"
+#include "pool.h"
 
 #define HWADDR_LEN	20
 #define IF_SSIDLEN	32
@@ -63,36 +66,127 @@
 #define IF_DATA_IPV6	4
 #define IF_DATA_IPV6ND	5
 #define IF_DATA_DHCP6	6
-#define IF_DATA_MAX	7
+#define IF_DATA_SCRIPT	7
+#define IF_DATA_MAX	8
 
 #ifdef __QNX__
 /* QNX carries defines for, but does not actually support PF_LINK */
 #undef IFLR_ACTIVE
 #endif
 
+/*
+ * Points on the way to a usable address, timed from when dhcpcd started.
+ * The first three are for dhcpcd as a whole, the rest per interface.
+ */
+enum dhcpcd_phase {
+	PHASE_CONFIG,		/* configuration read */
+	PHASE_IFDISCOVER,	/* interfaces discovered */
+	PHASE_PRIVSEP,		/* privilege separation started */
+	PHASE_PRESTART,		/* interface started */
+	PHASE_CARRIER,		/* carrier seen */
+	PHASE_DISCOVER,		/* DHCP DISCOVER sent */
+	PHASE_OFFER,		/* DHCP OFFER received */
+	PHASE_REQUEST,		/* DHCP REQUEST sent */
+	PHASE_ACK,		/* DHCP ACK received */
+	PHASE_ARP,		/* ARP probe passed */
+	PHASE_BOUND,		/* IPv4 address and routes added */
+	PHASE_RS,		/* Router Solicitation sent */
+	PHASE_RA,		/* Router Advertisement received */
+	PHASE_DAD,		/* IPv6 address passed DAD */
+	PHASE_DHCP6,		/* DHCPv6 addresses bound */
+	PHASE_MAX,
+};
+
+/* What is counted for each interface and protocol, see --stats counters.
+ * Not PROTO_ as script.c has those for the protocol variable. */
+enum dhcpcd_proto {
+	CNTP_DHCP,
+	CNTP_DHCP6,
+	CNTP_ND,
+	CNTP_ARP,
+	CNTP_LINK,		/* script runs not for a protocol */
+	CNTP_MAX,
+};
+
+enum dhcpcd_counter {
+	CNT_RECV,		/* packets received */
+	CNT_SENT,		/* packets sent */
+	CNT_RETRANS,		/* of those sent, retransmissions */
+	CNT_CKSUM,		/* dropped, bad checksum */
+	CNT_XID,		/* dropped, not our transaction */
+	CNT_AUTH,		/* dropped, failed authentication */
+	CNT_NOIF,		/* dropped, no interface; dhcpcd only */
+	CNT_SCRIPT,		/* script runs */
+	CNT_MAX,
+};
+
+/* s is an interface or, for CNT_NOIF, the context. */
+#define	STATS_COUNT(s, p, c)	((s)->counters[(p)][(c)]++)
+
+/* Most first DISCOVER, SOLICIT or RS messages to send a second
+ * when many interfaces start together. */
+#ifndef START_RATE
+#define START_RATE	20
+#endif
+
+/* Default rate and burst of DHCP, DHCPv6 and RS retransmissions,
+ * renewals and rebinds across all interfaces. */
+#ifndef TRANSMIT_RATE
+#define TRANSMIT_RATE	50
+#endif
+#ifndef TRANSMIT_BURST
+#define TRANSMIT_BURST	50
+#endif
+
 struct interface {
-	struct dhcpcd_ctx *ctx;
+	/*
+	 * Ordered by how often fields are touched, the most first.
+	 * Index lookups touch the first 64 bytes, walking the list and
+	 * dispatching to a protocol the first 128.
+	 */
+	rb_node_t index_tree;	/* node in ctx->ifindex */
 	TAILQ_ENTRY(interface) next;
-	char name[IF_NAMESIZE];
+	struct if_options *options;
+	unsigned int index_key;	/* index we are filed under, 0 if not */
 	unsigned int index;
 	unsigned int active;
 	unsigned int flags;
+
+	void *if_data[IF_DATA_MAX];
+
+	struct dhcpcd_ctx *ctx;
+	int carrier;
+	unsigned int metric;
 	uint16_t hwtype; /* ARPHRD_ETHER for example */
-	unsigned char hwaddr[HWADDR_LEN];
 	uint8_t hwlen;
-	unsigned short vlanid;
-	unsigned int metric;
-	int carrier;
 	bool wireless;
+	unsigned short vlanid;
+	bool name_indexed;
+	char name[IF_NAMESIZE];
+	rb_node_t name_tree;	/* node in ctx->ifnames */
+	unsigned char hwaddr[HWADDR_LEN];
+
+	/* Only looked at when the interface changes. */
+	unsigned long long carrier_timer; /* settles carrier_next */
+	int carrier_next;
+	unsigned int flags_next;
 	uint8_t ssid[IF_SSIDLEN];
 	unsigned int ssid_len;
-
 	char profile[PROFILE_LEN];
-	struct if_options *options;
-	void *if_data[IF_DATA_MAX];
+	struct arena arena;	/* if_data comes from here */
+
+	struct snapshot *snapshot;	/* what the last run left */
+	uint32_t snapshot_hash;	/* of the last one written, 0 if none */
+
+	/* usecs + 1 from start to first reaching each phase, 0 if not yet */
+	uint32_t phases[PHASE_MAX];
+	uint32_t counters[CNTP_MAX][CNT_MAX];
 };
 TAILQ_HEAD(if_head, interface);
 
+struct script_job;
+TAILQ_HEAD(script_job_head, script_job);
+
 #include "privsep.h"
 
 /* dhcpcd requires CMSG_SPACE to evaluate to a compile time constant. */
@@ -112,6 +206,8 @@ TAILQ_HEAD(if_head, interface);
 #endif
 
 struct passwd;
+struct if_msgbatch;
+struct shards;
 
 struct dhcpcd_ctx {
 	char pidfile[sizeof(PIDFILE) + IF_NAMESIZE + 1];
@@ -124,6 +220,19 @@ struct dhcpcd_ctx {
 	const char *cffile;
 	unsigned long long options;
 	char *logfile;
+	struct timespec started;
+	uint32_t phases[PHASE_MAX];	/* only up to PHASE_PRESTART */
+	uint32_t counters[CNTP_MAX][CNT_MAX];	/* only CNT_NOIF */
+	unsigned long long start_next;	/* msecs from started */
+	unsigned int tx_rate;		/* 0 means no pacing */
+	unsigned int tx_burst;
+	unsigned int tx_tokens;		/* thousandths of a message */
+	unsigned long long tx_last;	/* msecs from started */
+	unsigned int shards;		/* workers, 0 to run as one process */
+	unsigned int shard;		/* ours from 1, 0 if not a worker */
+	char shard_name[IF_NAMESIZE];	/* of our control socket */
+	int shard_fd;			/* a worker's to the manager */
+	struct shards *shard_mgr;	/* only for the manager */
 	int argc;
 	char **argv;
 	int ifac;	/* allowed interfaces */
@@ -134,10 +243,24 @@ struct dhcpcd_ctx {
 	char **ifv;	/* listed interfaces */
 	int ifcc;	/* configured interfaces */
 	char **ifcv;	/* configured interfaces */
+	int ifqc;	/* arrived interfaces */
+	char **ifqv;	/* waiting to be discovered together */
+	struct cf_cache *cf_cache;	/* dhcpcd.conf split into lines */
+	struct if_optmasks_head optmasks; /* masks shared by interfaces */
 	uint8_t duid_type;
 	unsigned char *duid;
 	size_t duid_len;
+	struct leasedb *leasedb;
+	struct leasewb *leasewb;	/* leases waiting to be written */
+	unsigned int lease_writeback;	/* seconds they may wait */
+	char *resolv_conf;	/* written by us and not a hook */
+	char *ntp_conf;
+	struct netconf *netconf;
+	bool warmstart;		/* adopt what the last run left */
+	bool snapshot_queued;
 	struct if_head *ifaces;
+	rb_tree_t ifindex;	/* interfaces by index */
+	rb_tree_t ifnames;	/* interfaces by name */
 
 	char *ctl_buf;
 	size_t ctl_buflen;
@@ -145,10 +268,20 @@ struct dhcpcd_ctx {
 	size_t ctl_extra;
 
 	rb_tree_t routes;	/* our routes */
-#ifdef RT_FREE_ROUTE_TABLE
-	rb_tree_t froutes;	/* free routes for re-use */
-#endif
+	rb_tree_t kroutes;	/* kernel routes, see rt_findkroute() */
+	unsigned int kroutes_af;	/* families loaded into kroutes */
+	struct pool rt_pool;	/* struct rt */
 	size_t rt_order;	/* route order storage */
+	bool rt_adopted;	/* routes may be adopted, see rt_adopt() */
+	time_t rt_holdnext;	/* when the next adopted route is let go */
+#ifdef INET
+	struct pool ia4_pool;	/* struct ipv4_addr */
+	struct lpm ipv4_lpm;	/* interface addresses by subnet */
+#endif
+#ifdef INET6
+	struct pool ia6_pool;	/* struct ipv6_addr */
+	struct lpm ipv6_lpm;	/* interface addresses by prefix */
+#endif
 
 	int pf_inet_fd;
 #ifdef PF_LINK
@@ -175,6 +308,12 @@ struct dhcpcd_ctx {
 	size_t script_buflen;
 	char **script_env;
 	size_t script_envlen;
+	struct script_job_head script_jobs;	/* queued and running */
+	unsigned int script_running;
+	unsigned int script_max;	/* scripts run at once */
+	bool script_worker;		/* run them in one long-lived shell */
+	pid_t script_wpid;
+	int script_wfd;
 
 	int control_fd;
 	int control_unpriv_fd;
@@ -182,9 +321,12 @@ struct dhcpcd_ctx {
 	char control_sock[sizeof(CONTROLSOCKET) + IF_NAMESIZE];
 	gid_t control_group;
 
+	unsigned int defs_loaded;	/* DEFS_* spaces loaded */
+
 	/* DHCP Enterprise options, RFC3925 */
 	struct dhcp_opt *vivso;
 	size_t vivso_len;
+	struct dhcp_optmap *vivso_map;	/* vivso by enterprise number */
 
 	char *randomstate; /* original state */
 
@@ -199,10 +341,20 @@ struct dhcpcd_ctx {
 	struct passwd *ps_user;	/* struct passwd for privsep user */
 	pid_t ps_root_pid;
 	int ps_root_fd;		/* Privileged Actioneer commands */
+	struct ps_root_req_head ps_root_reqs;	/* awaiting a reply */
+	struct ps_root_req_head ps_root_done;	/* awaiting a callback */
+	unsigned int ps_root_reqid;
 	int ps_log_fd;		/* chroot logging */
 	int ps_data_fd;		/* Data from root spawned processes */
 	struct eloop *ps_eloop;	/* eloop for polling root data */
 	struct ps_process_head ps_processes;	/* List of spawned processes */
+	rb_tree_t ps_procids;	/* spawned processes by ps_id */
+	rb_tree_t ps_procpids;	/* spawned processes by pid */
+	struct ps_ring_head ps_rings;	/* Shared memory to those processes */
+	struct ps_queue_head ps_queues;	/* Messages waiting to be sent */
+	bool ps_ring;
+	char *ps_mtimefile;	/* last file read via root */
+	time_t ps_mtime;	/* and its mtime */
 	pid_t ps_inet_pid;
 	int ps_inet_fd;		/* Network Proxy commands and data */
 	pid_t ps_control_pid;
@@ -210,11 +362,17 @@ struct dhcpcd_ctx {
 	int ps_control_data_fd;	/* Control Proxy - data query */
 	struct fd_list *ps_control;		/* Queue for the above */
 	struct fd_list *ps_control_client;	/* Queue for the above */
+	char *ps_control_buf;		/* Events read from the master */
+	size_t ps_control_buflen;
+	size_t ps_control_bufsize;
+	size_t ps_control_dumphdr;	/* length bytes of the frame seen */
+	size_t ps_control_dumpframe;	/* and its length, then what's left */
 #endif
 
 #ifdef INET
 	struct dhcp_opt *dhcp_opts;
 	size_t dhcp_opts_len;
+	struct dhcp_optmap *dhcp_optmap;	/* dhcp_opts by code */
 
 	int udp_rfd;
 	int udp_wfd;
@@ -224,23 +382,53 @@ struct dhcpcd_ctx {
 	 * practically never. See RFC3396 for details. */
 	uint8_t *opt_buffer;
 	size_t opt_buffer_len;
+	/* Where each option lives in the last message looked at. */
+	struct dhcp_optindex *opt_index;
+	/* Send buffers given back, re-used before any are allocated. */
+#define	DHCP_PKTKEEP	4
+	struct bootp_pkt *dhcp_pkts[DHCP_PKTKEEP];
+	size_t dhcp_pktsizes[DHCP_PKTKEEP];
+	size_t dhcp_npkts;
+	rb_tree_t dhcp_xids;	/* DHCP states by xid */
+#ifdef ARP
+	rb_tree_t arp_states;	/* ARP states by address */
+#endif
+	bool shared_bpf;	/* one BOOTP socket for all interfaces */
+	struct bpf *bpf_master;	/* the shared BOOTP socket */
 #endif
 #ifdef INET6
 	uint8_t *secret;
 	size_t secret_len;
+	rb_tree_t ipv6_addrs;	/* interface addresses by address */
 
 #ifndef __sun
 	int nd_fd;
 #endif
+	struct if_msgbatch *nd_msgs;	/* receive buffers for nd_fd */
 	struct ra_head *ra_routers;
+	rb_tree_t ra_tree;	/* ra_routers in order */
+	uint64_t ra_seq;
 
 	struct dhcp_opt *nd_opts;
 	size_t nd_opts_len;
+	struct dhcp_optmap *nd_optmap;
 #ifdef DHCP6
 	int dhcp6_rfd;
 	int dhcp6_wfd;
+	struct if_msgbatch *dhcp6_msgs;	/* receive buffers for dhcp6_rfd */
+	bool dhcp6_shared;	/* dhcp6_rfd even if not the manager */
 	struct dhcp_opt *dhcp6_opts;
 	size_t dhcp6_opts_len;
+	struct dhcp_optmap *dhcp6_optmap;
+	/* Storage for the parsed view of a DHCPv6 message. */
+	struct dhcp6_optent *dhcp6_optents;
+	size_t dhcp6_optents_len;
+	/* Configured prefix delegations, see dhcp6_pdindex(). */
+	struct dhcp6_pdent *dhcp6_pdents;
+	size_t dhcp6_pdents_len;
+	rb_tree_t dhcp6_pddown;
+	rb_tree_t dhcp6_pdup;
+	bool dhcp6_pdvalid;
 #endif
 
 #ifndef __linux__
@@ -268,6 +456,7 @@ extern const char *dhcpcd_default_script;
 int dhcpcd_ifafwaiting(const struct interface *);
 int dhcpcd_afwaiting(const struct dhcpcd_ctx *);
 void dhcpcd_daemonise(struct dhcpcd_ctx *);
+void dhcpcd_initduid(struct dhcpcd_ctx *, struct interface *);
 
 void dhcpcd_linkoverflow(struct dhcpcd_ctx *);
 int dhcpcd_handleargs(struct dhcpcd_ctx *, struct fd_list *, int, char **);
@@ -277,6 +466,11 @@ void dhcpcd_handlehwaddr(struct interface *, uint16_t, const void *, uint8_t);
 void dhcpcd_dropinterface(struct interface *, const char *);
 int dhcpcd_selectprofile(struct interface *, const char *);
 
+void dhcpcd_phase(struct dhcpcd_ctx *, struct interface *,
+    enum dhcpcd_phase);
+unsigned int dhcpcd_startdelay(struct dhcpcd_ctx *, unsigned int);
+unsigned int dhcpcd_pace(struct dhcpcd_ctx *);
+
 void dhcpcd_startinterface(void *);
 void dhcpcd_activateinterface(struct interface *, unsigned long long);
 
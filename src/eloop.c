@@ -43,15 +43,60 @@
 #include "config.h"
 #endif
 
-#if defined(HAVE_PPOLL)
+#if defined(HAVE_KQUEUE)
+#include <sys/event.h>
+#include <fcntl.h>
+#ifdef __NetBSD__
+/* udata is void * except on NetBSD.
+ * lengths are int except on NetBSD. */
+#define UPTR(x)	((intptr_t)(x))
+#define LENC(x)	(x)
+#else
+#define UPTR(x)	(x)
+#define LENC(x)	((int)(x))
+#endif
+#elif defined(HAVE_IO_URING)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#elif defined(HAVE_EPOLL)
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#elif defined(HAVE_PPOLL)
 #elif defined(HAVE_POLLTS)
 #define ppoll pollts
-#elif !defined(HAVE_PSELECT)
+#elif defined(HAVE_PSELECT)
+#define ppoll eloop_ppoll
+#else
 #pragma message("Compiling eloop with pselect(2) support.")
 #define HAVE_PSELECT
 #define ppoll eloop_ppoll
 #endif
 
+#if defined(HAVE_KQUEUE) || defined(HAVE_IO_URING) || defined(HAVE_EPOLL)
+#define	ELOOP_KERNEL
+#endif
+
+/* kqueue returns a kevent per filter, so allow for read and write.
+ * epoll needs room for the signalfd as well. */
+#if defined(HAVE_KQUEUE)
+#define	ELOOP_NFDS(n)	((n) * 2)
+#elif defined(HAVE_EPOLL)
+#define	ELOOP_NFDS(n)	((n) + 1)
+#else
+#define	ELOOP_NFDS(n)	(n)
+#endif
+
+/* A USDT probe for each callback dispatched, in the same provider as the
+ * rest of dhcpcd but kept here so eloop needs nothing else. */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define	ELOOP_PROBE(cb, arg)						\
+	DTRACE_PROBE2(dhcpcd, eloop_dispatch, (uintptr_t)(cb), (arg))
+#else
+#define	ELOOP_PROBE(cb, arg)
+#endif
+
 #include "eloop.h"
 
 #ifndef UNUSED
@@ -93,7 +138,7 @@
 #endif
 
 /*
- * Allow a backlog of signals.
+ * Allow a backlog of signals when not using kqueue or a signalfd.
  * If you use many eloops in the same process, they should all
  * use the same signal handler or have the signal handler unset.
  * Otherwise the signal might not behave as expected.
@@ -120,34 +165,110 @@ struct eloop_event {
 	void *read_cb_arg;
 	void (*write_cb)(void *);
 	void *write_cb_arg;
-	struct pollfd *pollfd;
+#ifdef ELOOP_STATS
+	size_t read_stat;
+	size_t write_stat;
+#endif
+#if defined(HAVE_IO_URING)
+	unsigned long long ring_data;		/* armed poll, or 0 */
+	unsigned int ring_events;
+#elif !defined(ELOOP_KERNEL)
+	size_t pollfd_idx;
+#endif
 };
 
+#define	ELOOP_EVENT_FDS_MIN	64
+
+/*
+ * Timeouts are kept in a binary min-heap ordered by their absolute
+ * monotonic deadline so the next one to fire is always at the root.
+ * They are also hashed by arg so that finding an existing timeout
+ * to replace or delete does not need to walk every timeout.
+ */
 struct eloop_timeout {
-	TAILQ_ENTRY(eloop_timeout) next;
-	unsigned int seconds;
+	TAILQ_ENTRY(eloop_timeout) next;	/* free list */
+	struct eloop_timeout *hnext;		/* hash chain */
+	size_t heap_idx;
+	unsigned int slot;			/* timer handle */
+	unsigned int gen;
+	unsigned long long seq;
+	unsigned long long seconds;
 	unsigned int nseconds;
 	void (*callback)(void *);
 	void *arg;
 	int queue;
+#ifdef ELOOP_STATS
+	size_t stat;
+#endif
 };
 
+#define	ELOOP_TIMEOUT_HASH_MIN	64
+
 struct eloop {
 	TAILQ_HEAD (event_head, eloop_event) events;
 	size_t nevents;
+	struct event_head deleted_events;
 	struct event_head free_events;
+	struct eloop_event **event_fds;		/* indexed by fd */
+	size_t event_fds_len;
 
 	struct timespec now;
-	TAILQ_HEAD (timeout_head, eloop_timeout) timeouts;
-	struct timeout_head free_timeouts;
+	int now_cached;
+	struct eloop_timeout **timeouts;
+	size_t ntimeouts;
+	size_t timeouts_len;
+	struct eloop_timeout **timeout_hash;
+	size_t timeout_hash_len;
+	struct eloop_timeout **timeout_slots;
+	size_t ntimeout_slots;
+	size_t timeout_slots_len;
+	unsigned long long timeout_seq;
+	TAILQ_HEAD (timeout_head, eloop_timeout) free_timeouts;
 
 	const int *signals;
 	size_t signals_len;
 	void (*signal_cb)(int, void *);
 	void *signal_cb_ctx;
+	void (*idle_cb)(void *);
+	void *idle_cb_ctx;
+
+	int events_need_setup;
+	int cleared;
+	int running;
+
+#ifdef ELOOP_STATS
+	struct eloop_stat *stats;
+	size_t nstats;
+	size_t stats_len;
+	int stats_timing;			/* set by eloop_stats() */
+#endif
 
+#if defined(HAVE_KQUEUE)
+	int poll_fd;
+	struct kevent *fds;
+#elif defined(HAVE_IO_URING)
+	int poll_fd;
+	void *ring;
+	size_t ring_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	unsigned int *sq_head, *sq_tail, *sq_mask;
+	unsigned int sq_entries;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned int ring_seq;
+#elif defined(HAVE_EPOLL)
+	int poll_fd;
+	int signal_fd;
+	struct epoll_event *fds;
+#else
 	struct pollfd *fds;
+	struct eloop_event **pollfd_events;	/* indexed as fds */
+	size_t npollfds;
+#endif
+#ifndef HAVE_IO_URING
 	size_t nfds;
+#endif
 
 	int exitnow;
 	int exitcode;
@@ -171,6 +292,90 @@ eloop_realloca(void *ptr, size_t n, size_t size)
 }
 #endif
 
+#ifdef ELOOP_STATS
+/* Not found, or there was no memory to record it. */
+#define	ELOOP_STAT_NONE	SIZE_MAX
+
+/*
+ * Stats are kept per callback function rather than per event or timeout
+ * so that they survive the event or timeout going away.
+ * There are only a few different callbacks, so a linear search when
+ * one is added is cheap enough.
+ */
+static size_t
+eloop_stat_find(struct eloop *eloop, void (*callback)(void *),
+    const char *name)
+{
+	struct eloop_stat *st;
+	size_t i;
+
+	if (callback == NULL)
+		return ELOOP_STAT_NONE;
+	for (i = 0; i < eloop->nstats; i++) {
+		if (eloop->stats[i].callback == callback)
+			return i;
+	}
+
+	if (eloop->nstats == eloop->stats_len) {
+		size_t len;
+
+		len = eloop->stats_len == 0 ? 32 : eloop->stats_len * 2;
+		st = eloop_realloca(eloop->stats, len, sizeof(*st));
+		if (st == NULL)
+			return ELOOP_STAT_NONE;
+		eloop->stats = st;
+		eloop->stats_len = len;
+	}
+
+	st = &eloop->stats[eloop->nstats];
+	memset(st, 0, sizeof(*st));
+	st->callback = callback;
+	st->name = name;
+	return eloop->nstats++;
+}
+
+static void
+eloop_stat_call(struct eloop *eloop, size_t idx,
+    void (*callback)(void *), void *arg)
+{
+	struct timespec ts, te;
+	struct eloop_stat *st;
+	unsigned long long ns;
+	unsigned int nsecs;
+
+	/* Reading the clock twice per callback isn't free, so only
+	 * pay for it once someone has asked for the stats. */
+	if (idx == ELOOP_STAT_NONE || !eloop->stats_timing) {
+		callback(arg);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	callback(arg);
+	clock_gettime(CLOCK_MONOTONIC, &te);
+	ns = eloop_timespec_diff(&te, &ts, &nsecs) * NSEC_PER_SEC + nsecs;
+
+	/* The callback could have added another and moved the stats. */
+	st = &eloop->stats[idx];
+	st->count++;
+	st->total_ns += ns;
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+}
+
+#define	ELOOP_CALL(eloop, stat, cb, arg)				\
+	do {								\
+		ELOOP_PROBE((cb), (arg));				\
+		eloop_stat_call((eloop), (stat), (cb), (arg));		\
+	} while (/* CONSTCOND */ 0)
+#else
+#define	ELOOP_CALL(eloop, stat, cb, arg)				\
+	do {								\
+		ELOOP_PROBE((cb), (arg));				\
+		(cb)((arg));						\
+	} while (/* CONSTCOND */ 0)
+#endif
+
 #ifdef HAVE_PSELECT
 /* Wrapper around pselect, to imitate the ppoll call. */
 static int
@@ -200,6 +405,10 @@ eloop_ppoll(struct pollfd * fds, nfds_t nfds,
 	r = pselect(maxfd + 1, &read_fds, &write_fds, NULL, ts, sigmask);
 	if (r > 0) {
 		for (n = 0; n < nfds; n++) {
+			if (fds[n].fd == -1) {
+				fds[n].revents = 0;
+				continue;
+			}
 			fds[n].revents =
 			    FD_ISSET(fds[n].fd, &read_fds) ? POLLIN : 0;
 			if (FD_ISSET(fds[n].fd, &write_fds))
@@ -246,300 +455,1222 @@ eloop_timespec_diff(const struct timespec *tsp, const struct timespec *usp,
 	return secs;
 }
 
+static int
+eloop_timeout_before(const struct eloop_timeout *a,
+    const struct eloop_timeout *b)
+{
+
+	if (a->seconds != b->seconds)
+		return a->seconds < b->seconds;
+	if (a->nseconds != b->nseconds)
+		return a->nseconds < b->nseconds;
+	/* Timeouts due at the same time run in the order added. */
+	return a->seq < b->seq;
+}
+
 static void
-eloop_reduce_timers(struct eloop *eloop)
+eloop_timeout_heap_set(struct eloop *eloop, size_t idx, struct eloop_timeout *t)
 {
-	struct timespec now;
-	unsigned long long secs;
-	unsigned int nsecs;
-	struct eloop_timeout *t;
 
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	secs = eloop_timespec_diff(&now, &eloop->now, &nsecs);
-
-	TAILQ_FOREACH(t, &eloop->timeouts, next) {
-		if (secs > t->seconds) {
-			t->seconds = 0;
-			t->nseconds = 0;
-		} else {
-			t->seconds -= (unsigned int)secs;
-			if (nsecs > t->nseconds) {
-				if (t->seconds == 0)
-					t->nseconds = 0;
-				else {
-					t->seconds--;
-					t->nseconds = NSEC_PER_SEC
-					    - (nsecs - t->nseconds);
-				}
-			} else
-				t->nseconds -= nsecs;
-		}
-	}
+	eloop->timeouts[idx] = t;
+	t->heap_idx = idx;
+}
+
+static void
+eloop_timeout_heap_up(struct eloop *eloop, size_t idx)
+{
+	struct eloop_timeout *t = eloop->timeouts[idx];
+	size_t parent;
 
-	eloop->now = now;
+	while (idx != 0) {
+		parent = (idx - 1) / 2;
+		if (!eloop_timeout_before(t, eloop->timeouts[parent]))
+			break;
+		eloop_timeout_heap_set(eloop, idx, eloop->timeouts[parent]);
+		idx = parent;
+	}
+	eloop_timeout_heap_set(eloop, idx, t);
 }
 
 static void
-eloop_event_setup_fds(struct eloop *eloop)
+eloop_timeout_heap_down(struct eloop *eloop, size_t idx)
 {
-	struct eloop_event *e;
-	struct pollfd *pfd;
+	struct eloop_timeout *t = eloop->timeouts[idx];
+	size_t child;
 
-	pfd = eloop->fds;
-	TAILQ_FOREACH(e, &eloop->events, next) {
-#ifdef ELOOP_DEBUG
-		fprintf(stderr, "%s(%d) fd=%d, rcb=%p, wcb=%p\n",
-		    __func__, getpid(), e->fd, e->read_cb, e->write_cb);
-#endif
-		e->pollfd = pfd;
-		pfd->fd = e->fd;
-		pfd->events = 0;
-		if (e->read_cb != NULL)
-			pfd->events |= POLLIN;
-		if (e->write_cb != NULL)
-			pfd->events |= POLLOUT;
-		pfd->revents = 0;
-		pfd++;
+	for (;;) {
+		child = idx * 2 + 1;
+		if (child >= eloop->ntimeouts)
+			break;
+		if (child + 1 < eloop->ntimeouts &&
+		    eloop_timeout_before(eloop->timeouts[child + 1],
+		    eloop->timeouts[child]))
+			child++;
+		if (!eloop_timeout_before(eloop->timeouts[child], t))
+			break;
+		eloop_timeout_heap_set(eloop, idx, eloop->timeouts[child]);
+		idx = child;
 	}
+	eloop_timeout_heap_set(eloop, idx, t);
 }
 
-size_t
-eloop_event_count(const struct eloop *eloop)
+static void
+eloop_timeout_heap_remove(struct eloop *eloop, struct eloop_timeout *t)
 {
+	size_t idx = t->heap_idx;
+	struct eloop_timeout *last;
 
-	return eloop->nevents;
+	assert(idx < eloop->ntimeouts && eloop->timeouts[idx] == t);
+	last = eloop->timeouts[--eloop->ntimeouts];
+	if (last == t)
+		return;
+	eloop_timeout_heap_set(eloop, idx, last);
+	if (idx != 0 &&
+	    eloop_timeout_before(last, eloop->timeouts[(idx - 1) / 2]))
+		eloop_timeout_heap_up(eloop, idx);
+	else
+		eloop_timeout_heap_down(eloop, idx);
 }
 
-int
-eloop_event_add_rw(struct eloop *eloop, int fd,
-    void (*read_cb)(void *), void *read_cb_arg,
-    void (*write_cb)(void *), void *write_cb_arg)
+static size_t
+eloop_timeout_hash_idx(size_t len, const void *arg)
 {
-	struct eloop_event *e;
-	struct pollfd *pfd;
+	uintptr_t h = (uintptr_t)arg;
 
-	assert(eloop != NULL);
-	assert(read_cb != NULL || write_cb != NULL);
-	if (fd == -1) {
-		errno = EINVAL;
+	/* Pointers are aligned, so mix the higher bits in. */
+	h ^= h >> 4 ^ h >> 12 ^ h >> 20;
+	return (size_t)h & (len - 1);
+}
+
+static struct eloop_timeout **
+eloop_timeout_hash_head(struct eloop *eloop, const void *arg)
+{
+
+	return &eloop->timeout_hash[
+	    eloop_timeout_hash_idx(eloop->timeout_hash_len, arg)];
+}
+
+static int
+eloop_timeout_hash_grow(struct eloop *eloop)
+{
+	struct eloop_timeout **hash, *t, *tn;
+	size_t i, len;
+
+	len = eloop->timeout_hash_len == 0 ?
+	    ELOOP_TIMEOUT_HASH_MIN : eloop->timeout_hash_len * 2;
+	hash = calloc(len, sizeof(*hash));
+	if (hash == NULL)
 		return -1;
+
+	for (i = 0; i < eloop->timeout_hash_len; i++) {
+		for (t = eloop->timeout_hash[i]; t != NULL; t = tn) {
+			tn = t->hnext;
+			t->hnext = hash[eloop_timeout_hash_idx(len, t->arg)];
+			hash[eloop_timeout_hash_idx(len, t->arg)] = t;
+		}
 	}
+	free(eloop->timeout_hash);
+	eloop->timeout_hash = hash;
+	eloop->timeout_hash_len = len;
+	return 0;
+}
 
-	TAILQ_FOREACH(e, &eloop->events, next) {
-		if (e->fd == fd)
+static void
+eloop_timeout_hash_remove(struct eloop *eloop, struct eloop_timeout *t)
+{
+	struct eloop_timeout **tp;
+
+	for (tp = eloop_timeout_hash_head(eloop, t->arg);
+	    *tp != NULL;
+	    tp = &(*tp)->hnext)
+	{
+		if (*tp == t)
 			break;
 	}
+	assert(*tp != NULL);
+	*tp = t->hnext;
+}
 
-	if (e == NULL) {
-		if (eloop->nevents + 1 > eloop->nfds) {
-			pfd = eloop_realloca(eloop->fds, eloop->nevents + 1,
-			    sizeof(*pfd));
-			if (pfd == NULL)
-				return -1;
-			eloop->fds = pfd;
-			eloop->nfds++;
-		}
+static void
+eloop_timeout_hash_insert(struct eloop *eloop, struct eloop_timeout *t)
+{
+	struct eloop_timeout **tp;
 
-		e = TAILQ_FIRST(&eloop->free_events);
-		if (e != NULL)
-			TAILQ_REMOVE(&eloop->free_events, e, next);
-		else {
-			e = malloc(sizeof(*e));
-			if (e == NULL)
-				return -1;
-		}
-		TAILQ_INSERT_HEAD(&eloop->events, e, next);
-		eloop->nevents++;
-		e->fd = fd;
-		e->read_cb = read_cb;
-		e->read_cb_arg = read_cb_arg;
-		e->write_cb = write_cb;
-		e->write_cb_arg = write_cb_arg;
-		goto setup;
-	}
+	tp = eloop_timeout_hash_head(eloop, t->arg);
+	t->hnext = *tp;
+	*tp = t;
+}
 
-	if (read_cb) {
-		e->read_cb = read_cb;
-		e->read_cb_arg = read_cb_arg;
-	}
-	if (write_cb) {
-		e->write_cb = write_cb;
-		e->write_cb_arg = write_cb_arg;
-	}
+/*
+ * Remove a timeout from the heap and hash.
+ * Bumping the generation invalidates any handle to it.
+ */
+static void
+eloop_timeout_unlink(struct eloop *eloop, struct eloop_timeout *t)
+{
 
-setup:
-	eloop_event_setup_fds(eloop);
-	return 0;
+	eloop_timeout_heap_remove(eloop, t);
+	eloop_timeout_hash_remove(eloop, t);
+	if (++t->gen == 0)
+		t->gen = 1;
 }
 
-int
-eloop_event_add(struct eloop *eloop, int fd,
-    void (*read_cb)(void *), void *read_cb_arg)
+static void
+eloop_timeout_free(struct eloop *eloop, struct eloop_timeout *t)
 {
 
-	return eloop_event_add_rw(eloop, fd, read_cb, read_cb_arg, NULL, NULL);
+	eloop_timeout_unlink(eloop, t);
+	TAILQ_INSERT_TAIL(&eloop->free_timeouts, t, next);
 }
 
-int
-eloop_event_add_w(struct eloop *eloop, int fd,
-    void (*write_cb)(void *), void *write_cb_arg)
+/*
+ * A timer handle is the slot the timeout lives in and the generation
+ * of it, so a handle to a timeout which has since fired or been
+ * deleted is never mistaken for a newer one.
+ * A handle of 0 is never valid.
+ */
+static unsigned long long
+eloop_timer_handle(const struct eloop_timeout *t)
 {
 
-	return eloop_event_add_rw(eloop, fd, NULL,NULL, write_cb, write_cb_arg);
+	return (unsigned long long)t->gen << 32 | t->slot;
 }
 
-int
-eloop_event_delete_write(struct eloop *eloop, int fd, int write_only)
+static struct eloop_timeout *
+eloop_timer_find(const struct eloop *eloop, unsigned long long handle)
 {
-	struct eloop_event *e;
+	size_t slot = (size_t)(handle & UINT32_MAX);
+	struct eloop_timeout *t;
 
-	assert(eloop != NULL);
+	if (handle == 0 || slot >= eloop->ntimeout_slots)
+		return NULL;
+	t = eloop->timeout_slots[slot];
+	if (t->gen != (unsigned int)(handle >> 32))
+		return NULL;
+	return t;
+}
 
-	TAILQ_FOREACH(e, &eloop->events, next) {
-		if (e->fd == fd)
-			break;
-	}
-	if (e == NULL) {
-		errno = ENOENT;
-		return -1;
-	}
+/* Take a timeout from the free list or allocate one and add it
+ * to the hash and the end of the heap. */
+static struct eloop_timeout *
+eloop_timeout_new(struct eloop *eloop, void (*callback)(void *), void *arg,
+    const char *name)
+{
+	struct eloop_timeout *t;
 
-	if (write_only) {
-		if (e->read_cb == NULL)
-			goto remove;
-		e->write_cb = NULL;
-		e->write_cb_arg = NULL;
-		goto done;
+	if (eloop->ntimeouts == eloop->timeouts_len) {
+		struct eloop_timeout **heap;
+		size_t len;
+
+		len = eloop->timeouts_len == 0 ?
+		    ELOOP_TIMEOUT_HASH_MIN : eloop->timeouts_len * 2;
+		heap = eloop_realloca(eloop->timeouts, len, sizeof(*heap));
+		if (heap == NULL)
+			return NULL;
+		eloop->timeouts = heap;
+		eloop->timeouts_len = len;
 	}
+	if (eloop->ntimeouts >= eloop->timeout_hash_len &&
+	    eloop_timeout_hash_grow(eloop) == -1)
+		return NULL;
 
-remove:
-	TAILQ_REMOVE(&eloop->events, e, next);
-	TAILQ_INSERT_TAIL(&eloop->free_events, e, next);
-	eloop->nevents--;
+	if ((t = TAILQ_FIRST(&eloop->free_timeouts))) {
+		TAILQ_REMOVE(&eloop->free_timeouts, t, next);
+	} else {
+		if (eloop->ntimeout_slots == eloop->timeout_slots_len) {
+			struct eloop_timeout **slots;
+			size_t len;
+
+			if (eloop->timeout_slots_len >= UINT32_MAX / 2) {
+				errno = ENOMEM;
+				return NULL;
+			}
+			len = eloop->timeout_slots_len == 0 ?
+			    ELOOP_TIMEOUT_HASH_MIN :
+			    eloop->timeout_slots_len * 2;
+			slots = eloop_realloca(eloop->timeout_slots, len,
+			    sizeof(*slots));
+			if (slots == NULL)
+				return NULL;
+			eloop->timeout_slots = slots;
+			eloop->timeout_slots_len = len;
+		}
+		if ((t = malloc(sizeof(*t))) == NULL)
+			return NULL;
+		t->slot = (unsigned int)eloop->ntimeout_slots++;
+		t->gen = 1;
+		eloop->timeout_slots[t->slot] = t;
+	}
 
-done:
-	eloop_event_setup_fds(eloop);
-	return 1;
+	t->callback = callback;
+	t->arg = arg;
+#ifdef ELOOP_STATS
+	t->stat = eloop_stat_find(eloop, callback, name);
+#else
+	UNUSED(name);
+#endif
+	eloop_timeout_hash_insert(eloop, t);
+	t->heap_idx = eloop->ntimeouts++;
+	eloop->timeouts[t->heap_idx] = t;
+	return t;
 }
 
 /*
- * This implementation should cope with UINT_MAX seconds on a system
- * where time_t is INT32_MAX. It should also cope with the monotonic timer
- * wrapping, although this is highly unlikely.
- * unsigned int should match or be greater than any on wire specified timeout.
+ * Granularities a deadline with slack can be aligned to, coarsest first.
+ * As deadlines are absolute, timeouts aligned to the same boundary
+ * fire together in one wakeup.
  */
-static int
-eloop_q_timeout_add(struct eloop *eloop, int queue,
-    unsigned int seconds, unsigned int nseconds,
-    void (*callback)(void *), void *arg)
-{
-	struct eloop_timeout *t, *tt = NULL;
+static const unsigned long long eloop_slack_align[] = {
+	60ULL * NSEC_PER_SEC,
+	10ULL * NSEC_PER_SEC,
+	1ULL * NSEC_PER_SEC,
+	250ULL * NSEC_PER_MSEC,
+	100ULL * NSEC_PER_MSEC,
+	10ULL * NSEC_PER_MSEC,
+	1ULL * NSEC_PER_MSEC,
+};
 
-	assert(eloop != NULL);
-	assert(callback != NULL);
-	assert(nseconds <= NSEC_PER_SEC);
+static void
+eloop_timeout_slack(struct eloop_timeout *t, unsigned int slack)
+{
+	unsigned long long when, latest, aligned;
+	size_t i;
 
-	/* Remove existing timeout if present. */
-	TAILQ_FOREACH(t, &eloop->timeouts, next) {
-		if (t->callback == callback && t->arg == arg) {
-			TAILQ_REMOVE(&eloop->timeouts, t, next);
-			break;
+	when = t->seconds * NSEC_PER_SEC + t->nseconds;
+	latest = when + (unsigned long long)slack * NSEC_PER_MSEC;
+	for (i = 0; i < __arraycount(eloop_slack_align); i++) {
+		aligned = latest - latest % eloop_slack_align[i];
+		if (aligned >= when) {
+			t->seconds = aligned / NSEC_PER_SEC;
+			t->nseconds = (unsigned int)(aligned % NSEC_PER_SEC);
+			return;
 		}
 	}
+}
 
-	if (t == NULL) {
-		/* No existing, so allocate or grab one from the free pool. */
-		if ((t = TAILQ_FIRST(&eloop->free_timeouts))) {
-			TAILQ_REMOVE(&eloop->free_timeouts, t, next);
-		} else {
-			if ((t = malloc(sizeof(*t))) == NULL)
-				return -1;
-		}
+/*
+ * While dispatching, the clock is read once per wakeup and shared by
+ * everything that needs it until the next wait.
+ * Outside of eloop_start there is no telling how long ago that was,
+ * so it's read each time.
+ */
+static const struct timespec *
+eloop_now(struct eloop *eloop)
+{
+
+	if (!eloop->now_cached) {
+		clock_gettime(CLOCK_MONOTONIC, &eloop->now);
+		eloop->now_cached = eloop->running;
 	}
+	return &eloop->now;
+}
 
-	eloop_reduce_timers(eloop);
+static void
+eloop_timeout_schedule(struct eloop *eloop, struct eloop_timeout *t,
+    int queue, unsigned int seconds, unsigned int nseconds,
+    unsigned int slack)
+{
+	const struct timespec *now = eloop_now(eloop);
 
-	t->seconds = seconds;
-	t->nseconds = nseconds;
-	t->callback = callback;
-	t->arg = arg;
+	t->seconds = (unsigned long long)now->tv_sec + seconds;
+	t->nseconds = (unsigned int)now->tv_nsec + nseconds;
+	if (t->nseconds >= NSEC_PER_SEC) {
+		t->seconds++;
+		t->nseconds -= NSEC_PER_SEC;
+	}
+	if (slack != 0)
+		eloop_timeout_slack(t, slack);
+	t->seq = eloop->timeout_seq++;
 	t->queue = queue;
 
-	/* The timeout list should be in chronological order,
-	 * soonest first. */
-	TAILQ_FOREACH(tt, &eloop->timeouts, next) {
-		if (t->seconds < tt->seconds ||
-		    (t->seconds == tt->seconds && t->nseconds < tt->nseconds))
-		{
-			TAILQ_INSERT_BEFORE(tt, t, next);
-			return 0;
-		}
-	}
-	TAILQ_INSERT_TAIL(&eloop->timeouts, t, next);
-	return 0;
+	/* A replaced timeout could now be due sooner or later. */
+	eloop_timeout_heap_up(eloop, t->heap_idx);
+	eloop_timeout_heap_down(eloop, t->heap_idx);
 }
 
-int
-eloop_q_timeout_add_tv(struct eloop *eloop, int queue,
-    const struct timespec *when, void (*callback)(void *), void *arg)
+#if defined(HAVE_KQUEUE)
+static int
+eloop_open(struct eloop *eloop)
 {
 
-	if (when->tv_sec < 0 || (unsigned long)when->tv_sec > UINT_MAX) {
-		errno = EINVAL;
+#ifdef HAVE_KQUEUE1
+	eloop->poll_fd = kqueue1(O_CLOEXEC);
+#else
+	int fd, flags;
+
+	fd = kqueue();
+	if (fd == -1)
 		return -1;
-	}
-	if (when->tv_nsec < 0 || when->tv_nsec > NSEC_PER_SEC) {
-		errno = EINVAL;
+	if ((flags = fcntl(fd, F_GETFD, 0)) == -1 ||
+	    fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1)
+	{
+		close(fd);
 		return -1;
 	}
+	eloop->poll_fd = fd;
+#endif
+	return eloop->poll_fd;
+}
 
-	return eloop_q_timeout_add(eloop, queue,
-	    (unsigned int)when->tv_sec, (unsigned int)when->tv_sec,
-	    callback, arg);
+static int
+eloop_event_kernel(struct eloop *eloop, struct eloop_event *e,
+    int oldread, int oldwrite)
+{
+	struct kevent ke[2], *kep = ke;
+
+	if (e->read_cb != NULL && !oldread) {
+		EV_SET(kep, (uintptr_t)e->fd, EVFILT_READ, EV_ADD,
+		    0, 0, UPTR(e));
+		kep++;
+	} else if (e->read_cb == NULL && oldread) {
+		EV_SET(kep, (uintptr_t)e->fd, EVFILT_READ, EV_DELETE,
+		    0, 0, UPTR(e));
+		kep++;
+	}
+	if (e->write_cb != NULL && !oldwrite) {
+		EV_SET(kep, (uintptr_t)e->fd, EVFILT_WRITE, EV_ADD,
+		    0, 0, UPTR(e));
+		kep++;
+	} else if (e->write_cb == NULL && oldwrite) {
+		EV_SET(kep, (uintptr_t)e->fd, EVFILT_WRITE, EV_DELETE,
+		    0, 0, UPTR(e));
+		kep++;
+	}
+	if (kep == ke)
+		return 0;
+	return kevent(eloop->poll_fd, ke, LENC(kep - ke), NULL, 0, NULL);
 }
 
-int
-eloop_q_timeout_add_sec(struct eloop *eloop, int queue, unsigned int seconds,
-    void (*callback)(void *), void *arg)
+static int
+eloop_signal_kqueue(struct eloop *eloop)
 {
+	struct kevent *ke;
+	size_t i;
+	int error;
 
-	return eloop_q_timeout_add(eloop, queue, seconds, 0, callback, arg);
+	if (eloop->signals_len == 0)
+		return 0;
+	ke = eloop_realloca(NULL, eloop->signals_len, sizeof(*ke));
+	if (ke == NULL)
+		return -1;
+	for (i = 0; i < eloop->signals_len; i++)
+		EV_SET(&ke[i], (uintptr_t)eloop->signals[i],
+		    EVFILT_SIGNAL, EV_ADD, 0, 0, UPTR(NULL));
+	error = kevent(eloop->poll_fd, ke, LENC(eloop->signals_len),
+	    NULL, 0, NULL);
+	free(ke);
+	return error;
 }
+#elif defined(HAVE_IO_URING)
+/*
+ * Each event has a oneshot poll armed in the ring which is armed again
+ * once dispatched, so a descriptor left readable is reported again just
+ * like the other backends.
+ * Arming and removing polls only queues a submission, they all go to
+ * the kernel with the next wait in one io_uring_enter(2) call.
+ * A poll is identified by the fd and a sequence number so completions
+ * for a poll since removed are ignored.
+ */
+#define	ELOOP_RING_ENTRIES	256
 
-int
-eloop_q_timeout_add_msec(struct eloop *eloop, int queue, unsigned long when,
-    void (*callback)(void *), void *arg)
+static int
+eloop_open(struct eloop *eloop)
 {
-	unsigned long seconds, nseconds;
+	struct io_uring_params p = { .flags = IORING_SETUP_R_DISABLED };
+	/* The ring can only be used to poll so it cannot be used to
+	 * get around a seccomp filter. */
+	struct io_uring_restriction res[] = {
+	    { .opcode = IORING_RESTRICTION_SQE_OP,
+	      .sqe_op = IORING_OP_POLL_ADD },
+	    { .opcode = IORING_RESTRICTION_SQE_OP,
+	      .sqe_op = IORING_OP_POLL_REMOVE },
+	};
+	int fd;
+	size_t len;
+	void *ring, *sqes;
+	char *r;
 
-	seconds = when / MSEC_PER_SEC;
-	if (seconds > UINT_MAX) {
-		errno = EINVAL;
+	fd = (int)syscall(__NR_io_uring_setup, ELOOP_RING_ENTRIES, &p);
+	if (fd == -1)
 		return -1;
+	/* Waiting with a timeout and signal mask needs Linux 5.11. */
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !(p.features & IORING_FEAT_EXT_ARG))
+	{
+		errno = ENOTSUP;
+		goto err;
+	}
+	if (syscall(__NR_io_uring_register, fd,
+	    IORING_REGISTER_RESTRICTIONS, res, __arraycount(res)) == -1 ||
+	    syscall(__NR_io_uring_register, fd,
+	    IORING_REGISTER_ENABLE_RINGS, NULL, 0) == -1)
+		goto err;
+
+	eloop->ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (len > eloop->ring_len)
+		eloop->ring_len = len;
+	ring = mmap(NULL, eloop->ring_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring == MAP_FAILED)
+		goto err;
+	eloop->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = mmap(NULL, eloop->sqes_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		munmap(ring, eloop->ring_len);
+		goto err;
 	}
 
-	nseconds = (when % MSEC_PER_SEC) * NSEC_PER_MSEC;
-	return eloop_q_timeout_add(eloop, queue,
-		(unsigned int)seconds, (unsigned int)nseconds, callback, arg);
+	r = ring;
+	eloop->ring = ring;
+	eloop->sqes = sqes;
+	eloop->sq_head = (unsigned int *)(void *)(r + p.sq_off.head);
+	eloop->sq_tail = (unsigned int *)(void *)(r + p.sq_off.tail);
+	eloop->sq_mask = (unsigned int *)(void *)(r + p.sq_off.ring_mask);
+	eloop->sq_entries = p.sq_entries;
+	eloop->cq_head = (unsigned int *)(void *)(r + p.cq_off.head);
+	eloop->cq_tail = (unsigned int *)(void *)(r + p.cq_off.tail);
+	eloop->cq_mask = (unsigned int *)(void *)(r + p.cq_off.ring_mask);
+	eloop->cqes = (struct io_uring_cqe *)(void *)(r + p.cq_off.cqes);
+
+	/* Submission entries are always used in ring order. */
+	for (len = 0; len < p.sq_entries; len++)
+		((unsigned int *)(void *)(r + p.sq_off.array))[len] =
+		    (unsigned int)len;
+
+	eloop->poll_fd = fd;
+	return fd;
+
+err:
+	close(fd);
+	return -1;
 }
 
-int
-eloop_q_timeout_delete(struct eloop *eloop, int queue,
-    void (*callback)(void *), void *arg)
+static void
+eloop_close(struct eloop *eloop)
+{
+
+	if (eloop->ring != NULL) {
+		munmap(eloop->sqes, eloop->sqes_len);
+		munmap(eloop->ring, eloop->ring_len);
+		eloop->ring = NULL;
+	}
+	if (eloop->poll_fd != -1) {
+		close(eloop->poll_fd);
+		eloop->poll_fd = -1;
+	}
+}
+
+static int
+eloop_ring_enter(struct eloop *eloop, unsigned int min_complete,
+    unsigned int flags, const void *arg, size_t argsz)
+{
+	unsigned int to_submit;
+
+	to_submit = *eloop->sq_tail -
+	    __atomic_load_n(eloop->sq_head, __ATOMIC_ACQUIRE);
+	return (int)syscall(__NR_io_uring_enter, eloop->poll_fd,
+	    to_submit, min_complete, flags, arg, argsz);
+}
+
+static struct io_uring_sqe *
+eloop_ring_sqe(struct eloop *eloop)
+{
+	unsigned int tail = *eloop->sq_tail;
+	struct io_uring_sqe *sqe;
+
+	/* If the queue is full hand it to the kernel now. */
+	if (tail - __atomic_load_n(eloop->sq_head, __ATOMIC_ACQUIRE) ==
+	    eloop->sq_entries &&
+	    eloop_ring_enter(eloop, 0, 0, NULL, 0) == -1)
+		return NULL;
+
+	sqe = &eloop->sqes[tail & *eloop->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+static void
+eloop_ring_push(struct eloop *eloop)
+{
+
+	__atomic_store_n(eloop->sq_tail, *eloop->sq_tail + 1,
+	    __ATOMIC_RELEASE);
+}
+
+static int
+eloop_event_kernel(struct eloop *eloop, struct eloop_event *e,
+    __unused int oldread, __unused int oldwrite)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int events = 0;
+
+	if (e->read_cb != NULL)
+		events |= POLLIN;
+	if (e->write_cb != NULL)
+		events |= POLLOUT;
+
+	if (e->ring_data != 0) {
+		if (events == e->ring_events)
+			return 0;
+		if ((sqe = eloop_ring_sqe(eloop)) == NULL)
+			return -1;
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = e->ring_data;
+		eloop_ring_push(eloop);
+		e->ring_data = 0;
+	}
+	if (events == 0)
+		return 0;
+
+	if ((sqe = eloop_ring_sqe(eloop)) == NULL)
+		return -1;
+	/* 0 is never a valid sequence so removals can use it. */
+	if (++eloop->ring_seq == 0)
+		eloop->ring_seq = 1;
+	e->ring_data = (unsigned long long)eloop->ring_seq << 32 |
+	    (unsigned int)e->fd;
+	e->ring_events = events;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = e->fd;
+	sqe->poll_events = (unsigned short)events;
+	sqe->user_data = e->ring_data;
+	eloop_ring_push(eloop);
+	return 0;
+}
+#elif defined(HAVE_EPOLL)
+static int
+eloop_open(struct eloop *eloop)
+{
+
+	eloop->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+	return eloop->poll_fd;
+}
+
+static int
+eloop_event_kernel(struct eloop *eloop, struct eloop_event *e,
+    int oldread, int oldwrite)
+{
+	struct epoll_event epe = { .events = 0 };
+	int op;
+
+	if (e->read_cb != NULL)
+		epe.events |= EPOLLIN;
+	if (e->write_cb != NULL)
+		epe.events |= EPOLLOUT;
+	epe.data.ptr = e;
+
+	if (epe.events == 0)
+		op = EPOLL_CTL_DEL;
+	else if (!oldread && !oldwrite)
+		op = EPOLL_CTL_ADD;
+	else
+		op = EPOLL_CTL_MOD;
+	if (epoll_ctl(eloop->poll_fd, op, e->fd, &epe) == 0)
+		return 0;
+
+	/* The fd could have been closed and re-opened without
+	 * being removed from eloop, in which case the kernel has
+	 * silently dropped it from the epoll set. */
+	if (op == EPOLL_CTL_MOD && errno == ENOENT)
+		return epoll_ctl(eloop->poll_fd, EPOLL_CTL_ADD, e->fd, &epe);
+	return -1;
+}
+
+/*
+ * Signals are read from a signalfd(2) in the epoll set, marked by a NULL
+ * data pointer, so a burst is batched into one wakeup and none are lost.
+ * The signals must stay blocked, which eloop_signal_mask does for us.
+ * If we cannot get one, the signal handler and its backlog are used.
+ */
+static int
+eloop_signal_epoll(struct eloop *eloop)
+{
+	struct epoll_event epe = { .events = EPOLLIN, .data.ptr = NULL };
+	sigset_t set;
+	size_t i;
+	int fd;
+
+	if (eloop->signals_len == 0 && eloop->signal_fd == -1)
+		return 0;
+	sigemptyset(&set);
+	for (i = 0; i < eloop->signals_len; i++)
+		sigaddset(&set, eloop->signals[i]);
+	fd = signalfd(eloop->signal_fd, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	eloop->signal_fd = fd;
+	if (epoll_ctl(eloop->poll_fd, EPOLL_CTL_ADD, fd, &epe) == -1 &&
+	    errno != EEXIST)
+		return -1;
+	return 0;
+}
+
+static void
+eloop_signal_epoll_close(struct eloop *eloop)
+{
+
+	if (eloop->signal_fd != -1) {
+		close(eloop->signal_fd);
+		eloop->signal_fd = -1;
+	}
+}
+
+static void
+eloop_signal_epoll_read(struct eloop *eloop)
+{
+	struct signalfd_siginfo ssi[ELOOP_NSIGNALS];
+	ssize_t len;
+	size_t i, n;
+
+	for (;;) {
+		len = read(eloop->signal_fd, ssi, sizeof(ssi));
+		if (len == -1 || (size_t)len < sizeof(ssi[0]))
+			return;
+		n = (size_t)len / sizeof(ssi[0]);
+		for (i = 0; i < n; i++) {
+			if (eloop->signal_cb != NULL)
+				eloop->signal_cb((int)ssi[i].ssi_signo,
+				    eloop->signal_cb_ctx);
+			if (eloop->exitnow || eloop->cleared)
+				return;
+		}
+		if (n != __arraycount(ssi))
+			return;
+	}
+}
+#endif
+
+#if defined(ELOOP_KERNEL) && !defined(HAVE_IO_URING)
+static void
+eloop_close(struct eloop *eloop)
+{
+
+	if (eloop->poll_fd != -1) {
+		close(eloop->poll_fd);
+		eloop->poll_fd = -1;
+	}
+}
+#endif
+
+static struct eloop_event *
+eloop_event_find(const struct eloop *eloop, int fd)
+{
+
+	if (fd < 0 || (size_t)fd >= eloop->event_fds_len)
+		return NULL;
+	return eloop->event_fds[fd];
+}
+
+static int
+eloop_event_fds_grow(struct eloop *eloop, int fd)
+{
+	struct eloop_event **efds;
+	size_t len;
+
+	len = eloop->event_fds_len == 0 ?
+	    ELOOP_EVENT_FDS_MIN : eloop->event_fds_len;
+	while (len <= (size_t)fd)
+		len *= 2;
+	efds = eloop_realloca(eloop->event_fds, len, sizeof(*efds));
+	if (efds == NULL)
+		return -1;
+	memset(efds + eloop->event_fds_len, 0,
+	    (len - eloop->event_fds_len) * sizeof(*efds));
+	eloop->event_fds = efds;
+	eloop->event_fds_len = len;
+	return 0;
+}
+
+#ifndef ELOOP_KERNEL
+static void
+eloop_event_setup_pollfd(struct eloop_event *e, struct pollfd *pfd)
+{
+
+#ifdef ELOOP_DEBUG
+	fprintf(stderr, "%s(%d) fd=%d, rcb=%p, wcb=%p\n",
+	    __func__, getpid(), e->fd, e->read_cb, e->write_cb);
+#endif
+	pfd->fd = e->fd;
+	pfd->events = 0;
+	if (e->read_cb != NULL)
+		pfd->events |= POLLIN;
+	if (e->write_cb != NULL)
+		pfd->events |= POLLOUT;
+}
+
+static int
+eloop_event_add_pollfd(struct eloop *eloop, struct eloop_event *e)
+{
+	struct pollfd *pfd;
+
+	if (eloop->npollfds == eloop->nfds) {
+		struct eloop_event **pe;
+		size_t nfds;
+
+		nfds = eloop->nfds == 0 ? ELOOP_EVENT_FDS_MIN : eloop->nfds * 2;
+		pfd = eloop_realloca(eloop->fds, nfds, sizeof(*pfd));
+		if (pfd == NULL)
+			return -1;
+		eloop->fds = pfd;
+		pe = eloop_realloca(eloop->pollfd_events, nfds, sizeof(*pe));
+		if (pe == NULL)
+			return -1;
+		eloop->pollfd_events = pe;
+		eloop->nfds = nfds;
+	}
+
+	e->pollfd_idx = eloop->npollfds++;
+	eloop->pollfd_events[e->pollfd_idx] = e;
+	pfd = &eloop->fds[e->pollfd_idx];
+	eloop_event_setup_pollfd(e, pfd);
+	/* Not ready until the next poll. */
+	pfd->revents = 0;
+	return 0;
+}
+#endif
+
+/*
+ * Events deleted while dispatching are only marked as such because
+ * the kernel reply or pollfd array may still reference them.
+ * Once we are about to wait again they are released, their pollfd
+ * slot reused by the last one and the kernel reply array sized to fit.
+ */
+static int
+eloop_event_setup_fds(struct eloop *eloop)
+{
+	struct eloop_event *e;
+#if defined(ELOOP_KERNEL) && !defined(HAVE_IO_URING)
+	size_t nfds;
+
+	nfds = ELOOP_NFDS(eloop->nevents);
+	if (nfds > eloop->nfds) {
+		void *fds;
+
+		fds = eloop_realloca(eloop->fds, nfds, sizeof(*eloop->fds));
+		if (fds == NULL)
+			return -1;
+		eloop->fds = fds;
+		eloop->nfds = nfds;
+	}
+#endif
+
+	while ((e = TAILQ_FIRST(&eloop->deleted_events)) != NULL) {
+		TAILQ_REMOVE(&eloop->deleted_events, e, next);
+#ifndef ELOOP_KERNEL
+		if (e->pollfd_idx != --eloop->npollfds) {
+			struct eloop_event *le;
+
+			le = eloop->pollfd_events[eloop->npollfds];
+			le->pollfd_idx = e->pollfd_idx;
+			eloop->pollfd_events[le->pollfd_idx] = le;
+			eloop->fds[le->pollfd_idx] =
+			    eloop->fds[eloop->npollfds];
+		}
+#endif
+		TAILQ_INSERT_TAIL(&eloop->free_events, e, next);
+	}
+
+	eloop->events_need_setup = 0;
+	return 0;
+}
+
+size_t
+eloop_event_count(const struct eloop *eloop)
+{
+
+	return eloop->nevents;
+}
+
+int
+eloop_event_add_named(struct eloop *eloop, int fd,
+    void (*read_cb)(void *), void *read_cb_arg, const char *read_name,
+    void (*write_cb)(void *), void *write_cb_arg, const char *write_name)
+{
+	struct eloop_event *e;
+	int oldread, oldwrite;
+
+	assert(eloop != NULL);
+	assert(read_cb != NULL || write_cb != NULL);
+	if (fd == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+#ifndef ELOOP_STATS
+	UNUSED(read_name);
+	UNUSED(write_name);
+#endif
+
+	e = eloop_event_find(eloop, fd);
+	if (e == NULL) {
+		if ((size_t)fd >= eloop->event_fds_len &&
+		    eloop_event_fds_grow(eloop, fd) == -1)
+			return -1;
+
+		e = TAILQ_FIRST(&eloop->free_events);
+		if (e != NULL)
+			TAILQ_REMOVE(&eloop->free_events, e, next);
+		else {
+			e = malloc(sizeof(*e));
+			if (e == NULL)
+				return -1;
+		}
+		e->fd = fd;
+		e->read_cb = read_cb;
+		e->read_cb_arg = read_cb_arg;
+		e->write_cb = write_cb;
+		e->write_cb_arg = write_cb_arg;
+#ifdef ELOOP_STATS
+		e->read_stat = eloop_stat_find(eloop, read_cb, read_name);
+		e->write_stat = eloop_stat_find(eloop, write_cb, write_name);
+#endif
+#ifdef HAVE_IO_URING
+		e->ring_data = 0;
+#endif
+#ifdef ELOOP_KERNEL
+		if (eloop_event_kernel(eloop, e, 0, 0) == -1) {
+#else
+		if (eloop_event_add_pollfd(eloop, e) == -1) {
+#endif
+			TAILQ_INSERT_TAIL(&eloop->free_events, e, next);
+			return -1;
+		}
+		TAILQ_INSERT_HEAD(&eloop->events, e, next);
+		eloop->event_fds[fd] = e;
+		eloop->nevents++;
+#ifdef ELOOP_KERNEL
+		/* The kernel reply array may need to grow. */
+		eloop->events_need_setup = 1;
+#endif
+		return 0;
+	}
+
+	oldread = e->read_cb != NULL;
+	oldwrite = e->write_cb != NULL;
+	if (read_cb) {
+#ifdef ELOOP_STATS
+		if (read_cb != e->read_cb)
+			e->read_stat = eloop_stat_find(eloop,
+			    read_cb, read_name);
+#endif
+		e->read_cb = read_cb;
+		e->read_cb_arg = read_cb_arg;
+	}
+	if (write_cb) {
+#ifdef ELOOP_STATS
+		if (write_cb != e->write_cb)
+			e->write_stat = eloop_stat_find(eloop,
+			    write_cb, write_name);
+#endif
+		e->write_cb = write_cb;
+		e->write_cb_arg = write_cb_arg;
+	}
+#ifdef ELOOP_KERNEL
+	if (eloop_event_kernel(eloop, e, oldread, oldwrite) == -1)
+		return -1;
+#else
+	UNUSED(oldread);
+	UNUSED(oldwrite);
+	eloop_event_setup_pollfd(e, &eloop->fds[e->pollfd_idx]);
+#endif
+	return 0;
+}
+
+int
+eloop_event_delete_write(struct eloop *eloop, int fd, int write_only)
+{
+	struct eloop_event *e;
+
+	assert(eloop != NULL);
+
+	e = eloop_event_find(eloop, fd);
+	if (e == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (write_only) {
+		if (e->read_cb == NULL)
+			goto remove;
+		if (e->write_cb == NULL)
+			return 1;
+		e->write_cb = NULL;
+		e->write_cb_arg = NULL;
+#ifdef ELOOP_KERNEL
+		eloop_event_kernel(eloop, e, 1, 1);
+#else
+		eloop_event_setup_pollfd(e, &eloop->fds[e->pollfd_idx]);
+#endif
+		return 1;
+	}
+
+remove:
+#ifdef ELOOP_KERNEL
+	/* The fd may already be closed, in which case the kernel
+	 * has already removed it, so ignore any error. */
+	{
+		int oldread = e->read_cb != NULL;
+		int oldwrite = e->write_cb != NULL;
+
+		e->read_cb = NULL;
+		e->write_cb = NULL;
+		eloop_event_kernel(eloop, e, oldread, oldwrite);
+	}
+#endif
+	eloop->event_fds[e->fd] = NULL;
+	e->fd = -1;
+	e->read_cb = NULL;
+	e->write_cb = NULL;
+#ifndef ELOOP_KERNEL
+	eloop->fds[e->pollfd_idx].fd = -1;
+	eloop->fds[e->pollfd_idx].events = 0;
+	eloop->fds[e->pollfd_idx].revents = 0;
+#endif
+	TAILQ_REMOVE(&eloop->events, e, next);
+	TAILQ_INSERT_TAIL(&eloop->deleted_events, e, next);
+	eloop->nevents--;
+	eloop->events_need_setup = 1;
+	return 1;
+}
+
+/*
+ * This implementation should cope with UINT_MAX seconds on a system
+ * where time_t is INT32_MAX.
+ * The deadline is stored as unsigned long long seconds since the
+ * monotonic clock epoch so it cannot overflow.
+ * unsigned int should match or be greater than any on wire specified timeout.
+ */
+static int
+eloop_q_timeout_add(struct eloop *eloop, int queue,
+    unsigned int seconds, unsigned int nseconds, unsigned int slack,
+    void (*callback)(void *), void *arg, const char *name)
+{
+	struct eloop_timeout *t;
+
+	assert(eloop != NULL);
+	assert(callback != NULL);
+	assert(nseconds <= NSEC_PER_SEC);
+
+	/* Find an existing timeout to replace. */
+	t = NULL;
+	if (eloop->timeout_hash_len != 0) {
+		for (t = *eloop_timeout_hash_head(eloop, arg);
+		    t != NULL;
+		    t = t->hnext)
+		{
+			if (t->callback == callback && t->arg == arg)
+				break;
+		}
+	}
+
+	if (t == NULL &&
+	    (t = eloop_timeout_new(eloop, callback, arg, name)) == NULL)
+		return -1;
+	eloop_timeout_schedule(eloop, t, queue, seconds, nseconds, slack);
+	return 0;
+}
+
+/*
+ * Unlike eloop_q_timeout_add, an existing (callback, arg) pair is not
+ * replaced. Instead the timeout the handle refers to is rescheduled if
+ * it's still pending, otherwise a new one is added and the handle
+ * updated to match.
+ */
+static int
+eloop_q_timer_add(struct eloop *eloop, int queue, unsigned long long *handle,
+    unsigned int seconds, unsigned int nseconds, unsigned int slack,
+    void (*callback)(void *), void *arg, const char *name)
+{
+	struct eloop_timeout *t;
+
+	assert(eloop != NULL);
+	assert(handle != NULL);
+	assert(callback != NULL);
+	assert(nseconds <= NSEC_PER_SEC);
+
+	t = eloop_timer_find(eloop, *handle);
+	if (t == NULL) {
+		t = eloop_timeout_new(eloop, callback, arg, name);
+		if (t == NULL)
+			return -1;
+	} else {
+		if (t->arg != arg) {
+			eloop_timeout_hash_remove(eloop, t);
+			t->arg = arg;
+			eloop_timeout_hash_insert(eloop, t);
+		}
+		if (t->callback != callback) {
+			t->callback = callback;
+#ifdef ELOOP_STATS
+			t->stat = eloop_stat_find(eloop, callback, name);
+#endif
+		}
+	}
+
+	eloop_timeout_schedule(eloop, t, queue, seconds, nseconds, slack);
+	*handle = eloop_timer_handle(t);
+	return 0;
+}
+
+int
+eloop_q_timer_add_sec_named(struct eloop *eloop, int queue,
+    unsigned long long *handle, unsigned int seconds,
+    void (*callback)(void *), void *arg,
+    const char *name)
+{
+
+	return eloop_q_timer_add(eloop, queue, handle, seconds, 0, 0,
+	    callback, arg, name);
+}
+
+int
+eloop_q_timer_add_sec_slack_named(struct eloop *eloop, int queue,
+    unsigned long long *handle, unsigned int seconds, unsigned int slack,
+    void (*callback)(void *), void *arg,
+    const char *name)
+{
+
+	return eloop_q_timer_add(eloop, queue, handle, seconds, 0, slack,
+	    callback, arg, name);
+}
+
+int
+eloop_q_timer_add_msec_named(struct eloop *eloop, int queue,
+    unsigned long long *handle, unsigned long when,
+    void (*callback)(void *), void *arg,
+    const char *name)
+{
+
+	return eloop_q_timer_add_msec_slack_named(eloop, queue, handle,
+	    when, 0, callback, arg, name);
+}
+
+int
+eloop_q_timer_add_msec_slack_named(struct eloop *eloop, int queue,
+    unsigned long long *handle, unsigned long when, unsigned int slack,
+    void (*callback)(void *), void *arg,
+    const char *name)
+{
+	unsigned long seconds, nseconds;
+
+	seconds = when / MSEC_PER_SEC;
+	if (seconds > UINT_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	nseconds = (when % MSEC_PER_SEC) * NSEC_PER_MSEC;
+	return eloop_q_timer_add(eloop, queue, handle,
+		(unsigned int)seconds, (unsigned int)nseconds, slack,
+		callback, arg, name);
+}
+
+int
+eloop_timer_cancel(struct eloop *eloop, unsigned long long *handle)
+{
+	struct eloop_timeout *t;
+
+	assert(eloop != NULL);
+	assert(handle != NULL);
+
+	t = eloop_timer_find(eloop, *handle);
+	*handle = 0;
+	if (t == NULL)
+		return 0;
+	eloop_timeout_free(eloop, t);
+	return 1;
+}
+
+int
+eloop_timer_pending(const struct eloop *eloop, unsigned long long handle)
+{
+
+	assert(eloop != NULL);
+
+	return eloop_timer_find(eloop, handle) != NULL;
+}
+
+int
+eloop_q_timeout_add_tv_named(struct eloop *eloop, int queue,
+    const struct timespec *when, void (*callback)(void *), void *arg,
+    const char *name)
+{
+
+	if (when->tv_sec < 0 || (unsigned long)when->tv_sec > UINT_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (when->tv_nsec < 0 || when->tv_nsec > NSEC_PER_SEC) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return eloop_q_timeout_add(eloop, queue,
+	    (unsigned int)when->tv_sec, (unsigned int)when->tv_nsec, 0,
+	    callback, arg, name);
+}
+
+int
+eloop_q_timeout_add_sec_named(struct eloop *eloop, int queue, unsigned int seconds,
+    void (*callback)(void *), void *arg,
+    const char *name)
+{
+
+	return eloop_q_timeout_add(eloop, queue, seconds, 0, 0, callback, arg, name);
+}
+
+int
+eloop_q_timeout_add_sec_slack_named(struct eloop *eloop, int queue,
+    unsigned int seconds, unsigned int slack,
+    void (*callback)(void *), void *arg,
+    const char *name)
+{
+
+	return eloop_q_timeout_add(eloop, queue, seconds, 0, slack,
+	    callback, arg, name);
+}
+
+int
+eloop_q_timeout_add_msec_named(struct eloop *eloop, int queue, unsigned long when,
+    void (*callback)(void *), void *arg,
+    const char *name)
+{
+	unsigned long seconds, nseconds;
+
+	seconds = when / MSEC_PER_SEC;
+	if (seconds > UINT_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	nseconds = (when % MSEC_PER_SEC) * NSEC_PER_MSEC;
+	return eloop_q_timeout_add(eloop, queue,
+		(unsigned int)seconds, (unsigned int)nseconds, 0,
+		callback, arg, name);
+}
+
+int
+eloop_q_timeout_delete(struct eloop *eloop, int queue,
+    void (*callback)(void *), void *arg)
 {
-	struct eloop_timeout *t, *tt;
+	struct eloop_timeout *t, *tn;
 	int n;
 
 	assert(eloop != NULL);
 
+	if (eloop->timeout_hash_len == 0)
+		return 0;
+
 	n = 0;
-	TAILQ_FOREACH_SAFE(t, &eloop->timeouts, next, tt) {
+	for (t = *eloop_timeout_hash_head(eloop, arg); t != NULL; t = tn) {
+		tn = t->hnext;
 		if ((queue == 0 || t->queue == queue) &&
 		    t->arg == arg &&
 		    (!callback || t->callback == callback))
 		{
-			TAILQ_REMOVE(&eloop->timeouts, t, next);
-			TAILQ_INSERT_TAIL(&eloop->free_timeouts, t, next);
+			eloop_timeout_free(eloop, t);
 			n++;
 		}
 	}
@@ -563,6 +1694,18 @@ eloop_enter(struct eloop *eloop)
 	eloop->exitnow = 0;
 }
 
+/* Called each time eloop_start is about to wait for events. */
+void
+eloop_idle_set_cb(struct eloop *eloop, void (*idle_cb)(void *),
+    void *idle_cb_ctx)
+{
+
+	assert(eloop != NULL);
+
+	eloop->idle_cb = idle_cb;
+	eloop->idle_cb_ctx = idle_cb_ctx;
+}
+
 void
 eloop_signal_set_cb(struct eloop *eloop,
     const int *signals, size_t signals_len,
@@ -575,6 +1718,12 @@ eloop_signal_set_cb(struct eloop *eloop,
 	eloop->signals_len = signals_len;
 	eloop->signal_cb = signal_cb;
 	eloop->signal_cb_ctx = signal_cb_ctx;
+#if defined(HAVE_KQUEUE)
+	eloop_signal_kqueue(eloop);
+#elif defined(HAVE_EPOLL)
+	if (eloop_signal_epoll(eloop) == -1)
+		eloop_signal_epoll_close(eloop);
+#endif
 }
 
 static volatile int _eloop_sig[ELOOP_NSIGNALS];
@@ -613,12 +1762,17 @@ eloop_signal_mask(struct eloop *eloop, sigset_t *oldset)
 	if (sigprocmask(SIG_SETMASK, &newset, oldset) == -1)
 		return -1;
 
+#ifdef HAVE_KQUEUE
+	/* kqueue records the blocked signals for us. */
+	UNUSED(sa);
+#else
 	sigemptyset(&sa.sa_mask);
 
 	for (i = 0; i < eloop->signals_len; i++) {
 		if (sigaction(eloop->signals[i], &sa, NULL) == -1)
 			return -1;
 	}
+#endif
 	return 0;
 }
 
@@ -638,14 +1792,67 @@ eloop_new(void)
 	}
 
 	TAILQ_INIT(&eloop->events);
+	TAILQ_INIT(&eloop->deleted_events);
 	TAILQ_INIT(&eloop->free_events);
-	TAILQ_INIT(&eloop->timeouts);
 	TAILQ_INIT(&eloop->free_timeouts);
 	eloop->exitcode = EXIT_FAILURE;
+#ifdef HAVE_EPOLL
+	eloop->signal_fd = -1;
+#endif
+
+#ifdef ELOOP_KERNEL
+	if (eloop_open(eloop) == -1) {
+		free(eloop);
+		return NULL;
+	}
+#endif
 
 	return eloop;
 }
 
+/*
+ * kqueue(2) descriptors are not inherited by a child process and
+ * epoll(7) and io_uring(7) descriptors are shared with the parent,
+ * so a child must
+ * call this to get its own and re-register any events it kept.
+ */
+int
+eloop_forked(struct eloop *eloop)
+{
+#ifdef ELOOP_KERNEL
+	struct eloop_event *e;
+
+	assert(eloop != NULL);
+
+	eloop_close(eloop);
+	if (eloop_open(eloop) == -1)
+		return -1;
+
+	TAILQ_FOREACH(e, &eloop->events, next) {
+#ifdef HAVE_IO_URING
+		/* Polls armed in the old ring are gone. */
+		e->ring_data = 0;
+#endif
+		if (eloop_event_kernel(eloop, e, 0, 0) == -1)
+			return -1;
+	}
+#if defined(HAVE_KQUEUE)
+	if (eloop_signal_kqueue(eloop) == -1)
+		return -1;
+#elif defined(HAVE_EPOLL)
+	/* Our signalfd should not be read by the parent as well. */
+	eloop_signal_epoll_close(eloop);
+	if (eloop_signal_epoll(eloop) == -1)
+		eloop_signal_epoll_close(eloop);
+#endif
+	/* Any kernel reply we are dispatching is no longer valid. */
+	eloop->cleared = 1;
+#else
+	UNUSED(eloop);
+#endif
+	return 0;
+}
+
 void
 eloop_clear(struct eloop *eloop)
 {
@@ -658,47 +1865,319 @@ eloop_clear(struct eloop *eloop)
 	eloop->nevents = 0;
 	eloop->signals = NULL;
 	eloop->signals_len = 0;
+#ifdef HAVE_EPOLL
+	eloop_signal_epoll_close(eloop);
+#endif
 
 	while ((e = TAILQ_FIRST(&eloop->events))) {
 		TAILQ_REMOVE(&eloop->events, e, next);
 		free(e);
 	}
+	while ((e = TAILQ_FIRST(&eloop->deleted_events))) {
+		TAILQ_REMOVE(&eloop->deleted_events, e, next);
+		free(e);
+	}
 	while ((e = TAILQ_FIRST(&eloop->free_events))) {
 		TAILQ_REMOVE(&eloop->free_events, e, next);
 		free(e);
 	}
-	while ((t = TAILQ_FIRST(&eloop->timeouts))) {
-		TAILQ_REMOVE(&eloop->timeouts, t, next);
-		free(t);
-	}
-	while ((t = TAILQ_FIRST(&eloop->free_timeouts))) {
-		TAILQ_REMOVE(&eloop->free_timeouts, t, next);
-		free(t);
+	/* Timeouts keep their slots, only with a new generation, so a
+	 * handle from before, say one a forked child inherited, never
+	 * matches a timer added after. eloop_free() releases them. */
+	while (eloop->ntimeouts != 0) {
+		t = eloop->timeouts[--eloop->ntimeouts];
+		if (++t->gen == 0)
+			t->gen = 1;
+		TAILQ_INSERT_TAIL(&eloop->free_timeouts, t, next);
 	}
-
+	free(eloop->timeouts);
+	eloop->timeouts = NULL;
+	eloop->timeouts_len = 0;
+	free(eloop->timeout_hash);
+	eloop->timeout_hash = NULL;
+	eloop->timeout_hash_len = 0;
+
+	free(eloop->event_fds);
+	eloop->event_fds = NULL;
+	eloop->event_fds_len = 0;
+#ifndef HAVE_IO_URING
 	free(eloop->fds);
 	eloop->fds = NULL;
 	eloop->nfds = 0;
+#endif
+#ifndef ELOOP_KERNEL
+	free(eloop->pollfd_events);
+	eloop->pollfd_events = NULL;
+	eloop->npollfds = 0;
+#endif
+	eloop->events_need_setup = 0;
+
+	/* We could be called from a callback in a forked child,
+	 * so tell any dispatch in progress to stop. */
+	eloop->cleared = 1;
 }
 
 void
 eloop_free(struct eloop *eloop)
 {
 
+	struct eloop_timeout *t;
+
 	eloop_clear(eloop);
+	if (eloop != NULL) {
+		while ((t = TAILQ_FIRST(&eloop->free_timeouts))) {
+			TAILQ_REMOVE(&eloop->free_timeouts, t, next);
+			free(t);
+		}
+		free(eloop->timeout_slots);
+	}
+#ifdef ELOOP_KERNEL
+	if (eloop != NULL)
+		eloop_close(eloop);
+#endif
+#ifdef ELOOP_STATS
+	if (eloop != NULL)
+		free(eloop->stats);
+#endif
 	free(eloop);
 }
 
-int
-eloop_start(struct eloop *eloop, sigset_t *signals)
+/*
+ * Callbacks are only timed from the first call on, which returns
+ * nothing counted yet.
+ * Stats are not reset by eloop_clear so a forked child
+ * carries on from its parent.
+ */
+size_t
+eloop_stats(struct eloop *eloop, const struct eloop_stat **stats)
+{
+
+	assert(eloop != NULL);
+#ifdef ELOOP_STATS
+	eloop->stats_timing = 1;
+	*stats = eloop->stats;
+	return eloop->nstats;
+#else
+	*stats = NULL;
+	return 0;
+#endif
+}
+
+/*
+ * All the backends service every event reported ready in one pass.
+ * A callback may delete any event, including its own, which clears
+ * the callbacks and marks the fd as -1 so it's skipped here.
+ */
+#if defined(HAVE_KQUEUE)
+static int
+eloop_run_kqueue(struct eloop *eloop, const struct timespec *ts)
+{
+	int n;
+	struct kevent *ke, kes;
+	struct eloop_event *e;
+
+	/* If we have no events we still need to wait for signals. */
+	if (eloop->nfds == 0)
+		n = kevent(eloop->poll_fd, NULL, 0, &kes, 1, ts);
+	else
+		n = kevent(eloop->poll_fd, NULL, 0,
+		    eloop->fds, LENC(eloop->nfds), ts);
+	if (n == -1)
+		return -1;
+
+	for (ke = eloop->nfds == 0 ? &kes : eloop->fds; n != 0; n--, ke++) {
+		if (eloop->exitnow || eloop->cleared)
+			break;
+		if (ke->filter == EVFILT_SIGNAL) {
+			if (eloop->signal_cb != NULL)
+				eloop->signal_cb((int)ke->ident,
+				    eloop->signal_cb_ctx);
+			continue;
+		}
+		e = (struct eloop_event *)ke->udata;
+		if (e->fd == -1)
+			continue;
+		if (ke->filter == EVFILT_WRITE) {
+			if (e->write_cb != NULL)
+				ELOOP_CALL(eloop, e->write_stat,
+				    e->write_cb, e->write_cb_arg);
+		} else if (e->read_cb != NULL)
+			ELOOP_CALL(eloop, e->read_stat,
+			    e->read_cb, e->read_cb_arg);
+	}
+	return 0;
+}
+#elif defined(HAVE_IO_URING)
+static int
+eloop_run_io_uring(struct eloop *eloop,
+    const struct timespec *ts, const sigset_t *signals)
+{
+	struct __kernel_timespec kts;
+	struct io_uring_getevents_arg arg = {
+		.sigmask = (uintptr_t)signals,
+		.sigmask_sz = _NSIG / NBBY,
+	};
+	struct io_uring_cqe cqe;
+	struct eloop_event *e;
+	unsigned int head;
+
+	if (ts != NULL) {
+		kts.tv_sec = ts->tv_sec;
+		kts.tv_nsec = ts->tv_nsec;
+		arg.ts = (uintptr_t)&kts;
+	}
+
+	/* Submit any polls armed or removed since the last wait
+	 * and wait for completions in one go. */
+	if (eloop_ring_enter(eloop, 1,
+	    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+	    &arg, sizeof(arg)) == -1 && errno != ETIME)
+		return -1;
+
+	head = *eloop->cq_head;
+	while (head != __atomic_load_n(eloop->cq_tail, __ATOMIC_ACQUIRE)) {
+		if (eloop->exitnow || eloop->cleared)
+			break;
+		cqe = eloop->cqes[head & *eloop->cq_mask];
+		__atomic_store_n(eloop->cq_head, ++head, __ATOMIC_RELEASE);
+
+		e = eloop_event_find(eloop, (int)(cqe.user_data & UINT32_MAX));
+		if (e == NULL || e->ring_data != cqe.user_data)
+			continue;
+		/* The poll has completed, so leave it disarmed on error. */
+		e->ring_data = 0;
+		if (cqe.res < 0)
+			continue;
+		if (cqe.res & POLLOUT && e->write_cb != NULL) {
+			ELOOP_CALL(eloop, e->write_stat,
+			    e->write_cb, e->write_cb_arg);
+			if (eloop->cleared || e->fd == -1)
+				continue;
+		}
+		if (cqe.res & ~POLLOUT && e->read_cb != NULL) {
+			ELOOP_CALL(eloop, e->read_stat,
+			    e->read_cb, e->read_cb_arg);
+			if (eloop->cleared || e->fd == -1)
+				continue;
+		}
+		/* Unless a callback changed the event, arm it again. */
+		if (e->ring_data == 0 &&
+		    eloop_event_kernel(eloop, e, 0, 0) == -1)
+			return -1;
+	}
+	return 0;
+}
+#elif defined(HAVE_EPOLL)
+static int
+eloop_run_epoll(struct eloop *eloop,
+    const struct timespec *ts, const sigset_t *signals)
+{
+	int timeout, n;
+	struct epoll_event *epe, epes;
+	struct eloop_event *e;
+
+	if (ts == NULL)
+		timeout = -1;
+	else if (ts->tv_sec > INT_MAX / MSEC_PER_SEC - 1)
+		timeout = INT_MAX;
+	else
+		/* Round up so we don't wake before the timeout is due. */
+		timeout = (int)(ts->tv_sec * MSEC_PER_SEC +
+		    (ts->tv_nsec + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC);
+
+	/* Signals stay blocked when we have a signalfd. */
+	if (eloop->signal_fd != -1)
+		signals = NULL;
+
+	/* epoll_pwait(2) needs room for at least one event. */
+	if (eloop->nfds == 0)
+		n = epoll_pwait(eloop->poll_fd, &epes, 1, timeout, signals);
+	else
+		n = epoll_pwait(eloop->poll_fd, eloop->fds,
+		    (int)eloop->nfds, timeout, signals);
+	if (n == -1)
+		return -1;
+
+	for (epe = eloop->nfds == 0 ? &epes : eloop->fds; n != 0; n--, epe++) {
+		if (eloop->exitnow || eloop->cleared)
+			break;
+		e = (struct eloop_event *)epe->data.ptr;
+		if (e == NULL) {
+			eloop_signal_epoll_read(eloop);
+			continue;
+		}
+		if (epe->events & EPOLLOUT && e->write_cb != NULL) {
+			ELOOP_CALL(eloop, e->write_stat,
+			    e->write_cb, e->write_cb_arg);
+			if (eloop->cleared || e->fd == -1)
+				continue;
+		}
+		if (epe->events & (EPOLLIN | EPOLLERR | EPOLLHUP) &&
+		    e->read_cb != NULL)
+			ELOOP_CALL(eloop, e->read_stat,
+			    e->read_cb, e->read_cb_arg);
+	}
+	return 0;
+}
+#else
+static int
+eloop_run_ppoll(struct eloop *eloop,
+    const struct timespec *ts, const sigset_t *signals)
 {
 	int n;
+	size_t i, npollfds;
 	struct eloop_event *e;
+	struct pollfd *pfd;
+
+	npollfds = eloop->npollfds;
+	n = ppoll(eloop->fds, (nfds_t)npollfds, ts, signals);
+	if (n == -1 || n == 0)
+		return n;
+
+	/* Events added by a callback are appended and
+	 * won't be ready until the next poll.
+	 * The arrays could be reallocated by a callback, so index them. */
+	for (i = 0; i < npollfds && n != 0; i++) {
+		if (eloop->exitnow || eloop->cleared)
+			break;
+		pfd = &eloop->fds[i];
+		if (pfd->revents == 0)
+			continue;
+		n--;
+		e = eloop->pollfd_events[i];
+		if (e->fd == -1)
+			continue;
+		if (pfd->revents & POLLOUT && e->write_cb != NULL) {
+			ELOOP_CALL(eloop, e->write_stat,
+			    e->write_cb, e->write_cb_arg);
+			if (eloop->cleared || e->fd == -1)
+				continue;
+			pfd = &eloop->fds[i];
+		}
+		if (pfd->revents & ~POLLOUT && e->read_cb != NULL)
+			ELOOP_CALL(eloop, e->read_stat,
+			    e->read_cb, e->read_cb_arg);
+	}
+	return 0;
+}
+#endif
+
+int
+eloop_start(struct eloop *eloop, sigset_t *signals)
+{
+	int n, error;
 	struct eloop_timeout *t;
+	const struct timespec *now;
 	struct timespec ts, *tsp;
+	unsigned long long nowsecs, secs;
 
 	assert(eloop != NULL);
+#ifdef HAVE_KQUEUE
+	UNUSED(signals);
+#endif
 
+	eloop->running = 1;
+	eloop->now_cached = 0;
 	for (;;) {
 		if (eloop->exitnow)
 			break;
@@ -710,56 +2189,75 @@ eloop_start(struct eloop *eloop, sigset_t *signals)
 			continue;
 		}
 
-		t = TAILQ_FIRST(&eloop->timeouts);
+		t = eloop->ntimeouts != 0 ? eloop->timeouts[0] : NULL;
 		if (t == NULL && eloop->nevents == 0)
 			break;
 
-		if (t != NULL)
-			eloop_reduce_timers(eloop);
-
-		if (t != NULL && t->seconds == 0 && t->nseconds == 0) {
-			TAILQ_REMOVE(&eloop->timeouts, t, next);
-			t->callback(t->arg);
-			TAILQ_INSERT_TAIL(&eloop->free_timeouts, t, next);
-			continue;
-		}
-
 		if (t != NULL) {
-			if (t->seconds > INT_MAX) {
+			now = eloop_now(eloop);
+			nowsecs = (unsigned long long)now->tv_sec;
+			if (t->seconds < nowsecs ||
+			    (t->seconds == nowsecs &&
+			    t->nseconds <= (unsigned int)now->tv_nsec))
+			{
+				eloop_timeout_unlink(eloop, t);
+				ELOOP_CALL(eloop, t->stat,
+				    t->callback, t->arg);
+				TAILQ_INSERT_TAIL(&eloop->free_timeouts,
+				    t, next);
+				continue;
+			}
+
+			secs = t->seconds - nowsecs;
+			if (t->nseconds < (unsigned int)now->tv_nsec) {
+				secs--;
+				ts.tv_nsec = (long)(t->nseconds + NSEC_PER_SEC)
+				    - now->tv_nsec;
+			} else
+				ts.tv_nsec = (long)t->nseconds - now->tv_nsec;
+			if (secs > INT_MAX) {
 				ts.tv_sec = (time_t)INT_MAX;
 				ts.tv_nsec = 0;
-			} else {
-				ts.tv_sec = (time_t)t->seconds;
-				ts.tv_nsec = (long)t->nseconds;
-			}
+			} else
+				ts.tv_sec = (time_t)secs;
 			tsp = &ts;
 		} else
 			tsp = NULL;
 
-		n = ppoll(eloop->fds, (nfds_t)eloop->nevents, tsp, signals);
+		/* Nothing more to do until we wait. */
+		if (eloop->idle_cb != NULL)
+			eloop->idle_cb(eloop->idle_cb_ctx);
+
+		if (eloop->events_need_setup &&
+		    eloop_event_setup_fds(eloop) == -1)
+		{
+			error = -errno;
+			goto out;
+		}
+		eloop->cleared = 0;
+		/* Read the clock again once woken. */
+		eloop->now_cached = 0;
+
+#if defined(HAVE_KQUEUE)
+		n = eloop_run_kqueue(eloop, tsp);
+#elif defined(HAVE_IO_URING)
+		n = eloop_run_io_uring(eloop, tsp, signals);
+#elif defined(HAVE_EPOLL)
+		n = eloop_run_epoll(eloop, tsp, signals);
+#else
+		n = eloop_run_ppoll(eloop, tsp, signals);
+#endif
 		if (n == -1) {
 			if (errno == EINTR)
 				continue;
-			return -errno;
-		}
-		if (n == 0)
-			continue;
-
-		TAILQ_FOREACH(e, &eloop->events, next) {
-			if (e->pollfd->revents & POLLOUT) {
-				if (e->write_cb != NULL) {
-					e->write_cb(e->write_cb_arg);
-					break;
-				}
-			}
-			if (e->pollfd->revents) {
-				if (e->read_cb != NULL) {
-					e->read_cb(e->read_cb_arg);
-					break;
-				}
-			}
+			error = -errno;
+			goto out;
 		}
 	}
+	error = eloop->exitcode;
 
-	return eloop->exitcode;
+out:
+	eloop->running = 0;
+	eloop->now_cached = 0;
+	return error;
 }
@@ -37,6 +37,9 @@
 #define	NSEC_PER_CSEC		10000000
 #define	NSEC_PER_MSEC		1000000
 #define	NSEC_PER_SEC		1000000000
+#define	NSEC_PER_USEC		1000
+#define	USEC_PER_MSEC		1000
+#define	USEC_PER_SEC		1000000
 
 /* eloop queues are really only for deleting timeouts registered
  * for a function or object.
@@ -52,16 +55,38 @@
 /* Forward declare eloop - the content should be invisible to the outside */
 struct eloop;
 
+/*
+ * With ELOOP_STATS the time spent in each callback is recorded
+ * once eloop_stats() has first been called.
+ * The add macros pass the name of the callback along to label it.
+ */
+#ifdef ELOOP_STATS
+#define	ELOOP_NAME(cb)	#cb
+#else
+#define	ELOOP_NAME(cb)	NULL
+#endif
+
+struct eloop_stat {
+	void (*callback)(void *);
+	const char *name;
+	unsigned long long count;
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+};
+
 unsigned long long eloop_timespec_diff(const struct timespec *tsp,
     const struct timespec *usp, unsigned int *nsp);
 size_t eloop_event_count(const struct eloop  *);
-int eloop_event_add_rw(struct eloop *, int,
-    void (*)(void *), void *,
-    void (*)(void *), void *);
-int eloop_event_add(struct eloop *, int,
-    void (*)(void *), void *);
-int eloop_event_add_w(struct eloop *, int,
-    void (*)(void *), void *);
+#define eloop_event_add_rw(eloop, fd, rcb, rarg, wcb, warg) \
+    eloop_event_add_named((eloop), (fd), (rcb), (rarg), ELOOP_NAME(rcb), \
+    (wcb), (warg), ELOOP_NAME(wcb))
+#define eloop_event_add(eloop, fd, cb, arg) \
+    eloop_event_add_rw(eloop, fd, cb, arg, NULL, NULL)
+#define eloop_event_add_w(eloop, fd, cb, arg) \
+    eloop_event_add_rw(eloop, fd, NULL, NULL, cb, arg)
+int eloop_event_add_named(struct eloop *, int,
+    void (*)(void *), void *, const char *,
+    void (*)(void *), void *, const char *);
 #define eloop_event_delete(eloop, fd) \
     eloop_event_delete_write((eloop), (fd), 0)
 #define eloop_event_remove_writecb(eloop, fd) \
@@ -69,30 +94,96 @@ int eloop_event_add_w(struct eloop *, int,
 int eloop_event_delete_write(struct eloop *, int, int);
 
 #define eloop_timeout_add_tv(eloop, tv, cb, ctx) \
-    eloop_q_timeout_add_tv((eloop), ELOOP_QUEUE, (tv), (cb), (ctx))
+    eloop_q_timeout_add_tv((eloop), ELOOP_QUEUE, (tv), cb, (ctx))
 #define eloop_timeout_add_sec(eloop, tv, cb, ctx) \
-    eloop_q_timeout_add_sec((eloop), ELOOP_QUEUE, (tv), (cb), (ctx))
+    eloop_q_timeout_add_sec((eloop), ELOOP_QUEUE, (tv), cb, (ctx))
 #define eloop_timeout_add_msec(eloop, ms, cb, ctx) \
-    eloop_q_timeout_add_msec((eloop), ELOOP_QUEUE, (ms), (cb), (ctx))
+    eloop_q_timeout_add_msec((eloop), ELOOP_QUEUE, (ms), cb, (ctx))
 #define eloop_timeout_delete(eloop, cb, ctx) \
     eloop_q_timeout_delete((eloop), ELOOP_QUEUE, (cb), (ctx))
-int eloop_q_timeout_add_tv(struct eloop *, int,
-    const struct timespec *, void (*)(void *), void *);
-int eloop_q_timeout_add_sec(struct eloop *, int,
-    unsigned int, void (*)(void *), void *);
-int eloop_q_timeout_add_msec(struct eloop *, int,
-    unsigned long, void (*)(void *), void *);
+#define eloop_q_timeout_add_tv(eloop, q, tv, cb, ctx) \
+    eloop_q_timeout_add_tv_named((eloop), (q), (tv), (cb), (ctx), \
+    ELOOP_NAME(cb))
+#define eloop_q_timeout_add_sec(eloop, q, tv, cb, ctx) \
+    eloop_q_timeout_add_sec_named((eloop), (q), (tv), (cb), (ctx), \
+    ELOOP_NAME(cb))
+#define eloop_q_timeout_add_msec(eloop, q, ms, cb, ctx) \
+    eloop_q_timeout_add_msec_named((eloop), (q), (ms), (cb), (ctx), \
+    ELOOP_NAME(cb))
+int eloop_q_timeout_add_tv_named(struct eloop *, int,
+    const struct timespec *, void (*)(void *), void *, const char *);
+int eloop_q_timeout_add_sec_named(struct eloop *, int,
+    unsigned int, void (*)(void *), void *, const char *);
+int eloop_q_timeout_add_msec_named(struct eloop *, int,
+    unsigned long, void (*)(void *), void *, const char *);
 int eloop_q_timeout_delete(struct eloop *, int, void (*)(void *), void *);
 
+/*
+ * The slack variants allow the timeout to fire up to slack milliseconds
+ * late so that it can share a wakeup with other timeouts.
+ */
+#define eloop_timeout_add_sec_slack(eloop, tv, slack, cb, ctx) \
+    eloop_q_timeout_add_sec_slack((eloop), ELOOP_QUEUE, (tv), (slack), \
+    cb, (ctx))
+#define eloop_q_timeout_add_sec_slack(eloop, q, tv, slack, cb, ctx) \
+    eloop_q_timeout_add_sec_slack_named((eloop), (q), (tv), (slack), \
+    (cb), (ctx), ELOOP_NAME(cb))
+int eloop_q_timeout_add_sec_slack_named(struct eloop *, int,
+    unsigned int, unsigned int, void (*)(void *), void *, const char *);
+
+/*
+ * Timer handles refer to exactly one timeout so it can be rescheduled
+ * or cancelled in constant time without matching on callback and arg.
+ * A handle should be initialised to 0 and stays safe to use after the
+ * timeout has fired or been deleted, or the eloop has been cleared.
+ */
+#define eloop_timer_add_sec(eloop, h, tv, cb, ctx) \
+    eloop_q_timer_add_sec((eloop), ELOOP_QUEUE, (h), (tv), cb, (ctx))
+#define eloop_timer_add_msec(eloop, h, ms, cb, ctx) \
+    eloop_q_timer_add_msec((eloop), ELOOP_QUEUE, (h), (ms), cb, (ctx))
+#define eloop_timer_add_sec_slack(eloop, h, tv, slack, cb, ctx) \
+    eloop_q_timer_add_sec_slack((eloop), ELOOP_QUEUE, (h), (tv), (slack), \
+    cb, (ctx))
+#define eloop_timer_add_msec_slack(eloop, h, ms, slack, cb, ctx) \
+    eloop_q_timer_add_msec_slack((eloop), ELOOP_QUEUE, (h), (ms), (slack), \
+    cb, (ctx))
+#define eloop_q_timer_add_sec(eloop, q, h, tv, cb, ctx) \
+    eloop_q_timer_add_sec_named((eloop), (q), (h), (tv), (cb), (ctx), \
+    ELOOP_NAME(cb))
+#define eloop_q_timer_add_msec(eloop, q, h, ms, cb, ctx) \
+    eloop_q_timer_add_msec_named((eloop), (q), (h), (ms), (cb), (ctx), \
+    ELOOP_NAME(cb))
+#define eloop_q_timer_add_sec_slack(eloop, q, h, tv, slack, cb, ctx) \
+    eloop_q_timer_add_sec_slack_named((eloop), (q), (h), (tv), (slack), \
+    (cb), (ctx), ELOOP_NAME(cb))
+#define eloop_q_timer_add_msec_slack(eloop, q, h, ms, slack, cb, ctx) \
+    eloop_q_timer_add_msec_slack_named((eloop), (q), (h), (ms), (slack), \
+    (cb), (ctx), ELOOP_NAME(cb))
+int eloop_q_timer_add_sec_named(struct eloop *, int, unsigned long long *,
+    unsigned int, void (*)(void *), void *, const char *);
+int eloop_q_timer_add_msec_named(struct eloop *, int, unsigned long long *,
+    unsigned long, void (*)(void *), void *, const char *);
+int eloop_q_timer_add_sec_slack_named(struct eloop *, int,
+    unsigned long long *, unsigned int, unsigned int,
+    void (*)(void *), void *, const char *);
+int eloop_q_timer_add_msec_slack_named(struct eloop *, int,
+    unsigned long long *, unsigned long, unsigned int,
+    void (*)(void *), void *, const char *);
+int eloop_timer_cancel(struct eloop *, unsigned long long *);
+int eloop_timer_pending(const struct eloop *, unsigned long long);
+
 void eloop_signal_set_cb(struct eloop *, const int *, size_t,
     void (*)(int, void *), void *);
+void eloop_idle_set_cb(struct eloop *, void (*)(void *), void *);
 int eloop_signal_mask(struct eloop *, sigset_t *oldset);
 
 struct eloop * eloop_new(void);
+int eloop_forked(struct eloop *);
 void eloop_clear(struct eloop *);
 void eloop_free(struct eloop *);
 void eloop_exit(struct eloop *, int);
 void eloop_enter(struct eloop *);
 int eloop_start(struct eloop *, sigset_t *);
+size_t eloop_stats(struct eloop *, const struct eloop_stat **);
 
 #endif
@@ -343,7 +343,8 @@ if_ignoregroup(int s, const char *ifname)
 #endif
 
 bool
-if_ignore(struct dhcpcd_ctx *ctx, const char *ifname)
+if_ignore(struct dhcpcd_ctx *ctx, const char *ifname,
+    __unused const void *ifadata)
 {
 	struct if_spec spec;
 
@@ -511,7 +512,7 @@ if_vimaster(struct dhcpcd_ctx *ctx, const char *ifname)
 }
 
 unsigned short
-if_vlanid(const struct interface *ifp)
+if_vlanid(const struct interface *ifp, __unused const void *ifadata)
 {
 #ifdef SIOCGETVLAN
 	struct vlanreq vlr = { .vlr_tag = 0 };
@@ -658,13 +659,12 @@ if_copysa(struct sockaddr *dst, const struct sockaddr *src)
 #endif
 }
 
-int
-if_route(unsigned char cmd, const struct rt *rt)
+static void
+if_routertm(unsigned char cmd, const struct rt *rt, struct rtm *rtmp)
 {
 	struct dhcpcd_ctx *ctx;
-	struct rtm rtmsg;
-	struct rt_msghdr *rtm = &rtmsg.hdr;
-	char *bp = rtmsg.buffer;
+	struct rt_msghdr *rtm = &rtmp->hdr;
+	char *bp = rtmp->buffer;
 	struct sockaddr_dl sdl;
 	bool gateway_unspec;
 
@@ -678,7 +678,7 @@ if_route(unsigned char cmd, const struct rt *rt)
 		bp += RT_ROUNDUP((sa)->sa_len);				      \
 	}  while (0 /* CONSTCOND */)
 
-	memset(&rtmsg, 0, sizeof(rtmsg));
+	memset(rtmp, 0, sizeof(*rtmp));
 	rtm->rtm_version = RTM_VERSION;
 	rtm->rtm_type = cmd;
 #ifdef __OpenBSD__
@@ -795,7 +795,16 @@ if_route(unsigned char cmd, const struct rt *rt)
 #undef ADDSA
 
 	rtm->rtm_msglen = (unsigned short)(bp - (char *)rtm);
+}
+
+int
+if_route(unsigned char cmd, const struct rt *rt)
+{
+	struct dhcpcd_ctx *ctx = rt->rt_ifp->ctx;
+	struct rtm rtmsg;
+	struct rt_msghdr *rtm = &rtmsg.hdr;
 
+	if_routertm(cmd, rt, &rtmsg);
 #ifdef PRIVSEP
 	if (ctx->options & DHCPCD_PRIVSEP) {
 		if (ps_root_route(ctx, rtm, rtm->rtm_msglen) == -1)
@@ -808,6 +817,52 @@ if_route(unsigned char cmd, const struct rt *rt)
 	return 0;
 }
 
+int
+if_routes(struct dhcpcd_ctx *ctx, struct if_rtreq *reqs, size_t nreqs)
+{
+	struct rtm rtmsg;
+	size_t i;
+	int failed = 0;
+#ifdef PRIVSEP
+	uint8_t buf[RTM_BATCH_MAX * sizeof(struct rtm)];
+	int errs[RTM_BATCH_MAX];
+	size_t n, len;
+	ssize_t r;
+
+	/* The routing socket takes one message per write, so the
+	 * saving is in crossing to the privileged process once. */
+	if (ctx->options & DHCPCD_PRIVSEP) {
+		for (; nreqs != 0; reqs += n, nreqs -= n) {
+			n = MIN(nreqs, RTM_BATCH_MAX);
+			len = 0;
+			for (i = 0; i < n; i++) {
+				if_routertm(reqs[i].cmd, reqs[i].rt, &rtmsg);
+				memcpy(buf + len, &rtmsg,
+				    rtmsg.hdr.rtm_msglen);
+				len += rtmsg.hdr.rtm_msglen;
+			}
+			r = ps_root_routes(ctx, buf, len, errs, n);
+			for (i = 0; i < n; i++) {
+				reqs[i].error = r == -1 ? errno : errs[i];
+				if (reqs[i].error != 0)
+					failed++;
+			}
+		}
+		return failed == 0 ? 0 : -1;
+	}
+#endif
+
+	for (i = 0; i < nreqs; i++) {
+		if_routertm(reqs[i].cmd, reqs[i].rt, &rtmsg);
+		if (write(ctx->link_fd, &rtmsg, rtmsg.hdr.rtm_msglen) == -1) {
+			reqs[i].error = errno;
+			failed++;
+		} else
+			reqs[i].error = 0;
+	}
+	return failed == 0 ? 0 : -1;
+}
+
 static bool
 if_realroute(const struct rt_msghdr *rtm)
 {
@@ -893,6 +948,7 @@ if_copyrt(struct dhcpcd_ctx *ctx, struct rt *rt, const struct rt_msghdr *rtm)
 		errno = ESRCH;
 		return -1;
 	}
+	rt_setkey(rt);
 	return 0;
 }
 
@@ -1379,7 +1435,9 @@ if_ifa(struct dhcpcd_ctx *ctx, const struct ifa_msghdr *ifam)
 		sa = rti_info[RTAX_IFA];
 #ifdef PRIVSEP_GETIFADDRS
 		if (IN_PRIVSEP(ctx)) {
-			if (ps_root_getifaddrs(ctx, &ifaddrs) == -1) {
+			if (ps_root_getifaddrs(ctx,
+			    ifp->name, &ifaddrs) == -1)
+			{
 				logerr("ps_root_getifaddrs");
 				break;
 			}
@@ -30,16 +30,18 @@
 
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/param.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 
 #include <linux/icmpv6.h>
 #include <linux/if_addr.h>
 #include <linux/if_link.h>
 #include <linux/if_packet.h>
 #include <linux/if_tun.h>
-#include <linux/if_vlan.h>
+#include <linux/bpf.h>
 #include <linux/filter.h>
 #include <linux/netlink.h>
 #include <linux/sockios.h>
@@ -60,6 +62,7 @@
 #include <linux/if_arp.h>
 #endif
 
+#include <assert.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -77,6 +80,7 @@
 #include "common.h"
 #include "dev.h"
 #include "dhcp.h"
+#include "eloop.h"
 #include "if.h"
 #include "ipv4.h"
 #include "ipv4ll.h"
@@ -141,10 +145,63 @@ int if_getssid_wext(const char *ifname, uint8_t *ssid);
 	(struct rtattr *)(void *)(((char *)(rta)) \
 	+ RTA_ALIGN((rta)->rta_len)))
 
+#ifdef HAVE_NL80211_H
+/* SSIDs from nl80211 association events, kept until disassociation
+ * or carrier loss so if_getssid() need not ask the kernel. */
+struct nl80211_ssid {
+	TAILQ_ENTRY(nl80211_ssid) next;
+	unsigned int ifindex;
+	unsigned int ssid_len;
+	uint8_t ssid[IF_SSIDLEN];
+};
+TAILQ_HEAD(nl80211_ssidhead, nl80211_ssid);
+#endif
+
+#ifdef INET
+/* The last event for an IPv4 address in the messages read at once. */
+struct link_addr4 {
+	unsigned int la_ifindex;
+	int la_cmd;
+	struct in_addr la_addr;
+	struct in_addr la_net;
+	struct in_addr la_brd;
+	int la_flags;
+	pid_t la_pid;
+};
+#define	LINK_ADDR4_MAX	64
+#endif
+
+/* Link socket datagrams read for each wakeup at most. */
+#define	LINK_READ_MAX	128
+
 struct priv {
 	int route_fd;
 	int generic_fd;
 	uint32_t route_pid;
+
+#ifdef HAVE_NL80211_H
+	int nl80211_family;		/* 0 until resolved */
+	int nl80211_fd;			/* mlme events, -1 if none */
+	struct nl80211_ssidhead nl80211_ssids;
+#endif
+
+#ifdef INET
+	/* IPv4 address events link_addr() has yet to act on */
+	struct link_addr4 addr4[LINK_ADDR4_MAX];
+	size_t addr4_n;
+#endif
+
+#ifdef INET6
+	/* RTM_NEWADDR requests queued by if_address6_batch() */
+	unsigned int addr6_batch;
+	void (*addr6_cb)(struct ipv6_addr *, unsigned int, int);
+	size_t addr6_n;
+	struct ipv6_addr *addr6_ia[NETLINK_BATCH_MAX];
+	unsigned int addr6_flags[NETLINK_BATCH_MAX];
+	size_t addr6_len;
+	/* 128 bytes covers an aligned struct nlma */
+	uint8_t addr6_buf[NETLINK_BATCH_MAX * 128];
+#endif
 };
 
 /* We need this to send a broadcast for InfiniBand.
@@ -159,11 +216,14 @@ static const uint8_t ipv4_bcast_addr[] = {
 };
 #endif
 
-static int if_addressexists(struct interface *, struct in_addr *);
+#ifdef HAVE_NL80211_H
+static void if_nl80211_open(struct dhcpcd_ctx *);
+static void if_nl80211_close(struct dhcpcd_ctx *);
+static void if_nl80211_dropssid(struct dhcpcd_ctx *, unsigned int);
+#endif
 
 #define PROC_INET6	"/proc/net/if_inet6"
 #define PROC_PROMOTE	"/proc/sys/net/ipv4/conf/%s/promote_secondaries"
-#define SYS_BRIDGE	"/sys/class/net/%s/bridge/bridge_id"
 #define SYS_LAYER2	"/sys/class/net/%s/device/layer2"
 #define SYS_TUNTAP	"/sys/class/net/%s/tun_flags"
 
@@ -315,17 +375,8 @@ if_conf(struct interface *ifp)
 	return 0;
 }
 
-static bool
-if_bridge(struct dhcpcd_ctx *ctx, const char *ifname)
-{
-	char path[sizeof(SYS_BRIDGE) + IF_NAMESIZE], buf[64];
-
-	snprintf(path, sizeof(path), SYS_BRIDGE, ifname);
-	if (dhcp_readfile(ctx, path, buf, sizeof(buf)) == -1)
-		return false;
-	return true;
-}
-
+/* Only needed for kernels which don't report the tun type
+ * in IFLA_LINKINFO. */
 static bool
 if_tap(struct dhcpcd_ctx *ctx, const char *ifname)
 {
@@ -339,12 +390,12 @@ if_tap(struct dhcpcd_ctx *ctx, const char *ifname)
 }
 
 bool
-if_ignore(struct dhcpcd_ctx *ctx, const char *ifname)
+if_ignore(__unused struct dhcpcd_ctx *ctx, __unused const char *ifname,
+    const void *ifadata)
 {
+	const struct if_ifadata *ifd = ifadata;
 
-	if (if_tap(ctx, ifname) || if_bridge(ctx, ifname))
-		return true;
-	return false;
+	return ifd != NULL && ifd->ifd_ignore;
 }
 
 /* XXX work out Virtal Interface Masters */
@@ -356,16 +407,11 @@ if_vimaster(__unused struct dhcpcd_ctx *ctx, __unused const char *ifname)
 }
 
 unsigned short
-if_vlanid(const struct interface *ifp)
+if_vlanid(__unused const struct interface *ifp, const void *ifadata)
 {
-	struct vlan_ioctl_args v;
+	const struct if_ifadata *ifd = ifadata;
 
-	memset(&v, 0, sizeof(v));
-	strlcpy(v.device1, ifp->name, sizeof(v.device1));
-	v.cmd = GET_VLAN_VID_CMD;
-	if (ioctl(ifp->ctx->pf_inet_fd, SIOCGIFVLAN, &v) != 0)
-		return 0; /* 0 means no VLANID */
-	return (unsigned short)v.u.VID;
+	return ifd != NULL ? ifd->ifd_vlanid : 0; /* 0 means no VLANID */
 }
 
 int
@@ -462,6 +508,11 @@ if_opensockets_os(struct dhcpcd_ctx *ctx)
 		return -1;
 
 	ctx->priv = priv;
+#ifdef HAVE_NL80211_H
+	TAILQ_INIT(&priv->nl80211_ssids);
+	priv->nl80211_fd = -1;
+#endif
+
 	memset(&snl, 0, sizeof(snl));
 	priv->route_fd = if_linksocket(&snl, NETLINK_ROUTE, 0);
 	if (priv->route_fd == -1)
@@ -476,6 +527,10 @@ if_opensockets_os(struct dhcpcd_ctx *ctx)
 	if (priv->generic_fd == -1)
 		return -1;
 
+#ifdef HAVE_NL80211_H
+	if_nl80211_open(ctx);
+#endif
+
 	return 0;
 }
 
@@ -488,6 +543,9 @@ if_closesockets_os(struct dhcpcd_ctx *ctx)
 		priv = (struct priv *)ctx->priv;
 		close(priv->route_fd);
 		close(priv->generic_fd);
+#ifdef HAVE_NL80211_H
+		if_nl80211_close(ctx);
+#endif
 	}
 }
 
@@ -591,6 +649,94 @@ recv_again:
 	return r;
 }
 
+/*
+ * Collect the acks for n requests sent together, the first of which
+ * had the sequence seq. The error for each request is stored in errs.
+ */
+int
+if_getnetlinkacks(int fd, uint32_t seq, int *errs, size_t n)
+{
+	unsigned char buf[16 * 1024];
+	struct sockaddr_nl nladdr;
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+	struct msghdr msg = {
+	    .msg_name = &nladdr,
+	    .msg_iov = &iov, .msg_iovlen = 1,
+	};
+	ssize_t len;
+	struct nlmsghdr *nlm;
+	struct nlmsgerr *err;
+	size_t i, got;
+
+	for (i = 0; i < n; i++)
+		errs[i] = -1;
+
+	for (got = 0; got < n;) {
+		msg.msg_namelen = sizeof(nladdr);
+		len = recvmsg(fd, &msg, 0);
+		if (len == -1)
+			return -1;
+		if (len == 0) {
+			errno = ECONNRESET;
+			return -1;
+		}
+		if (msg.msg_namelen != sizeof(nladdr)) {
+			errno = EINVAL;
+			return -1;
+		}
+		/* Ignore message if it is not from kernel */
+		if (nladdr.nl_pid != 0)
+			continue;
+
+		for (nlm = (struct nlmsghdr *)buf;
+		     NLMSG_OK(nlm, (size_t)len);
+		     nlm = NLMSG_NEXT(nlm, len))
+		{
+			if (nlm->nlmsg_type != NLMSG_ERROR)
+				continue;
+			if (nlm->nlmsg_len - sizeof(*nlm) < sizeof(*err)) {
+				errno = EBADMSG;
+				return -1;
+			}
+			i = nlm->nlmsg_seq - seq;
+			if (i >= n || errs[i] != -1)
+				continue;
+			err = (struct nlmsgerr *)NLMSG_DATA(nlm);
+			errs[i] = -err->error;
+			got++;
+		}
+	}
+	return 0;
+}
+
+/* dhcpcd and the kernel only use these protocols.
+ * Routes with any other come from a routing daemon. */
+static const uint8_t if_rtprotos[] = {
+	RTPROT_UNSPEC,
+	RTPROT_REDIRECT,
+	RTPROT_KERNEL,
+	RTPROT_BOOT,
+	RTPROT_STATIC,
+#ifdef RTPROT_RA
+	RTPROT_RA,
+#endif
+#ifdef RTPROT_DHCP
+	RTPROT_DHCP,
+#endif
+};
+
+static bool
+if_rtprotoours(uint8_t protocol)
+{
+	size_t i;
+
+	for (i = 0; i < __arraycount(if_rtprotos); i++) {
+		if (if_rtprotos[i] == protocol)
+			return true;
+	}
+	return false;
+}
+
 static int
 if_copyrt(struct dhcpcd_ctx *ctx, struct rt *rt, struct nlmsghdr *nlm)
 {
@@ -612,6 +758,8 @@ if_copyrt(struct dhcpcd_ctx *ctx, struct rt *rt, struct nlmsghdr *nlm)
 	memset(rt, 0, sizeof(*rt));
 	if (rtm->rtm_type == RTN_UNREACHABLE)
 		rt->rt_flags |= RTF_REJECT;
+	if (!if_rtprotoours(rtm->rtm_protocol))
+		rt->rt_dflags |= RTDF_DAEMON;
 
 	rta = RTM_RTA(rtm);
 	len = RTM_PAYLOAD(nlm);
@@ -689,6 +837,7 @@ if_copyrt(struct dhcpcd_ctx *ctx, struct rt *rt, struct nlmsghdr *nlm)
 		errno = ESRCH;
 		return -1;
 	}
+	rt_setkey(rt);
 	return 0;
 }
 
@@ -734,6 +883,66 @@ link_route(struct dhcpcd_ctx *ctx, __unused struct interface *ifp,
 	return 0;
 }
 
+#ifdef INET
+/*
+ * A deleted IPv4 address can be added straight back, as when a
+ * secondary address is promoted, and acting on the deletion would drop
+ * our lease.  So only the last event for each address in the messages
+ * read together is acted on, which is how the kernel has it now.
+ * Should we miss any the socket overflows and dhcpcd_linkoverflow()
+ * learns the addresses again.
+ */
+static void
+link_addr4_flush(struct dhcpcd_ctx *ctx)
+{
+	struct priv *priv = ctx->priv;
+	struct link_addr4 *la;
+	struct interface *ifp;
+	size_t i;
+
+	for (i = 0; i < priv->addr4_n; i++) {
+		la = &priv->addr4[i];
+		/* The interface could have gone since. */
+		ifp = if_findindex(ctx->ifaces, la->la_ifindex);
+		if (ifp == NULL)
+			continue;
+		ipv4_handleifa(ctx, la->la_cmd, NULL, ifp->name,
+		    &la->la_addr, &la->la_net, &la->la_brd,
+		    la->la_flags, la->la_pid);
+	}
+	priv->addr4_n = 0;
+}
+
+static void
+link_addr4_queue(struct dhcpcd_ctx *ctx, struct interface *ifp, int cmd,
+    const struct in_addr *addr, const struct in_addr *net,
+    const struct in_addr *brd, int flags, pid_t pid)
+{
+	struct priv *priv = ctx->priv;
+	struct link_addr4 *la;
+	size_t i;
+
+	for (i = 0; i < priv->addr4_n; i++) {
+		la = &priv->addr4[i];
+		if (la->la_ifindex == ifp->index &&
+		    la->la_addr.s_addr == addr->s_addr)
+			break;
+	}
+	if (i == priv->addr4_n) {
+		if (priv->addr4_n == LINK_ADDR4_MAX)
+			link_addr4_flush(ctx);
+		la = &priv->addr4[priv->addr4_n++];
+		la->la_ifindex = ifp->index;
+		la->la_addr = *addr;
+	}
+	la->la_cmd = cmd;
+	la->la_net = *net;
+	la->la_brd = *brd;
+	la->la_flags = flags;
+	la->la_pid = pid;
+}
+#endif
+
 static int
 link_addr(struct dhcpcd_ctx *ctx, struct interface *ifp, struct nlmsghdr *nlm)
 {
@@ -803,17 +1012,7 @@ link_addr(struct dhcpcd_ctx *ctx, struct interface *ifp, struct nlmsghdr *nlm)
 			}
 		}
 
-		/* Validate RTM_DELADDR really means address deleted
-		 * and anything else really means address exists. */
-		if (if_addressexists(ifp, &addr) == 1) {
-			if (nlm->nlmsg_type == RTM_DELADDR)
-				break;
-		} else {
-			if (nlm->nlmsg_type != RTM_DELADDR)
-				break;
-		}
-
-		ipv4_handleifa(ctx, nlm->nlmsg_type, NULL, ifp->name,
+		link_addr4_queue(ctx, ifp, nlm->nlmsg_type,
 		    &addr, &net, &brd, ifa->ifa_flags, (pid_t)nlm->nlmsg_pid);
 		break;
 #endif
@@ -1009,6 +1208,10 @@ link_netlink(struct dhcpcd_ctx *ctx, void *arg, struct nlmsghdr *nlm)
 		dhcpcd_handlehwaddr(ifp, ifi->ifi_type, hwa, hwl);
 	}
 
+#ifdef HAVE_NL80211_H
+	if (!(ifi->ifi_flags & IFF_RUNNING))
+		if_nl80211_dropssid(ctx, ifp->index);
+#endif
 	dhcpcd_handlecarrier(ifp,
 	    ifi->ifi_flags & IFF_RUNNING ? LINK_UP : LINK_DOWN,
 	    ifi->ifi_flags);
@@ -1023,9 +1226,159 @@ if_handlelink(struct dhcpcd_ctx *ctx)
 		.iov_base = buf,
 		.iov_len = sizeof(buf),
 	};
+	unsigned int n;
+	int r;
+#ifdef INET
+	struct priv *priv = ctx->priv;
+	int serrno;
+#endif
+
+	/* Read all that is queued, so an address deleted and added
+	 * back is seen together. */
+	for (n = 0; n < LINK_READ_MAX; n++) {
+		r = if_getnetlink(ctx, &iov, ctx->link_fd, MSG_DONTWAIT,
+		    &link_netlink, NULL);
+		if (r == -1) {
+			if (n != 0 &&
+			    (errno == EAGAIN || errno == EWOULDBLOCK))
+				r = 0;
+			break;
+		}
+	}
+
+#ifdef INET
+	serrno = errno;
+	/* On overflow dhcpcd_linkoverflow() learns them all again. */
+	if (r == -1 && (errno == ENOBUFS || errno == ENOMEM))
+		priv->addr4_n = 0;
+	else
+		link_addr4_flush(ctx);
+	errno = serrno;
+#endif
+	return r;
+}
+
+/*
+ * Have the kernel drop link socket messages which link_netlink() would
+ * only throw away, so they no longer wake us:
+ * route messages we sent or for tables other than main,
+ * routes added by routing daemons,
+ * neighbours other than IPv6 ones,
+ * and addresses and neighbours on interfaces we don't know.
+ * Route deletions by daemons still come through as the route could be
+ * one we think is ours.
+ * Each multicast notification is sent on its own, so only the first
+ * message needs to be looked at.
+ * The interfaces are compiled in, so this is redone as they change.
+ */
+#define	LINK_FILTER_IFMAX	100	/* beyond this, accept any interface */
+#define	LINK_FILTER_LEN		(48 + LINK_FILTER_IFMAX * 2)
+
+/* BPF loads are in network order, netlink messages in host order. */
+#define	LF_NLMSG(f)		offsetof(struct nlmsghdr, f)
+#define	LF_DATA(s, f)		(NLMSG_HDRLEN + offsetof(s, f))
+
+#define	LF_STMT(bp, c, v)						\
+	do { BPF_SET_STMT((bp), (c), (v)); (bp)++; } while (0)
+#define	LF_JEQ(bp, v, t, f)						\
+	do { BPF_SET_JUMP((bp), BPF_JMP + BPF_JEQ + BPF_K, (v), (t), (f)); \
+	     (bp)++; } while (0)
+/* Point the true branch of the jump at j to bp. */
+#define	LF_LAND(j, bp)		((j)->jt = (uint8_t)((bp) - (j) - 1))
+
+int
+if_linkfilter(struct dhcpcd_ctx *ctx)
+{
+	struct sock_filter filter[LINK_FILTER_LEN], *bp = filter;
+	struct sock_filter *jroute, *jaddr[2];
+	struct sock_fprog pf = { .filter = filter };
+#ifdef INET6
+	struct sock_filter *jneigh[2];
+#endif
+	struct priv *priv = ctx->priv;
+	struct interface *ifp;
+	size_t i, nifs;
+
+	if (ctx->link_fd == -1 || priv == NULL || ctx->ifaces == NULL)
+		return 0;
+
+	LF_STMT(bp, BPF_LD + BPF_H + BPF_ABS, LF_NLMSG(nlmsg_type));
+	LF_JEQ(bp, htons(RTM_NEWROUTE), 1, 0);
+	jroute = bp;
+	LF_JEQ(bp, htons(RTM_DELROUTE), 0, 0);
+
+	/* Route messages we sent. */
+	LF_STMT(bp, BPF_LD + BPF_W + BPF_ABS, LF_NLMSG(nlmsg_pid));
+	LF_JEQ(bp, htonl(priv->route_pid), 0, 1);
+	LF_STMT(bp, BPF_RET + BPF_K, 0);
+#ifdef PRIVSEP
+	if (ctx->ps_root_pid != 0) {
+		LF_JEQ(bp, htonl((uint32_t)ctx->ps_root_pid), 0, 1);
+		LF_STMT(bp, BPF_RET + BPF_K, 0);
+	}
+#endif
+	LF_STMT(bp, BPF_LD + BPF_B + BPF_ABS, LF_DATA(struct rtmsg, rtm_table));
+	LF_JEQ(bp, RT_TABLE_MAIN, 1, 0);
+	LF_STMT(bp, BPF_RET + BPF_K, 0);
+	LF_STMT(bp, BPF_LD + BPF_H + BPF_ABS, LF_NLMSG(nlmsg_type));
+	LF_JEQ(bp, htons(RTM_NEWROUTE), 1, 0);
+	LF_STMT(bp, BPF_RET + BPF_K, BPF_WHOLEPACKET);
+	LF_STMT(bp, BPF_LD + BPF_B + BPF_ABS,
+	    LF_DATA(struct rtmsg, rtm_protocol));
+	for (i = 0; i < __arraycount(if_rtprotos); i++) {
+		LF_JEQ(bp, if_rtprotos[i], 0, 1);
+		LF_STMT(bp, BPF_RET + BPF_K, BPF_WHOLEPACKET);
+	}
+	LF_STMT(bp, BPF_RET + BPF_K, 0);
+	jroute->jf = (uint8_t)(bp - jroute - 1);
+
+	jaddr[0] = bp;
+	LF_JEQ(bp, htons(RTM_NEWADDR), 0, 0);
+	jaddr[1] = bp;
+	LF_JEQ(bp, htons(RTM_DELADDR), 0, 0);
+#ifdef INET6
+	jneigh[0] = bp;
+	LF_JEQ(bp, htons(RTM_NEWNEIGH), 0, 0);
+	jneigh[1] = bp;
+	LF_JEQ(bp, htons(RTM_DELNEIGH), 0, 0);
+#endif
+	/* Links and everything else. */
+	LF_STMT(bp, BPF_RET + BPF_K, BPF_WHOLEPACKET);
+
+#ifdef INET6
+	LF_LAND(jneigh[0], bp);
+	LF_LAND(jneigh[1], bp);
+	LF_STMT(bp, BPF_LD + BPF_B + BPF_ABS,
+	    LF_DATA(struct ndmsg, ndm_family));
+	LF_JEQ(bp, AF_INET6, 1, 0);
+	LF_STMT(bp, BPF_RET + BPF_K, 0);
+	LF_STMT(bp, BPF_LD + BPF_W + BPF_ABS,
+	    LF_DATA(struct ndmsg, ndm_ifindex));
+	LF_STMT(bp, BPF_JMP + BPF_JA, 1);
+#endif
 
-	return if_getnetlink(ctx, &iov, ctx->link_fd, MSG_DONTWAIT,
-	    &link_netlink, NULL);
+	LF_LAND(jaddr[0], bp);
+	LF_LAND(jaddr[1], bp);
+	LF_STMT(bp, BPF_LD + BPF_W + BPF_ABS,
+	    LF_DATA(struct ifaddrmsg, ifa_index));
+	nifs = 0;
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		nifs++;
+	}
+	if (nifs <= LINK_FILTER_IFMAX) {
+		TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+			LF_JEQ(bp, htonl(ifp->index), 0, 1);
+			LF_STMT(bp, BPF_RET + BPF_K, BPF_WHOLEPACKET);
+		}
+		LF_STMT(bp, BPF_RET + BPF_K, 0);
+	} else
+		LF_STMT(bp, BPF_RET + BPF_K, BPF_WHOLEPACKET);
+
+	assert(bp <= filter + LINK_FILTER_LEN);
+	/* Not bpf_attach(), that is only built with INET. */
+	pf.len = (unsigned short)(bp - filter);
+	return setsockopt(ctx->link_fd, SOL_SOCKET, SO_ATTACH_FILTER,
+	    &pf, sizeof(pf));
 }
 
 #ifdef PRIVSEP
@@ -1286,25 +1639,54 @@ genl_parse(struct nlmsghdr *nlm, struct nlattr *tb[], int maxtype)
 	return nla_parse(tb, head, len, maxtype);
 }
 
+struct gnl_family {
+	const char *gf_group;		/* multicast group wanted */
+	uint32_t gf_groupid;		/* 0 if not found */
+};
+
+static void
+gnl_getgroup(struct gnl_family *gf, struct nlattr *groups)
+{
+	struct nlattr *grp, *tb[CTRL_ATTR_MCAST_GRP_ID + 1];
+	size_t rem;
+
+	NLA_FOR_EACH_ATTR(grp, NLA_DATA(groups), NLA_LEN(groups), rem) {
+		if (nla_parse(tb, NLA_DATA(grp), NLA_LEN(grp),
+		    CTRL_ATTR_MCAST_GRP_ID) == -1)
+			continue;
+		if (tb[CTRL_ATTR_MCAST_GRP_NAME] == NULL ||
+		    tb[CTRL_ATTR_MCAST_GRP_ID] == NULL ||
+		    strncmp(NLA_DATA(tb[CTRL_ATTR_MCAST_GRP_NAME]),
+		    gf->gf_group, NLA_LEN(tb[CTRL_ATTR_MCAST_GRP_NAME])) != 0)
+			continue;
+		memcpy(&gf->gf_groupid, NLA_DATA(tb[CTRL_ATTR_MCAST_GRP_ID]),
+		    sizeof(gf->gf_groupid));
+		return;
+	}
+}
+
 static int
-_gnl_getfamily(__unused struct dhcpcd_ctx *ctx, __unused void *arg,
+_gnl_getfamily(__unused struct dhcpcd_ctx *ctx, void *arg,
     struct nlmsghdr *nlm)
 {
-	struct nlattr *tb[CTRL_ATTR_FAMILY_ID + 1];
+	struct gnl_family *gf = arg;
+	struct nlattr *tb[CTRL_ATTR_MCAST_GROUPS + 1];
 	uint16_t family;
 
-	if (genl_parse(nlm, tb, CTRL_ATTR_FAMILY_ID) == -1)
+	if (genl_parse(nlm, tb, CTRL_ATTR_MCAST_GROUPS) == -1)
 		return -1;
 	if (tb[CTRL_ATTR_FAMILY_ID] == NULL) {
 		errno = ENOENT;
 		return -1;
 	}
 	memcpy(&family, NLA_DATA(tb[CTRL_ATTR_FAMILY_ID]), sizeof(family));
+	if (gf != NULL && tb[CTRL_ATTR_MCAST_GROUPS] != NULL)
+		gnl_getgroup(gf, tb[CTRL_ATTR_MCAST_GROUPS]);
 	return (int)family;
 }
 
 static int
-gnl_getfamily(struct dhcpcd_ctx *ctx, const char *name)
+gnl_getfamily(struct dhcpcd_ctx *ctx, const char *name, struct gnl_family *gf)
 {
 	struct nlmg nlm;
 
@@ -1318,7 +1700,44 @@ gnl_getfamily(struct dhcpcd_ctx *ctx, const char *name)
 	    CTRL_ATTR_FAMILY_NAME, name) == -1)
 		return -1;
 	return if_sendnetlink(ctx, NETLINK_GENERIC, &nlm.hdr,
-	    &_gnl_getfamily, NULL);
+	    &_gnl_getfamily, gf);
+}
+
+/* The family only changes if cfg80211 is reloaded. */
+static int
+if_nl80211_family(struct dhcpcd_ctx *ctx)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	int family;
+
+	if (priv->nl80211_family != 0)
+		return priv->nl80211_family;
+	family = gnl_getfamily(ctx, "nl80211", NULL);
+	if (family != -1)
+		priv->nl80211_family = family;
+	return family;
+}
+
+/* ie[0] is type, ie[1] is length, ie[2..] is data */
+static int
+if_ssid_ie(const uint8_t *ie, size_t ie_len, uint8_t *ssid)
+{
+
+	while (ie_len >= 2 && ie_len >= (size_t)ie[1] + 2) {
+		if (ie[0] == 0) {
+			/* SSID */
+			if (ie[1] > IF_SSIDLEN) {
+				errno = ENOBUFS;
+				return -1;
+			}
+			memcpy(ssid, ie + 2, ie[1]);
+			return ie[1];
+		}
+		ie_len -= (size_t)ie[1] + 2;
+		ie += ie[1] + 2;
+	}
+	errno = ENOENT;
+	return -1;
 }
 
 static int
@@ -1355,34 +1774,32 @@ _if_getssid_nl80211(__unused struct dhcpcd_ctx *ctx, void *arg,
 		return 0;
 
 	ie = NLA_DATA(bss[NL80211_BSS_INFORMATION_ELEMENTS]);
-	ie_len = (int)NLA_LEN(bss[NL80211_BSS_INFORMATION_ELEMENTS]);
-	/* ie[0] is type, ie[1] is lenth, ie[2..] is data */
-	while (ie_len >= 2 && ie_len >= ie[1]) {
-		if (ie[0] == 0) {
-			/* SSID */
-			if (ie[1] > IF_SSIDLEN) {
-				errno = ENOBUFS;
-				return -1;
-			}
-			ifp->ssid_len = ie[1];
-			memcpy(ifp->ssid, ie + 2, ifp->ssid_len);
-			return (int)ifp->ssid_len;
-		}
-		ie_len -= ie[1] + 2;
-		ie += ie[1] + 2;
-	}
-
-	return 0;
+	ie_len = if_ssid_ie(ie, NLA_LEN(bss[NL80211_BSS_INFORMATION_ELEMENTS]),
+	    ifp->ssid);
+	if (ie_len == -1)
+		return errno == ENOENT ? 0 : -1;
+	ifp->ssid_len = (unsigned int)ie_len;
+	return ie_len;
 }
 
 static int
 if_getssid_nl80211(struct interface *ifp)
 {
+	struct priv *priv = (struct priv *)ifp->ctx->priv;
+	struct nl80211_ssid *ns;
 	int family;
 	struct nlmg nlm;
 
+	TAILQ_FOREACH(ns, &priv->nl80211_ssids, next) {
+		if (ns->ifindex == ifp->index) {
+			ifp->ssid_len = ns->ssid_len;
+			memcpy(ifp->ssid, ns->ssid, ns->ssid_len);
+			return (int)ifp->ssid_len;
+		}
+	}
+
 	errno = 0;
-	family = gnl_getfamily(ifp->ctx, "nl80211");
+	family = if_nl80211_family(ifp->ctx);
 	if (family == -1)
 		return -1;
 
@@ -1395,7 +1812,12 @@ if_getssid_nl80211(struct interface *ifp)
 	nla_put_32(&nlm.hdr, sizeof(nlm), NL80211_ATTR_IFINDEX, ifp->index);
 	if (if_sendnetlink(ifp->ctx, NETLINK_GENERIC, &nlm.hdr,
 	    NULL, NULL) == -1)
+	{
+		/* An unknown family, so cfg80211 has been reloaded. */
+		if (errno == EOPNOTSUPP)
+			priv->nl80211_family = 0;
 		return -1;
+	}
 
 	/* We need to parse out the list of scan results and find the one
 	 * we are connected to. */
@@ -1409,156 +1831,303 @@ if_getssid_nl80211(struct interface *ifp)
 	return if_sendnetlink(ifp->ctx, NETLINK_GENERIC, &nlm.hdr,
 	    &_if_getssid_nl80211, ifp);
 }
-#endif
 
-int
-if_getssid(struct interface *ifp)
+static void
+if_nl80211_freessids(struct dhcpcd_ctx *ctx)
 {
-	int r;
-
-#ifdef HAVE_NL80211_H
-	r = if_getssid_nl80211(ifp);
-	if (r == -1)
-		ifp->ssid_len = 0;
-#else
-	r = if_getssid_wext(ifp->name, ifp->ssid);
-	if (r != -1)
-		ifp->ssid_len = (unsigned int)r;
-#endif
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct nl80211_ssid *ns;
 
-	ifp->ssid[ifp->ssid_len] = '\0';
-	return r;
+	while ((ns = TAILQ_FIRST(&priv->nl80211_ssids)) != NULL) {
+		TAILQ_REMOVE(&priv->nl80211_ssids, ns, next);
+		free(ns);
+	}
 }
 
-struct nlma
-{
-	struct nlmsghdr hdr;
-	struct ifaddrmsg ifa;
-	char buffer[64];
-};
-
-#ifdef INET
-struct ifiaddr
-{
-	unsigned int ifa_ifindex;
-	struct in_addr ifa_addr;
-};
-
-static int
-_if_addressexists(__unused struct dhcpcd_ctx *ctx,
-    void *arg, struct nlmsghdr *nlm)
+static void
+if_nl80211_dropssid(struct dhcpcd_ctx *ctx, unsigned int ifindex)
 {
-	struct ifiaddr *ia = arg;
-	in_addr_t this_addr;
-	size_t len;
-	struct rtattr *rta;
-	struct ifaddrmsg *ifa;
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct nl80211_ssid *ns;
 
-	ifa = NLMSG_DATA(nlm);
-	if (ifa->ifa_index != ia->ifa_ifindex || ifa->ifa_family != AF_INET)
-		return 0;
-	rta = IFA_RTA(ifa);
-	len = NLMSG_PAYLOAD(nlm, sizeof(*ifa));
-	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
-		switch (rta->rta_type) {
-		case IFA_LOCAL:
-			memcpy(&this_addr, RTA_DATA(rta), sizeof(this_addr));
-			return this_addr == ia->ifa_addr.s_addr ? 1 : 0;
+	TAILQ_FOREACH(ns, &priv->nl80211_ssids, next) {
+		if (ns->ifindex == ifindex) {
+			TAILQ_REMOVE(&priv->nl80211_ssids, ns, next);
+			free(ns);
+			return;
 		}
 	}
-	return 0;
 }
 
-static int
-if_addressexists(struct interface *ifp, struct in_addr *addr)
+static void
+if_nl80211_setssid(struct dhcpcd_ctx *ctx, unsigned int ifindex,
+    const uint8_t *ie, size_t ie_len)
 {
-	struct ifiaddr ia = {
-		.ifa_ifindex = ifp->index,
-		.ifa_addr = *addr,
-	};
-	struct nlma nlm = {
-	    .hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg)),
-	    .hdr.nlmsg_type = RTM_GETADDR,
-	    .hdr.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
-	    .ifa.ifa_family = AF_INET,
-	    .ifa.ifa_index = ifp->index,
-	};
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct nl80211_ssid *ns;
+	uint8_t ssid[IF_SSIDLEN];
+	int ssid_len;
+
+	ssid_len = if_ssid_ie(ie, ie_len, ssid);
+	if (ssid_len == -1) {
+		/* if_getssid() will have to ask. */
+		if_nl80211_dropssid(ctx, ifindex);
+		return;
+	}
 
-	return if_sendnetlink(ifp->ctx, NETLINK_ROUTE, &nlm.hdr,
-	    &_if_addressexists, &ia);
+	TAILQ_FOREACH(ns, &priv->nl80211_ssids, next) {
+		if (ns->ifindex == ifindex)
+			break;
+	}
+	if (ns == NULL) {
+		if ((ns = malloc(sizeof(*ns))) == NULL) {
+			logerr(__func__);
+			return;
+		}
+		ns->ifindex = ifindex;
+		TAILQ_INSERT_TAIL(&priv->nl80211_ssids, ns, next);
+	}
+	ns->ssid_len = (unsigned int)ssid_len;
+	memcpy(ns->ssid, ssid, ns->ssid_len);
 }
-#endif
 
-struct nlmr
+static void
+if_nl80211_event(struct dhcpcd_ctx *ctx, struct nlmsghdr *nlm)
 {
-	struct nlmsghdr hdr;
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct genlmsghdr *ghdr;
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	uint32_t ifindex;
+	uint16_t status;
+
+	if (nlm->nlmsg_type != priv->nl80211_family ||
+	    nlm->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+		return;
+	ghdr = NLMSG_DATA(nlm);
+	if (genl_parse(nlm, tb, NL80211_ATTR_MAX) == -1 ||
+	    tb[NL80211_ATTR_IFINDEX] == NULL)
+		return;
+	memcpy(&ifindex, NLA_DATA(tb[NL80211_ATTR_IFINDEX]), sizeof(ifindex));
+
+	switch (ghdr->cmd) {
+	case NL80211_CMD_CONNECT:
+		if (tb[NL80211_ATTR_STATUS_CODE] != NULL) {
+			memcpy(&status, NLA_DATA(tb[NL80211_ATTR_STATUS_CODE]),
+			    sizeof(status));
+			if (status != 0) {
+				if_nl80211_dropssid(ctx, ifindex);
+				break;
+			}
+		}
+		/* FALLTHROUGH */
+	case NL80211_CMD_ROAM:
+		/* The SSID is in the (re)association request. */
+		if (tb[NL80211_ATTR_REQ_IE] != NULL)
+			if_nl80211_setssid(ctx, ifindex,
+			    NLA_DATA(tb[NL80211_ATTR_REQ_IE]),
+			    NLA_LEN(tb[NL80211_ATTR_REQ_IE]));
+		else
+			if_nl80211_dropssid(ctx, ifindex);
+		break;
+	case NL80211_CMD_DISCONNECT:
+		if_nl80211_dropssid(ctx, ifindex);
+		break;
+	}
+}
+
+static void
+if_nl80211_handle(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct priv *priv = (struct priv *)ctx->priv;
+	unsigned char buf[16 * 1024];
+	struct sockaddr_nl nladdr;
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+	struct msghdr msg = {
+	    .msg_name = &nladdr,
+	    .msg_iov = &iov, .msg_iovlen = 1,
+	};
+	struct nlmsghdr *nlm;
+	ssize_t len;
+
+	for (;;) {
+		msg.msg_namelen = sizeof(nladdr);
+		len = recvmsg(priv->nl80211_fd, &msg, MSG_DONTWAIT);
+		if (len == -1) {
+			if (errno == ENOBUFS) {
+				/* We missed events, so ask from now on. */
+				if_nl80211_freessids(ctx);
+				continue;
+			}
+			if (errno != EAGAIN && errno != EINTR)
+				logerr(__func__);
+			return;
+		}
+		if (len == 0 || msg.msg_namelen != sizeof(nladdr) ||
+		    nladdr.nl_pid != 0)
+			continue;
+
+		for (nlm = (struct nlmsghdr *)buf;
+		     NLMSG_OK(nlm, (size_t)len);
+		     nlm = NLMSG_NEXT(nlm, len))
+			if_nl80211_event(ctx, nlm);
+	}
+}
+
+/*
+ * Listen to association events so that a carrier change can use the
+ * SSID we already know rather than query nl80211 for it.
+ * This is done before any sandbox is entered, so if nl80211 only
+ * appears later we just keep asking.
+ */
+static void
+if_nl80211_open(struct dhcpcd_ctx *ctx)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct gnl_family gf = { .gf_group = "mlme" };
+	struct sockaddr_nl snl = { .nl_groups = 0 };
+	int family, fd;
+
+	family = gnl_getfamily(ctx, "nl80211", &gf);
+	if (family == -1)
+		return;
+	priv->nl80211_family = family;
+	if (gf.gf_groupid == 0)
+		return;
+
+	fd = if_linksocket(&snl, NETLINK_GENERIC, SOCK_NONBLOCK);
+	if (fd == -1) {
+		logerr("%s: if_linksocket", __func__);
+		return;
+	}
+	if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+	    &gf.gf_groupid, sizeof(gf.gf_groupid)) == -1 ||
+	    eloop_event_add(ctx->eloop, fd, if_nl80211_handle, ctx) == -1)
+	{
+		logerr(__func__);
+		close(fd);
+		return;
+	}
+	priv->nl80211_fd = fd;
+}
+
+static void
+if_nl80211_close(struct dhcpcd_ctx *ctx)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+
+	if (priv->nl80211_fd != -1) {
+		eloop_event_delete(ctx->eloop, priv->nl80211_fd);
+		close(priv->nl80211_fd);
+		priv->nl80211_fd = -1;
+	}
+	if_nl80211_freessids(ctx);
+}
+#endif
+
+int
+if_getssid(struct interface *ifp)
+{
+	int r;
+
+#ifdef HAVE_NL80211_H
+	r = if_getssid_nl80211(ifp);
+	if (r == -1)
+		ifp->ssid_len = 0;
+#else
+	r = if_getssid_wext(ifp->name, ifp->ssid);
+	if (r != -1)
+		ifp->ssid_len = (unsigned int)r;
+#endif
+
+	ifp->ssid[ifp->ssid_len] = '\0';
+	return r;
+}
+
+struct nlma
+{
+	struct nlmsghdr hdr;
+	struct ifaddrmsg ifa;
+	char buffer[64];
+};
+
+
+struct nlmr
+{
+	struct nlmsghdr hdr;
 	struct rtmsg rt;
 	char buffer[256];
 };
 
-int
-if_route(unsigned char cmd, const struct rt *rt)
+struct nlml
+{
+	struct nlmsghdr hdr;
+	struct ifinfomsg i;
+	char buffer[32];
+};
+
+static void
+if_routenlm(unsigned char cmd, const struct rt *rt, struct nlmr *nlm)
 {
-	struct nlmr nlm;
 	bool gateway_unspec;
 
-	memset(&nlm, 0, sizeof(nlm));
-	nlm.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	memset(nlm, 0, sizeof(*nlm));
+	nlm->hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
 	switch (cmd) {
 	case RTM_CHANGE:
-		nlm.hdr.nlmsg_type = RTM_NEWROUTE;
-		nlm.hdr.nlmsg_flags = NLM_F_CREATE | NLM_F_REPLACE;
+		nlm->hdr.nlmsg_type = RTM_NEWROUTE;
+		nlm->hdr.nlmsg_flags = NLM_F_CREATE | NLM_F_REPLACE;
 		break;
 	case RTM_ADD:
-		nlm.hdr.nlmsg_type = RTM_NEWROUTE;
-		nlm.hdr.nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
+		nlm->hdr.nlmsg_type = RTM_NEWROUTE;
+		nlm->hdr.nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
 		break;
 	case RTM_DELETE:
-		nlm.hdr.nlmsg_type = RTM_DELROUTE;
+		nlm->hdr.nlmsg_type = RTM_DELROUTE;
 		break;
 	}
-	nlm.hdr.nlmsg_flags |= NLM_F_REQUEST;
-	nlm.rt.rtm_family = (unsigned char)rt->rt_dest.sa_family;
-	nlm.rt.rtm_table = RT_TABLE_MAIN;
+	nlm->hdr.nlmsg_flags |= NLM_F_REQUEST;
+	nlm->rt.rtm_family = (unsigned char)rt->rt_dest.sa_family;
+	nlm->rt.rtm_table = RT_TABLE_MAIN;
 
 	gateway_unspec = sa_is_unspecified(&rt->rt_gateway);
 
 	if (cmd == RTM_DELETE) {
-		nlm.rt.rtm_scope = RT_SCOPE_NOWHERE;
+		nlm->rt.rtm_scope = RT_SCOPE_NOWHERE;
 	} else {
 		/* Address generated routes are RTPROT_KERNEL,
 		 * otherwise RTPROT_BOOT */
 #ifdef RTPROT_RA
 		if (rt->rt_dflags & RTDF_RA)
-			nlm.rt.rtm_protocol = RTPROT_RA;
+			nlm->rt.rtm_protocol = RTPROT_RA;
 		else
 #endif
 #ifdef RTPROT_DHCP
 		if (rt->rt_dflags & RTDF_DHCP)
-			nlm.rt.rtm_protocol = RTPROT_DHCP;
+			nlm->rt.rtm_protocol = RTPROT_DHCP;
 		else
 #endif
 		if (rt->rt_dflags & RTDF_IFA_ROUTE)
-			nlm.rt.rtm_protocol = RTPROT_KERNEL;
+			nlm->rt.rtm_protocol = RTPROT_KERNEL;
 		else
-			nlm.rt.rtm_protocol = RTPROT_BOOT;
+			nlm->rt.rtm_protocol = RTPROT_BOOT;
 		if (rt->rt_ifp->flags & IFF_LOOPBACK)
-			nlm.rt.rtm_scope = RT_SCOPE_HOST;
+			nlm->rt.rtm_scope = RT_SCOPE_HOST;
 		else if (gateway_unspec)
-			nlm.rt.rtm_scope = RT_SCOPE_LINK;
+			nlm->rt.rtm_scope = RT_SCOPE_LINK;
 		else
-			nlm.rt.rtm_scope = RT_SCOPE_UNIVERSE;
+			nlm->rt.rtm_scope = RT_SCOPE_UNIVERSE;
 		if (rt->rt_flags & RTF_REJECT)
-			nlm.rt.rtm_type = RTN_UNREACHABLE;
+			nlm->rt.rtm_type = RTN_UNREACHABLE;
 		else
-			nlm.rt.rtm_type = RTN_UNICAST;
+			nlm->rt.rtm_type = RTN_UNICAST;
 	}
 
 #define ADDSA(type, sa)							\
-	add_attr_l(&nlm.hdr, sizeof(nlm), (type),			\
+	add_attr_l(&nlm->hdr, sizeof(*nlm), (type),			\
 	    (const char *)(sa) + sa_addroffset((sa)),			\
 	    (unsigned short)sa_addrlen((sa)));
-	nlm.rt.rtm_dst_len = (unsigned char)sa_toprefix(&rt->rt_netmask);
+	nlm->rt.rtm_dst_len = (unsigned char)sa_toprefix(&rt->rt_netmask);
 	/* rt->rt_dest and rt->gateway are unions where sockaddr_in6
 	 * is the biggest member. However, we access them as the
 	 * generic sockaddr and coverity thinks this will overrun. */
@@ -1582,7 +2151,7 @@ if_route(unsigned char cmd, const struct rt *rt)
 			metrics->rta_len = RTA_LENGTH(0);
 			rta_add_attr_32(metrics, sizeof(metricsbuf),
 			    RTAX_MTU, rt->rt_mtu);
-			add_attr_l(&nlm.hdr, sizeof(nlm), RTA_METRICS,
+			add_attr_l(&nlm->hdr, sizeof(*nlm), RTA_METRICS,
 			    RTA_DATA(metrics),
 			    (unsigned short)RTA_PAYLOAD(metrics));
 		}
@@ -1605,22 +2174,81 @@ if_route(unsigned char cmd, const struct rt *rt)
 				pref = ICMPV6_ROUTER_PREF_INVALID;
 				break;
 			}
-			add_attr_8(&nlm.hdr, sizeof(nlm), RTA_PREF, pref);
+			add_attr_8(&nlm->hdr, sizeof(*nlm), RTA_PREF, pref);
 		}
 #endif
 	}
 
 	if (!sa_is_loopback(&rt->rt_gateway))
-		add_attr_32(&nlm.hdr, sizeof(nlm), RTA_OIF, rt->rt_ifp->index);
+		add_attr_32(&nlm->hdr, sizeof(*nlm), RTA_OIF,
+		    rt->rt_ifp->index);
 
 	if (rt->rt_metric != 0)
-		add_attr_32(&nlm.hdr, sizeof(nlm), RTA_PRIORITY,
+		add_attr_32(&nlm->hdr, sizeof(*nlm), RTA_PRIORITY,
 		    rt->rt_metric);
+}
 
+int
+if_route(unsigned char cmd, const struct rt *rt)
+{
+	struct nlmr nlm;
+
+	if_routenlm(cmd, rt, &nlm);
 	return if_sendnetlink(rt->rt_ifp->ctx, NETLINK_ROUTE, &nlm.hdr,
 	    NULL, NULL);
 }
 
+int
+if_routes(struct dhcpcd_ctx *ctx, struct if_rtreq *reqs, size_t nreqs)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct sockaddr_nl snl = { .nl_family = AF_NETLINK };
+	uint8_t buf[NETLINK_BATCH_MAX * NLMSG_ALIGN(sizeof(struct nlmr))];
+	struct iovec iov = { .iov_base = buf };
+	struct msghdr msg = {
+	    .msg_name = &snl, .msg_namelen = sizeof(snl),
+	    .msg_iov = &iov, .msg_iovlen = 1
+	};
+	struct nlmr nlm;
+	int errs[NETLINK_BATCH_MAX];
+	uint32_t seq = 0;
+	size_t i, n;
+	ssize_t r;
+	int failed = 0;
+
+	for (; nreqs != 0; reqs += n, nreqs -= n) {
+		n = MIN(nreqs, NETLINK_BATCH_MAX);
+		iov.iov_len = 0;
+		for (i = 0; i < n; i++) {
+			if_routenlm(reqs[i].cmd, reqs[i].rt, &nlm);
+			nlm.hdr.nlmsg_flags |= NLM_F_ACK;
+			nlm.hdr.nlmsg_seq = (uint32_t)++ctx->seq;
+			if (i == 0)
+				seq = nlm.hdr.nlmsg_seq;
+			memcpy(buf + iov.iov_len, &nlm, nlm.hdr.nlmsg_len);
+			iov.iov_len += NLMSG_ALIGN(nlm.hdr.nlmsg_len);
+		}
+
+#ifdef PRIVSEP
+		if (ctx->options & DHCPCD_PRIVSEP)
+			r = ps_root_sendnetlinkbatch(ctx, NETLINK_ROUTE, &msg,
+			    errs, n);
+		else
+#endif
+		if (sendmsg(priv->route_fd, &msg, 0) == -1)
+			r = -1;
+		else
+			r = if_getnetlinkacks(priv->route_fd, seq, errs, n);
+
+		for (i = 0; i < n; i++) {
+			reqs[i].error = r == -1 ? errno : errs[i];
+			if (reqs[i].error != 0)
+				failed++;
+		}
+	}
+	return failed == 0 ? 0 : -1;
+}
+
 static int
 _if_initrt(struct dhcpcd_ctx *ctx, void *arg,
     struct nlmsghdr *nlm)
@@ -1628,7 +2256,7 @@ _if_initrt(struct dhcpcd_ctx *ctx, void *arg,
 	struct rt rt, *rtn;
 	rb_tree_t *kroutes = arg;
 
-	if (if_copyrt(ctx, &rt, nlm) != 0)
+	if (if_copyrt(ctx, &rt, nlm) != 0 || rt.rt_dflags & RTDF_DAEMON)
 		return 0;
 	if ((rtn = rt_new(rt.rt_ifp)) == NULL) {
 		logerr(__func__);
@@ -1659,9 +2287,157 @@ if_initrt(struct dhcpcd_ctx *ctx, rb_tree_t *kroutes, int af)
 /* Linux is a special snowflake when it comes to BPF. */
 const char *bpf_name = "Packet Socket";
 
-/* Linux is a special snowflake for opening BPF. */
-struct bpf *
-bpf_open(const struct interface *ifp,
+#if defined(PACKET_AUXDATA) || defined(TPACKET3_HDRLEN)
+/* Locally generated frames may not have a checksum yet and the
+ * NIC or kernel may have already verified the checksum for us. */
+static unsigned int
+bpf_csum_flags(uint32_t status)
+{
+	unsigned int flags = 0;
+
+	if (status & TP_STATUS_CSUMNOTREADY)
+		flags |= BPF_PARTIALCSUM;
+#ifdef TP_STATUS_CSUM_VALID
+	if (status & TP_STATUS_CSUM_VALID)
+		flags |= BPF_CSUMVALID;
+#endif
+	return flags;
+}
+#endif
+
+#ifdef TPACKET3_HDRLEN
+/* The kernel fills a block with as many frames as fit and hands it
+ * over when full or after BPF_RING_TIMEOUT milliseconds.
+ * DHCP and ARP frames are small, so a few blocks are plenty. */
+#define	BPF_RING_BLOCKSIZE	(1U << 14)
+#define	BPF_RING_BLOCKS		4U
+#define	BPF_RING_FRAMESIZE	(1U << 11)
+#define	BPF_RING_TIMEOUT	10U
+/* The sender address follows the header, as TPACKET_ALIGN() does
+ * without the sign conversion. */
+#define	BPF_RING_SLL_OFF						\
+	((sizeof(struct tpacket3_hdr) + TPACKET_ALIGNMENT - 1) &	\
+	~(size_t)(TPACKET_ALIGNMENT - 1))
+
+static int
+bpf_open_ring(struct bpf *bpf)
+{
+	int n = TPACKET_V3;
+	struct tpacket_req3 req = {
+		.tp_block_size = BPF_RING_BLOCKSIZE,
+		.tp_block_nr = BPF_RING_BLOCKS,
+		.tp_frame_size = BPF_RING_FRAMESIZE,
+		.tp_frame_nr = BPF_RING_BLOCKS *
+		    (BPF_RING_BLOCKSIZE / BPF_RING_FRAMESIZE),
+		.tp_retire_blk_tov = BPF_RING_TIMEOUT,
+	};
+	void *ring;
+	size_t size;
+
+	if (setsockopt(bpf->bpf_fd, SOL_PACKET, PACKET_VERSION,
+	    &n, sizeof(n)) == -1 ||
+	    setsockopt(bpf->bpf_fd, SOL_PACKET, PACKET_RX_RING,
+	    &req, sizeof(req)) == -1)
+		return -1;
+
+	size = (size_t)req.tp_block_size * req.tp_block_nr;
+	ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    bpf->bpf_fd, 0);
+	if (ring == MAP_FAILED)
+		return -1;
+	bpf->bpf_ring = ring;
+	bpf->bpf_ring_size = size;
+	bpf->bpf_ring_nblocks = req.tp_block_nr;
+	return 0;
+}
+
+static struct tpacket_block_desc *
+bpf_ring_desc(const struct bpf *bpf)
+{
+
+	return (void *)((char *)bpf->bpf_ring +
+	    bpf->bpf_ring_block * BPF_RING_BLOCKSIZE);
+}
+
+static bool
+bpf_ring_ready(const struct tpacket_block_desc *bd)
+{
+
+	return __atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+	    TP_STATUS_USER;
+}
+
+static void
+bpf_ring_release(struct bpf *bpf, struct tpacket_block_desc *bd)
+{
+
+	__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+	    __ATOMIC_RELEASE);
+	bpf->bpf_ring_block = (bpf->bpf_ring_block + 1) %
+	    bpf->bpf_ring_nblocks;
+	bpf->bpf_ring_npkts = 0;
+}
+
+/* Frames are returned from the block in place.
+ * The last frame of a block is copied to bpf_buffer so the block
+ * can go back to the kernel before the caller stops reading. */
+static ssize_t
+bpf_read_ring(struct bpf *bpf, void **frame, int *ifindex)
+{
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *hdr;
+	const struct sockaddr_ll *sll;
+	size_t len;
+
+	bd = bpf_ring_desc(bpf);
+	while (bpf->bpf_ring_npkts == 0) {
+		if (!bpf_ring_ready(bd)) {
+			bpf->bpf_flags |= BPF_EOF;
+			return 0;
+		}
+		bpf->bpf_ring_npkts = bd->hdr.bh1.num_pkts;
+		bpf->bpf_ring_pos = bd->hdr.bh1.offset_to_first_pkt;
+		if (bpf->bpf_ring_npkts == 0) {
+			bpf_ring_release(bpf, bd);
+			bd = bpf_ring_desc(bpf);
+		}
+	}
+
+	hdr = (void *)((char *)bd + bpf->bpf_ring_pos);
+	bpf->bpf_ring_pos += hdr->tp_next_offset;
+	*frame = (char *)hdr + hdr->tp_mac;
+	len = hdr->tp_snaplen;
+	bpf->bpf_time.tv_sec = (time_t)hdr->tp_sec;
+	bpf->bpf_time.tv_nsec = (long)hdr->tp_nsec;
+	if (ifindex != NULL) {
+		sll = (const void *)((char *)hdr + BPF_RING_SLL_OFF);
+		*ifindex = sll->sll_ifindex;
+	}
+
+	bpf->bpf_flags &= ~(BPF_PARTIALCSUM | BPF_CSUMVALID);
+	bpf->bpf_flags |= bpf_csum_flags(hdr->tp_status);
+	if (bpf->bpf_ifp != NULL && bpf_frame_bcast(bpf->bpf_ifp, *frame) == 0)
+		bpf->bpf_flags |= BPF_BCAST;
+	else
+		bpf->bpf_flags &= ~BPF_BCAST;
+
+	if (--bpf->bpf_ring_npkts == 0) {
+		if (len > bpf->bpf_size)
+			len = bpf->bpf_size;
+		memcpy(bpf->bpf_buffer, *frame, len);
+		*frame = bpf->bpf_buffer;
+		bpf_ring_release(bpf, bd);
+		if (!bpf_ring_ready(bpf_ring_desc(bpf)))
+			bpf->bpf_flags |= BPF_EOF;
+	}
+	return (ssize_t)len;
+}
+#endif
+
+/* Linux is a special snowflake for opening BPF.
+ * An ifindex of 0 binds to every interface for a shared socket. */
+static struct bpf *
+bpf_open_socket(const struct interface *ifp, unsigned int ifindex,
     int (*filter)(const struct bpf *, const struct in_addr *),
     const struct in_addr *ia)
 {
@@ -1674,7 +2450,7 @@ bpf_open(const struct interface *ifp,
 		.sll = {
 			.sll_family = PF_PACKET,
 			.sll_protocol = htons(ETH_P_ALL),
-			.sll_ifindex = (int)ifp->index,
+			.sll_ifindex = (int)ifindex,
 		}
 	};
 #ifdef PACKET_AUXDATA
@@ -1685,6 +2461,7 @@ bpf_open(const struct interface *ifp,
 	if (bpf == NULL)
 		return NULL;
 	bpf->bpf_ifp = ifp;
+	bpf->bpf_ifmap = bpf->bpf_xidmap = -1;
 
 	/* Allocate a suitably large buffer for a single packet. */
 	bpf->bpf_size = ETH_DATA_LEN;
@@ -1692,18 +2469,36 @@ bpf_open(const struct interface *ifp,
 	if (bpf->bpf_buffer == NULL)
 		goto eexit;
 
+#ifdef TPACKET3_HDRLEN
+	/* A socket without a protocol receives nothing until bound,
+	 * so the ring and filter can be set up before any frame arrives.
+	 * Fall back to reading frames one by one if the kernel cannot. */
+	bpf->bpf_fd = xsocket(PF_PACKET, SOCK_RAW|SOCK_CXNB, 0);
+	if (bpf->bpf_fd != -1 && bpf_open_ring(bpf) == -1) {
+		close(bpf->bpf_fd);
+		bpf->bpf_fd = -1;
+	}
+	if (bpf->bpf_fd == -1)
+#endif
 	bpf->bpf_fd = xsocket(PF_PACKET, SOCK_RAW|SOCK_CXNB,htons(ETH_P_ALL));
 	if (bpf->bpf_fd == -1)
 		goto eexit;
 
 	/* We cannot validate the correct interface,
 	 * so we MUST set this first. */
-	if (bind(bpf->bpf_fd, &su.sa, sizeof(su.sll)) == -1)
+	if (bpf->bpf_ring == NULL &&
+	    bind(bpf->bpf_fd, &su.sa, sizeof(su.sll)) == -1)
 		goto eexit;
 
 	if (filter(bpf, ia) != 0)
 		goto eexit;
 
+	if (bpf->bpf_ring != NULL) {
+		if (bind(bpf->bpf_fd, &su.sa, sizeof(su.sll)) == -1)
+			goto eexit;
+		return bpf;
+	}
+
 	/* In the ideal world, this would be set before the bind and filter. */
 #ifdef PACKET_AUXDATA
 	n = 1;
@@ -1712,6 +2507,12 @@ bpf_open(const struct interface *ifp,
 		if (errno != ENOPROTOOPT)
 			goto eexit;
 	}
+#ifdef SO_TIMESTAMPNS
+	/* The ring stamps frames itself. */
+	if (setsockopt(bpf->bpf_fd, SOL_SOCKET, SO_TIMESTAMPNS,
+	    &n, sizeof(n)) != 0)
+		goto eexit;
+#endif
 #endif
 
 	/*
@@ -1726,51 +2527,70 @@ bpf_open(const struct interface *ifp,
 	return bpf;
 
 eexit:
+	if (bpf->bpf_ring != NULL)
+		munmap(bpf->bpf_ring, bpf->bpf_ring_size);
 	if (bpf->bpf_fd != -1)
 		close(bpf->bpf_fd);
+	if (bpf->bpf_ifmap != -1)
+		close(bpf->bpf_ifmap);
+	if (bpf->bpf_xidmap != -1)
+		close(bpf->bpf_xidmap);
 	free(bpf->bpf_buffer);
 	free(bpf);
 	return NULL;
 }
 
 /* BPF requires that we read the entire buffer.
- * So we pass the buffer in the API so we can loop on >1 packet. */
-ssize_t
-bpf_read(struct bpf *bpf, void *data, size_t len)
+ * So the frame returned points into bpf_buffer and is valid until the
+ * next read, which lets the caller loop on >1 packet without a copy. */
+static ssize_t
+bpf_recv(struct bpf *bpf, void **frame, int *ifindex)
 {
 	ssize_t bytes;
 	struct iovec iov = {
 		.iov_base = bpf->bpf_buffer,
 		.iov_len = bpf->bpf_size,
 	};
+	struct sockaddr_ll sll;
 	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
 #ifdef PACKET_AUXDATA
 	union {
 		struct cmsghdr hdr;
-		uint8_t buf[CMSG_SPACE(sizeof(struct tpacket_auxdata))];
+		uint8_t buf[CMSG_SPACE(sizeof(struct tpacket_auxdata)) +
+		    CMSG_SPACE(sizeof(struct timespec))];
 	} cmsgbuf = { .buf = { 0 } };
 	struct cmsghdr *cmsg;
 	struct tpacket_auxdata *aux;
 #endif
 
+#ifdef TPACKET3_HDRLEN
+	if (bpf->bpf_ring != NULL)
+		return bpf_read_ring(bpf, frame, ifindex);
+#endif
+
 #ifdef PACKET_AUXDATA
 	msg.msg_control = cmsgbuf.buf;
 	msg.msg_controllen = sizeof(cmsgbuf.buf);
 #endif
+	if (ifindex != NULL) {
+		msg.msg_name = &sll;
+		msg.msg_namelen = sizeof(sll);
+	}
 
 	bytes = recvmsg(bpf->bpf_fd, &msg, 0);
 	if (bytes == -1)
 		return -1;
+	timespecclear(&bpf->bpf_time);
 	bpf->bpf_flags |= BPF_EOF; /* We only ever read one packet. */
-	bpf->bpf_flags &= ~BPF_PARTIALCSUM;
-	if (bytes) {
+	bpf->bpf_flags &= ~(BPF_PARTIALCSUM | BPF_CSUMVALID);
+	*frame = bpf->bpf_buffer;
+	if (ifindex != NULL)
+		*ifindex = sll.sll_ifindex;
+	if (bytes && bpf->bpf_ifp != NULL) {
 		if (bpf_frame_bcast(bpf->bpf_ifp, bpf->bpf_buffer) == 0)
 			bpf->bpf_flags |= BPF_BCAST;
 		else
 			bpf->bpf_flags &= ~BPF_BCAST;
-		if ((size_t)bytes > len)
-			bytes = (ssize_t)len;
-		memcpy(data, bpf->bpf_buffer, (size_t)bytes);
 #ifdef PACKET_AUXDATA
 		for (cmsg = CMSG_FIRSTHDR(&msg);
 		     cmsg;
@@ -1779,13 +2599,505 @@ bpf_read(struct bpf *bpf, void *data, size_t len)
 			if (cmsg->cmsg_level == SOL_PACKET &&
 			    cmsg->cmsg_type == PACKET_AUXDATA) {
 				aux = (void *)CMSG_DATA(cmsg);
-				if (aux->tp_status & TP_STATUS_CSUMNOTREADY)
-					bpf->bpf_flags |= BPF_PARTIALCSUM;
+				bpf->bpf_flags |=
+				    bpf_csum_flags(aux->tp_status);
 			}
+#ifdef SCM_TIMESTAMPNS
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SCM_TIMESTAMPNS)
+				memcpy(&bpf->bpf_time, CMSG_DATA(cmsg),
+				    sizeof(bpf->bpf_time));
+#endif
 		}
 #endif
 	}
-	return bytes;
+	return bytes;
+}
+
+/*
+ * With shared_bpf one unbound socket carries BOOTP for every Ethernet
+ * interface, cutting the descriptors, kernel filters and wakeups.
+ * Each interface still gets a struct bpf of its own, a view without a
+ * descriptor, filed by ifindex under the shared socket.
+ * Frames are handed to the view owner from bpf_shared_read() and
+ * replies go out through the shared socket addressed to the interface.
+ * With privilege separation one pooled BPF helper owns the shared
+ * socket and its views, see privsep-bpf.c.
+ */
+static int
+bpf_compare_view(__unused void *context, const void *node1, const void *node2)
+{
+	const struct bpf *b1 = node1, *b2 = node2;
+
+	if (b1->bpf_ifindex < b2->bpf_ifindex)
+		return -1;
+	return b1->bpf_ifindex == b2->bpf_ifindex ? 0 : 1;
+}
+
+static int
+bpf_compare_viewkey(__unused void *context, const void *node, const void *key)
+{
+	const struct bpf *bpf = node;
+	unsigned int idx = *(const unsigned int *)key;
+
+	if (bpf->bpf_ifindex < idx)
+		return -1;
+	return bpf->bpf_ifindex == idx ? 0 : 1;
+}
+
+static const rb_tree_ops_t bpf_view_ops = {
+	.rbto_compare_nodes = bpf_compare_view,
+	.rbto_compare_key = bpf_compare_viewkey,
+	.rbto_node_offset = offsetof(struct bpf, bpf_tree),
+	.rbto_context = NULL
+};
+
+/*
+ * If the kernel lets us, the shared socket is filtered by one eBPF
+ * program matching the views against two maps:
+ * ifindex -> BPF_VIEW_* flags, so frames for interfaces without a view
+ * are dropped, and xid -> the number of views using it, for the views
+ * with xidfilter.
+ * Changing what a view matches is then a map write rather than
+ * installing a new filter, which a locked filter won't allow anyway.
+ * The xid is matched for any view as replies can be redirected.
+ * Otherwise the classic filter is used and views then match anything.
+ */
+#ifdef __NR_bpf
+#define	BPF_VIEW_XID		0x01U	/* match the xid */
+#define	BPF_VIEW_MAX		4096	/* views of one socket */
+
+#define	EBPF_INSN(c, d, s, o, i)					\
+	{ .code = (c), .dst_reg = (d), .src_reg = (s),			\
+	  .off = (o), .imm = (i) }
+/* The map fd is filled in when loaded. */
+#define	EBPF_LD_MAP(d)							\
+	EBPF_INSN(BPF_LD + BPF_DW + BPF_IMM, (d), BPF_PSEUDO_MAP_FD, 0, 0), \
+	EBPF_INSN(0, 0, 0, 0, 0)
+#define	EBPF_ETHER(o)		((int)sizeof(struct ether_header) + (o))
+#define	EBPF_UDP(o)		((int)sizeof(struct ether_header) + \
+				 (int)sizeof(struct udphdr) + (o))
+
+/* r6 holds the frame for the BPF_ABS and BPF_IND loads,
+ * r7 the flags of the view and r8 the IP header length. */
+static const struct bpf_insn bpf_bootp_ebpf[] = {
+	EBPF_INSN(BPF_ALU64 + BPF_MOV + BPF_X, BPF_REG_6, BPF_REG_1, 0, 0),
+
+	/* Find the view for the interface. */
+	EBPF_INSN(BPF_LDX + BPF_W + BPF_MEM, BPF_REG_2, BPF_REG_6,
+	    offsetof(struct __sk_buff, ifindex), 0),
+	EBPF_INSN(BPF_STX + BPF_W + BPF_MEM, BPF_REG_10, BPF_REG_2, -4, 0),
+	EBPF_INSN(BPF_ALU64 + BPF_MOV + BPF_X, BPF_REG_2, BPF_REG_10, 0, 0),
+	EBPF_INSN(BPF_ALU64 + BPF_ADD + BPF_K, BPF_REG_2, 0, 0, -4),
+#define	EBPF_IFMAP		5
+	EBPF_LD_MAP(BPF_REG_1),
+	EBPF_INSN(BPF_JMP + BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+	EBPF_INSN(BPF_JMP + BPF_JEQ + BPF_K, BPF_REG_0, 0, 28, 0),
+	EBPF_INSN(BPF_LDX + BPF_W + BPF_MEM, BPF_REG_7, BPF_REG_0, 0, 0),
+
+	/* Make sure this is an IP packet. */
+	EBPF_INSN(BPF_LD + BPF_H + BPF_ABS, 0, 0, 0,
+	    offsetof(struct ether_header, ether_type)),
+	EBPF_INSN(BPF_JMP + BPF_JNE + BPF_K, BPF_REG_0, 0, 25, ETHERTYPE_IP),
+
+	/* Make sure it's an IPv4 packet. */
+	EBPF_INSN(BPF_LD + BPF_B + BPF_ABS, 0, 0, 0, EBPF_ETHER(0)),
+	EBPF_INSN(BPF_ALU + BPF_AND + BPF_K, BPF_REG_0, 0, 0, 0xf0),
+	EBPF_INSN(BPF_JMP + BPF_JNE + BPF_K, BPF_REG_0, 0, 22, 0x40),
+
+	/* Make sure it's a UDP packet. */
+	EBPF_INSN(BPF_LD + BPF_B + BPF_ABS, 0, 0, 0,
+	    EBPF_ETHER(offsetof(struct ip, ip_p))),
+	EBPF_INSN(BPF_JMP + BPF_JNE + BPF_K, BPF_REG_0, 0, 20, IPPROTO_UDP),
+
+	/* Make sure this isn't a fragment. */
+	EBPF_INSN(BPF_LD + BPF_H + BPF_ABS, 0, 0, 0,
+	    EBPF_ETHER(offsetof(struct ip, ip_off))),
+	EBPF_INSN(BPF_JMP + BPF_JSET + BPF_K, BPF_REG_0, 0, 18, 0x1fff),
+
+	/* Advance to the UDP header. */
+	EBPF_INSN(BPF_LD + BPF_B + BPF_ABS, 0, 0, 0, EBPF_ETHER(0)),
+	EBPF_INSN(BPF_ALU + BPF_AND + BPF_K, BPF_REG_0, 0, 0, 0x0f),
+	EBPF_INSN(BPF_ALU + BPF_LSH + BPF_K, BPF_REG_0, 0, 0, 2),
+	EBPF_INSN(BPF_ALU64 + BPF_MOV + BPF_X, BPF_REG_8, BPF_REG_0, 0, 0),
+
+	/* Make sure it's from and to the right port. */
+	EBPF_INSN(BPF_LD + BPF_W + BPF_IND, 0, BPF_REG_8, 0, EBPF_ETHER(0)),
+	EBPF_INSN(BPF_JMP + BPF_JNE + BPF_K, BPF_REG_0, 0, 12,
+	    (BOOTPS << 16) + BOOTPC),
+
+	/* Make sure it's for a transaction of ours if the view wants. */
+	EBPF_INSN(BPF_JMP + BPF_JSET + BPF_K, BPF_REG_7, 0, 1, BPF_VIEW_XID),
+	EBPF_INSN(BPF_JMP + BPF_JA, 0, 0, 8, 0),
+	EBPF_INSN(BPF_LD + BPF_W + BPF_IND, 0, BPF_REG_8, 0,
+	    EBPF_UDP(offsetof(struct bootp, xid))),
+	EBPF_INSN(BPF_STX + BPF_W + BPF_MEM, BPF_REG_10, BPF_REG_0, -8, 0),
+	EBPF_INSN(BPF_ALU64 + BPF_MOV + BPF_X, BPF_REG_2, BPF_REG_10, 0, 0),
+	EBPF_INSN(BPF_ALU64 + BPF_ADD + BPF_K, BPF_REG_2, 0, 0, -8),
+#define	EBPF_XIDMAP		31
+	EBPF_LD_MAP(BPF_REG_1),
+	EBPF_INSN(BPF_JMP + BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+	EBPF_INSN(BPF_JMP + BPF_JEQ + BPF_K, BPF_REG_0, 0, 2, 0),
+
+	/* All passed, return the packet. */
+	EBPF_INSN(BPF_ALU64 + BPF_MOV + BPF_K, BPF_REG_0, 0, 0,
+	    BPF_WHOLEPACKET),
+	EBPF_INSN(BPF_JMP + BPF_EXIT, 0, 0, 0, 0),
+	EBPF_INSN(BPF_ALU64 + BPF_MOV + BPF_K, BPF_REG_0, 0, 0, 0),
+	EBPF_INSN(BPF_JMP + BPF_EXIT, 0, 0, 0, 0),
+};
+
+static int
+bpf_sys(int cmd, union bpf_attr *attr)
+{
+
+	return (int)syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int
+bpf_map_new(unsigned int max_entries)
+{
+	union bpf_attr attr = {
+		.map_type = BPF_MAP_TYPE_HASH,
+		.key_size = sizeof(uint32_t),
+		.value_size = sizeof(uint32_t),
+		.max_entries = max_entries,
+		.map_flags = BPF_F_NO_PREALLOC,
+	};
+
+	return bpf_sys(BPF_MAP_CREATE, &attr);
+}
+
+static int
+bpf_map_get(int fd, uint32_t key, uint32_t *value)
+{
+	union bpf_attr attr = {
+		.map_fd = (uint32_t)fd,
+		.key = (uintptr_t)&key,
+		.value = (uintptr_t)value,
+	};
+
+	return bpf_sys(BPF_MAP_LOOKUP_ELEM, &attr);
+}
+
+static int
+bpf_map_set(int fd, uint32_t key, uint32_t value)
+{
+	union bpf_attr attr = {
+		.map_fd = (uint32_t)fd,
+		.key = (uintptr_t)&key,
+		.value = (uintptr_t)&value,
+		.flags = BPF_ANY,
+	};
+
+	return bpf_sys(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+static int
+bpf_map_del(int fd, uint32_t key)
+{
+	union bpf_attr attr = {
+		.map_fd = (uint32_t)fd,
+		.key = (uintptr_t)&key,
+	};
+
+	return bpf_sys(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+static int
+bpf_attach_ebpf(struct bpf *bpf)
+{
+	struct bpf_insn prog[__arraycount(bpf_bootp_ebpf)];
+	union bpf_attr attr = {
+		.prog_type = BPF_PROG_TYPE_SOCKET_FILTER,
+		.insns = (uintptr_t)prog,
+		.insn_cnt = __arraycount(prog),
+		.license = (uintptr_t)"BSD",
+	};
+	int fd;
+
+	bpf->bpf_ifmap = bpf_map_new(BPF_VIEW_MAX);
+	if (bpf->bpf_ifmap == -1)
+		goto err;
+	bpf->bpf_xidmap = bpf_map_new(BPF_VIEW_MAX * 2);
+	if (bpf->bpf_xidmap == -1)
+		goto err;
+
+	memcpy(prog, bpf_bootp_ebpf, sizeof(prog));
+	prog[EBPF_IFMAP].imm = bpf->bpf_ifmap;
+	prog[EBPF_XIDMAP].imm = bpf->bpf_xidmap;
+	fd = bpf_sys(BPF_PROG_LOAD, &attr);
+	if (fd == -1)
+		goto err;
+	if (setsockopt(bpf->bpf_fd, SOL_SOCKET, SO_ATTACH_BPF,
+	    &fd, sizeof(fd)) == -1)
+	{
+		close(fd);
+		goto err;
+	}
+	/* The socket holds the program now. */
+	close(fd);
+	return 0;
+
+err:
+	logdebug("%s: eBPF", __func__);
+	if (bpf->bpf_ifmap != -1) {
+		close(bpf->bpf_ifmap);
+		bpf->bpf_ifmap = -1;
+	}
+	if (bpf->bpf_xidmap != -1) {
+		close(bpf->bpf_xidmap);
+		bpf->bpf_xidmap = -1;
+	}
+	return -1;
+}
+
+static int
+bpf_xid_ref(const struct bpf *master, uint32_t xid)
+{
+	uint32_t n;
+
+	if (bpf_map_get(master->bpf_xidmap, xid, &n) == -1) {
+		if (errno != ENOENT)
+			return -1;
+		n = 0;
+	}
+	return bpf_map_set(master->bpf_xidmap, xid, n + 1);
+}
+
+static void
+bpf_xid_unref(const struct bpf *master, const uint32_t *xids, size_t nxids)
+{
+	uint32_t n;
+
+	for (; nxids != 0; nxids--, xids++) {
+		if (bpf_map_get(master->bpf_xidmap, *xids, &n) == -1)
+			continue;
+		if (n > 1)
+			bpf_map_set(master->bpf_xidmap, *xids, n - 1);
+		else
+			bpf_map_del(master->bpf_xidmap, *xids);
+	}
+}
+#endif
+
+/* Match the frames for a view in the kernel, by xid if xidfilter.
+ * The new xids are added before the old ones go so we don't drop
+ * a reply in between. */
+int
+bpf_filter_view(struct bpf *bpf, bool xidfilter,
+    const uint32_t *xids, size_t nxids)
+{
+#ifdef __NR_bpf
+	const struct bpf *master = bpf->bpf_master;
+	size_t i;
+
+	if (master->bpf_ifmap == -1)
+		return 0;
+	assert(nxids <= __arraycount(bpf->bpf_xids));
+	for (i = 0; i < nxids; i++) {
+		if (bpf_xid_ref(master, xids[i]) == -1) {
+			bpf_xid_unref(master, xids, i);
+			return -1;
+		}
+	}
+	bpf_xid_unref(master, bpf->bpf_xids, bpf->bpf_nxids);
+	memcpy(bpf->bpf_xids, xids, nxids * sizeof(*xids));
+	bpf->bpf_nxids = nxids;
+	return bpf_map_set(master->bpf_ifmap, bpf->bpf_ifindex,
+	    xidfilter ? BPF_VIEW_XID : 0);
+#else
+	UNUSED(bpf);
+	UNUSED(xidfilter);
+	UNUSED(xids);
+	UNUSED(nxids);
+	return 0;
+#endif
+}
+
+static int
+bpf_bootp_shared(const struct bpf *bpf, const struct in_addr *ia)
+{
+
+#ifdef __NR_bpf
+	if (bpf_attach_ebpf(UNCONST(bpf)) == 0)
+		return bpf_lock(bpf->bpf_fd);
+#endif
+	return bpf_bootp(bpf, ia);
+}
+
+static void
+bpf_shared_read(void *arg)
+{
+	struct bpf *master = arg, *bpf;
+	void *frame;
+	ssize_t bytes;
+	int ifindex;
+	unsigned int idx;
+
+	/* As dhcp_readbpf(), a view may close the shared socket. */
+	master->bpf_flags &= ~(BPF_EOF | BPF_CLOSED);
+	master->bpf_flags |= BPF_READING;
+	while (!(master->bpf_flags & BPF_EOF)) {
+		bytes = bpf_recv(master, &frame, &ifindex);
+		if (bytes == -1) {
+			logerr(__func__);
+			break;
+		}
+		if (bytes == 0)
+			break;
+		idx = (unsigned int)ifindex;
+		bpf = rb_tree_find_node(&master->bpf_views, &idx);
+		if (bpf == NULL || bpf->bpf_cb == NULL)
+			continue;
+
+		bpf->bpf_frame = frame;
+		bpf->bpf_frame_len = (size_t)bytes;
+		bpf->bpf_time = master->bpf_time;
+		bpf->bpf_flags &= ~(BPF_PARTIALCSUM | BPF_CSUMVALID | BPF_BCAST);
+		bpf->bpf_flags |=
+		    master->bpf_flags & (BPF_PARTIALCSUM | BPF_CSUMVALID);
+		if (bpf_frame_bcast(bpf->bpf_ifp, frame) == 0)
+			bpf->bpf_flags |= BPF_BCAST;
+		/* The view may be freed once this returns. */
+		bpf->bpf_cb(bpf->bpf_cb_arg);
+	}
+	master->bpf_flags &= ~BPF_READING;
+	if (master->bpf_flags & BPF_CLOSED)
+		bpf_close(master);
+}
+
+/* Open the shared socket before any view needs it.
+ * The pooled privsep BPF helper does this while it still can. */
+int
+bpf_open_shared(struct dhcpcd_ctx *ctx)
+{
+	struct bpf *master;
+
+	if (ctx->bpf_master != NULL)
+		return 0;
+	master = bpf_open_socket(NULL, 0, bpf_bootp_shared, NULL);
+	if (master == NULL)
+		return -1;
+	rb_tree_init(&master->bpf_views, &bpf_view_ops);
+	if (eloop_event_add(ctx->eloop, master->bpf_fd,
+	    bpf_shared_read, master) == -1)
+	{
+		bpf_close(master);
+		return -1;
+	}
+	ctx->bpf_master = master;
+	return 0;
+}
+
+static struct bpf *
+bpf_open_view(const struct interface *ifp)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct bpf *master, *bpf;
+
+	if (bpf_open_shared(ctx) == -1)
+		return NULL;
+	master = ctx->bpf_master;
+
+	bpf = calloc(1, sizeof(*bpf));
+	if (bpf == NULL)
+		goto err;
+	bpf->bpf_ifp = ifp;
+	bpf->bpf_fd = bpf->bpf_ifmap = bpf->bpf_xidmap = -1;
+	bpf->bpf_master = master;
+	bpf->bpf_ifindex = ifp->index;
+	if (rb_tree_insert_node(&master->bpf_views, bpf) != bpf) {
+		free(bpf);
+		errno = EEXIST;
+		goto err;
+	}
+	if (bpf_bootp(bpf, NULL) == -1) {
+		bpf_close(bpf);
+		return NULL;
+	}
+	return bpf;
+
+err:
+	if (RB_TREE_MIN(&master->bpf_views) == NULL)
+		bpf_close_view(NULL, ctx);
+	return NULL;
+}
+
+/* Detach a view and close the shared socket with the last one.
+ * A NULL view just closes an unused shared socket. */
+void
+bpf_close_view(struct bpf *bpf, struct dhcpcd_ctx *ctx)
+{
+	struct bpf *master = ctx->bpf_master;
+
+	if (bpf != NULL) {
+#ifdef __NR_bpf
+		if (master->bpf_ifmap != -1) {
+			bpf_xid_unref(master, bpf->bpf_xids, bpf->bpf_nxids);
+			bpf_map_del(master->bpf_ifmap, bpf->bpf_ifindex);
+		}
+#endif
+		rb_tree_remove_node(&master->bpf_views, bpf);
+		bpf->bpf_master = NULL;
+	}
+	if (RB_TREE_MIN(&master->bpf_views) != NULL)
+		return;
+	/* The pooled privsep BPF helper could not open it again. */
+	if (bpf != NULL && IN_PRIVSEP(ctx))
+		return;
+	eloop_event_delete(ctx->eloop, master->bpf_fd);
+	bpf_close(master);
+	ctx->bpf_master = NULL;
+}
+
+ssize_t
+bpf_send_view(const struct bpf *bpf, uint16_t protocol,
+    struct iovec *iov, int iovcnt)
+{
+	struct sockaddr_ll sll = {
+		.sll_family = PF_PACKET,
+		.sll_protocol = htons(protocol),
+		.sll_ifindex = (int)bpf->bpf_ifindex,
+	};
+	struct msghdr msg = {
+		.msg_name = &sll,
+		.msg_namelen = sizeof(sll),
+		.msg_iov = iov,
+		.msg_iovlen = (size_t)iovcnt,
+	};
+
+	return sendmsg(bpf->bpf_master->bpf_fd, &msg, 0);
+}
+
+struct bpf *
+bpf_open(const struct interface *ifp,
+    int (*filter)(const struct bpf *, const struct in_addr *),
+    const struct in_addr *ia)
+{
+
+	/* Under privsep only the pooled BPF helper has the shared socket. */
+	if (filter == bpf_bootp && ifp->ctx->shared_bpf &&
+	    ifp->hwtype == ARPHRD_ETHER &&
+	    (!IN_PRIVSEP(ifp->ctx) || ifp->ctx->bpf_master != NULL))
+		return bpf_open_view(ifp);
+	return bpf_open_socket(ifp, ifp->index, filter, ia);
+}
+
+ssize_t
+bpf_read(struct bpf *bpf, void **frame)
+{
+
+	if (bpf->bpf_master != NULL) {
+		/* bpf_shared_read() queues one frame at a time. */
+		bpf->bpf_flags |= BPF_EOF;
+		if (bpf->bpf_frame == NULL)
+			return 0;
+		*frame = bpf->bpf_frame;
+		bpf->bpf_frame = NULL;
+		return (ssize_t)bpf->bpf_frame_len;
+	}
+	return bpf_recv(bpf, frame, NULL);
 }
 
 int
@@ -1799,14 +3111,21 @@ bpf_attach(int s, void *filter, unsigned int filter_len)
 	/* Install the filter. */
 	if (setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &pf, sizeof(pf)) == -1)
 		return -1;
+	return 0;
+}
+
+int
+bpf_lock(int s)
+{
 
 #ifdef SO_LOCK_FILTER
 	int on = 1;
 
 	if (setsockopt(s, SOL_SOCKET, SO_LOCK_FILTER, &on, sizeof(on)) == -1)
 		return -1;
+#else
+	UNUSED(s);
 #endif
-
 	return 0;
 }
 
@@ -1875,6 +3194,78 @@ __unused const struct in_addr *addr, __unused const char *alias)
 #endif
 
 #ifdef INET6
+static int
+if_address6_send(struct dhcpcd_ctx *ctx, struct priv *priv)
+{
+	struct sockaddr_nl snl = { .nl_family = AF_NETLINK };
+	struct iovec iov = {
+		.iov_base = priv->addr6_buf,
+		.iov_len = priv->addr6_len,
+	};
+	struct msghdr msg = {
+	    .msg_name = &snl, .msg_namelen = sizeof(snl),
+	    .msg_iov = &iov, .msg_iovlen = 1
+	};
+	struct nlmsghdr *hdr = (struct nlmsghdr *)priv->addr6_buf;
+	int errs[NETLINK_BATCH_MAX];
+	size_t i, n = priv->addr6_n;
+	ssize_t r;
+	int failed = 0;
+
+	if (n == 0)
+		return 0;
+
+#ifdef PRIVSEP
+	if (ctx->options & DHCPCD_PRIVSEP)
+		r = ps_root_sendnetlinkbatch(ctx, NETLINK_ROUTE, &msg,
+		    errs, n);
+	else
+#else
+	UNUSED(ctx);
+#endif
+	if (sendmsg(priv->route_fd, &msg, 0) == -1)
+		r = -1;
+	else
+		r = if_getnetlinkacks(priv->route_fd, hdr->nlmsg_seq, errs, n);
+	if (r == -1) {
+		for (i = 0; i < n; i++)
+			errs[i] = errno;
+	}
+
+	priv->addr6_n = 0;
+	priv->addr6_len = 0;
+	for (i = 0; i < n; i++) {
+		if (errs[i] == 0)
+			continue;
+		failed++;
+		if (priv->addr6_cb != NULL)
+			priv->addr6_cb(priv->addr6_ia[i],
+			    priv->addr6_flags[i], errs[i]);
+	}
+	return failed == 0 ? 0 : -1;
+}
+
+static int
+if_address6_queue(struct priv *priv, struct nlmsghdr *hdr,
+    const struct ipv6_addr *ia)
+{
+	struct dhcpcd_ctx *ctx = ia->iface->ctx;
+	size_t len = NLMSG_ALIGN(hdr->nlmsg_len);
+
+	if (priv->addr6_n == NETLINK_BATCH_MAX ||
+	    priv->addr6_len + len > sizeof(priv->addr6_buf))
+		if_address6_send(ctx, priv);
+
+	hdr->nlmsg_flags |= NLM_F_ACK;
+	hdr->nlmsg_seq = (uint32_t)++ctx->seq;
+	memcpy(priv->addr6_buf + priv->addr6_len, hdr, hdr->nlmsg_len);
+	priv->addr6_len += len;
+	priv->addr6_ia[priv->addr6_n] = UNCONST(ia);
+	priv->addr6_flags[priv->addr6_n] = ia->flags;
+	priv->addr6_n++;
+	return 0;
+}
+
 int
 if_address6(unsigned char cmd, const struct ipv6_addr *ia)
 {
@@ -1933,10 +3324,43 @@ if_address6(unsigned char cmd, const struct ipv6_addr *ia)
 		    &cinfo, sizeof(cinfo));
 	}
 
+	if (cmd == RTM_NEWADDR) {
+		struct priv *priv = (struct priv *)ia->iface->ctx->priv;
+
+		if (priv != NULL && priv->addr6_batch != 0)
+			return if_address6_queue(priv, &nlm.hdr, ia);
+	}
+
 	return if_sendnetlink(ia->iface->ctx, NETLINK_ROUTE, &nlm.hdr,
 	    NULL, NULL);
 }
 
+void
+if_address6_batch(struct dhcpcd_ctx *ctx,
+    void (*cb)(struct ipv6_addr *, unsigned int, int))
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+
+	if (priv == NULL)
+		return;
+	/* Batches nest, the outermost one sends. */
+	if (priv->addr6_batch++ == 0)
+		priv->addr6_cb = cb;
+}
+
+int
+if_address6_commit(struct dhcpcd_ctx *ctx)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	int r;
+
+	if (priv == NULL || priv->addr6_batch == 0 || --priv->addr6_batch != 0)
+		return 0;
+	r = if_address6_send(ctx, priv);
+	priv->addr6_cb = NULL;
+	return r;
+}
+
 int
 if_addrflags6(const struct interface *ifp, const struct in6_addr *addr,
     __unused const char *alias)
@@ -1988,13 +3412,6 @@ if_getlifetime6(__unused struct ipv6_addr *ia)
 	return -1;
 }
 
-struct nlml
-{
-	struct nlmsghdr hdr;
-	struct ifinfomsg i;
-	char buffer[32];
-};
-
 #ifdef HAVE_IN6_ADDR_GEN_MODE_NONE
 static struct rtattr *
 add_attr_nest(struct nlmsghdr *n, unsigned short maxlen, unsigned short type)
@@ -2136,3 +3553,364 @@ ip6_forwarding(const char *ifname)
 }
 
 #endif /* INET6 */
+
+/* sll_addr is too short for some hardware addresses. */
+#define	IFA_SLL_LEN	(offsetof(struct sockaddr_ll, sll_addr) + HWADDR_LEN)
+
+struct if_nlifaddrs {
+	struct ifaddrs		ifa;	/* must be first */
+	struct if_ifadata	data;
+	char			name[IF_NAMESIZE];
+	union {
+		struct sockaddr		sa;
+		struct sockaddr_ll	sll;
+		struct sockaddr_in	sin;
+		struct sockaddr_in6	sin6;
+		uint8_t			buf[IFA_SLL_LEN];
+	} addr;
+	union sa_ss		netmask, brd;
+};
+
+struct if_nlwalk {
+	struct ifaddrs		*nw_head;
+	struct ifaddrs		**nw_tail;
+	struct if_nlifaddrs	*nw_link;	/* last link looked up */
+	int			nw_error;
+};
+
+/* Dumps go on our route socket, leaving the link socket to events. */
+static int
+if_dumpnetlink(struct dhcpcd_ctx *ctx, struct nlmsghdr *hdr,
+    int (*cb)(struct dhcpcd_ctx *, void *, struct nlmsghdr *), void *cbarg)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct sockaddr_nl snl = { .nl_family = AF_NETLINK };
+	struct iovec iov = { .iov_base = hdr, .iov_len = hdr->nlmsg_len };
+	struct msghdr msg = {
+	    .msg_name = &snl, .msg_namelen = sizeof(snl),
+	    .msg_iov = &iov, .msg_iovlen = 1
+	};
+	unsigned char buf[32 * 1024];
+	struct iovec riov = {
+		.iov_base = buf,
+		.iov_len = sizeof(buf),
+	};
+
+	hdr->nlmsg_flags |= NLM_F_ACK;
+	hdr->nlmsg_seq = (uint32_t)++ctx->seq;
+	if ((unsigned int)ctx->seq > UINT32_MAX)
+		ctx->seq = 0;
+
+	if (sendmsg(priv->route_fd, &msg, 0) == -1)
+		return -1;
+	return if_getnetlink(ctx, &riov, priv->route_fd, 0, cb, cbarg);
+}
+
+static void
+if_nlappend(struct if_nlwalk *nw, struct if_nlifaddrs *nifa)
+{
+
+	nifa->ifa.ifa_name = nifa->name;
+	nifa->ifa.ifa_data = &nifa->data;
+	*nw->nw_tail = &nifa->ifa;
+	nw->nw_tail = &nifa->ifa.ifa_next;
+}
+
+static void
+if_nllinkinfo(struct dhcpcd_ctx *ctx, struct if_nlifaddrs *nifa,
+    struct rtattr *linkinfo)
+{
+	struct rtattr *rta, *data = NULL;
+	size_t len = RTA_PAYLOAD(linkinfo);
+	const char *kind = NULL;
+	bool tuntype = false;
+
+	for (rta = RTA_DATA(linkinfo); RTA_OK(rta, len);
+	    rta = RTA_NEXT(rta, len))
+	{
+		switch (rta->rta_type) {
+		case IFLA_INFO_KIND:
+			kind = RTA_DATA(rta);
+			break;
+		case IFLA_INFO_DATA:
+			data = rta;
+			break;
+		}
+	}
+	if (kind == NULL)
+		return;
+
+	if (strcmp(kind, "bridge") == 0) {
+		nifa->data.ifd_ignore = true;
+		return;
+	}
+	if (strcmp(kind, "vlan") != 0 && strcmp(kind, "tun") != 0)
+		return;
+
+	if (data != NULL) {
+		len = RTA_PAYLOAD(data);
+		for (rta = RTA_DATA(data); RTA_OK(rta, len);
+		    rta = RTA_NEXT(rta, len))
+		{
+			if (*kind == 'v' && rta->rta_type == IFLA_VLAN_ID &&
+			    RTA_PAYLOAD(rta) >= sizeof(uint16_t))
+				memcpy(&nifa->data.ifd_vlanid, RTA_DATA(rta),
+				    sizeof(nifa->data.ifd_vlanid));
+			else if (*kind == 't' &&
+			    rta->rta_type == IFLA_TUN_TYPE &&
+			    RTA_PAYLOAD(rta) >= sizeof(uint8_t))
+			{
+				tuntype = true;
+				if (*(uint8_t *)RTA_DATA(rta) == IFF_TAP)
+					nifa->data.ifd_ignore = true;
+			}
+		}
+	}
+	if (*kind == 't' && !tuntype)
+		nifa->data.ifd_ignore = if_tap(ctx, nifa->name);
+}
+
+static int
+if_nllink(struct dhcpcd_ctx *ctx, void *arg, struct nlmsghdr *nlm)
+{
+	struct if_nlwalk *nw = arg;
+	struct if_nlifaddrs *nifa;
+	struct ifinfomsg *ifi;
+	struct rtattr *rta, *hwaddr = NULL, *linkinfo = NULL;
+	size_t len;
+
+	if (nlm->nlmsg_type != RTM_NEWLINK)
+		return 0;
+	len = nlm->nlmsg_len - sizeof(*nlm);
+	if (len < sizeof(*ifi)) {
+		nw->nw_error = EBADMSG;
+		return 0;
+	}
+	if ((nifa = calloc(1, sizeof(*nifa))) == NULL) {
+		nw->nw_error = errno;
+		return 0;
+	}
+
+	ifi = NLMSG_DATA(nlm);
+	rta = IFLA_RTA(ifi);
+	len = NLMSG_PAYLOAD(nlm, sizeof(*ifi));
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			strlcpy(nifa->name, RTA_DATA(rta), sizeof(nifa->name));
+			break;
+		case IFLA_ADDRESS:
+			hwaddr = rta;
+			break;
+		case IFLA_LINKINFO:
+			linkinfo = rta;
+			break;
+		}
+	}
+
+	nifa->ifa.ifa_flags = ifi->ifi_flags;
+	nifa->addr.sll.sll_family = AF_PACKET;
+	nifa->addr.sll.sll_ifindex = ifi->ifi_index;
+	nifa->addr.sll.sll_hatype = ifi->ifi_type;
+	if (hwaddr != NULL && RTA_PAYLOAD(hwaddr) <= HWADDR_LEN) {
+		nifa->addr.sll.sll_halen = (unsigned char)RTA_PAYLOAD(hwaddr);
+		memcpy(nifa->addr.buf + offsetof(struct sockaddr_ll, sll_addr),
+		    RTA_DATA(hwaddr), nifa->addr.sll.sll_halen);
+	}
+	nifa->ifa.ifa_addr = &nifa->addr.sa;
+	if (linkinfo != NULL)
+		if_nllinkinfo(ctx, nifa, linkinfo);
+
+	if_nlappend(nw, nifa);
+	return 0;
+}
+
+#if defined(INET) || defined(INET6)
+static struct if_nlifaddrs *
+if_nlfindlink(struct if_nlwalk *nw, unsigned int ifindex)
+{
+	struct ifaddrs *ifa;
+	struct if_nlifaddrs *nifa;
+
+	/* Addresses are dumped by interface. */
+	if (nw->nw_link != NULL &&
+	    (unsigned int)nw->nw_link->addr.sll.sll_ifindex == ifindex)
+		return nw->nw_link;
+
+	for (ifa = nw->nw_head; ifa != NULL; ifa = ifa->ifa_next) {
+		nifa = (struct if_nlifaddrs *)(void *)ifa;
+		if (nifa->addr.sa.sa_family != AF_PACKET)
+			break;
+		if ((unsigned int)nifa->addr.sll.sll_ifindex == ifindex)
+			return nw->nw_link = nifa;
+	}
+	return NULL;
+}
+
+static int
+if_nladdr(__unused struct dhcpcd_ctx *ctx, void *arg, struct nlmsghdr *nlm)
+{
+	struct if_nlwalk *nw = arg;
+	struct if_nlifaddrs *link, *nifa;
+	struct ifaddrmsg *ifa;
+	struct rtattr *rta;
+	size_t len;
+#ifdef INET
+	struct rtattr *address = NULL, *local = NULL, *brd = NULL;
+#endif
+
+	if (nlm->nlmsg_type != RTM_NEWADDR)
+		return 0;
+	len = nlm->nlmsg_len - sizeof(*nlm);
+	if (len < sizeof(*ifa)) {
+		nw->nw_error = EBADMSG;
+		return 0;
+	}
+	ifa = NLMSG_DATA(nlm);
+	switch (ifa->ifa_family) {
+#ifdef INET
+	case AF_INET:
+		break;
+#endif
+#ifdef INET6
+	case AF_INET6:
+		break;
+#endif
+	default:
+		return 0;
+	}
+	if ((link = if_nlfindlink(nw, ifa->ifa_index)) == NULL)
+		return 0;
+	if ((nifa = calloc(1, sizeof(*nifa))) == NULL) {
+		nw->nw_error = errno;
+		return 0;
+	}
+
+	strlcpy(nifa->name, link->name, sizeof(nifa->name));
+	nifa->ifa.ifa_flags = link->ifa.ifa_flags;
+	/* Matches what RTM_NEWADDR messages give us. */
+	nifa->data.ifd_addrflags = ifa->ifa_flags;
+	nifa->addr.sa.sa_family = ifa->ifa_family;
+	nifa->netmask.sa.sa_family = ifa->ifa_family;
+
+	rta = IFA_RTA(ifa);
+	len = NLMSG_PAYLOAD(nlm, sizeof(*ifa));
+	switch (ifa->ifa_family) {
+#ifdef INET
+	case AF_INET:
+		for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+			switch (rta->rta_type) {
+			case IFA_ADDRESS:
+				address = rta;
+				break;
+			case IFA_LOCAL:
+				local = rta;
+				break;
+			case IFA_BROADCAST:
+				if (!(nifa->ifa.ifa_flags & IFF_POINTOPOINT))
+					brd = rta;
+				break;
+			case IFA_LABEL:
+				strlcpy(nifa->name, RTA_DATA(rta),
+				    sizeof(nifa->name));
+				break;
+			}
+		}
+		/* IFA_ADDRESS is the peer on point to point links. */
+		if (nifa->ifa.ifa_flags & IFF_POINTOPOINT)
+			brd = address;
+		if (local == NULL)
+			local = address;
+		if (local != NULL)
+			memcpy(&nifa->addr.sin.sin_addr, RTA_DATA(local),
+			    sizeof(nifa->addr.sin.sin_addr));
+		if (brd != NULL) {
+			nifa->brd.sin.sin_family = AF_INET;
+			memcpy(&nifa->brd.sin.sin_addr, RTA_DATA(brd),
+			    sizeof(nifa->brd.sin.sin_addr));
+			nifa->ifa.ifa_broadaddr = &nifa->brd.sa;
+		}
+		inet_cidrtoaddr(ifa->ifa_prefixlen,
+		    &nifa->netmask.sin.sin_addr);
+		break;
+#endif
+#ifdef INET6
+	case AF_INET6:
+		for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+			if (rta->rta_type == IFA_ADDRESS)
+				memcpy(&nifa->addr.sin6.sin6_addr,
+				    RTA_DATA(rta),
+				    sizeof(nifa->addr.sin6.sin6_addr));
+		}
+		if (IN6_IS_ADDR_LINKLOCAL(&nifa->addr.sin6.sin6_addr))
+			nifa->addr.sin6.sin6_scope_id = ifa->ifa_index;
+		ipv6_mask(&nifa->netmask.sin6.sin6_addr, ifa->ifa_prefixlen);
+		break;
+#endif
+	}
+
+	nifa->ifa.ifa_addr = &nifa->addr.sa;
+	nifa->ifa.ifa_netmask = &nifa->netmask.sa;
+	if_nlappend(nw, nifa);
+	return 0;
+}
+#endif
+
+/* Links come first, then their addresses.
+ * If ifname is given, only that interface is listed. */
+int
+if_getifaddrs_nl(struct dhcpcd_ctx *ctx, struct ifaddrs **ifap,
+    const char *ifname)
+{
+	struct if_nlwalk nw = { .nw_head = NULL, .nw_tail = &nw.nw_head };
+	struct nlml nlm = {
+	    .hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+	    .hdr.nlmsg_type = RTM_GETLINK,
+	    .hdr.nlmsg_flags = NLM_F_REQUEST,
+	};
+#if defined(INET) || defined(INET6)
+	struct nlma nlma = {
+	    .hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg)),
+	    .hdr.nlmsg_type = RTM_GETADDR,
+	    .hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+	};
+#endif
+	int r;
+
+	if (ifname == NULL)
+		nlm.hdr.nlmsg_flags |= NLM_F_DUMP;
+	else if (add_attr_l(&nlm.hdr, sizeof(nlm), IFLA_IFNAME,
+	    ifname, (unsigned short)(strlen(ifname) + 1)) == -1)
+		return -1;
+
+	r = if_dumpnetlink(ctx, &nlm.hdr, if_nllink, &nw);
+	/* The interface has gone already. */
+	if (r == -1 && ifname != NULL && errno == ENODEV)
+		r = 0;
+#if defined(INET) || defined(INET6)
+	if (r != -1 && nw.nw_error == 0 && nw.nw_head != NULL)
+		r = if_dumpnetlink(ctx, &nlma.hdr, if_nladdr, &nw);
+#endif
+	if (r != -1 && nw.nw_error != 0) {
+		errno = nw.nw_error;
+		r = -1;
+	}
+	if (r == -1) {
+		if_freeifaddrs_nl(nw.nw_head);
+		return -1;
+	}
+
+	*ifap = nw.nw_head;
+	return 0;
+}
+
+void
+if_freeifaddrs_nl(struct ifaddrs *ifaddrs)
+{
+	struct ifaddrs *ifa;
+
+	while ((ifa = ifaddrs) != NULL) {
+		ifaddrs = ifa->ifa_next;
+		free(ifa);
+	}
+}
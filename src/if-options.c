@@ -38,6 +38,7 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <paths.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -53,8 +54,11 @@
 #include "if.h"
 #include "if-options.h"
 #include "ipv4.h"
+#include "leasewb.h"
 #include "logerr.h"
+#include "netconf.h"
 #include "sa.h"
+#include "shard.h"
 
 #define	IN_CONFIG_BLOCK(ifo)	((ifo)->options & DHCPCD_FORKED)
 #define	SET_CONFIG_BLOCK(ifo)	((ifo)->options |= DHCPCD_FORKED)
@@ -165,6 +169,27 @@ const struct option cf_options[] = {
 	{"inactive",        no_argument,       NULL, O_INACTIVE},
 	{"mudurl",          required_argument, NULL, O_MUDURL},
 	{"link_rcvbuf",     required_argument, NULL, O_LINK_RCVBUF},
+	{"stats",           required_argument, NULL, O_STATS},
+	{"leasedb",         no_argument,       NULL, O_LEASEDB},
+	{"parallel_reboot", no_argument,       NULL, O_PARALLEL_REBOOT},
+	{"shared_bpf",      no_argument,       NULL, O_SHARED_BPF},
+	{"shared_dhcp6",    no_argument,       NULL, O_SHARED_DHCP6},
+	{"xidfilter",       no_argument,       NULL, O_XIDFILTER},
+	{"privsep_ring",    no_argument,       NULL, O_PRIVSEP_RING},
+	{"script_jobs",     required_argument, NULL, O_SCRIPT_JOBS},
+	{"script_worker",   no_argument,       NULL, O_SCRIPT_WORKER},
+	{"write_resolv_conf", optional_argument, NULL, O_RESOLV_CONF},
+	{"write_ntp_conf",  optional_argument, NULL, O_NTP_CONF},
+	{"log_ratelimit",   required_argument, NULL, O_LOG_RATELIMIT},
+	{"ipv4ll_probes",   required_argument, NULL, O_IPV4LL_PROBES},
+	{"log_startup",     no_argument,       NULL, O_LOG_STARTUP},
+	{"warmstart",       no_argument,       NULL, O_WARMSTART},
+	{"transmit_rate",   required_argument, NULL, O_TRANSMIT_RATE},
+	{"renew_spread",    required_argument, NULL, O_RENEW_SPREAD},
+	{"shards",          required_argument, NULL, O_SHARDS},
+	{"carrier_debounce", required_argument, NULL, O_CARRIER_DEBOUNCE},
+	{"lease_writeback", required_argument, NULL, O_LEASE_WRITEBACK},
+	{"fastest_server",  no_argument,       NULL, O_FASTESTSERVER},
 	{NULL,              0,                 NULL, '\0'}
 };
 
@@ -486,7 +511,7 @@ parse_addr(__unused struct in_addr *addr, __unused struct in_addr *net,
 }
 #endif
 
-static void
+static int
 set_option_space(struct dhcpcd_ctx *ctx,
     const char *arg,
     const struct dhcp_opt **d, size_t *dl,
@@ -501,28 +526,34 @@ set_option_space(struct dhcpcd_ctx *ctx,
 
 #ifdef INET6
 	if (strncmp(arg, "nd_", strlen("nd_")) == 0) {
+		if (if_optmasks_unshare(ifo) == -1)
+			return -1;
+		load_definitions(ctx, DEFS_ND);
 		*d = ctx->nd_opts;
 		*dl = ctx->nd_opts_len;
 		*od = ifo->nd_override;
 		*odl = ifo->nd_override_len;
-		*request = ifo->requestmasknd;
-		*require = ifo->requiremasknd;
-		*no = ifo->nomasknd;
-		*reject = ifo->rejectmasknd;
-		return;
+		*request = ifo->masks->requestmasknd;
+		*require = ifo->masks->requiremasknd;
+		*no = ifo->masks->nomasknd;
+		*reject = ifo->masks->rejectmasknd;
+		return 0;
 	}
 
 #ifdef DHCP6
 	if (strncmp(arg, "dhcp6_", strlen("dhcp6_")) == 0) {
+		if (if_optmasks_unshare(ifo) == -1)
+			return -1;
+		load_definitions(ctx, DEFS_DHCP6);
 		*d = ctx->dhcp6_opts;
 		*dl = ctx->dhcp6_opts_len;
 		*od = ifo->dhcp6_override;
 		*odl = ifo->dhcp6_override_len;
-		*request = ifo->requestmask6;
-		*require = ifo->requiremask6;
-		*no = ifo->nomask6;
-		*reject = ifo->rejectmask6;
-		return;
+		*request = ifo->masks->requestmask6;
+		*require = ifo->masks->requiremask6;
+		*no = ifo->masks->nomask6;
+		*reject = ifo->masks->rejectmask6;
+		return 0;
 	}
 #endif
 #else
@@ -530,6 +561,7 @@ set_option_space(struct dhcpcd_ctx *ctx,
 #endif
 
 #ifdef INET
+	load_definitions(ctx, DEFS_DHCP);
 	*d = ctx->dhcp_opts;
 	*dl = ctx->dhcp_opts_len;
 	*od = ifo->dhcp_override;
@@ -544,6 +576,7 @@ set_option_space(struct dhcpcd_ctx *ctx,
 	*require = ifo->requiremask;
 	*no = ifo->nomask;
 	*reject = ifo->rejectmask;
+	return 0;
 }
 
 void
@@ -552,7 +585,7 @@ free_dhcp_opt_embenc(struct dhcp_opt *opt)
 	size_t i;
 	struct dhcp_opt *o;
 
-	free(opt->var);
+	free(UNCONST(opt->var));
 
 	for (i = 0, o = opt->embopts; i < opt->embopts_len; i++, o++)
 		free_dhcp_opt_embenc(o);
@@ -626,7 +659,7 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 	int e, i, t;
 	long l;
 	unsigned long u;
-	char *p = NULL, *bp, *fp, *np;
+	char *p = NULL, *bp, *fp, *np, **cfp;
 	ssize_t s;
 	struct in_addr addr, addr2;
 	in_addr_t *naddr;
@@ -673,7 +706,8 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 	case 'P': /* FALLTHROUGH */
 	case 'T': /* FALLTHROUGH */
 	case 'U': /* FALLTHROUGH */
-	case 'V': /* We need to handle non interface options */
+	case 'V': /* FALLTHROUGH */
+	case O_STATS: /* We need to handle non interface options */
 		break;
 	case 'b':
 		ifo->options |= DHCPCD_BACKGROUND;
@@ -782,8 +816,9 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 		break;
 	case 'o':
 		ARG_REQUIRED;
-		set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
-		    &request, &require, &no, &reject);
+		if (set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
+		    &request, &require, &no, &reject) == -1)
+			return -1;
 		if (make_option_mask(d, dl, od, odl, request, arg, 1) != 0 ||
 		    make_option_mask(d, dl, od, odl, no, arg, -1) != 0 ||
 		    make_option_mask(d, dl, od, odl, reject, arg, -1) != 0)
@@ -794,8 +829,9 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 		break;
 	case O_REJECT:
 		ARG_REQUIRED;
-		set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
-		    &request, &require, &no, &reject);
+		if (set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
+		    &request, &require, &no, &reject) == -1)
+			return -1;
 		if (make_option_mask(d, dl, od, odl, reject, arg, 1) != 0 ||
 		    make_option_mask(d, dl, od, odl, request, arg, -1) != 0 ||
 		    make_option_mask(d, dl, od, odl, require, arg, -1) != 0)
@@ -1057,8 +1093,9 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 		break;
 	case 'O':
 		ARG_REQUIRED;
-		set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
-		    &request, &require, &no, &reject);
+		if (set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
+		    &request, &require, &no, &reject) == -1)
+			return -1;
 		if (make_option_mask(d, dl, od, odl, request, arg, -1) != 0 ||
 		    make_option_mask(d, dl, od, odl, require, arg, -1) != 0 ||
 		    make_option_mask(d, dl, od, odl, no, arg, 1) != 0)
@@ -1069,8 +1106,9 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 		break;
 	case 'Q':
 		ARG_REQUIRED;
-		set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
-		    &request, &require, &no, &reject);
+		if (set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
+		    &request, &require, &no, &reject) == -1)
+			return -1;
 		if (make_option_mask(d, dl, od, odl, require, arg, 1) != 0 ||
 		    make_option_mask(d, dl, od, odl, request, arg, 1) != 0 ||
 		    make_option_mask(d, dl, od, odl, no, arg, -1) != 0 ||
@@ -1260,8 +1298,10 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 		ifo->fqdn = FQDN_DISABLE;
 
 		/* Block everything */
+		if (if_optmasks_unshare(ifo) == -1)
+			return -1;
 		memset(ifo->nomask, 0xff, sizeof(ifo->nomask));
-		memset(ifo->nomask6, 0xff, sizeof(ifo->nomask6));
+		memset(ifo->masks->nomask6, 0xff, sizeof(ifo->masks->nomask6));
 
 		/* Allow the bare minimum through */
 #ifdef INET
@@ -1279,10 +1319,10 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 #endif
 
 #ifdef DHCP6
-		del_option_mask(ifo->nomask6, D6_OPTION_DNS_SERVERS);
-		del_option_mask(ifo->nomask6, D6_OPTION_DOMAIN_LIST);
-		del_option_mask(ifo->nomask6, D6_OPTION_SOL_MAX_RT);
-		del_option_mask(ifo->nomask6, D6_OPTION_INF_MAX_RT);
+		del_option_mask(ifo->masks->nomask6, D6_OPTION_DNS_SERVERS);
+		del_option_mask(ifo->masks->nomask6, D6_OPTION_DOMAIN_LIST);
+		del_option_mask(ifo->masks->nomask6, D6_OPTION_SOL_MAX_RT);
+		del_option_mask(ifo->masks->nomask6, D6_OPTION_INF_MAX_RT);
 #endif
 
 		break;
@@ -1307,8 +1347,9 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
 		break;
 	case O_DESTINATION:
 		ARG_REQUIRED;
-		set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
-		    &request, &require, &no, &reject);
+		if (set_option_space(ctx, arg, &d, &dl, &od, &odl, ifo,
+		    &request, &require, &no, &reject) == -1)
+			return -1;
 		if (make_option_mask(d, dl, od, odl,
 		    ifo->dstmask, arg, 2) != 0)
 		{
@@ -2186,6 +2227,235 @@ invalid_token:
 	case O_NOUP:
 		ifo->options &= ~DHCPCD_IF_UP;
 		break;
+	case O_PARALLEL_REBOOT:
+		ifo->options |= DHCPCD_PARALLEL_REBOOT;
+		break;
+	case O_XIDFILTER:
+		ifo->xidfilter = true;
+		break;
+	case O_FASTESTSERVER:
+		ifo->fastest_server = true;
+		break;
+	case O_SHARED_BPF:
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("%s: shared_bpf is a global option", ifname);
+			return -1;
+		}
+#ifdef INET
+		ctx->shared_bpf = true;
+#endif
+		break;
+	case O_SHARED_DHCP6:
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("%s: shared_dhcp6 is a global option", ifname);
+			return -1;
+		}
+#ifdef DHCP6
+		ctx->dhcp6_shared = true;
+#endif
+		break;
+	case O_PRIVSEP_RING:
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("%s: privsep_ring is a global option", ifname);
+			return -1;
+		}
+#ifdef PRIVSEP
+		ctx->ps_ring = true;
+#endif
+		break;
+	case O_SCRIPT_JOBS:
+		ARG_REQUIRED;
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("%s: script_jobs is a global option", ifname);
+			return -1;
+		}
+		ctx->script_max = (unsigned int)strtou(arg, NULL, 0,
+		    1, UINT16_MAX, &e);
+		if (e) {
+			logerrx("failed to convert script_jobs %s", arg);
+			return -1;
+		}
+		break;
+	case O_SCRIPT_WORKER:
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("%s: script_worker is a global option",
+			    ifname);
+			return -1;
+		}
+		ctx->script_worker = true;
+		break;
+	case O_RESOLV_CONF:
+	case O_NTP_CONF:
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("%s: %s is a global option", ifname,
+			    opt == O_RESOLV_CONF ?
+			    "write_resolv_conf" : "write_ntp_conf");
+			return -1;
+		}
+		cfp = opt == O_RESOLV_CONF ?
+		    &ctx->resolv_conf : &ctx->ntp_conf;
+		free(*cfp);
+		*cfp = NULL;
+		if (arg == NULL || *arg == '\0')
+			arg = opt == O_RESOLV_CONF ?
+			    NETCONF_RESOLV_CONF : NETCONF_NTP_CONF;
+		s = parse_nstring(NULL, 0, arg);
+		if (s == -1 || (*cfp = malloc((size_t)s)) == NULL ||
+		    parse_nstring(*cfp, (size_t)s, arg) == -1 ||
+		    **cfp != '/')
+		{
+			if (*cfp != NULL && **cfp != '/')
+				logerrx("%s: must be an absolute path", *cfp);
+			else
+				logerr(__func__);
+			free(*cfp);
+			*cfp = NULL;
+			return -1;
+		}
+		break;
+	case O_LOG_RATELIMIT:
+		ARG_REQUIRED;
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("%s: log_ratelimit is a global option", ifname);
+			return -1;
+		}
+		fp = strchr(arg, '/');
+		if (fp != NULL)
+			*fp++ = '\0';
+		u = (unsigned long)strtou(arg, NULL, 0, 0, UINT16_MAX, &e);
+		if (e) {
+			logerrx("failed to convert log_ratelimit %s", arg);
+			return -1;
+		}
+		if (fp == NULL)
+			l = 1;
+		else {
+			l = (long)strtou(fp, NULL, 0, 1, UINT16_MAX, &e);
+			if (e) {
+				logerrx("failed to convert log_ratelimit "
+				    "interval %s", fp);
+				return -1;
+			}
+		}
+		logsetratelimit((unsigned int)u, (unsigned int)l);
+		break;
+	case O_IPV4LL_PROBES:
+		ARG_REQUIRED;
+		ifo->ipv4ll_probes = (unsigned int)strtou(arg, NULL, 0,
+		    1, IPV4LL_PROBES_MAX, &e);
+		if (e) {
+			logerrx("failed to convert ipv4ll_probes %s", arg);
+			return -1;
+		}
+		break;
+	case O_LOG_STARTUP:
+		ifo->log_startup = true;
+		break;
+	case O_WARMSTART:
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("%s: warmstart is a global option", ifname);
+			return -1;
+		}
+		ctx->warmstart = true;
+		/* What we leave behind is adopted by the next run. */
+		ifo->options |= DHCPCD_PERSISTENT;
+		break;
+	case O_TRANSMIT_RATE:
+		ARG_REQUIRED;
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("%s: transmit_rate is a global option", ifname);
+			return -1;
+		}
+		fp = strchr(arg, '/');
+		if (fp != NULL)
+			*fp++ = '\0';
+		u = (unsigned long)strtou(arg, NULL, 0, 0, UINT16_MAX, &e);
+		if (e) {
+			logerrx("failed to convert transmit_rate %s", arg);
+			return -1;
+		}
+		if (fp == NULL)
+			l = (long)u;
+		else {
+			l = (long)strtou(fp, NULL, 0, 1, UINT16_MAX, &e);
+			if (e) {
+				logerrx("failed to convert transmit_rate "
+				    "burst %s", fp);
+				return -1;
+			}
+		}
+		ctx->tx_rate = (unsigned int)u;
+		ctx->tx_burst = l == 0 ? 1 : (unsigned int)l;
+		ctx->tx_tokens = ctx->tx_burst * 1000;
+		break;
+	case O_RENEW_SPREAD:
+		ARG_REQUIRED;
+		ifo->renew_spread = (unsigned int)strtou(arg, NULL, 0,
+		    0, 50, &e);
+		if (e) {
+			logerrx("failed to convert renew_spread %s", arg);
+			return -1;
+		}
+		break;
+	case O_CARRIER_DEBOUNCE:
+		ARG_REQUIRED;
+		fp = strchr(arg, '/');
+		if (fp != NULL)
+			*fp++ = '\0';
+		ifo->carrier_down = (unsigned int)strtou(arg, NULL, 0,
+		    0, CARRIER_DEBOUNCE_MAX, &e);
+		if (e) {
+			logerrx("failed to convert carrier_debounce %s", arg);
+			return -1;
+		}
+		if (fp == NULL)
+			ifo->carrier_up = ifo->carrier_down;
+		else {
+			ifo->carrier_up = (unsigned int)strtou(fp, NULL, 0,
+			    0, CARRIER_DEBOUNCE_MAX, &e);
+			if (e) {
+				logerrx("failed to convert carrier_debounce "
+				    "up %s", fp);
+				return -1;
+			}
+		}
+		break;
+	case O_SHARDS:
+		ARG_REQUIRED;
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("%s: shards is a global option", ifname);
+			return -1;
+		}
+		u = (unsigned long)strtou(arg, NULL, 0, 0, SHARD_MAX, &e);
+		if (e) {
+			logerrx("failed to convert shards %s", arg);
+			return -1;
+		}
+		/* Interfaces are shared out once, when we start. */
+		if (!(ctx->options & DHCPCD_STARTED))
+			ctx->shards = (unsigned int)u;
+		break;
+	case O_LEASEDB:
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("%s: leasedb is a global option", ifname);
+			return -1;
+		}
+		ifo->options |= DHCPCD_LEASEDB;
+		break;
+	case O_LEASE_WRITEBACK:
+		ARG_REQUIRED;
+		if (IN_CONFIG_BLOCK(ifo)) {
+			logerrx("%s: lease_writeback is a global option",
+			    ifname);
+			return -1;
+		}
+		ctx->lease_writeback = (unsigned int)strtou(arg, NULL, 0,
+		    0, LEASEWB_MAX, &e);
+		if (e) {
+			logerrx("failed to convert lease_writeback %s", arg);
+			return -1;
+		}
+		break;
 	case O_SLAAC:
 		ARG_REQUIRED;
 		np = strwhite(arg);
@@ -2248,6 +2518,126 @@ arg_required:
 #endif
 }
 
+/* Which digest an option is hashed into, or -1 if it changes nothing
+ * about how an interface is configured. */
+static int
+if_options_digestof(int opt)
+{
+
+	switch (opt) {
+	case 'b': /* FALLTHROUGH */
+	case 'c': /* FALLTHROUGH */
+	case 'd': /* FALLTHROUGH */
+	case 'f': /* FALLTHROUGH */
+	case 'g': /* FALLTHROUGH */
+	case 'j': /* FALLTHROUGH */
+	case 'n': /* FALLTHROUGH */
+	case 'q': /* FALLTHROUGH */
+	case 'x': /* FALLTHROUGH */
+	case 'z': /* FALLTHROUGH */
+	case 'B': /* FALLTHROUGH */
+	case 'M': /* FALLTHROUGH */
+	case 'N': /* FALLTHROUGH */
+	case 'P': /* FALLTHROUGH */
+	case 'T': /* FALLTHROUGH */
+	case 'U': /* FALLTHROUGH */
+	case 'V': /* FALLTHROUGH */
+	case 'Z': /* FALLTHROUGH */
+	case O_STATS: /* FALLTHROUGH */
+	case O_CONTROLGRP: /* FALLTHROUGH */
+	case O_SHARED_BPF: /* FALLTHROUGH */
+	case O_SHARED_DHCP6: /* FALLTHROUGH */
+	case O_PRIVSEP_RING: /* FALLTHROUGH */
+	case O_SCRIPT_JOBS: /* FALLTHROUGH */
+	case O_SCRIPT_WORKER: /* FALLTHROUGH */
+	case O_RESOLV_CONF: /* FALLTHROUGH */
+	case O_NTP_CONF: /* FALLTHROUGH */
+	case O_LOG_RATELIMIT: /* FALLTHROUGH */
+	case O_WARMSTART: /* FALLTHROUGH */
+	case O_TRANSMIT_RATE: /* FALLTHROUGH */
+	case O_SHARDS: /* FALLTHROUGH */
+	case O_LEASEDB: /* FALLTHROUGH */
+	case O_LEASE_WRITEBACK:
+		return -1;
+	case 'l': /* FALLTHROUGH */
+	case 'r': /* FALLTHROUGH */
+	case 's': /* FALLTHROUGH */
+	case 'A': /* FALLTHROUGH */
+	case 'I': /* FALLTHROUGH */
+	case 'J': /* FALLTHROUGH */
+	case 'L': /* FALLTHROUGH */
+	case 'W': /* FALLTHROUGH */
+	case 'X': /* FALLTHROUGH */
+	case O_ARPING: /* FALLTHROUGH */
+	case O_DESTINATION: /* FALLTHROUGH */
+	case O_BOOTP: /* FALLTHROUGH */
+	case O_DHCP: /* FALLTHROUGH */
+	case O_NODHCP: /* FALLTHROUGH */
+	case O_XIDFILTER: /* FALLTHROUGH */
+	case O_IPV4LL_PROBES:
+		return IFO_DIGEST_DHCP;
+	case O_IPV6RA_AUTOCONF: /* FALLTHROUGH */
+	case O_IPV6RA_NOAUTOCONF: /* FALLTHROUGH */
+	case O_IPV6RA_FORK:
+		return IFO_DIGEST_IPV6ND;
+	case O_INFORM6: /* FALLTHROUGH */
+	case O_IA_NA: /* FALLTHROUGH */
+	case O_IA_TA: /* FALLTHROUGH */
+	case O_IA_PD: /* FALLTHROUGH */
+	case O_DHCP6: /* FALLTHROUGH */
+	case O_NODHCP6:
+		return IFO_DIGEST_DHCP6;
+	case 'k': /* FALLTHROUGH */
+	case 'w': /* FALLTHROUGH */
+	case O_PARALLEL_REBOOT:
+		return IFO_DIGEST_NORESTART;
+	default:
+		return IFO_DIGEST_ANY;
+	}
+}
+
+/* FNV-1a, before parse_option() writes into the argument. */
+static void
+if_options_digest(struct if_options *ifo, int opt, const char *arg)
+{
+	int d = if_options_digestof(opt);
+	uint32_t h;
+	size_t i;
+	const uint8_t *p;
+
+	if (d == -1)
+		return;
+	h = ifo->digest[d];
+	for (p = (const uint8_t *)&opt, i = 0; i < sizeof(opt); i++) {
+		h ^= p[i];
+		h *= 16777619U;
+	}
+	/* With the NUL, so "a" "b" is not "ab" and NULL is not "". */
+	if (arg != NULL) {
+		for (p = (const uint8_t *)arg; ; p++) {
+			h ^= *p;
+			h *= 16777619U;
+			if (*p == '\0')
+				break;
+		}
+	}
+	ifo->digest[d] = h;
+}
+
+/* The digests which differ, as IFO_CHANGED() bits. */
+unsigned int
+if_options_changed(const uint32_t *old, const uint32_t *new)
+{
+	unsigned int changed = 0;
+	int d;
+
+	for (d = 0; d < IFO_DIGEST_MAX; d++) {
+		if (old[d] != new[d])
+			changed |= 1U << d;
+	}
+	return changed;
+}
+
 static int
 parse_config_line(struct dhcpcd_ctx *ctx, const char *ifname,
     struct if_options *ifo, const char *opt, char *line,
@@ -2265,6 +2655,7 @@ parse_config_line(struct dhcpcd_ctx *ctx, const char *ifname,
 			return -1;
 		}
 
+		if_options_digest(ifo, cf_options[i].val, line);
 		return parse_option(ctx, ifname, ifo, cf_options[i].val, line,
 		    ldop, edop);
 	}
@@ -2307,21 +2698,29 @@ struct if_options *
 default_config(struct dhcpcd_ctx *ctx)
 {
 	struct if_options *ifo;
+	int i;
 
 	/* Seed our default options */
-	if ((ifo = calloc(1, sizeof(*ifo))) == NULL) {
+	if ((ifo = calloc(1, sizeof(*ifo))) == NULL ||
+	    (ifo->masks = calloc(1, sizeof(*ifo->masks))) == NULL)
+	{
 		logerr(__func__);
+		free(ifo);
 		return NULL;
 	}
+	ifo->masks->refs = 1;
 	ifo->options |= DHCPCD_IF_UP | DHCPCD_LINK | DHCPCD_INITIAL_DELAY;
 	ifo->timeout = DEFAULT_TIMEOUT;
 	ifo->reboot = DEFAULT_REBOOT;
+	ifo->ipv4ll_probes = 1;
 	ifo->metric = -1;
 	ifo->auth.options |= DHCPCD_AUTH_REQUIRE;
 	rb_tree_init(&ifo->routes, &rt_compare_list_ops);
 #ifdef AUTH
 	TAILQ_INIT(&ifo->auth.tokens);
 #endif
+	for (i = 0; i < IFO_DIGEST_MAX; i++)
+		ifo->digest[i] = 2166136261U;
 
 	/* Inherit some global defaults */
 	if (ctx->options & DHCPCD_PERSISTENT)
@@ -2332,188 +2731,298 @@ default_config(struct dhcpcd_ctx *ctx)
 	return ifo;
 }
 
-struct if_options *
-read_config(struct dhcpcd_ctx *ctx,
-    const char *ifname, const char *ssid, const char *profile)
+/* dhcpcd.conf is split into its lines just once.
+ * Each interface then applies the global lines and its own blocks,
+ * stepping over the blocks of everything else. */
+struct cf_line {
+	const char *cl_option;
+	const char *cl_arg;
+	size_t cl_next;		/* a block starts, this is where it ends */
+	bool cl_block;
+};
+
+struct cf_cache {
+	char *cc_buf;
+	struct cf_line *cc_lines;
+	size_t cc_nlines;
+	char *cc_arg;
+	size_t cc_arglen;
+	time_t cc_mtime;
+};
+
+void
+free_config(struct dhcpcd_ctx *ctx)
+{
+	struct cf_cache *cc = ctx->cf_cache;
+
+	if (cc == NULL)
+		return;
+	free(cc->cc_buf);
+	free(cc->cc_lines);
+	free(cc->cc_arg);
+	free(cc);
+	ctx->cf_cache = NULL;
+}
+
+static void
+free_opts(struct dhcp_opt **opts, size_t *len, const struct dhcp_opt *builtin)
 {
-	struct if_options *ifo;
-	char buf[UDPLEN_MAX], *bp; /* 64k max config file size */
-	char *line, *option, *p;
-	ssize_t buflen;
-	size_t vlen;
-	int skip, have_profile, new_block, had_block;
-#if !defined(INET) || !defined(INET6)
-	size_t i;
 	struct dhcp_opt *opt;
+	size_t i;
+
+	/* The built in tables are not ours to free. */
+	if (*opts != NULL && *opts != builtin) {
+		for (i = 0, opt = *opts; i < *len; i++, opt++)
+			free_dhcp_opt_embenc(opt);
+		free(*opts);
+	}
+	*opts = NULL;
+	*len = 0;
+}
+
+void
+free_definitions(struct dhcpcd_ctx *ctx)
+{
+#ifdef EMBEDDED_CONFIG
+#define	BUILTIN(a)	NULL
+#else
+#define	BUILTIN(a)	(a)
 #endif
-	struct dhcp_opt *ldop, *edop;
 
-	/* Seed our default options */
-	if ((ifo = default_config(ctx)) == NULL)
-		return NULL;
-	if (default_options == 0) {
-		default_options |= DHCPCD_DAEMONISE | DHCPCD_GATEWAY;
 #ifdef INET
-		skip = socket(PF_INET, SOCK_DGRAM, 0);
-		if (skip != -1) {
-			close(skip);
-			default_options |= DHCPCD_IPV4 | DHCPCD_ARP |
-			    DHCPCD_DHCP | DHCPCD_IPV4LL;
-		}
+	free_opts(&ctx->dhcp_opts, &ctx->dhcp_opts_len,
+	    BUILTIN(dhcpcd_embedded_opts));
+	dhcp_optmap_free(&ctx->dhcp_optmap);
 #endif
 #ifdef INET6
-		skip = socket(PF_INET6, SOCK_DGRAM, 0);
-		if (skip != -1) {
-			close(skip);
-			default_options |= DHCPCD_IPV6 | DHCPCD_IPV6RS |
-			    DHCPCD_IPV6RA_AUTOCONF | DHCPCD_IPV6RA_REQRDNSS |
-			    DHCPCD_DHCP6;
-		}
+	free_opts(&ctx->nd_opts, &ctx->nd_opts_len,
+	    BUILTIN(dhcpcd_embedded_ndopts));
+	dhcp_optmap_free(&ctx->nd_optmap);
+#ifdef DHCP6
+	free_opts(&ctx->dhcp6_opts, &ctx->dhcp6_opts_len,
+	    BUILTIN(dhcpcd_embedded_dhcp6opts));
+	dhcp_optmap_free(&ctx->dhcp6_optmap);
 #endif
-#ifdef PLUGIN_DEV
-		default_options |= DHCPCD_DEV;
 #endif
-	}
-	ifo->options |= default_options;
+	free_opts(&ctx->vivso, &ctx->vivso_len,
+	    BUILTIN(dhcpcd_embedded_vivso));
+	dhcp_optmap_free(&ctx->vivso_map);
+#undef BUILTIN
+	ctx->defs_loaded = 0;
+}
 
-	CLEAR_CONFIG_BLOCK(ifo);
+#ifdef EMBEDDED_CONFIG
+/* The define starting each block of the definitions file,
+ * embed and encap belong to the block they are in. */
+static const struct {
+	const char *name;
+	unsigned int space;
+} def_spaces[] = {
+	{ "define",	DEFS_DHCP },
+	{ "definend",	DEFS_ND },
+	{ "define6",	DEFS_DHCP6 },
+	{ "vendopt",	DEFS_VIVSO },
+};
 
-	vlen = strlcpy((char *)ifo->vendorclassid + 1, ctx->vendor,
-	    sizeof(ifo->vendorclassid) - 1);
-	ifo->vendorclassid[0] = (uint8_t)(vlen > 255 ? 0 : vlen);
+static void
+load_definitions_file(struct dhcpcd_ctx *ctx, unsigned int spaces)
+{
+	struct if_options *ifo;
+	char buf[UDPLEN_MAX], *bp; /* 64k max config file size */
+	char *line, *p;
+	const char *option;
+	ssize_t buflen;
+	struct dhcp_opt *ldop = NULL, *edop = NULL;
+	unsigned int space = 0;
+	size_t i;
 
-	/* Reset route order */
-	ctx->rt_order = 0;
+	/* Only the defines are parsed into this. */
+	ifo = calloc(1, sizeof(*ifo));
+	if (ifo == NULL) {
+		logerr(__func__);
+		return;
+	}
 
-	/* Parse our embedded options file */
-	if (ifname == NULL && !(ctx->options & DHCPCD_PRINT_PIDFILE)) {
-		/* Space for initial estimates */
+	/* Space for initial estimates */
 #if defined(INET) && defined(INITDEFINES)
+	if (spaces & DEFS_DHCP) {
 		ifo->dhcp_override =
 		    calloc(INITDEFINES, sizeof(*ifo->dhcp_override));
 		if (ifo->dhcp_override == NULL)
 			logerr(__func__);
 		else
 			ifo->dhcp_override_len = INITDEFINES;
+	}
 #endif
-
 #if defined(INET6) && defined(INITDEFINENDS)
+	if (spaces & DEFS_ND) {
 		ifo->nd_override =
 		    calloc(INITDEFINENDS, sizeof(*ifo->nd_override));
 		if (ifo->nd_override == NULL)
 			logerr(__func__);
 		else
 			ifo->nd_override_len = INITDEFINENDS;
+	}
 #endif
-#if defined(INET6) && defined(INITDEFINE6S)
+#if defined(DHCP6) && defined(INITDEFINE6S)
+	if (spaces & DEFS_DHCP6) {
 		ifo->dhcp6_override =
 		    calloc(INITDEFINE6S, sizeof(*ifo->dhcp6_override));
 		if (ifo->dhcp6_override == NULL)
 			logerr(__func__);
 		else
 			ifo->dhcp6_override_len = INITDEFINE6S;
+	}
 #endif
 
-		/* Now load our embedded config */
-#ifdef EMBEDDED_CONFIG
-		buflen = dhcp_readfile(ctx, EMBEDDED_CONFIG, buf, sizeof(buf));
-		if (buflen == -1) {
-			logerr("%s: %s", __func__, EMBEDDED_CONFIG);
-			return ifo;
-		}
-		if (buf[buflen - 1] != '\0') {
-			if ((size_t)buflen < sizeof(buf) - 1)
-				buflen++;
-			buf[buflen - 1] = '\0';
-		}
-#else
-		buflen = (ssize_t)strlcpy(buf, dhcpcd_embedded_conf,
-		    sizeof(buf));
-		if ((size_t)buflen >= sizeof(buf)) {
-			logerrx("%s: embedded config too big", __func__);
-			return ifo;
+	buflen = dhcp_readfile(ctx, EMBEDDED_CONFIG, buf, sizeof(buf));
+	if (buflen == -1) {
+		logerr("%s: %s", __func__, EMBEDDED_CONFIG);
+		free(ifo->dhcp_override);
+		free(ifo->nd_override);
+		free(ifo->dhcp6_override);
+		free(ifo);
+		return;
+	}
+	if (buf[buflen - 1] != '\0') {
+		if ((size_t)buflen < sizeof(buf) - 1)
+			buflen++;
+		buf[buflen - 1] = '\0';
+	}
+	bp = buf;
+	while ((line = get_line(&bp, &buflen)) != NULL) {
+		option = strsep(&line, " \t");
+		if (line)
+			line = strskipwhite(line);
+		/* Trim trailing whitespace */
+		if (line) {
+			p = line + strlen(line) - 1;
+			while (p != line &&
+			    (*p == ' ' || *p == '\t') &&
+			    *(p - 1) != '\\')
+				*p-- = '\0';
 		}
-		/* Our embedded config is NULL terminated */
-#endif
-		bp = buf;
-		while ((line = get_line(&bp, &buflen)) != NULL) {
-			option = strsep(&line, " \t");
-			if (line)
-				line = strskipwhite(line);
-			/* Trim trailing whitespace */
-			if (line) {
-				p = line + strlen(line) - 1;
-				while (p != line &&
-				    (*p == ' ' || *p == '\t') &&
-				    *(p - 1) != '\\')
-					*p-- = '\0';
+		for (i = 0; i < __arraycount(def_spaces); i++) {
+			if (strcmp(option, def_spaces[i].name) == 0) {
+				space = def_spaces[i].space;
+				break;
 			}
+		}
+		if (space & spaces)
 			parse_config_line(ctx, NULL, ifo, option, line,
 			    &ldop, &edop);
-		}
+	}
 
 #ifdef INET
+	if (spaces & DEFS_DHCP) {
 		ctx->dhcp_opts = ifo->dhcp_override;
 		ctx->dhcp_opts_len = ifo->dhcp_override_len;
-#else
-		for (i = 0, opt = ifo->dhcp_override;
-		    i < ifo->dhcp_override_len;
-		    i++, opt++)
-			free_dhcp_opt_embenc(opt);
-		free(ifo->dhcp_override);
+	}
 #endif
-		ifo->dhcp_override = NULL;
-		ifo->dhcp_override_len = 0;
-
 #ifdef INET6
+	if (spaces & DEFS_ND) {
 		ctx->nd_opts = ifo->nd_override;
 		ctx->nd_opts_len = ifo->nd_override_len;
+	}
 #ifdef DHCP6
+	if (spaces & DEFS_DHCP6) {
 		ctx->dhcp6_opts = ifo->dhcp6_override;
 		ctx->dhcp6_opts_len = ifo->dhcp6_override_len;
+	}
 #endif
-#else
-		for (i = 0, opt = ifo->nd_override;
-		    i < ifo->nd_override_len;
-		    i++, opt++)
-			free_dhcp_opt_embenc(opt);
-		free(ifo->nd_override);
-		for (i = 0, opt = ifo->dhcp6_override;
-		    i < ifo->dhcp6_override_len;
-		    i++, opt++)
-			free_dhcp_opt_embenc(opt);
-		free(ifo->dhcp6_override);
 #endif
-		ifo->nd_override = NULL;
-		ifo->nd_override_len = 0;
-		ifo->dhcp6_override = NULL;
-		ifo->dhcp6_override_len = 0;
-
+	if (spaces & DEFS_VIVSO) {
 		ctx->vivso = ifo->vivso_override;
 		ctx->vivso_len = ifo->vivso_override_len;
-		ifo->vivso_override = NULL;
-		ifo->vivso_override_len = 0;
 	}
+	free(ifo);
+}
+#endif
 
-	/* Parse our options file */
-	buflen = dhcp_readfile(ctx, ctx->cffile, buf, sizeof(buf));
+/*
+ * Definitions are only loaded for a space once something needs it,
+ * such as the protocol starting on an interface or the config naming
+ * one of its options, so a single stack host never loads the others.
+ */
+void
+load_definitions(struct dhcpcd_ctx *ctx, unsigned int spaces)
+{
+
+#ifndef INET
+	spaces &= ~DEFS_DHCP;
+#endif
+#ifndef INET6
+	spaces &= ~DEFS_ND;
+#endif
+#ifndef DHCP6
+	spaces &= ~DEFS_DHCP6;
+#endif
+	spaces &= ~ctx->defs_loaded;
+	if (spaces == 0)
+		return;
+	/* Even if loading fails, don't try again until reloaded. */
+	ctx->defs_loaded |= spaces;
+
+#ifdef EMBEDDED_CONFIG
+	load_definitions_file(ctx, spaces);
+#else
+	/* The built in definitions were parsed at build time. */
+#ifdef INET
+	if (spaces & DEFS_DHCP) {
+		ctx->dhcp_opts = dhcpcd_embedded_opts;
+		ctx->dhcp_opts_len = dhcpcd_embedded_opts_len;
+	}
+#endif
+#ifdef INET6
+	if (spaces & DEFS_ND) {
+		ctx->nd_opts = dhcpcd_embedded_ndopts;
+		ctx->nd_opts_len = dhcpcd_embedded_ndopts_len;
+	}
+#ifdef DHCP6
+	if (spaces & DEFS_DHCP6) {
+		ctx->dhcp6_opts = dhcpcd_embedded_dhcp6opts;
+		ctx->dhcp6_opts_len = dhcpcd_embedded_dhcp6opts_len;
+	}
+#endif
+#endif
+	if (spaces & DEFS_VIVSO) {
+		ctx->vivso = dhcpcd_embedded_vivso;
+		ctx->vivso_len = dhcpcd_embedded_vivso_len;
+	}
+#endif
+}
+
+static struct cf_cache *
+load_config(struct dhcpcd_ctx *ctx)
+{
+	struct cf_cache *cc;
+	struct cf_line *cl;
+	char *bp, *line, *option, *p;
+	ssize_t buflen;
+	size_t n, len, block = SIZE_MAX;
+
+	if ((cc = calloc(1, sizeof(*cc))) == NULL ||
+	    (cc->cc_buf = malloc(UDPLEN_MAX)) == NULL)
+		goto err;
+	buflen = dhcp_readfile(ctx, ctx->cffile, cc->cc_buf, UDPLEN_MAX);
 	if (buflen == -1) {
 		/* dhcpcd can continue without it, but no DNS options
 		 * would be requested ... */
 		logerr("%s: %s", __func__, ctx->cffile);
-		return ifo;
+		goto out;
 	}
-	if (buf[buflen - 1] != '\0') {
-		if ((size_t)buflen < sizeof(buf) - 1)
+	if (cc->cc_buf[buflen - 1] != '\0') {
+		if (buflen < UDPLEN_MAX - 1)
 			buflen++;
-		buf[buflen - 1] = '\0';
+		cc->cc_buf[buflen - 1] = '\0';
 	}
-	dhcp_filemtime(ctx, ctx->cffile, &ifo->mtime);
+	dhcp_filemtime(ctx, ctx->cffile, &cc->cc_mtime);
+	/* Only keep what we read. */
+	if ((bp = realloc(cc->cc_buf, (size_t)buflen)) != NULL)
+		cc->cc_buf = bp;
 
-	ldop = edop = NULL;
-	skip = have_profile = new_block = 0;
-	had_block = ifname == NULL ? 1 : 0;
-	bp = buf;
+	n = 0;
+	bp = cc->cc_buf;
 	while ((line = get_line(&bp, &buflen)) != NULL) {
 		option = strsep(&line, " \t");
 		if (line)
@@ -2526,6 +3035,140 @@ read_config(struct dhcpcd_ctx *ctx,
 			    *(p - 1) != '\\')
 				*p-- = '\0';
 		}
+
+		if (cc->cc_nlines == n) {
+			n = n == 0 ? 64 : n * 2;
+			cl = reallocarray(cc->cc_lines, n, sizeof(*cl));
+			if (cl == NULL)
+				goto err;
+			cc->cc_lines = cl;
+		}
+		cl = &cc->cc_lines[cc->cc_nlines];
+		cl->cl_option = option;
+		cl->cl_arg = line;
+		cl->cl_next = 0;
+		cl->cl_block = strcmp(option, "interface") == 0 ||
+		    strcmp(option, "ssid") == 0 ||
+		    strcmp(option, "profile") == 0;
+		if (cl->cl_block) {
+			if (block != SIZE_MAX)
+				cc->cc_lines[block].cl_next = cc->cc_nlines;
+			block = cc->cc_nlines;
+		}
+		if (line != NULL && (len = strlen(line) + 1) > cc->cc_arglen)
+			cc->cc_arglen = len;
+		cc->cc_nlines++;
+	}
+	if (block != SIZE_MAX)
+		cc->cc_lines[block].cl_next = cc->cc_nlines;
+	if (cc->cc_arglen != 0 &&
+	    (cc->cc_arg = malloc(cc->cc_arglen)) == NULL)
+		goto err;
+	return cc;
+
+err:
+	logerr(__func__);
+out:
+	if (cc != NULL) {
+		free(cc->cc_buf);
+		free(cc->cc_lines);
+		free(cc);
+	}
+	return NULL;
+}
+
+static void
+add_ifcv(struct dhcpcd_ctx *ctx, const char *ifname)
+{
+	char **n;
+
+	n = reallocarray(ctx->ifcv, (size_t)ctx->ifcc + 1, sizeof(char *));
+	if (n == NULL) {
+		logerr(__func__);
+		return;
+	}
+	ctx->ifcv = n;
+	ctx->ifcv[ctx->ifcc] = strdup(ifname);
+	if (ctx->ifcv[ctx->ifcc] == NULL) {
+		logerr(__func__);
+		return;
+	}
+	ctx->ifcc++;
+}
+
+struct if_options *
+read_config(struct dhcpcd_ctx *ctx,
+    const char *ifname, const char *ssid, const char *profile)
+{
+	struct if_options *ifo;
+	char *line;
+	const char *option;
+	size_t vlen, i;
+	int skip, have_profile, new_block, had_block;
+	struct dhcp_opt *ldop, *edop;
+	struct cf_cache *cc;
+	const struct cf_line *cl;
+	time_t mtime;
+
+	/* Seed our default options */
+	if ((ifo = default_config(ctx)) == NULL)
+		return NULL;
+	if (default_options == 0) {
+		default_options |= DHCPCD_DAEMONISE | DHCPCD_GATEWAY;
+#ifdef INET
+		skip = socket(PF_INET, SOCK_DGRAM, 0);
+		if (skip != -1) {
+			close(skip);
+			default_options |= DHCPCD_IPV4 | DHCPCD_ARP |
+			    DHCPCD_DHCP | DHCPCD_IPV4LL;
+		}
+#endif
+#ifdef INET6
+		skip = socket(PF_INET6, SOCK_DGRAM, 0);
+		if (skip != -1) {
+			close(skip);
+			default_options |= DHCPCD_IPV6 | DHCPCD_IPV6RS |
+			    DHCPCD_IPV6RA_AUTOCONF | DHCPCD_IPV6RA_REQRDNSS |
+			    DHCPCD_DHCP6;
+		}
+#endif
+#ifdef PLUGIN_DEV
+		default_options |= DHCPCD_DEV;
+#endif
+	}
+	ifo->options |= default_options;
+
+	CLEAR_CONFIG_BLOCK(ifo);
+
+	vlen = strlcpy((char *)ifo->vendorclassid + 1, ctx->vendor,
+	    sizeof(ifo->vendorclassid) - 1);
+	ifo->vendorclassid[0] = (uint8_t)(vlen > 255 ? 0 : vlen);
+
+	/* Reset route order */
+	ctx->rt_order = 0;
+
+	/* Reset log rate limiting, the config can set it again */
+	if (ifname == NULL)
+		logsetratelimit(0, 0);
+
+	/* Parse our options file once, each interface reuses it. */
+	cc = ctx->cf_cache;
+	if (ifname == NULL || cc == NULL ||
+	    dhcp_filemtime(ctx, ctx->cffile, &mtime) == -1 ||
+	    mtime != cc->cc_mtime)
+	{
+		free_config(ctx);
+		if ((cc = ctx->cf_cache = load_config(ctx)) == NULL)
+			return ifo;
+	}
+	ifo->mtime = cc->cc_mtime;
+
+	ldop = edop = NULL;
+	skip = have_profile = new_block = 0;
+	had_block = ifname == NULL ? 1 : 0;
+	for (i = 0; i < cc->cc_nlines;) {
+		cl = &cc->cc_lines[i];
+		option = cl->cl_option;
 		if (skip == 0 && new_block) {
 			had_block = 1;
 			new_block = 0;
@@ -2533,64 +3176,50 @@ read_config(struct dhcpcd_ctx *ctx,
 			SET_CONFIG_BLOCK(ifo);
 		}
 
-		/* Start of an interface block, skip if not ours */
-		if (strcmp(option, "interface") == 0) {
-			char **n;
-
+		if (cl->cl_block) {
 			new_block = 1;
-			if (line == NULL) {
-				/* No interface given */
-				skip = 1;
-				continue;
-			}
-			if (ifname && strcmp(line, ifname) == 0)
-				skip = 0;
-			else
-				skip = 1;
-			if (ifname)
-				continue;
-
-			n = reallocarray(ctx->ifcv,
-			    (size_t)ctx->ifcc + 1, sizeof(char *));
-			if (n == NULL) {
-				logerr(__func__);
-				continue;
-			}
-			ctx->ifcv = n;
-			ctx->ifcv[ctx->ifcc] = strdup(line);
-			if (ctx->ifcv[ctx->ifcc] == NULL) {
-				logerr(__func__);
-				continue;
+			/* Start of an interface block, skip if not ours */
+			if (strcmp(option, "interface") == 0) {
+				if (cl->cl_arg == NULL) {
+					/* No interface given */
+					skip = 1;
+				} else if (ifname != NULL)
+					skip = strcmp(cl->cl_arg, ifname) != 0;
+				else {
+					skip = 1;
+					add_ifcv(ctx, cl->cl_arg);
+				}
+			/* Start of an ssid block, skip if not ours */
+			} else if (strcmp(option, "ssid") == 0) {
+				skip = ssid == NULL || cl->cl_arg == NULL ||
+				    strcmp(cl->cl_arg, ssid) != 0;
+			/* Start of a profile block, skip if not ours */
+			} else {
+				if (profile && cl->cl_arg &&
+				    strcmp(cl->cl_arg, profile) == 0) {
+					skip = 0;
+					have_profile = 1;
+				} else
+					skip = 1;
 			}
-			ctx->ifcc++;
-			continue;
-		}
-		/* Start of an ssid block, skip if not ours */
-		if (strcmp(option, "ssid") == 0) {
-			new_block = 1;
-			if (ssid && line && strcmp(line, ssid) == 0)
-				skip = 0;
-			else
-				skip = 1;
-			continue;
-		}
-		/* Start of a profile block, skip if not ours */
-		if (strcmp(option, "profile") == 0) {
-			new_block = 1;
-			if (profile && line && strcmp(line, profile) == 0) {
-				skip = 0;
-				have_profile = 1;
-			} else
-				skip = 1;
+			/* Blocks not ours are not even looked at. */
+			i = skip ? cl->cl_next : i + 1;
 			continue;
 		}
+		i++;
+
 		/* Skip arping if we have selected a profile but not parsing
 		 * one. */
 		if (profile && !have_profile && strcmp(option, "arping") == 0)
 			continue;
-		if (skip)
-			continue;
 
+		/* parse_option writes into the argument, so give it
+		 * a copy to keep ours for the next interface. */
+		if (cl->cl_arg != NULL) {
+			line = cc->cc_arg;
+			strlcpy(line, cl->cl_arg, cc->cc_arglen);
+		} else
+			line = NULL;
 		parse_config_line(ctx, ifname, ifo, option, line, &ldop, &edop);
 	}
 
@@ -2604,6 +3233,7 @@ read_config(struct dhcpcd_ctx *ctx,
 		ifo->options &= ~DHCPCD_WAITOPTS;
 	CLEAR_CONFIG_BLOCK(ifo);
 	finish_config(ifo);
+	if_optmasks_share(ctx, ifo, ifname);
 	return ifo;
 }
 
@@ -2627,6 +3257,7 @@ add_options(struct dhcpcd_ctx *ctx, const char *ifname,
 	    ctx->options & DHCPCD_PRINT_PIDFILE ? NOERR_IF_OPTS : IF_OPTS,
 	    cf_options, &oi)) != -1)
 	{
+		if_options_digest(ifo, opt, optarg);
 		r = parse_option(ctx, ifname, ifo, opt, optarg, NULL, NULL);
 		if (r != 1)
 			break;
@@ -2637,17 +3268,75 @@ add_options(struct dhcpcd_ctx *ctx, const char *ifname,
 	}
 
 	finish_config(ifo);
+	if_optmasks_share(ctx, ifo, ifname);
 	return r;
 }
 
+static void
+if_optmasks_free(struct dhcpcd_ctx *ctx, struct if_optmasks *m)
+{
+
+	if (--m->refs != 0)
+		return;
+	if (m->listed)
+		TAILQ_REMOVE(&ctx->optmasks, m, next);
+	free(m);
+}
+
+/* Copy on write. */
+int
+if_optmasks_unshare(struct if_options *ifo)
+{
+	struct if_optmasks *m;
+
+	if (ifo->masks->refs == 1)
+		return 0;
+	if ((m = malloc(sizeof(*m))) == NULL) {
+		logerr(__func__);
+		return -1;
+	}
+	memcpy(m, ifo->masks, sizeof(*m));
+	m->refs = 1;
+	m->listed = false;
+	ifo->masks->refs--;
+	ifo->masks = m;
+	return 0;
+}
+
+/* Swap our masks for identical ones already in use, if any. */
+void
+if_optmasks_share(struct dhcpcd_ctx *ctx, struct if_options *ifo,
+    const char *ifname)
+{
+	struct if_optmasks *m = ifo->masks, *sm;
+	const size_t off = offsetof(struct if_optmasks, requestmasknd);
+
+	TAILQ_FOREACH(sm, &ctx->optmasks, next) {
+		if (sm != m &&
+		    memcmp((char *)sm + off, (char *)m + off,
+		    sizeof(*m) - off) == 0)
+			break;
+	}
+	if (sm == NULL) {
+		if (!m->listed) {
+			TAILQ_INSERT_TAIL(&ctx->optmasks, m, next);
+			m->listed = true;
+		}
+		return;
+	}
+
+	if_optmasks_free(ctx, m);
+	sm->refs++;
+	ifo->masks = sm;
+	if (ifname != NULL)
+		logdebugx("%s: sharing option masks (%u users, %zu bytes saved)",
+		    ifname, sm->refs, (sm->refs - 1) * sizeof(*sm));
+}
+
 void
 free_options(struct dhcpcd_ctx *ctx, struct if_options *ifo)
 {
 	size_t i;
-#ifdef RT_FREE_ROUTE_TABLE
-	struct interface *ifp;
-	struct rt *rt;
-#endif
 	struct dhcp_opt *opt;
 	struct vivco *vo;
 #ifdef AUTH
@@ -2657,6 +3346,11 @@ free_options(struct dhcpcd_ctx *ctx, struct if_options *ifo)
 	if (ifo == NULL)
 		return;
 
+#if defined(DHCP6) && !defined(SMALL)
+	/* The prefix delegation index points into our options. */
+	ctx->dhcp6_pdvalid = false;
+#endif
+
 	if (ifo->environ) {
 		i = 0;
 		while (ifo->environ[i])
@@ -2670,18 +3364,6 @@ free_options(struct dhcpcd_ctx *ctx, struct if_options *ifo)
 		free(ifo->config);
 	}
 
-#ifdef RT_FREE_ROUTE_TABLE
-	/* Stupidly, we don't know the interface when creating the options.
-	 * As such, make sure each route has one so they can goto the
-	 * free list. */
-	ifp = ctx->ifaces != NULL ? TAILQ_FIRST(ctx->ifaces) : NULL;
-	if (ifp != NULL) {
-		RB_TREE_FOREACH(rt, &ifo->routes) {
-			if (rt->rt_ifp == NULL)
-				rt->rt_ifp = ifp;
-		}
-	}
-#endif
 	rt_headclear0(ctx, &ifo->routes, AF_UNSPEC);
 
 	free(ifo->arping);
@@ -2703,6 +3385,10 @@ free_options(struct dhcpcd_ctx *ctx, struct if_options *ifo)
 	    opt++, ifo->dhcp6_override_len--)
 		free_dhcp_opt_embenc(opt);
 	free(ifo->dhcp6_override);
+	dhcp_optmap_free(&ifo->dhcp_overmap);
+	dhcp_optmap_free(&ifo->nd_overmap);
+	dhcp_optmap_free(&ifo->dhcp6_overmap);
+	dhcp_optmap_free(&ifo->vivso_overmap);
 	for (vo = ifo->vivco;
 	    ifo->vivco_len > 0;
 	    vo++, ifo->vivco_len--)
@@ -2719,14 +3405,12 @@ free_options(struct dhcpcd_ctx *ctx, struct if_options *ifo)
 		free(ifo->ia[ifo->ia_len - 1].sla);
 #endif
 	free(ifo->ia);
+	if_optmasks_free(ctx, ifo->masks);
 
 #ifdef AUTH
 	while ((token = TAILQ_FIRST(&ifo->auth.tokens))) {
 		TAILQ_REMOVE(&ifo->auth.tokens, token, next);
-		if (token->realm_len)
-			free(token->realm);
-		free(token->key);
-		free(token);
+		dhcp_auth_token_free(token);
 	}
 #endif
 	free(ifo);
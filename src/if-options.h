@@ -49,6 +49,8 @@
 
 #define DEFAULT_TIMEOUT		30
 #define DEFAULT_REBOOT		5
+#define IPV4LL_PROBES_MAX	8	/* addresses probed at once */
+#define CARRIER_DEBOUNCE_MAX	60000	/* msecs */
 
 #ifndef HOSTNAME_MAX_LEN
 #define HOSTNAME_MAX_LEN	250	/* 255 - 3 (FQDN) - 2 (DNS enc) */
@@ -65,12 +67,14 @@
 #define DHCPCD_GATEWAY			(1ULL << 3)
 #define DHCPCD_STATIC			(1ULL << 4)
 #define DHCPCD_DEBUG			(1ULL << 5)
+#define DHCPCD_LEASEDB			(1ULL << 6)
 #define DHCPCD_LASTLEASE		(1ULL << 7)
 #define DHCPCD_INFORM			(1ULL << 8)
 #define DHCPCD_REQUEST			(1ULL << 9)
 #define DHCPCD_IPV4LL			(1ULL << 10)
 #define DHCPCD_DUID			(1ULL << 11)
 #define DHCPCD_PERSISTENT		(1ULL << 12)
+#define DHCPCD_PARALLEL_REBOOT		(1ULL << 13)
 #define DHCPCD_DAEMONISE		(1ULL << 14)
 #define DHCPCD_DAEMONISED		(1ULL << 15)
 #define DHCPCD_TEST			(1ULL << 16)
@@ -180,6 +184,27 @@
 #define O_INACTIVE		O_BASE + 47
 #define O_MUDURL		O_BASE + 48
 #define O_MSUSERCLASS		O_BASE + 49
+#define O_STATS			O_BASE + 50
+#define O_LEASEDB		O_BASE + 51
+#define O_PARALLEL_REBOOT	O_BASE + 52
+#define O_SHARED_BPF		O_BASE + 53
+#define O_XIDFILTER		O_BASE + 54
+#define O_PRIVSEP_RING		O_BASE + 55
+#define O_SCRIPT_JOBS		O_BASE + 56
+#define O_SCRIPT_WORKER		O_BASE + 57
+#define O_RESOLV_CONF		O_BASE + 58
+#define O_NTP_CONF		O_BASE + 59
+#define O_LOG_RATELIMIT		O_BASE + 60
+#define O_IPV4LL_PROBES		O_BASE + 61
+#define O_LOG_STARTUP		O_BASE + 62
+#define O_WARMSTART		O_BASE + 63
+#define O_TRANSMIT_RATE		O_BASE + 64
+#define O_RENEW_SPREAD		O_BASE + 65
+#define O_SHARDS		O_BASE + 66
+#define O_CARRIER_DEBOUNCE	O_BASE + 67
+#define O_LEASE_WRITEBACK	O_BASE + 68
+#define O_FASTESTSERVER		O_BASE + 69
+#define O_SHARED_DHCP6		O_BASE + 70
 
 extern const struct option cf_options[];
 
@@ -211,6 +236,37 @@ struct vivco {
 	uint8_t *data;
 };
 
+/* The ND and DHCPv6 masks are 64k between them and are normally the
+ * same for every interface, so interfaces share them where they match.
+ * Call if_optmasks_unshare() before writing to them. */
+struct if_optmasks {
+	TAILQ_ENTRY(if_optmasks) next;
+	unsigned int refs;
+	bool listed;
+	uint8_t requestmasknd[(UINT16_MAX + 1) / NBBY];
+	uint8_t requiremasknd[(UINT16_MAX + 1) / NBBY];
+	uint8_t nomasknd[(UINT16_MAX + 1) / NBBY];
+	uint8_t rejectmasknd[(UINT16_MAX + 1) / NBBY];
+	uint8_t requestmask6[(UINT16_MAX + 1) / NBBY];
+	uint8_t requiremask6[(UINT16_MAX + 1) / NBBY];
+	uint8_t nomask6[(UINT16_MAX + 1) / NBBY];
+	uint8_t rejectmask6[(UINT16_MAX + 1) / NBBY];
+};
+TAILQ_HEAD(if_optmasks_head, if_optmasks);
+
+/* Options given to an interface are hashed by the protocol they
+ * configure, so a reload need only restart the protocols whose
+ * options changed. */
+#define	IFO_DIGEST_ANY		0	/* more than one protocol, or unsure */
+#define	IFO_DIGEST_DHCP		1	/* DHCP, IPv4LL and ARP */
+#define	IFO_DIGEST_IPV6ND	2
+#define	IFO_DIGEST_DHCP6	3
+#define	IFO_DIGEST_NORESTART	4	/* taken up as is, such as waitip */
+#define	IFO_DIGEST_MAX		5
+#define	IFO_CHANGED(c, d)	((c) & (1U << (d)))
+#define	IFO_CHANGED_ANY		(1U << IFO_DIGEST_ANY)
+#define	IFO_CHANGED_RESTART	(~(1U << IFO_DIGEST_NORESTART))
+
 struct if_options {
 	time_t mtime;
 	uint8_t iaid[4];
@@ -220,14 +276,7 @@ struct if_options {
 	uint8_t nomask[256 / NBBY];
 	uint8_t rejectmask[256 / NBBY];
 	uint8_t dstmask[256 / NBBY];
-	uint8_t requestmasknd[(UINT16_MAX + 1) / NBBY];
-	uint8_t requiremasknd[(UINT16_MAX + 1) / NBBY];
-	uint8_t nomasknd[(UINT16_MAX + 1) / NBBY];
-	uint8_t rejectmasknd[(UINT16_MAX + 1) / NBBY];
-	uint8_t requestmask6[(UINT16_MAX + 1) / NBBY];
-	uint8_t requiremask6[(UINT16_MAX + 1) / NBBY];
-	uint8_t nomask6[(UINT16_MAX + 1) / NBBY];
-	uint8_t rejectmask6[(UINT16_MAX + 1) / NBBY];
+	struct if_optmasks *masks;
 	uint32_t leasetime;
 	uint32_t timeout;
 	uint32_t reboot;
@@ -240,6 +289,14 @@ struct if_options {
 	struct in6_addr req_addr6;
 	uint8_t req_prefix_len;
 	unsigned int mtu;
+	bool xidfilter;
+	bool fastest_server;		/* hold offers from failing servers */
+	unsigned int ipv4ll_probes;	/* IPv4LL addresses probed at once */
+	bool log_startup;		/* log startup phase timings */
+	unsigned int renew_spread;	/* percent to bring T1/T2 forward */
+	unsigned int carrier_down;	/* msecs carrier must stay lost */
+	unsigned int carrier_up;	/* and back before we act on it */
+	uint32_t digest[IFO_DIGEST_MAX];
 	char **config;
 
 	char **environ;
@@ -274,6 +331,10 @@ struct if_options {
 	size_t vivco_len;
 	struct dhcp_opt *vivso_override;
 	size_t vivso_override_len;
+	struct dhcp_optmap *dhcp_overmap;	/* the overrides by code */
+	struct dhcp_optmap *nd_overmap;
+	struct dhcp_optmap *dhcp6_overmap;
+	struct dhcp_optmap *vivso_overmap;
 
 	struct auth auth;
 };
@@ -285,5 +346,19 @@ int add_options(struct dhcpcd_ctx *, const char *,
     struct if_options *, int, char **);
 void free_dhcp_opt_embenc(struct dhcp_opt *);
 void free_options(struct dhcpcd_ctx *, struct if_options *);
+unsigned int if_options_changed(const uint32_t *, const uint32_t *);
+int if_optmasks_unshare(struct if_options *);
+void if_optmasks_share(struct dhcpcd_ctx *, struct if_options *,
+    const char *);
+void free_config(struct dhcpcd_ctx *);
+
+/* Option definition spaces, each loaded on first use. */
+#define	DEFS_DHCP	0x01U
+#define	DEFS_ND		0x02U
+#define	DEFS_DHCP6	0x04U
+#define	DEFS_VIVSO	0x08U
+#define	DEFS_ALL	(DEFS_DHCP | DEFS_ND | DEFS_DHCP6 | DEFS_VIVSO)
+void load_definitions(struct dhcpcd_ctx *, unsigned int);
+void free_definitions(struct dhcpcd_ctx *);
 
 #endif
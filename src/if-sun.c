@@ -272,14 +272,16 @@ if_getssid(__unused struct interface *ifp)
 
 /* XXX work out TAP interfaces? */
 bool
-if_ignore(__unused struct dhcpcd_ctx *ctx, __unused const char *ifname)
+if_ignore(__unused struct dhcpcd_ctx *ctx, __unused const char *ifname,
+    __unused const void *ifadata)
 {
 
 	return false;
 }
 
 unsigned short
-if_vlanid(__unused const struct interface *ifp)
+if_vlanid(__unused const struct interface *ifp,
+    __unused const void *ifadata)
 {
 
 	return 0;
@@ -803,6 +805,7 @@ if_finishrt(struct dhcpcd_ctx *ctx, struct rt *rt)
 	if (rt->rt_mtu == (unsigned int)mtu)
 		rt->rt_mtu = 0;
 
+	rt_setkey(rt);
 	return 0;
 }
 
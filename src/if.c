@@ -77,6 +77,119 @@
 #include "ipv6nd.h"
 #include "logerr.h"
 #include "privsep.h"
+#include "script.h"
+#include "shard.h"
+#include "snapshot.h"
+
+static int
+if_compare_index(__unused void *context, const void *node1, const void *node2)
+{
+	const struct interface *ifp1 = node1, *ifp2 = node2;
+
+	if (ifp1->index_key < ifp2->index_key)
+		return -1;
+	return ifp1->index_key == ifp2->index_key ? 0 : 1;
+}
+
+static int
+if_compare_indexkey(__unused void *context, const void *node, const void *key)
+{
+	const struct interface *ifp = node;
+	unsigned int idx = *(const unsigned int *)key;
+
+	if (ifp->index_key < idx)
+		return -1;
+	return ifp->index_key == idx ? 0 : 1;
+}
+
+static const rb_tree_ops_t if_compare_index_ops = {
+	.rbto_compare_nodes = if_compare_index,
+	.rbto_compare_key = if_compare_indexkey,
+	.rbto_node_offset = offsetof(struct interface, index_tree),
+	.rbto_context = NULL
+};
+
+static int
+if_compare_name(__unused void *context, const void *node1, const void *node2)
+{
+	const struct interface *ifp1 = node1, *ifp2 = node2;
+
+	return strcmp(ifp1->name, ifp2->name);
+}
+
+static int
+if_compare_namekey(__unused void *context, const void *node, const void *key)
+{
+	const struct interface *ifp = node;
+
+	return strcmp(ifp->name, key);
+}
+
+static const rb_tree_ops_t if_compare_name_ops = {
+	.rbto_compare_nodes = if_compare_name,
+	.rbto_compare_key = if_compare_namekey,
+	.rbto_node_offset = offsetof(struct interface, name_tree),
+	.rbto_context = NULL
+};
+
+void
+if_ctxinit(struct dhcpcd_ctx *ctx)
+{
+
+	rb_tree_init(&ctx->ifindex, &if_compare_index_ops);
+	rb_tree_init(&ctx->ifnames, &if_compare_name_ops);
+#ifdef INET
+	rb_tree_init(&ctx->dhcp_xids, &dhcp_xid_ops);
+#endif
+#ifdef ARP
+	rb_tree_init(&ctx->arp_states, &arp_state_ops);
+#endif
+#ifdef INET6
+	rb_tree_init(&ctx->ipv6_addrs, &ipv6_addr_ops);
+#endif
+}
+
+static void
+if_unindexidx(struct interface *ifp)
+{
+
+	if (ifp->index_key == 0)
+		return;
+	rb_tree_remove_node(&ifp->ctx->ifindex, ifp);
+	ifp->index_key = 0;
+}
+
+/*
+ * File ifp by index and name once it is on ctx->ifaces, so lookups there
+ * don't walk the list. if_free removes it again.
+ * Interfaces are never renamed or re-indexed in place; the kernel
+ * reports that as a departure and an arrival.
+ */
+void
+if_indexctx(struct interface *ifp)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+
+	if (ifp->index != 0 && ifp->index_key == 0) {
+		ifp->index_key = ifp->index;
+		if (rb_tree_insert_node(&ctx->ifindex, ifp) != ifp)
+			ifp->index_key = 0;
+	}
+	if (!ifp->name_indexed &&
+	    rb_tree_insert_node(&ctx->ifnames, ifp) == ifp)
+		ifp->name_indexed = true;
+}
+
+static void
+if_unindex(struct interface *ifp)
+{
+
+	if_unindexidx(ifp);
+	if (ifp->name_indexed) {
+		rb_tree_remove_node(&ifp->ctx->ifnames, ifp);
+		ifp->name_indexed = false;
+	}
+}
 
 void
 if_free(struct interface *ifp)
@@ -84,6 +197,7 @@ if_free(struct interface *ifp)
 
 	if (ifp == NULL)
 		return;
+	if_unindex(ifp);
 #ifdef IPV4LL
 	ipv4ll_free(ifp);
 #endif
@@ -99,7 +213,11 @@ if_free(struct interface *ifp)
 	ipv6_free(ifp);
 #endif
 	rt_freeif(ifp);
+	snapshot_free(ifp);
+	script_freeenv(ifp);
 	free_options(ifp->ctx, ifp->options);
+	/* Whatever the protocols left behind goes with the arena. */
+	arena_dispose(&ifp->arena);
 	free(ifp);
 }
 
@@ -281,16 +399,23 @@ if_learnaddrs(struct dhcpcd_ctx *ctx, struct if_head *ifs,
 #endif
 #ifdef INET6
 	struct sockaddr_in6 *sin6, *net6;
+	uint8_t prefix_len;
 #endif
 	int addrflags;
 
+	/* Addresses we already know exactly as reported generate no
+	 * event, so relearning after a link overflow only acts on
+	 * what changed. */
+	ifp = NULL;
 	for (ifa = *ifaddrs; ifa; ifa = ifa->ifa_next) {
 		if (ifa->ifa_addr == NULL)
 			continue;
-		if ((ifp = if_find(ifs, ifa->ifa_name)) == NULL)
+		/* Addresses are listed by interface. */
+		if ((ifp == NULL || strcmp(ifp->name, ifa->ifa_name) != 0) &&
+		    (ifp = if_find(ifs, ifa->ifa_name)) == NULL)
 			continue;
-#ifdef HAVE_IFADDRS_ADDRFLAGS
-		addrflags = (int)ifa->ifa_addrflags;
+#ifdef IFA_ADDRFLAGS
+		addrflags = IFA_ADDRFLAGS(ifa);
 #endif
 		switch(ifa->ifa_addr->sa_family) {
 #ifdef INET
@@ -301,7 +426,7 @@ if_learnaddrs(struct dhcpcd_ctx *ctx, struct if_head *ifs,
 				brd = (void *)ifa->ifa_dstaddr;
 			else
 				brd = (void *)ifa->ifa_broadaddr;
-#ifndef HAVE_IFADDRS_ADDRFLAGS
+#ifndef IFA_ADDRFLAGS
 			addrflags = if_addrflags(ifp, &addr->sin_addr,
 			    ifa->ifa_name);
 			if (addrflags == -1) {
@@ -317,6 +442,10 @@ if_learnaddrs(struct dhcpcd_ctx *ctx, struct if_head *ifs,
 				continue;
 			}
 #endif
+			if (ipv4_keepaddr(ifp, &addr->sin_addr,
+			    &net->sin_addr, brd ? &brd->sin_addr : NULL,
+			    addrflags))
+				break;
 			ipv4_handleifa(ctx, RTM_NEWADDR, ifs, ifa->ifa_name,
 				&addr->sin_addr, &net->sin_addr,
 				brd ? &brd->sin_addr : NULL, addrflags, 0);
@@ -333,7 +462,7 @@ if_learnaddrs(struct dhcpcd_ctx *ctx, struct if_head *ifs,
 				sin6->sin6_addr.s6_addr[2] =
 				    sin6->sin6_addr.s6_addr[3] = '\0';
 #endif
-#ifndef HAVE_IFADDRS_ADDRFLAGS
+#ifndef IFA_ADDRFLAGS
 			addrflags = if_addrflags6(ifp, &sin6->sin6_addr,
 			    ifa->ifa_name);
 			if (addrflags == -1) {
@@ -349,18 +478,33 @@ if_learnaddrs(struct dhcpcd_ctx *ctx, struct if_head *ifs,
 				continue;
 			}
 #endif
+			prefix_len = ipv6_prefixlen(&net6->sin6_addr);
+			if (ipv6_keepaddr(ifp, &sin6->sin6_addr,
+			    prefix_len, addrflags))
+				break;
 			ipv6_handleifa(ctx, RTM_NEWADDR, ifs,
 			    ifa->ifa_name, &sin6->sin6_addr,
-			    ipv6_prefixlen(&net6->sin6_addr), addrflags, 0);
+			    prefix_len, addrflags, 0);
 			break;
 #endif
 		}
 	}
 
+	if_freeifaddrs(ctx, ifaddrs);
+}
+
+void
+if_freeifaddrs(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs)
+{
+
+	if (*ifaddrs == NULL)
+		return;
 #ifdef PRIVSEP_GETIFADDRS
 	if (IN_PRIVSEP(ctx))
 		free(*ifaddrs);
 	else
+#else
+	UNUSED(ctx);
 #endif
 		freeifaddrs(*ifaddrs);
 	*ifaddrs = NULL;
@@ -466,9 +610,20 @@ if_discover(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs,
 	}
 	TAILQ_INIT(ifs);
 
+#ifdef __linux__
+	if (if_getifaddrs_nl(ctx, ifaddrs,
+	    argc == -1 ? argv[0] : NULL) == -1)
+	{
+		logerr("if_getifaddrs_nl");
+		free(ifs);
+		return NULL;
+	}
+#else
 #ifdef PRIVSEP_GETIFADDRS
 	if (ctx->options & DHCPCD_PRIVSEP) {
-		if (ps_root_getifaddrs(ctx, ifaddrs) == -1) {
+		if (ps_root_getifaddrs(ctx,
+		    argc == -1 ? argv[0] : NULL, ifaddrs) == -1)
+		{
 			logerr("ps_root_getifaddrs");
 			free(ifs);
 			return NULL;
@@ -480,6 +635,7 @@ if_discover(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs,
 		free(ifs);
 		return NULL;
 	}
+#endif
 
 	for (ifa = *ifaddrs; ifa; ifa = ifa->ifa_next) {
 		if (ifa->ifa_addr != NULL) {
@@ -534,6 +690,9 @@ if_discover(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs,
 				break;
 		if (ctx->ifac && i == ctx->ifac)
 			active = IF_INACTIVE;
+		/* Another worker looks after it. */
+		if (!shard_owns(ctx, spec.devname))
+			active = IF_INACTIVE;
 
 #ifdef PLUGIN_DEV
 		/* Ensure that the interface name has settled */
@@ -556,7 +715,9 @@ if_discover(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs,
 		    !if_hasconf(ctx, spec.devname));
 
 		/* Don't allow some reserved interface names unless explicit. */
-		if (if_noconf && if_ignore(ctx, spec.devname)) {
+		if (if_noconf &&
+		    if_ignore(ctx, spec.devname, ifa->ifa_data))
+		{
 			logdebugx("%s: ignoring due to interface type and"
 			    " no config", spec.devname);
 			active = IF_INACTIVE;
@@ -659,24 +820,6 @@ if_discover(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs,
 			active = if_check_arphrd(ifp, active, if_noconf);
 #endif
 		}
-#ifdef __linux__
-		else {
-			struct ifreq ifr = { .ifr_flags = 0 };
-
-			/* This is a huge bug in getifaddrs(3) as there
-			 * is no reason why this can't be returned in
-			 * ifa_addr. */
-			strlcpy(ifr.ifr_name, ifa->ifa_name,
-			    sizeof(ifr.ifr_name));
-			if (ioctl(ctx->pf_inet_fd, SIOCGIFHWADDR, &ifr) == -1)
-				logerr("%s: SIOCGIFHWADDR", ifa->ifa_name);
-			ifp->hwtype = ifr.ifr_hwaddr.sa_family;
-			if (ioctl(ctx->pf_inet_fd, SIOCGIFINDEX, &ifr) == -1)
-				logerr("%s: SIOCGIFINDEX", ifa->ifa_name);
-			ifp->index = (unsigned int)ifr.ifr_ifindex;
-			if_check_arphrd(ifp, active, if_noconf);
-		}
-#endif
 
 		if (!(ctx->options & (DHCPCD_DUMPLEASE | DHCPCD_TEST))) {
 			/* Handle any platform init for the interface */
@@ -687,7 +830,7 @@ if_discover(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs,
 			}
 		}
 
-		ifp->vlanid = if_vlanid(ifp);
+		ifp->vlanid = if_vlanid(ifp, ifa->ifa_data);
 
 #ifdef SIOCGIFPRIORITY
 		/* Respect the interface priority */
@@ -805,6 +948,23 @@ if_findindexname(struct if_head *ifaces, unsigned int idx, const char *name)
 		if (name && if_nametospec(name, &spec) == -1)
 			return NULL;
 
+		/* ctx->ifaces is indexed by if_indexctx. */
+		ifp = TAILQ_FIRST(ifaces);
+		if (ifp != NULL && ifp->ctx->ifaces == ifaces &&
+		    (name != NULL || idx != 0))
+		{
+			if (name != NULL)
+				ifp = rb_tree_find_node(&ifp->ctx->ifnames,
+				    spec.devname);
+			else
+				ifp = rb_tree_find_node(&ifp->ctx->ifindex,
+				    &idx);
+			if (ifp != NULL)
+				return ifp;
+			errno = ENXIO;
+			return NULL;
+		}
+
 		TAILQ_FOREACH(ifp, ifaces, next) {
 			if ((name && strcmp(ifp->name, spec.devname) == 0) ||
 			    (!name && ifp->index == idx))
@@ -830,6 +990,20 @@ if_findindex(struct if_head *ifaces, unsigned int idx)
 	return if_findindexname(ifaces, idx, NULL);
 }
 
+struct interface *
+if_findindexctx(struct dhcpcd_ctx *ctx, unsigned int idx)
+{
+
+	return if_findindex(ctx->ifaces, idx);
+}
+
+struct interface *
+if_findnamectx(struct dhcpcd_ctx *ctx, const char *name)
+{
+
+	return if_find(ctx->ifaces, name);
+}
+
 struct interface *
 if_loopback(struct dhcpcd_ctx *ctx)
 {
@@ -946,10 +1120,7 @@ if_findifpfromcmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, int *hoplimit)
 	}
 
 	/* Find the receiving interface */
-	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
-		if (ifp->index == ifindex)
-			break;
-	}
+	ifp = if_findindexctx(ctx, ifindex);
 	if (ifp == NULL)
 		errno = ESRCH;
 	return ifp;
@@ -1041,3 +1212,73 @@ out:
 	return -1;
 #endif
 }
+
+struct if_msgbatch *
+if_msgbatch_new(size_t buflen)
+{
+	struct if_msgbatch *b;
+
+	if ((b = calloc(1, sizeof(*b))) == NULL)
+		return NULL;
+	/* Pages for slots a burst never reaches are never touched. */
+	if ((b->buf = malloc(buflen * IF_MSGBATCH_MAX)) == NULL) {
+		free(b);
+		return NULL;
+	}
+	b->buflen = buflen;
+	return b;
+}
+
+void
+if_msgbatch_free(struct if_msgbatch *b)
+{
+
+	if (b == NULL)
+		return;
+	free(b->buf);
+	free(b);
+}
+
+int
+if_recvmsgs(int fd, struct if_msgbatch *b)
+{
+	struct msghdr *msg;
+	unsigned int i;
+	int n;
+#ifndef HAVE_RECVMMSG
+	ssize_t len;
+#endif
+
+	for (i = 0; i < IF_MSGBATCH_MAX; i++) {
+		msg = IF_MSGBATCH_MSG(b, i);
+		b->iov[i].iov_base = b->buf + (b->buflen * i);
+		b->iov[i].iov_len = b->buflen;
+		msg->msg_name = &b->from[i];
+		msg->msg_namelen = sizeof(b->from[i]);
+		msg->msg_iov = &b->iov[i];
+		msg->msg_iovlen = 1;
+		msg->msg_control = b->control[i].buf;
+		msg->msg_controllen = sizeof(b->control[i].buf);
+		msg->msg_flags = 0;
+	}
+
+#ifdef HAVE_RECVMMSG
+	/* Only the first datagram may block, the rest are what is queued. */
+#ifdef MSG_WAITFORONE
+	n = recvmmsg(fd, b->msgs, IF_MSGBATCH_MAX, MSG_WAITFORONE, NULL);
+#else
+	n = recvmmsg(fd, b->msgs, IF_MSGBATCH_MAX, MSG_DONTWAIT, NULL);
+#endif
+	if (n == -1)
+		return -1;
+	for (i = 0; i < (unsigned int)n; i++)
+		b->iov[i].iov_len = b->msgs[i].msg_len;
+#else
+	len = recvmsg(fd, IF_MSGBATCH_MSG(b, 0), 0);
+	if (len == -1)
+		return -1;
+	b->iov[0].iov_len = (size_t)len;
+	n = 1;
+#endif
+	return n;
+}
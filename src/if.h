@@ -136,6 +136,25 @@ int if_getifaddrs(struct ifaddrs **);
 int if_getsubnet(struct dhcpcd_ctx *, const char *, int, void *, size_t);
 #endif
 
+#ifdef __linux__
+/* getifaddrs(3) leaves us to probe sysfs and ioctls for each interface
+ * and /proc for each IPv6 address, so if-linux.c builds the list from
+ * RTM_GETLINK and RTM_GETADDR dumps instead.
+ * What getifaddrs(3) cannot tell us is carried in ifa_data. */
+struct if_ifadata {
+	int ifd_addrflags;
+	bool ifd_ignore;		/* bridge or tap */
+	unsigned short ifd_vlanid;
+};
+#define	IFA_ADDRFLAGS(ifa)	\
+	(((const struct if_ifadata *)(ifa)->ifa_data)->ifd_addrflags)
+int if_getifaddrs_nl(struct dhcpcd_ctx *, struct ifaddrs **, const char *);
+void if_freeifaddrs_nl(struct ifaddrs *);
+#define	freeifaddrs	if_freeifaddrs_nl
+#elif defined(HAVE_IFADDRS_ADDRFLAGS)
+#define	IFA_ADDRFLAGS(ifa)	((int)(ifa)->ifa_addrflags)
+#endif
+
 int if_ioctl(struct dhcpcd_ctx *, ioctl_request_t, void *, size_t);
 #ifdef HAVE_PLEDGE
 #define	pioctl(ctx, req, data, len) if_ioctl((ctx), (req), (data), (len))
@@ -152,10 +171,15 @@ struct if_head *if_discover(struct dhcpcd_ctx *, struct ifaddrs **,
     int, char * const *);
 void if_markaddrsstale(struct if_head *);
 void if_learnaddrs(struct dhcpcd_ctx *, struct if_head *, struct ifaddrs **);
+void if_freeifaddrs(struct dhcpcd_ctx *, struct ifaddrs **);
 void if_deletestaleaddrs(struct if_head *);
 struct interface *if_find(struct if_head *, const char *);
 struct interface *if_findindex(struct if_head *, unsigned int);
+void if_indexctx(struct interface *);
+struct interface *if_findindexctx(struct dhcpcd_ctx *, unsigned int);
+struct interface *if_findnamectx(struct dhcpcd_ctx *, const char *);
 struct interface *if_loopback(struct dhcpcd_ctx *);
+void if_ctxinit(struct dhcpcd_ctx *);
 void if_free(struct interface *);
 int if_domtu(const struct interface *, short int);
 #define if_getmtu(ifp) if_domtu((ifp), 0)
@@ -189,15 +213,23 @@ int if_conf(struct interface *);
 int if_init(struct interface *);
 int if_getssid(struct interface *);
 int if_ignoregroup(int, const char *);
-bool if_ignore(struct dhcpcd_ctx *, const char *);
+bool if_ignore(struct dhcpcd_ctx *, const char *, const void *);
 int if_vimaster(struct dhcpcd_ctx *ctx, const char *);
-unsigned short if_vlanid(const struct interface *);
+unsigned short if_vlanid(const struct interface *, const void *);
 char * if_getnetworknamespace(char *, size_t);
 int if_opensockets(struct dhcpcd_ctx *);
 int if_opensockets_os(struct dhcpcd_ctx *);
 void if_closesockets(struct dhcpcd_ctx *);
 void if_closesockets_os(struct dhcpcd_ctx *);
 int if_handlelink(struct dhcpcd_ctx *);
+#ifdef __linux__
+/* Drops the link messages we would ignore in the kernel.
+ * Call again when ctx->ifaces changes. */
+#define HAVE_IF_LINKFILTER
+int if_linkfilter(struct dhcpcd_ctx *);
+#else
+#define if_linkfilter(ctx) ((void)(ctx), 0)
+#endif
 int if_randomisemac(struct interface *);
 int if_setmac(struct interface *ifp, void *, uint8_t);
 
@@ -229,7 +261,58 @@ int if_setmac(struct interface *ifp, void *, uint8_t);
 int xsocket(int, int, int);
 int xsocketpair(int, int, int, int[2]);
 
+/* Datagrams drained from a socket with one call.
+ * Each has its own name, control and data buffer so they can all be
+ * processed after the read. Without recvmmsg(2) this is one recvmsg(2). */
+#ifdef HAVE_RECVMMSG
+#define	IF_MSGBATCH_MAX		8
+#else
+#define	IF_MSGBATCH_MAX		1
+#endif
+/* Packet info, hop limit and a receive timestamp. */
+#define	IF_MSGBATCH_CONTROLLEN	(CMSG_SPACE(sizeof(struct in6_pktinfo)) + \
+				 CMSG_SPACE(sizeof(int)) +		\
+				 CMSG_SPACE(sizeof(struct timespec)))
+struct if_msgbatch {
+	uint8_t *buf;
+	size_t buflen;
+	struct sockaddr_storage from[IF_MSGBATCH_MAX];
+	union {
+		struct cmsghdr hdr;
+		uint8_t buf[IF_MSGBATCH_CONTROLLEN];
+	} control[IF_MSGBATCH_MAX];
+	struct iovec iov[IF_MSGBATCH_MAX];
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[IF_MSGBATCH_MAX];
+#else
+	struct msghdr msgs[IF_MSGBATCH_MAX];
+#endif
+};
+#ifdef HAVE_RECVMMSG
+#define	IF_MSGBATCH_MSG(b, i)	(&(b)->msgs[(i)].msg_hdr)
+#else
+#define	IF_MSGBATCH_MSG(b, i)	(&(b)->msgs[(i)])
+#endif
+struct if_msgbatch *if_msgbatch_new(size_t);
+void if_msgbatch_free(struct if_msgbatch *);
+int if_recvmsgs(int, struct if_msgbatch *);
+
 int if_route(unsigned char, const struct rt *rt);
+/* A request for if_routes(), which sets error to 0 or an errno. */
+struct if_rtreq {
+	unsigned char cmd;
+	const struct rt *rt;
+	int error;
+};
+#if defined(__linux__) || defined(BSD)
+/* The requests are sent together and carried out in order. */
+#define HAVE_IF_ROUTES
+int if_routes(struct dhcpcd_ctx *, struct if_rtreq *, size_t);
+#endif
+#ifdef BSD
+/* Most route messages we will hand to the privileged process at once. */
+#define RTM_BATCH_MAX	32
+#endif
 int if_initrt(struct dhcpcd_ctx *, rb_tree_t *, int);
 
 int if_missfilter(struct interface *, struct sockaddr *);
@@ -255,6 +338,15 @@ int if_address6(unsigned char, const struct ipv6_addr *);
 int if_addrflags6(const struct interface *, const struct in6_addr *,
     const char *);
 int if_getlifetime6(struct ipv6_addr *);
+#ifdef __linux__
+/* if_address6(RTM_NEWADDR) requests are queued between these and sent
+ * together. Batches nest. The callback is given each address the kernel
+ * refused along with its flags when queued and the error. */
+#define HAVE_IF_ADDRESS6_BATCH
+void if_address6_batch(struct dhcpcd_ctx *,
+    void (*)(struct ipv6_addr *, unsigned int, int));
+int if_address6_commit(struct dhcpcd_ctx *);
+#endif
 
 #else
 #define if_checkipv6(a, b, c) (-1)
@@ -265,8 +357,12 @@ struct interface *if_findifpfromcmsg(struct dhcpcd_ctx *,
     struct msghdr *, int *);
 
 #ifdef __linux__
+/* Most netlink requests we will send in one go. */
+#define NETLINK_BATCH_MAX	64
+
 int if_linksocket(struct sockaddr_nl *, int, int);
 int if_getnetlink(struct dhcpcd_ctx *, struct iovec *, int, int,
     int (*)(struct dhcpcd_ctx *, void *, struct nlmsghdr *), void *);
+int if_getnetlinkacks(int, uint32_t, int *, size_t);
 #endif
 #endif
@@ -153,21 +153,26 @@ ipv4_iffindlladdr(struct interface *ifp)
 	return NULL;
 }
 
-static struct ipv4_addr *
-ipv4_iffindmaskaddr(struct interface *ifp, const struct in_addr *addr)
+/*
+ * Addresses in state->addrs are also kept in ctx->ipv4_lpm by subnet.
+ * Call ipv4_indexaddr() after every insert or mask change and
+ * ipv4_unindexaddr() before every remove.
+ */
+static void
+ipv4_indexaddr(struct ipv4_addr *ia)
 {
-	struct ipv4_state *state;
-	struct ipv4_addr *ap;
+	struct lpm *lpm = &ia->iface->ctx->ipv4_lpm;
 
-	state = IPV4_STATE(ifp);
-	if (state) {
-		TAILQ_FOREACH (ap, &state->addrs, next) {
-			if ((ap->addr.s_addr & ap->mask.s_addr) ==
-			    (addr->s_addr & ap->mask.s_addr))
-				return ap;
-		}
-	}
-	return NULL;
+	lpm_remove(lpm, ia);
+	if (lpm_insert(lpm, ia, &ia->addr, inet_ntocidr(ia->mask)) == -1)
+		logerr(__func__);
+}
+
+static void
+ipv4_unindexaddr(struct ipv4_addr *ia)
+{
+
+	lpm_remove(&ia->iface->ctx->ipv4_lpm, ia);
 }
 
 struct ipv4_addr *
@@ -184,18 +189,12 @@ ipv4_findaddr(struct dhcpcd_ctx *ctx, const struct in_addr *addr)
 	return NULL;
 }
 
+/* Find the address whose subnet most closely contains addr. */
 struct ipv4_addr *
 ipv4_findmaskaddr(struct dhcpcd_ctx *ctx, const struct in_addr *addr)
 {
-	struct interface *ifp;
-	struct ipv4_addr *ap;
 
-	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
-		ap = ipv4_iffindmaskaddr(ifp, addr);
-		if (ap)
-			return ap;
-	}
-	return NULL;
+	return lpm_lookup(&ctx->ipv4_lpm, addr);
 }
 
 int
@@ -501,6 +500,7 @@ ipv4_deladdr(struct ipv4_addr *addr, int keeparp)
 	    errno != EADDRNOTAVAIL && errno != ESRCH &&
 	    errno != ENXIO && errno != ENODEV)
 		logerr("%s: %s", addr->iface->name, __func__);
+	rt_kroutes_flush(addr->iface->ctx, AF_INET);
 
 #ifdef ARP
 	if (!keeparp)
@@ -516,7 +516,8 @@ ipv4_deladdr(struct ipv4_addr *addr, int keeparp)
 
 			dstate = D_STATE(ap->iface);
 			TAILQ_REMOVE(&state->addrs, ap, next);
-			free(ap);
+			ipv4_unindexaddr(ap);
+			pool_put(ap);
 
 			if (dstate && dstate->addr == ap) {
 				dstate->added = 0;
@@ -558,7 +559,8 @@ ipv4_getstate(struct interface *ifp)
 
 	state = IPV4_STATE(ifp);
 	if (state == NULL) {
-	        ifp->if_data[IF_DATA_IPV4] = malloc(sizeof(*state));
+	        ifp->if_data[IF_DATA_IPV4] =
+	            arena_get(&ifp->arena, sizeof(*state));
 		state = IPV4_STATE(ifp);
 		if (state == NULL) {
 			logerr(__func__);
@@ -644,7 +646,7 @@ ipv4_addaddr(struct interface *ifp, const struct in_addr *addr,
 
 	ia = ipv4_iffindaddr(ifp, addr, NULL);
 	if (ia == NULL) {
-		ia = malloc(sizeof(*ia));
+		ia = pool_get(&ifp->ctx->ia4_pool);
 		if (ia == NULL) {
 			logerr(__func__);
 			return NULL;
@@ -659,6 +661,8 @@ ipv4_addaddr(struct interface *ifp, const struct in_addr *addr,
 		ia->flags &= ~IPV4_AF_NEW;
 
 	ia->mask = *mask;
+	if (!(ia->flags & IPV4_AF_NEW))
+		ipv4_indexaddr(ia);
 	ia->brd = *bcast;
 #ifdef IP_LIFETIME
 	if (ifp->options->options & DHCPCD_LASTLEASE_EXTEND) {
@@ -679,7 +683,7 @@ ipv4_addaddr(struct interface *ifp, const struct in_addr *addr,
 	blank = (ia->alias[0] == '\0');
 	if ((replaced = ipv4_aliasaddr(ia, &replaced_ia)) == -1) {
 		logerr("%s: ipv4_aliasaddr", ifp->name);
-		free(ia);
+		pool_put(ia);
 		return NULL;
 	}
 	if (blank)
@@ -695,19 +699,22 @@ ipv4_addaddr(struct interface *ifp, const struct in_addr *addr,
 			logerr("%s: if_addaddress",
 			    __func__);
 		if (ia->flags & IPV4_AF_NEW)
-			free(ia);
+			pool_put(ia);
 		return NULL;
 	}
 
 #ifdef ALIAS_ADDR
 	if (replaced) {
 		TAILQ_REMOVE(&state->addrs, replaced_ia, next);
-		free(replaced_ia);
+		ipv4_unindexaddr(replaced_ia);
+		pool_put(replaced_ia);
 	}
 #endif
 
-	if (ia->flags & IPV4_AF_NEW)
+	if (ia->flags & IPV4_AF_NEW) {
 		TAILQ_INSERT_TAIL(&state->addrs, ia, next);
+		ipv4_indexaddr(ia);
+	}
 	return ia;
 }
 
@@ -740,6 +747,7 @@ ipv4_applyaddr(void *arg)
 	if (state == NULL)
 		return;
 
+	rt_release(ifp, AF_INET, RTDF_IFA_ROUTE | RTDF_DHCP | RTDF_STATIC);
 	lease = &state->lease;
 	if (state->new == NULL) {
 		if ((ifo->options & (DHCPCD_EXITING | DHCPCD_PERSISTENT)) !=
@@ -837,6 +845,22 @@ ipv4_markaddrsstale(struct interface *ifp)
 	}
 }
 
+/* If we know the address exactly as reported, just clear the stale
+ * mark and return true as there is nothing to handle. */
+bool
+ipv4_keepaddr(struct interface *ifp, const struct in_addr *addr,
+    const struct in_addr *mask, const struct in_addr *brd, int addrflags)
+{
+	struct ipv4_addr *ia;
+
+	ia = ipv4_iffindaddr(ifp, addr, mask);
+	if (ia == NULL || ia->addr_flags != addrflags ||
+	    ia->brd.s_addr != (brd != NULL ? brd->s_addr : INADDR_ANY))
+		return false;
+	ia->flags &= ~IPV4_AF_STALE;
+	return true;
+}
+
 void
 ipv4_deletestaleaddrs(struct interface *ifp)
 {
@@ -898,7 +922,7 @@ ipv4_handleifa(struct dhcpcd_ctx *ctx,
 	switch (cmd) {
 	case RTM_NEWADDR:
 		if (ia == NULL) {
-			if ((ia = malloc(sizeof(*ia))) == NULL) {
+			if ((ia = pool_get(&ifp->ctx->ia4_pool)) == NULL) {
 				logerr(__func__);
 				return;
 			}
@@ -921,6 +945,7 @@ ipv4_handleifa(struct dhcpcd_ctx *ctx,
 			ia->mask = *mask;
 			snprintf(ia->saddr, sizeof(ia->saddr), "%s/%d",
 			    inet_ntoa(*addr), inet_ntocidr(*mask));
+			ipv4_indexaddr(ia);
 		}
 		if (brd != NULL)
 			ia->brd = *brd;
@@ -936,6 +961,9 @@ ipv4_handleifa(struct dhcpcd_ctx *ctx,
 		    mask->s_addr != ia->mask.s_addr)
 			return;
 		TAILQ_REMOVE(&state->addrs, ia, next);
+		ipv4_unindexaddr(ia);
+		/* Routes using the address go without notice. */
+		rt_kroutes_flush(ctx, AF_INET);
 		break;
 	default:
 		return;
@@ -950,7 +978,7 @@ ipv4_handleifa(struct dhcpcd_ctx *ctx,
 	}
 
 	if (cmd == RTM_DELADDR)
-		free(ia);
+		pool_put(ia);
 }
 
 void
@@ -964,7 +992,8 @@ ipv4_free(struct interface *ifp)
 
 	while ((ia = TAILQ_FIRST(&state->addrs))) {
 		TAILQ_REMOVE(&state->addrs, ia, next);
-		free(ia);
+		ipv4_unindexaddr(ia);
+		pool_put(ia);
 	}
-	free(state);
+	arena_put(&ifp->arena, state);
 }
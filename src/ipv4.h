@@ -96,6 +96,7 @@ struct ipv4_addr {
 #ifdef ALIAS_ADDR
 	char alias[IF_NAMESIZE];
 #endif
+	struct lpm_entry lpm;	/* entry in ctx->ipv4_lpm */
 };
 TAILQ_HEAD(ipv4_addrhead, ipv4_addr);
 
@@ -144,6 +145,8 @@ struct ipv4_addr *ipv4_findaddr(struct dhcpcd_ctx *, const struct in_addr *);
 struct ipv4_addr *ipv4_findmaskaddr(struct dhcpcd_ctx *,
     const struct in_addr *);
 void ipv4_markaddrsstale(struct interface *);
+bool ipv4_keepaddr(struct interface *, const struct in_addr *,
+    const struct in_addr *, const struct in_addr *, int);
 void ipv4_deletestaleaddrs(struct interface *);
 void ipv4_handleifa(struct dhcpcd_ctx *, int, struct if_head *, const char *,
     const struct in_addr *, const struct in_addr *, const struct in_addr *,
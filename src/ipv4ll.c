@@ -57,8 +57,8 @@ static const struct in_addr inaddr_llbcast = {
 	.s_addr = HTONL(LINKLOCAL_BCAST)
 };
 
-static void
-ipv4ll_pickaddr(struct interface *ifp)
+static struct in_addr
+ipv4ll_randomaddr(struct interface *ifp)
 {
 	struct in_addr addr = { .s_addr = 0 };
 	struct ipv4ll_state *state;
@@ -81,12 +81,25 @@ again:
 		/* No point using a failed address */
 		if (IN_ARE_ADDR_EQUAL(&addr, &state->pickedaddr))
 			goto again;
+#ifndef KERNEL_RFC5227
+		/* Nor one we are probing already */
+		if (arp_find(ifp, &addr) != NULL)
+			goto again;
+#endif
 		/* Ensure we don't have the address on another interface */
 	} while (ipv4_findaddr(ifp->ctx, &addr) != NULL);
 
 	/* Restore the original random state */
 	setstate(ifp->ctx->randomstate);
-	state->pickedaddr = addr;
+	return addr;
+}
+
+static void
+ipv4ll_pickaddr(struct interface *ifp)
+{
+	struct ipv4ll_state *state = IPV4LL_STATE(ifp);
+
+	state->pickedaddr = ipv4ll_randomaddr(ifp);
 }
 
 int
@@ -185,6 +198,25 @@ ipv4ll_announced_arp(struct arp_state *astate)
 }
 
 #ifndef KERNEL_RFC5227
+static void ipv4ll_probemore(void *);
+
+/* Forget an address being probed, returning false if it wasn't. */
+static bool
+ipv4ll_unprobe(struct ipv4ll_state *state, const struct arp_state *astate)
+{
+	size_t i;
+
+	for (i = 0; i < state->nprobes; i++) {
+		if (state->probes[i] != astate)
+			continue;
+		state->nprobes--;
+		memmove(&state->probes[i], &state->probes[i + 1],
+		    (state->nprobes - i) * sizeof(state->probes[0]));
+		return true;
+	}
+	return false;
+}
+
 /* This is the callback by ARP freeing */
 static void
 ipv4ll_free_arp(struct arp_state *astate)
@@ -192,8 +224,32 @@ ipv4ll_free_arp(struct arp_state *astate)
 	struct ipv4ll_state *state;
 
 	state = IPV4LL_STATE(astate->iface);
-	if (state != NULL && state->arp == astate)
+	if (state == NULL)
+		return;
+	if (state->arp == astate)
 		state->arp = NULL;
+	else
+		ipv4ll_unprobe(state, astate);
+}
+
+/* Stop probing every address but keep. */
+static void
+ipv4ll_freeprobes(struct interface *ifp, const struct arp_state *keep)
+{
+	struct ipv4ll_state *state = IPV4LL_STATE(ifp);
+	struct arp_state *astate;
+	size_t i;
+
+	eloop_timeout_delete(ifp->ctx->eloop, ipv4ll_probemore, ifp);
+	for (i = 0; i < state->nprobes;) {
+		astate = state->probes[i];
+		if (astate == keep) {
+			i++;
+			continue;
+		}
+		ipv4ll_unprobe(state, astate);
+		arp_free(astate);
+	}
 }
 
 /* This is us freeing any ARP state */
@@ -203,9 +259,12 @@ ipv4ll_freearp(struct interface *ifp)
 	struct ipv4ll_state *state;
 
 	state = IPV4LL_STATE(ifp);
-	if (state == NULL || state->arp == NULL)
+	if (state == NULL)
 		return;
 
+	ipv4ll_freeprobes(ifp, NULL);
+	if (state->arp == NULL)
+		return;
 	eloop_timeout_delete(ifp->ctx->eloop, NULL, state->arp);
 	arp_free(state->arp);
 	state->arp = NULL;
@@ -251,6 +310,7 @@ test:
 		eloop_exit(ifp->ctx->eloop, EXIT_SUCCESS);
 		return;
 	}
+	rt_release(ifp, AF_INET, RTDF_IPV4LL);
 	rt_build(ifp->ctx, AF_INET);
 	astate = arp_announceaddr(ifp->ctx, &ia->addr);
 	if (astate != NULL)
@@ -293,15 +353,42 @@ ipv4ll_defend_failed(struct interface *ifp)
 static void
 ipv4ll_not_found_arp(struct arp_state *astate)
 {
+	struct interface *ifp = astate->iface;
+	struct ipv4ll_state *state = IPV4LL_STATE(ifp);
 
-	ipv4ll_not_found(astate->iface);
+	/* Claim the first address to pass and stop probing the rest. */
+	if (ipv4ll_unprobe(state, astate)) {
+		ipv4ll_freeprobes(ifp, NULL);
+		state->arp = astate;
+		state->pickedaddr = astate->addr;
+	}
+	ipv4ll_not_found(ifp);
 }
 
 static void
 ipv4ll_found_arp(struct arp_state *astate, __unused const struct arp_msg *amsg)
 {
+	struct interface *ifp = astate->iface;
+	struct ipv4ll_state *state = IPV4LL_STATE(ifp);
+
+	if (!ipv4ll_unprobe(state, astate)) {
+		ipv4ll_found(ifp);
+		return;
+	}
 
-	ipv4ll_found(astate->iface);
+	/* So it's not picked again. */
+	state->pickedaddr = astate->addr;
+	arp_free(astate);
+
+	/* While other addresses are still being probed,
+	 * just probe another in place of this one. */
+	if (state->nprobes != 0 && state->conflicts + 1 < MAX_CONFLICTS) {
+		state->conflicts++;
+		eloop_timeout_add_sec(ifp->ctx->eloop, PROBE_WAIT,
+		    ipv4ll_probemore, ifp);
+		return;
+	}
+	ipv4ll_found(ifp);
 }
 
 static void
@@ -310,6 +397,42 @@ ipv4ll_defend_failed_arp(struct arp_state *astate)
 
 	ipv4ll_defend_failed(astate->iface);
 }
+
+static struct arp_state *
+ipv4ll_probeaddr(struct interface *ifp, const struct in_addr *addr)
+{
+	struct ipv4ll_state *state = IPV4LL_STATE(ifp);
+	struct arp_state *astate;
+
+	astate = arp_new(ifp, addr);
+	if (astate == NULL)
+		return NULL;
+
+	astate->found_cb = ipv4ll_found_arp;
+	astate->not_found_cb = ipv4ll_not_found_arp;
+	astate->announced_cb = ipv4ll_announced_arp;
+	astate->defend_failed_cb = ipv4ll_defend_failed_arp;
+	astate->free_cb = ipv4ll_free_arp;
+	state->probes[state->nprobes++] = astate;
+	arp_probe(astate);
+	return astate;
+}
+
+/* Probe more addresses at once to speed up finding a free one
+ * on a busy link. */
+static void
+ipv4ll_probemore(void *arg)
+{
+	struct interface *ifp = arg;
+	struct ipv4ll_state *state = IPV4LL_STATE(ifp);
+	struct in_addr addr;
+
+	while (state->nprobes < ifp->options->ipv4ll_probes) {
+		addr = ipv4ll_randomaddr(ifp);
+		if (ipv4ll_probeaddr(ifp, &addr) == NULL)
+			break;
+	}
+}
 #endif
 
 void
@@ -319,12 +442,10 @@ ipv4ll_start(void *arg)
 	struct ipv4ll_state *state;
 	struct ipv4_addr *ia;
 	bool repick;
-#ifndef KERNEL_RFC5227
-	struct arp_state *astate;
-#endif
 
 	if ((state = IPV4LL_STATE(ifp)) == NULL) {
-		ifp->if_data[IF_DATA_IPV4LL] = calloc(1, sizeof(*state));
+		ifp->if_data[IF_DATA_IPV4LL] =
+		    arena_get(&ifp->arena, sizeof(*state));
 		if ((state = IPV4LL_STATE(ifp)) == NULL) {
 			logerr(__func__);
 			return;
@@ -402,16 +523,11 @@ ipv4ll_start(void *arg)
 	ipv4ll_not_found(ifp);
 #else
 	ipv4ll_freearp(ifp);
-	state->arp = astate = arp_new(ifp, &state->pickedaddr);
-	if (state->arp == NULL)
+	if (ipv4ll_probeaddr(ifp, &state->pickedaddr) == NULL)
 		return;
-
-	astate->found_cb = ipv4ll_found_arp;
-	astate->not_found_cb = ipv4ll_not_found_arp;
-	astate->announced_cb = ipv4ll_announced_arp;
-	astate->defend_failed_cb = ipv4ll_defend_failed_arp;
-	astate->free_cb = ipv4ll_free_arp;
-	arp_probe(astate);
+	/* An address we already have is all that is worth probing. */
+	if (ia == NULL)
+		ipv4ll_probemore(ifp);
 #endif
 }
 
@@ -473,7 +589,7 @@ ipv4ll_free(struct interface *ifp)
 	assert(ifp != NULL);
 
 	ipv4ll_freearp(ifp);
-	free(IPV4LL_STATE(ifp));
+	arena_put(&ifp->arena, IPV4LL_STATE(ifp));
 	ifp->if_data[IF_DATA_IPV4LL] = NULL;
 }
 
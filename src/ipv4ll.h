@@ -48,7 +48,10 @@ struct ipv4ll_state {
 	bool down;
 	size_t conflicts;
 #ifndef KERNEL_RFC5227
-	struct arp_state *arp;
+	struct arp_state *arp;		/* the address claimed */
+	/* Addresses being probed, the first to pass is claimed. */
+	struct arp_state *probes[IPV4LL_PROBES_MAX];
+	size_t nprobes;
 #endif
 };
 
@@ -55,6 +55,7 @@
 #include <errno.h>
 #include <ifaddrs.h>
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
@@ -122,9 +123,102 @@
 #endif
 
 #ifdef IPV6_MANAGETEMPADDR
-static void ipv6_regentempaddr(void *);
+static void ipv6_schedregen(struct interface *, const struct timespec *);
 #endif
 
+/*
+ * The addresses each interface has, as reported by the kernel, are
+ * also kept in ctx->ipv6_addrs by address and then interface, and in
+ * ctx->ipv6_lpm by prefix, so address events and lookups don't walk
+ * every list.
+ * Keep it in step with state->addrs by using ipv6_indexaddr() and
+ * ipv6_unindexaddr() around every insert and remove.
+ */
+struct ipv6_addrkey {
+	const struct in6_addr *addr;
+	const struct interface *ifp;
+};
+
+static int
+ipv6_addrcmp(const struct in6_addr *addr1, const struct interface *ifp1,
+    const struct in6_addr *addr2, const struct interface *ifp2)
+{
+	int r;
+
+	if ((r = memcmp(addr1, addr2, sizeof(*addr1))) != 0)
+		return r;
+	if (ifp1 == ifp2)
+		return 0;
+	return (uintptr_t)ifp1 < (uintptr_t)ifp2 ? -1 : 1;
+}
+
+static int
+ipv6_addrcmp_nodes(__unused void *context, const void *n1, const void *n2)
+{
+	const struct ipv6_addr *ia1 = n1, *ia2 = n2;
+
+	return ipv6_addrcmp(&ia1->addr, ia1->iface, &ia2->addr, ia2->iface);
+}
+
+static int
+ipv6_addrcmp_key(__unused void *context, const void *n, const void *key)
+{
+	const struct ipv6_addr *ia = n;
+	const struct ipv6_addrkey *k = key;
+
+	return ipv6_addrcmp(&ia->addr, ia->iface, k->addr, k->ifp);
+}
+
+const rb_tree_ops_t ipv6_addr_ops = {
+	.rbto_compare_nodes = ipv6_addrcmp_nodes,
+	.rbto_compare_key = ipv6_addrcmp_key,
+	.rbto_node_offset = offsetof(struct ipv6_addr, tree),
+	.rbto_context = NULL
+};
+
+static void
+ipv6_indexaddr(struct ipv6_addr *ia)
+{
+
+	struct dhcpcd_ctx *ctx = ia->iface->ctx;
+
+	if (ia->indexed)
+		return;
+	if (rb_tree_insert_node(&ctx->ipv6_addrs, ia) != ia)
+		return;
+	ia->indexed = true;
+	ia->lpm.le_node = NULL;
+	if (ia->prefix_len <= 128)
+		lpm_insert(&ctx->ipv6_lpm, ia, &ia->addr, ia->prefix_len);
+}
+
+static void
+ipv6_unindexaddr(struct ipv6_addr *ia)
+{
+
+	if (!ia->indexed)
+		return;
+	rb_tree_remove_node(&ia->iface->ctx->ipv6_addrs, ia);
+	lpm_remove(&ia->iface->ctx->ipv6_lpm, ia);
+	ia->indexed = false;
+}
+
+/* Find addr on ifp, or on any interface if ifp is NULL. */
+static struct ipv6_addr *
+ipv6_lookupaddr(struct dhcpcd_ctx *ctx, const struct interface *ifp,
+    const struct in6_addr *addr)
+{
+	struct ipv6_addrkey key = { .addr = addr, .ifp = ifp };
+	struct ipv6_addr *ia;
+
+	if (ifp != NULL)
+		return rb_tree_find_node(&ctx->ipv6_addrs, &key);
+	ia = rb_tree_find_node_geq(&ctx->ipv6_addrs, &key);
+	if (ia == NULL || !IN6_ARE_ADDR_EQUAL(&ia->addr, addr))
+		return NULL;
+	return ia;
+}
+
 int
 ipv6_init(struct dhcpcd_ctx *ctx)
 {
@@ -136,6 +230,7 @@ ipv6_init(struct dhcpcd_ctx *ctx)
 	if (ctx->ra_routers == NULL)
 		return -1;
 	TAILQ_INIT(ctx->ra_routers);
+	rb_tree_init(&ctx->ra_tree, &ipv6nd_ra_ops);
 
 #ifndef __sun
 	ctx->nd_fd = -1;
@@ -147,7 +242,7 @@ ipv6_init(struct dhcpcd_ctx *ctx)
 	return 0;
 }
 
-static ssize_t
+ssize_t
 ipv6_readsecret(struct dhcpcd_ctx *ctx)
 {
 	char line[1024];
@@ -337,7 +432,6 @@ ipv6_maketemporaryaddress(struct in6_addr *addr,
     const struct interface *ifp)
 {
 	struct in6_addr mask;
-	struct interface *ifpn;
 
 	if (ipv6_mask(&mask, prefix_len) == -1)
 		return -1;
@@ -347,11 +441,7 @@ again:
 	addr->s6_addr32[2] |= (arc4random() & ~mask.s6_addr32[2]);
 	addr->s6_addr32[3] |= (arc4random() & ~mask.s6_addr32[3]);
 
-	TAILQ_FOREACH(ifpn, ifp->ctx->ifaces, next) {
-		if (ipv6_iffindaddr(ifpn, addr, 0) != NULL)
-			break;
-	}
-	if (ifpn != NULL)
+	if (ipv6_lookupaddr(ifp->ctx, NULL, addr) != NULL)
 		goto again;
 	if (ipv6_reserved(addr))
 		goto again;
@@ -558,6 +648,23 @@ ipv6_userprefix(
 }
 
 #ifdef IPV6_POLLADDRFLAG
+/*
+ * The kernel may not tell us when DAD completes, so poll for it.
+ * This is only a backstop: a RTM_NEWADDR showing the address is no
+ * longer tentative cancels the poll.
+ * The slack lets addresses added together share one wakeup.
+ */
+#define	IPV6_POLLADDRFLAG_SLACK	(RETRANS_TIMER / 4)
+
+static void
+ipv6_polladdrflags(struct ipv6_addr *ia, unsigned long msec)
+{
+
+	eloop_timer_add_msec_slack(ia->iface->ctx->eloop,
+	    &ia->addrflags_timer, msec, IPV6_POLLADDRFLAG_SLACK,
+	    ipv6_checkaddrflags, ia);
+}
+
 void
 ipv6_checkaddrflags(void *arg)
 {
@@ -584,8 +691,7 @@ ipv6_checkaddrflags(void *arg)
 		    &ia->addr, ia->prefix_len, flags, 0);
 	} else {
 		/* Still tentative? Check again in a bit. */
-		eloop_timeout_add_msec(ia->iface->ctx->eloop,
-		    RETRANS_TIMER / 2, ipv6_checkaddrflags, ia);
+		ipv6_polladdrflags(ia, RETRANS_TIMER / 2);
 	}
 }
 #endif
@@ -596,7 +702,7 @@ ipv6_deletedaddr(struct ipv6_addr *ia)
 
 #ifdef DHCP6
 #ifdef PRIVSEP
-	if (!(ia->iface->ctx->options & DHCPCD_MASTER))
+	if (!DHCP6_SHARED(ia->iface->ctx))
 		ps_inet_closedhcp6(ia);
 #elif defined(SMALL)
 	UNUSED(ia);
@@ -628,12 +734,10 @@ ipv6_deleteaddr(struct ipv6_addr *ia)
 	ipv6_deletedaddr(ia);
 
 	state = IPV6_STATE(ia->iface);
-	TAILQ_FOREACH(ap, &state->addrs, next) {
-		if (IN6_ARE_ADDR_EQUAL(&ap->addr, &ia->addr)) {
-			TAILQ_REMOVE(&state->addrs, ap, next);
-			ipv6_freeaddr(ap);
-			break;
-		}
+	ap = ipv6_lookupaddr(ia->iface->ctx, ia->iface, &ia->addr);
+	if (ap != NULL) {
+		TAILQ_REMOVE(&state->addrs, ap, next);
+		ipv6_freeaddr(ap);
 	}
 
 #ifdef ND6_ADVERTISE
@@ -751,9 +855,19 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 	    ia->prefix_pltime &&
 	    ia->prefix_vltime &&
 	    ifp->options->options & DHCPCD_SLAACTEMP)
-		eloop_timeout_add_sec(ifp->ctx->eloop,
-		    ia->prefix_pltime - REGEN_ADVANCE,
-		    ipv6_regentempaddr, ia);
+	{
+		struct timespec n;
+		uint32_t due;
+
+		clock_gettime(CLOCK_MONOTONIC, &n);
+		if (ia->prefix_pltime > REGEN_ADVANCE)
+			due = ia->prefix_pltime - REGEN_ADVANCE;
+		else
+			due = 0;
+		ia->regen = n.tv_sec + due;
+		ia->regen_early = ia->regen - MIN(TEMP_REGEN_WINDOW, due / 4);
+		ipv6_schedregen(ifp, &n);
+	}
 #endif
 
 	/* Restore real pltime and vltime */
@@ -768,12 +882,12 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 #endif
 
 #ifdef IPV6_POLLADDRFLAG
-	eloop_timeout_delete(ifp->ctx->eloop,
-		ipv6_checkaddrflags, ia);
-	if (!(ia->flags & IPV6_AF_DADCOMPLETED)) {
-		eloop_timeout_add_msec(ifp->ctx->eloop,
-		    RETRANS_TIMER / 2, ipv6_checkaddrflags, ia);
-	}
+	/* DAD cannot complete before the first NS has been
+	 * waited for. */
+	if (!(ia->flags & IPV6_AF_DADCOMPLETED))
+		ipv6_polladdrflags(ia, RETRANS_TIMER);
+	else
+		eloop_timer_cancel(ifp->ctx->eloop, &ia->addrflags_timer);
 #endif
 
 #ifdef __sun
@@ -788,12 +902,17 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 			break;
 	}
 	if (ia2 == NULL) {
-		if ((ia2 = malloc(sizeof(*ia2))) == NULL) {
+		if ((ia2 = pool_get(&ifp->ctx->ia6_pool)) == NULL) {
 			logerr(__func__);
 			return 0; /* Well, we did add the address */
 		}
 		memcpy(ia2, ia, sizeof(*ia2));
+		ia2->indexed = false;
+#ifdef IPV6_MANAGETEMPADDR
+		ia2->regen = ia2->regen_early = 0;
+#endif
 		TAILQ_INSERT_TAIL(&state->addrs, ia2, next);
+		ipv6_indexaddr(ia2);
 	}
 #endif
 
@@ -973,13 +1092,52 @@ ipv6_doaddr(struct ipv6_addr *ia, struct timespec *now)
 	return ia->flags & IPV6_AF_NEW ? 1 : 0;
 }
 
+#ifdef HAVE_IF_ADDRESS6_BATCH
+/* The kernel refused a batched address, so undo ipv6_addaddr1. */
+static void
+ipv6_addaddr_failed(struct ipv6_addr *ia, unsigned int flags, int error)
+{
+	const unsigned int mask =
+	    IPV6_AF_NEW | IPV6_AF_ADDED | IPV6_AF_DELEGATED;
+
+	errno = error;
+	logerr("%s: %s: %s", __func__, ia->iface->name, ia->saddr);
+	ia->flags = (ia->flags & ~mask) | (flags & mask);
+}
+#endif
+
+/* Addresses added between these are sent to the kernel together. */
+void
+ipv6_batchaddrs(__unused struct dhcpcd_ctx *ctx)
+{
+
+#ifdef HAVE_IF_ADDRESS6_BATCH
+	if_address6_batch(ctx, ipv6_addaddr_failed);
+#endif
+}
+
+void
+ipv6_commitaddrs(__unused struct dhcpcd_ctx *ctx)
+{
+
+#ifdef HAVE_IF_ADDRESS6_BATCH
+	if_address6_commit(ctx);
+#endif
+}
+
 ssize_t
 ipv6_addaddrs(struct ipv6_addrhead *iaddrs)
 {
 	struct timespec now;
 	struct ipv6_addr *ia, *ian;
+	struct dhcpcd_ctx *ctx;
 	ssize_t i, r;
 
+	if ((ia = TAILQ_FIRST(iaddrs)) == NULL)
+		return 0;
+	ctx = ia->iface->ctx;
+	ipv6_batchaddrs(ctx);
+
 	i = 0;
 	timespecclear(&now);
 	TAILQ_FOREACH_SAFE(ia, iaddrs, next, ian) {
@@ -991,6 +1149,8 @@ ipv6_addaddrs(struct ipv6_addrhead *iaddrs)
 			ipv6_freeaddr(ia);
 		}
 	}
+
+	ipv6_commitaddrs(ctx);
 	return i;
 }
 
@@ -1016,9 +1176,10 @@ ipv6_freeaddr(struct ipv6_addr *ia)
 		eloop_event_delete(eloop, ia->dhcp6_fd);
 	}
 
+	ipv6_unindexaddr(ia);
 	eloop_q_timeout_delete(eloop, ELOOP_QUEUE_ALL, NULL, ia);
 	free(ia->na);
-	free(ia);
+	pool_put(ia);
 }
 
 void
@@ -1039,8 +1200,10 @@ ipv6_freedrop_addrs(struct ipv6_addrhead *addrs, int drop,
 		    ap->delegating_prefix->iface != ifd))
 			continue;
 #endif
-		if (drop != 2)
+		if (drop != 2) {
 			TAILQ_REMOVE(addrs, ap, next);
+			ipv6_unindexaddr(ap);
+		}
 		if (drop && ap->flags & IPV6_AF_ADDED &&
 		    (ap->iface->options->options &
 		    (DHCPCD_EXITING | DHCPCD_PERSISTENT)) !=
@@ -1050,8 +1213,10 @@ ipv6_freedrop_addrs(struct ipv6_addrhead *addrs, int drop,
 			if (!IN6_IS_ADDR_LINKLOCAL(&ap->addr) ||
 			    CAN_DROP_LLADDR(ap->iface))
 			{
-				if (drop == 2)
+				if (drop == 2) {
 					TAILQ_REMOVE(addrs, ap, next);
+					ipv6_unindexaddr(ap);
+				}
 				/* Find the same address somewhere else */
 				apf = ipv6_findaddr(ap->iface->ctx, &ap->addr,
 				    0);
@@ -1082,7 +1247,8 @@ ipv6_getstate(struct interface *ifp)
 
 	state = IPV6_STATE(ifp);
 	if (state == NULL) {
-	        ifp->if_data[IF_DATA_IPV6] = calloc(1, sizeof(*state));
+	        ifp->if_data[IF_DATA_IPV6] =
+	            arena_get(&ifp->arena, sizeof(*state));
 		state = IPV6_STATE(ifp);
 		if (state == NULL) {
 			logerr(__func__);
@@ -1174,21 +1340,23 @@ ipv6_handleifa(struct dhcpcd_ctx *ctx,
 		ifs = ctx->ifaces;
 	if (ifs == NULL)
 		return;
-	if ((ifp = if_find(ifs, ifname)) == NULL)
+	if (ifs == ctx->ifaces)
+		ifp = if_findnamectx(ctx, ifname);
+	else
+		ifp = if_find(ifs, ifname);
+	if (ifp == NULL)
 		return;
 	if ((state = ipv6_getstate(ifp)) == NULL)
 		return;
 	anyglobal = ipv6_anyglobal(ifp) != NULL;
 
-	TAILQ_FOREACH(ia, &state->addrs, next) {
-		if (IN6_ARE_ADDR_EQUAL(&ia->addr, addr))
-			break;
-	}
+	ia = ipv6_lookupaddr(ctx, ifp, addr);
 
 	switch (cmd) {
 	case RTM_DELADDR:
 		if (ia != NULL) {
 			TAILQ_REMOVE(&state->addrs, ia, next);
+			ipv6_unindexaddr(ia);
 #ifdef ND6_ADVERTISE
 			/* Advertise the address if it exists on
 			 * another interface. */
@@ -1228,6 +1396,7 @@ ipv6_handleifa(struct dhcpcd_ctx *ctx,
 			 * restart. */
 			ia->acquired = ia->created;
 			TAILQ_INSERT_TAIL(&state->addrs, ia, next);
+			ipv6_indexaddr(ia);
 		}
 		ia->addr_flags = addrflags;
 		ia->flags &= ~IPV6_AF_STALE;
@@ -1238,11 +1407,14 @@ ipv6_handleifa(struct dhcpcd_ctx *ctx,
 		if (IN6_IS_ADDR_LINKLOCAL(&ia->addr) || ia->dadcallback) {
 #ifdef IPV6_POLLADDRFLAG
 			if (ia->addr_flags & IN6_IFF_TENTATIVE) {
-				eloop_timeout_add_msec(
-				    ia->iface->ctx->eloop,
-				    RETRANS_TIMER / 2, ipv6_checkaddrflags, ia);
+				/* Don't push back a poll already due. */
+				if (!eloop_timer_pending(ctx->eloop,
+				    ia->addrflags_timer))
+					ipv6_polladdrflags(ia,
+					    RETRANS_TIMER / 2);
 				break;
 			}
+			eloop_timer_cancel(ctx->eloop, &ia->addrflags_timer);
 #endif
 
 			if (ia->dadcallback)
@@ -1315,53 +1487,31 @@ ipv6_iffindaddr(struct interface *ifp, const struct in6_addr *addr,
 	struct ipv6_addr *ap;
 
 	state = IPV6_STATE(ifp);
-	if (state) {
-		TAILQ_FOREACH(ap, &state->addrs, next) {
-			if (addr == NULL) {
-				if (IN6_IS_ADDR_LINKLOCAL(&ap->addr) &&
-				    (!revflags || !(ap->addr_flags & revflags)))
-					return ap;
-			} else {
-				if (IN6_ARE_ADDR_EQUAL(&ap->addr, addr) &&
-				    (!revflags || !(ap->addr_flags & revflags)))
-					return ap;
-			}
-		}
-	}
-	return NULL;
-}
+	if (state == NULL)
+		return NULL;
 
-static struct ipv6_addr *
-ipv6_iffindmaskaddr(const struct interface *ifp, const struct in6_addr *addr)
-{
-	struct ipv6_state *state;
-	struct ipv6_addr *ap;
-	struct in6_addr mask;
+	if (addr != NULL) {
+		ap = ipv6_lookupaddr(ifp->ctx, ifp, addr);
+		if (ap != NULL &&
+		    (!revflags || !(ap->addr_flags & revflags)))
+			return ap;
+		return NULL;
+	}
 
-	state = IPV6_STATE(ifp);
-	if (state) {
-		TAILQ_FOREACH(ap, &state->addrs, next) {
-			if (ipv6_mask(&mask, ap->prefix_len) == -1)
-				continue;
-			if (IN6_ARE_MASKED_ADDR_EQUAL(&ap->addr, addr, &mask))
-				return ap;
-		}
+	TAILQ_FOREACH(ap, &state->addrs, next) {
+		if (IN6_IS_ADDR_LINKLOCAL(&ap->addr) &&
+		    (!revflags || !(ap->addr_flags & revflags)))
+			return ap;
 	}
 	return NULL;
 }
 
+/* Find the address whose prefix most closely contains addr. */
 struct ipv6_addr *
 ipv6_findmaskaddr(struct dhcpcd_ctx *ctx, const struct in6_addr *addr)
 {
-	struct interface *ifp;
-	struct ipv6_addr *ap;
 
-	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
-		ap = ipv6_iffindmaskaddr(ifp, addr);
-		if (ap != NULL)
-			return ap;
-	}
-	return NULL;
+	return lpm_lookup(&ctx->ipv6_lpm, addr);
 }
 
 int
@@ -1452,7 +1602,7 @@ nextslaacprivate:
 		if (ipv6_makestableprivate(&ap->addr,
 			&ap->prefix, ap->prefix_len, ifp, &dadcounter) == -1)
 		{
-			free(ap);
+			pool_put(ap);
 			return -1;
 		}
 		ap->dadcounter = dadcounter;
@@ -1472,7 +1622,7 @@ nextslaacprivate:
 			} else if (ifp->hwlen == 8)
 				memcpy(&ap->addr.s6_addr[8], ifp->hwaddr, 8);
 			else {
-				free(ap);
+				pool_put(ap);
 				errno = ENOTSUP;
 				return -1;
 			}
@@ -1481,7 +1631,7 @@ nextslaacprivate:
 
 		/* Sanity check: g bit must not indciate "group" */
 		if (EUI64_GROUP(&ap->addr)) {
-			free(ap);
+			pool_put(ap);
 			errno = EINVAL;
 			return -1;
 		}
@@ -1489,30 +1639,28 @@ nextslaacprivate:
 	}
 
 	/* Do we already have this address? */
-	TAILQ_FOREACH(ap2, &state->addrs, next) {
-		if (IN6_ARE_ADDR_EQUAL(&ap->addr, &ap2->addr)) {
-			if (ap2->addr_flags & IN6_IFF_DUPLICATED) {
-				if (ifp->options->options &
-				    DHCPCD_SLAACPRIVATE)
-				{
-					dadcounter++;
-					goto nextslaacprivate;
-				}
-				free(ap);
-				errno = EADDRNOTAVAIL;
-				return -1;
+	ap2 = ipv6_lookupaddr(ifp->ctx, ifp, &ap->addr);
+	if (ap2 != NULL) {
+		if (ap2->addr_flags & IN6_IFF_DUPLICATED) {
+			if (ifp->options->options & DHCPCD_SLAACPRIVATE) {
+				dadcounter++;
+				goto nextslaacprivate;
 			}
-
-			logwarnx("%s: waiting for %s to complete",
-			    ap2->iface->name, ap2->saddr);
-			free(ap);
-			errno =	EEXIST;
-			return 0;
+			pool_put(ap);
+			errno = EADDRNOTAVAIL;
+			return -1;
 		}
+
+		logwarnx("%s: waiting for %s to complete",
+		    ap2->iface->name, ap2->saddr);
+		pool_put(ap);
+		errno =	EEXIST;
+		return 0;
 	}
 
 	inet_ntop(AF_INET6, &ap->addr, ap->saddr, sizeof(ap->saddr));
 	TAILQ_INSERT_TAIL(&state->addrs, ap, next);
+	ipv6_indexaddr(ap);
 	ipv6_addaddr(ap, NULL);
 	return 1;
 }
@@ -1530,11 +1678,9 @@ ipv6_tryaddlinklocal(struct interface *ifp)
 	ia = ipv6_iffindaddr(ifp, NULL, IN6_IFF_DUPLICATED);
 	if (ia != NULL) {
 #ifdef IPV6_POLLADDRFLAG
-		if (ia->addr_flags & IN6_IFF_TENTATIVE) {
-			eloop_timeout_add_msec(
-			    ia->iface->ctx->eloop,
-			    RETRANS_TIMER / 2, ipv6_checkaddrflags, ia);
-		}
+		if (ia->addr_flags & IN6_IFF_TENTATIVE &&
+		    !eloop_timer_pending(ifp->ctx->eloop, ia->addrflags_timer))
+			ipv6_polladdrflags(ia, RETRANS_TIMER / 2);
 #endif
 		return 0;
 	}
@@ -1612,7 +1758,7 @@ ipv6_newaddr(struct interface *ifp, const struct in6_addr *addr,
 	} else
 		addr_flags = IN6_IFF_TENTATIVE;
 
-	ia = calloc(1, sizeof(*ia));
+	ia = pool_get(&ifp->ctx->ia6_pool);
 	if (ia == NULL)
 		goto err;
 
@@ -1673,7 +1819,7 @@ paddr:
 
 err:
 	logerr(__func__);
-	free(ia);
+	pool_put(ia);
 	return NULL;
 }
 
@@ -1773,6 +1919,7 @@ ipv6_startstatic(struct interface *ifp)
 			return -1;
 		state = IPV6_STATE(ifp);
 		TAILQ_INSERT_TAIL(&state->addrs, ia, next);
+		ipv6_indexaddr(ia);
 		run_script = 0;
 	} else
 		run_script = 1;
@@ -1844,7 +1991,7 @@ ipv6_freedrop(struct interface *ifp, int drop)
 	} else {
 		/* Because we need to cache the addresses we don't control,
 		 * we only free the state on when NOT dropping addresses. */
-		free(state);
+		arena_put(&ifp->arena, state);
 		ifp->if_data[IF_DATA_IPV6] = NULL;
 		eloop_timeout_delete(ifp->ctx->eloop, NULL, ifp);
 	}
@@ -1856,6 +2003,10 @@ ipv6_ctxfree(struct dhcpcd_ctx *ctx)
 
 	free(ctx->ra_routers);
 	free(ctx->secret);
+	if_msgbatch_free(ctx->nd_msgs);
+#ifdef DHCP6
+	if_msgbatch_free(ctx->dhcp6_msgs);
+#endif
 }
 
 int
@@ -1893,6 +2044,10 @@ ipv6_handleifa_addrs(int cmd,
 			if (ia->addr_flags &
 			    (IN6_IFF_DETACHED | IN6_IFF_TENTATIVE))
 				break;
+#ifdef IPV6_POLLADDRFLAG
+			eloop_timer_cancel(ia->iface->ctx->eloop,
+			    &ia->addrflags_timer);
+#endif
 			if ((ia->flags & IPV6_AF_DADCOMPLETED) == 0) {
 				found++;
 				if (ia->dadcallback)
@@ -1984,11 +2139,12 @@ ipv6_createtempaddr(struct ipv6_addr *ia0, const struct timespec *now)
 	    ia->prefix_pltime > ia0->prefix_vltime)
 	{
 		errno =	EINVAL;
-		free(ia);
+		pool_put(ia);
 		return NULL;
 	}
 
 	TAILQ_INSERT_TAIL(&state->addrs, ia, next);
+	ipv6_indexaddr(ia);
 	return ia;
 }
 
@@ -2099,13 +2255,77 @@ ipv6_regentempaddr0(struct ipv6_addr *ia, struct timespec *tv)
 		logerr(__func__);
 }
 
+/* Regenerate the temporary addresses marked IPV6_AF_REGEN together. */
+static void
+ipv6_regenmarked(struct interface *ifp, struct timespec *tv)
+{
+	struct ipv6_state *state = IPV6_STATE(ifp);
+	struct ipv6_addr *ia;
+
+	ipv6_batchaddrs(ifp->ctx);
+	TAILQ_FOREACH(ia, &state->addrs, next) {
+		if (ia->flags & IPV6_AF_REGEN) {
+			ipv6_regentempaddr0(ia, tv);
+			ia->flags &= ~IPV6_AF_REGEN;
+		}
+	}
+	ipv6_commitaddrs(ifp->ctx);
+}
+
+/*
+ * Each interface has one timer for the temporary addresses due to be
+ * regenerated. It fires between the earliest and latest time the first
+ * one due may be regenerated, so it can share a wakeup with other
+ * interfaces, and takes every address which may be regenerated by then
+ * with it.
+ */
 static void
 ipv6_regentempaddr(void *arg)
 {
+	struct interface *ifp = arg;
+	struct ipv6_state *state;
+	struct ipv6_addr *ia;
 	struct timespec tv;
 
+	state = IPV6_STATE(ifp);
+	if (state == NULL)
+		return;
+
 	clock_gettime(CLOCK_MONOTONIC, &tv);
-	ipv6_regentempaddr0(arg, &tv);
+	TAILQ_FOREACH(ia, &state->addrs, next) {
+		if (ia->regen != 0 && ia->regen_early <= tv.tv_sec) {
+			ia->regen = 0;
+			ia->flags |= IPV6_AF_REGEN;
+		} else
+			ia->flags &= ~IPV6_AF_REGEN;
+	}
+
+	ipv6_regenmarked(ifp, &tv);
+	ipv6_schedregen(ifp, &tv);
+}
+
+static void
+ipv6_schedregen(struct interface *ifp, const struct timespec *now)
+{
+	struct ipv6_state *state = IPV6_STATE(ifp);
+	struct ipv6_addr *ia, *next;
+	time_t when;
+
+	next = NULL;
+	TAILQ_FOREACH(ia, &state->addrs, next) {
+		if (ia->regen != 0 && (next == NULL || ia->regen < next->regen))
+			next = ia;
+	}
+	if (next == NULL) {
+		eloop_timer_cancel(ifp->ctx->eloop, &state->regen_timer);
+		return;
+	}
+
+	when = MAX(next->regen_early, now->tv_sec);
+	eloop_timer_add_sec_slack(ifp->ctx->eloop, &state->regen_timer,
+	    (unsigned int)(when - now->tv_sec),
+	    (unsigned int)(MAX(next->regen, when) - when) * 1000,
+	    ipv6_regentempaddr, ifp);
 }
 
 void
@@ -2129,18 +2349,16 @@ ipv6_regentempaddrs(void *arg)
 		if (ia->flags & IPV6_AF_TEMPORARY &&
 		    ia->flags & IPV6_AF_ADDED &&
 		    !(ia->flags & IPV6_AF_STALE))
+		{
+			/* Replaced now, so no need to regen it again. */
+			ia->regen = 0;
 			ia->flags |= IPV6_AF_REGEN;
-		else
+		} else
 			ia->flags &= ~IPV6_AF_REGEN;
 	}
 
-	/* Now regen temp addrs */
-	TAILQ_FOREACH(ia, &state->addrs, next) {
-		if (ia->flags & IPV6_AF_REGEN) {
-			ipv6_regentempaddr0(ia, &tv);
-			ia->flags &= ~IPV6_AF_REGEN;
-		}
-	}
+	ipv6_regenmarked(ifp, &tv);
+	ipv6_schedregen(ifp, &tv);
 }
 #endif /* IPV6_MANAGETEMPADDR */
 
@@ -2160,6 +2378,22 @@ ipv6_markaddrsstale(struct interface *ifp, unsigned int flags)
 	}
 }
 
+/* If we know the address exactly as reported, just clear the stale
+ * mark and return true as there is nothing to handle. */
+bool
+ipv6_keepaddr(struct interface *ifp, const struct in6_addr *addr,
+    uint8_t prefix_len, int addrflags)
+{
+	struct ipv6_addr *ia;
+
+	ia = ipv6_iffindaddr(ifp, addr, 0);
+	if (ia == NULL || ia->prefix_len != prefix_len ||
+	    ia->addr_flags != addrflags)
+		return false;
+	ia->flags &= ~IPV6_AF_STALE;
+	return true;
+}
+
 void
 ipv6_deletestaleaddrs(struct interface *ifp)
 {
@@ -61,6 +61,10 @@
 #define MAX_DESYNC_FACTOR	600	/* 10 minutes */
 #define TEMP_IDGEN_RETRIES	3
 
+/* Temporary addresses may be regenerated up to this many seconds early,
+ * or a quarter of the time until due if less, to batch them together. */
+#define TEMP_REGEN_WINDOW	60	/* seconds */
+
 /* RFC7217 constants */
 #define IDGEN_RETRIES	3
 #define IDGEN_DELAY	1 /* second */
@@ -190,6 +194,10 @@ struct ipv6_addr {
 	uint16_t ia_type;
 	int dhcp6_fd;
 
+	rb_node_t tree;		/* node in ctx->ipv6_addrs */
+	struct lpm_entry lpm;	/* entry in ctx->ipv6_lpm */
+	bool indexed;
+
 #ifndef SMALL
 	struct ipv6_addr *delegating_prefix;
 	struct ipv6_addrhead pd_pfxs;
@@ -201,6 +209,13 @@ struct ipv6_addr {
 
 	void (*dadcallback)(void *);
 	int dadcounter;
+#ifdef IPV6_MANAGETEMPADDR
+	time_t regen;		/* monotonic second to regenerate by */
+	time_t regen_early;	/* and the earliest it may be */
+#endif
+#ifdef IPV6_POLLADDRFLAG
+	unsigned long long addrflags_timer;
+#endif
 
 	struct nd_neighbor_advert *na;
 	size_t na_len;
@@ -222,7 +237,6 @@ struct ipv6_addr {
 #define	IPV6_AF_NOREJECT	(1U << 8)
 #define	IPV6_AF_REQUEST		(1U << 9)
 #define	IPV6_AF_STATIC		(1U << 10)
-#define	IPV6_AF_DELEGATEDLOG	(1U << 11)
 #define	IPV6_AF_RAPFX		(1U << 12)
 #define	IPV6_AF_EXTENDED	(1U << 13)
 #define	IPV6_AF_REGEN		(1U << 14)
@@ -244,6 +258,7 @@ struct ipv6_state {
 
 #ifdef IPV6_MANAGETEMPADDR
 	uint32_t desync_factor;
+	unsigned long long regen_timer;
 #endif
 };
 
@@ -254,7 +269,10 @@ struct ipv6_state {
 #define IPV6_STATE_RUNNING(ifp) ipv6_staticdadcompleted((ifp))
 
 
+extern const rb_tree_ops_t ipv6_addr_ops;
+
 int ipv6_init(struct dhcpcd_ctx *);
+ssize_t ipv6_readsecret(struct dhcpcd_ctx *);
 int ipv6_makestableprivate(struct in6_addr *,
     const struct in6_addr *, int, const struct interface *, int *);
 int ipv6_makeaddr(struct in6_addr *, struct interface *,
@@ -265,9 +283,12 @@ int ipv6_userprefix( const struct in6_addr *, short prefix_len,
     uint64_t user_number, struct in6_addr *result, short result_len);
 void ipv6_checkaddrflags(void *);
 void ipv6_markaddrsstale(struct interface *, unsigned int);
+bool ipv6_keepaddr(struct interface *, const struct in6_addr *, uint8_t, int);
 void ipv6_deletestaleaddrs(struct interface *);
 int ipv6_addaddr(struct ipv6_addr *, const struct timespec *);
 int ipv6_doaddr(struct ipv6_addr *, struct timespec *);
+void ipv6_batchaddrs(struct dhcpcd_ctx *);
+void ipv6_commitaddrs(struct dhcpcd_ctx *);
 ssize_t ipv6_addaddrs(struct ipv6_addrhead *addrs);
 void ipv6_deleteaddr(struct ipv6_addr *);
 void ipv6_freedrop_addrs(struct ipv6_addrhead *, int,
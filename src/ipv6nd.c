@@ -55,6 +55,7 @@
 #include "ipv6nd.h"
 #include "logerr.h"
 #include "privsep.h"
+#include "probe.h"
 #include "route.h"
 #include "script.h"
 
@@ -132,6 +133,7 @@ __CTASSERT(sizeof(struct nd_opt_rdnss) == 8);
 //
 
 static void ipv6nd_handledata(void *);
+static void ipv6nd_sortrouters(struct interface *);
 
 /*
  * Android ships buggy ICMP6 filter headers.
@@ -340,6 +342,7 @@ ipv6nd_sendrsprobe(void *arg)
 	};
 	struct cmsghdr *cm;
 	struct in6_pktinfo pi = { .ipi6_ifindex = ifp->index };
+	unsigned int delay;
 	int s;
 #ifndef __sun
 	struct dhcpcd_ctx *ctx = ifp->ctx;
@@ -352,6 +355,12 @@ ipv6nd_sendrsprobe(void *arg)
 		return;
 	}
 
+	if ((delay = dhcpcd_pace(ifp->ctx)) != 0) {
+		eloop_timer_add_msec(ifp->ctx->eloop, &state->rs_timer,
+		    delay, ipv6nd_sendrsprobe, ifp);
+		return;
+	}
+
 #ifdef HAVE_SA_LEN
 	dst.sin6_len = sizeof(dst);
 #endif
@@ -366,10 +375,13 @@ ipv6nd_sendrsprobe(void *arg)
 	memcpy(CMSG_DATA(cm), &pi, sizeof(pi));
 
 	logdebugx("%s: sending Router Solicitation", ifp->name);
+	dhcpcd_phase(ifp->ctx, ifp, PHASE_RS);
 #ifdef PRIVSEP
 	if (IN_PRIVSEP(ifp->ctx)) {
-		if (ps_inet_sendnd(ifp, &msg) == -1)
+		if (ps_inet_sendnd(ifp, &msg) == -1) {
 			logerr(__func__);
+			goto next;
+		}
 		goto sent;
 	}
 #endif
@@ -398,14 +410,20 @@ ipv6nd_sendrsprobe(void *arg)
 		 * would be logged.
 		 * Generally the error is ENOBUFS when struggling to
 		 * associate with an access point. */
+		goto next;
 	}
 
 #ifdef PRIVSEP
 sent:
 #endif
+	STATS_COUNT(ifp, CNTP_ND, CNT_SENT);
+	if (state->rsprobes != 0)
+		STATS_COUNT(ifp, CNTP_ND, CNT_RETRANS);
+next:
 	if (state->rsprobes++ < MAX_RTR_SOLICITATIONS)
-		eloop_timeout_add_sec(ifp->ctx->eloop,
-		    RTR_SOLICITATION_INTERVAL, ipv6nd_sendrsprobe, ifp);
+		eloop_timer_add_sec_slack(ifp->ctx->eloop, &state->rs_timer,
+		    RTR_SOLICITATION_INTERVAL, RTR_SOLICITATION_SLACK,
+		    ipv6nd_sendrsprobe, ifp);
 	else
 		logwarnx("%s: no IPv6 Routers available", ifp->name);
 }
@@ -599,6 +617,7 @@ ipv6nd_startexpire(struct interface *ifp)
 		if (rap->iface == ifp)
 			rap->willexpire = true;
 	}
+	ipv6nd_sortrouters(ifp);
 	eloop_q_timeout_add_sec(ifp->ctx->eloop, ELOOP_IPV6RA_EXPIRE,
 	    RTR_CARRIER_EXPIRE, ipv6nd_expire, ifp);
 }
@@ -622,39 +641,86 @@ ipv6nd_rtpref(struct ra *rap)
 	/* NOTREACHED */
 }
 
+/*
+ * ctx->ra_routers is kept in order by also placing each router in
+ * ctx->ra_tree by rank. A router only moves when its rank changes,
+ * taking its place in the list from its neighbour in the tree.
+ * The rank orders by interface metric, then working routers before
+ * expired, expiring, zero lifetime and unreachable ones,
+ * then by router preference.
+ * All things being equal, prefer older routers.
+ */
+static uint64_t
+ipv6nd_rarank(struct ra *rap)
+{
+	uint64_t rank;
+
+	rank = (uint64_t)rap->iface->metric << 8;
+	if (rap->expired)
+		rank |= 0x80;
+	if (rap->willexpire)
+		rank |= 0x40;
+	if (rap->lifetime == 0)
+		rank |= 0x20;
+	if (!rap->isreachable)
+		rank |= 0x10;
+	rank |= (uint64_t)(RTPREF_HIGH - ipv6nd_rtpref(rap)) & 0x0f;
+	return rank;
+}
+
+static int
+ipv6nd_racmp(__unused void *context, const void *n1, const void *n2)
+{
+	const struct ra *ra1 = n1, *ra2 = n2;
+
+	if (ra1->rank != ra2->rank)
+		return ra1->rank < ra2->rank ? -1 : 1;
+	if (ra1->seq != ra2->seq)
+		return ra1->seq < ra2->seq ? -1 : 1;
+	return 0;
+}
+
+const rb_tree_ops_t ipv6nd_ra_ops = {
+	.rbto_compare_nodes = ipv6nd_racmp,
+	.rbto_compare_key = ipv6nd_racmp,
+	.rbto_node_offset = offsetof(struct ra, tree),
+	.rbto_context = NULL
+};
+
 static void
-ipv6nd_sortrouters(struct dhcpcd_ctx *ctx)
+ipv6nd_sortrouter(struct ra *rap)
 {
-	struct ra_head sorted_routers = TAILQ_HEAD_INITIALIZER(sorted_routers);
-	struct ra *ra1, *ra2;
+	struct dhcpcd_ctx *ctx = rap->iface->ctx;
+	uint64_t rank = ipv6nd_rarank(rap);
+	struct ra *ran;
 
-	while ((ra1 = TAILQ_FIRST(ctx->ra_routers)) != NULL) {
-		TAILQ_REMOVE(ctx->ra_routers, ra1, next);
-		TAILQ_FOREACH(ra2, &sorted_routers, next) {
-			if (ra1->iface->metric > ra2->iface->metric)
-				continue;
-			if (ra1->expired && !ra2->expired)
-				continue;
-			if (ra1->willexpire && !ra2->willexpire)
-				continue;
-			if (ra1->lifetime == 0 && ra2->lifetime != 0)
-				continue;
-			if (!ra1->isreachable && ra2->reachable)
-				continue;
-			if (ipv6nd_rtpref(ra1) <= ipv6nd_rtpref(ra2))
-				continue;
-			/* All things being equal, prefer older routers. */
-			/* We don't need to check time, becase newer
-			 * routers are always added to the tail and then
-			 * sorted. */
-			TAILQ_INSERT_BEFORE(ra2, ra1, next);
-			break;
-		}
-		if (ra2 == NULL)
-			TAILQ_INSERT_TAIL(&sorted_routers, ra1, next);
+	if (rap->sorted) {
+		if (rap->rank == rank)
+			return;
+		rb_tree_remove_node(&ctx->ra_tree, rap);
+		TAILQ_REMOVE(ctx->ra_routers, rap, next);
 	}
 
-	TAILQ_CONCAT(ctx->ra_routers, &sorted_routers, next);
+	rap->rank = rank;
+	rb_tree_insert_node(&ctx->ra_tree, rap);
+	rap->sorted = true;
+	ran = RB_TREE_NEXT(&ctx->ra_tree, rap);
+	if (ran != NULL)
+		TAILQ_INSERT_BEFORE(ran, rap, next);
+	else
+		TAILQ_INSERT_TAIL(ctx->ra_routers, rap, next);
+}
+
+static void
+ipv6nd_sortrouters(struct interface *ifp)
+{
+	struct ra *rap, *ran;
+
+	/* A router moved further on is just seen again unchanged. */
+	TAILQ_FOREACH_SAFE(rap, ifp->ctx->ra_routers, next, ran) {
+		if (rap->iface == ifp)
+			ipv6nd_sortrouter(rap);
+	}
 }
 
 static void
@@ -717,7 +783,7 @@ ipv6nd_neighbour(struct dhcpcd_ctx *ctx, struct in6_addr *addr, bool reachable)
 	    reachable ? "reachable again" : "unreachable");
 
 	/* See if we can install a reachable default router. */
-	ipv6nd_sortrouters(ctx);
+	ipv6nd_sortrouter(rap);
 	ipv6nd_applyra(rap->iface);
 	rt_build(ctx, AF_INET6);
 
@@ -816,8 +882,10 @@ ipv6nd_removefreedrop_ra(struct ra *rap, int remove_ra, int drop_ra)
 
 	eloop_timeout_delete(rap->iface->ctx->eloop, NULL, rap->iface);
 	eloop_timeout_delete(rap->iface->ctx->eloop, NULL, rap);
-	if (remove_ra)
+	if (remove_ra) {
+		rb_tree_remove_node(&rap->iface->ctx->ra_tree, rap);
 		TAILQ_REMOVE(rap->iface->ctx->ra_routers, rap, next);
+	}
 	ipv6_freedrop_addrs(&rap->addrs, drop_ra, NULL);
 	free(rap->data);
 	free(rap);
@@ -848,7 +916,7 @@ ipv6nd_free(struct interface *ifp)
 	close(state->nd_fd);
 #endif
 	free(state->rs);
-	free(state);
+	arena_put(&ifp->arena, state);
 	ifp->if_data[IF_DATA_IPV6ND] = NULL;
 	n = 0;
 	TAILQ_FOREACH_SAFE(rap, ifp->ctx->ra_routers, next, ran) {
@@ -1015,6 +1083,8 @@ ipv6nd_dadcallback(void *arg)
 	}
 
 try_script:
+	if (!(ia->addr_flags & IN6_IFF_DUPLICATED))
+		dhcpcd_phase(ifp->ctx, ifp, PHASE_DAD);
 	if (!wascompleted) {
 		TAILQ_FOREACH(rap, ifp->ctx->ra_routers, next) {
 			if (rap->iface != ifp)
@@ -1086,6 +1156,97 @@ dhcp6_start(__unused struct interface *ifp, __unused enum DH6S init_state)
 }
 #endif
 
+/*
+ * Compare two options of len bytes which have nlt 32-bit lifetimes
+ * at off. The lifetimes only differ if one of them is zero.
+ */
+static int
+ipv6nd_ltcmp(const uint8_t *p1, const uint8_t *p2, size_t len,
+    size_t off, size_t nlt)
+{
+	uint32_t lt1, lt2;
+	size_t end = off + nlt * sizeof(lt1);
+
+	if (len < end)
+		return memcmp(p1, p2, len);
+	if (memcmp(p1, p2, off) != 0)
+		return -1;
+	for (; off < end; off += sizeof(lt1)) {
+		memcpy(&lt1, p1 + off, sizeof(lt1));
+		memcpy(&lt2, p2 + off, sizeof(lt2));
+		if ((lt1 == 0) != (lt2 == 0))
+			return -1;
+	}
+	return memcmp(p1 + end, p2 + end, len - end);
+}
+
+/*
+ * Routers re-send the same RA every few seconds and some of them
+ * count the lifetimes down as they go.
+ * Return true if the RA only differs from the one we have in the
+ * value of lifetimes which are still non zero, so the caller
+ * just needs to refresh them.
+ */
+static bool
+ipv6nd_rasame(const struct ra *rap, const uint8_t *data, size_t len)
+{
+	const struct nd_router_advert *ra1, *ra2;
+	const uint8_t *p1, *p2;
+	size_t olen;
+	struct nd_opt_hdr ndo;
+	int r;
+
+	if (rap->data_len != len || len < sizeof(*ra1))
+		return false;
+
+	ra1 = (const void *)rap->data;
+	ra2 = (const void *)data;
+	if (ra1->nd_ra_curhoplimit != ra2->nd_ra_curhoplimit ||
+	    ra1->nd_ra_flags_reserved != ra2->nd_ra_flags_reserved ||
+	    (ra1->nd_ra_router_lifetime == 0) !=
+	    (ra2->nd_ra_router_lifetime == 0) ||
+	    ra1->nd_ra_reachable != ra2->nd_ra_reachable ||
+	    ra1->nd_ra_retransmit != ra2->nd_ra_retransmit)
+		return false;
+
+	len -= sizeof(*ra1);
+	p1 = rap->data + sizeof(*ra1);
+	p2 = data + sizeof(*ra1);
+	for (; len > 0; p1 += olen, p2 += olen, len -= olen) {
+		if (len < sizeof(ndo))
+			return false;
+		memcpy(&ndo, p2, sizeof(ndo));
+		olen = (size_t)ndo.nd_opt_len * 8;
+		if (olen == 0 || olen > len || memcmp(p1, p2, sizeof(ndo)))
+			return false;
+
+		switch (ndo.nd_opt_type) {
+		case ND_OPT_PREFIX_INFORMATION:
+			/* Valid time is followed by preferred time. */
+			r = ipv6nd_ltcmp(p1, p2, olen,
+			    offsetof(struct nd_opt_prefix_info,
+			    nd_opt_pi_valid_time), 2);
+			break;
+		case ND_OPT_RDNSS:
+			r = ipv6nd_ltcmp(p1, p2, olen,
+			    offsetof(struct nd_opt_rdnss,
+			    nd_opt_rdnss_lifetime), 1);
+			break;
+		case ND_OPT_DNSSL:
+			r = ipv6nd_ltcmp(p1, p2, olen,
+			    offsetof(struct nd_opt_dnssl,
+			    nd_opt_dnssl_lifetime), 1);
+			break;
+		default:
+			r = memcmp(p1, p2, olen);
+			break;
+		}
+		if (r != 0)
+			return false;
+	}
+	return true;
+}
+
 static void
 ipv6nd_handlera(struct dhcpcd_ctx *ctx,
     const struct sockaddr_in6 *from, const char *sfrom,
@@ -1102,7 +1263,7 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 	struct in6_addr pi_prefix;
 	struct ipv6_addr *ia;
 	struct dhcp_opt *dho;
-	bool new_rap, new_data, has_address;
+	bool new_rap, new_data, has_address, refresh;
 	uint32_t old_lifetime;
 	int ifmtu;
 	int loglevel;
@@ -1111,6 +1272,7 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 	bool new_ia;
 #endif
 
+	PROBE3(nd_ra, ifp != NULL ? ifp->name : NULL, sfrom, len);
 	if (ifp == NULL || RS_STATE(ifp) == NULL) {
 #ifdef DEBUG_RS
 		logdebugx("RA for unexpected interface from %s", sfrom);
@@ -1139,6 +1301,7 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 #endif
 		return;
 	}
+	load_definitions(ifp->ctx, DEFS_ND);
 
 	/* We could receive a RA before we sent a RS*/
 	if (ipv6_linklocal(ifp) == NULL) {
@@ -1178,6 +1341,13 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 
 	nd_ra = (struct nd_router_advert *)icp;
 
+	/* If only the lifetimes have changed we just need to refresh them
+	 * and can skip applying the RA, building routes and running
+	 * the script. */
+	refresh = rap != NULL && !rap->expired && !rap->willexpire &&
+	    rap->isreachable && !(ctx->options & DHCPCD_TEST) &&
+	    ipv6nd_rasame(rap, (uint8_t *)icp, len);
+
 	/* We don't want to spam the log with the fact we got an RA every
 	 * 30 seconds or so, so only spam the log if it's different. */
 	if (rap == NULL || (rap->data_len != len ||
@@ -1197,6 +1367,7 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 			return;
 		}
 		rap->iface = ifp;
+		rap->seq = ++ctx->ra_seq;
 		rap->from = from->sin6_addr;
 		strlcpy(rap->sfrom, sfrom, sizeof(rap->sfrom));
 		TAILQ_INIT(&rap->addrs);
@@ -1226,6 +1397,7 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 	    LOG_INFO : LOG_DEBUG;
 	logmessage(loglevel, "%s: Router Advertisement from %s",
 	    ifp->name, rap->sfrom);
+	dhcpcd_phase(ifp->ctx, ifp, PHASE_RA);
 
 	clock_gettime(CLOCK_MONOTONIC, &rap->acquired);
 	rap->flags = nd_ra->nd_ra_flags_reserved;
@@ -1280,16 +1452,11 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 			break;
 		}
 
-		if (has_option_mask(ifp->options->rejectmasknd,
+		if (has_option_mask(ifp->options->masks->rejectmasknd,
 		    ndo.nd_opt_type))
 		{
-			for (i = 0, dho = ctx->nd_opts;
-			    i < ctx->nd_opts_len;
-			    i++, dho++)
-			{
-				if (dho->option == ndo.nd_opt_type)
-					break;
-			}
+			dho = dhcp_optmap_find(&ctx->nd_optmap,
+			    ctx->nd_opts, ctx->nd_opts_len, ndo.nd_opt_type);
 			if (dho != NULL)
 				logwarnx("%s: reject RA (option %s) from %s",
 				    ifp->name, dho->var, rap->sfrom);
@@ -1303,7 +1470,8 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 			return;
 		}
 
-		if (has_option_mask(ifp->options->nomasknd, ndo.nd_opt_type))
+		if (has_option_mask(ifp->options->masks->nomasknd,
+		    ndo.nd_opt_type))
 			continue;
 
 		switch (ndo.nd_opt_type) {
@@ -1455,7 +1623,7 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 	    i < ctx->nd_opts_len;
 	    i++, dho++)
 	{
-		if (has_option_mask(ifp->options->requiremasknd,
+		if (has_option_mask(ifp->options->masks->requiremasknd,
 		    dho->option))
 		{
 			logwarnx("%s: reject RA (no option %s) from %s",
@@ -1485,23 +1653,24 @@ ipv6nd_handlera(struct dhcpcd_ctx *ctx,
 		logwarnx("%s: no global addresses for default route",
 		    ifp->name);
 
-	if (new_rap)
-		TAILQ_INSERT_TAIL(ctx->ra_routers, rap, next);
-	if (new_data)
-		ipv6nd_sortrouters(ifp->ctx);
+	ipv6nd_sortrouter(rap);
 
 	if (ifp->ctx->options & DHCPCD_TEST) {
 		script_runreason(ifp, "TEST");
 		goto handle_flag;
 	}
-	ipv6nd_applyra(ifp);
+	if (!refresh)
+		ipv6nd_applyra(ifp);
 	ipv6_addaddrs(&rap->addrs);
 #ifdef IPV6_MANAGETEMPADDR
 	ipv6_addtempaddrs(ifp, &rap->acquired);
 #endif
 
-	rt_build(ifp->ctx, AF_INET6);
-	ipv6nd_scriptrun(rap);
+	if (!refresh) {
+		rt_release(ifp, AF_INET6, RTDF_RA);
+		rt_build(ifp->ctx, AF_INET6);
+		ipv6nd_scriptrun(rap);
+	}
 
 	eloop_timeout_delete(ifp->ctx->eloop, NULL, ifp);
 	eloop_timeout_delete(ifp->ctx->eloop, NULL, rap); /* reachable timer */
@@ -1576,7 +1745,6 @@ ipv6nd_getoption(struct dhcpcd_ctx *ctx,
 {
 	struct nd_opt_hdr ndo;
 	size_t i;
-	struct dhcp_opt *opt;
 
 	if (od) {
 		*os = sizeof(ndo);
@@ -1594,15 +1762,8 @@ ipv6nd_getoption(struct dhcpcd_ctx *ctx,
 		*code = ndo.nd_opt_type;
 	}
 
-	for (i = 0, opt = ctx->nd_opts;
-	    i < ctx->nd_opts_len; i++, opt++)
-	{
-		if (opt->option == *code) {
-			*oopt = opt;
-			break;
-		}
-	}
-
+	*oopt = dhcp_optmap_find(&ctx->nd_optmap,
+	    ctx->nd_opts, ctx->nd_opts_len, *code);
 	if (od)
 		return od + sizeof(ndo);
 	return NULL;
@@ -1620,7 +1781,10 @@ ipv6nd_env(FILE *fp, const struct interface *ifp)
 	struct ipv6_addr *ia;
 	struct timespec now;
 	int pref;
+	struct if_options *ifo = ifp->options;
+	struct dhcpcd_ctx *ctx = ifp->ctx;
 
+	load_definitions(ctx, DEFS_ND);
 	clock_gettime(CLOCK_MONOTONIC, &now);
 	i = n = 0;
 	TAILQ_FOREACH(rap, ifp->ctx->ra_routers, next) {
@@ -1673,23 +1837,17 @@ ipv6nd_env(FILE *fp, const struct interface *ifp)
 				errno =	EINVAL;
 				break;
 			}
-			if (has_option_mask(rap->iface->options->nomasknd,
+			if (has_option_mask(
+			    rap->iface->options->masks->nomasknd,
 			    ndo.nd_opt_type))
 				continue;
-			for (j = 0, opt = rap->iface->options->nd_override;
-			    j < rap->iface->options->nd_override_len;
-			    j++, opt++)
-				if (opt->option == ndo.nd_opt_type)
-					break;
-			if (j == rap->iface->options->nd_override_len) {
-				for (j = 0, opt = rap->iface->ctx->nd_opts;
-				    j < rap->iface->ctx->nd_opts_len;
-				    j++, opt++)
-					if (opt->option == ndo.nd_opt_type)
-						break;
-				if (j == rap->iface->ctx->nd_opts_len)
-					opt = NULL;
-			}
+			opt = dhcp_optmap_find(&ifo->nd_overmap,
+			    ifo->nd_override, ifo->nd_override_len,
+			    ndo.nd_opt_type);
+			if (opt == NULL)
+				opt = dhcp_optmap_find(&ctx->nd_optmap,
+				    ctx->nd_opts, ctx->nd_opts_len,
+				    ndo.nd_opt_type);
 			if (opt == NULL)
 				continue;
 			dhcp_envoption(rap->iface->ctx, fp,
@@ -1833,7 +1991,8 @@ ipv6nd_expirera(void *arg)
 				break;
 			}
 
-			if (has_option_mask(rap->iface->options->nomasknd,
+			if (has_option_mask(
+			    rap->iface->options->masks->nomasknd,
 			    ndo.nd_opt_type))
 				continue;
 
@@ -1901,7 +2060,7 @@ ipv6nd_expirera(void *arg)
 	if (expired) {
 		logwarnx("%s: part of a Router Advertisement expired",
 		    ifp->name);
-		ipv6nd_sortrouters(ifp->ctx);
+		ipv6nd_sortrouters(ifp);
 		ipv6nd_applyra(ifp);
 		rt_build(ifp->ctx, AF_INET6);
 		script_runreason(ifp, "ROUTERADVERT");
@@ -1951,8 +2110,10 @@ ipv6nd_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg)
 	ifp = if_findifpfromcmsg(ctx, msg, &hoplimit);
 	if (ifp == NULL) {
 		logerr(__func__);
+		STATS_COUNT(ctx, CNTP_ND, CNT_NOIF);
 		return;
 	}
+	STATS_COUNT(ifp, CNTP_ND, CNT_RECV);
 
 	/* Don't do anything if the user hasn't configured it. */
 	if (ifp->active != IF_ACTIVE_USER ||
@@ -1977,26 +2138,7 @@ static void
 ipv6nd_handledata(void *arg)
 {
 	struct dhcpcd_ctx *ctx;
-	int fd;
-	struct sockaddr_in6 from;
-	union {
-		struct icmp6_hdr hdr;
-		uint8_t buf[64 * 1024]; /* Maximum ICMPv6 size */
-	} iovbuf;
-	struct iovec iov = {
-		.iov_base = iovbuf.buf, .iov_len = sizeof(iovbuf.buf),
-	};
-	union {
-		struct cmsghdr hdr;
-		uint8_t buf[CMSG_SPACE(sizeof(struct in6_pktinfo)) +
-		    CMSG_SPACE(sizeof(int))];
-	} cmsgbuf = { .buf = { 0 } };
-	struct msghdr msg = {
-	    .msg_name = &from, .msg_namelen = sizeof(from),
-	    .msg_iov = &iov, .msg_iovlen = 1,
-	    .msg_control = cmsgbuf.buf, .msg_controllen = sizeof(cmsgbuf.buf),
-	};
-	ssize_t len;
+	int fd, i, n;
 
 #ifdef __sun
 	struct interface *ifp;
@@ -2010,14 +2152,23 @@ ipv6nd_handledata(void *arg)
 	ctx = arg;
 	fd = ctx->nd_fd;
 #endif
-	len = recvmsg(fd, &msg, 0);
-	if (len == -1) {
+	if (ctx->nd_msgs == NULL) {
+		/* Maximum ICMPv6 size */
+		ctx->nd_msgs = if_msgbatch_new(64 * 1024);
+		if (ctx->nd_msgs == NULL) {
+			logerr(__func__);
+			return;
+		}
+	}
+
+	n = if_recvmsgs(fd, ctx->nd_msgs);
+	if (n == -1) {
 		logerr(__func__);
 		return;
 	}
 
-	iov.iov_len = (size_t)len;
-	ipv6nd_recvmsg(ctx, &msg);
+	for (i = 0; i < n; i++)
+		ipv6nd_recvmsg(ctx, IF_MSGBATCH_MSG(ctx->nd_msgs, i));
 }
 
 static void
@@ -2029,7 +2180,8 @@ ipv6nd_startrs1(void *arg)
 	loginfox("%s: soliciting an IPv6 router", ifp->name);
 	state = RS_STATE(ifp);
 	if (state == NULL) {
-		ifp->if_data[IF_DATA_IPV6ND] = calloc(1, sizeof(*state));
+		ifp->if_data[IF_DATA_IPV6ND] =
+		    arena_get(&ifp->arena, sizeof(*state));
 		state = RS_STATE(ifp);
 		if (state == NULL) {
 			logerr(__func__);
@@ -2065,6 +2217,7 @@ ipv6nd_startrs(struct interface *ifp)
 	}
 
 	delay = arc4random_uniform(MAX_RTR_SOLICITATION_DELAY * MSEC_PER_SEC);
+	delay = dhcpcd_startdelay(ifp->ctx, delay);
 	logdebugx("%s: delaying IPv6 router solicitation for %0.1f seconds",
 	    ifp->name, (float)delay / MSEC_PER_SEC);
 	eloop_timeout_add_msec(ifp->ctx->eloop, delay, ipv6nd_startrs1, ifp);
@@ -39,6 +39,10 @@
 
 struct ra {
 	TAILQ_ENTRY(ra) next;
+	rb_node_t tree;
+	uint64_t rank;		/* sort key when last placed in the tree */
+	uint64_t seq;
+	bool sorted;
 	struct interface *iface;
 	struct in6_addr from;
 	char sfrom[INET6_ADDRSTRLEN];
@@ -66,6 +70,7 @@ struct rs_state {
 	size_t rslen;
 	int rsprobes;
 	uint32_t retrans;
+	unsigned long long rs_timer;
 #ifdef __sun
 	int nd_fd;
 #endif
@@ -87,6 +92,9 @@ struct rs_state {
 #endif
 #endif
 
+/* Milliseconds a solicitation may be delayed to share a wakeup. */
+#define RTR_SOLICITATION_SLACK		250
+
 /* On carrier up, expire known routers after RTR_CARRIER_EXPIRE seconds. */
 #define RTR_CARRIER_EXPIRE		\
     (MAX_RTR_SOLICITATION_DELAY +	\
@@ -98,6 +106,8 @@ struct rs_state {
 #define	RETRANS_TIMER			1000	/* milliseconds */
 #define	DELAY_FIRST_PROBE_TIME		5	/* seconds */
 
+extern const rb_tree_ops_t ipv6nd_ra_ops;
+
 int ipv6nd_open(bool);
 #ifdef __sun
 int ipv6nd_openif(struct interface *);
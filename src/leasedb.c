@@ -0,0 +1,626 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - lease database
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * All leases live in one append only file so that starting on a host with
+ * thousands of interfaces reads one file rather than one per lease.
+ * The file is mapped read only and indexed by lease file name.
+ * Writing or removing a lease appends a record under an exclusive lock
+ * which replaces any earlier record of the same name.
+ * When replaced records take more space than live ones the live records
+ * are written to a new file which is renamed over the old one.
+ * Other processes notice the new inode and map it again.
+ */
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_SYS_RBTREE_H
+#include <sys/rbtree.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcpcd.h"
+#include "leasedb.h"
+#include "logerr.h"
+
+#define	LEASEDB_MAGIC	"dhcpcdDB"
+#define	LEASEDB_VERSION	1
+#define	LEASEDB_ALIGN	8
+/* Don't bother compacting a file smaller than this. */
+#define	LEASEDB_COMPACT	(64 * 1024)
+
+struct leasedb_hdr {
+	char		ldh_magic[8];
+	uint32_t	ldh_version;
+	uint32_t	ldh_reserved;
+};
+
+/* Followed by the name, the lease and padding to LEASEDB_ALIGN. */
+struct leasedb_rec {
+	uint32_t	ldr_len;
+	uint16_t	ldr_namelen;
+	uint16_t	ldr_flags;
+	uint32_t	ldr_datalen;
+	uint32_t	ldr_reserved;
+	int64_t		ldr_mtime;
+};
+#define	LDR_DELETED	0x0001
+
+struct leasedb_ent {
+	rb_node_t	lde_tree;
+	size_t		lde_off;
+	size_t		lde_len;
+	char		lde_name[];
+};
+
+struct leasedb {
+	int		ldb_fd;
+	dev_t		ldb_dev;
+	ino_t		ldb_ino;
+	void		*ldb_map;
+	size_t		ldb_maplen;
+	off_t		ldb_fsize;	/* file size when last looked at */
+	size_t		ldb_end;	/* end of the last valid record */
+	size_t		ldb_live;	/* bytes used by live records */
+	rb_tree_t	ldb_tree;
+};
+
+static int
+leasedb_compare_nodes(__unused void *context,
+    const void *node1, const void *node2)
+{
+	const struct leasedb_ent *e1 = node1, *e2 = node2;
+
+	return strcmp(e1->lde_name, e2->lde_name);
+}
+
+static int
+leasedb_compare_key(__unused void *context,
+    const void *node, const void *key)
+{
+	const struct leasedb_ent *e = node;
+
+	return strcmp(e->lde_name, key);
+}
+
+static const rb_tree_ops_t leasedb_ops = {
+	.rbto_compare_nodes = leasedb_compare_nodes,
+	.rbto_compare_key = leasedb_compare_key,
+	.rbto_node_offset = offsetof(struct leasedb_ent, lde_tree),
+	.rbto_context = NULL
+};
+
+/* Leases are named by the path they would otherwise be written to. */
+static const char *
+leasedb_name(const char *file)
+{
+	const char *name, *ext;
+
+	if (strncmp(file, DBDIR "/", sizeof(DBDIR)) != 0)
+		return NULL;
+	name = file + sizeof(DBDIR);
+	if (strchr(name, '/') != NULL)
+		return NULL;
+	ext = strrchr(name, '.');
+	if (ext == NULL || ext == name ||
+	    (strcmp(ext, ".lease") != 0 && strcmp(ext, ".lease6") != 0))
+		return NULL;
+	return name;
+}
+
+bool
+leasedb_handles(const struct dhcpcd_ctx *ctx, const char *file)
+{
+
+	return ctx->options & DHCPCD_LEASEDB && leasedb_name(file) != NULL;
+}
+
+static void
+leasedb_clear(struct leasedb *db)
+{
+	struct leasedb_ent *e;
+
+	while ((e = RB_TREE_MIN(&db->ldb_tree)) != NULL) {
+		rb_tree_remove_node(&db->ldb_tree, e);
+		free(e);
+	}
+	if (db->ldb_map != NULL) {
+		munmap(db->ldb_map, db->ldb_maplen);
+		db->ldb_map = NULL;
+	}
+	db->ldb_maplen = 0;
+	db->ldb_fsize = 0;
+	db->ldb_end = 0;
+	db->ldb_live = 0;
+}
+
+static void
+leasedb_close(struct leasedb *db)
+{
+
+	leasedb_clear(db);
+	if (db->ldb_fd != -1) {
+		close(db->ldb_fd);
+		db->ldb_fd = -1;
+	}
+}
+
+/* Replace the entry for name with a record of len bytes at off.
+ * A deleted record just removes the entry. */
+static int
+leasedb_set(struct leasedb *db, const char *name, size_t namelen,
+    size_t off, size_t len, bool deleted)
+{
+	struct leasedb_ent *e, *e1;
+
+	e = malloc(sizeof(*e) + namelen + 1);
+	if (e == NULL)
+		return -1;
+	memcpy(e->lde_name, name, namelen);
+	e->lde_name[namelen] = '\0';
+
+	e1 = rb_tree_find_node(&db->ldb_tree, e->lde_name);
+	if (e1 != NULL) {
+		free(e);
+		e = e1;
+		db->ldb_live -= e->lde_len;
+		if (deleted) {
+			rb_tree_remove_node(&db->ldb_tree, e);
+			free(e);
+			return 0;
+		}
+	} else {
+		if (deleted) {
+			free(e);
+			return 0;
+		}
+		e1 = rb_tree_insert_node(&db->ldb_tree, e);
+		assert(e1 == e);
+	}
+	e->lde_off = off;
+	e->lde_len = len;
+	db->ldb_live += len;
+	return 0;
+}
+
+/* Index the records from the end of the last valid one. */
+static int
+leasedb_index(struct leasedb *db)
+{
+	const char *map = db->ldb_map;
+	struct leasedb_rec rec;
+	size_t off = db->ldb_end;
+
+	while (db->ldb_maplen - off >= sizeof(rec)) {
+		memcpy(&rec, map + off, sizeof(rec));
+		if (rec.ldr_namelen == 0 ||
+		    rec.ldr_len % LEASEDB_ALIGN != 0 ||
+		    rec.ldr_len > db->ldb_maplen - off ||
+		    rec.ldr_len <
+		    sizeof(rec) + rec.ldr_namelen + rec.ldr_datalen)
+			break;
+		if (leasedb_set(db, map + off + sizeof(rec), rec.ldr_namelen,
+		    off, rec.ldr_len, rec.ldr_flags & LDR_DELETED) == -1)
+			return -1;
+		off += rec.ldr_len;
+	}
+
+	/* A partial record is left if we were killed mid write.
+	 * It's removed before the next append. */
+	if (off != db->ldb_maplen)
+		logwarnx("%s: ignoring %zu bytes at offset %zu",
+		    LEASEDB, db->ldb_maplen - off, off);
+	db->ldb_end = off;
+	return 0;
+}
+
+static int
+leasedb_init(struct leasedb *db)
+{
+	struct leasedb_hdr hdr = {
+		.ldh_magic = LEASEDB_MAGIC,
+		.ldh_version = LEASEDB_VERSION,
+	};
+
+	if (ftruncate(db->ldb_fd, 0) == -1 ||
+	    pwrite(db->ldb_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		return -1;
+	db->ldb_fsize = sizeof(hdr);
+	db->ldb_end = sizeof(hdr);
+	return 0;
+}
+
+/* Map the whole file and index anything we haven't seen yet. */
+static int
+leasedb_map(struct leasedb *db, const struct stat *st)
+{
+	struct leasedb_hdr hdr;
+	void *map;
+
+	if (st->st_size < db->ldb_fsize)
+		leasedb_clear(db);
+	if (st->st_size < (off_t)sizeof(hdr)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	map = mmap(NULL, (size_t)st->st_size, PROT_READ, MAP_SHARED,
+	    db->ldb_fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	if (db->ldb_map != NULL)
+		munmap(db->ldb_map, db->ldb_maplen);
+	db->ldb_map = map;
+	db->ldb_maplen = (size_t)st->st_size;
+	db->ldb_fsize = st->st_size;
+
+	if (db->ldb_end == 0) {
+		memcpy(&hdr, map, sizeof(hdr));
+		if (memcmp(hdr.ldh_magic, LEASEDB_MAGIC,
+		    sizeof(hdr.ldh_magic)) != 0 ||
+		    hdr.ldh_version != LEASEDB_VERSION)
+		{
+			logerrx("%s: unknown format", LEASEDB);
+			errno = EINVAL;
+			return -1;
+		}
+		db->ldb_end = sizeof(hdr);
+	}
+	return leasedb_index(db);
+}
+
+/* Make sure we have the current file open and indexed. */
+static struct leasedb *
+leasedb_sync(struct dhcpcd_ctx *ctx)
+{
+	struct leasedb *db = ctx->leasedb;
+	struct stat st;
+
+	if (db == NULL) {
+		db = calloc(1, sizeof(*db));
+		if (db == NULL)
+			return NULL;
+		db->ldb_fd = -1;
+		rb_tree_init(&db->ldb_tree, &leasedb_ops);
+		ctx->leasedb = db;
+	}
+
+	/* If the file was compacted by another process, start again. */
+	if (db->ldb_fd != -1 && (stat(LEASEDB, &st) == -1 ||
+	    st.st_dev != db->ldb_dev || st.st_ino != db->ldb_ino))
+		leasedb_close(db);
+
+	if (db->ldb_fd == -1) {
+		db->ldb_fd = open(LEASEDB,
+		    O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+		if (db->ldb_fd == -1)
+			return NULL;
+		if (fstat(db->ldb_fd, &st) == -1) {
+			leasedb_close(db);
+			return NULL;
+		}
+		db->ldb_dev = st.st_dev;
+		db->ldb_ino = st.st_ino;
+
+		/* A new file, or one we were killed creating. */
+		if (st.st_size < (off_t)sizeof(struct leasedb_hdr)) {
+			if (flock(db->ldb_fd, LOCK_EX) == -1 ||
+			    fstat(db->ldb_fd, &st) == -1 ||
+			    (st.st_size < (off_t)sizeof(struct leasedb_hdr) &&
+			    leasedb_init(db) == -1))
+			{
+				leasedb_close(db);
+				return NULL;
+			}
+			flock(db->ldb_fd, LOCK_UN);
+			if (db->ldb_fsize != 0)
+				return db;
+		}
+	}
+
+	if (st.st_size != db->ldb_fsize && leasedb_map(db, &st) == -1) {
+		leasedb_close(db);
+		return NULL;
+	}
+	return db;
+}
+
+/* Lock the current file, following any rename made while we waited. */
+static struct leasedb *
+leasedb_lock(struct dhcpcd_ctx *ctx)
+{
+	struct leasedb *db;
+	struct stat st;
+
+	for (;;) {
+		if ((db = leasedb_sync(ctx)) == NULL)
+			return NULL;
+		if (flock(db->ldb_fd, LOCK_EX) == -1)
+			return NULL;
+		if (stat(LEASEDB, &st) == 0 &&
+		    st.st_dev == db->ldb_dev && st.st_ino == db->ldb_ino)
+			break;
+		flock(db->ldb_fd, LOCK_UN);
+		leasedb_close(db);
+	}
+
+	/* Pick up anything appended while we waited. */
+	if (st.st_size != db->ldb_fsize && leasedb_map(db, &st) == -1) {
+		flock(db->ldb_fd, LOCK_UN);
+		leasedb_close(db);
+		return NULL;
+	}
+	return db;
+}
+
+static void
+leasedb_unlock(struct leasedb *db)
+{
+
+	if (db->ldb_fd != -1)
+		flock(db->ldb_fd, LOCK_UN);
+}
+
+static int
+leasedb_compact(struct leasedb *db)
+{
+	struct leasedb_hdr hdr = {
+		.ldh_magic = LEASEDB_MAGIC,
+		.ldh_version = LEASEDB_VERSION,
+	};
+	struct stat st;
+	struct leasedb_ent *e;
+	char *buf, *p;
+	size_t len;
+	int fd;
+
+	/* Our own appends are not mapped yet. */
+	if (fstat(db->ldb_fd, &st) == -1 || leasedb_map(db, &st) == -1)
+		return -1;
+
+	len = sizeof(hdr) + db->ldb_live;
+	if ((buf = malloc(len)) == NULL)
+		return -1;
+	memcpy(buf, &hdr, sizeof(hdr));
+	p = buf + sizeof(hdr);
+	RB_TREE_FOREACH(e, &db->ldb_tree) {
+		memcpy(p, (char *)db->ldb_map + e->lde_off, e->lde_len);
+		p += e->lde_len;
+	}
+
+	fd = open(LEASEDB ".new", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+	    0640);
+	if (fd == -1)
+		goto err;
+	if (write(fd, buf, len) != (ssize_t)len || close(fd) == -1) {
+		if (fd != -1)
+			close(fd);
+		unlink(LEASEDB ".new");
+		goto err;
+	}
+	free(buf);
+	if (rename(LEASEDB ".new", LEASEDB) == -1) {
+		unlink(LEASEDB ".new");
+		return -1;
+	}
+
+	/* Dropping the old file also drops our lock on it. */
+	leasedb_close(db);
+	return 0;
+
+err:
+	free(buf);
+	return -1;
+}
+
+static ssize_t
+leasedb_append(struct dhcpcd_ctx *ctx, const char *name,
+    const void *data, size_t len, uint16_t flags, time_t mtime)
+{
+	struct leasedb *db;
+	struct leasedb_rec *rec;
+	size_t namelen = strlen(name), reclen;
+	ssize_t bytes;
+
+	reclen = sizeof(*rec) + namelen + len;
+	reclen = (reclen + LEASEDB_ALIGN - 1) & ~(size_t)(LEASEDB_ALIGN - 1);
+	if (namelen > UINT16_MAX || reclen > UINT32_MAX) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	if ((rec = calloc(1, reclen)) == NULL)
+		return -1;
+	rec->ldr_len = (uint32_t)reclen;
+	rec->ldr_namelen = (uint16_t)namelen;
+	rec->ldr_flags = flags;
+	rec->ldr_datalen = (uint32_t)len;
+	rec->ldr_mtime = (int64_t)(mtime != 0 ? mtime : time(NULL));
+	memcpy(rec + 1, name, namelen);
+	if (len != 0)
+		memcpy((char *)(rec + 1) + namelen, data, len);
+
+	if ((db = leasedb_lock(ctx)) == NULL) {
+		free(rec);
+		return -1;
+	}
+
+	/* Drop any partial record so ours can be found. */
+	if (db->ldb_fsize != (off_t)db->ldb_end) {
+		if (ftruncate(db->ldb_fd, (off_t)db->ldb_end) == -1)
+			goto err;
+		db->ldb_fsize = (off_t)db->ldb_end;
+	}
+
+	bytes = write(db->ldb_fd, rec, reclen);
+	if (bytes != (ssize_t)reclen) {
+		if (bytes != -1) {
+			if (ftruncate(db->ldb_fd, (off_t)db->ldb_end) == -1)
+				logerr("%s: ftruncate", LEASEDB);
+			errno = ENOSPC;
+		}
+		goto err;
+	}
+	free(rec);
+	rec = NULL;
+
+	if (leasedb_set(db, name, namelen, db->ldb_end, reclen,
+	    flags & LDR_DELETED) == -1)
+	{
+		/* Index it from the file next time. */
+		leasedb_unlock(db);
+		leasedb_close(db);
+		return -1;
+	}
+	db->ldb_end += reclen;
+	db->ldb_fsize += (off_t)reclen;
+
+	if (db->ldb_end > LEASEDB_COMPACT &&
+	    db->ldb_end - sizeof(struct leasedb_hdr) > db->ldb_live * 2 &&
+	    leasedb_compact(db) == -1)
+		logerr("%s: compact", LEASEDB);
+
+	leasedb_unlock(db);
+	return (ssize_t)len;
+
+err:
+	free(rec);
+	leasedb_unlock(db);
+	return -1;
+}
+
+static const struct leasedb_rec *
+leasedb_find(struct dhcpcd_ctx *ctx, const char *name)
+{
+	struct leasedb *db;
+	struct leasedb_ent *e;
+	struct stat st;
+
+	if ((db = leasedb_sync(ctx)) == NULL)
+		return NULL;
+	e = rb_tree_find_node(&db->ldb_tree, name);
+	if (e == NULL) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	/* We appended it ourselves and haven't mapped it yet. */
+	if (e->lde_off + e->lde_len > db->ldb_maplen) {
+		if (fstat(db->ldb_fd, &st) == -1 ||
+		    leasedb_map(db, &st) == -1)
+			return NULL;
+	}
+	return (const void *)((const char *)db->ldb_map + e->lde_off);
+}
+
+ssize_t
+leasedb_read(struct dhcpcd_ctx *ctx, const char *file, void *data, size_t len)
+{
+	const struct leasedb_rec *rec;
+
+	rec = leasedb_find(ctx, leasedb_name(file));
+	if (rec == NULL) {
+		/* Leases from before the database was enabled. */
+		if (errno == ENOENT)
+			return readfile(file, data, len);
+		return -1;
+	}
+
+	/* Mirror readfile. */
+	if (rec->ldr_datalen >= len) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	memcpy(data, (const char *)(rec + 1) + rec->ldr_namelen,
+	    rec->ldr_datalen);
+	return (ssize_t)rec->ldr_datalen;
+}
+
+ssize_t
+leasedb_write(struct dhcpcd_ctx *ctx, const char *file,
+    const void *data, size_t len, time_t mtime)
+{
+	ssize_t bytes;
+
+	bytes = leasedb_append(ctx, leasedb_name(file), data, len, 0, mtime);
+	/* Don't leave a stale lease from before the database was enabled. */
+	if (bytes != -1)
+		unlink(file);
+	return bytes;
+}
+
+int
+leasedb_mtime(struct dhcpcd_ctx *ctx, const char *file, time_t *time)
+{
+	const struct leasedb_rec *rec;
+
+	rec = leasedb_find(ctx, leasedb_name(file));
+	if (rec == NULL) {
+		if (errno == ENOENT)
+			return filemtime(file, time);
+		return -1;
+	}
+	*time = (time_t)rec->ldr_mtime;
+	return 0;
+}
+
+int
+leasedb_unlink(struct dhcpcd_ctx *ctx, const char *file)
+{
+	const char *name = leasedb_name(file);
+	int r;
+
+	/* Remove any lease from before the database was enabled as well. */
+	r = unlink(file);
+	if (leasedb_find(ctx, name) == NULL)
+		return r;
+	return leasedb_append(ctx, name, NULL, 0, LDR_DELETED, 0) == -1 ?
+	    -1 : 0;
+}
+
+void
+leasedb_free(struct dhcpcd_ctx *ctx)
+{
+
+	if (ctx->leasedb == NULL)
+		return;
+	leasedb_close(ctx->leasedb);
+	free(ctx->leasedb);
+	ctx->leasedb = NULL;
+}
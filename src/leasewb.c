@@ -0,0 +1,341 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - lease write behind
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Binding or renewing a lease wrote it out there and then, which under
+ * privsep is also a round trip to the privileged actioneer.
+ * A renewal which changes nothing but the transaction id now leaves the
+ * file be for as long as the lease on disk still lasts until the next
+ * renewal and lapses no later than the one just bound, so a restart never
+ * believes it has more of a lease than the server gave.
+ * With lease_writeback the rest are gathered up and written together that
+ * many seconds later and when we exit, and are read from here until then.
+ * Each is given the time it was bound as its mtime, so a lease written
+ * later than that looks no younger than it is.
+ */
+
+#ifdef HAVE_SYS_RBTREE_H
+#include <sys/rbtree.h>
+#endif
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcp-common.h"
+#include "dhcpcd.h"
+#include "eloop.h"
+#include "leasewb.h"
+#include "logerr.h"
+#include "privsep.h"
+
+#define	LEASEWB_MODE	0640
+
+struct leasewb_ent {
+	rb_node_t	lwe_tree;
+	void		*lwe_data;
+	size_t		lwe_len;
+	time_t		lwe_mtime;	/* when the lease was bound */
+	time_t		lwe_expires;	/* when it lapses, 0 never */
+	bool		lwe_dirty;	/* not written yet */
+	char		lwe_file[];
+};
+
+struct leasewb {
+	rb_tree_t	lwb_tree;
+	bool		lwb_queued;
+};
+
+static int
+leasewb_compare_nodes(__unused void *context,
+    const void *node1, const void *node2)
+{
+	const struct leasewb_ent *e1 = node1, *e2 = node2;
+
+	return strcmp(e1->lwe_file, e2->lwe_file);
+}
+
+static int
+leasewb_compare_key(__unused void *context,
+    const void *node, const void *key)
+{
+	const struct leasewb_ent *e = node;
+
+	return strcmp(e->lwe_file, key);
+}
+
+static const rb_tree_ops_t leasewb_ops = {
+	.rbto_compare_nodes = leasewb_compare_nodes,
+	.rbto_compare_key = leasewb_compare_key,
+	.rbto_node_offset = offsetof(struct leasewb_ent, lwe_tree),
+	.rbto_context = NULL
+};
+
+static struct leasewb_ent *
+leasewb_find(const struct dhcpcd_ctx *ctx, const char *file)
+{
+
+	if (ctx->leasewb == NULL)
+		return NULL;
+	return rb_tree_find_node(&ctx->leasewb->lwb_tree, file);
+}
+
+static void
+leasewb_writeent(struct dhcpcd_ctx *ctx, struct leasewb_ent *e, bool wait)
+{
+	ssize_t r;
+
+#ifndef PRIVSEP
+	UNUSED(wait);
+#endif
+
+	e->lwe_dirty = false;
+#ifdef PRIVSEP
+	/* Don't wait for root to write each lease of a batch. */
+	if (!wait && IN_PRIVSEP(ctx) &&
+	    !(ctx->options & DHCPCD_PRIVSEPROOT))
+		r = ps_root_writefile_async(ctx, e->lwe_file, LEASEWB_MODE,
+		    e->lwe_data, e->lwe_len, e->lwe_mtime);
+	else
+#endif
+	r = dhcp_writefile_mtime(ctx, e->lwe_file, LEASEWB_MODE,
+	    e->lwe_data, e->lwe_len, e->lwe_mtime);
+	if (r == -1) {
+		logerr("%s: %s", __func__, e->lwe_file);
+		/* Whatever is on disk now, it isn't this. */
+		e->lwe_len = 0;
+	}
+}
+
+static void
+leasewb_writedirty(struct dhcpcd_ctx *ctx, bool wait)
+{
+	struct leasewb_ent *e;
+
+	RB_TREE_FOREACH(e, &ctx->leasewb->lwb_tree) {
+		if (e->lwe_dirty)
+			leasewb_writeent(ctx, e, wait);
+	}
+}
+
+static void
+leasewb_writeall(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+
+	ctx->leasewb->lwb_queued = false;
+	leasewb_writedirty(ctx, false);
+}
+
+/* Does the lease on disk still do for a lease bound now? */
+static bool
+leasewb_unchanged(const struct leasewb_ent *e, const uint8_t *data,
+    size_t len, size_t hdrlen, time_t now, time_t expires, uint32_t renew)
+{
+
+	if (e->lwe_dirty || e->lwe_len != len || len < hdrlen ||
+	    memcmp((const uint8_t *)e->lwe_data + hdrlen, data + hdrlen,
+	    len - hdrlen) != 0)
+		return false;
+	if (e->lwe_expires == 0 || expires == 0)
+		return e->lwe_expires == expires;
+	return e->lwe_expires <= expires &&
+	    e->lwe_expires >= now + (time_t)renew;
+}
+
+/* Hands a bound lease over to be written.
+ * The first hdrlen bytes of it change with every exchange.
+ * lifetime is how long it lasts and renew when it will next be renewed,
+ * in seconds from now. */
+ssize_t
+leasewb_write(const struct interface *ifp, const char *file,
+    const void *data, size_t len, size_t hdrlen,
+    uint32_t lifetime, uint32_t renew)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct leasewb *wb = ctx->leasewb;
+	struct leasewb_ent *e;
+	time_t now, expires;
+	size_t flen;
+	void *n;
+
+	now = time(NULL);
+	if (now == -1)
+		return -1;
+	if (lifetime == UINT32_MAX)
+		expires = 0;
+	else
+		expires = now + (time_t)lifetime;
+
+	if (wb == NULL) {
+		wb = malloc(sizeof(*wb));
+		if (wb == NULL)
+			return -1;
+		rb_tree_init(&wb->lwb_tree, &leasewb_ops);
+		wb->lwb_queued = false;
+		ctx->leasewb = wb;
+	}
+
+	e = rb_tree_find_node(&wb->lwb_tree, file);
+	if (e != NULL &&
+	    leasewb_unchanged(e, data, len, hdrlen, now, expires, renew))
+	{
+		logdebugx("%s: lease unchanged: %s", ifp->name, file);
+		return (ssize_t)len;
+	}
+
+	if (e == NULL) {
+		flen = strlen(file) + 1;
+		e = malloc(sizeof(*e) + flen);
+		if (e == NULL)
+			return -1;
+		memcpy(e->lwe_file, file, flen);
+		e->lwe_data = NULL;
+		e->lwe_len = 0;
+		e->lwe_dirty = false;
+		rb_tree_insert_node(&wb->lwb_tree, e);
+	}
+	if (len > e->lwe_len) {
+		n = realloc(e->lwe_data, len);
+		if (n == NULL)
+			return -1;
+		e->lwe_data = n;
+	}
+	memcpy(e->lwe_data, data, len);
+	e->lwe_len = len;
+	e->lwe_mtime = now;
+	e->lwe_expires = expires;
+
+	if (ctx->lease_writeback == 0 || ctx->options & DHCPCD_EXITING) {
+		logdebugx("%s: writing lease: %s", ifp->name, file);
+		leasewb_writeent(ctx, e, true);
+		return (ssize_t)len;
+	}
+
+	logdebugx("%s: writing lease in %u seconds: %s",
+	    ifp->name, ctx->lease_writeback, file);
+	e->lwe_dirty = true;
+	if (!wb->lwb_queued) {
+		if (eloop_timeout_add_sec(ctx->eloop, ctx->lease_writeback,
+		    leasewb_writeall, ctx) == -1)
+		{
+			logerr(__func__);
+			leasewb_writeent(ctx, e, true);
+		} else
+			wb->lwb_queued = true;
+	}
+	return (ssize_t)len;
+}
+
+/* Is a newer lease waiting here than on disk? */
+bool
+leasewb_handles(const struct dhcpcd_ctx *ctx, const char *file)
+{
+	struct leasewb_ent *e = leasewb_find(ctx, file);
+
+	return e != NULL && e->lwe_dirty;
+}
+
+ssize_t
+leasewb_read(struct dhcpcd_ctx *ctx, const char *file, void *data, size_t len)
+{
+	struct leasewb_ent *e = leasewb_find(ctx, file);
+
+	if (e == NULL || !e->lwe_dirty) {
+		errno = ENOENT;
+		return -1;
+	}
+	/* Same as readfile(), the buffer must be bigger than the lease. */
+	if (e->lwe_len >= len) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	memcpy(data, e->lwe_data, e->lwe_len);
+	return (ssize_t)e->lwe_len;
+}
+
+int
+leasewb_mtime(struct dhcpcd_ctx *ctx, const char *file, time_t *time)
+{
+	struct leasewb_ent *e = leasewb_find(ctx, file);
+
+	if (e == NULL || !e->lwe_dirty) {
+		errno = ENOENT;
+		return -1;
+	}
+	*time = e->lwe_mtime;
+	return 0;
+}
+
+/* The lease is going, so forget it before it is written back. */
+void
+leasewb_unlink(struct dhcpcd_ctx *ctx, const char *file)
+{
+	struct leasewb_ent *e = leasewb_find(ctx, file);
+
+	if (e == NULL)
+		return;
+	rb_tree_remove_node(&ctx->leasewb->lwb_tree, e);
+	free(e->lwe_data);
+	free(e);
+}
+
+/* Write out anything still waiting before we exit. */
+void
+leasewb_flush(struct dhcpcd_ctx *ctx)
+{
+
+	if (ctx->leasewb == NULL)
+		return;
+	if (ctx->leasewb->lwb_queued) {
+		eloop_timeout_delete(ctx->eloop, leasewb_writeall, ctx);
+		ctx->leasewb->lwb_queued = false;
+	}
+	leasewb_writedirty(ctx, true);
+}
+
+void
+leasewb_free(struct dhcpcd_ctx *ctx)
+{
+	struct leasewb_ent *e;
+
+	if (ctx->leasewb == NULL)
+		return;
+	while ((e = RB_TREE_MIN(&ctx->leasewb->lwb_tree)) != NULL) {
+		rb_tree_remove_node(&ctx->leasewb->lwb_tree, e);
+		free(e->lwe_data);
+		free(e);
+	}
+	free(ctx->leasewb);
+	ctx->leasewb = NULL;
+}
@@ -30,6 +30,7 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -52,6 +53,40 @@
 
 #define UNUSED(a)		(void)(a)
 
+#ifndef SMALL
+/* Messages are formatted once into a ring of records.
+ * This keeps the last few for logdump() and, when async, lets logflush()
+ * write them out in batches when the event loop is idle. */
+#define	LOGERR_NRECS		LOGERR_NDUMP
+#define	LOGERR_RECLEN		512
+#define	LOGERR_PREFIXLEN	128
+
+struct logrec {
+	time_t		 lr_time;
+	int		 lr_pri;
+	pid_t		 lr_pid;
+	char		 lr_msg[LOGERR_RECLEN];
+};
+
+static struct logrec _logrecs[LOGERR_NRECS];
+
+/* Each call site logs with its own format string, so the pointer to it
+ * is used as the key to rate limit on.
+ * Sites which hash to the same slot just take it from each other. */
+#define	LOGERR_NLIMITS		64
+#define	LOGERR_TOKEN		1000	/* tokens are kept in thousandths */
+
+struct loglimit {
+	const char	*ll_fmt;
+	int		 ll_pri;
+	unsigned int	 ll_tokens;
+	unsigned int	 ll_suppressed;
+	struct timespec	 ll_time;
+};
+
+static struct loglimit _loglimits[LOGERR_NLIMITS];
+#endif
+
 struct logctx {
 	char		 log_buf[BUFSIZ];
 	unsigned int	 log_opts;
@@ -62,6 +97,14 @@ struct logctx {
 #ifdef LOGERR_TAG
 	const char	*log_tag;
 #endif
+	bool		 log_async;
+	size_t		 log_nrecs;	/* records made */
+	size_t		 log_nflushed;	/* and written out */
+	time_t		 log_datetime;
+	char		 log_date[32];
+	unsigned int	 log_burst;
+	unsigned int	 log_interval;
+	unsigned int	 log_nsuppressed;	/* limits with a summary due */
 #endif
 };
 
@@ -102,82 +145,93 @@ getprogname(void)
 #endif
 
 #ifndef SMALL
-/* Write the time, syslog style. month day time - */
-static int
-logprintdate(FILE *stream)
+/* Write the time, syslog style. month day time -
+ * This only changes once a second, so only format it then. */
+static const char *
+logdate(struct logctx *ctx, time_t now)
 {
-	struct timeval tv;
-	time_t now;
 	struct tm tmnow;
-	char buf[32];
 
-	if (gettimeofday(&tv, NULL) == -1)
-		return -1;
-
-	now = tv.tv_sec;
-	if (localtime_r(&now, &tmnow) == NULL)
-		return -1;
-	if (strftime(buf, sizeof(buf), "%b %d %T ", &tmnow) == 0)
-		return -1;
-	return fprintf(stream, "%s", buf);
+	if (ctx->log_date[0] != '\0' && ctx->log_datetime == now)
+		return ctx->log_date;
+	if (localtime_r(&now, &tmnow) == NULL ||
+	    strftime(ctx->log_date, sizeof(ctx->log_date), "%b %d %T ",
+	    &tmnow) == 0)
+	{
+		ctx->log_date[0] = '\0';
+		return NULL;
+	}
+	ctx->log_datetime = now;
+	return ctx->log_date;
 }
-#endif
 
-__printflike(3, 0) static int
-vlogprintf_r(struct logctx *ctx, FILE *stream, const char *fmt, va_list args)
+/* Write the date, tag and pid to buf for stderr or the log file. */
+static int
+logprefix(struct logctx *ctx, char *buf, size_t buflen, bool err,
+    time_t now, pid_t pid)
 {
-	int len = 0, e;
-	va_list a;
-#ifndef SMALL
+	const char *date;
+	size_t len = 0;
+	int l;
 	bool log_pid;
 #ifdef LOGERR_TAG
 	bool log_tag;
 #endif
 
-	if ((stream == stderr && ctx->log_opts & LOGERR_ERR_DATE) ||
-	    (stream != stderr && ctx->log_opts & LOGERR_LOG_DATE))
-	{
-		if ((e = logprintdate(stream)) == -1)
+#define	LOGAPPEND(...)							\
+	do {								\
+		l = snprintf(buf + len, buflen - len, __VA_ARGS__);	\
+		if (l == -1)						\
+			return -1;					\
+		len += (size_t)l;					\
+		if (len >= buflen)					\
+			len = buflen - 1;				\
+	} while (0 /* CONSTCOND */)
+
+	buf[0] = '\0';
+	if (ctx->log_opts & (err ? LOGERR_ERR_DATE : LOGERR_LOG_DATE)) {
+		if ((date = logdate(ctx, now)) == NULL)
 			return -1;
-		len += e;
+		LOGAPPEND("%s", date);
 	}
 
 #ifdef LOGERR_TAG
-	log_tag = ((stream == stderr && ctx->log_opts & LOGERR_ERR_TAG) ||
-	    (stream != stderr && ctx->log_opts & LOGERR_LOG_TAG));
+	log_tag = ctx->log_opts & (err ? LOGERR_ERR_TAG : LOGERR_LOG_TAG);
 	if (log_tag) {
 		if (ctx->log_tag == NULL)
 			ctx->log_tag = getprogname();
-		if ((e = fprintf(stream, "%s", ctx->log_tag)) == -1)
-			return -1;
-		len += e;
+		LOGAPPEND("%s", ctx->log_tag);
 	}
 #endif
 
-	log_pid = ((stream == stderr && ctx->log_opts & LOGERR_ERR_PID) ||
-	    (stream != stderr && ctx->log_opts & LOGERR_LOG_PID));
-	if (log_pid) {
-		pid_t pid;
-
-		if (ctx->log_pid == 0)
-			pid = getpid();
-		else
-			pid = ctx->log_pid;
-		if ((e = fprintf(stream, "[%d]", pid)) == -1)
-			return -1;
-		len += e;
-	}
+	log_pid = ctx->log_opts & (err ? LOGERR_ERR_PID : LOGERR_LOG_PID);
+	if (log_pid)
+		LOGAPPEND("[%d]", pid == 0 ? getpid() : pid);
 
 #ifdef LOGERR_TAG
 	if (log_tag || log_pid)
 #else
 	if (log_pid)
 #endif
-	{
-		if ((e = fprintf(stream, ": ")) == -1)
-			return -1;
-		len += e;
-	}
+		LOGAPPEND(": ");
+#undef LOGAPPEND
+
+	return (int)len;
+}
+#endif
+
+__printflike(3, 0) static int
+vlogprintf_r(struct logctx *ctx, FILE *stream, const char *fmt, va_list args)
+{
+	int len = 0, e;
+	va_list a;
+#ifndef SMALL
+	char buf[LOGERR_PREFIXLEN];
+
+	len = logprefix(ctx, buf, sizeof(buf), stream == stderr, time(NULL),
+	    ctx->log_pid);
+	if (len == -1 || fputs(buf, stream) == EOF)
+		return -1;
 #else
 	UNUSED(ctx);
 #endif
@@ -193,6 +247,114 @@ vlogprintf_r(struct logctx *ctx, FILE *stream, const char *fmt, va_list args)
 	return e == -1 ? -1 : len + e;
 }
 
+#ifndef SMALL
+static bool
+logwants_err(const struct logctx *ctx, int pri)
+{
+
+	return ctx->log_opts & LOGERR_ERR &&
+	    (pri <= LOG_ERR ||
+	    (!(ctx->log_opts & LOGERR_QUIET) && pri <= LOG_INFO) ||
+	    (ctx->log_opts & LOGERR_DEBUG && pri <= LOG_DEBUG));
+}
+
+/* Add a record to buf, writing buf out first if it is full. */
+static void
+logbatch(struct logctx *ctx, FILE *stream, char *buf, size_t *buflen,
+    const struct logrec *lr, pid_t pid)
+{
+	size_t len = *buflen, mlen = strlen(lr->lr_msg);
+	int l;
+
+	if (len + LOGERR_PREFIXLEN + mlen + 1 > BUFSIZ) {
+		fwrite(buf, 1, len, stream);
+		len = 0;
+	}
+	l = logprefix(ctx, buf + len, BUFSIZ - len, stream == stderr,
+	    lr->lr_time, lr->lr_pid != 0 ? lr->lr_pid : pid);
+	if (l == -1)
+		return;
+	len += (size_t)l;
+	memcpy(buf + len, lr->lr_msg, mlen);
+	len += mlen;
+	buf[len++] = '\n';
+	*buflen = len;
+}
+#endif
+
+#ifndef SMALL
+static void logexpire(struct logctx *);
+#endif
+
+void
+logflush(void)
+{
+#ifndef SMALL
+	struct logctx *ctx = &_logctx;
+	const struct logrec *lr;
+	char ebuf[BUFSIZ], fbuf[BUFSIZ];
+	size_t elen = 0, flen = 0;
+	pid_t pid;
+
+	if (ctx->log_nsuppressed != 0)
+		logexpire(ctx);
+	if (ctx->log_nflushed == ctx->log_nrecs)
+		return;
+
+	pid = getpid();
+	while (ctx->log_nflushed != ctx->log_nrecs) {
+		lr = &_logrecs[ctx->log_nflushed++ % LOGERR_NRECS];
+		if (logwants_err(ctx, lr->lr_pri))
+			logbatch(ctx, stderr, ebuf, &elen, lr, pid);
+		if (ctx->log_file != NULL &&
+		    (lr->lr_pri != LOG_DEBUG || ctx->log_opts & LOGERR_DEBUG))
+			logbatch(ctx, ctx->log_file, fbuf, &flen, lr, pid);
+		if (ctx->log_opts & LOGERR_LOG)
+			syslog(lr->lr_pri, "%s", lr->lr_msg);
+	}
+	if (elen != 0)
+		fwrite(ebuf, 1, elen, stderr);
+	if (flen != 0)
+		fwrite(fbuf, 1, flen, ctx->log_file);
+#endif
+}
+
+#ifndef SMALL
+/* Returns the length of the message, which if too long for a record
+ * is truncated there and left for the caller to write out in full. */
+__printflike(3, 0) static int
+logrecord(struct logctx *ctx, int pri, const char *fmt, va_list args,
+    struct logrec **lrp)
+{
+	struct logrec *lr;
+	va_list a;
+	int len;
+
+	/* Don't overwrite what has yet to be written out. */
+	if (ctx->log_nrecs - ctx->log_nflushed == LOGERR_NRECS)
+		logflush();
+
+	lr = &_logrecs[ctx->log_nrecs % LOGERR_NRECS];
+	va_copy(a, args);
+	len = vsnprintf(lr->lr_msg, sizeof(lr->lr_msg), fmt, a);
+	va_end(a);
+	if (len == -1)
+		return -1;
+	lr->lr_time = time(NULL);
+	lr->lr_pri = pri;
+	lr->lr_pid = ctx->log_pid;
+
+	/* Keep the order by writing out what came before. */
+	if ((size_t)len >= sizeof(lr->lr_msg)) {
+		logflush();
+		ctx->log_nflushed++;
+	}
+	ctx->log_nrecs++;
+	*lrp = lr;
+	return len;
+}
+#endif
+
 /*
  * NetBSD's gcc has been modified to check for the non standard %m in printf
  * like functions and warn noisily about it that they should be marked as
@@ -209,10 +371,17 @@ vlogprintf_r(struct logctx *ctx, FILE *stream, const char *fmt, va_list args)
 #pragma GCC diagnostic ignored "-Wmissing-format-attribute"
 #endif
 __printflike(2, 0) static int
-vlogmessage(int pri, const char *fmt, va_list args)
+vlogwrite(int pri, const char *fmt, va_list args)
 {
 	struct logctx *ctx = &_logctx;
 	int len = 0;
+#ifndef SMALL
+	struct logrec *lr = NULL;
+	int rlen = -1;
+
+	if (pri <= LOG_INFO || ctx->log_opts & LOGERR_DEBUG)
+		rlen = logrecord(ctx, pri, fmt, args, &lr);
+#endif
 
 	if (ctx->log_fd != -1) {
 		char buf[LOGERR_SYSLOGBUF];
@@ -221,6 +390,15 @@ vlogmessage(int pri, const char *fmt, va_list args)
 		memcpy(buf, &pri, sizeof(pri));
 		pid = getpid();
 		memcpy(buf + sizeof(pri), &pid, sizeof(pid));
+#ifndef SMALL
+		/* The privileged process writes these out, not us. */
+		ctx->log_nflushed = ctx->log_nrecs;
+		if (lr != NULL && rlen < LOGERR_RECLEN) {
+			len = rlen;
+			memcpy(buf + sizeof(pri) + sizeof(pid), lr->lr_msg,
+			    (size_t)len + 1);
+		} else
+#endif
 		len = vsnprintf(buf + sizeof(pri) + sizeof(pid),
 		    sizeof(buf) - sizeof(pri) - sizeof(pid),
 		    fmt, args);
@@ -230,6 +408,16 @@ vlogmessage(int pri, const char *fmt, va_list args)
 		return len;
 	}
 
+#ifndef SMALL
+	if (lr != NULL && rlen < LOGERR_RECLEN) {
+		/* Errors are written out at once as we may be about
+		 * to exit. */
+		if (!ctx->log_async || pri <= LOG_ERR)
+			logflush();
+		return rlen;
+	}
+#endif
+
 	if (ctx->log_opts & LOGERR_ERR &&
 	    (pri <= LOG_ERR ||
 	    (!(ctx->log_opts & LOGERR_QUIET) && pri <= LOG_INFO) ||
@@ -251,6 +439,121 @@ vlogmessage(int pri, const char *fmt, va_list args)
 #pragma GCC diagnostic pop
 #endif
 
+__printflike(2, 3) static void
+logwrite(int pri, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vlogwrite(pri, fmt, args);
+	va_end(args);
+}
+
+#ifndef SMALL
+static void
+logsuppressed(struct logctx *ctx, struct loglimit *ll)
+{
+	unsigned int n = ll->ll_suppressed;
+
+	ll->ll_suppressed = 0;
+	ctx->log_nsuppressed--;
+	logwrite(ll->ll_pri, "suppressed %u similar messages: %s",
+	    n, ll->ll_fmt);
+}
+
+/* Top up the bucket for the time passed since it was last done. */
+static void
+logrefill(const struct logctx *ctx, struct loglimit *ll,
+    const struct timespec *now)
+{
+	unsigned long long ms, tokens;
+
+	ms = (unsigned long long)(now->tv_sec - ll->ll_time.tv_sec) * 1000;
+	if (now->tv_nsec >= ll->ll_time.tv_nsec)
+		ms += (unsigned long long)
+		    (now->tv_nsec - ll->ll_time.tv_nsec) / 1000000;
+	else
+		ms -= (unsigned long long)
+		    (ll->ll_time.tv_nsec - now->tv_nsec) / 1000000;
+	/* burst tokens every interval seconds is burst / interval
+	 * thousandths of a token every millisecond. */
+	tokens = ms * ctx->log_burst / ctx->log_interval;
+	/* Don't move the clock on if nothing was added or we would
+	 * never refill while flooded. */
+	if (tokens == 0)
+		return;
+	tokens += ll->ll_tokens;
+	if (tokens > ctx->log_burst * LOGERR_TOKEN)
+		tokens = ctx->log_burst * LOGERR_TOKEN;
+	ll->ll_tokens = (unsigned int)tokens;
+	ll->ll_time = *now;
+}
+
+/* Report call sites that have been quiet long enough to log again. */
+static void
+logexpire(struct logctx *ctx)
+{
+	struct loglimit *ll;
+	struct timespec now;
+	size_t i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < LOGERR_NLIMITS && ctx->log_nsuppressed != 0; i++) {
+		ll = &_loglimits[i];
+		if (ll->ll_suppressed == 0)
+			continue;
+		logrefill(ctx, ll, &now);
+		if (ll->ll_tokens >= LOGERR_TOKEN)
+			logsuppressed(ctx, ll);
+	}
+}
+
+/* Returns true if the message should be dropped. */
+static bool
+logratelimit(struct logctx *ctx, int pri, const char *fmt)
+{
+	struct loglimit *ll;
+	struct timespec now;
+
+	if (ctx->log_burst == 0)
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ll = &_loglimits[((uintptr_t)fmt >> 3) % LOGERR_NLIMITS];
+	if (ll->ll_fmt != fmt) {
+		if (ll->ll_suppressed != 0)
+			logsuppressed(ctx, ll);
+		ll->ll_fmt = fmt;
+		ll->ll_pri = pri;
+		ll->ll_tokens = ctx->log_burst * LOGERR_TOKEN;
+		ll->ll_time = now;
+	} else
+		logrefill(ctx, ll, &now);
+
+	if (ll->ll_tokens < LOGERR_TOKEN) {
+		if (ll->ll_suppressed++ == 0)
+			ctx->log_nsuppressed++;
+		return true;
+	}
+	ll->ll_tokens -= LOGERR_TOKEN;
+	/* Say what was missed before logging again. */
+	if (ll->ll_suppressed != 0)
+		logsuppressed(ctx, ll);
+	return false;
+}
+#endif
+
+__printflike(2, 0) static int
+vlogmessage(int pri, const char *fmt, va_list args)
+{
+
+#ifndef SMALL
+	if (logratelimit(&_logctx, pri, fmt))
+		return 0;
+#endif
+	return vlogwrite(pri, fmt, args);
+}
+
 __printflike(2, 3) void
 logmessage(int pri, const char *fmt, ...)
 {
@@ -267,8 +570,15 @@ vlogerrmessage(int pri, const char *fmt, va_list args)
 	int _errno = errno;
 	char buf[1024];
 
+#ifndef SMALL
+	/* Limit on the callers format and save formatting it. */
+	if (logratelimit(&_logctx, pri, fmt)) {
+		errno = _errno;
+		return;
+	}
+#endif
 	vsnprintf(buf, sizeof(buf), fmt, args);
-	logmessage(pri, "%s: %s", buf, strerror(_errno));
+	logwrite(pri, "%s: %s", buf, strerror(_errno));
 	errno = _errno;
 }
 
@@ -375,6 +685,7 @@ logsetfd(int fd)
 {
 	struct logctx *ctx = &_logctx;
 
+	logflush();
 	ctx->log_fd = fd;
 #ifndef SMALL
 	if (fd != -1 && ctx->log_file != NULL) {
@@ -405,7 +716,8 @@ logreadfd(int fd)
 
 	memcpy(&pri, buf, sizeof(pri));
 	memcpy(&ctx->log_pid, buf + sizeof(pri), sizeof(ctx->log_pid));
-	logmessage(pri, "%s", buf + sizeof(pri) + sizeof(ctx->log_pid));
+	/* The sender has already rate limited this. */
+	logwrite(pri, "%s", buf + sizeof(pri) + sizeof(ctx->log_pid));
 	ctx->log_pid = 0;
 	return len;
 }
@@ -427,6 +739,120 @@ logsetopts(unsigned int opts)
 	setlogmask(LOG_UPTO(opts & LOGERR_DEBUG ? LOG_DEBUG : LOG_INFO));
 }
 
+void
+logsetasync(bool async)
+{
+#ifndef SMALL
+	struct logctx *ctx = &_logctx;
+
+	ctx->log_async = async;
+	if (!async)
+		logflush();
+#else
+	UNUSED(async);
+#endif
+}
+
+void
+logratelimit_report(void)
+{
+#ifndef SMALL
+	struct logctx *ctx = &_logctx;
+	size_t i;
+
+	for (i = 0; i < LOGERR_NLIMITS && ctx->log_nsuppressed != 0; i++) {
+		if (_loglimits[i].ll_suppressed != 0)
+			logsuppressed(ctx, &_loglimits[i]);
+	}
+#endif
+}
+
+/* Allow each call site burst messages every interval seconds.
+ * A burst of 0 turns rate limiting off. */
+void
+logsetratelimit(unsigned int burst, unsigned int interval)
+{
+#ifndef SMALL
+	struct logctx *ctx = &_logctx;
+	size_t i;
+
+	if (interval == 0)
+		interval = 1;
+	if (burst == ctx->log_burst && interval == ctx->log_interval)
+		return;
+	logratelimit_report();
+	for (i = 0; i < LOGERR_NLIMITS; i++)
+		_loglimits[i].ll_fmt = NULL;
+	ctx->log_burst = burst;
+	ctx->log_interval = interval;
+#else
+	UNUSED(burst);
+	UNUSED(interval);
+#endif
+}
+
+#ifndef SMALL
+static const char *
+logpriname(int pri)
+{
+
+	switch (pri) {
+	case LOG_EMERG:		return "emerg";
+	case LOG_ALERT:		return "alert";
+	case LOG_CRIT:		return "crit";
+	case LOG_ERR:		return "err";
+	case LOG_WARNING:	return "warning";
+	case LOG_NOTICE:	return "notice";
+	case LOG_INFO:		return "info";
+	default:		return "debug";
+	}
+}
+#endif
+
+/* Write the last n records, or all we have for 0, to buf as
+ * NUL terminated lines, oldest first. Returns the length used. */
+size_t
+logdump(char *buf, size_t buflen, size_t n)
+{
+#ifndef SMALL
+	struct logctx *ctx = &_logctx;
+	const struct logrec *lr;
+	const char *date;
+	size_t i, len = 0, have;
+	int l;
+
+	have = ctx->log_nrecs < LOGERR_NRECS ? ctx->log_nrecs : LOGERR_NRECS;
+	if (n == 0 || n > have)
+		n = have;
+	for (i = ctx->log_nrecs - n; i != ctx->log_nrecs; i++) {
+		if (buflen - len < LOGERR_DUMPLINE)
+			break;
+		lr = &_logrecs[i % LOGERR_NRECS];
+		if ((date = logdate(ctx, lr->lr_time)) == NULL)
+			date = "";
+		if (lr->lr_pid != 0)
+			l = snprintf(buf + len, LOGERR_DUMPLINE,
+			    "%s%s: [%d] %s", date, logpriname(lr->lr_pri),
+			    lr->lr_pid, lr->lr_msg);
+		else
+			l = snprintf(buf + len, LOGERR_DUMPLINE,
+			    "%s%s: %s", date, logpriname(lr->lr_pri),
+			    lr->lr_msg);
+		if (l == -1)
+			break;
+		if (l >= LOGERR_DUMPLINE)
+			l = LOGERR_DUMPLINE - 1;
+		len += (size_t)l + 1;
+	}
+	return len;
+#else
+	UNUSED(buf);
+	UNUSED(buflen);
+	UNUSED(n);
+	return 0;
+#endif
+}
+
 #ifdef LOGERR_TAG
 void
 logsettag(const char *tag)
@@ -450,6 +876,9 @@ logopen(const char *path)
 	/* Cache timezone */
 	tzset();
 
+	/* Write out what we have to the old log file. */
+	logflush();
+
 	(void)setvbuf(stderr, ctx->log_buf, _IOLBF, sizeof(ctx->log_buf));
 
 #ifndef SMALL
@@ -483,6 +912,7 @@ logclose(void)
 	struct logctx *ctx = &_logctx;
 #endif
 
+	logflush();
 	closelog();
 #ifndef SMALL
 	if (ctx->log_file == NULL)
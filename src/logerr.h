@@ -30,6 +30,8 @@
 #define LOGERR_H
 
 #include <sys/param.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #ifndef __printflike
 #if __GNUC__ > 2 || defined(__INTEL_COMPILER)
@@ -102,6 +104,21 @@ void logsetopts(unsigned int);
 void logsettag(const char *);
 #endif
 
+/* Buffer messages until logflush(), except for errors. */
+void logsetasync(bool);
+void logflush(void);
+
+/* Rate limit each call site to burst messages every interval seconds. */
+void logsetratelimit(unsigned int, unsigned int);
+/* Report what has been suppressed so far, for example before forking. */
+void logratelimit_report(void);
+
+/* The last messages are kept and can be dumped as lines.
+ * Each line is at most LOGERR_DUMPLINE bytes. */
+#define	LOGERR_NDUMP	256
+#define	LOGERR_DUMPLINE	640
+size_t logdump(char *, size_t, size_t);
+
 /* Can be called more than once. */
 int logopen(const char *);
 
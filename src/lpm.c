@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - longest prefix match tries
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <errno.h>
+#include <string.h>
+
+#include "lpm.h"
+
+struct lpm_node {
+	struct lpm_node *ln_parent;
+	struct lpm_node *ln_child[2];
+	TAILQ_HEAD(, lpm_entry) ln_entries;
+	unsigned int ln_plen;
+	uint8_t ln_key[LPM_KEYLEN];	/* masked to ln_plen */
+};
+
+#define	LPM_BIT(key, n)		(((key)[(n) / 8] >> (7 - (n) % 8)) & 1)
+#define	LPM_ENTRY(lpm, obj)	\
+	((struct lpm_entry *)(void *)((char *)(obj) + (lpm)->l_offset))
+
+void
+lpm_init(struct lpm *lpm, const char *name, unsigned int bits, size_t offset)
+{
+
+	lpm->l_root = NULL;
+	pool_init(&lpm->l_pool, name, sizeof(struct lpm_node));
+	lpm->l_offset = offset;
+	lpm->l_bits = bits;
+}
+
+void
+lpm_dispose(struct lpm *lpm)
+{
+
+	/* Objects still filed are the caller's to free. */
+	lpm->l_root = NULL;
+	pool_dispose(&lpm->l_pool);
+}
+
+/* Number of leading bits a and b share, up to limit. */
+static unsigned int
+lpm_common(const uint8_t *a, const uint8_t *b, unsigned int limit)
+{
+	unsigned int i, n;
+	uint8_t x;
+
+	for (i = 0; i * 8 < limit; i++) {
+		if ((x = a[i] ^ b[i]) == 0)
+			continue;
+		for (n = i * 8; !(x & 0x80); x = (uint8_t)(x << 1))
+			n++;
+		return n < limit ? n : limit;
+	}
+	return limit;
+}
+
+static struct lpm_node *
+lpm_newnode(struct lpm *lpm, struct lpm_node *parent,
+    const uint8_t *key, unsigned int plen)
+{
+	struct lpm_node *n;
+
+	if ((n = pool_get(&lpm->l_pool)) == NULL)
+		return NULL;
+	n->ln_parent = parent;
+	TAILQ_INIT(&n->ln_entries);
+	n->ln_plen = plen;
+	memcpy(n->ln_key, key, plen / 8);
+	if (plen % 8 != 0)
+		n->ln_key[plen / 8] =
+		    (uint8_t)(key[plen / 8] & (0xff << (8 - plen % 8)));
+	return n;
+}
+
+int
+lpm_insert(struct lpm *lpm, void *obj, const void *addr, unsigned int plen)
+{
+	struct lpm_entry *le = LPM_ENTRY(lpm, obj);
+	const uint8_t *key = addr;
+	struct lpm_node **np, *n, *nn, *glue, *parent = NULL;
+	unsigned int c = 0;
+
+	if (plen > lpm->l_bits) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	np = &lpm->l_root;
+	while ((n = *np) != NULL) {
+		c = lpm_common(key, n->ln_key,
+		    plen < n->ln_plen ? plen : n->ln_plen);
+		if (c < n->ln_plen)
+			break;
+		if (n->ln_plen == plen)
+			goto add;
+		parent = n;
+		np = &n->ln_child[LPM_BIT(key, n->ln_plen)];
+	}
+
+	if ((nn = lpm_newnode(lpm, parent, key, plen)) == NULL)
+		return -1;
+	if (n == NULL)
+		*np = nn;
+	else if (c == plen) {
+		/* We contain n. */
+		nn->ln_child[LPM_BIT(n->ln_key, plen)] = n;
+		n->ln_parent = nn;
+		*np = nn;
+	} else {
+		/* We and n part ways at bit c. */
+		if ((glue = lpm_newnode(lpm, parent, key, c)) == NULL) {
+			pool_put(nn);
+			return -1;
+		}
+		glue->ln_child[LPM_BIT(key, c)] = nn;
+		glue->ln_child[LPM_BIT(n->ln_key, c)] = n;
+		nn->ln_parent = n->ln_parent = glue;
+		*np = glue;
+	}
+	n = nn;
+
+add:
+	TAILQ_INSERT_TAIL(&n->ln_entries, le, le_next);
+	le->le_node = n;
+	return 0;
+}
+
+void
+lpm_remove(struct lpm *lpm, void *obj)
+{
+	struct lpm_entry *le = LPM_ENTRY(lpm, obj);
+	struct lpm_node *n, *child, *parent;
+
+	if ((n = le->le_node) == NULL)
+		return;
+	TAILQ_REMOVE(&n->ln_entries, le, le_next);
+	le->le_node = NULL;
+
+	/* Drop nodes which neither hold anything nor split the trie. */
+	while (n != NULL && TAILQ_EMPTY(&n->ln_entries) &&
+	    (n->ln_child[0] == NULL || n->ln_child[1] == NULL))
+	{
+		child = n->ln_child[0] != NULL ?
+		    n->ln_child[0] : n->ln_child[1];
+		parent = n->ln_parent;
+		if (parent == NULL)
+			lpm->l_root = child;
+		else
+			parent->ln_child[parent->ln_child[1] == n] = child;
+		if (child != NULL)
+			child->ln_parent = parent;
+		pool_put(n);
+		n = parent;
+	}
+}
+
+/* Returns the first object filed under the longest prefix of addr. */
+void *
+lpm_lookup(const struct lpm *lpm, const void *addr)
+{
+	const uint8_t *key = addr;
+	const struct lpm_node *n, *best = NULL;
+
+	n = lpm->l_root;
+	while (n != NULL) {
+		if (lpm_common(key, n->ln_key, n->ln_plen) < n->ln_plen)
+			break;
+		if (!TAILQ_EMPTY(&n->ln_entries))
+			best = n;
+		if (n->ln_plen == lpm->l_bits)
+			break;
+		n = n->ln_child[LPM_BIT(key, n->ln_plen)];
+	}
+	if (best == NULL)
+		return NULL;
+	return (char *)TAILQ_FIRST(&best->ln_entries) - lpm->l_offset;
+}
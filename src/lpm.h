@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - longest prefix match tries
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LPM_H
+#define LPM_H
+
+#include <sys/queue.h>
+#include <stdint.h>
+
+#include "pool.h"
+
+/*
+ * A path compressed binary trie answering "which prefix contains
+ * this address" in at most one step per bit of the address.
+ * Objects embed a struct lpm_entry and are filed under a prefix;
+ * several objects may share one, and the first added is returned.
+ * Nodes come from a pool owned by the trie.
+ */
+#define	LPM_KEYLEN	16	/* bytes, enough for IPv6 */
+
+struct lpm_node;
+
+struct lpm_entry {
+	TAILQ_ENTRY(lpm_entry) le_next;
+	struct lpm_node *le_node;	/* NULL if not in a trie */
+};
+
+struct lpm {
+	struct lpm_node *l_root;
+	struct pool l_pool;
+	size_t l_offset;		/* of struct lpm_entry in objects */
+	unsigned int l_bits;		/* address length */
+};
+
+void lpm_init(struct lpm *, const char *, unsigned int, size_t);
+int lpm_insert(struct lpm *, void *, const void *, unsigned int);
+void lpm_remove(struct lpm *, void *);
+void *lpm_lookup(const struct lpm *, const void *);
+void lpm_dispose(struct lpm *);
+
+#endif
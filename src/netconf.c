@@ -0,0 +1,821 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - built-in resolv.conf and ntp.conf writers
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * The resolv.conf and ntp.conf hooks rebuild their files from the
+ * variables of every event.
+ * Here we keep what each interface and protocol contributes and only
+ * write a file when what is merged from all of them changes.
+ * The output matches what the hooks write without resolvconf(8).
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcp-common.h"
+#include "dhcpcd.h"
+#include "if.h"
+#include "logerr.h"
+#include "netconf.h"
+
+#define	NETCONF_SIG	"# Generated by dhcpcd"
+#define	NETCONF_SIG_END	"# End of dhcpcd"
+#define	NETCONF_BUFLEN	(64 * 1024)
+#define	NETCONF_PROTOLEN	16
+
+/* A space separated list of words. */
+struct netconf_str {
+	char *ns_str;
+	size_t ns_len;
+	size_t ns_size;
+};
+
+struct netconf_ent {
+	TAILQ_ENTRY(netconf_ent) next;
+	char ne_ifname[IF_NAMESIZE];
+	char ne_protocol[NETCONF_PROTOLEN];
+	bool ne_resolv;
+	struct netconf_str ne_domain;
+	struct netconf_str ne_search;
+	struct netconf_str ne_servers;
+	struct netconf_str ne_ntp;
+	bool ne_ntpset;
+};
+TAILQ_HEAD(netconf_head, netconf_ent);
+
+struct netconf {
+	struct netconf_head nc_ents;
+	struct netconf_str nc_resolv;	/* last written, less head and tail */
+	bool nc_resolvset;
+	struct netconf_str nc_ntp;	/* last written block */
+	bool nc_ntpset;
+};
+
+static int
+netconf_add(struct netconf_str *ns, const char *s, size_t len)
+{
+	char *n;
+	size_t size;
+
+	if (ns->ns_len + len + 1 > ns->ns_size) {
+		size = ns->ns_len + len + 1 + 128;
+		if ((n = realloc(ns->ns_str, size)) == NULL)
+			return -1;
+		ns->ns_str = n;
+		ns->ns_size = size;
+	}
+	memcpy(ns->ns_str + ns->ns_len, s, len);
+	ns->ns_len += len;
+	ns->ns_str[ns->ns_len] = '\0';
+	return 0;
+}
+
+static int
+netconf_adds(struct netconf_str *ns, const char *s)
+{
+
+	return netconf_add(ns, s, strlen(s));
+}
+
+static bool
+netconf_hasword(const struct netconf_str *ns, const char *w, size_t len)
+{
+	const char *p, *e;
+
+	if (ns->ns_len == 0)
+		return false;
+	for (p = ns->ns_str; *p != '\0'; p = *e == '\0' ? e : e + 1) {
+		e = p + strcspn(p, " ");
+		if ((size_t)(e - p) == len && strncmp(p, w, len) == 0)
+			return true;
+	}
+	return false;
+}
+
+/* Add each word, if uniq only those not in the list like uniqify
+ * in the hooks. */
+static int
+netconf_addwords(struct netconf_str *ns, const char *words, bool uniq)
+{
+	const char *p;
+	size_t len;
+
+	if (words == NULL)
+		return 0;
+	for (p = words; *p != '\0'; p += len) {
+		p += strspn(p, " \t\n");
+		if ((len = strcspn(p, " \t\n")) == 0)
+			break;
+		if (uniq && netconf_hasword(ns, p, len))
+			continue;
+		if ((ns->ns_len != 0 && netconf_add(ns, " ", 1) == -1) ||
+		    netconf_add(ns, p, len) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static void
+netconf_clear(struct netconf_str *ns)
+{
+
+	ns->ns_len = 0;
+	if (ns->ns_str != NULL)
+		*ns->ns_str = '\0';
+}
+
+static bool
+netconf_equal(const struct netconf_str *a, const struct netconf_str *b)
+{
+
+	return a->ns_len == b->ns_len &&
+	    (a->ns_len == 0 || memcmp(a->ns_str, b->ns_str, a->ns_len) == 0);
+}
+
+static int
+netconf_copy(struct netconf_str *dst, const struct netconf_str *src)
+{
+
+	netconf_clear(dst);
+	if (src->ns_len == 0)
+		return 0;
+	return netconf_add(dst, src->ns_str, src->ns_len);
+}
+
+static const char *
+netconf_get(const char *env, size_t envlen, const char *var)
+{
+	const char *p, *ep = env + envlen;
+	size_t len = strlen(var);
+
+	for (p = env; p < ep; p += strlen(p) + 1) {
+		if (strncmp(p, var, len) == 0 && p[len] == '=')
+			return p + len + 1;
+	}
+	return NULL;
+}
+
+/* Same as valid_domainname in the hooks. */
+static bool
+netconf_validdomain(const char *name, size_t len)
+{
+	const char *p, *ep = name + len, *label;
+
+	if (len == 0 || len > 255)
+		return false;
+	for (label = p = name; p <= ep; p++) {
+		if (p != ep && *p != '.') {
+			if (!isalnum((unsigned char)*p) &&
+			    *p != '-' && *p != '_')
+				return false;
+			continue;
+		}
+		if (p == label || p - label > 63 ||
+		    *label == '-' || *label == '_' ||
+		    p[-1] == '-' || p[-1] == '_')
+			return false;
+		label = p + 1;
+	}
+	return true;
+}
+
+static bool
+netconf_validdomains(const struct netconf_str *ns)
+{
+	const char *p;
+	size_t len;
+
+	if (ns->ns_len == 0)
+		return true;
+	for (p = ns->ns_str; *p != '\0'; p += len + (p[len] == ' ')) {
+		len = strcspn(p, " ");
+		if (!netconf_validdomain(p, len))
+			return false;
+	}
+	return true;
+}
+
+static void
+netconf_freeent(struct netconf_ent *ne)
+{
+
+	free(ne->ne_domain.ns_str);
+	free(ne->ne_search.ns_str);
+	free(ne->ne_servers.ns_str);
+	free(ne->ne_ntp.ns_str);
+	free(ne);
+}
+
+static struct netconf_ent *
+netconf_findent(struct netconf *nc, const char *ifname, const char *protocol,
+    bool create)
+{
+	struct netconf_ent *ne, *nep;
+
+	TAILQ_FOREACH(ne, &nc->nc_ents, next) {
+		if (strcmp(ne->ne_ifname, ifname) == 0 &&
+		    strcmp(ne->ne_protocol, protocol) == 0)
+			return ne;
+	}
+	if (!create)
+		return NULL;
+	if ((ne = calloc(1, sizeof(*ne))) == NULL)
+		return NULL;
+	strlcpy(ne->ne_ifname, ifname, sizeof(ne->ne_ifname));
+	strlcpy(ne->ne_protocol, protocol, sizeof(ne->ne_protocol));
+
+	/* Keep by protocol, like the glob in list_interfaces. */
+	TAILQ_FOREACH(nep, &nc->nc_ents, next) {
+		if (strcmp(nep->ne_protocol, ne->ne_protocol) > 0)
+			break;
+	}
+	if (nep == NULL)
+		TAILQ_INSERT_TAIL(&nc->nc_ents, ne, next);
+	else
+		TAILQ_INSERT_BEFORE(nep, ne, next);
+	return ne;
+}
+
+/* Gather the DNS servers and search list from Router Advertisements
+ * which have not expired, like eval_nd_dns in the hooks. */
+static int
+netconf_nddns(struct netconf_ent *ne, const char *env, size_t envlen)
+{
+	char var[64];
+	const char *v;
+	long acquired, now, ltime;
+	int i, j, err;
+
+	for (i = 1; ; i++) {
+		snprintf(var, sizeof(var), "nd%d_acquired", i);
+		if ((v = netconf_get(env, envlen, var)) == NULL)
+			break;
+		acquired = (long)strtoi(v, NULL, 0, 0, LONG_MAX, &err);
+		snprintf(var, sizeof(var), "nd%d_now", i);
+		if ((v = netconf_get(env, envlen, var)) == NULL)
+			break;
+		now = (long)strtoi(v, NULL, 0, 0, LONG_MAX, &err);
+		for (j = 1; ; j++) {
+			snprintf(var, sizeof(var), "nd%d_rdnss%d_lifetime", i, j);
+			if ((v = netconf_get(env, envlen, var)) == NULL)
+				break;
+			ltime = (long)strtoi(v, NULL, 0, 0, LONG_MAX, &err);
+			if (ltime - (now - acquired) > 0) {
+				snprintf(var, sizeof(var),
+				    "nd%d_rdnss%d_servers", i, j);
+				if (netconf_addwords(&ne->ne_servers,
+				    netconf_get(env, envlen, var), true) == -1)
+					return -1;
+			}
+			snprintf(var, sizeof(var), "nd%d_dnssl%d_lifetime", i, j);
+			if ((v = netconf_get(env, envlen, var)) == NULL)
+				break;
+			ltime = (long)strtoi(v, NULL, 0, 0, LONG_MAX, &err);
+			if (ltime - (now - acquired) > 0) {
+				snprintf(var, sizeof(var),
+				    "nd%d_dnssl%d_search", i, j);
+				if (netconf_addwords(&ne->ne_search,
+				    netconf_get(env, envlen, var), true) == -1)
+					return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Like add_resolv_conf in the hooks. */
+static int
+netconf_setresolv(struct netconf_ent *ne, const char *reason,
+    const char *env, size_t envlen)
+{
+	const char *servers, *search, *domain = NULL, *v, *p;
+	bool dhcp6;
+	size_t len;
+
+	netconf_clear(&ne->ne_domain);
+	netconf_clear(&ne->ne_search);
+	netconf_clear(&ne->ne_servers);
+	ne->ne_resolv = false;
+
+	dhcp6 = strcmp(reason, "BOUND6") == 0 ||
+	    strcmp(reason, "RENEW6") == 0 ||
+	    strcmp(reason, "REBIND6") == 0 ||
+	    strcmp(reason, "REBOOT6") == 0 ||
+	    strcmp(reason, "INFORM6") == 0;
+	if (dhcp6) {
+		servers = netconf_get(env, envlen, "new_dhcp6_name_servers");
+		search = netconf_get(env, envlen, "new_dhcp6_domain_search");
+	} else {
+		servers = netconf_get(env, envlen, "new_domain_name_servers");
+		search = netconf_get(env, envlen, "new_domain_search");
+	}
+	if (netconf_addwords(&ne->ne_servers, servers, true) == -1 ||
+	    netconf_addwords(&ne->ne_search, search, true) == -1 ||
+	    netconf_nddns(ne, env, envlen) == -1)
+		return -1;
+
+	/* Derive a domain from our various hostname options. */
+	v = netconf_get(env, envlen, "new_domain_name");
+	if (v != NULL && *v != '\0')
+		domain = v;
+	else {
+		const char *names[] = {
+		    "new_dhcp6_fqdn", "new_fqdn", "new_host_name"
+		};
+		size_t i;
+
+		for (i = 0; i < __arraycount(names); i++) {
+			v = netconf_get(env, envlen, names[i]);
+			if (v != NULL && (p = strchr(v, '.')) != NULL) {
+				domain = p + 1;
+				break;
+			}
+		}
+	}
+
+	if (domain != NULL) {
+		domain += strspn(domain, " \t\n");
+		len = strcspn(domain, " \t\n");
+		if (netconf_validdomain(domain, len)) {
+			if (netconf_add(&ne->ne_domain, domain, len) == -1)
+				return -1;
+		} else if (len != 0)
+			logerrx("Invalid domain name: %.*s", (int)len, domain);
+		/* If there is no search list, make the domain one. */
+		if (ne->ne_search.ns_len == 0 &&
+		    netconf_addwords(&ne->ne_search, domain, true) == -1)
+			return -1;
+	}
+	if (!netconf_validdomains(&ne->ne_search)) {
+		logerrx("Invalid domain name in list: %s",
+		    ne->ne_search.ns_str);
+		netconf_clear(&ne->ne_search);
+	}
+
+	ne->ne_resolv = ne->ne_domain.ns_len != 0 ||
+	    ne->ne_search.ns_len != 0 || ne->ne_servers.ns_len != 0;
+	return 0;
+}
+
+/* Entries in interface order, then by protocol as they are kept. */
+static int
+netconf_ents(struct dhcpcd_ctx *ctx, struct netconf_ent ***entsp)
+{
+	struct netconf *nc = ctx->netconf;
+	struct netconf_ent *ne, **ents;
+	struct interface *ifp;
+	size_t n = 0, i, j;
+
+	TAILQ_FOREACH(ne, &nc->nc_ents, next)
+		n++;
+	if ((ents = reallocarray(NULL, n + 1, sizeof(*ents))) == NULL)
+		return -1;
+
+	i = 0;
+	if (ctx->ifaces != NULL) {
+		TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+			TAILQ_FOREACH(ne, &nc->nc_ents, next) {
+				if (strcmp(ne->ne_ifname, ifp->name) == 0)
+					ents[i++] = ne;
+			}
+		}
+	}
+	/* Anything left for a departed interface goes last. */
+	TAILQ_FOREACH(ne, &nc->nc_ents, next) {
+		for (j = 0; j < i; j++) {
+			if (ents[j] == ne)
+				break;
+		}
+		if (j == i)
+			ents[i++] = ne;
+	}
+	*entsp = ents;
+	return (int)i;
+}
+
+static int
+netconf_addfrom(struct netconf_str *ns, const char *sig,
+    struct netconf_ent **ents, int n, bool resolv)
+{
+	const struct netconf_ent *ne;
+	bool first = true;
+	int i;
+
+	if (netconf_adds(ns, sig) == -1)
+		return -1;
+	for (i = 0; i < n; i++) {
+		ne = ents[i];
+		if (!(resolv ? ne->ne_resolv : ne->ne_ntpset))
+			continue;
+		if (netconf_adds(ns, first ? " from " : ", ") == -1 ||
+		    netconf_adds(ns, ne->ne_ifname) == -1 ||
+		    (*ne->ne_protocol != '\0' &&
+		    (netconf_adds(ns, ".") == -1 ||
+		    netconf_adds(ns, ne->ne_protocol) == -1)))
+			return -1;
+		first = false;
+	}
+	return netconf_adds(ns, "\n");
+}
+
+/* Add a line for each word. */
+static int
+netconf_addlines(struct netconf_str *ns, const char *key,
+    const struct netconf_str *words)
+{
+	const char *p;
+	size_t len;
+
+	if (words->ns_len == 0)
+		return 0;
+	for (p = words->ns_str; *p != '\0'; p += len + (p[len] == ' ')) {
+		len = strcspn(p, " ");
+		if (netconf_adds(ns, key) == -1 ||
+		    netconf_add(ns, p, len) == -1 ||
+		    netconf_adds(ns, "\n") == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+netconf_addfile(struct dhcpcd_ctx *ctx, struct netconf_str *ns,
+    char *buf, const char *ext)
+{
+	char file[PATH_MAX];
+	ssize_t bytes;
+
+	snprintf(file, sizeof(file), "%s.%s", ctx->resolv_conf, ext);
+	bytes = dhcp_readfile(ctx, file, buf, NETCONF_BUFLEN);
+	if (bytes == -1) {
+		if (errno != ENOENT)
+			logerr("%s: %s", __func__, file);
+		if (netconf_adds(ns, "# ") == -1 ||
+		    netconf_adds(ns, file) == -1 ||
+		    netconf_adds(ns, " can replace this line\n") == -1)
+			return -1;
+		return 0;
+	}
+	return netconf_add(ns, buf, (size_t)bytes);
+}
+
+/* Like build_resolv_conf in the hooks. */
+static int
+netconf_writeresolv(struct dhcpcd_ctx *ctx)
+{
+	struct netconf *nc = ctx->netconf;
+	struct netconf_ent **ents;
+	struct netconf_str hdr = { 0 }, body = { 0 }, file = { 0 };
+	struct netconf_str domains = { 0 }, search = { 0 }, servers = { 0 };
+	char *buf = NULL;
+	size_t len;
+	int n, i, err = -1;
+
+	if ((n = netconf_ents(ctx, &ents)) == -1)
+		return -1;
+	if (netconf_addfrom(&hdr, NETCONF_SIG, ents, n, true) == -1)
+		goto out;
+	for (i = 0; i < n; i++) {
+		if (!ents[i]->ne_resolv)
+			continue;
+		if (netconf_addwords(&domains,
+		    ents[i]->ne_domain.ns_str, false) == -1 ||
+		    netconf_addwords(&search,
+		    ents[i]->ne_search.ns_str, true) == -1 ||
+		    netconf_addwords(&servers,
+		    ents[i]->ne_servers.ns_str, true) == -1)
+			goto out;
+	}
+
+	/* Every domain but the first searched, unless it's just the one. */
+	len = domains.ns_len == 0 ? 0 : strcspn(domains.ns_str, " ");
+	if (len != domains.ns_len &&
+	    netconf_addwords(&search, domains.ns_str, true) == -1)
+		goto out;
+	if (len != 0 && search.ns_len == len &&
+	    strncmp(search.ns_str, domains.ns_str, len) == 0)
+		netconf_clear(&search);
+	if (len != 0 &&
+	    (netconf_adds(&body, "domain ") == -1 ||
+	    netconf_add(&body, domains.ns_str, len) == -1 ||
+	    netconf_adds(&body, "\n") == -1))
+		goto out;
+	if (search.ns_len != 0 &&
+	    (netconf_adds(&body, "search ") == -1 ||
+	    netconf_add(&body, search.ns_str, search.ns_len) == -1 ||
+	    netconf_adds(&body, "\n") == -1))
+		goto out;
+	if (netconf_addlines(&body, "nameserver ", &servers) == -1)
+		goto out;
+
+	/* Nothing has changed. */
+	if (netconf_copy(&file, &hdr) == -1 ||
+	    netconf_add(&file, body.ns_str, body.ns_len) == -1)
+		goto out;
+	if (nc->nc_resolvset && netconf_equal(&file, &nc->nc_resolv)) {
+		err = 0;
+		goto out;
+	}
+	if (netconf_copy(&nc->nc_resolv, &file) == -1)
+		goto out;
+	nc->nc_resolvset = false;
+
+	if ((buf = malloc(NETCONF_BUFLEN)) == NULL)
+		goto out;
+	netconf_clear(&file);
+	if (netconf_add(&file, hdr.ns_str, hdr.ns_len) == -1 ||
+	    netconf_addfile(ctx, &file, buf, "head") == -1 ||
+	    netconf_add(&file, body.ns_str, body.ns_len) == -1 ||
+	    netconf_addfile(ctx, &file, buf, "tail") == -1)
+		goto out;
+	if (dhcp_writefile(ctx, ctx->resolv_conf, 0644,
+	    file.ns_str, file.ns_len) == -1)
+	{
+		logerr("%s: %s", __func__, ctx->resolv_conf);
+		goto out;
+	}
+	logdebugx("wrote %s", ctx->resolv_conf);
+	nc->nc_resolvset = true;
+	err = 0;
+
+out:
+	free(ents);
+	free(buf);
+	free(hdr.ns_str);
+	free(body.ns_str);
+	free(file.ns_str);
+	free(domains.ns_str);
+	free(search.ns_str);
+	free(servers.ns_str);
+	return err;
+}
+
+/* Copy all but our own lines, like remove_markers in the hooks. */
+static int
+netconf_removemarkers(struct netconf_str *ns, const char *data, size_t len)
+{
+	const char *p, *e, *ep = data + len;
+	bool in_marker = false;
+
+	for (p = data; p < ep; p = e) {
+		e = memchr(p, '\n', (size_t)(ep - p));
+		e = e == NULL ? ep : e + 1;
+		if (strncmp(p, NETCONF_SIG, MIN(strlen(NETCONF_SIG),
+		    (size_t)(e - p))) == 0 &&
+		    (size_t)(e - p) >= strlen(NETCONF_SIG))
+			in_marker = true;
+		else if (in_marker &&
+		    (size_t)(e - p) >= strlen(NETCONF_SIG_END) &&
+		    strncmp(p, NETCONF_SIG_END, strlen(NETCONF_SIG_END)) == 0)
+			in_marker = false;
+		else if (!in_marker &&
+		    netconf_add(ns, p, (size_t)(e - p)) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+/* Like build_ntp_conf in the hooks. */
+static int
+netconf_writentp(struct dhcpcd_ctx *ctx)
+{
+	struct netconf *nc = ctx->netconf;
+	struct netconf_ent **ents;
+	struct netconf_str block = { 0 }, servers = { 0 }, file = { 0 };
+	char *buf = NULL;
+	ssize_t bytes;
+	int n, i, err = -1;
+
+	if ((n = netconf_ents(ctx, &ents)) == -1)
+		return -1;
+	for (i = 0; i < n; i++) {
+		if (ents[i]->ne_ntpset &&
+		    netconf_addwords(&servers,
+		    ents[i]->ne_ntp.ns_str, true) == -1)
+			goto out;
+	}
+	if (servers.ns_len != 0 &&
+	    (netconf_addfrom(&block, NETCONF_SIG, ents, n, false) == -1 ||
+	    netconf_addlines(&block, "server ", &servers) == -1 ||
+	    netconf_addfrom(&block, NETCONF_SIG_END, ents, n, false) == -1))
+		goto out;
+
+	if (nc->nc_ntpset && netconf_equal(&block, &nc->nc_ntp)) {
+		err = 0;
+		goto out;
+	}
+	if (netconf_copy(&nc->nc_ntp, &block) == -1)
+		goto out;
+	nc->nc_ntpset = false;
+
+	if ((buf = malloc(NETCONF_BUFLEN)) == NULL)
+		goto out;
+	bytes = dhcp_readfile(ctx, ctx->ntp_conf, buf, NETCONF_BUFLEN);
+	if (bytes == -1) {
+		if (errno != ENOENT) {
+			logerr("%s: %s", __func__, ctx->ntp_conf);
+			goto out;
+		}
+		if (block.ns_len == 0) {
+			nc->nc_ntpset = true;
+			err = 0;
+			goto out;
+		}
+	} else if (netconf_removemarkers(&file, buf, (size_t)bytes) == -1)
+		goto out;
+	if (netconf_add(&file, block.ns_str, block.ns_len) == -1)
+		goto out;
+
+	if (bytes == -1 || (size_t)bytes != file.ns_len ||
+	    memcmp(buf, file.ns_str, file.ns_len) != 0)
+	{
+		if (dhcp_writefile(ctx, ctx->ntp_conf, 0644,
+		    file.ns_str, file.ns_len) == -1)
+		{
+			logerr("%s: %s", __func__, ctx->ntp_conf);
+			goto out;
+		}
+		logdebugx("wrote %s", ctx->ntp_conf);
+	}
+	nc->nc_ntpset = true;
+	err = 0;
+
+out:
+	free(ents);
+	free(buf);
+	free(block.ns_str);
+	free(servers.ns_str);
+	free(file.ns_str);
+	return err;
+}
+
+void
+netconf_event(struct dhcpcd_ctx *ctx, const char *env, size_t envlen)
+{
+	struct netconf *nc = ctx->netconf;
+	struct netconf_ent *ne;
+	const char *ifname, *protocol, *reason, *v;
+	bool up, down, ra, dhcp6;
+
+	if (ctx->resolv_conf == NULL && ctx->ntp_conf == NULL)
+		return;
+
+	ifname = netconf_get(env, envlen, "interface");
+	reason = netconf_get(env, envlen, "reason");
+	if (ifname == NULL || reason == NULL)
+		return;
+	if ((protocol = netconf_get(env, envlen, "protocol")) == NULL)
+		protocol = "";
+	v = netconf_get(env, envlen, "if_up");
+	up = v != NULL && strcmp(v, "true") == 0;
+	v = netconf_get(env, envlen, "if_down");
+	down = v != NULL && strcmp(v, "true") == 0;
+	ra = strcmp(reason, "ROUTERADVERT") == 0;
+	if (!up && !down && !ra)
+		return;
+
+	if (nc == NULL) {
+		if ((nc = calloc(1, sizeof(*nc))) == NULL) {
+			logerr(__func__);
+			return;
+		}
+		TAILQ_INIT(&nc->nc_ents);
+		ctx->netconf = nc;
+	}
+
+	ne = netconf_findent(nc, ifname, protocol, up || ra);
+	if (ne == NULL) {
+		if (up || ra)
+			logerr(__func__);
+		else if (nc->nc_resolvset || nc->nc_ntpset)
+			return;
+	}
+
+	if (ne != NULL && ctx->resolv_conf != NULL) {
+		if (up || ra) {
+			if (netconf_setresolv(ne, reason, env, envlen) == -1)
+				logerr(__func__);
+		} else {
+			netconf_clear(&ne->ne_domain);
+			netconf_clear(&ne->ne_search);
+			netconf_clear(&ne->ne_servers);
+			ne->ne_resolv = false;
+		}
+	}
+	if (ne != NULL && ctx->ntp_conf != NULL && !ra) {
+		netconf_clear(&ne->ne_ntp);
+		ne->ne_ntpset = up;
+		dhcp6 = reason[strlen(reason) - 1] == '6';
+		if (up && netconf_addwords(&ne->ne_ntp,
+		    netconf_get(env, envlen, dhcp6 ?
+		    "new_dhcp6_sntp_servers" : "new_ntp_servers"), true) == -1)
+			logerr(__func__);
+	}
+	if (ne != NULL && !ne->ne_resolv && !ne->ne_ntpset) {
+		TAILQ_REMOVE(&nc->nc_ents, ne, next);
+		netconf_freeent(ne);
+	}
+
+	if (ctx->resolv_conf != NULL && netconf_writeresolv(ctx) == -1)
+		logerr(__func__);
+	if (ctx->ntp_conf != NULL && netconf_writentp(ctx) == -1)
+		logerr(__func__);
+}
+
+/* Forget the interfaces match() is true for, as if each had gone down. */
+void
+netconf_forget(struct dhcpcd_ctx *ctx,
+    bool (*match)(const char *, const void *), const void *arg)
+{
+	struct netconf *nc = ctx->netconf;
+	struct netconf_ent *ne, *nen;
+	bool changed = false;
+
+	if (nc == NULL)
+		return;
+	TAILQ_FOREACH_SAFE(ne, &nc->nc_ents, next, nen) {
+		if (!match(ne->ne_ifname, arg))
+			continue;
+		TAILQ_REMOVE(&nc->nc_ents, ne, next);
+		netconf_freeent(ne);
+		changed = true;
+	}
+	if (!changed)
+		return;
+
+	if (ctx->resolv_conf != NULL && netconf_writeresolv(ctx) == -1)
+		logerr(__func__);
+	if (ctx->ntp_conf != NULL && netconf_writentp(ctx) == -1)
+		logerr(__func__);
+}
+
+/* The privileged actioneer only reads or writes our files. */
+bool
+netconf_handles(const struct dhcpcd_ctx *ctx, const char *file, bool write)
+{
+	size_t len;
+
+	if (ctx->ntp_conf != NULL && strcmp(ctx->ntp_conf, file) == 0)
+		return true;
+	if (ctx->resolv_conf == NULL)
+		return false;
+	len = strlen(ctx->resolv_conf);
+	if (strncmp(ctx->resolv_conf, file, len) != 0)
+		return false;
+	if (file[len] == '\0')
+		return true;
+	return !write &&
+	    (strcmp(file + len, ".head") == 0 ||
+	    strcmp(file + len, ".tail") == 0);
+}
+
+void
+netconf_free(struct dhcpcd_ctx *ctx)
+{
+	struct netconf *nc = ctx->netconf;
+	struct netconf_ent *ne;
+
+	free(ctx->resolv_conf);
+	free(ctx->ntp_conf);
+	ctx->resolv_conf = ctx->ntp_conf = NULL;
+	if (nc == NULL)
+		return;
+	while ((ne = TAILQ_FIRST(&nc->nc_ents)) != NULL) {
+		TAILQ_REMOVE(&nc->nc_ents, ne, next);
+		netconf_freeent(ne);
+	}
+	free(nc->nc_resolv.ns_str);
+	free(nc->nc_ntp.ns_str);
+	free(nc);
+	ctx->netconf = NULL;
+}
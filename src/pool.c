@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - fixed size object pools
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+/*
+ * Each object is preceded by a tag naming its pool, so pool_put() needs
+ * nothing but the object. Once freed, the tag links the free list.
+ * The union also keeps every object suitably aligned.
+ */
+union pool_tag {
+	struct pool *pool;
+	union pool_tag *next;
+	long double ld;
+	long long ll;
+	void *p;
+};
+
+#define	TAG_ROUNDUP(len) \
+	(((len) + sizeof(union pool_tag) - 1) / sizeof(union pool_tag) * \
+	sizeof(union pool_tag))
+
+void
+pool_init(struct pool *p, const char *name, size_t size)
+{
+
+	memset(p, 0, sizeof(*p));
+	p->p_name = name;
+	p->p_size = sizeof(union pool_tag) + TAG_ROUNDUP(size);
+	p->p_perchunk = (POOL_CHUNKSIZE - sizeof(union pool_tag)) / p->p_size;
+	if (p->p_perchunk == 0)
+		p->p_perchunk = 1;
+}
+
+static int
+pool_grow(struct pool *p)
+{
+	union pool_tag *c, *t;
+	char *items;
+	size_t i;
+
+	c = malloc(sizeof(*c) + p->p_size * p->p_perchunk);
+	if (c == NULL)
+		return -1;
+	c->next = p->p_chunks;
+	p->p_chunks = c;
+	p->p_nchunks++;
+
+	/* Link from the back so objects are handed out in address order. */
+	items = (char *)(c + 1);
+	for (i = p->p_perchunk; i != 0; i--) {
+		t = (union pool_tag *)(void *)(items + p->p_size * (i - 1));
+		t->next = p->p_free;
+		p->p_free = t;
+	}
+	return 0;
+}
+
+/* Returns a zeroed object, or NULL with errno set. */
+void *
+pool_get(struct pool *p)
+{
+	union pool_tag *t;
+
+	assert(p->p_size != 0);
+	if (p->p_free == NULL && pool_grow(p) == -1)
+		return NULL;
+
+	t = p->p_free;
+	p->p_free = t->next;
+	t->pool = p;
+	if (++p->p_inuse > p->p_maxinuse)
+		p->p_maxinuse = p->p_inuse;
+	p->p_gets++;
+
+	memset(t + 1, 0, p->p_size - sizeof(*t));
+	return t + 1;
+}
+
+void
+pool_put(void *obj)
+{
+	union pool_tag *t;
+	struct pool *p;
+
+	if (obj == NULL)
+		return;
+
+	t = (union pool_tag *)obj - 1;
+	p = t->pool;
+	assert(p->p_inuse != 0);
+	p->p_inuse--;
+	t->next = p->p_free;
+	p->p_free = t;
+}
+
+void
+pool_dispose(struct pool *p)
+{
+	union pool_tag *c;
+
+	while ((c = p->p_chunks) != NULL) {
+		p->p_chunks = c->next;
+		free(c);
+	}
+	p->p_free = NULL;
+	p->p_nchunks = p->p_inuse = 0;
+}
@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - fixed size object pools
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/*
+ * A pool hands out objects of one size, carved from chunks of
+ * POOL_CHUNKSIZE bytes.
+ * Freed objects go on a free list for re-use, so building and
+ * tearing down routes and addresses doesn't churn the heap.
+ * Chunks are only given back when the pool is disposed of.
+ */
+#define	POOL_CHUNKSIZE	4096
+
+union pool_tag;
+
+struct pool {
+	const char *p_name;
+	size_t p_size;		/* object size including its tag */
+	size_t p_perchunk;	/* objects in each chunk */
+	union pool_tag *p_chunks;
+	union pool_tag *p_free;
+	size_t p_nchunks;
+	size_t p_inuse;
+	size_t p_maxinuse;
+	unsigned long long p_gets;
+};
+
+void pool_init(struct pool *, const char *, size_t);
+void *pool_get(struct pool *);
+void pool_put(void *);
+void pool_dispose(struct pool *);
+
+#endif
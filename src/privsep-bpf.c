@@ -58,18 +58,20 @@ ps_bpf_recvbpf(void *arg)
 {
 	struct ps_process *psp = arg;
 	struct bpf *bpf = psp->psp_bpf;
-	uint8_t buf[FRAMELEN_MAX];
+	void *frame;
 	ssize_t len;
 	struct ps_msghdr psm = {
 		.ps_id = psp->psp_id,
 		.ps_cmd = psp->psp_id.psi_cmd,
 	};
+	struct iovec iov;
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
 
 	bpf->bpf_flags &= ~BPF_EOF;
 	/* A BPF read can read more than one filtered packet at time.
 	 * This mechanism allows us to read each packet from the buffer. */
 	while (!(bpf->bpf_flags & BPF_EOF)) {
-		len = bpf_read(bpf, buf, sizeof(buf));
+		len = bpf_read(bpf, &frame);
 		if (len == -1) {
 			int error = errno;
 
@@ -79,7 +81,7 @@ ps_bpf_recvbpf(void *arg)
 			/* If the interface has departed, close the BPF
 			 * socket. This stops log spam if RTM_IFANNOUNCE is
 			 * delayed in announcing the departing interface. */
-			eloop_event_delete(psp->psp_ctx->eloop, bpf->bpf_fd);
+			bpf_event_delete(bpf, psp->psp_ctx->eloop);
 			bpf_close(bpf);
 			psp->psp_bpf = NULL;
 			break;
@@ -87,13 +89,28 @@ ps_bpf_recvbpf(void *arg)
 		if (len == 0)
 			break;
 		psm.ps_flags = bpf->bpf_flags;
-		len = ps_sendpsmdata(psp->psp_ctx, psp->psp_ctx->ps_data_fd,
-		    &psm, buf, (size_t)len);
+		iov.iov_base = frame;
+		iov.iov_len = (size_t)len;
+		/* The control data is when the frame arrived, if known. */
+		if (timespecisset(&bpf->bpf_time)) {
+			msg.msg_control = &bpf->bpf_time;
+			msg.msg_controllen = sizeof(bpf->bpf_time);
+		} else {
+			msg.msg_control = NULL;
+			msg.msg_controllen = 0;
+		}
+		len = ps_queuepsmmsg(psp->psp_ctx, psp->psp_ctx->ps_data_fd,
+		    &psm, &msg);
 		if (len == -1)
 			logerr(__func__);
 		if (len == -1 || len == 0)
 			break;
 	}
+	/* Send every frame from this read together.
+	 * The pool hands us one frame at a time, so let the queue
+	 * gather frames for every interface it serves. */
+	if (!psp->psp_pooled)
+		ps_flushqueue(psp->psp_ctx, psp->psp_ctx->ps_data_fd);
 }
 
 static ssize_t
@@ -175,14 +192,253 @@ ps_bpf_start_bpf(void *arg)
 	return -1;
 }
 
+/* Fill in psp for the interface sent with a start command. */
+static void
+ps_bpf_setprocess(struct ps_process *psp, uint16_t cmd, struct msghdr *msg)
+{
+	struct iovec *iov = msg->msg_iov;
+	struct interface *ifp = &psp->psp_ifp;
+
+	assert(msg->msg_iovlen == 1);
+	assert(iov->iov_len == sizeof(*ifp));
+	memcpy(ifp, iov->iov_base, sizeof(*ifp));
+	ifp->ctx = psp->psp_ctx;
+	ifp->options = NULL;
+	memset(ifp->if_data, 0, sizeof(ifp->if_data));
+
+	memcpy(psp->psp_ifname, ifp->name, sizeof(psp->psp_ifname));
+
+	switch (cmd) {
+#ifdef ARP
+	case PS_BPF_ARP:
+		psp->psp_proto = ETHERTYPE_ARP;
+		psp->psp_protostr = "ARP";
+		psp->psp_filter = bpf_arp;
+		break;
+#endif
+	case PS_BPF_BOOTP:
+		psp->psp_proto = ETHERTYPE_IP;
+		psp->psp_protostr = "BOOTP";
+		psp->psp_filter = bpf_bootp;
+		break;
+	}
+}
+
+#ifdef __linux__
+/*
+ * With shared_bpf, BOOTP for every Ethernet interface is served by one
+ * pooled BPF helper rather than a helper per interface.
+ * The pool opens the shared socket while it is still privileged and
+ * each interface it serves is then only a view of that socket.
+ * The privileged actioneer keeps a record per interface, without a
+ * process, so commands are looked up as before and forwarded to the
+ * pool, which stops once it serves nothing.
+ */
+static struct ps_id ps_bpf_poolid = { .psi_cmd = PS_BPF_BOOTP };
+
+static bool
+ps_bpf_poolable(const struct ps_process *psp)
+{
+
+	return psp->psp_ctx->shared_bpf && psp->psp_proto == ETHERTYPE_IP &&
+	    psp->psp_ifp.hwtype == ARPHRD_ETHER;
+}
+
+static ssize_t
+ps_bpf_poolopen(struct ps_process *pool,
+    struct ps_msghdr *psm, struct msghdr *msg)
+{
+	struct dhcpcd_ctx *ctx = pool->psp_ctx;
+	struct ps_process *psp;
+
+	psp = ps_newprocess(ctx, &psm->ps_id);
+	if (psp == NULL)
+		return -1;
+	psp->psp_fd = -1;
+	psp->psp_pooled = true;
+	ps_bpf_setprocess(psp, PS_BPF_BOOTP, msg);
+
+	/* Opening anything other than a view needs privileges we have
+	 * dropped and a socket(2) call the sandbox will not allow. */
+	if (!ps_bpf_poolable(psp) || ctx->bpf_master == NULL) {
+		errno = ENOTSUP;
+		goto err;
+	}
+	psp->psp_bpf = bpf_open(&psp->psp_ifp, psp->psp_filter, NULL);
+	if (psp->psp_bpf == NULL)
+		goto err;
+	if (bpf_event_add(psp->psp_bpf, ctx->eloop, ps_bpf_recvbpf, psp) == -1)
+		goto err;
+	return 0;
+
+err:
+	logerr("%s: %s", psp->psp_ifname, __func__);
+	ps_freeprocess(psp);
+	return -1;
+}
+
+static ssize_t
+ps_bpf_poolrecvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
+{
+	struct ps_process *pool = arg, *psp;
+	struct iovec *iov = msg->msg_iov;
+
+#ifdef PRIVSEP_DEBUG
+	logerrx("%s: IN cmd %x", __func__, psm->ps_cmd);
+#endif
+
+	if ((psm->ps_cmd & ~(PS_START | PS_STOP)) != PS_BPF_BOOTP) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	psp = ps_findprocess(pool->psp_ctx, &psm->ps_id);
+	if (psm->ps_cmd & PS_STOP) {
+		if (psp != NULL)
+			ps_freeprocess(psp);
+		return 0;
+	}
+	if (psm->ps_cmd & PS_START)
+		return psp != NULL ? 0 : ps_bpf_poolopen(pool, psm, msg);
+
+	/* We might have had an earlier ENXIO error. */
+	if (psp == NULL || psp->psp_bpf == NULL) {
+		errno = ENXIO;
+		return -1;
+	}
+	return bpf_send(psp->psp_bpf, psp->psp_proto,
+	    iov->iov_base, iov->iov_len);
+}
+
+static void
+ps_bpf_poolrecvmsg(void *arg)
+{
+	struct ps_process *pool = arg;
+
+	if (ps_recvpsmsg(pool->psp_ctx, pool->psp_fd,
+	    ps_bpf_poolrecvmsgcb, arg) == -1)
+		logerr(__func__);
+}
+
+static int
+ps_bpf_start_pool(void *arg)
+{
+	struct ps_process *pool = arg;
+	struct dhcpcd_ctx *ctx = pool->psp_ctx;
+
+	setproctitle("[BPF BOOTP] shared");
+	ps_freeprocesses(ctx, pool);
+
+	if (bpf_open_shared(ctx) == 0)
+		return 0;
+	logerr("%s: bpf_open_shared", __func__);
+	eloop_exit(ctx->eloop, EXIT_FAILURE);
+	return -1;
+}
+
+/* Serve psp from the pool, starting the pool if need be. */
+static ssize_t
+ps_bpf_pooljoin(struct ps_process *psp,
+    struct ps_msghdr *psm, struct msghdr *msg)
+{
+	struct dhcpcd_ctx *ctx = psp->psp_ctx;
+	struct ps_process *pool;
+	pid_t start;
+
+	psp->psp_fd = -1;
+	psp->psp_pooled = true;
+
+	pool = ps_findprocess(ctx, &ps_bpf_poolid);
+	if (pool == NULL) {
+		pool = ps_newprocess(ctx, &ps_bpf_poolid);
+		if (pool == NULL)
+			goto err;
+		strlcpy(pool->psp_ifname, "shared", sizeof(pool->psp_ifname));
+		pool->psp_proto = ETHERTYPE_IP;
+		pool->psp_protostr = "BOOTP";
+
+		start = ps_dostart(ctx,
+		    &pool->psp_pid, &pool->psp_fd,
+		    ps_bpf_poolrecvmsg, NULL, pool,
+		    ps_bpf_start_pool, NULL,
+		    PSF_DROPPRIVS);
+		switch (start) {
+		case -1:
+			ps_freeprocess(pool);
+			goto err;
+		case 0:
+			ps_entersandbox("stdio", NULL);
+			return 0;
+		default:
+			ps_indexprocess(pool);
+#ifdef PRIVSEP_DEBUG
+			logdebugx("spawned BPF BOOTP pool on PID %d", start);
+#endif
+			break;
+		}
+	}
+
+	if (ps_sendpsmmsg(ctx, pool->psp_fd, psm, msg) == -1) {
+		logerr("%s: failed to send message to pid %d",
+		    __func__, pool->psp_pid);
+		goto err;
+	}
+	pool->psp_npooled++;
+	return 1;
+
+err:
+	ps_freeprocess(psp);
+	return -1;
+}
+
+/* Forward a command for an interface the pool serves. */
+ssize_t
+ps_bpf_poolcmd(struct ps_process *psp,
+    struct ps_msghdr *psm, struct msghdr *msg)
+{
+	struct dhcpcd_ctx *ctx = psp->psp_ctx;
+	struct ps_process *pool;
+	ssize_t err;
+
+	pool = ps_findprocess(ctx, &ps_bpf_poolid);
+	if (pool == NULL) {
+		/* The pool exited, so start it again if asked. */
+		ps_freeprocess(psp);
+		if (psm->ps_cmd & PS_START)
+			return ps_bpf_cmd(ctx, psm, msg);
+		return 0;
+	}
+	if (psm->ps_cmd & PS_START)
+		return 0;
+
+	err = ps_sendpsmmsg(ctx, pool->psp_fd, psm, msg);
+	if (err == -1) {
+		/* Interfaces left without it are freed as they are used. */
+		logerr("%s: failed to send message to pid %d",
+		    __func__, pool->psp_pid);
+		shutdown(pool->psp_fd, SHUT_RDWR);
+		ps_freeprocess(pool);
+		ps_freeprocess(psp);
+		return 0;
+	}
+	if (psm->ps_cmd & PS_STOP) {
+		ps_freeprocess(psp);
+		if (--pool->psp_npooled == 0) {
+			err = ps_dostop(ctx, &pool->psp_pid, &pool->psp_fd);
+			ps_freeprocess(pool);
+			return err;
+		}
+	}
+	return 0;
+}
+#endif
+
 ssize_t
 ps_bpf_cmd(struct dhcpcd_ctx *ctx, struct ps_msghdr *psm, struct msghdr *msg)
 {
 	uint16_t cmd;
 	struct ps_process *psp;
 	pid_t start;
-	struct iovec *iov = msg->msg_iov;
-	struct interface *ifp;
 
 	cmd = (uint16_t)(psm->ps_cmd & ~(PS_START | PS_STOP));
 	psp = ps_findprocess(ctx, &psm->ps_id);
@@ -214,31 +470,12 @@ ps_bpf_cmd(struct dhcpcd_ctx *ctx, struct ps_msghdr *psm, struct msghdr *msg)
 	psp = ps_newprocess(ctx, &psm->ps_id);
 	if (psp == NULL)
 		return -1;
+	ps_bpf_setprocess(psp, cmd, msg);
 
-	ifp = &psp->psp_ifp;
-	assert(msg->msg_iovlen == 1);
-	assert(iov->iov_len == sizeof(*ifp));
-	memcpy(ifp, iov->iov_base, sizeof(*ifp));
-	ifp->ctx = psp->psp_ctx;
-	ifp->options = NULL;
-	memset(ifp->if_data, 0, sizeof(ifp->if_data));
-
-	memcpy(psp->psp_ifname, ifp->name, sizeof(psp->psp_ifname));
-
-	switch (cmd) {
-#ifdef ARP
-	case PS_BPF_ARP:
-		psp->psp_proto = ETHERTYPE_ARP;
-		psp->psp_protostr = "ARP";
-		psp->psp_filter = bpf_arp;
-		break;
+#ifdef __linux__
+	if (ps_bpf_poolable(psp))
+		return ps_bpf_pooljoin(psp, psm, msg);
 #endif
-	case PS_BPF_BOOTP:
-		psp->psp_proto = ETHERTYPE_IP;
-		psp->psp_protostr = "BOOTP";
-		psp->psp_filter = bpf_bootp;
-		break;
-	}
 
 	start = ps_dostart(ctx,
 	    &psp->psp_pid, &psp->psp_fd,
@@ -253,6 +490,7 @@ ps_bpf_cmd(struct dhcpcd_ctx *ctx, struct ps_msghdr *psm, struct msghdr *msg)
 		ps_entersandbox("stdio", NULL);
 		break;
 	default:
+		ps_indexprocess(psp);
 #ifdef PRIVSEP_DEBUG
 		logdebugx("%s: spawned BPF %s on PID %d",
 		    psp->psp_ifname, psp->psp_protostr, start);
@@ -270,6 +508,8 @@ ps_bpf_dispatch(struct dhcpcd_ctx *ctx,
 	struct interface *ifp;
 	uint8_t *bpf;
 	size_t bpf_len;
+	struct timespec ts;
+	const struct timespec *rxtime = NULL;
 
 	switch (psm->ps_cmd) {
 #ifdef ARP
@@ -282,13 +522,17 @@ ps_bpf_dispatch(struct dhcpcd_ctx *ctx,
 		return -1;
 	}
 
-	ifp = if_findindex(ctx->ifaces, psm->ps_id.psi_ifindex);
+	ifp = if_findindexctx(ctx, psm->ps_id.psi_ifindex);
 	/* interface may have departed .... */
 	if (ifp == NULL)
 		return -1;
 
 	bpf = iov->iov_base;
 	bpf_len = iov->iov_len;
+	if (msg->msg_controllen == sizeof(ts)) {
+		memcpy(&ts, msg->msg_control, sizeof(ts));
+		rxtime = &ts;
+	}
 
 	switch (psm->ps_cmd) {
 #ifdef ARP
@@ -297,7 +541,8 @@ ps_bpf_dispatch(struct dhcpcd_ctx *ctx,
 		break;
 #endif
 	case PS_BPF_BOOTP:
-		dhcp_packet(ifp, bpf, bpf_len, (unsigned int)psm->ps_flags);
+		dhcp_packet(ifp, bpf, bpf_len, (unsigned int)psm->ps_flags,
+		    rxtime);
 		break;
 	}
 
@@ -320,7 +565,7 @@ ps_bpf_send(const struct interface *ifp, const struct in_addr *ia,
 	if (ia != NULL)
 		psm.ps_id.psi_addr.psa_in_addr = *ia;
 
-	return ps_sendpsmdata(ctx, ctx->ps_root_fd, &psm, data, len);
+	return ps_queuepsmdata(ctx, ctx->ps_root_fd, &psm, data, len);
 }
 
 #ifdef ARP
@@ -33,6 +33,10 @@ ssize_t ps_bpf_cmd(struct dhcpcd_ctx *,
     struct ps_msghdr *, struct msghdr *);
 ssize_t ps_bpf_dispatch(struct dhcpcd_ctx *,
     struct ps_msghdr *, struct msghdr *);
+#ifdef __linux__
+ssize_t ps_bpf_poolcmd(struct ps_process *,
+    struct ps_msghdr *, struct msghdr *);
+#endif
 
 #ifdef ARP
 ssize_t ps_bpf_openarp(const struct interface *, const struct in_addr *);
@@ -45,6 +45,7 @@
 #include <unistd.h>
 
 #include "dhcpcd.h"
+#include "if.h"
 #include "logerr.h"
 #include "privsep.h"
 
@@ -118,6 +119,39 @@ ps_root_doroute(void *data, size_t len)
 	return err;
 }
 
+static ssize_t
+ps_root_doroutes(void *data, size_t len, void **rdata, size_t *rlen)
+{
+	static int errs[RTM_BATCH_MAX];
+	struct rt_msghdr rtm;
+	uint8_t *p = data;
+	size_t n = 0;
+	int s;
+
+	s = socket(PF_ROUTE, SOCK_RAW, 0);
+	if (s == -1)
+		return -1;
+	while (len != 0) {
+		if (len < sizeof(rtm) || n == __arraycount(errs))
+			goto einval;
+		memcpy(&rtm, p, sizeof(rtm));
+		if (rtm.rtm_msglen < sizeof(rtm) || rtm.rtm_msglen > len)
+			goto einval;
+		errs[n++] = write(s, p, rtm.rtm_msglen) == -1 ? errno : 0;
+		p += rtm.rtm_msglen;
+		len -= rtm.rtm_msglen;
+	}
+	close(s);
+	*rdata = errs;
+	*rlen = n * sizeof(errs[0]);
+	return 0;
+
+einval:
+	close(s);
+	errno = EINVAL;
+	return -1;
+}
+
 #if defined(HAVE_CAPSICUM) || defined(HAVE_PLEDGE)
 static ssize_t
 ps_root_doindirectioctl(unsigned long req, void *data, size_t len)
@@ -179,6 +213,8 @@ ps_root_os(struct ps_msghdr *psm, struct msghdr *msg,
 		break;
 	case PS_ROUTE:
 		return ps_root_doroute(data, len);
+	case PS_ROUTEBATCH:
+		return ps_root_doroutes(data, len, rdata, rlen);
 #if defined(HAVE_CAPSICUM) || defined(HAVE_PLEDGE)
 	case PS_IOCTLINDIRECT:
 		err = ps_root_doindirectioctl(psm->ps_flags, data, len);
@@ -236,6 +272,17 @@ ps_root_route(struct dhcpcd_ctx *ctx, void *data, size_t len)
 	return ps_root_readerror(ctx, data, len);
 }
 
+ssize_t
+ps_root_routes(struct dhcpcd_ctx *ctx, void *data, size_t len,
+    int *errs, size_t n)
+{
+
+	if (ps_sendcmd(ctx, ctx->ps_root_fd, PS_ROUTEBATCH, 0,
+	    data, len) == -1)
+		return -1;
+	return ps_root_readerror(ctx, errs, n * sizeof(*errs));
+}
+
 #if defined(HAVE_CAPSICUM) || defined(HAVE_PLEDGE)
 ssize_t
 ps_root_indirectioctl(struct dhcpcd_ctx *ctx, unsigned long request,
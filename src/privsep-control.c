@@ -62,7 +62,7 @@ ps_ctl_startcb(void *arg)
 
 	ctx->ps_control_pid = getpid();
 
-	return control_start(ctx,
+	return control_start(ctx, ctx->shard != 0 ? ctx->shard_name :
 	    ctx->options & DHCPCD_MASTER ? NULL : *ctx->ifv, af);
 }
 
@@ -90,9 +90,30 @@ ps_ctl_recvmsg(void *arg)
 		logerr(__func__);
 }
 
+/* Each argument is NUL terminated. */
+static int
+ps_ctl_splitargs(char *data, size_t len, char **argv, size_t argvlen)
+{
+	char *p, *e = data + len;
+	size_t argc = 0;
+
+	for (p = data; p < e && argc < argvlen; p += strlen(p) + 1) {
+		if (memchr(p, '\0', (size_t)(e - p)) == NULL)
+			break;
+		argv[argc++] = p;
+	}
+	if (argc == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return (int)argc;
+}
+
 ssize_t
 ps_ctl_handleargs(struct fd_list *fd, char *data, size_t len)
 {
+	char *argv[16];
+	int argc, i;
 
 	/* Make any change here in dhcpcd.c as well. */
 	if (strncmp(data, "--version",
@@ -103,10 +124,25 @@ ps_ctl_handleargs(struct fd_list *fd, char *data, size_t len)
 	    MIN(strlen("--getconfigfile"), len)) == 0) {
 		return control_queue(fd, UNCONST(fd->ctx->cffile),
 		    strlen(fd->ctx->cffile) + 1);
-	} else if (strncmp(data, "--listen",
-	    MIN(strlen("--listen"), len)) == 0) {
-		fd->flags |= FD_LISTEN;
-		return 0;
+	}
+
+	argc = ps_ctl_splitargs(data, len, argv, __arraycount(argv));
+	if (argc == -1)
+		return -1;
+	if (strcmp(argv[0], "--listen") == 0) {
+		char *p = argv[argc - 1] + strlen(argv[argc - 1]);
+
+		/* The last argument may have \n as well. */
+		if (p != argv[argc - 1] && p[-1] == '\n')
+			p[-1] = '\0';
+		return control_listen(fd, argc, argv);
+	}
+	/* Our listeners are here rather than in the master. */
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--stats=control") == 0 ||
+		    (strcmp(argv[i], "--stats") == 0 && i + 1 < argc &&
+		    strcmp(argv[i + 1], "control") == 0))
+			return control_stats(fd);
 	}
 
 	if (fd->ctx->ps_control_client != NULL &&
@@ -115,6 +151,13 @@ ps_ctl_handleargs(struct fd_list *fd, char *data, size_t len)
 		logerrx("%s: cannot handle another client", __func__);
 		return 0;
 	}
+
+	/* A dump can take more than one read from the master,
+	 * so keep the client until the end of it has been relayed. */
+	if (strcmp(argv[0], "--dumpstate") == 0) {
+		fd->flags |= FD_DUMP;
+		fd->ctx->ps_control_dumphdr = 0;
+	}
 	return 1;
 }
 
@@ -149,6 +192,16 @@ ps_ctl_dispatch(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 			return -1;
 		ctx->ps_control_client = fd;
 		control_recvdata(fd, iov->iov_base, iov->iov_len);
+		/* With nothing queued control_writeone() will never
+		 * end it, so do so here to let the next client in. */
+		if (ctx->ps_control_client == fd &&
+		    TAILQ_FIRST(&fd->queue) == NULL && fd->dump == NULL &&
+		    !(fd->flags & (FD_LISTEN | FD_DUMP)))
+		{
+			if (ps_ctl_sendeof(fd) == -1)
+				logerr(__func__);
+			control_free(fd);
+		}
 		break;
 	case PS_CTL_EOF:
 		control_free(ctx->ps_control_client);
@@ -169,6 +222,35 @@ ps_ctl_dodispatch(void *arg)
 		logerr(__func__);
 }
 
+/* Look for the zero length which ends a dump. */
+static void
+ps_ctl_dumpscan(struct dhcpcd_ctx *ctx, const char *data, size_t len)
+{
+	struct fd_list *fd = ctx->ps_control_client;
+	size_t n;
+
+	while (len != 0 && fd->flags & FD_DUMP) {
+		if (ctx->ps_control_dumphdr < sizeof(size_t)) {
+			n = MIN(sizeof(size_t) - ctx->ps_control_dumphdr, len);
+			memcpy((char *)&ctx->ps_control_dumpframe +
+			    ctx->ps_control_dumphdr, data, n);
+			ctx->ps_control_dumphdr += n;
+			data += n;
+			len -= n;
+			if (ctx->ps_control_dumphdr == sizeof(size_t) &&
+			    ctx->ps_control_dumpframe == 0)
+				fd->flags &= ~FD_DUMP;
+			continue;
+		}
+		n = MIN(ctx->ps_control_dumpframe, len);
+		ctx->ps_control_dumpframe -= n;
+		data += n;
+		len -= n;
+		if (ctx->ps_control_dumpframe == 0)
+			ctx->ps_control_dumphdr = 0;
+	}
+}
+
 static void
 ps_ctl_recv(void *arg)
 {
@@ -185,6 +267,8 @@ ps_ctl_recv(void *arg)
 	}
 	if (ctx->ps_control_client == NULL) /* client disconnected */
 		return;
+	if (ctx->ps_control_client->flags & FD_DUMP)
+		ps_ctl_dumpscan(ctx, buf, (size_t)len);
 	errno = 0;
 	if (control_queue(ctx->ps_control_client, buf, (size_t)len) == -1)
 		logerr("%s: control_queue", __func__);
@@ -194,25 +278,47 @@ static void
 ps_ctl_listen(void *arg)
 {
 	struct dhcpcd_ctx *ctx = arg;
-	char buf[BUFSIZ];
-	ssize_t len;
-	struct fd_list *fd;
+	char *p;
+	size_t len;
+	ssize_t bytes;
+
+	if (ctx->ps_control_bufsize - ctx->ps_control_buflen < BUFSIZ) {
+		p = realloc(ctx->ps_control_buf,
+		    ctx->ps_control_bufsize + BUFSIZ);
+		if (p == NULL) {
+			logerr(__func__);
+			return;
+		}
+		ctx->ps_control_buf = p;
+		ctx->ps_control_bufsize += BUFSIZ;
+	}
 
 	errno = 0;
-	len = read(ctx->ps_control->fd, buf, sizeof(buf));
-	if (len == -1 || len == 0) {
+	bytes = read(ctx->ps_control->fd,
+	    ctx->ps_control_buf + ctx->ps_control_buflen,
+	    ctx->ps_control_bufsize - ctx->ps_control_buflen);
+	if (bytes == -1 || bytes == 0) {
 		logerr("%s: read", __func__);
 		eloop_exit(ctx->eloop, EXIT_FAILURE);
 		return;
 	}
-
-	/* Send to our listeners */
-	TAILQ_FOREACH(fd, &ctx->control_fds, next) {
-		if (!(fd->flags & FD_LISTEN))
-			continue;
-		if (control_queue(fd, buf, (size_t)len)== -1)
-			logerr("%s: control_queue", __func__);
+	ctx->ps_control_buflen += (size_t)bytes;
+
+	/* Each event is framed by its length so each listener
+	 * can be sent it whole, or in its own encoding. */
+	p = ctx->ps_control_buf;
+	while (ctx->ps_control_buflen >= sizeof(len)) {
+		memcpy(&len, p, sizeof(len));
+		if (ctx->ps_control_buflen - sizeof(len) < len)
+			break;
+		if (len != 0 && control_queuelisteners(ctx,
+		    p + sizeof(len), len) == -1)
+			logerr("%s: control_queuelisteners", __func__);
+		p += sizeof(len) + len;
+		ctx->ps_control_buflen -= sizeof(len) + len;
 	}
+	if (ctx->ps_control_buflen != 0 && p != ctx->ps_control_buf)
+		memmove(ctx->ps_control_buf, p, ctx->ps_control_buflen);
 }
 
 pid_t
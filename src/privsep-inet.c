@@ -67,12 +67,14 @@ ps_inet_recvra(void *arg)
 	struct rs_state *state = RS_STATE(ifp);
 	struct dhcpcd_ctx *ctx = ifp->ctx;
 
-	if (ps_recvmsg(ctx, state->nd_fd, PS_ND, ctx->ps_inet_fd) == -1)
+	if (ps_recvmsgs(ctx, state->nd_fd, PS_ND, ctx->ps_inet_fd,
+	    &ctx->nd_msgs) == -1)
 		logerr(__func__);
 #else
 	struct dhcpcd_ctx *ctx = arg;
 
-	if (ps_recvmsg(ctx, ctx->nd_fd, PS_ND, ctx->ps_inet_fd) == -1)
+	if (ps_recvmsgs(ctx, ctx->nd_fd, PS_ND, ctx->ps_inet_fd,
+	    &ctx->nd_msgs) == -1)
 		logerr(__func__);
 #endif
 }
@@ -84,7 +86,8 @@ ps_inet_recvdhcp6(void *arg)
 {
 	struct dhcpcd_ctx *ctx = arg;
 
-	if (ps_recvmsg(ctx, ctx->dhcp6_rfd, PS_DHCP6, ctx->ps_inet_fd) == -1)
+	if (ps_recvmsgs(ctx, ctx->dhcp6_rfd, PS_DHCP6, ctx->ps_inet_fd,
+	    &ctx->dhcp6_msgs) == -1)
 		logerr(__func__);
 }
 #endif
@@ -103,8 +106,7 @@ ps_inet_canstart(const struct dhcpcd_ctx *ctx)
 		return true;
 #endif
 #ifdef DHCP6
-	if ((ctx->options & (DHCPCD_IPV6 | DHCPCD_MASTER)) ==
-	    (DHCPCD_IPV6 | DHCPCD_MASTER))
+	if (ctx->options & DHCPCD_IPV6 && DHCP6_SHARED(ctx))
 		return true;
 #endif
 
@@ -178,9 +180,7 @@ ps_inet_startcb(void *arg)
 	}
 #endif
 #ifdef DHCP6
-	if ((ctx->options & (DHCPCD_IPV6 | DHCPCD_MASTER)) ==
-	    (DHCPCD_IPV6 | DHCPCD_MASTER))
-	{
+	if (ctx->options & DHCPCD_IPV6 && DHCP6_SHARED(ctx)) {
 		ctx->dhcp6_rfd = dhcp6_openudp(0, NULL);
 		if (ctx->dhcp6_rfd == -1)
 			logerr("%s: dhcp6_open", __func__);
@@ -585,6 +585,7 @@ ps_inet_cmd(struct dhcpcd_ctx *ctx, struct ps_msghdr *psm, struct msghdr *msg)
 		ps_entersandbox("stdio", NULL);
 		break;
 	default:
+		ps_indexprocess(psp);
 		break;
 	}
 	return start;
@@ -605,7 +606,7 @@ ps_inet_in_docmd(struct ipv4_addr *ia, uint16_t cmd, const struct msghdr *msg)
 		},
 	};
 
-	return ps_sendpsmmsg(ctx, ctx->ps_root_fd, &psm, msg);
+	return ps_queuepsmmsg(ctx, ctx->ps_root_fd, &psm, msg);
 }
 
 ssize_t
@@ -626,7 +627,7 @@ ssize_t
 ps_inet_sendbootp(struct interface *ifp, const struct msghdr *msg)
 {
 
-	return ps_sendmsg(ifp->ctx, ifp->ctx->ps_root_fd, PS_BOOTP, 0, msg);
+	return ps_queuemsg(ifp->ctx, ifp->ctx->ps_root_fd, PS_BOOTP, 0, msg);
 }
 #endif /* INET */
 
@@ -644,7 +645,7 @@ ps_inet_ifp_docmd(struct interface *ifp, uint16_t cmd, const struct msghdr *msg)
 		},
 	};
 
-	return ps_sendpsmmsg(ctx, ctx->ps_root_fd, &psm, msg);
+	return ps_queuepsmmsg(ctx, ctx->ps_root_fd, &psm, msg);
 }
 
 ssize_t
@@ -672,7 +673,7 @@ ssize_t
 ps_inet_sendnd(struct interface *ifp, const struct msghdr *msg)
 {
 
-	return ps_sendmsg(ifp->ctx, ifp->ctx->ps_root_fd, PS_ND, 0, msg);
+	return ps_queuemsg(ifp->ctx, ifp->ctx->ps_root_fd, PS_ND, 0, msg);
 }
 #endif
 
@@ -690,7 +691,7 @@ ps_inet_in6_docmd(struct ipv6_addr *ia, uint16_t cmd, const struct msghdr *msg)
 		},
 	};
 
-	return ps_sendpsmmsg(ctx, ctx->ps_root_fd, &psm, msg);
+	return ps_queuepsmmsg(ctx, ctx->ps_root_fd, &psm, msg);
 }
 
 ssize_t
@@ -711,7 +712,7 @@ ssize_t
 ps_inet_senddhcp6(struct interface *ifp, const struct msghdr *msg)
 {
 
-	return ps_sendmsg(ifp->ctx, ifp->ctx->ps_root_fd, PS_DHCP6, 0, msg);
+	return ps_queuemsg(ifp->ctx, ifp->ctx->ps_root_fd, PS_DHCP6, 0, msg);
 }
 #endif /* DHCP6 */
 #endif /* INET6 */
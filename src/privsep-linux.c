@@ -31,6 +31,7 @@
 #include <sys/syscall.h>
 
 #include <linux/audit.h>
+#include <linux/bpf.h>
 #include <linux/filter.h>
 #include <linux/seccomp.h>
 #include <linux/sockios.h>
@@ -82,14 +83,60 @@ out:
 	return retval;
 }
 
+static ssize_t
+ps_root_dosendnetlinkbatch(int protocol, struct msghdr *msg,
+    void **rdata, size_t *rlen)
+{
+	static int errs[NETLINK_BATCH_MAX];
+	struct sockaddr_nl snl = { .nl_family = AF_NETLINK };
+	struct nlmsghdr *nlm, *hdr;
+	size_t len, n;
+	int s;
+	ssize_t retval;
+
+	if (msg->msg_iovlen != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	hdr = msg->msg_iov[0].iov_base;
+	len = msg->msg_iov[0].iov_len;
+	n = 0;
+	for (nlm = hdr; NLMSG_OK(nlm, len); nlm = NLMSG_NEXT(nlm, len))
+		n++;
+	if (n == 0 || n > NETLINK_BATCH_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((s = if_linksocket(&snl, protocol, 0)) == -1)
+		return -1;
+
+	if (sendmsg(s, msg, 0) == -1) {
+		retval = -1;
+		goto out;
+	}
+
+	retval = if_getnetlinkacks(s, hdr->nlmsg_seq, errs, n);
+	if (retval != -1) {
+		*rdata = errs;
+		*rlen = n * sizeof(errs[0]);
+	}
+out:
+	close(s);
+	return retval;
+}
+
 ssize_t
 ps_root_os(struct ps_msghdr *psm, struct msghdr *msg,
-    __unused void **rdata, __unused size_t *rlen)
+    void **rdata, size_t *rlen)
 {
 
 	switch (psm->ps_cmd) {
 	case PS_ROUTE:
 		return ps_root_dosendnetlink((int)psm->ps_flags, msg);
+	case PS_ROUTEBATCH:
+		return ps_root_dosendnetlinkbatch((int)psm->ps_flags, msg,
+		    rdata, rlen);
 	default:
 		errno = ENOTSUP;
 		return -1;
@@ -106,6 +153,17 @@ ps_root_sendnetlink(struct dhcpcd_ctx *ctx, int protocol, struct msghdr *msg)
 	return ps_root_readerror(ctx, NULL, 0);
 }
 
+ssize_t
+ps_root_sendnetlinkbatch(struct dhcpcd_ctx *ctx, int protocol,
+    struct msghdr *msg, int *errs, size_t n)
+{
+
+	if (ps_sendmsg(ctx, ctx->ps_root_fd, PS_ROUTEBATCH,
+	    (unsigned long)protocol, msg) == -1)
+		return -1;
+	return ps_root_readerror(ctx, errs, n * sizeof(*errs));
+}
+
 #if (BYTE_ORDER == LITTLE_ENDIAN)
 # define SECCOMP_ARG_LO	0
 # define SECCOMP_ARG_HI	sizeof(uint32_t)
@@ -212,9 +270,57 @@ static struct sock_filter ps_seccomp_filter[] = {
 	/* Allow syscalls */
 	BPF_STMT(BPF_LD + BPF_W + BPF_ABS,
 		offsetof(struct seccomp_data, nr)),
+	/* A call is checked against each entry in turn, so those made
+	 * each time the event loop wakes come first and the rest
+	 * follow in alphabetical order. */
+#ifdef __NR_epoll_pwait
+	SECCOMP_ALLOW(__NR_epoll_pwait),
+#endif
+#ifdef __NR_epoll_wait
+	SECCOMP_ALLOW(__NR_epoll_wait),
+#endif
+#if defined(HAVE_IO_URING) && defined(__NR_io_uring_enter)
+	/* eloop restricts the ring to polling. */
+	SECCOMP_ALLOW(__NR_io_uring_enter),
+#endif
+#ifdef __NR_ppoll
+	SECCOMP_ALLOW(__NR_ppoll),
+#endif
+#ifdef __NR_ppoll_time64
+	SECCOMP_ALLOW(__NR_ppoll_time64),
+#endif
+#ifdef __NR_recvmsg
+	SECCOMP_ALLOW(__NR_recvmsg),
+#endif
+#ifdef __NR_writev
+	SECCOMP_ALLOW(__NR_writev),
+#endif
+#ifdef __NR_read
+	SECCOMP_ALLOW(__NR_read),
+#endif
+#ifdef __NR_write
+	SECCOMP_ALLOW(__NR_write),
+#endif
+#ifdef __NR_sendmsg
+	SECCOMP_ALLOW(__NR_sendmsg),
+#endif
+#ifdef __NR_sendto
+	SECCOMP_ALLOW(__NR_sendto),
+#endif
+#ifdef __NR_recvmmsg
+	SECCOMP_ALLOW(__NR_recvmmsg),
+#endif
+#ifdef __NR_recvmmsg_time64
+	SECCOMP_ALLOW(__NR_recvmmsg_time64),
+#endif
 #ifdef __NR_accept
 	SECCOMP_ALLOW(__NR_accept),
 #endif
+#ifdef __NR_bpf
+	/* Views of the shared BOOTP socket update its maps. */
+	SECCOMP_ALLOW_ARG(__NR_bpf, 0, BPF_MAP_UPDATE_ELEM),
+	SECCOMP_ALLOW_ARG(__NR_bpf, 0, BPF_MAP_DELETE_ELEM),
+#endif
 #ifdef __NR_brk
 	SECCOMP_ALLOW(__NR_brk),
 #endif
@@ -230,6 +336,9 @@ static struct sock_filter ps_seccomp_filter[] = {
 #ifdef __NR_close
 	SECCOMP_ALLOW(__NR_close),
 #endif
+#ifdef __NR_epoll_ctl
+	SECCOMP_ALLOW(__NR_epoll_ctl),
+#endif
 #ifdef __NR_exit_group
 	SECCOMP_ALLOW(__NR_exit_group),
 #endif
@@ -245,6 +354,10 @@ static struct sock_filter ps_seccomp_filter[] = {
 #ifdef __NR_getpid
 	SECCOMP_ALLOW(__NR_getpid),
 #endif
+#ifdef __NR_getsockopt
+	/* For route socket overflow */
+	SECCOMP_ALLOW_ARG(__NR_getsockopt, 2, SO_RCVBUF),
+#endif
 #ifdef __NR_ioctl
 	SECCOMP_ALLOW_ARG(__NR_ioctl, 1, SIOCGIFFLAGS),
 	SECCOMP_ALLOW_ARG(__NR_ioctl, 1, SIOCGIFHWADDR),
@@ -263,15 +376,6 @@ static struct sock_filter ps_seccomp_filter[] = {
 #ifdef __NR_nanosleep
 	SECCOMP_ALLOW(__NR_nanosleep),	/* XXX should use ppoll instead */
 #endif
-#ifdef __NR_ppoll
-	SECCOMP_ALLOW(__NR_ppoll),
-#endif
-#ifdef __NR_ppoll_time64
-	SECCOMP_ALLOW(__NR_ppoll_time64),
-#endif
-#ifdef __NR_read
-	SECCOMP_ALLOW(__NR_read),
-#endif
 #ifdef __NR_readv
 	SECCOMP_ALLOW(__NR_readv),
 #endif
@@ -281,20 +385,17 @@ static struct sock_filter ps_seccomp_filter[] = {
 #ifdef __NR_recvfrom
 	SECCOMP_ALLOW(__NR_recvfrom),
 #endif
-#ifdef __NR_recvmsg
-	SECCOMP_ALLOW(__NR_recvmsg),
-#endif
 #ifdef __NR_rt_sigreturn
 	SECCOMP_ALLOW(__NR_rt_sigreturn),
 #endif
 #ifdef __NR_send
 	SECCOMP_ALLOW(__NR_send),
 #endif
-#ifdef __NR_sendmsg
-	SECCOMP_ALLOW(__NR_sendmsg),
-#endif
-#ifdef __NR_sendto
-	SECCOMP_ALLOW(__NR_sendto),
+#ifdef __NR_setsockopt
+	/* For the link socket receive buffer and filter */
+	SECCOMP_ALLOW_ARG(__NR_setsockopt, 2, SO_RCVBUF),
+	SECCOMP_ALLOW_ARG(__NR_setsockopt, 2, SO_RCVBUFFORCE),
+	SECCOMP_ALLOW_ARG(__NR_setsockopt, 2, SO_ATTACH_FILTER),
 #endif
 #ifdef __NR_shutdown
 	SECCOMP_ALLOW(__NR_shutdown),
@@ -308,16 +409,9 @@ static struct sock_filter ps_seccomp_filter[] = {
 #ifdef __NR_waitpid
 	SECCOMP_ALLOW(__NR_waitpid),
 #endif
-#ifdef __NR_write
-	SECCOMP_ALLOW(__NR_write),
-#endif
-#ifdef __NR_writev
-	SECCOMP_ALLOW(__NR_writev),
-#endif
 #ifdef __NR_uname
 	SECCOMP_ALLOW(__NR_uname),
 #endif
-
 	/* Deny everything else */
 	BPF_STMT(BPF_RET + BPF_K, SECCOMP_FILTER_FAIL),
 };
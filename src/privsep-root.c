@@ -46,12 +46,15 @@
 #include "auth.h"
 #include "common.h"
 #include "dev.h"
+#include "dhcp-common.h"
 #include "dhcpcd.h"
 #include "dhcp6.h"
 #include "eloop.h"
 #include "if.h"
 #include "ipv6nd.h"
+#include "leasedb.h"
 #include "logerr.h"
+#include "netconf.h"
 #include "privsep.h"
 #include "sa.h"
 #include "script.h"
@@ -71,8 +74,11 @@ struct psr_ctx {
 	struct psr_error psr_error;
 	size_t psr_datalen;
 	void *psr_data;
+	time_t *psr_mtime;	/* PS_READFILE replies lead with this */
 };
 
+static void ps_root_drainasync(struct dhcpcd_ctx *);
+
 static void
 ps_root_readerrorcb(void *arg)
 {
@@ -81,6 +87,9 @@ ps_root_readerrorcb(void *arg)
 	struct psr_error *psr_error = &psr_ctx->psr_error;
 	struct iovec iov[] = {
 		{ .iov_base = psr_error, .iov_len = sizeof(*psr_error) },
+		{ .iov_base = psr_ctx->psr_mtime,
+		  .iov_len = psr_ctx->psr_mtime != NULL ?
+		    sizeof(*psr_ctx->psr_mtime) : 0 },
 		{ .iov_base = psr_ctx->psr_data,
 		  .iov_len = psr_ctx->psr_datalen },
 	};
@@ -99,20 +108,26 @@ ps_root_readerrorcb(void *arg)
 		PSR_ERROR(errno);
 	else if ((size_t)len < sizeof(*psr_error))
 		PSR_ERROR(EINVAL);
+	else if (psr_error->psr_result != -1 &&
+	    (size_t)len < iov[0].iov_len + iov[1].iov_len)
+		PSR_ERROR(EINVAL);
 	exit_code = EXIT_SUCCESS;
 
 out:
 	eloop_exit(ctx->ps_eloop, exit_code);
 }
 
-ssize_t
-ps_root_readerror(struct dhcpcd_ctx *ctx, void *data, size_t len)
+static ssize_t
+ps_root_readerrormtime(struct dhcpcd_ctx *ctx, void *data, size_t len,
+    time_t *mtime)
 {
 	struct psr_ctx psr_ctx = {
 	    .psr_ctx = ctx,
 	    .psr_data = data, .psr_datalen = len,
+	    .psr_mtime = mtime,
 	};
 
+	ps_root_drainasync(ctx);
 	if (eloop_event_add(ctx->ps_eloop, ctx->ps_root_fd,
 	    ps_root_readerrorcb, &psr_ctx) == -1)
 		return -1;
@@ -124,7 +139,13 @@ ps_root_readerror(struct dhcpcd_ctx *ctx, void *data, size_t len)
 	return psr_ctx.psr_error.psr_result;
 }
 
-#ifdef PRIVSEP_GETIFADDRS
+ssize_t
+ps_root_readerror(struct dhcpcd_ctx *ctx, void *data, size_t len)
+{
+
+	return ps_root_readerrormtime(ctx, data, len, NULL);
+}
+
 static void
 ps_root_mreaderrorcb(void *arg)
 {
@@ -166,8 +187,8 @@ out:
 	eloop_exit(ctx->ps_eloop, exit_code);
 }
 
-ssize_t
-ps_root_mreaderror(struct dhcpcd_ctx *ctx, void **data, size_t *len)
+static ssize_t
+ps_root_mreadreply(struct dhcpcd_ctx *ctx, void **data, size_t *len)
 {
 	struct psr_ctx psr_ctx = {
 	    .psr_ctx = ctx,
@@ -185,7 +206,144 @@ ps_root_mreaderror(struct dhcpcd_ctx *ctx, void **data, size_t *len)
 	*len = psr_ctx.psr_datalen;
 	return psr_ctx.psr_error.psr_result;
 }
-#endif
+
+ssize_t
+ps_root_mreaderror(struct dhcpcd_ctx *ctx, void **data, size_t *len)
+{
+
+	ps_root_drainasync(ctx);
+	return ps_root_mreadreply(ctx, data, len);
+}
+
+/*
+ * Root answers each request in turn, so replies come back in the order
+ * the requests were sent and the oldest request in flight owns the next.
+ */
+static void
+ps_root_readasync(struct dhcpcd_ctx *ctx)
+{
+	struct ps_root_req *psq = TAILQ_FIRST(&ctx->ps_root_reqs);
+
+	psq->psq_data = NULL;
+	psq->psq_datalen = 0;
+	psq->psq_result = ps_root_mreadreply(ctx,
+	    &psq->psq_data, &psq->psq_datalen);
+	psq->psq_errno = errno;
+	TAILQ_REMOVE(&ctx->ps_root_reqs, psq, next);
+	TAILQ_INSERT_TAIL(&ctx->ps_root_done, psq, next);
+}
+
+static void
+ps_root_dispatchasync(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct ps_root_req *psq;
+
+	while ((psq = TAILQ_FIRST(&ctx->ps_root_done)) != NULL) {
+		TAILQ_REMOVE(&ctx->ps_root_done, psq, next);
+		if (psq->psq_cb != NULL)
+			psq->psq_cb(psq->psq_arg, psq->psq_result,
+			    psq->psq_errno, psq->psq_data, psq->psq_datalen);
+		free(psq->psq_data);
+		free(psq);
+	}
+}
+
+static void
+ps_root_asynccb(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+
+	ps_root_readasync(ctx);
+	if (TAILQ_EMPTY(&ctx->ps_root_reqs))
+		eloop_event_delete(ctx->eloop, ctx->ps_root_fd);
+	ps_root_dispatchasync(ctx);
+}
+
+/* A synchronous request has to wait for those already in flight.
+ * Their callbacks are run from the main loop so they cannot nest. */
+static void
+ps_root_drainasync(struct dhcpcd_ctx *ctx)
+{
+
+	if (TAILQ_EMPTY(&ctx->ps_root_reqs))
+		return;
+	eloop_event_delete(ctx->eloop, ctx->ps_root_fd);
+	do
+		ps_root_readasync(ctx);
+	while (!TAILQ_EMPTY(&ctx->ps_root_reqs));
+	eloop_timeout_add_sec(ctx->eloop, 0, ps_root_dispatchasync, ctx);
+}
+
+static void
+ps_root_freeasync(struct dhcpcd_ctx *ctx)
+{
+	struct ps_root_req *psq;
+
+	eloop_timeout_delete(ctx->eloop, ps_root_dispatchasync, ctx);
+	while ((psq = TAILQ_FIRST(&ctx->ps_root_reqs)) != NULL) {
+		TAILQ_REMOVE(&ctx->ps_root_reqs, psq, next);
+		free(psq);
+	}
+	while ((psq = TAILQ_FIRST(&ctx->ps_root_done)) != NULL) {
+		TAILQ_REMOVE(&ctx->ps_root_done, psq, next);
+		free(psq->psq_data);
+		free(psq);
+	}
+}
+
+/* Send a request to root without waiting for the reply.
+ * cb is called from the main loop with the result, errno and any data,
+ * which is only valid for the duration of the call.
+ * Returns an id for ps_root_cancel() or 0 on error. */
+unsigned int
+ps_root_async(struct dhcpcd_ctx *ctx, uint16_t cmd, unsigned long flags,
+    const void *data, size_t len,
+    void (*cb)(void *, ssize_t, int, void *, size_t), void *arg)
+{
+	struct ps_root_req *psq;
+
+	psq = malloc(sizeof(*psq));
+	if (psq == NULL)
+		return 0;
+	if (ps_sendcmd(ctx, ctx->ps_root_fd, cmd, flags, data, len) == -1) {
+		free(psq);
+		return 0;
+	}
+
+	if (TAILQ_EMPTY(&ctx->ps_root_reqs) &&
+	    eloop_event_add(ctx->eloop, ctx->ps_root_fd,
+	    ps_root_asynccb, ctx) == -1)
+		logerr(__func__);
+	if (++ctx->ps_root_reqid == 0)
+		ctx->ps_root_reqid = 1;
+	psq->psq_id = ctx->ps_root_reqid;
+	psq->psq_cb = cb;
+	psq->psq_arg = arg;
+	psq->psq_data = NULL;
+	TAILQ_INSERT_TAIL(&ctx->ps_root_reqs, psq, next);
+	return psq->psq_id;
+}
+
+/* The request still has to be answered, but nobody is told. */
+void
+ps_root_cancel(struct dhcpcd_ctx *ctx, unsigned int id)
+{
+	struct ps_root_req *psq;
+
+	TAILQ_FOREACH(psq, &ctx->ps_root_reqs, next) {
+		if (psq->psq_id == id) {
+			psq->psq_cb = NULL;
+			return;
+		}
+	}
+	TAILQ_FOREACH(psq, &ctx->ps_root_done, next) {
+		if (psq->psq_id == id) {
+			psq->psq_cb = NULL;
+			return;
+		}
+	}
+}
 
 static ssize_t
 ps_root_writeerror(struct dhcpcd_ctx *ctx, ssize_t result,
@@ -256,29 +414,10 @@ ps_root_doioctl(unsigned long req, void *data, size_t len)
 static ssize_t
 ps_root_run_script(struct dhcpcd_ctx *ctx, const void *data, size_t len)
 {
-	const char *envbuf = data;
-	char * const argv[] = { ctx->script, NULL };
-	pid_t pid;
-	int status;
 
-	if (len == 0)
-		return 0;
-
-	if (script_buftoenv(ctx, UNCONST(envbuf), len) == NULL)
-		return -1;
-
-	pid = script_exec(argv, ctx->script_env);
-	if (pid == -1)
-		return -1;
-	/* Wait for the script to finish */
-	while (waitpid(pid, &status, 0) == -1) {
-		if (errno != EINTR) {
-			logerr(__func__);
-			status = 0;
-			break;
-		}
-	}
-	return status;
+	/* The script runs in the background so we can carry on
+	 * serving the other processes. */
+	return script_queue(ctx, data, len);
 }
 
 static bool
@@ -292,12 +431,14 @@ ps_root_validpath(const struct dhcpcd_ctx *ctx, uint16_t cmd, const char *path)
 
 	if (cmd == PS_READFILE) {
 #ifdef EMBEDDED_CONFIG
-		if (strcmp(ctx->cffile, EMBEDDED_CONFIG) == 0)
+		if (strcmp(path, EMBEDDED_CONFIG) == 0)
 			return true;
 #endif
 		if (strcmp(ctx->cffile, path) == 0)
 			return true;
 	}
+	if (netconf_handles(ctx, path, cmd != PS_READFILE))
+		return true;
 	if (strncmp(DBDIR, path, strlen(DBDIR)) == 0)
 		return true;
 	if (strncmp(RUNDIR, path, strlen(RUNDIR)) == 0)
@@ -314,11 +455,21 @@ ps_root_validpath(const struct dhcpcd_ctx *ctx, uint16_t cmd, const char *path)
 	return false;
 }
 
+/* As with reading, the mtime leads the file name and contents. */
 static ssize_t
-ps_root_dowritefile(const struct dhcpcd_ctx *ctx,
+ps_root_dowritefile(struct dhcpcd_ctx *ctx,
     mode_t mode, void *data, size_t len)
 {
-	char *file = data, *nc;
+	char *file, *nc;
+	time_t mtime;
+
+	if (len < sizeof(mtime)) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(&mtime, data, sizeof(mtime));
+	file = (char *)data + sizeof(mtime);
+	len -= sizeof(mtime);
 
 	nc = memchr(file, '\0', len);
 	if (nc == NULL) {
@@ -329,7 +480,33 @@ ps_root_dowritefile(const struct dhcpcd_ctx *ctx,
 	if (!ps_root_validpath(ctx, PS_WRITEFILE, file))
 		return -1;
 	nc++;
-	return writefile(file, mode, nc, len - (size_t)(nc - file));
+	return dhcp_writefile_mtime(ctx, file, mode, nc,
+	    len - (size_t)(nc - file), mtime);
+}
+
+/* The mtime leads the contents so that reading a lease or the config
+ * doesn't need another trip to us to check how old it is. */
+static ssize_t
+ps_root_doreadfile(struct dhcpcd_ctx *ctx, const char *file,
+    uint8_t *buf, size_t len)
+{
+	time_t mtime;
+	ssize_t bytes;
+	int err;
+
+	buf += sizeof(mtime);
+	len -= sizeof(mtime);
+	if (leasedb_handles(ctx, file)) {
+		bytes = leasedb_read(ctx, file, buf, len);
+		err = bytes == -1 ? -1 : leasedb_mtime(ctx, file, &mtime);
+	} else {
+		bytes = readfile(file, buf, len);
+		err = bytes == -1 ? -1 : filemtime(file, &mtime);
+	}
+	if (err == -1)
+		return -1;
+	memcpy(buf - sizeof(mtime), &mtime, sizeof(mtime));
+	return bytes;
 }
 
 #ifdef AUTH
@@ -346,33 +523,54 @@ ps_root_monordm(uint64_t *rdm, size_t len)
 #endif
 
 #ifdef PRIVSEP_GETIFADDRS
+/*
+ * A PS_GETIFADDRS reply is psi_count records followed by this trailer.
+ * Each record is a struct ifaddrs, its name, the lengths of its
+ * sockaddrs and ifa_data and then those, all aligned so the manager
+ * only has to point the struct ifaddrs at them where they lie.
+ * The trailer goes last so the first record is the start of the buffer.
+ * If the request names an interface, only its records are sent.
+ */
+struct psr_ifaddrs {
+	uint32_t psi_version;
+	uint32_t psi_count;
+};
+#define	PSR_IFADDRS_VERSION	1
 #define	IFA_NADDRS	4
+#define	IFA_HDRLEN	\
+	(ALIGN(sizeof(struct ifaddrs)) + ALIGN(IFNAMSIZ) + \
+	 ALIGN(sizeof(socklen_t) * IFA_NADDRS))
+
 static ssize_t
-ps_root_dogetifaddrs(void **rdata, size_t *rlen)
+ps_root_dogetifaddrs(const char *ifname, size_t ifnamelen,
+    void **rdata, size_t *rlen)
 {
 	struct ifaddrs *ifaddrs, *ifa;
+	struct psr_ifaddrs *psi;
 	size_t len;
 	uint8_t *buf, *sap;
 	socklen_t salen;
 
-	if (getifaddrs(&ifaddrs) == -1)
+	if (ifnamelen == 0)
+		ifname = NULL;
+	else if (memchr(ifname, '\0', ifnamelen) == NULL) {
+		errno = EINVAL;
 		return -1;
-	if (ifaddrs == NULL) {
-		*rdata = NULL;
-		*rlen = 0;
-		return 0;
 	}
 
+	if (getifaddrs(&ifaddrs) == -1)
+		return -1;
+
 	/* Work out the buffer length required.
 	 * Ensure everything is aligned correctly, which does
 	 * create a larger buffer than what is needed to send,
 	 * but makes creating the same structure in the client
 	 * much easier. */
-	len = 0;
+	len = ALIGN(sizeof(*psi));
 	for (ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next) {
-		len += ALIGN(sizeof(*ifa));
-		len += ALIGN(IFNAMSIZ);
-		len += ALIGN(sizeof(salen) * IFA_NADDRS);
+		if (ifname != NULL && strcmp(ifa->ifa_name, ifname) != 0)
+			continue;
+		len += IFA_HDRLEN;
 		if (ifa->ifa_addr != NULL)
 			len += ALIGN(sa_len(ifa->ifa_addr));
 		if (ifa->ifa_netmask != NULL)
@@ -401,7 +599,14 @@ ps_root_dogetifaddrs(void **rdata, size_t *rlen)
 	*rdata = buf;
 	*rlen = len;
 
+	psi = (struct psr_ifaddrs *)(void *)(buf + len - ALIGN(sizeof(*psi)));
+	psi->psi_version = PSR_IFADDRS_VERSION;
+
 	for (ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next) {
+		if (ifname != NULL && strcmp(ifa->ifa_name, ifname) != 0)
+			continue;
+		psi->psi_count++;
+
 		memcpy(buf, ifa, sizeof(*ifa));
 		buf += ALIGN(sizeof(*ifa));
 
@@ -468,6 +673,10 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 #endif
 
 	if (psp != NULL) {
+#if defined(INET) && defined(__linux__)
+		if (psp->psp_pooled)
+			return ps_bpf_poolcmd(psp, psm, msg);
+#endif
 		if (psm->ps_cmd & PS_STOP) {
 			int ret = ps_dostop(ctx, &psp->psp_pid, &psp->psp_fd);
 
@@ -483,8 +692,6 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 			logerr("%s: failed to send message to pid %d",
 			    __func__, psp->psp_pid);
 			shutdown(psp->psp_fd, SHUT_RDWR);
-			close(psp->psp_fd);
-			psp->psp_fd = -1;
 			ps_freeprocess(psp);
 		}
 		return 0;
@@ -537,17 +744,20 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 			err = -1;
 			break;
 		}
-		err = unlink(data);
+		if (leasedb_handles(ctx, data))
+			err = leasedb_unlink(ctx, data);
+		else
+			err = unlink(data);
 		break;
 	case PS_READFILE:
 		if (!ps_root_validpath(ctx, psm->ps_cmd, data)) {
 			err = -1;
 			break;
 		}
-		err = readfile(data, buf, sizeof(buf));
+		err = ps_root_doreadfile(ctx, data, buf, sizeof(buf));
 		if (err != -1) {
 			rdata = buf;
-			rlen = (size_t)err;
+			rlen = sizeof(mtime) + (size_t)err;
 		}
 		break;
 	case PS_WRITEFILE:
@@ -555,7 +765,10 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 		    data, len);
 		break;
 	case PS_FILEMTIME:
-		err = filemtime(data, &mtime);
+		if (leasedb_handles(ctx, data))
+			err = leasedb_mtime(ctx, data, &mtime);
+		else
+			err = filemtime(data, &mtime);
 		if (err != -1) {
 			rdata = &mtime;
 			rlen = sizeof(mtime);
@@ -575,7 +788,7 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 #endif
 #ifdef PRIVSEP_GETIFADDRS
 	case PS_GETIFADDRS:
-		err = ps_root_dogetifaddrs(&rdata, &rlen);
+		err = ps_root_dogetifaddrs(data, len, &rdata, &rlen);
 		free_rdata = true;
 		break;
 #endif
@@ -709,12 +922,25 @@ ps_root_startcb(void *arg)
 }
 
 static void
-ps_root_signalcb(int sig, __unused void *arg)
+ps_root_signalcb(int sig, void *arg)
 {
+	struct dhcpcd_ctx *ctx = arg;
+	struct ps_process *psp;
+	pid_t pid;
+	int status;
 
 	if (sig == SIGCHLD) {
-		while (waitpid(-1, NULL, WNOHANG) > 0)
-			;
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			if (script_reap(ctx, pid, status))
+				continue;
+			/* A helper which exited on its own can be started
+			 * again by the next command for it. */
+			psp = ps_findprocesspid(ctx, pid);
+			if (psp == NULL)
+				continue;
+			logwarnx("%s: PID %d exited", __func__, (int)pid);
+			ps_freeprocess(psp);
+		}
 		return;
 	}
 }
@@ -851,18 +1077,51 @@ ps_root_start(struct dhcpcd_ctx *ctx)
 
 int
 ps_root_stop(struct dhcpcd_ctx *ctx)
+{
+	pid_t pid = ctx->ps_root_pid;
+	int err;
+
+	/* Let root finish what it was asked to do, such as the
+	 * STOPPED script, before it's told to stop. */
+	if (ctx->ps_root_fd != -1) {
+		ps_root_drainasync(ctx);
+		ps_root_dispatchasync(ctx);
+	}
+	ps_root_freeasync(ctx);
+	err = ps_dostop(ctx, &ctx->ps_root_pid, &ctx->ps_root_fd);
+
+	/* Scripts run in the background, so wait for root to finish
+	 * them before we are seen to exit. */
+	if (pid != 0 && pid != getpid()) {
+		while (waitpid(pid, NULL, 0) == -1) {
+			if (errno != EINTR)
+				break;
+		}
+	}
+	return err;
+}
+
+static void
+ps_root_scriptcb(__unused void *arg, ssize_t result, int err,
+    __unused void *data, __unused size_t len)
 {
 
-	return ps_dostop(ctx, &ctx->ps_root_pid, &ctx->ps_root_fd);
+	if (result == -1) {
+		errno = err;
+		logerr(__func__);
+	}
 }
 
+/* The caller has nothing to do with the result, so don't wait for root
+ * to run the script and reap it. */
 ssize_t
 ps_root_script(struct dhcpcd_ctx *ctx, const void *data, size_t len)
 {
 
-	if (ps_sendcmd(ctx, ctx->ps_root_fd, PS_SCRIPT, 0, data, len) == -1)
+	if (ps_root_async(ctx, PS_SCRIPT, 0, data, len,
+	    ps_root_scriptcb, NULL) == 0)
 		return -1;
-	return ps_root_readerror(ctx, NULL, 0);
+	return 0;
 }
 
 ssize_t
@@ -882,10 +1141,26 @@ ps_root_ioctl(struct dhcpcd_ctx *ctx, ioctl_request_t req, void *data,
 	return ps_root_readerror(ctx, data, len);
 }
 
+/* The mtime of the last file read is kept just long enough
+ * to answer the filemtime check which follows it. */
+static void
+ps_root_setmtime(struct dhcpcd_ctx *ctx, const char *file, time_t mtime)
+{
+
+	free(ctx->ps_mtimefile);
+	if (file == NULL) {
+		ctx->ps_mtimefile = NULL;
+		return;
+	}
+	ctx->ps_mtimefile = strdup(file);
+	ctx->ps_mtime = mtime;
+}
+
 ssize_t
 ps_root_unlink(struct dhcpcd_ctx *ctx, const char *file)
 {
 
+	ps_root_setmtime(ctx, NULL, 0);
 	if (ps_sendcmd(ctx, ctx->ps_root_fd, PS_UNLINK, 0,
 	    file, strlen(file) + 1) == -1)
 		return -1;
@@ -896,21 +1171,30 @@ ssize_t
 ps_root_readfile(struct dhcpcd_ctx *ctx, const char *file,
     void *data, size_t len)
 {
+	time_t mtime;
+	ssize_t bytes;
+
+	ps_root_setmtime(ctx, NULL, 0);
 	if (ps_sendcmd(ctx, ctx->ps_root_fd, PS_READFILE, 0,
 	    file, strlen(file) + 1) == -1)
 		return -1;
-	return ps_root_readerror(ctx, data, len);
+	bytes = ps_root_readerrormtime(ctx, data, len, &mtime);
+	if (bytes != -1)
+		ps_root_setmtime(ctx, file, mtime);
+	return bytes;
 }
 
 ssize_t
 ps_root_writefile(struct dhcpcd_ctx *ctx, const char *file, mode_t mode,
-    const void *data, size_t len)
+    const void *data, size_t len, time_t mtime)
 {
 	char buf[PS_BUFLEN];
 	size_t flen;
 
-	flen = strlcpy(buf, file, sizeof(buf));
-	flen += 1;
+	ps_root_setmtime(ctx, NULL, 0);
+	memcpy(buf, &mtime, sizeof(mtime));
+	flen = strlcpy(buf + sizeof(mtime), file, sizeof(buf) - sizeof(mtime));
+	flen += sizeof(mtime) + 1;
 	if (flen > sizeof(buf) || flen + len > sizeof(buf)) {
 		errno = ENOBUFS;
 		return -1;
@@ -923,10 +1207,51 @@ ps_root_writefile(struct dhcpcd_ctx *ctx, const char *file, mode_t mode,
 	return ps_root_readerror(ctx, NULL, 0);
 }
 
+static void
+ps_root_writefilecb(__unused void *arg, ssize_t result, int err,
+    __unused void *data, __unused size_t len)
+{
+
+	if (result == -1) {
+		errno = err;
+		logerr(__func__);
+	}
+}
+
+/* As ps_root_writefile, but any error is only logged. */
+ssize_t
+ps_root_writefile_async(struct dhcpcd_ctx *ctx, const char *file,
+    mode_t mode, const void *data, size_t len, time_t mtime)
+{
+	char buf[PS_BUFLEN];
+	size_t flen;
+
+	ps_root_setmtime(ctx, NULL, 0);
+	memcpy(buf, &mtime, sizeof(mtime));
+	flen = strlcpy(buf + sizeof(mtime), file, sizeof(buf) - sizeof(mtime));
+	flen += sizeof(mtime) + 1;
+	if (flen > sizeof(buf) || flen + len > sizeof(buf)) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	memcpy(buf + flen, data, len);
+
+	if (ps_root_async(ctx, PS_WRITEFILE, mode, buf, flen + len,
+	    ps_root_writefilecb, NULL) == 0)
+		return -1;
+	return (ssize_t)len;
+}
+
 ssize_t
 ps_root_filemtime(struct dhcpcd_ctx *ctx, const char *file, time_t *time)
 {
 
+	if (ctx->ps_mtimefile != NULL && strcmp(ctx->ps_mtimefile, file) == 0) {
+		*time = ctx->ps_mtime;
+		ps_root_setmtime(ctx, NULL, 0);
+		return 0;
+	}
+
 	if (ps_sendcmd(ctx, ctx->ps_root_fd, PS_FILEMTIME, 0,
 	    file, strlen(file) + 1) == -1)
 		return -1;
@@ -943,54 +1268,65 @@ ps_root_logreopen(struct dhcpcd_ctx *ctx)
 }
 
 #ifdef PRIVSEP_GETIFADDRS
+/* The list is made in the reply buffer itself, so free(3) the first
+ * entry once done with rather than calling freeifaddrs(3).
+ * If ifname is not NULL then only addresses on it are returned. */
 int
-ps_root_getifaddrs(struct dhcpcd_ctx *ctx, struct ifaddrs **ifahead)
+ps_root_getifaddrs(struct dhcpcd_ctx *ctx, const char *ifname,
+    struct ifaddrs **ifahead)
 {
-	struct ifaddrs *ifa;
+	struct psr_ifaddrs psi;
+	struct ifaddrs *ifa, **ifap;
 	void *buf = NULL;
 	char *bp, *sap;
 	socklen_t salen;
 	size_t len;
 	ssize_t err;
+	uint32_t n;
 
-	if (ps_sendcmd(ctx, ctx->ps_root_fd,
-	    PS_GETIFADDRS, 0, NULL, 0) == -1)
+	if (ps_sendcmd(ctx, ctx->ps_root_fd, PS_GETIFADDRS, 0,
+	    ifname, ifname != NULL ? strlen(ifname) + 1 : 0) == -1)
 		return -1;
 	err = ps_root_mreaderror(ctx, &buf, &len);
 
-	if (err == -1)
+	if (err == -1) {
+		free(buf);
 		return -1;
-
-	/* Should be impossible - lo0 will always exist. */
-	if (len == 0) {
-		*ifahead = NULL;
-		return 0;
 	}
 
+	if (len < ALIGN(sizeof(psi)))
+		goto err;
+	len -= ALIGN(sizeof(psi));
+	memcpy(&psi, (char *)buf + len, sizeof(psi));
+	if (psi.psi_version != PSR_IFADDRS_VERSION)
+		goto err;
 	bp = buf;
-	*ifahead = (struct ifaddrs *)(void *)bp;
-	for (ifa = *ifahead; ifa != NULL; ifa = ifa->ifa_next) {
-		if (len < ALIGN(sizeof(*ifa)) +
-		    ALIGN(IFNAMSIZ) + ALIGN(sizeof(salen) * IFA_NADDRS))
+
+	ifap = ifahead;
+	for (n = 0; n < psi.psi_count; n++) {
+		if (len < IFA_HDRLEN)
 			goto err;
+		ifa = (struct ifaddrs *)(void *)bp;
+		*ifap = ifa;
+		ifap = &ifa->ifa_next;
 		bp += ALIGN(sizeof(*ifa));
 		ifa->ifa_name = bp;
 		bp += ALIGN(IFNAMSIZ);
 		sap = bp;
 		bp += ALIGN(sizeof(salen) * IFA_NADDRS);
-		len -= ALIGN(sizeof(*ifa)) +
-		    ALIGN(IFNAMSIZ) + ALIGN(sizeof(salen) * IFA_NADDRS);
+		len -= IFA_HDRLEN;
 
 #define	COPYOUTSA(addr)						\
 	do {							\
 		memcpy(&salen, sap, sizeof(salen));		\
-		if (len < salen)				\
+		if (len < ALIGN(salen))				\
 			goto err;				\
 		if (salen != 0) {				\
-			(addr) = (struct sockaddr *)bp;		\
+			(addr) = (struct sockaddr *)(void *)bp;	\
 			bp += ALIGN(salen);			\
 			len -= ALIGN(salen);			\
-		}						\
+		} else						\
+			(addr) = NULL;				\
 		sap += sizeof(salen);				\
 	} while (0 /* CONSTCOND */)
 
@@ -999,7 +1335,7 @@ ps_root_getifaddrs(struct dhcpcd_ctx *ctx, struct ifaddrs **ifahead)
 		COPYOUTSA(ifa->ifa_broadaddr);
 
 		memcpy(&salen, sap, sizeof(salen));
-		if (len < salen)
+		if (len < ALIGN(salen))
 			goto err;
 		if (salen != 0) {
 			ifa->ifa_data = bp;
@@ -1007,12 +1343,14 @@ ps_root_getifaddrs(struct dhcpcd_ctx *ctx, struct ifaddrs **ifahead)
 			len -= ALIGN(salen);
 		} else
 			ifa->ifa_data = NULL;
-
-		if (len != 0)
-			ifa->ifa_next = (struct ifaddrs *)(void *)bp;
-		else
-			ifa->ifa_next = NULL;
 	}
+	if (len != 0)
+		goto err;
+	*ifap = NULL;
+
+	/* Nothing matched, so don't leave a buffer nobody will free. */
+	if (psi.psi_count == 0)
+		free(buf);
 	return 0;
 
 err:
@@ -31,32 +31,52 @@
 
 #include "if.h"
 
-#if defined(PRIVSEP) && (defined(HAVE_CAPSICUM) || defined(__linux__))
+#if defined(PRIVSEP) && defined(HAVE_CAPSICUM)
 #define PRIVSEP_GETIFADDRS
 #endif
 
+/* A request to root whose reply is handed to a callback. */
+struct ps_root_req {
+	TAILQ_ENTRY(ps_root_req) next;
+	unsigned int psq_id;
+	void (*psq_cb)(void *, ssize_t, int, void *, size_t);
+	void *psq_arg;
+	ssize_t psq_result;
+	int psq_errno;
+	void *psq_data;
+	size_t psq_datalen;
+};
+TAILQ_HEAD(ps_root_req_head, ps_root_req);
+
 pid_t ps_root_start(struct dhcpcd_ctx *ctx);
 int ps_root_stop(struct dhcpcd_ctx *ctx);
 
 ssize_t ps_root_readerror(struct dhcpcd_ctx *, void *, size_t);
 ssize_t ps_root_mreaderror(struct dhcpcd_ctx *, void **, size_t *);
+unsigned int ps_root_async(struct dhcpcd_ctx *, uint16_t, unsigned long,
+    const void *, size_t,
+    void (*)(void *, ssize_t, int, void *, size_t), void *);
+void ps_root_cancel(struct dhcpcd_ctx *, unsigned int);
 ssize_t ps_root_ioctl(struct dhcpcd_ctx *, ioctl_request_t, void *, size_t);
 ssize_t ps_root_ip6forwarding(struct dhcpcd_ctx *, const char *);
 ssize_t ps_root_unlink(struct dhcpcd_ctx *, const char *);
 ssize_t ps_root_filemtime(struct dhcpcd_ctx *, const char *, time_t *);
 ssize_t ps_root_readfile(struct dhcpcd_ctx *, const char *, void *, size_t);
 ssize_t ps_root_writefile(struct dhcpcd_ctx *, const char *, mode_t,
-    const void *, size_t);
+    const void *, size_t, time_t);
+ssize_t ps_root_writefile_async(struct dhcpcd_ctx *, const char *, mode_t,
+    const void *, size_t, time_t);
 ssize_t ps_root_logreopen(struct dhcpcd_ctx *);
 ssize_t ps_root_script(struct dhcpcd_ctx *, const void *, size_t);
 int ps_root_getauthrdm(struct dhcpcd_ctx *, uint64_t *);
 #ifdef PRIVSEP_GETIFADDRS
-int ps_root_getifaddrs(struct dhcpcd_ctx *, struct ifaddrs **);
+int ps_root_getifaddrs(struct dhcpcd_ctx *, const char *, struct ifaddrs **);
 #endif
 
 ssize_t ps_root_os(struct ps_msghdr *, struct msghdr *, void **, size_t *);
 #if defined(BSD) || defined(__sun)
 ssize_t ps_root_route(struct dhcpcd_ctx *, void *, size_t);
+ssize_t ps_root_routes(struct dhcpcd_ctx *, void *, size_t, int *, size_t);
 ssize_t ps_root_ioctllink(struct dhcpcd_ctx *, unsigned long, void *, size_t);
 ssize_t ps_root_ioctl6(struct dhcpcd_ctx *, unsigned long, void *, size_t);
 ssize_t ps_root_indirectioctl(struct dhcpcd_ctx *, unsigned long, const char *,
@@ -65,6 +85,8 @@ ssize_t ps_root_ifignoregroup(struct dhcpcd_ctx *, const char *);
 #endif
 #ifdef __linux__
 ssize_t ps_root_sendnetlink(struct dhcpcd_ctx *, int, struct msghdr *);
+ssize_t ps_root_sendnetlinkbatch(struct dhcpcd_ctx *, int, struct msghdr *,
+    int *, size_t);
 #endif
 
 #ifdef PLUGIN_DEV
@@ -40,6 +40,7 @@
  * this in a script or something.
  */
 
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -69,9 +70,12 @@
 #include "dhcp.h"
 #include "dhcp6.h"
 #include "eloop.h"
+#include "if.h"
 #include "ipv6nd.h"
 #include "logerr.h"
 #include "privsep.h"
+#include "probe.h"
+#include "script.h"
 
 #ifdef HAVE_CAPSICUM
 #include <sys/capsicum.h>
@@ -81,6 +85,10 @@
 #include <util.h>
 #endif
 
+#ifndef MAP_ANONYMOUS
+#define	MAP_ANONYMOUS	MAP_ANON
+#endif
+
 int
 ps_init(struct dhcpcd_ctx *ctx)
 {
@@ -314,6 +322,208 @@ ps_rights_limit_stdio(struct dhcpcd_ctx *ctx)
 }
 #endif
 
+/*
+ * With privsep_ring, each process pair started by ps_dostart() shares a
+ * ring per direction, so large messages are not copied through the
+ * kernel. Each record is announced by a PS_RING header on the socket
+ * and so is received in order with the messages which still use it.
+ * A record is its length then the ps_msghdr and data, aligned as
+ * PS_MSGBATCH. A zero length means the rest of the ring is unused.
+ * The peer can write anywhere in the mapping, so each side keeps its
+ * own head or tail and only trusts what it reads after checking it.
+ */
+struct ps_ringbuf {
+	size_t prb_head;		/* only set by the sender */
+	uint8_t prb_pad[64 - sizeof(size_t)];
+	size_t prb_tail;		/* only set by the receiver */
+	uint8_t prb_pad2[64 - sizeof(size_t)];
+	uint8_t prb_data[PS_RING_SIZE];
+};
+
+#define	PS_RING_RECLEN(len)	PS_MSGBATCH_ALIGN(sizeof(size_t) + (len))
+
+static struct ps_ring *
+ps_ring_new(void)
+{
+	struct ps_ring *pr;
+	struct ps_ringbuf *rb;
+
+	rb = mmap(NULL, sizeof(*rb) * 2, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (rb == MAP_FAILED)
+		return NULL;
+	if ((pr = malloc(sizeof(*pr))) == NULL) {
+		munmap(rb, sizeof(*rb) * 2);
+		return NULL;
+	}
+	pr->pr_fd = -1;
+	pr->pr_tx = &rb[0];
+	pr->pr_rx = &rb[1];
+	pr->pr_head = pr->pr_tail = 0;
+	return pr;
+}
+
+static void
+ps_ring_free(struct ps_ring *pr)
+{
+	struct ps_ringbuf *rb;
+
+	/* Both rings are in one mapping, the lowest first. */
+	rb = pr->pr_tx < pr->pr_rx ? pr->pr_tx : pr->pr_rx;
+	munmap(rb, sizeof(*rb) * 2);
+	free(pr);
+}
+
+static struct ps_ring *
+ps_ring_find(struct dhcpcd_ctx *ctx, int fd)
+{
+	struct ps_ring *pr;
+
+	if (fd == -1)
+		return NULL;
+	TAILQ_FOREACH(pr, &ctx->ps_rings, next) {
+		if (pr->pr_fd == fd)
+			return pr;
+	}
+	return NULL;
+}
+
+static void
+ps_ring_close(struct dhcpcd_ctx *ctx, int fd)
+{
+	struct ps_ring *pr;
+
+	if ((pr = ps_ring_find(ctx, fd)) == NULL)
+		return;
+	TAILQ_REMOVE(&ctx->ps_rings, pr, next);
+	ps_ring_free(pr);
+}
+
+static void
+ps_ring_freeall(struct dhcpcd_ctx *ctx)
+{
+	struct ps_ring *pr;
+
+	while ((pr = TAILQ_FIRST(&ctx->ps_rings)) != NULL) {
+		TAILQ_REMOVE(&ctx->ps_rings, pr, next);
+		ps_ring_free(pr);
+	}
+}
+
+/* Returns 0 if the message should go on the socket instead. */
+static ssize_t
+ps_ring_writev(struct ps_ring *pr, const struct iovec *iov, int iovcnt)
+{
+	struct ps_ringbuf *rb = pr->pr_tx;
+	struct ps_msghdr bell = { .ps_cmd = PS_RING };
+	size_t len, reclen, head, tail, off, pad;
+	uint8_t *p;
+	int i;
+
+	for (len = 0, i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (len < PS_RING_MIN || len > sizeof(struct ps_msg))
+		return 0;
+
+	reclen = PS_RING_RECLEN(len);
+	head = pr->pr_head;
+	tail = __atomic_load_n(&rb->prb_tail, __ATOMIC_ACQUIRE);
+	off = head % PS_RING_SIZE;
+	pad = PS_RING_SIZE - off;
+	if (pad >= reclen)
+		pad = 0;
+	if (head - tail > PS_RING_SIZE ||
+	    PS_RING_SIZE - (head - tail) < pad + reclen)
+		return 0;
+
+	if (pad != 0) {
+		memset(rb->prb_data + off, 0, sizeof(len));
+		off = 0;
+	}
+	p = rb->prb_data + off;
+	memcpy(p, &len, sizeof(len));
+	p += sizeof(len);
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(p, iov[i].iov_base, iov[i].iov_len);
+		p += iov[i].iov_len;
+	}
+	__atomic_store_n(&rb->prb_head, head + pad + reclen, __ATOMIC_RELEASE);
+
+	if (write(pr->pr_fd, &bell, sizeof(bell)) == -1) {
+		/* Without the doorbell the record was never sent. */
+		__atomic_store_n(&rb->prb_head, head, __ATOMIC_RELEASE);
+		return -1;
+	}
+	pr->pr_head = head + pad + reclen;
+	return (ssize_t)len;
+}
+
+/*
+ * Copy the next record out before acting on it, as the sender could
+ * otherwise change it after we have validated it.
+ */
+static ssize_t
+ps_ring_read(struct dhcpcd_ctx *ctx, int fd, void *buf, size_t buflen)
+{
+	struct ps_ring *pr;
+	struct ps_ringbuf *rb;
+	size_t len, head, tail, off, avail, skip;
+
+	if ((pr = ps_ring_find(ctx, fd)) == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	rb = pr->pr_rx;
+	tail = pr->pr_tail;
+	head = __atomic_load_n(&rb->prb_head, __ATOMIC_ACQUIRE);
+	avail = head - tail;
+	if (avail > PS_RING_SIZE)
+		goto invalid;
+
+	off = tail % PS_RING_SIZE;
+	if (avail < sizeof(len) || PS_RING_SIZE - off < sizeof(len))
+		goto invalid;
+	memcpy(&len, rb->prb_data + off, sizeof(len));
+	if (len == 0) {
+		skip = PS_RING_SIZE - off;
+		if (skip > avail - sizeof(len))
+			goto invalid;
+		tail += skip;
+		avail -= skip;
+		off = 0;
+		memcpy(&len, rb->prb_data, sizeof(len));
+	}
+	if (len > buflen ||
+	    PS_RING_RECLEN(len) > avail ||
+	    PS_RING_RECLEN(len) > PS_RING_SIZE - off)
+		goto invalid;
+
+	memcpy(buf, rb->prb_data + off + sizeof(len), len);
+	pr->pr_tail = tail + PS_RING_RECLEN(len);
+	__atomic_store_n(&rb->prb_tail, pr->pr_tail, __ATOMIC_RELEASE);
+	return (ssize_t)len;
+
+invalid:
+	logerrx("%s: ring out of sync", __func__);
+	errno = EINVAL;
+	return -1;
+}
+
+static ssize_t
+ps_writev(struct dhcpcd_ctx *ctx, int fd, const struct iovec *iov, int iovcnt)
+{
+	struct ps_ring *pr;
+	ssize_t len;
+
+	if ((pr = ps_ring_find(ctx, fd)) != NULL &&
+	    (len = ps_ring_writev(pr, iov, iovcnt)) != 0)
+		return len;
+	return writev(fd, iov, iovcnt);
+}
+
+static void ps_queue_close(struct dhcpcd_ctx *, int);
+static void ps_queue_freeall(struct dhcpcd_ctx *);
+
 pid_t
 ps_dostart(struct dhcpcd_ctx *ctx,
     pid_t *priv_pid, int *priv_fd,
@@ -323,34 +533,66 @@ ps_dostart(struct dhcpcd_ctx *ctx,
 {
 	int fd[2];
 	pid_t pid;
+	struct ps_ring *pr = NULL;
+	struct ps_ringbuf *rb;
 
 	if (xsocketpair(AF_UNIX, SOCK_DGRAM | SOCK_CXNB, 0, fd) == -1) {
 		logerr("%s: socketpair", __func__);
 		return -1;
 	}
+	if (ctx->ps_ring && (pr = ps_ring_new()) == NULL) {
+		logerr("%s: ps_ring_new", __func__);
+		return -1;
+	}
 	if (ps_setbuf_fdpair(fd) == -1) {
 		logerr("%s: ps_setbuf_fdpair", __func__);
+		if (pr != NULL)
+			ps_ring_free(pr);
 		return -1;
 	}
 #ifdef PRIVSEP_RIGHTS
 	if (ps_rights_limit_fdpair(fd) == -1) {
 		logerr("%s: ps_rights_limit_fdpair", __func__);
+		if (pr != NULL)
+			ps_ring_free(pr);
 		return -1;
 	}
 #endif
 
+	/* Don't leave our messages, or how many we suppressed,
+	 * for the child to write out as well. */
+	logratelimit_report();
+	logflush();
 	switch (pid = fork()) {
 	case -1:
 		logerr("fork");
+		if (pr != NULL)
+			ps_ring_free(pr);
 		return -1;
 	case 0:
 		*priv_fd = fd[1];
 		close(fd[0]);
+		/* Rings and queues to our parent's other processes
+		 * are not ours, nor are the scripts it runs. */
+		ps_ring_freeall(ctx);
+		ps_queue_freeall(ctx);
+		script_freejobs(ctx);
+		if (pr != NULL) {
+			rb = pr->pr_tx;
+			pr->pr_tx = pr->pr_rx;
+			pr->pr_rx = rb;
+			pr->pr_fd = *priv_fd;
+			TAILQ_INSERT_TAIL(&ctx->ps_rings, pr, next);
+		}
 		break;
 	default:
 		*priv_pid = pid;
 		*priv_fd = fd[0];
 		close(fd[1]);
+		if (pr != NULL) {
+			pr->pr_fd = *priv_fd;
+			TAILQ_INSERT_TAIL(&ctx->ps_rings, pr, next);
+		}
 		if (recv_unpriv_msg == NULL)
 			;
 		else if (eloop_event_add(ctx->eloop, *priv_fd,
@@ -369,6 +611,10 @@ ps_dostart(struct dhcpcd_ctx *ctx,
 	}
 	pidfile_clean();
 	eloop_clear(ctx->eloop);
+	if (eloop_forked(ctx->eloop) == -1) {
+		logerr("%s: eloop_forked", __func__);
+		goto errexit;
+	}
 
 	/* We are not root */
 	if (priv_fd != &ctx->ps_root_fd) {
@@ -441,6 +687,8 @@ ps_dostop(struct dhcpcd_ctx *ctx, pid_t *pid, int *fd)
 			err = -1;
 		}
 		(void)shutdown(*fd, SHUT_RDWR);
+		ps_ring_close(ctx, *fd);
+		ps_queue_close(ctx, *fd);
 		close(*fd);
 		*fd = -1;
 	}
@@ -451,12 +699,73 @@ ps_dostop(struct dhcpcd_ctx *ctx, pid_t *pid, int *fd)
 	return err;
 }
 
+static int
+ps_process_compare_id(__unused void *context,
+    const void *node1, const void *node2)
+{
+	const struct ps_process *psp1 = node1, *psp2 = node2;
+
+	return memcmp(&psp1->psp_id, &psp2->psp_id, sizeof(psp1->psp_id));
+}
+
+static int
+ps_process_compare_idkey(__unused void *context,
+    const void *node, const void *key)
+{
+	const struct ps_process *psp = node;
+
+	return memcmp(&psp->psp_id, key, sizeof(psp->psp_id));
+}
+
+static const rb_tree_ops_t ps_process_id_ops = {
+	.rbto_compare_nodes = ps_process_compare_id,
+	.rbto_compare_key = ps_process_compare_idkey,
+	.rbto_node_offset = offsetof(struct ps_process, psp_idtree),
+	.rbto_context = NULL
+};
+
+static int
+ps_process_compare_pid(__unused void *context,
+    const void *node1, const void *node2)
+{
+	const struct ps_process *psp1 = node1, *psp2 = node2;
+
+	if (psp1->psp_pidkey < psp2->psp_pidkey)
+		return -1;
+	return psp1->psp_pidkey == psp2->psp_pidkey ? 0 : 1;
+}
+
+static int
+ps_process_compare_pidkey(__unused void *context,
+    const void *node, const void *key)
+{
+	const struct ps_process *psp = node;
+	pid_t pid = *(const pid_t *)key;
+
+	if (psp->psp_pidkey < pid)
+		return -1;
+	return psp->psp_pidkey == pid ? 0 : 1;
+}
+
+static const rb_tree_ops_t ps_process_pid_ops = {
+	.rbto_compare_nodes = ps_process_compare_pid,
+	.rbto_compare_key = ps_process_compare_pidkey,
+	.rbto_node_offset = offsetof(struct ps_process, psp_pidtree),
+	.rbto_context = NULL
+};
+
 int
 ps_start(struct dhcpcd_ctx *ctx)
 {
 	pid_t pid;
 
 	TAILQ_INIT(&ctx->ps_processes);
+	rb_tree_init(&ctx->ps_procids, &ps_process_id_ops);
+	rb_tree_init(&ctx->ps_procpids, &ps_process_pid_ops);
+	TAILQ_INIT(&ctx->ps_rings);
+	TAILQ_INIT(&ctx->ps_queues);
+	TAILQ_INIT(&ctx->ps_root_reqs);
+	TAILQ_INIT(&ctx->ps_root_done);
 
 	switch (pid = ps_root_start(ctx)) {
 	case -1:
@@ -511,6 +820,9 @@ ps_entersandbox(const char *_pledge, const char **sandbox)
 	UNUSED(_pledge);
 #endif
 
+	/* Write out what we logged while syslog can still be opened. */
+	logflush();
+
 #if defined(HAVE_CAPSICUM)
 	if (sandbox != NULL)
 		*sandbox = "capsicum";
@@ -620,8 +932,13 @@ ps_freeprocess(struct ps_process *psp)
 {
 
 	TAILQ_REMOVE(&psp->psp_ctx->ps_processes, psp, next);
+	rb_tree_remove_node(&psp->psp_ctx->ps_procids, psp);
+	if (psp->psp_pidkey != 0)
+		rb_tree_remove_node(&psp->psp_ctx->ps_procpids, psp);
 	if (psp->psp_fd != -1) {
 		eloop_event_delete(psp->psp_ctx->eloop, psp->psp_fd);
+		ps_ring_close(psp->psp_ctx, psp->psp_fd);
+		ps_queue_close(psp->psp_ctx, psp->psp_fd);
 		close(psp->psp_fd);
 	}
 	if (psp->psp_work_fd != -1) {
@@ -692,6 +1009,191 @@ ps_unrollmsg(struct msghdr *msg, struct ps_msghdr *psm,
 	return 0;
 }
 
+static struct ps_queue *
+ps_queue_find(struct dhcpcd_ctx *ctx, int fd)
+{
+	struct ps_queue *pq;
+
+	TAILQ_FOREACH(pq, &ctx->ps_queues, next) {
+		if (pq->pq_fd == fd)
+			return pq;
+	}
+	return NULL;
+}
+
+static void
+ps_queue_free(struct ps_queue *pq)
+{
+
+	eloop_timeout_delete(pq->pq_ctx->eloop, NULL, pq);
+	TAILQ_REMOVE(&pq->pq_ctx->ps_queues, pq, next);
+	free(pq);
+}
+
+/* Anything still queued is lost with the process. */
+static void
+ps_queue_close(struct dhcpcd_ctx *ctx, int fd)
+{
+	struct ps_queue *pq;
+
+	if ((pq = ps_queue_find(ctx, fd)) != NULL)
+		ps_queue_free(pq);
+}
+
+static void
+ps_queue_freeall(struct dhcpcd_ctx *ctx)
+{
+	struct ps_queue *pq;
+
+	while ((pq = TAILQ_FIRST(&ctx->ps_queues)) != NULL)
+		ps_queue_free(pq);
+}
+
+static ssize_t
+ps_queue_flush(struct ps_queue *pq)
+{
+	struct dhcpcd_ctx *ctx = pq->pq_ctx;
+	struct ps_msghdr psm = {
+		.ps_cmd = PS_MSGBATCH,
+		.ps_datalen = pq->pq_len,
+	}, qpsm;
+	struct iovec iov[] = {
+		{ .iov_base = &psm, .iov_len = sizeof(psm) },
+		{ .iov_base = pq->pq_data, .iov_len = pq->pq_len },
+	};
+	ssize_t len;
+
+	if (pq->pq_count == 0)
+		return 0;
+	eloop_timeout_delete(ctx->eloop, NULL, pq);
+
+	if (pq->pq_count == 1) {
+		/* Send a lone message as it is, without the padding. */
+		memcpy(&qpsm, pq->pq_data, sizeof(qpsm));
+		iov[1].iov_len = sizeof(qpsm) + qpsm.ps_namelen +
+		    qpsm.ps_controllen + qpsm.ps_datalen;
+		len = ps_writev(ctx, pq->pq_fd, &iov[1], 1);
+	} else
+		len = ps_writev(ctx, pq->pq_fd, iov, __arraycount(iov));
+	pq->pq_count = 0;
+	pq->pq_len = 0;
+
+	if (len == -1) {
+		logerr(__func__);
+		if (ctx->options & DHCPCD_FORKED &&
+		    !(ctx->options & DHCPCD_PRIVSEPROOT))
+			eloop_exit(ctx->eloop, EXIT_FAILURE);
+	}
+	return len;
+}
+
+static void
+ps_queue_flushcb(void *arg)
+{
+
+	ps_queue_flush(arg);
+}
+
+ssize_t
+ps_flushqueue(struct dhcpcd_ctx *ctx, int fd)
+{
+	struct ps_queue *pq;
+
+	if ((pq = ps_queue_find(ctx, fd)) == NULL)
+		return 0;
+	return ps_queue_flush(pq);
+}
+
+/*
+ * Queue a message which needs no reply.
+ * Queued messages are sent together as one PS_MSGBATCH when the eloop
+ * next runs, or before anything else is sent on fd,
+ * so the receiver handles them all in one read.
+ */
+ssize_t
+ps_queuepsmmsg(struct dhcpcd_ctx *ctx, int fd,
+    struct ps_msghdr *psm, const struct msghdr *msg)
+{
+	struct ps_queue *pq;
+	size_t mlen, len;
+	uint8_t *p;
+	int i;
+
+	psm->ps_namelen = msg != NULL ? msg->msg_namelen : 0;
+	psm->ps_controllen = msg != NULL ? (socklen_t)msg->msg_controllen : 0;
+	psm->ps_datalen = 0;
+	for (i = 0; msg != NULL && i < (int)msg->msg_iovlen; i++)
+		psm->ps_datalen += msg->msg_iov[i].iov_len;
+	mlen = psm->ps_namelen + psm->ps_controllen + psm->ps_datalen;
+	len = PS_MSGBATCH_ALIGN(sizeof(*psm) + mlen);
+	if (len > sizeof(pq->pq_data))
+		return ps_sendpsmmsg(ctx, fd, psm, msg);
+
+	if ((pq = ps_queue_find(ctx, fd)) == NULL) {
+		if ((pq = malloc(sizeof(*pq))) == NULL)
+			return ps_sendpsmmsg(ctx, fd, psm, msg);
+		pq->pq_ctx = ctx;
+		pq->pq_fd = fd;
+		pq->pq_count = 0;
+		pq->pq_len = 0;
+		TAILQ_INSERT_TAIL(&ctx->ps_queues, pq, next);
+	}
+	if (len > sizeof(pq->pq_data) - pq->pq_len &&
+	    ps_queue_flush(pq) == -1)
+		return -1;
+
+	p = pq->pq_data + pq->pq_len;
+	memcpy(p, psm, sizeof(*psm));
+	p += sizeof(*psm);
+	if (psm->ps_namelen != 0) {
+		memcpy(p, msg->msg_name, psm->ps_namelen);
+		p += psm->ps_namelen;
+	}
+	if (psm->ps_controllen != 0) {
+		memcpy(p, msg->msg_control, psm->ps_controllen);
+		p += psm->ps_controllen;
+	}
+	for (i = 0; msg != NULL && i < (int)msg->msg_iovlen; i++) {
+		if (msg->msg_iov[i].iov_len == 0)
+			continue;
+		memcpy(p, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+		p += msg->msg_iov[i].iov_len;
+	}
+	memset(p, 0, (size_t)(pq->pq_data + pq->pq_len + len - p));
+	pq->pq_len += len;
+
+	if (pq->pq_count++ == 0 &&
+	    eloop_timeout_add_msec(ctx->eloop, 0, ps_queue_flushcb, pq) == -1)
+		return ps_queue_flush(pq);
+	return (ssize_t)(sizeof(*psm) + mlen);
+}
+
+ssize_t
+ps_queuepsmdata(struct dhcpcd_ctx *ctx, int fd,
+    struct ps_msghdr *psm, const void *data, size_t len)
+{
+	struct iovec iov[] = {
+		{ .iov_base = UNCONST(data), .iov_len = len },
+	};
+	struct msghdr msg = {
+		.msg_iov = iov, .msg_iovlen = 1,
+	};
+
+	return ps_queuepsmmsg(ctx, fd, psm, &msg);
+}
+
+ssize_t
+ps_queuemsg(struct dhcpcd_ctx *ctx, int fd, uint16_t cmd, unsigned long flags,
+    const struct msghdr *msg)
+{
+	struct ps_msghdr psm = {
+		.ps_cmd = cmd,
+		.ps_flags = flags,
+	};
+
+	return ps_queuepsmmsg(ctx, fd, &psm, msg);
+}
+
 ssize_t
 ps_sendpsmmsg(struct dhcpcd_ctx *ctx, int fd,
     struct ps_msghdr *psm, const struct msghdr *msg)
@@ -707,6 +1209,10 @@ ps_sendpsmmsg(struct dhcpcd_ctx *ctx, int fd,
 	int iovlen;
 	ssize_t len;
 
+	/* Keep the order of anything queued before us. */
+	if (ps_flushqueue(ctx, fd) == -1)
+		return -1;
+
 	if (msg != NULL) {
 		struct iovec *iovp = &iov[1];
 		int i;
@@ -734,7 +1240,8 @@ ps_sendpsmmsg(struct dhcpcd_ctx *ctx, int fd,
 	} else
 		iovlen = 1;
 
-	len = writev(fd, iov, iovlen);
+	len = ps_writev(ctx, fd, iov, iovlen);
+	PROBE3(ps_send, fd, psm->ps_cmd, len);
 	if (len == -1) {
 		logerr(__func__);
 		if (ctx->options & DHCPCD_FORKED &&
@@ -821,46 +1328,28 @@ ps_sendcmd(struct dhcpcd_ctx *ctx, int fd, uint16_t cmd, unsigned long flags,
 }
 
 static ssize_t
-ps_sendcmdmsg(int fd, uint16_t cmd, const struct msghdr *msg)
+ps_sendcmdmsg(struct dhcpcd_ctx *ctx, int fd, uint16_t cmd,
+    const struct msghdr *msg)
 {
-	struct ps_msghdr psm = { .ps_cmd = cmd };
-	uint8_t data[PS_BUFLEN], *p = data;
+	struct ps_msghdr psm = {
+		.ps_cmd = cmd,
+		.ps_namelen = msg->msg_namelen,
+		.ps_controllen = (socklen_t)msg->msg_controllen,
+		.ps_datalen = msg->msg_iov[0].iov_len,
+	};
 	struct iovec iov[] = {
 		{ .iov_base = &psm, .iov_len = sizeof(psm) },
-		{ .iov_base = data, .iov_len = 0 },
+		{ .iov_base = msg->msg_name, .iov_len = psm.ps_namelen },
+		{ .iov_base = msg->msg_control, .iov_len = psm.ps_controllen },
+		{ .iov_base = msg->msg_iov[0].iov_base,
+		  .iov_len = psm.ps_datalen },
 	};
-	size_t dl = sizeof(data);
 
-	if (msg->msg_namelen != 0) {
-		if (msg->msg_namelen > dl)
-			goto nobufs;
-		psm.ps_namelen = msg->msg_namelen;
-		memcpy(p, msg->msg_name, msg->msg_namelen);
-		p += msg->msg_namelen;
-		dl -= msg->msg_namelen;
-	}
-
-	if (msg->msg_controllen != 0) {
-		if (msg->msg_controllen > dl)
-			goto nobufs;
-		psm.ps_controllen = (socklen_t)msg->msg_controllen;
-		memcpy(p, msg->msg_control, msg->msg_controllen);
-		p += msg->msg_controllen;
-		dl -= msg->msg_controllen;
+	if (psm.ps_namelen + psm.ps_controllen + psm.ps_datalen > PS_BUFLEN) {
+		errno = ENOBUFS;
+		return -1;
 	}
-
-	psm.ps_datalen = msg->msg_iov[0].iov_len;
-	if (psm.ps_datalen > dl)
-		goto nobufs;
-
-	iov[1].iov_len = psm.ps_namelen + psm.ps_controllen + psm.ps_datalen;
-	if (psm.ps_datalen != 0)
-		memcpy(p, msg->msg_iov[0].iov_base, psm.ps_datalen);
-	return writev(fd, iov, __arraycount(iov));
-
-nobufs:
-	errno = ENOBUFS;
-	return -1;
+	return ps_writev(ctx, fd, iov, __arraycount(iov));
 }
 
 ssize_t
@@ -891,7 +1380,7 @@ ps_recvmsg(struct dhcpcd_ctx *ctx, int rfd, uint16_t cmd, int wfd)
 	}
 
 	iov[0].iov_len = (size_t)len;
-	len = ps_sendcmdmsg(wfd, cmd, &msg);
+	len = ps_sendcmdmsg(ctx, wfd, cmd, &msg);
 	if (len == -1) {
 		logerr("ps_sendcmdmsg");
 		if (ctx->options & DHCPCD_FORKED &&
@@ -901,6 +1390,147 @@ ps_recvmsg(struct dhcpcd_ctx *ctx, int rfd, uint16_t cmd, int wfd)
 	return len;
 }
 
+/*
+ * Forward datagrams drained together as few PS_MSGBATCH messages as
+ * possible. Each is framed by its own ps_msghdr and padded so the next
+ * header stays aligned. A datagram on its own is sent as normal.
+ */
+static ssize_t
+ps_sendcmdmsgs(struct dhcpcd_ctx *ctx, int fd, uint16_t cmd,
+    struct if_msgbatch *b, int n)
+{
+	struct ps_msghdr psm = { .ps_cmd = PS_MSGBATCH }, bpsm;
+	uint8_t data[PS_BUFLEN], *p;
+	struct iovec iov[] = {
+		{ .iov_base = &psm, .iov_len = sizeof(psm) },
+		{ .iov_base = data, .iov_len = 0 },
+	};
+	struct msghdr *msg;
+	int i, j;
+	size_t len;
+	ssize_t err = 0;
+
+	for (i = 0; i < n; i = j) {
+		p = data;
+		psm.ps_datalen = 0;
+		for (j = i; j < n; j++) {
+			msg = IF_MSGBATCH_MSG(b, j);
+			len = sizeof(bpsm) + msg->msg_namelen +
+			    msg->msg_controllen + msg->msg_iov[0].iov_len;
+			len = PS_MSGBATCH_ALIGN(len);
+			if (len > sizeof(data) - psm.ps_datalen)
+				break;
+
+			bpsm = (struct ps_msghdr){
+				.ps_cmd = cmd,
+				.ps_namelen = msg->msg_namelen,
+				.ps_controllen = (socklen_t)msg->msg_controllen,
+				.ps_datalen = msg->msg_iov[0].iov_len,
+			};
+			memcpy(p, &bpsm, sizeof(bpsm));
+			p += sizeof(bpsm);
+			memcpy(p, msg->msg_name, bpsm.ps_namelen);
+			p += bpsm.ps_namelen;
+			memcpy(p, msg->msg_control, bpsm.ps_controllen);
+			p += bpsm.ps_controllen;
+			memcpy(p, msg->msg_iov[0].iov_base, bpsm.ps_datalen);
+			p += bpsm.ps_datalen;
+			psm.ps_datalen += len;
+			memset(p, 0, (size_t)(data + psm.ps_datalen - p));
+			p = data + psm.ps_datalen;
+		}
+
+		if (j <= i + 1) {
+			j = i + 1;
+			if (ps_sendcmdmsg(ctx, fd, cmd,
+			    IF_MSGBATCH_MSG(b, i)) == -1)
+				err = -1;
+			continue;
+		}
+
+		iov[1].iov_len = psm.ps_datalen;
+		if (ps_writev(ctx, fd, iov, __arraycount(iov)) == -1)
+			err = -1;
+	}
+	return err;
+}
+
+ssize_t
+ps_recvmsgs(struct dhcpcd_ctx *ctx, int rfd, uint16_t cmd, int wfd,
+    struct if_msgbatch **bp)
+{
+	int n;
+	ssize_t len;
+
+	if (*bp == NULL && (*bp = if_msgbatch_new(64 * 1024)) == NULL) {
+		logerr(__func__);
+		return -1;
+	}
+
+	n = if_recvmsgs(rfd, *bp);
+	if (n == -1) {
+		logerr("%s: recvmsgs", __func__);
+		if (ctx->options & DHCPCD_FORKED &&
+		    !(ctx->options & DHCPCD_PRIVSEPROOT))
+			eloop_exit(ctx->eloop, EXIT_FAILURE);
+		return -1;
+	}
+
+	len = ps_sendcmdmsgs(ctx, wfd, cmd, *bp, n);
+	if (len == -1) {
+		logerr("ps_sendcmdmsgs");
+		if (ctx->options & DHCPCD_FORKED &&
+		    !(ctx->options & DHCPCD_PRIVSEPROOT))
+			eloop_exit(ctx->eloop, EXIT_FAILURE);
+	}
+	return len;
+}
+
+static ssize_t
+ps_recvpsmsgs(uint8_t *data, size_t len,
+    ssize_t (*callback)(void *, struct ps_msghdr *, struct msghdr *),
+    void *cbctx)
+{
+	struct ps_msghdr psm;
+	struct iovec iov[1];
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 1 };
+	size_t mlen;
+	ssize_t err = 0;
+	pid_t pid = getpid();
+
+	while (len != 0) {
+		if (len < sizeof(psm)) {
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(&psm, data, sizeof(psm));
+		mlen = psm.ps_namelen + psm.ps_controllen + psm.ps_datalen;
+		if (mlen > len - sizeof(psm)) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (ps_unrollmsg(&msg, &psm, data + sizeof(psm), mlen) == -1)
+			return -1;
+
+		if (callback != NULL) {
+			errno = 0;
+			if (callback(cbctx, &psm, &msg) == -1)
+				err = -1;
+			/* A callback which started a process also returns
+			 * in that process, which must not act on the rest. */
+			if (getpid() != pid)
+				return err;
+		}
+
+		mlen = PS_MSGBATCH_ALIGN(sizeof(psm) + mlen);
+		if (mlen > len)
+			mlen = len;
+		data += mlen;
+		len -= mlen;
+	}
+	return err;
+}
+
 ssize_t
 ps_recvpsmsg(struct dhcpcd_ctx *ctx, int fd,
     ssize_t (*callback)(void *, struct ps_msghdr *, struct msghdr *),
@@ -914,6 +1544,9 @@ ps_recvpsmsg(struct dhcpcd_ctx *ctx, int fd,
 	bool stop = false;
 
 	len = read(fd, &psm, sizeof(psm));
+	if (len >= (ssize_t)sizeof(psm.psm_hdr) &&
+	    psm.psm_hdr.ps_cmd == PS_RING)
+		len = ps_ring_read(ctx, fd, &psm, sizeof(psm));
 #ifdef PRIVSEP_DEBUG
 	logdebugx("%s: %zd", __func__, len);
 #endif
@@ -945,6 +1578,10 @@ ps_recvpsmsg(struct dhcpcd_ctx *ctx, int fd,
 		return len;
 	}
 	dlen -= sizeof(psm.psm_hdr);
+	PROBE3(ps_recv, fd, psm.psm_hdr.ps_cmd, dlen);
+
+	if (psm.psm_hdr.ps_cmd == PS_MSGBATCH)
+		return ps_recvpsmsgs(psm.psm_data, dlen, callback, cbctx);
 
 	if (ps_unrollmsg(&msg, &psm.psm_hdr, psm.psm_data, dlen) == -1)
 		return -1;
@@ -961,12 +1598,21 @@ ps_findprocess(struct dhcpcd_ctx *ctx, struct ps_id *psid)
 {
 	struct ps_process *psp;
 
-	TAILQ_FOREACH(psp, &ctx->ps_processes, next) {
-		if (memcmp(&psp->psp_id, psid, sizeof(psp->psp_id)) == 0)
-			return psp;
-	}
-	errno = ESRCH;
-	return NULL;
+	psp = rb_tree_find_node(&ctx->ps_procids, psid);
+	if (psp == NULL)
+		errno = ESRCH;
+	return psp;
+}
+
+struct ps_process *
+ps_findprocesspid(struct dhcpcd_ctx *ctx, pid_t pid)
+{
+	struct ps_process *psp;
+
+	psp = rb_tree_find_node(&ctx->ps_procpids, &pid);
+	if (psp == NULL)
+		errno = ESRCH;
+	return psp;
 }
 
 struct ps_process *
@@ -980,10 +1626,28 @@ ps_newprocess(struct dhcpcd_ctx *ctx, struct ps_id *psid)
 	psp->psp_ctx = ctx;
 	memcpy(&psp->psp_id, psid, sizeof(psp->psp_id));
 	psp->psp_work_fd = -1;
+	if (rb_tree_insert_node(&ctx->ps_procids, psp) != psp) {
+		free(psp);
+		errno = EEXIST;
+		return NULL;
+	}
 	TAILQ_INSERT_TAIL(&ctx->ps_processes, psp, next);
 	return psp;
 }
 
+/* File psp by pid once it has started. ps_freeprocess removes it. */
+void
+ps_indexprocess(struct ps_process *psp)
+{
+	struct dhcpcd_ctx *ctx = psp->psp_ctx;
+
+	if (psp->psp_pid <= 0 || psp->psp_pidkey != 0)
+		return;
+	psp->psp_pidkey = psp->psp_pid;
+	if (rb_tree_insert_node(&ctx->ps_procpids, psp) != psp)
+		psp->psp_pidkey = 0;
+}
+
 void
 ps_freeprocesses(struct dhcpcd_ctx *ctx, struct ps_process *notthis)
 {
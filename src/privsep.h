@@ -53,6 +53,9 @@
 #define	PS_CTL			0x0018
 #define	PS_CTL_EOF		0x0019
 #define	PS_LOGREOPEN		0x0020
+#define	PS_MSGBATCH		0x0021
+#define	PS_ROUTEBATCH		0x0022
+#define	PS_RING			0x0023
 
 /* BSD Commands */
 #define	PS_IOCTLLINK		0x0101
@@ -87,6 +90,16 @@
 				 CMSG_SPACE(sizeof(struct in6_pktinfo) + \
 				            sizeof(int)))
 
+/* Each message in a PS_MSGBATCH starts on this boundary. */
+#define	PS_MSGBATCH_ALIGN(len)	\
+	(((len) + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1))
+
+/* Shared memory ring per direction of a process pair when privsep_ring
+ * is set. It must hold at least one fully sized message.
+ * Smaller messages cost no more than the doorbell, so use the socket. */
+#define	PS_RING_SIZE		(256 * 1024)
+#define	PS_RING_MIN		512
+
 /* Handy macro to work out if in the privsep engine or not. */
 #define	IN_PRIVSEP(ctx)	\
 	((ctx)->options & DHCPCD_PRIVSEP)
@@ -147,9 +160,12 @@ struct ps_msg {
 struct bpf;
 struct ps_process {
 	TAILQ_ENTRY(ps_process) next;
+	rb_node_t psp_idtree;	/* node in ctx->ps_procids */
+	rb_node_t psp_pidtree;	/* node in ctx->ps_procpids */
 	struct dhcpcd_ctx *psp_ctx;
 	struct ps_id psp_id;
 	pid_t psp_pid;
+	pid_t psp_pidkey;	/* pid we are filed under, 0 if not */
 	int psp_fd;
 	int psp_work_fd;
 	unsigned int psp_ifindex;
@@ -161,10 +177,34 @@ struct ps_process {
 	int (*psp_filter)(const struct bpf *, const struct in_addr *);
 	struct interface psp_ifp; /* Move BPF gubbins elsewhere */
 	struct bpf *psp_bpf;
+	bool psp_pooled;		/* served by the pooled BPF helper */
+	unsigned int psp_npooled;	/* interfaces the pool serves */
 #endif
 };
 TAILQ_HEAD(ps_process_head, ps_process);
 
+struct ps_ringbuf;
+struct ps_ring {
+	TAILQ_ENTRY(ps_ring) next;
+	int pr_fd;			/* socket carrying the doorbells */
+	struct ps_ringbuf *pr_tx;
+	struct ps_ringbuf *pr_rx;
+	size_t pr_head;			/* private copies, those in the */
+	size_t pr_tail;			/* shared rings are only published */
+};
+TAILQ_HEAD(ps_ring_head, ps_ring);
+
+/* Messages which need no reply, sent together as one PS_MSGBATCH. */
+struct ps_queue {
+	TAILQ_ENTRY(ps_queue) next;
+	struct dhcpcd_ctx *pq_ctx;
+	int pq_fd;
+	unsigned int pq_count;
+	size_t pq_len;
+	uint8_t pq_data[PS_BUFLEN];
+};
+TAILQ_HEAD(ps_queue_head, ps_queue);
+
 #include "privsep-control.h"
 #include "privsep-inet.h"
 #include "privsep-root.h"
@@ -187,7 +227,17 @@ ssize_t ps_sendmsg(struct dhcpcd_ctx *, int, uint16_t, unsigned long,
     const struct msghdr *);
 ssize_t ps_sendcmd(struct dhcpcd_ctx *, int, uint16_t, unsigned long,
     const void *data, size_t len);
+ssize_t ps_queuepsmmsg(struct dhcpcd_ctx *, int,
+    struct ps_msghdr *, const struct msghdr *);
+ssize_t ps_queuepsmdata(struct dhcpcd_ctx *, int,
+    struct ps_msghdr *, const void *, size_t);
+ssize_t ps_queuemsg(struct dhcpcd_ctx *, int, uint16_t, unsigned long,
+    const struct msghdr *);
+ssize_t ps_flushqueue(struct dhcpcd_ctx *, int);
 ssize_t ps_recvmsg(struct dhcpcd_ctx *, int, uint16_t, int);
+struct if_msgbatch;
+ssize_t ps_recvmsgs(struct dhcpcd_ctx *, int, uint16_t, int,
+    struct if_msgbatch **);
 ssize_t ps_recvpsmsg(struct dhcpcd_ctx *, int,
     ssize_t (*callback)(void *, struct ps_msghdr *, struct msghdr *), void *);
 
@@ -215,7 +265,9 @@ pid_t ps_dostart(struct dhcpcd_ctx * ctx,
 int ps_dostop(struct dhcpcd_ctx *ctx, pid_t *pid, int *fd);
 
 struct ps_process *ps_findprocess(struct dhcpcd_ctx *, struct ps_id *);
+struct ps_process *ps_findprocesspid(struct dhcpcd_ctx *, pid_t);
 struct ps_process *ps_newprocess(struct dhcpcd_ctx *, struct ps_id *);
+void ps_indexprocess(struct ps_process *);
 void ps_freeprocess(struct ps_process *);
 void ps_freeprocesses(struct dhcpcd_ctx *, struct ps_process *);
 #endif
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - static trace probes
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef PROBE_H
+#define PROBE_H
+
+/*
+ * USDT probes in the dhcpcd provider, for dtrace(1) or bpftrace(8):
+ *	bpftrace -e 'usdt:/sbin/dhcpcd:dhcpcd:dhcp_send { ... }'
+ * Each is a nop unless traced and nothing at all without sys/sdt.h,
+ * so arguments must not have side effects.
+ * Arguments must be scalars, so pass arrays such as ifp->name as pointers.
+ * The probes and their arguments are listed in dhcpcd(8).
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define	PROBE0(name)			DTRACE_PROBE(dhcpcd, name)
+#define	PROBE1(name, a)			DTRACE_PROBE1(dhcpcd, name, a)
+#define	PROBE2(name, a, b)		DTRACE_PROBE2(dhcpcd, name, a, b)
+#define	PROBE3(name, a, b, c)		DTRACE_PROBE3(dhcpcd, name, a, b, c)
+#define	PROBE4(name, a, b, c, d)	DTRACE_PROBE4(dhcpcd, name, a, b, c, d)
+#else
+#define	PROBE0(name)
+#define	PROBE1(name, a)
+#define	PROBE2(name, a, b)
+#define	PROBE3(name, a, b, c)
+#define	PROBE4(name, a, b, c, d)
+#endif
+
+#endif
@@ -38,14 +38,18 @@
 #include "config.h"
 #include "common.h"
 #include "dhcpcd.h"
+#include "eloop.h"
 #include "if.h"
 #include "if-options.h"
 #include "ipv4.h"
 #include "ipv4ll.h"
 #include "ipv6.h"
 #include "logerr.h"
+#include "pool.h"
+#include "probe.h"
 #include "route.h"
 #include "sa.h"
+#include "snapshot.h"
 
 /* Needed for NetBSD-6, 7 and 8. */
 #ifndef RB_TREE_FOREACH_SAFE
@@ -63,13 +67,6 @@
         (N) = (S))
 #endif
 
-#ifdef RT_FREE_ROUTE_TABLE_STATS
-static size_t croutes;
-static size_t nroutes;
-static size_t froutes;
-static size_t mroutes;
-#endif
-
 static void
 rt_maskedaddr(struct sockaddr *dst,
 	const struct sockaddr *addr, const struct sockaddr *netmask)
@@ -122,21 +119,57 @@ rt_cmp_netmask(const struct rt *rt1, const struct rt *rt2)
 	return sa_cmp(&rt1->rt_netmask, &rt2->rt_netmask);
 }
 
-static int
-rt_compare_os(__unused void *context, const void *node1, const void *node2)
+/*
+ * Routes must be keyed before they go into a tree using
+ * rt_compare_os_ops. Protocol routes are keyed by rt_build() and
+ * kernel routes by the platform code which reads them.
+ */
+void
+rt_setkey(struct rt *rt)
 {
-	const struct rt *rt1 = node1, *rt2 = node2;
-	int c;
-
-	/* Sort by masked destination. */
-	c = rt_cmp_dest(rt1, rt2);
-	if (c != 0)
-		return c;
-
+	union sa_ss ma = { .sa.sa_family = AF_UNSPEC };
+	struct rt_key *key = &rt->rt_key;
+	const uint8_t *p;
+	size_t i;
+
+	memset(key, 0, sizeof(*key));
+	rt_maskedaddr(&ma.sa, &rt->rt_dest, &rt->rt_netmask);
+	key->rk_family = ma.sa.sa_family;
+	switch (ma.sa.sa_family) {
+	case AF_INET:
+		p = (const uint8_t *)&ma.sin.sin_addr;
+		for (i = 0; i < sizeof(ma.sin.sin_addr); i++)
+			key->rk_dest[0] |= (uint64_t)p[i] << (56 - i * 8);
+		break;
+	case AF_INET6:
+		p = ma.sin6.sin6_addr.s6_addr;
+		for (i = 0; i < sizeof(ma.sin6.sin6_addr); i++)
+			key->rk_dest[i / 8] |=
+			    (uint64_t)p[i] << (56 - (i % 8) * 8);
+		break;
+	}
 #ifdef HAVE_ROUTE_METRIC
-	c = (int)(rt1->rt_ifp->metric - rt2->rt_ifp->metric);
+	if (rt->rt_ifp != NULL)
+		key->rk_metric = rt->rt_ifp->metric;
 #endif
-	return c;
+}
+
+/* Sort by masked destination, then interface metric. */
+static int
+rt_compare_os(__unused void *context, const void *node1, const void *node2)
+{
+	const struct rt_key *k1 = &((const struct rt *)node1)->rt_key;
+	const struct rt_key *k2 = &((const struct rt *)node2)->rt_key;
+
+	if (k1->rk_family != k2->rk_family)
+		return k1->rk_family < k2->rk_family ? -1 : 1;
+	if (k1->rk_dest[0] != k2->rk_dest[0])
+		return k1->rk_dest[0] < k2->rk_dest[0] ? -1 : 1;
+	if (k1->rk_dest[1] != k2->rk_dest[1])
+		return k1->rk_dest[1] < k2->rk_dest[1] ? -1 : 1;
+	if (k1->rk_metric != k2->rk_metric)
+		return k1->rk_metric < k2->rk_metric ? -1 : 1;
+	return 0;
 }
 
 static int
@@ -206,30 +239,13 @@ const rb_tree_ops_t rt_compare_proto_ops = {
 	.rbto_context = NULL
 };
 
-#ifdef RT_FREE_ROUTE_TABLE
-static int
-rt_compare_free(__unused void *context, const void *node1, const void *node2)
-{
-
-	return node1 == node2 ? 0 : node1 < node2 ? -1 : 1;
-}
-
-static const rb_tree_ops_t rt_compare_free_ops = {
-	.rbto_compare_nodes = rt_compare_free,
-	.rbto_compare_key = rt_compare_free,
-	.rbto_node_offset = offsetof(struct rt, rt_tree),
-	.rbto_context = NULL
-};
-#endif
-
 void
 rt_init(struct dhcpcd_ctx *ctx)
 {
 
 	rb_tree_init(&ctx->routes, &rt_compare_os_ops);
-#ifdef RT_FREE_ROUTE_TABLE
-	rb_tree_init(&ctx->froutes, &rt_compare_free_ops);
-#endif
+	rb_tree_init(&ctx->kroutes, &rt_compare_os_ops);
+	pool_init(&ctx->rt_pool, "rt", sizeof(struct rt));
 }
 
 bool
@@ -291,9 +307,6 @@ rt_headclear0(struct dhcpcd_ctx *ctx, rb_tree_t *rts, int af)
 	if (rts == NULL)
 		return;
 	assert(ctx != NULL);
-#ifdef RT_FREE_ROUTE_TABLE
-	assert(&ctx->froutes != rts);
-#endif
 
 	RB_TREE_FOREACH_SAFE(rt, rts, rtn) {
 		if (af != AF_UNSPEC &&
@@ -322,7 +335,7 @@ rt_headfree(rb_tree_t *rts)
 
 	while ((rt = RB_TREE_MIN(rts)) != NULL) {
 		rb_tree_remove_node(rts, rt);
-		free(rt);
+		pool_put(rt);
 	}
 }
 
@@ -332,14 +345,8 @@ rt_dispose(struct dhcpcd_ctx *ctx)
 
 	assert(ctx != NULL);
 	rt_headfree(&ctx->routes);
-#ifdef RT_FREE_ROUTE_TABLE
-	rt_headfree(&ctx->froutes);
-#ifdef RT_FREE_ROUTE_TABLE_STATS
-	logdebugx("free route list used %zu times", froutes);
-	logdebugx("new routes from route free list %zu", nroutes);
-	logdebugx("maximum route free list size %zu", mroutes);
-#endif
-#endif
+	rt_headfree(&ctx->kroutes);
+	pool_dispose(&ctx->rt_pool);
 }
 
 struct rt *
@@ -348,20 +355,10 @@ rt_new0(struct dhcpcd_ctx *ctx)
 	struct rt *rt;
 
 	assert(ctx != NULL);
-#ifdef RT_FREE_ROUTE_TABLE
-	if ((rt = RB_TREE_MIN(&ctx->froutes)) != NULL) {
-		rb_tree_remove_node(&ctx->froutes, rt);
-#ifdef RT_FREE_ROUTE_TABLE_STATS
-		croutes--;
-		nroutes++;
-#endif
-	} else
-#endif
-	if ((rt = malloc(sizeof(*rt))) == NULL) {
+	if ((rt = pool_get(&ctx->rt_pool)) == NULL) {
 		logerr(__func__);
 		return NULL;
 	}
-	memset(rt, 0, sizeof(*rt));
 	return rt;
 }
 
@@ -412,26 +409,8 @@ rt_proto_add(rb_tree_t *tree, struct rt *rt)
 void
 rt_free(struct rt *rt)
 {
-#ifdef RT_FREE_ROUTE_TABLE
-	struct dhcpcd_ctx *ctx;
 
-	assert(rt != NULL);
-	if (rt->rt_ifp == NULL) {
-		free(rt);
-		return;
-	}
-
-	ctx = rt->rt_ifp->ctx;
-	rb_tree_insert_node(&ctx->froutes, rt);
-#ifdef RT_FREE_ROUTE_TABLE_STATS
-	croutes++;
-	froutes++;
-	if (croutes > mroutes)
-		mroutes = croutes;
-#endif
-#else
-	free(rt);
-#endif
+	pool_put(rt);
 }
 
 void
@@ -449,10 +428,134 @@ rt_freeif(struct interface *ifp)
 			rt_free(rt);
 		}
 	}
+	RB_TREE_FOREACH_SAFE(rt, &ctx->kroutes, rtn) {
+		if (rt->rt_ifp == ifp) {
+			rb_tree_remove_node(&ctx->kroutes, rt);
+			rt_free(rt);
+		}
+	}
+}
+
+static bool
+rt_cmp(const struct rt *r1, const struct rt *r2)
+{
+
+	return (r1->rt_ifp == r2->rt_ifp &&
+#ifdef HAVE_ROUTE_METRIC
+	    r1->rt_metric == r2->rt_metric &&
+#endif
+	    sa_cmp(&r1->rt_gateway, &r2->rt_gateway) == 0);
+}
+
+/*
+ * ctx->kroutes is our view of the kernel routing table.
+ * A family is dumped the first time a route we don't already manage
+ * has to be checked against it. After that it's kept up to date from
+ * the route messages we receive and the changes we make ourselves,
+ * and is only dumped again once rt_kroutes_flush() drops it.
+ * Routes owned by a routing daemon are kept out of it, but once adding
+ * ours finds one a marker with RTDF_DAEMON set holds its key so we
+ * leave it be rather than dump the table again on every rt_build().
+ */
+static unsigned int
+rt_kroutes_af(int af)
+{
+
+	switch (af) {
+	case AF_INET:
+		return 0x1;
+	case AF_INET6:
+		return 0x2;
+	default:
+		return 0x3;
+	}
+}
+
+void
+rt_kroutes_flush(struct dhcpcd_ctx *ctx, int af)
+{
+
+	rt_headclear0(ctx, &ctx->kroutes, af);
+	ctx->kroutes_af &= ~rt_kroutes_af(af);
+}
+
+static struct rt *
+rt_findkroute(struct dhcpcd_ctx *ctx, const struct rt *rt)
+{
+	int af = rt->rt_dest.sa_family;
+	struct rt *krt;
+
+	if (!(ctx->kroutes_af & rt_kroutes_af(af))) {
+		if (if_initrt(ctx, &ctx->kroutes, af) == -1)
+			logerr("if_initrt");
+		else
+			ctx->kroutes_af |= rt_kroutes_af(af);
+	}
+	krt = rb_tree_find_node(&ctx->kroutes, rt);
+	if (krt != NULL && krt->rt_dflags & RTDF_DAEMON)
+		return NULL;
+	return krt;
+}
+
+static bool
+rt_daemonkroute(struct dhcpcd_ctx *ctx, const struct rt *rt)
+{
+	struct rt *krt;
+
+	krt = rb_tree_find_node(&ctx->kroutes, rt);
+	return krt != NULL && krt->rt_dflags & RTDF_DAEMON;
+}
+
+static void
+rt_setdaemonkroute(struct dhcpcd_ctx *ctx, const struct rt *rt)
+{
+	int af = rt->rt_dest.sa_family;
+	struct rt *krt;
+
+	if (!(ctx->kroutes_af & rt_kroutes_af(af)) ||
+	    (krt = rt_new0(ctx)) == NULL)
+		return;
+	memcpy(krt, rt, sizeof(*krt));
+	krt->rt_dflags |= RTDF_DAEMON;
+	if (rb_tree_insert_node(&ctx->kroutes, krt) != krt)
+		rt_free(krt);
+}
+
+static void
+rt_setkroute(struct dhcpcd_ctx *ctx, const struct rt *rt)
+{
+	int af = rt->rt_dest.sa_family;
+	struct rt *krt;
+
+	if (!(ctx->kroutes_af & rt_kroutes_af(af)))
+		return;
+
+	krt = rb_tree_find_node(&ctx->kroutes, rt);
+	if (krt != NULL)
+		rb_tree_remove_node(&ctx->kroutes, krt);
+	else if ((krt = rt_new0(ctx)) == NULL) {
+		rt_kroutes_flush(ctx, af);
+		return;
+	}
+	memcpy(krt, rt, sizeof(*krt));
+	rb_tree_insert_node(&ctx->kroutes, krt);
+}
+
+static void
+rt_delkroute(struct dhcpcd_ctx *ctx, const struct rt *rt, bool exact)
+{
+	struct rt *krt;
+
+	krt = rb_tree_find_node(&ctx->kroutes, rt);
+	if (krt == NULL || (exact && !rt_cmp(krt, rt)))
+		return;
+	rb_tree_remove_node(&ctx->kroutes, krt);
+	rt_free(krt);
 }
 
 /* If something other than dhcpcd removes a route,
- * we need to remove it from our internal table. */
+ * we need to remove it from our internal table.
+ * Any other change is noted in our view of the kernel. */
 void
 rt_recvrt(int cmd, const struct rt *rt, pid_t pid)
 {
@@ -466,7 +569,18 @@ rt_recvrt(int cmd, const struct rt *rt, pid_t pid)
 	ctx = rt->rt_ifp->ctx;
 
 	switch(cmd) {
+	case RTM_ADD:
+	case RTM_CHANGE:
+		/* Routes owned by a routing daemon are not ours to touch. */
+		if (!(rt->rt_dflags & RTDF_DAEMON))
+			rt_setkroute(ctx, rt);
+		break;
 	case RTM_DELETE:
+		/* Free the key of any route of ours it held back. */
+		if (!(rt->rt_dflags & RTDF_DAEMON))
+			rt_delkroute(ctx, rt, true);
+		else if (rt_daemonkroute(ctx, rt))
+			rt_delkroute(ctx, rt, false);
 		f = rb_tree_find_node(&ctx->routes, rt);
 		if (f != NULL) {
 			char buf[32];
@@ -485,11 +599,44 @@ rt_recvrt(int cmd, const struct rt *rt, pid_t pid)
 #endif
 }
 
-static bool
-rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
+/* After route messages have been lost, dump the kernel table again
+ * and forget any route of ours it no longer has, as rt_recvrt() would
+ * have done, so rt_build() puts just those back. */
+void
+rt_resync(struct dhcpcd_ctx *ctx)
+{
+	struct rt *rt, *rtn;
+	unsigned int lost = 0;
+
+	rt_kroutes_flush(ctx, AF_UNSPEC);
+	RB_TREE_FOREACH_SAFE(rt, &ctx->routes, rtn) {
+		if (rt->rt_dflags & RTDF_FAKE ||
+		    rt_findkroute(ctx, rt) != NULL)
+			continue;
+		rb_tree_remove_node(&ctx->routes, rt);
+		rt_desc("lost", rt);
+		lost |= rt_kroutes_af(rt->rt_dest.sa_family);
+		rt_free(rt);
+	}
+
+#ifdef INET
+	if (lost & rt_kroutes_af(AF_INET))
+		rt_build(ctx, AF_INET);
+#endif
+#ifdef INET6
+	if (lost & rt_kroutes_af(AF_INET6))
+		rt_build(ctx, AF_INET6);
+#endif
+}
+
+/* Returns -1 if nrt should not be installed, 1 if the kernel already
+ * has it, otherwise 0 with the route it replaces in ortp. */
+static int
+rt_addprep(struct rt *nrt, struct rt **ortp, bool *changep)
 {
 	struct dhcpcd_ctx *ctx;
-	bool change, kroute, result;
+	struct rt *ort = *ortp;
+	bool change;
 
 	assert(nrt != NULL);
 	ctx = nrt->rt_ifp->ctx;
@@ -507,13 +654,17 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 	    (!nrt->rt_ifp->active && !(ctx->options & DHCPCD_GATEWAY))) &&
 	    sa_is_unspecified(&nrt->rt_dest) &&
 	    sa_is_unspecified(&nrt->rt_netmask))
-		return false;
+		return -1;
+
+	/* A routing daemon already has this key, leave it alone. */
+	if (ort == NULL && rt_daemonkroute(ctx, nrt))
+		return -1;
 
 	rt_desc(ort == NULL ? "adding" : "changing", nrt);
 
-	change = kroute = result = false;
+	change = false;
 	if (ort == NULL) {
-		ort = rb_tree_find_node(kroutes, nrt);
+		ort = rt_findkroute(ctx, nrt);
 		if (ort != NULL &&
 		    ((ort->rt_flags & RTF_REJECT &&
 		      nrt->rt_flags & RTF_REJECT) ||
@@ -524,9 +675,8 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 		    sa_cmp(&ort->rt_gateway, &nrt->rt_gateway) == 0)))
 		{
 			if (ort->rt_mtu == nrt->rt_mtu)
-				return true;
+				return 1;
 			change = true;
-			kroute = true;
 		}
 	} else if (ort->rt_dflags & RTDF_FAKE &&
 	    !(nrt->rt_dflags & RTDF_FAKE) &&
@@ -539,7 +689,7 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 	    sa_cmp(&ort->rt_gateway, &nrt->rt_gateway) == 0)
 	{
 		if (ort->rt_mtu == nrt->rt_mtu)
-			return true;
+			return 1;
 		change = true;
 	}
 
@@ -552,6 +702,18 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 		change = false;
 #endif
 
+	*ortp = ort;
+	*changep = change;
+	return 0;
+}
+
+static bool
+rt_add(struct rt *nrt, struct rt *ort, bool change)
+{
+	struct dhcpcd_ctx *ctx = nrt->rt_ifp->ctx;
+	bool odeleted, result;
+
+	odeleted = result = false;
 	if (change) {
 		if (if_route(RTM_CHANGE, nrt) != -1) {
 			result = true;
@@ -568,13 +730,24 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 		if (ort != NULL) {
 			if (if_route(RTM_DELETE, ort) == -1 && errno != ESRCH)
 				logerr("if_route (DEL)");
+			else
+				odeleted = true;
 		}
 		result = true;
 		goto out;
 	}
 
 	/* If the kernel claims the route exists we need to rip out the
-	 * old one first. */
+	 * old one first.
+	 * If we don't know about it our view of the kernel is stale,
+	 * unless it's kept out of our view as a routing daemon owns it. */
+	if (errno == EEXIST && ort == NULL) {
+		rt_kroutes_flush(ctx, nrt->rt_dest.sa_family);
+		ort = rt_findkroute(ctx, nrt);
+		if (ort == NULL)
+			rt_setdaemonkroute(ctx, nrt);
+		errno = EEXIST;
+	}
 	if (errno != EEXIST || ort == NULL)
 		goto logerr;
 #endif
@@ -588,7 +761,7 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 		if (if_route(RTM_DELETE, ort) == -1 && errno != ESRCH)
 			logerr("if_route (DEL)");
 		else
-			kroute = false;
+			odeleted = true;
 	}
 #ifdef ROUTE_PER_GATEWAY
 	/* The OS allows many routes to the same dest with different gateways.
@@ -615,10 +788,11 @@ logerr:
 	logerr("if_route (ADD)");
 
 out:
-	if (kroute) {
-		rb_tree_remove_node(kroutes, ort);
-		rt_free(ort);
-	}
+	/* Keep our view of the kernel in step. ort may be part of it. */
+	if (odeleted)
+		rt_delkroute(ctx, ort, false);
+	if (result)
+		rt_setkroute(ctx, nrt);
 	return result;
 }
 
@@ -631,116 +805,489 @@ rt_delete(struct rt *rt)
 	retval = if_route(RTM_DELETE, rt) == -1 ? false : true;
 	if (!retval && errno != ENOENT && errno != ESRCH)
 		logerr(__func__);
+	else
+		rt_delkroute(rt->rt_ifp->ctx, rt, false);
 	return retval;
 }
 
+#ifndef HAVE_IF_ROUTES
+static int
+if_routes(__unused struct dhcpcd_ctx *ctx, struct if_rtreq *reqs,
+    size_t nreqs)
+{
+	size_t i;
+	int failed = 0;
+
+	for (i = 0; i < nreqs; i++) {
+		if (if_route(reqs[i].cmd, reqs[i].rt) == -1) {
+			reqs[i].error = errno;
+			failed++;
+		} else
+			reqs[i].error = 0;
+	}
+	return failed == 0 ? 0 : -1;
+}
+#endif
+
+/*
+ * rt_build queues the routes it adds, changes and deletes so they
+ * reach the kernel in as few messages as possible.
+ * Anything the kernel refuses is tried again with rt_add() which
+ * reports the error and works around it just as it always has.
+ */
+struct rt_op {
+	struct rt *rt;		/* the route we want */
+	struct rt *or;		/* what it replaces in ctx->routes */
+	struct rt ort;		/* what it replaces in the kernel */
+	bool hasort;
+	bool change;
+	bool delort;		/* ort still needs deleting */
+	size_t req;		/* the request which decides it */
+};
+
+struct rt_txn {
+	struct rt_op *ops;
+	size_t nops;
+	struct if_rtreq *reqs;
+	size_t nreqs;
+	size_t ndelort;
+};
+
+static bool
+rt_txn_init(struct rt_txn *txn, struct dhcpcd_ctx *ctx, rb_tree_t *routes)
+{
+	struct rt *rt;
+	size_t n = 0, m = 0;
+
+	RB_TREE_FOREACH(rt, routes)
+		n++;
+	RB_TREE_FOREACH(rt, &ctx->routes)
+		m++;
+	if (n == 0 && m == 0)
+		return false;
+
+	/* Each route is at most one op of up to two requests and can
+	 * leave the route it replaced to delete with those we no longer
+	 * want. */
+	txn->ops = reallocarray(NULL, n == 0 ? 1 : n, sizeof(*txn->ops));
+	txn->reqs = reallocarray(NULL, n * 2 + m, sizeof(*txn->reqs));
+	if (txn->ops == NULL || txn->reqs == NULL) {
+		free(txn->ops);
+		free(txn->reqs);
+		return false;
+	}
+	txn->nops = txn->nreqs = txn->ndelort = 0;
+	return true;
+}
+
+static void
+rt_txn_free(struct rt_txn *txn)
+{
+
+	free(txn->ops);
+	free(txn->reqs);
+}
+
+static void
+rt_txn_req(struct rt_txn *txn, unsigned char cmd, const struct rt *rt)
+{
+	struct if_rtreq *req = &txn->reqs[txn->nreqs++];
+
+	req->cmd = cmd;
+	req->rt = rt;
+	req->error = 0;
+}
+
 static bool
-rt_cmp(const struct rt *r1, const struct rt *r2)
+rt_txn_add(struct rt_txn *txn, struct rt *nrt, struct rt *or,
+    const struct rt *ort, bool change)
 {
+	struct rt_op *op;
 
-	return (r1->rt_ifp == r2->rt_ifp &&
+#ifdef ROUTE_PER_GATEWAY
+	/* rt_add() has to keep deleting ort until there's an error. */
+	if (ort != NULL)
+		return false;
+#endif
+
+	op = &txn->ops[txn->nops++];
+	op->rt = nrt;
+	op->or = or;
+	op->hasort = ort != NULL;
+	if (op->hasort)
+		memcpy(&op->ort, ort, sizeof(op->ort));
+	op->change = change;
+	op->delort = false;
+	return true;
+}
+
+/* Returns true if a route failed, so another may take its place. */
+static bool
+rt_txn_commit(struct dhcpcd_ctx *ctx, struct rt_txn *txn, rb_tree_t *added)
+{
+	struct rt_op *op;
+	size_t i;
+	int err;
+	bool retry = false;
+
+	txn->nreqs = 0;
+	for (i = 0; i < txn->nops; i++) {
+		op = &txn->ops[i];
+		if (op->change)
+			rt_txn_req(txn, RTM_CHANGE, op->rt);
+		else {
+#ifndef HAVE_ROUTE_METRIC
+			/* No route metrics, delete before adding. */
+			if (op->hasort)
+				rt_txn_req(txn, RTM_DELETE, &op->ort);
+#endif
+			rt_txn_req(txn, RTM_ADD, op->rt);
+		}
+		op->req = txn->nreqs - 1;
+	}
+	if (txn->nreqs != 0)
+		if_routes(ctx, txn->reqs, txn->nreqs);
+
+	for (i = 0; i < txn->nops; i++) {
+		op = &txn->ops[i];
+		err = txn->reqs[op->req].error;
+		if (op->change) {
+			if (err != 0 && err != ESRCH) {
+				errno = err;
+				logerr("if_route (CHG)");
+			}
+		}
+#ifndef HAVE_ROUTE_METRIC
+		else {
+			if (op->hasort) {
+				int derr = txn->reqs[op->req - 1].error;
+
+				if (derr != 0 && derr != ESRCH) {
+					errno = derr;
+					logerr("if_route (DEL)");
+				} else
+					rt_delkroute(ctx, &op->ort, false);
+			}
+			/* As rt_add(), our view of subnet routes may lag. */
+			if (err == EEXIST)
+				err = 0;
+		}
+#endif
+
+		if (err == 0) {
+			rt_setkroute(ctx, op->rt);
 #ifdef HAVE_ROUTE_METRIC
-	    r1->rt_metric == r2->rt_metric &&
+			/* The old route goes once the new one is in. */
+			if (!op->change && op->hasort) {
+				op->delort = true;
+				txn->ndelort++;
+			}
 #endif
-	    sa_cmp(&r1->rt_gateway, &r2->rt_gateway) == 0);
+		} else if (!rt_add(op->rt, op->hasort ? &op->ort : NULL, false))
+		{
+			rb_tree_remove_node(added, op->rt);
+			rt_free(op->rt);
+			retry = true;
+			continue;
+		}
+
+		if (op->or != NULL) {
+			rb_tree_remove_node(&ctx->routes, op->or);
+			rt_free(op->or);
+		}
+	}
+
+	txn->nreqs = 0;
+	return retry;
+}
+
+static void
+rt_txn_delete(struct dhcpcd_ctx *ctx, struct rt_txn *txn)
+{
+	struct if_rtreq *req;
+	size_t i;
+
+	if (txn->nreqs == 0)
+		return;
+	if_routes(ctx, txn->reqs, txn->nreqs);
+
+	for (i = 0; i < txn->nreqs; i++) {
+		req = &txn->reqs[i];
+		if (i < txn->ndelort) {
+			/* Only forget ort if it wasn't just replaced. */
+			if (req->error != 0 && req->error != ESRCH) {
+				errno = req->error;
+				logerr("if_route (DEL)");
+			} else
+				rt_delkroute(ctx, req->rt, true);
+		} else {
+			if (req->error != 0 &&
+			    req->error != ENOENT && req->error != ESRCH)
+			{
+				errno = req->error;
+				logerr("rt_delete");
+			} else
+				rt_delkroute(ctx, req->rt, false);
+		}
+	}
+}
+
+/* Returns 1 if rt is in place, 0 if it's queued on txn and -1 if not. */
+static int
+rt_doadd(struct rt_txn *txn, struct rt *nrt, struct rt *or)
+{
+	struct rt *ort = or;
+	bool change;
+
+	switch (rt_addprep(nrt, &ort, &change)) {
+	case -1:
+		return -1;
+	case 1:
+		return 1;
+	}
+	if (txn != NULL && rt_txn_add(txn, nrt, or, ort, change))
+		return 0;
+	return rt_add(nrt, ort, change) ? 1 : -1;
 }
 
+/*
+ * Routes the last run of dhcpcd added are adopted before whatever added
+ * them is running again, so that rt_build() does not remove them first.
+ * They are held until the protocol which added them releases them or
+ * the address they depend on would have expired.
+ */
 static bool
-rt_doroute(rb_tree_t *kroutes, struct rt *rt)
+rt_held(const struct rt *rt, time_t *now)
+{
+	struct timespec ts;
+
+	if (!(rt->rt_dflags & RTDF_ADOPTED))
+		return false;
+	if (rt->rt_hold == 0)
+		return true;
+	if (*now == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		*now = ts.tv_sec;
+	}
+	return rt->rt_hold > *now;
+}
+
+static void
+rt_holdexpire(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct rt *rt;
+
+	ctx->rt_holdnext = 0;
+#ifdef INET
+	rt_build(ctx, AF_INET);
+#endif
+#ifdef INET6
+	rt_build(ctx, AF_INET6);
+#endif
+
+	ctx->rt_adopted = false;
+	RB_TREE_FOREACH(rt, &ctx->routes) {
+		if (!(rt->rt_dflags & RTDF_ADOPTED))
+			continue;
+		ctx->rt_adopted = true;
+		if (rt->rt_hold != 0 &&
+		    (ctx->rt_holdnext == 0 || rt->rt_hold < ctx->rt_holdnext))
+			ctx->rt_holdnext = rt->rt_hold;
+	}
+	if (ctx->rt_holdnext != 0) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		eloop_timeout_add_sec(ctx->eloop,
+		    ctx->rt_holdnext > now.tv_sec ?
+		    (unsigned int)(ctx->rt_holdnext - now.tv_sec) : 0,
+		    rt_holdexpire, ctx);
+	}
+}
+
+/* Adopt rt if the kernel still has it. hold is when to let go of it
+ * in monotonic seconds, 0 for when its protocol releases it. */
+bool
+rt_adopt(struct rt *rt, time_t hold)
+{
+	struct dhcpcd_ctx *ctx = rt->rt_ifp->ctx;
+	struct rt *krt, *art;
+	struct timespec now;
+
+	rt_setkey(rt);
+	if (rb_tree_find_node(&ctx->routes, rt) != NULL)
+		return false;
+	krt = rt_findkroute(ctx, rt);
+	if (krt == NULL || !rt_cmp(rt, krt))
+		return false;
+	if ((art = rt_new0(ctx)) == NULL)
+		return false;
+	memcpy(art, krt, sizeof(*art));
+	art->rt_dflags = rt->rt_dflags | RTDF_ADOPTED;
+	art->rt_hold = hold;
+	rb_tree_insert_node(&ctx->routes, art);
+	ctx->rt_adopted = true;
+
+	if (hold != 0 && (ctx->rt_holdnext == 0 || hold < ctx->rt_holdnext)) {
+		ctx->rt_holdnext = hold;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		eloop_timeout_add_sec(ctx->eloop,
+		    hold > now.tv_sec ? (unsigned int)(hold - now.tv_sec) : 0,
+		    rt_holdexpire, ctx);
+	}
+	return true;
+}
+
+/* The protocol has built its routes again, so any it added last time
+ * that it no longer wants can go. */
+void
+rt_release(struct interface *ifp, int af, unsigned int dflags)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct rt *rt;
+	bool adopted = false;
+
+	if (!ctx->rt_adopted)
+		return;
+	RB_TREE_FOREACH(rt, &ctx->routes) {
+		if (!(rt->rt_dflags & RTDF_ADOPTED))
+			continue;
+		if (rt->rt_ifp == ifp && rt->rt_dest.sa_family == af &&
+		    rt->rt_dflags & dflags)
+			rt->rt_dflags &= (unsigned int)~RTDF_ADOPTED;
+		else
+			adopted = true;
+	}
+	ctx->rt_adopted = adopted;
+}
+
+/* Returns as rt_doadd(). */
+static int
+rt_doroute(struct rt_txn *txn, struct rt *rt)
 {
 	struct dhcpcd_ctx *ctx;
 	struct rt *or;
+	int r;
 
 	ctx = rt->rt_ifp->ctx;
 	/* Do we already manage it? */
 	or = rb_tree_find_node(&ctx->routes, rt);
 	if (or != NULL) {
 		if (rt->rt_dflags & RTDF_FAKE)
-			return true;
+			return 1;
 		if (or->rt_dflags & RTDF_FAKE ||
 		    !rt_cmp(rt, or) ||
 		    (rt->rt_ifa.sa_family != AF_UNSPEC &&
 		    sa_cmp(&or->rt_ifa, &rt->rt_ifa) != 0) ||
 		    or->rt_mtu != rt->rt_mtu)
 		{
-			if (!rt_add(kroutes, rt, or))
-				return false;
+			if ((r = rt_doadd(txn, rt, or)) != 1)
+				return r;
 		}
 		rb_tree_remove_node(&ctx->routes, or);
 		rt_free(or);
 	} else {
 		if (rt->rt_dflags & RTDF_FAKE) {
-			or = rb_tree_find_node(kroutes, rt);
+			or = rt_findkroute(ctx, rt);
 			if (or == NULL)
-				return false;
+				return -1;
 			if (!rt_cmp(rt, or))
-				return false;
-		} else {
-			if (!rt_add(kroutes, rt, NULL))
-				return false;
-		}
+				return -1;
+		} else
+			return rt_doadd(txn, rt, NULL);
 	}
 
-	return true;
+	return 1;
 }
 
 void
 rt_build(struct dhcpcd_ctx *ctx, int af)
 {
-	rb_tree_t routes, added, kroutes;
+	rb_tree_t routes, added, deleted;
 	struct rt *rt, *rtn;
+	struct rt_txn txn, *txnp;
 	unsigned long long o;
+	bool allaf, batch, retry;
+	size_t i;
+	time_t now = 0;
 
+	PROBE1(rt_build_start, af);
 	rb_tree_init(&routes, &rt_compare_proto_ops);
 	rb_tree_init(&added, &rt_compare_os_ops);
-	rb_tree_init(&kroutes, &rt_compare_os_ops);
-	if_initrt(ctx, &kroutes, af);
 	ctx->rt_order = 0;
 	ctx->options |= DHCPCD_RTBUILD;
 
+	/* Only routes for af are applied below, but BSD needs the
+	 * default routes from both families for the miss filter. */
+#ifdef BSD
+	allaf = true;
+#else
+	allaf = false;
+#endif
 #ifdef INET
-	if (!inet_getroutes(ctx, &routes))
+	if ((allaf || af == AF_INET) && !inet_getroutes(ctx, &routes))
 		goto getfail;
 #endif
 #ifdef INET6
-	if (!inet6_getroutes(ctx, &routes))
+	if ((allaf || af == AF_INET6) && !inet6_getroutes(ctx, &routes))
 		goto getfail;
 #endif
 
 #ifdef BSD
 	/* Rewind the miss filter */
 	ctx->rt_missfilterlen = 0;
-#endif
-
-	RB_TREE_FOREACH_SAFE(rt, &routes, rtn) {
-#ifdef BSD
+	RB_TREE_FOREACH(rt, &routes) {
 		if (rt_is_default(rt) &&
 		    if_missfilter(rt->rt_ifp, &rt->rt_gateway) == -1)
 			logerr("if_missfilter");
+	}
 #endif
-		if ((rt->rt_dest.sa_family != af &&
-		    rt->rt_dest.sa_family != AF_UNSPEC) ||
-		    (rt->rt_gateway.sa_family != af &&
-		    rt->rt_gateway.sa_family != AF_UNSPEC))
-			continue;
-		/* Is this route already in our table? */
-		if (rb_tree_find_node(&added, rt) != NULL)
-			continue;
-		if (rt_doroute(&kroutes, rt)) {
+
+	/* If we can't queue, everything is done one route at a time. */
+	batch = rt_txn_init(&txn, ctx, &routes);
+	txnp = batch ? &txn : NULL;
+	do {
+		RB_TREE_FOREACH_SAFE(rt, &routes, rtn) {
+			if ((rt->rt_dest.sa_family != af &&
+			    rt->rt_dest.sa_family != AF_UNSPEC) ||
+			    (rt->rt_gateway.sa_family != af &&
+			    rt->rt_gateway.sa_family != AF_UNSPEC))
+				continue;
+			rt_setkey(rt);
+			/* Is this route already in our table? */
+			if (rb_tree_find_node(&added, rt) != NULL)
+				continue;
 			rb_tree_remove_node(&routes, rt);
+			if (rt_doroute(txnp, rt) == -1) {
+				rt_free(rt);
+				continue;
+			}
 			if (rb_tree_insert_node(&added, rt) != rt) {
 				errno = EEXIST;
 				logerr(__func__);
 				rt_free(rt);
 			}
 		}
-	}
+		/* Routes the kernel refused make way for the next best. */
+		retry = txnp != NULL && rt_txn_commit(ctx, txnp, &added);
+		txnp = NULL;
+	} while (retry);
 
 #ifdef BSD
 	if (if_missfilter_apply(ctx) == -1 && errno != ENOTSUP)
 		logerr("if_missfilter_apply");
 #endif
 
+	/* Routes we replaced go first. */
+	rb_tree_init(&deleted, &rt_compare_os_ops);
+	if (batch) {
+		for (i = 0; i < txn.nops; i++) {
+			if (txn.ops[i].delort)
+				rt_txn_req(&txn, RTM_DELETE, &txn.ops[i].ort);
+		}
+	}
+
 	/* Remove old routes we used to manage. */
 	RB_TREE_FOREACH_REVERSE_SAFE(rt, &ctx->routes, rtn) {
 		if ((rt->rt_dest.sa_family != af &&
@@ -750,17 +1297,35 @@ rt_build(struct dhcpcd_ctx *ctx, int af)
 			continue;
 		rb_tree_remove_node(&ctx->routes, rt);
 		if (rb_tree_find_node(&added, rt) == NULL) {
+			if (ctx->rt_adopted && rt_held(rt, &now)) {
+				rb_tree_insert_node(&added, rt);
+				continue;
+			}
 			o = rt->rt_ifp->options ?
 			    rt->rt_ifp->options->options :
 			    ctx->options;
 			if ((o &
 				(DHCPCD_EXITING | DHCPCD_PERSISTENT)) !=
 				(DHCPCD_EXITING | DHCPCD_PERSISTENT))
+			{
+				if (batch) {
+					rt_desc("deleting", rt);
+					rt_txn_req(&txn, RTM_DELETE, rt);
+					rb_tree_insert_node(&deleted, rt);
+					continue;
+				}
 				rt_delete(rt);
+			}
 		}
 		rt_free(rt);
 	}
 
+	if (batch) {
+		rt_txn_delete(ctx, &txn);
+		rt_headclear0(ctx, &deleted, AF_UNSPEC);
+		rt_txn_free(&txn);
+	}
+
 	/* XXX This needs to be optimised. */
 	while ((rt = RB_TREE_MIN(&added)) != NULL) {
 		rb_tree_remove_node(&added, rt);
@@ -770,9 +1335,9 @@ rt_build(struct dhcpcd_ctx *ctx, int af)
 			rt_free(rt);
 		}
 	}
-
+	snapshot_queue(ctx);
 
 getfail:
 	rt_headclear(&routes, AF_UNSPEC);
-	rt_headclear(&kroutes, AF_UNSPEC);
+	PROBE1(rt_build_done, af);
 }
@@ -37,21 +37,11 @@
 #include <net/route.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "dhcpcd.h"
 #include "sa.h"
 
-/*
- * Enable the route free list by default as
- * memory usage is still reported as low/unchanged even
- * when dealing with millions of routes.
- */
-#if !defined(RT_FREE_ROUTE_TABLE)
-#define	RT_FREE_ROUTE_TABLE 1
-#elif RT_FREE_ROUTE_TABLE == 0
-#undef	RT_FREE_ROUTE_TABLE
-#endif
-
 /* Some systems have route metrics.
  * OpenBSD route priority is not this. */
 #ifndef HAVE_ROUTE_METRIC
@@ -78,6 +68,14 @@
 #undef rt_mtu
 #endif
 
+/* What rt_compare_os() sorts on, packed by rt_setkey() so comparing
+ * routes is a few integer compares. */
+struct rt_key {
+	uint64_t		rk_dest[2];	/* masked destination */
+	uint32_t		rk_family;
+	uint32_t		rk_metric;	/* interface metric */
+};
+
 struct rt {
 	union sa_ss		rt_ss_dest;
 #define rt_dest			rt_ss_dest.sa
@@ -109,7 +107,11 @@ struct rt {
 #define	RTDF_DHCP		0x10		/* DHCP route */
 #define	RTDF_STATIC		0x20		/* Configured in dhcpcd */
 #define	RTDF_GATELINK		0x40		/* Gateway is on link */
+#define	RTDF_DAEMON		0x80		/* Routing daemon route */
+#define	RTDF_ADOPTED		0x100		/* Left by the last run */
+	time_t			rt_hold;	/* adopted until, 0 forever */
 	size_t			rt_order;
+	struct rt_key		rt_key;
 	rb_node_t		rt_tree;
 };
 
@@ -130,7 +132,12 @@ struct rt * rt_new(struct interface *);
 struct rt * rt_proto_add_ctx(rb_tree_t *, struct rt *, struct dhcpcd_ctx *);
 struct rt * rt_proto_add(rb_tree_t *, struct rt *);
 int rt_cmp_dest(const struct rt *, const struct rt *);
+void rt_setkey(struct rt *);
 void rt_recvrt(int, const struct rt *, pid_t);
+void rt_kroutes_flush(struct dhcpcd_ctx *, int);
+void rt_resync(struct dhcpcd_ctx *);
 void rt_build(struct dhcpcd_ctx *, int);
+bool rt_adopt(struct rt *, time_t);
+void rt_release(struct interface *, int, unsigned int);
 
 #endif
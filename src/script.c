@@ -36,6 +36,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <pwd.h>
 #include <signal.h>
 #include <spawn.h>
@@ -54,7 +55,9 @@
 #include "ipv4ll.h"
 #include "ipv6nd.h"
 #include "logerr.h"
+#include "netconf.h"
 #include "privsep.h"
+#include "probe.h"
 #include "script.h"
 
 #define DEFAULT_PATH	"/usr/bin:/usr/sbin:/bin:/sbin"
@@ -83,8 +86,9 @@ if_printoptions(void)
 		printf(" -  %s\n", *p);
 }
 
-pid_t
-script_exec(char *const *argv, char *const *env)
+static pid_t
+script_spawn(char *const *argv, char *const *env,
+    const posix_spawn_file_actions_t *actions)
 {
 	pid_t pid = 0;
 	posix_spawnattr_t attr;
@@ -113,7 +117,7 @@ script_exec(char *const *argv, char *const *env)
 	posix_spawnattr_setsigdefault(&attr, &defsigs);
 #endif
 	errno = 0;
-	r = posix_spawn(&pid, argv[0], NULL, &attr, argv, env);
+	r = posix_spawn(&pid, argv[0], actions, &attr, argv, env);
 	posix_spawnattr_destroy(&attr);
 	if (r) {
 		errno = r;
@@ -122,6 +126,13 @@ script_exec(char *const *argv, char *const *env)
 	return pid;
 }
 
+pid_t
+script_exec(char *const *argv, char *const *env)
+{
+
+	return script_spawn(argv, env, NULL);
+}
+
 #ifdef INET
 static int
 append_config(FILE *fp, const char *prefix, const char *const *config)
@@ -155,6 +166,15 @@ static const char *protocols[] = {
 	"dhcp6",
 	"static6"
 };
+/* The --stats counters row the script runs of each are counted in. */
+static const enum dhcpcd_proto script_counted[] = {
+	CNTP_LINK,
+	CNTP_DHCP,
+	CNTP_ARP,
+	CNTP_ND,
+	CNTP_DHCP6,
+	CNTP_LINK,
+};
 
 int
 efprintf(FILE *fp, const char *fmt, ...)
@@ -173,8 +193,180 @@ efprintf(FILE *fp, const char *fmt, ...)
 	return r;
 }
 
-char **
-script_buftoenv(struct dhcpcd_ctx *ctx, char *buf, size_t len)
+/*
+ * Rendering the options of a lease is most of the work of make_env(),
+ * yet the same lease is rendered time and again: as new_ for each of
+ * its events, as old_ once it's replaced and for every listener that
+ * asks for it.
+ * So the last leases rendered for each protocol are kept until the
+ * interface options change.
+ * Every string starts with the prefix, so they are kept without it
+ * and one rendering serves both new_ and old_.
+ */
+#define	SENV_DHCP	0
+#define	SENV_DHCP6	1
+#define	SENV_PROTOS	2
+#define	SENV_LEASES	2	/* the new lease and the old */
+
+struct script_envcache {
+	void *sec_lease;	/* the lease rendered */
+	size_t sec_leaselen;
+	char *sec_env;		/* its env strings less the prefix */
+	size_t sec_envlen;
+	unsigned long long sec_used;
+};
+
+struct script_ifenv {
+	struct script_envcache sie_cache[SENV_PROTOS][SENV_LEASES];
+	unsigned long long sie_used;
+};
+
+typedef ssize_t script_renderfn(FILE *, const char *,
+    const struct interface *, const void *, size_t);
+
+#ifdef HAVE_OPEN_MEMSTREAM
+static void
+script_envstore(struct script_envcache *sec, const char *prefix,
+    const void *lease, size_t len, const char *env, size_t envlen)
+{
+	const char *ep = env + envlen, *p;
+	size_t plen = strlen(prefix), nenv = 0, slen;
+	char *buf, *bp;
+	void *l;
+
+	if (envlen != 0 && env[envlen - 1] != '\0')
+		return;
+	for (p = env; p < ep; p += strlen(p) + 1) {
+		if (strncmp(p, prefix, plen) != 0)
+			return;
+		nenv++;
+	}
+
+	if ((buf = malloc(envlen - (nenv * plen) + 1)) == NULL)
+		return;
+	if ((l = malloc(len)) == NULL) {
+		free(buf);
+		return;
+	}
+	memcpy(l, lease, len);
+	for (p = env, bp = buf; p < ep; p += slen + 1) {
+		slen = strlen(p);
+		memcpy(bp, p + plen, slen - plen + 1);
+		bp += slen - plen + 1;
+	}
+
+	free(sec->sec_lease);
+	free(sec->sec_env);
+	sec->sec_lease = l;
+	sec->sec_leaselen = len;
+	sec->sec_env = buf;
+	sec->sec_envlen = (size_t)(bp - buf);
+}
+#endif
+
+static int
+script_leaseenv(FILE *fp, int proto, const char *prefix,
+    const struct interface *ifp, const void *lease, size_t len,
+    script_renderfn *render)
+{
+#ifdef HAVE_OPEN_MEMSTREAM
+	/* The cache is not part of the state of the interface. */
+	struct interface *ifw = UNCONST(ifp);
+	struct script_ifenv *sie = ifw->if_data[IF_DATA_SCRIPT];
+	struct script_envcache *sec, *seco = NULL;
+	const char *env, *ep;
+	long start, end;
+	size_t i;
+
+	if (sie == NULL) {
+		sie = ifw->if_data[IF_DATA_SCRIPT] =
+		    arena_get(&ifw->arena, sizeof(*sie));
+		if (sie == NULL)
+			return (int)render(fp, prefix, ifp, lease, len);
+	}
+
+	for (i = 0; i < SENV_LEASES; i++) {
+		sec = &sie->sie_cache[proto][i];
+		if (sec->sec_env != NULL && sec->sec_leaselen == len &&
+		    memcmp(sec->sec_lease, lease, len) == 0)
+			goto cached;
+		if (seco == NULL || sec->sec_used < seco->sec_used)
+			seco = sec;
+	}
+
+	if ((start = ftell(fp)) == -1)
+		return (int)render(fp, prefix, ifp, lease, len);
+	if (render(fp, prefix, ifp, lease, len) == -1)
+		return -1;
+	/* Once flushed, the memstream buffer holds all that's written. */
+	if (fflush(fp) == EOF || (end = ftell(fp)) == -1)
+		return 1;
+	script_envstore(seco, prefix, lease, len,
+	    ifp->ctx->script_buf + start, (size_t)(end - start));
+	seco->sec_used = ++sie->sie_used;
+	return 1;
+
+cached:
+	sec->sec_used = ++sie->sie_used;
+	ep = sec->sec_env + sec->sec_envlen;
+	for (env = sec->sec_env; env < ep; env += strlen(env) + 1) {
+		if (efprintf(fp, "%s%s", prefix, env) == -1)
+			return -1;
+	}
+	return 1;
+#else
+	UNUSED(proto);
+	return (int)render(fp, prefix, ifp, lease, len);
+#endif
+}
+
+void
+script_freeenv(struct interface *ifp)
+{
+	struct script_ifenv *sie = ifp->if_data[IF_DATA_SCRIPT];
+	struct script_envcache *sec;
+	size_t i, j;
+
+	if (sie == NULL)
+		return;
+	for (i = 0; i < SENV_PROTOS; i++) {
+		for (j = 0; j < SENV_LEASES; j++) {
+			sec = &sie->sie_cache[i][j];
+			free(sec->sec_lease);
+			free(sec->sec_env);
+		}
+	}
+	arena_put(&ifp->arena, sie);
+	ifp->if_data[IF_DATA_SCRIPT] = NULL;
+}
+
+#ifdef INET
+static ssize_t
+script_dhcpenv(FILE *fp, const char *prefix, const struct interface *ifp,
+    const void *lease, size_t len)
+{
+
+	if (dhcp_env(fp, prefix, ifp, lease, len) == -1)
+		return -1;
+	if (append_config(fp, prefix,
+	    (const char *const *)ifp->options->config) == -1)
+		return -1;
+	return 1;
+}
+#endif
+
+#ifdef DHCP6
+static ssize_t
+script_dhcp6env(FILE *fp, const char *prefix, const struct interface *ifp,
+    const void *lease, size_t len)
+{
+
+	return dhcp6_optenv(fp, prefix, ifp, lease, len);
+}
+#endif
+
+static char **
+script_buftoenvp(char ***envv, size_t *envlen, char *buf, size_t len)
 {
 	char **env, **envp, *bufp, *endp;
 	size_t nenv;
@@ -196,16 +388,16 @@ script_buftoenv(struct dhcpcd_ctx *ctx, char *buf, size_t len)
 	if (nenv == 0)
 		return NULL;
 
-	if (ctx->script_envlen < nenv) {
-		env = reallocarray(ctx->script_env, nenv + 1, sizeof(*env));
+	if (*envlen < nenv) {
+		env = reallocarray(*envv, nenv + 1, sizeof(*env));
 		if (env == NULL)
 			return NULL;
-		ctx->script_env = env;
-		ctx->script_envlen = nenv;
+		*envv = env;
+		*envlen = nenv;
 	}
 
 	bufp = buf;
-	envp = ctx->script_env;
+	envp = *envv;
 	*envp++ = bufp++;
 	endp--; /* Avoid setting the last \0 to an invalid pointer */
 	for (; bufp < endp; bufp++) {
@@ -214,12 +406,20 @@ script_buftoenv(struct dhcpcd_ctx *ctx, char *buf, size_t len)
 	}
 	*envp = NULL;
 
-	return ctx->script_env;
+	return *envv;
+}
+
+char **
+script_buftoenv(struct dhcpcd_ctx *ctx, char *buf, size_t len)
+{
+
+	return script_buftoenvp(&ctx->script_env, &ctx->script_envlen,
+	    buf, len);
 }
 
 static long
 make_env(struct dhcpcd_ctx *ctx, const struct interface *ifp,
-    const char *reason)
+    const char *reason, int *protocolp)
 {
 	FILE *fp;
 	long buf_pos, i;
@@ -275,6 +475,14 @@ make_env(struct dhcpcd_ctx *ctx, const struct interface *ifp,
 			goto eexit;
 		if (efprintf(fp, "pid=%d", getpid()) == -1)
 			goto eexit;
+		if ((ifp->ctx->resolv_conf != NULL ||
+		    ifp->ctx->ntp_conf != NULL) &&
+		    efprintf(fp, "builtin_hooks=%s%s%s",
+		    ifp->ctx->resolv_conf != NULL ? "resolv.conf" : "",
+		    ifp->ctx->resolv_conf != NULL &&
+		    ifp->ctx->ntp_conf != NULL ? " " : "",
+		    ifp->ctx->ntp_conf != NULL ? "ntp.conf" : "") == -1)
+			goto eexit;
 	}
 	if (!is_stdin) {
 		if (efprintf(fp, "reason=%s", reason) == -1)
@@ -338,6 +546,8 @@ make_env(struct dhcpcd_ctx *ctx, const struct interface *ifp,
 	else
 		protocol = PROTO_DHCP;
 #endif
+	if (protocolp != NULL)
+		*protocolp = protocol;
 
 	if (!is_stdin) {
 		if (efprintf(fp, "interface=%s", ifp->name) == -1)
@@ -453,18 +663,17 @@ make_env(struct dhcpcd_ctx *ctx, const struct interface *ifp,
 	}
 #ifdef INET
 	if (protocol == PROTO_DHCP && state && state->old) {
-		if (dhcp_env(fp, "old", ifp,
-		    state->old, state->old_len) == -1)
-			goto eexit;
-		if (append_config(fp, "old",
-		    (const char *const *)ifo->config) == -1)
+		if (script_leaseenv(fp, SENV_DHCP, "old", ifp,
+		    state->old, state->old_len, script_dhcpenv) == -1)
 			goto eexit;
 	}
 #endif
 #ifdef DHCP6
 	if (protocol == PROTO_DHCP6 && d6_state && d6_state->old) {
-		if (dhcp6_env(fp, "old", ifp,
-		    d6_state->old, d6_state->old_len) == -1)
+		if (script_leaseenv(fp, SENV_DHCP6, "old", ifp,
+		    d6_state->old, d6_state->old_len, script_dhcp6env) == -1)
+			goto eexit;
+		if (dhcp6_env(fp, "old", ifp, NULL, 0) == -1)
 			goto eexit;
 	}
 #endif
@@ -478,11 +687,8 @@ dumplease:
 	}
 #endif
 	if (protocol == PROTO_DHCP && state && state->new) {
-		if (dhcp_env(fp, "new", ifp,
-		    state->new, state->new_len) == -1)
-			goto eexit;
-		if (append_config(fp, "new",
-		    (const char *const *)ifo->config) == -1)
+		if (script_leaseenv(fp, SENV_DHCP, "new", ifp,
+		    state->new, state->new_len, script_dhcpenv) == -1)
 			goto eexit;
 	}
 #endif
@@ -493,8 +699,11 @@ dumplease:
 	}
 #ifdef DHCP6
 	if (protocol == PROTO_DHCP6 && D6_STATE_RUNNING(ifp)) {
-		if (dhcp6_env(fp, "new", ifp,
-		    d6_state->new, d6_state->new_len) == -1)
+		if (d6_state->new != NULL &&
+		    script_leaseenv(fp, SENV_DHCP6, "new", ifp,
+		    d6_state->new, d6_state->new_len, script_dhcp6env) == -1)
+			goto eexit;
+		if (dhcp6_env(fp, "new", ifp, NULL, 0) == -1)
 			goto eexit;
 	}
 #endif
@@ -560,7 +769,7 @@ send_interface1(struct fd_list *fd, const struct interface *ifp,
 	struct dhcpcd_ctx *ctx = ifp->ctx;
 	long len;
 
-	len = make_env(ifp->ctx, ifp, reason);
+	len = make_env(ifp->ctx, ifp, reason, NULL);
 	if (len == -1)
 		return -1;
 	return control_queue(fd, ctx->script_buf, (size_t)len);
@@ -657,34 +866,426 @@ send_interface(struct fd_list *fd, const struct interface *ifp, int af)
 	return retval;
 }
 
-static int
-script_run(struct dhcpcd_ctx *ctx, char **argv)
+/*
+ * Scripts run in the background so a slow hook cannot stall us.
+ * Each interface has its scripts run one at a time in the order they
+ * were queued, but scripts for different interfaces can run together,
+ * up to script_jobs of them.
+ */
+struct script_job {
+	TAILQ_ENTRY(script_job) next;
+	char sj_ifname[IF_NAMESIZE];
+	pid_t sj_pid;		/* 0 until started */
+	char **sj_env;
+	size_t sj_envlen;
+	size_t sj_buflen;
+	char sj_buf[];		/* the env strings sj_env points into */
+};
+
+static void script_startjobs(struct dhcpcd_ctx *);
+
+static void
+script_freejob(struct dhcpcd_ctx *ctx, struct script_job *job)
 {
-	pid_t pid;
-	int status = 0;
 
-	pid = script_exec(argv, ctx->script_env);
-	if (pid == -1)
-		logerr("%s: %s", __func__, argv[0]);
-	else if (pid != 0) {
-		/* Wait for the script to finish */
+	TAILQ_REMOVE(&ctx->script_jobs, job, next);
+	free(job->sj_env);
+	free(job);
+}
+
+static void
+script_jobdone(struct dhcpcd_ctx *ctx, struct script_job *job)
+{
+
+	ctx->script_running--;
+	script_freejob(ctx, job);
+	script_startjobs(ctx);
+}
+
+/* A script waits for any queued before it for the same interface. */
+static bool
+script_jobready(const struct dhcpcd_ctx *ctx, const struct script_job *job)
+{
+	const struct script_job *j;
+
+	TAILQ_FOREACH(j, &ctx->script_jobs, next) {
+		if (j == job)
+			return true;
+		if (strcmp(j->sj_ifname, job->sj_ifname) == 0)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * With script_worker, one long-lived worker runs the hooks
+ * so they are not loaded again by a fresh shell for every event.
+ * It reads each event as one env string a line ended by a blank line,
+ * runs the hooks for it and writes back their exit status as a line.
+ * It runs one event at a time.
+ */
+static struct script_job *
+script_workerjob(const struct dhcpcd_ctx *ctx)
+{
+	struct script_job *job;
+
+	if (ctx->script_wpid == 0)
+		return NULL;
+	TAILQ_FOREACH(job, &ctx->script_jobs, next) {
+		if (job->sj_pid == ctx->script_wpid)
+			return job;
+	}
+	return NULL;
+}
+
+/* The shell can only export valid names, one env string a line. */
+static bool
+script_canwork(const struct script_job *job)
+{
+	const char *env, *ep = job->sj_buf + job->sj_buflen, *p;
+
+	for (env = job->sj_buf; env < ep; env += strlen(env) + 1) {
+		if (!isalpha((unsigned char)*env) && *env != '_')
+			return false;
+		for (p = env + 1; *p != '='; p++) {
+			if (*p == '\0' ||
+			    (!isalnum((unsigned char)*p) && *p != '_'))
+				return false;
+		}
+		if (strchr(p, '\n') != NULL)
+			return false;
+	}
+	return true;
+}
+
+static void
+script_workerclose(struct dhcpcd_ctx *ctx)
+{
+
+	eloop_event_delete(ctx->eloop, ctx->script_wfd);
+	close(ctx->script_wfd);
+	ctx->script_wfd = -1;
+	ctx->script_wpid = 0;
+}
+
+static void
+script_workerread(struct dhcpcd_ctx *ctx, bool wait)
+{
+	struct script_job *job;
+	char buf[16];
+	ssize_t len;
+	pid_t pid;
+	int status, e;
+
+	len = read(ctx->script_wfd, buf, sizeof(buf) - 1);
+	if (len == -1 && errno == EINTR)
+		return;
+	if (len <= 0) {
+		/* The worker has gone, so reap it with its event. */
+		if (len == -1)
+			logerr("%s: read", __func__);
+		pid = ctx->script_wpid;
+		script_workerclose(ctx);
+		if (!wait)
+			return; /* SIGCHLD will */
 		while (waitpid(pid, &status, 0) == -1) {
 			if (errno != EINTR) {
 				logerr("%s: waitpid", __func__);
-				status = 0;
-				break;
+				return;
 			}
 		}
-		if (WIFEXITED(status)) {
-			if (WEXITSTATUS(status))
-				logerrx("%s: %s: WEXITSTATUS %d",
-				    __func__, argv[0], WEXITSTATUS(status));
-		} else if (WIFSIGNALED(status))
-			logerrx("%s: %s: %s",
-			    __func__, argv[0], strsignal(WTERMSIG(status)));
+		script_reap(ctx, pid, status);
+		return;
 	}
 
-	return WEXITSTATUS(status);
+	if ((job = script_workerjob(ctx)) == NULL)
+		return;
+	buf[len] = '\0';
+	status = (int)strtoi(buf, NULL, 10, 0, 255, &e);
+	if (e != 0 && e != ENOTSUP)
+		status = 255;
+	if (status != 0)
+		logerrx("%s: %s: WEXITSTATUS %d",
+		    job->sj_ifname, ctx->script, status);
+	script_jobdone(ctx, job);
+}
+
+static void
+script_workercb(void *arg)
+{
+
+	script_workerread(arg, false);
+}
+
+static int
+script_startworker(struct dhcpcd_ctx *ctx)
+{
+	char *argv[] = { ctx->script, UNCONST("--worker"), NULL };
+	char *env[] = { NULL, NULL }, *path;
+	posix_spawn_file_actions_t actions;
+	int fd[2], r;
+	pid_t pid;
+
+	/* Events carry their own environment, so the worker has none
+	 * that one event could leave for the next. */
+	path = getenv("PATH");
+	if (asprintf(&env[0], "PATH=%s",
+	    path == NULL ? DEFAULT_PATH : path) == -1)
+		return -1;
+
+	if (xsocketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fd) == -1) {
+		free(env[0]);
+		return -1;
+	}
+
+	/* Events are read from stdin and the statuses written to fd 3. */
+	if ((r = posix_spawn_file_actions_init(&actions)) != 0) {
+		errno = r;
+		pid = -1;
+		goto out;
+	}
+	posix_spawn_file_actions_adddup2(&actions, fd[1], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, fd[1], 3);
+	pid = script_spawn(argv, env, &actions);
+	posix_spawn_file_actions_destroy(&actions);
+
+out:
+	free(env[0]);
+	close(fd[1]);
+	if (pid == -1) {
+		close(fd[0]);
+		return -1;
+	}
+	ctx->script_wpid = pid;
+	ctx->script_wfd = fd[0];
+	if (eloop_event_add(ctx->eloop, ctx->script_wfd,
+	    script_workercb, ctx) == -1)
+		logerr("%s: eloop_event_add", __func__);
+	return 0;
+}
+
+static int
+script_workersend(struct dhcpcd_ctx *ctx, struct script_job *job)
+{
+	char *p, *ep = job->sj_buf + job->sj_buflen;
+	size_t len;
+	ssize_t n;
+
+	if (ctx->script_wpid == 0 && script_startworker(ctx) == -1) {
+		logerr("%s: %s", __func__, ctx->script);
+		return -1;
+	}
+
+	for (p = job->sj_buf; p < ep; p++) {
+		if (*p == '\0')
+			*p = '\n';
+	}
+	*p = '\n';
+
+	p = job->sj_buf;
+	len = job->sj_buflen + 1;
+	while (len != 0) {
+		n = write(ctx->script_wfd, p, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			logerr(__func__);
+			/* Without the rest of the event it will exit. */
+			script_workerclose(ctx);
+			/* Restore the env strings to exec instead. */
+			for (p = job->sj_buf; p < ep; p++) {
+				if (*p == '\n')
+					*p = '\0';
+			}
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+
+	job->sj_pid = ctx->script_wpid;
+	return 0;
+}
+
+static void
+script_startjobs(struct dhcpcd_ctx *ctx)
+{
+	struct script_job *job, *jobn;
+	char *argv[] = { ctx->script, NULL };
+
+	TAILQ_FOREACH_SAFE(job, &ctx->script_jobs, next, jobn) {
+		if (ctx->script_running >= ctx->script_max)
+			break;
+		if (job->sj_pid != 0 || !script_jobready(ctx, job))
+			continue;
+
+		if (ctx->script_worker && script_canwork(job)) {
+			if (script_workerjob(ctx) != NULL)
+				continue;
+			if (script_workersend(ctx, job) == 0) {
+				ctx->script_running++;
+				continue;
+			}
+		}
+
+		job->sj_pid = script_exec(argv, job->sj_env);
+		if (job->sj_pid == -1) {
+			logerr("%s: %s", __func__, argv[0]);
+			script_freejob(ctx, job);
+			continue;
+		}
+		ctx->script_running++;
+	}
+}
+
+/* Find the interface the script is for so it can be ordered. */
+static void
+script_jobname(struct script_job *job)
+{
+	const char *env = job->sj_buf, *ep = env + job->sj_buflen;
+
+	for (; env < ep; env += strlen(env) + 1) {
+		if (strncmp(env, "interface=", 10) == 0) {
+			strlcpy(job->sj_ifname, env + 10,
+			    sizeof(job->sj_ifname));
+			return;
+		}
+	}
+	*job->sj_ifname = '\0';
+}
+
+/* Run every queued script to completion. */
+static void
+script_wait(struct dhcpcd_ctx *ctx)
+{
+	struct script_job *job;
+	pid_t pid;
+	int status;
+
+	while ((job = TAILQ_FIRST(&ctx->script_jobs)) != NULL) {
+		/* The oldest script is always the first to be started. */
+		if (job->sj_pid == 0) {
+			script_startjobs(ctx);
+			continue;
+		}
+		if (script_workerjob(ctx) != NULL) {
+			script_workerread(ctx, true);
+			continue;
+		}
+		/* Scripts for other interfaces can finish first. */
+		if ((pid = waitpid(-1, &status, 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+			logerr("%s: waitpid", __func__);
+			script_freejobs(ctx);
+			break;
+		}
+		script_reap(ctx, pid, status);
+	}
+}
+
+int
+script_queue(struct dhcpcd_ctx *ctx, const char *env, size_t len)
+{
+	struct script_job *job;
+
+	if (len == 0)
+		return 0;
+	if (env[len - 1] != '\0') {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* One more byte for the worker to end the event with. */
+	job = malloc(sizeof(*job) + len + 1);
+	if (job == NULL)
+		return -1;
+	memcpy(job->sj_buf, env, len);
+	job->sj_buflen = len;
+	job->sj_pid = 0;
+	job->sj_env = NULL;
+	job->sj_envlen = 0;
+	if (script_buftoenvp(&job->sj_env, &job->sj_envlen,
+	    job->sj_buf, len) == NULL)
+	{
+		free(job->sj_env);
+		free(job);
+		return -1;
+	}
+	script_jobname(job);
+
+	TAILQ_INSERT_TAIL(&ctx->script_jobs, job, next);
+	script_startjobs(ctx);
+#ifndef USE_SIGNALS
+	/* Without SIGCHLD we cannot tell when a script has finished. */
+	script_wait(ctx);
+#endif
+	return 0;
+}
+
+int
+script_reap(struct dhcpcd_ctx *ctx, pid_t pid, int status)
+{
+	struct script_job *job;
+
+	if (pid == ctx->script_wpid)
+		script_workerclose(ctx);
+
+	TAILQ_FOREACH(job, &ctx->script_jobs, next) {
+		if (job->sj_pid == pid)
+			break;
+	}
+	if (job == NULL)
+		return 0;
+
+	if (WIFEXITED(status)) {
+		if (WEXITSTATUS(status))
+			logerrx("%s: %s: WEXITSTATUS %d",
+			    job->sj_ifname, ctx->script, WEXITSTATUS(status));
+	} else if (WIFSIGNALED(status))
+		logerrx("%s: %s: %s",
+		    job->sj_ifname, ctx->script, strsignal(WTERMSIG(status)));
+
+	script_jobdone(ctx, job);
+	return 1;
+}
+
+/* We are about to exit, so run every queued script to completion. */
+void
+script_drain(struct dhcpcd_ctx *ctx)
+{
+	pid_t pid;
+	int status;
+
+	script_wait(ctx);
+
+	/* The worker exits once it reads the end of the events. */
+	if ((pid = ctx->script_wpid) == 0)
+		return;
+	script_workerclose(ctx);
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			logerr("%s: waitpid", __func__);
+			break;
+		}
+	}
+}
+
+/* Scripts our parent is running are not ours to wait for. */
+void
+script_freejobs(struct dhcpcd_ctx *ctx)
+{
+	struct script_job *job;
+
+	while ((job = TAILQ_FIRST(&ctx->script_jobs)) != NULL)
+		script_freejob(ctx, job);
+	ctx->script_running = 0;
+	/* Nor is its worker, which must not see our events. */
+	if (ctx->script_wpid != 0) {
+		close(ctx->script_wfd);
+		ctx->script_wfd = -1;
+		ctx->script_wpid = 0;
+	}
 }
 
 int
@@ -712,17 +1313,16 @@ int
 script_runreason(const struct interface *ifp, const char *reason)
 {
 	struct dhcpcd_ctx *ctx = ifp->ctx;
-	char *argv[2];
-	int status = 0;
-	struct fd_list *fd;
+	int status, protocol;
 	long buflen;
 
 	if (ctx->script == NULL &&
+	    ctx->resolv_conf == NULL && ctx->ntp_conf == NULL &&
 	    TAILQ_FIRST(&ifp->ctx->control_fds) == NULL)
 		return 0;
 
 	/* Make our env */
-	if ((buflen = make_env(ifp->ctx, ifp, reason)) == -1) {
+	if ((buflen = make_env(ifp->ctx, ifp, reason, &protocol)) == -1) {
 		logerr(__func__);
 		return -1;
 	}
@@ -730,12 +1330,17 @@ script_runreason(const struct interface *ifp, const char *reason)
 	if (strncmp(reason, "DUMP", 4) == 0)
 		return script_dump(ctx->script_buf, (size_t)buflen);
 
+	/* A worker's manager writes them from the events we send it. */
+	if (ctx->shard == 0)
+		netconf_event(ctx, ctx->script_buf, ctx->script_buflen);
+
 	if (ctx->script == NULL)
 		goto send_listeners;
 
-	argv[0] = ctx->script;
-	argv[1] = NULL;
-	logdebugx("%s: executing: %s %s", ifp->name, argv[0], reason);
+	logdebugx("%s: executing: %s %s", ifp->name, ctx->script, reason);
+	PROBE2(script_run, (const char *)ifp->name, reason);
+	STATS_COUNT((struct interface *)UNCONST(ifp),
+	    script_counted[protocol], CNT_SCRIPT);
 
 #ifdef PRIVSEP
 	if (ctx->options & DHCPCD_PRIVSEP) {
@@ -746,19 +1351,15 @@ script_runreason(const struct interface *ifp, const char *reason)
 	}
 #endif
 
-	script_run(ctx, argv);
+	if (script_queue(ctx, ctx->script_buf, ctx->script_buflen) == -1)
+		logerr("%s: script_queue", __func__);
 
 send_listeners:
 	/* Send to our listeners */
-	status = 0;
-	TAILQ_FOREACH(fd, &ctx->control_fds, next) {
-		if (!(fd->flags & FD_LISTEN))
-			continue;
-		if (control_queue(fd, ctx->script_buf, ctx->script_buflen)== -1)
-			logerr("%s: control_queue", __func__);
-		else
-			status = 1;
-	}
+	status = control_queuelisteners(ctx,
+	    ctx->script_buf, ctx->script_buflen);
+	if (status == -1)
+		logerr("%s: control_queuelisteners", __func__);
 
-	return status;
+	return status > 0 ? 1 : 0;
 }
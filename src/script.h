@@ -38,4 +38,9 @@ pid_t script_exec(char *const *, char *const *);
 int send_interface(struct fd_list *, const struct interface *, int);
 int script_dump(const char *, size_t);
 int script_runreason(const struct interface *, const char *);
+void script_freeenv(struct interface *);
+int script_queue(struct dhcpcd_ctx *, const char *, size_t);
+int script_reap(struct dhcpcd_ctx *, pid_t, int);
+void script_drain(struct dhcpcd_ctx *);
+void script_freejobs(struct dhcpcd_ctx *);
 #endif
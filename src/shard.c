@@ -0,0 +1,706 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - shard interfaces across worker processes
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcpcd.h"
+#include "control.h"
+#include "duid.h"
+#include "eloop.h"
+#include "if.h"
+#include "if-options.h"
+#include "ipv6.h"
+#include "logerr.h"
+#include "netconf.h"
+#include "route.h"
+#include "shard.h"
+
+/* Events are read in at least this much at a time. */
+#define	SHARD_BUFLEN	(16 * 1024)
+
+static void shard_connect(void *);
+
+/* FNV-1a, so an interface stays in its shard from one run to the next. */
+static uint32_t
+shard_hash(const char *s)
+{
+	uint32_t h = 2166136261U;
+
+	while (*s != '\0') {
+		h ^= (uint8_t)*s++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/* For netconf_forget(). */
+static bool
+shard_had(const char *ifname, const void *arg)
+{
+	const struct shard *s = arg;
+	const struct dhcpcd_ctx *ctx = s->s_ctx;
+
+	return shard_hash(ifname) % ctx->shards ==
+	    (uint32_t)(s - ctx->shard_mgr->sh_workers);
+}
+
+bool
+shard_owns(const struct dhcpcd_ctx *ctx, const char *ifname)
+{
+
+	if (ctx->shard == 0)
+		return true;
+	return shard_hash(ifname) % ctx->shards == ctx->shard - 1;
+}
+
+/*
+ * Without a DUID in the file or from the machine UUID, each worker would
+ * make its own from one of its interfaces.
+ * So make it now from all of them in a child, which is simpler than
+ * undoing all that discovery here, and read it back.
+ */
+static void
+shard_initduid(struct dhcpcd_ctx *ctx)
+{
+	struct ifaddrs *ifaddrs = NULL;
+	struct interface *ifp;
+	pid_t pid;
+	int status;
+
+	dhcpcd_initduid(ctx, NULL);
+	if (ctx->duid != NULL)
+		return;
+
+	switch (pid = fork()) {
+	case -1:
+		logerr("%s: fork", __func__);
+		return;
+	case 0:
+		/* We have no privileged actioneer to ask. */
+		ctx->options &= ~DHCPCD_PRIVSEP;
+		if (if_opensockets(ctx) == -1)
+			_exit(EXIT_FAILURE);
+		ctx->ifaces = if_discover(ctx, &ifaddrs, 0, NULL);
+		if (ctx->ifaces == NULL)
+			_exit(EXIT_FAILURE);
+		TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+			if (ifp->active)
+				break;
+		}
+		if (ifp == NULL && (ifp = TAILQ_FIRST(ctx->ifaces)) == NULL)
+			_exit(EXIT_FAILURE);
+		duid_init(ctx, ifp);
+		_exit(ctx->duid == NULL ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			logerr("%s: waitpid", __func__);
+			return;
+		}
+	}
+	dhcpcd_initduid(ctx, NULL);
+}
+
+/* The manager has gone, so stop as if it had told us to. */
+static void
+shard_lost(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	char buf[1];
+
+	/* Nothing is ever sent, this is just to see it close. */
+	if (read(ctx->shard_fd, buf, sizeof(buf)) > 0)
+		return;
+	logerrx("%s: manager has gone", ctx->shard_name + 1);
+	eloop_event_delete(ctx->eloop, ctx->shard_fd);
+	close(ctx->shard_fd);
+	ctx->shard_fd = -1;
+	raise(SIGTERM);
+}
+
+static void
+shard_closelisten(struct shard *s)
+{
+
+	if (s->s_listen_fd == -1)
+		return;
+	eloop_event_delete(s->s_ctx->eloop, s->s_listen_fd);
+	close(s->s_listen_fd);
+	s->s_listen_fd = -1;
+	s->s_buflen = 0;
+}
+
+/* It has exited and we have all it had to say. */
+static void
+shard_gone(void *arg)
+{
+	struct shard *s = arg;
+	struct dhcpcd_ctx *ctx = s->s_ctx;
+	struct shards *sh = ctx->shard_mgr;
+
+	eloop_timeout_delete(ctx->eloop, shard_gone, s);
+	shard_closelisten(s);
+	/* Its control proxy may not have sent us the events from
+	 * stopping, or it may have crashed. */
+	netconf_forget(ctx, shard_had, s);
+
+	/* Its interfaces are no longer looked after, so stop the rest
+	 * rather than carry on with only some of them. */
+	if (!sh->sh_stopping) {
+		logerrx("%s: exited unexpectedly", s->s_name + 1);
+		sh->sh_status = EXIT_FAILURE;
+		shard_signal(ctx, SIGTERM);
+	} else
+		logdebugx("%s: exited", s->s_name + 1);
+	if (--sh->sh_alive == 0)
+		eloop_exit(ctx->eloop, sh->sh_status);
+}
+
+static void
+shard_exited(void *arg)
+{
+	struct shard *s = arg;
+	struct dhcpcd_ctx *ctx = s->s_ctx;
+	char buf[1];
+
+	if (read(s->s_fd, buf, sizeof(buf)) > 0)
+		return;
+	eloop_event_delete(ctx->eloop, s->s_fd);
+	close(s->s_fd);
+	s->s_fd = -1;
+
+	/* Its control proxy can still be sending the events from
+	 * stopping, which we need for resolv.conf and ntp.conf. */
+	if (s->s_listen_fd == -1)
+		shard_gone(s);
+	else
+		eloop_timeout_add_msec(ctx->eloop, SHARD_TIMEOUT,
+		    shard_gone, s);
+}
+
+/* Connect to a worker and send it a command as control_send() does. */
+static int
+shard_open(const struct shards *sh, const struct shard *s,
+    int argc, char * const *argv)
+{
+	char buf[1024];
+	size_t len = 0, l;
+	int i, fd;
+
+	for (i = 0; i < argc; i++) {
+		l = strlen(argv[i]) + 1;
+		if (len + l > sizeof(buf)) {
+			errno = ENOBUFS;
+			return -1;
+		}
+		memcpy(buf + len, argv[i], l);
+		len += l;
+	}
+
+	if ((fd = control_open(s->s_name, sh->sh_family, false)) == -1)
+		return -1;
+	if (write(fd, buf, len) != (ssize_t)len) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Read exactly len bytes, waiting up to SHARD_TIMEOUT for each part. */
+static int
+shard_read(int fd, void *data, size_t len)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	char *p = data;
+	ssize_t n;
+
+	while (len != 0) {
+		switch (poll(&pfd, 1, SHARD_TIMEOUT)) {
+		case -1:
+			if (errno == EINTR)
+				continue;
+			return -1;
+		case 0:
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		n = read(fd, p, len);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			errno = ECONNRESET;
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+/* Read a frame as queued with FD_SENDLEN, *datap is NULL if empty. */
+static int
+shard_readframe(int fd, void **datap, size_t *lenp)
+{
+	void *data;
+
+	*datap = NULL;
+	if (shard_read(fd, lenp, sizeof(*lenp)) == -1)
+		return -1;
+	if (*lenp == 0)
+		return 0;
+	if (*lenp > SSIZE_MAX) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	if ((data = malloc(*lenp)) == NULL)
+		return -1;
+	if (shard_read(fd, data, *lenp) == -1) {
+		free(data);
+		return -1;
+	}
+	*datap = data;
+	return 0;
+}
+
+static void
+shard_event(void *arg)
+{
+	struct shard *s = arg;
+	struct dhcpcd_ctx *ctx = s->s_ctx;
+	size_t off, len;
+	ssize_t n;
+	char *nbuf;
+
+	if (s->s_bufsize - s->s_buflen < SHARD_BUFLEN) {
+		len = s->s_bufsize == 0 ? SHARD_BUFLEN * 2 : s->s_bufsize * 2;
+		if ((nbuf = realloc(s->s_buf, len)) == NULL) {
+			logerr(__func__);
+			return;
+		}
+		s->s_buf = nbuf;
+		s->s_bufsize = len;
+	}
+
+	n = read(s->s_listen_fd, s->s_buf + s->s_buflen,
+	    s->s_bufsize - s->s_buflen);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (n == -1 || n == 0) {
+		if (n == -1)
+			logerr("%s: %s", __func__, s->s_name + 1);
+		shard_closelisten(s);
+		if (s->s_fd == -1)
+			shard_gone(s);
+		else
+			eloop_timeout_add_msec(ctx->eloop, SHARD_RETRY,
+			    shard_connect, ctx);
+		return;
+	}
+	s->s_buflen += (size_t)n;
+
+	/* Each event is framed by its length, and is what the worker
+	 * gave its own listeners and would have written from. */
+	for (off = 0; s->s_buflen - off >= sizeof(len); off += len) {
+		memcpy(&len, s->s_buf + off, sizeof(len));
+		if (s->s_buflen - off - sizeof(len) < len)
+			break;
+		off += sizeof(len);
+		if (len == 0)
+			continue;
+		netconf_event(ctx, s->s_buf + off, len);
+		if (control_queuelisteners(ctx, s->s_buf + off, len) == -1)
+			logerr("%s: control_queuelisteners", __func__);
+	}
+	memmove(s->s_buf, s->s_buf + off, s->s_buflen - off);
+	s->s_buflen -= off;
+}
+
+static void
+shard_connect(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct shards *sh = ctx->shard_mgr;
+	static char *argv[] = { UNCONST("--listen"), UNCONST("limit=0") };
+	struct shard *s;
+	unsigned int i;
+	bool retry = false;
+
+	if (sh->sh_stopping)
+		return;
+	for (i = 0; i < ctx->shards; i++) {
+		s = &sh->sh_workers[i];
+		if (s->s_fd == -1 || s->s_listen_fd != -1)
+			continue;
+		s->s_listen_fd = shard_open(sh, s, 2, argv);
+		if (s->s_listen_fd == -1) {
+			/* Until it's started. */
+			if (errno != ENOENT && errno != ECONNREFUSED)
+				logerr("%s: %s", __func__, s->s_name + 1);
+			retry = true;
+			continue;
+		}
+		if (eloop_event_add(ctx->eloop, s->s_listen_fd,
+		    shard_event, s) == -1)
+			logerr("%s: eloop_event_add", __func__);
+	}
+	if (retry)
+		eloop_timeout_add_msec(ctx->eloop, SHARD_RETRY,
+		    shard_connect, ctx);
+}
+
+/*
+ * --dumplease, --getinterfaces and --stats are answered with a count
+ * and then that many entries, so every worker has to reply before
+ * we can.
+ */
+static int
+shard_dump(struct dhcpcd_ctx *ctx, struct fd_list *fd,
+    int argc, char **argv)
+{
+	struct shards *sh = ctx->shard_mgr;
+	struct shard *s;
+	struct iovec *iov = NULL, *niov;
+	size_t niov_size = 0, n = 0, start, count, c;
+	unsigned int i;
+	int sfd, err = 0;
+
+	for (i = 0; i < ctx->shards; i++) {
+		s = &sh->sh_workers[i];
+		if (s->s_fd == -1)
+			continue;
+		if ((sfd = shard_open(sh, s, argc, argv)) == -1) {
+			logerr("%s: %s", __func__, s->s_name + 1);
+			continue;
+		}
+		start = n;
+		if (shard_read(sfd, &count, sizeof(count)) == -1) {
+			/* It didn't like the command. */
+			if (errno != ECONNRESET)
+				logerr("%s: %s", __func__, s->s_name + 1);
+			count = 0;
+		}
+		if (count > SIZE_MAX - n) {
+			count = 0;
+			errno = ENOBUFS;
+			goto werr;
+		}
+		if (n + count > niov_size) {
+			if ((niov = reallocarray(iov, n + count,
+			    sizeof(*iov))) == NULL)
+				goto werr;
+			iov = niov;
+			niov_size = n + count;
+		}
+		for (c = 0; c < count; c++) {
+			if (shard_readframe(sfd, &iov[n].iov_base,
+			    &iov[n].iov_len) == -1)
+				goto werr;
+			/* An empty entry can't be queued. */
+			if (iov[n].iov_base != NULL)
+				n++;
+		}
+		close(sfd);
+		continue;
+werr:
+		/* Drop what we have of this worker. */
+		logerr("%s: %s", __func__, s->s_name + 1);
+		while (n > start)
+			free(iov[--n].iov_base);
+		close(sfd);
+	}
+
+	if (write(fd->fd, &n, sizeof(n)) != sizeof(n))
+		err = -1;
+	for (c = 0; c < n; c++) {
+		if (err == 0 &&
+		    control_queue(fd, iov[c].iov_base, iov[c].iov_len) == -1)
+			err = -1;
+		free(iov[c].iov_base);
+	}
+	free(iov);
+	return err;
+}
+
+/* --dumpstate entries can be passed on as they come. */
+static int
+shard_dumpstate(struct dhcpcd_ctx *ctx, struct fd_list *fd,
+    int argc, char **argv)
+{
+	struct shards *sh = ctx->shard_mgr;
+	struct shard *s;
+	unsigned int i;
+	void *data;
+	size_t len;
+	int sfd;
+
+	for (i = 0; i < ctx->shards; i++) {
+		s = &sh->sh_workers[i];
+		if (s->s_fd == -1)
+			continue;
+		if ((sfd = shard_open(sh, s, argc, argv)) == -1) {
+			logerr("%s: %s", __func__, s->s_name + 1);
+			continue;
+		}
+		for (;;) {
+			if (shard_readframe(sfd, &data, &len) == -1) {
+				logerr("%s: %s", __func__, s->s_name + 1);
+				break;
+			}
+			if (data == NULL)
+				break;
+			if (control_queue(fd, data, len) == -1)
+				logerr(__func__);
+			free(data);
+		}
+		close(sfd);
+	}
+	return control_queue_end(fd);
+}
+
+int
+shard_handleargs(struct dhcpcd_ctx *ctx, struct fd_list *fd,
+    int argc, char **argv)
+{
+	struct shards *sh = ctx->shard_mgr;
+	struct shard *s;
+	unsigned int i;
+	int opt, oi = 0, sfd;
+	bool dump = false, stop = false;
+
+	if (strcmp(*argv, "--listen") == 0)
+		return control_listen(fd, argc, argv);
+	if (strcmp(*argv, "--dumpstate") == 0)
+		return shard_dumpstate(ctx, fd, argc, argv);
+	if (strcmp(*argv, "--getinterfaces") == 0)
+		return shard_dump(ctx, fd, argc, argv);
+
+	optind = 0;
+	while ((opt = getopt_long(argc, argv, IF_OPTS, cf_options, &oi)) != -1)
+	{
+		switch (opt) {
+		case 'U':
+		case O_STATS:
+			dump = true;
+			break;
+		case 'k':
+		case 'x':
+			stop = true;
+			break;
+		}
+	}
+	if (dump)
+		return shard_dump(ctx, fd, argc, argv);
+
+	/* Only privileged users can control dhcpcd via the socket. */
+	if (fd->flags & FD_UNPRIV) {
+		errno = EPERM;
+		return -1;
+	}
+
+	/* Each worker ignores interfaces it does not have. */
+	if (stop && optind == argc)
+		sh->sh_stopping = true;
+	for (i = 0; i < ctx->shards; i++) {
+		s = &sh->sh_workers[i];
+		if (s->s_fd == -1)
+			continue;
+		if ((sfd = shard_open(sh, s, argc, argv)) == -1)
+			logerr("%s: %s", __func__, s->s_name + 1);
+		else
+			close(sfd);
+	}
+	return 0;
+}
+
+void
+shard_signal(struct dhcpcd_ctx *ctx, int sig)
+{
+	struct shards *sh = ctx->shard_mgr;
+	struct shard *s;
+	unsigned int i;
+
+	switch (sig) {
+	case SIGINT:
+	case SIGTERM:
+	case SIGALRM:
+		sh->sh_stopping = true;
+		break;
+	case SIGUSR2:
+		if (logopen(ctx->logfile) == -1)
+			logerr("logopen");
+		break;
+	}
+
+	logdebugx("passing signal %d to our workers", sig);
+	for (i = 0; i < ctx->shards; i++) {
+		s = &sh->sh_workers[i];
+		if (s->s_fd != -1 && kill(s->s_pid, sig) == -1)
+			logerr("%s: kill %s", __func__, s->s_name + 1);
+	}
+}
+
+/*
+ * Returns 0 in the manager, 1 in a worker which carries on starting as
+ * dhcpcd would for its share of interfaces, otherwise -1.
+ */
+int
+shard_start(struct dhcpcd_ctx *ctx, const struct if_options *ifo,
+    sa_family_t family)
+{
+	struct shards *sh;
+	struct shard *s;
+	unsigned int i, j;
+	int fds[2];
+
+#ifndef HAVE_ROUTE_METRIC
+	UNUSED(ifo);
+	UNUSED(family);
+	logerrx("shards needs route metrics to share the routing table");
+	errno = ENOTSUP;
+	return -1;
+#else
+	/* Everything the workers must agree on. */
+	if (ifo->options & (DHCPCD_DUID | DHCPCD_IPV6) &&
+	    !(ifo->options & DHCPCD_ANONYMOUS))
+		shard_initduid(ctx);
+#ifdef INET6
+	if (ifo->options & DHCPCD_SLAACPRIVATE && ctx->secret_len == 0)
+		(void)ipv6_readsecret(ctx);
+#endif
+
+	sh = calloc(1, sizeof(*sh) + ctx->shards * sizeof(sh->sh_workers[0]));
+	if (sh == NULL)
+		return -1;
+	sh->sh_family = family;
+	sh->sh_status = EXIT_SUCCESS;
+	for (i = 0; i < ctx->shards; i++) {
+		s = &sh->sh_workers[i];
+		s->s_ctx = ctx;
+		s->s_fd = s->s_listen_fd = -1;
+		if (snprintf(s->s_name, sizeof(s->s_name),
+		    SHARD_NAME, i + 1) == -1)
+		{
+			free(sh);
+			return -1;
+		}
+	}
+	ctx->shard_mgr = sh;
+
+	/* Nothing of ours goes on the eloop until every worker is forked
+	 * so they don't inherit it. */
+	for (i = 0; i < ctx->shards; i++) {
+		s = &sh->sh_workers[i];
+		if (xsocketpair(AF_UNIX, SOCK_STREAM | SOCK_CXNB, 0, fds) == -1)
+			return -1;
+		switch (s->s_pid = fork()) {
+		case -1:
+			close(fds[0]);
+			close(fds[1]);
+			return -1;
+		case 0:
+			close(fds[0]);
+			for (j = 0; j < i; j++)
+				close(sh->sh_workers[j].s_fd);
+			ctx->shard = i + 1;
+			ctx->shard_fd = fds[1];
+			strlcpy(ctx->shard_name, s->s_name,
+			    sizeof(ctx->shard_name));
+			free(sh);
+			ctx->shard_mgr = NULL;
+			if (eloop_forked(ctx->eloop) == -1 ||
+			    eloop_event_add(ctx->eloop, ctx->shard_fd,
+			    shard_lost, ctx) == -1)
+				return -1;
+			return 1;
+		}
+		close(fds[1]);
+		s->s_fd = fds[0];
+		sh->sh_alive++;
+		logdebugx("spawned %s on PID %d", s->s_name + 1, s->s_pid);
+	}
+
+	for (i = 0; i < ctx->shards; i++) {
+		s = &sh->sh_workers[i];
+		if (eloop_event_add(ctx->eloop, s->s_fd, shard_exited, s) == -1)
+			return -1;
+	}
+
+#ifdef PRIVSEP
+	/* We only pass messages on and write resolv.conf and ntp.conf,
+	 * the workers do the rest separated. */
+	ctx->options &= ~DHCPCD_PRIVSEP;
+#endif
+	if (control_start(ctx, NULL, family) == -1)
+		return -1;
+	setproctitle("[manager]");
+	shard_connect(ctx);
+	return 0;
+#endif
+}
+
+/* Closing our end of each worker tells any still running to stop. */
+void
+shard_free(struct dhcpcd_ctx *ctx)
+{
+	struct shards *sh = ctx->shard_mgr;
+	struct shard *s;
+	unsigned int i;
+
+	if (sh == NULL)
+		return;
+	for (i = 0; i < ctx->shards; i++) {
+		s = &sh->sh_workers[i];
+		eloop_timeout_delete(ctx->eloop, shard_gone, s);
+		shard_closelisten(s);
+		if (s->s_fd != -1) {
+			eloop_event_delete(ctx->eloop, s->s_fd);
+			close(s->s_fd);
+		}
+		free(s->s_buf);
+	}
+	free(sh);
+	ctx->shard_mgr = NULL;
+}
@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - shard interfaces across worker processes
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdbool.h>
+
+#include "dhcpcd.h"
+
+/*
+ * With shards N the master process becomes a manager which forks N
+ * workers, each a dhcpcd of its own for the interfaces whose names hash
+ * to it.
+ * The manager keeps the DUID and secret the workers share, owns the
+ * control socket and fans commands out to each worker over its own
+ * control socket, RUNDIR/.shardN.sock.
+ * It listens to every worker for events, relaying them to its own
+ * listeners and writing resolv.conf and ntp.conf from all of them.
+ * Each worker maintains the routes of its own interfaces, relying on
+ * the kernel to pick between them by metric.
+ */
+#define	SHARD_NAME	".shard%u"
+#define	SHARD_MAX	64
+/* How long the manager waits for a worker to answer, in msecs. */
+#define	SHARD_TIMEOUT	5000
+/* And between attempts to connect to one which is starting. */
+#define	SHARD_RETRY	100
+
+struct shard {
+	struct dhcpcd_ctx *s_ctx;
+	pid_t s_pid;
+	int s_fd;		/* EOF once the worker exits */
+	int s_listen_fd;	/* its events */
+	char s_name[IF_NAMESIZE];
+	char *s_buf;		/* events read but not yet whole */
+	size_t s_buflen;
+	size_t s_bufsize;
+};
+
+struct shards {
+	sa_family_t sh_family;
+	unsigned int sh_alive;
+	bool sh_stopping;
+	int sh_status;
+	struct shard sh_workers[];
+};
+
+int shard_start(struct dhcpcd_ctx *, const struct if_options *, sa_family_t);
+bool shard_owns(const struct dhcpcd_ctx *, const char *);
+int shard_handleargs(struct dhcpcd_ctx *, struct fd_list *, int, char **);
+void shard_signal(struct dhcpcd_ctx *, int);
+void shard_free(struct dhcpcd_ctx *);
+#endif
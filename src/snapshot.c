@@ -0,0 +1,694 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - state snapshot for warm restarts
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * With warmstart dhcpcd leaves its addresses and routes in place when it
+ * exits and notes down which of them were its own, one file per interface.
+ * Leases are already kept in their own files.
+ * When the interface starts again, the routes the kernel still has are
+ * adopted so that rt_build() won't remove them before whatever added them
+ * has caught up, and a DHCP lease whose address is still configured is
+ * carried on with rather than rebooted.
+ * The file is also written shortly after our routes change so that even
+ * a crash leaves a recent one behind.
+ */
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcp.h"
+#include "dhcp-common.h"
+#include "dhcp6.h"
+#include "dhcpcd.h"
+#include "eloop.h"
+#include "if.h"
+#include "ipv4.h"
+#include "ipv4ll.h"
+#include "ipv6.h"
+#include "ipv6nd.h"
+#include "logerr.h"
+#include "route.h"
+#include "sa.h"
+#include "snapshot.h"
+
+#define	SNAPSHOT_MAGIC	"dhcpcd-snapshot 1"
+/* Small enough to pass to the privileged actioneer in one message. */
+#define	SNAPSHOT_BUFLEN	(32 * 1024)
+/* Seconds to gather changes before writing them down. */
+#define	SNAPSHOT_DELAY	1
+
+/*
+ * Expiry times are wall clock in the file and monotonic in memory.
+ * 0 is forever and SNAPSHOT_NONE is nothing to expire.
+ */
+#define	SNAPSHOT_NONE	((time_t)-1)
+
+struct snapshot_addr {
+	int		sna_af;
+	uint8_t		sna_addr[sizeof(struct in6_addr)];
+};
+
+/* The addresses the last run left which are still on the interface. */
+struct snapshot {
+	size_t			sn_naddrs;
+	struct snapshot_addr	sn_addrs[];
+};
+
+struct snapshot_buf {
+	char		*sb_buf;
+	size_t		sb_len;
+	bool		sb_full;
+	time_t		sb_now;		/* monotonic */
+	time_t		sb_offset;	/* monotonic to wall clock */
+	time_t		sb_expires[2];	/* latest address expiry by family */
+	size_t		sb_naddrs;
+};
+
+/* Seconds to add to a monotonic time to make it a wall clock time. */
+static time_t
+snapshot_offset(time_t *now)
+{
+	struct timespec mono, real;
+	long long ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	*now = mono.tv_sec;
+	ns = (long long)(real.tv_sec - mono.tv_sec) * NSEC_PER_SEC +
+	    (real.tv_nsec - mono.tv_nsec);
+	/* Rounded so the same expiry is written the same each time. */
+	return (time_t)((ns + NSEC_PER_SEC / 2) / NSEC_PER_SEC);
+}
+
+static int
+snapshot_afidx(int af)
+{
+
+	switch (af) {
+	case AF_INET:
+		return 0;
+	case AF_INET6:
+		return 1;
+	default:
+		return -1;
+	}
+}
+
+__printflike(2, 3) static void
+snapshot_printf(struct snapshot_buf *sb, const char *fmt, ...)
+{
+	va_list va;
+	int l;
+
+	if (sb->sb_full)
+		return;
+	va_start(va, fmt);
+	l = vsnprintf(sb->sb_buf + sb->sb_len, SNAPSHOT_BUFLEN - sb->sb_len,
+	    fmt, va);
+	va_end(va);
+	if (l < 0 || (size_t)l >= SNAPSHOT_BUFLEN - sb->sb_len)
+		sb->sb_full = true;
+	else
+		sb->sb_len += (size_t)l;
+}
+
+static void
+snapshot_addaddr(struct snapshot_buf *sb, int af, const void *addr,
+    int prefix_len, time_t expires, const char *src)
+{
+	char buf[INET6_ADDRSTRLEN];
+	time_t *fexp;
+
+	if (expires != 0 && expires <= sb->sb_now)
+		return;
+	if (inet_ntop(af, addr, buf, sizeof(buf)) == NULL)
+		return;
+	snapshot_printf(sb, "addr %s %s/%d %lld %s\n",
+	    af == AF_INET ? "inet" : "inet6", buf, prefix_len,
+	    expires == 0 ? 0LL : (long long)(expires + sb->sb_offset), src);
+	sb->sb_naddrs++;
+
+	/* Routes are only as good as the addresses they go with. */
+	fexp = &sb->sb_expires[snapshot_afidx(af)];
+	if (*fexp == SNAPSHOT_NONE ||
+	    (*fexp != 0 && (expires == 0 || expires > *fexp)))
+		*fexp = expires;
+}
+
+#ifdef INET6
+static void
+snapshot_addaddrs6(struct snapshot_buf *sb, const struct ipv6_addrhead *addrs,
+    const char *src)
+{
+	const struct ipv6_addr *ia;
+	time_t expires;
+
+	TAILQ_FOREACH(ia, addrs, next) {
+		if (!(ia->flags & IPV6_AF_ADDED) ||
+		    ia->flags & IPV6_AF_DELEGATEDPFX)
+			continue;
+		if (ia->prefix_vltime == ND6_INFINITE_LIFETIME)
+			expires = 0;
+		else
+			expires = ia->acquired.tv_sec + ia->prefix_vltime;
+		snapshot_addaddr(sb, AF_INET6, &ia->addr, ia->prefix_len,
+		    expires, src);
+	}
+}
+#endif
+
+static void
+snapshot_build(struct interface *ifp, struct snapshot_buf *sb)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	char buf[INET6_ADDRSTRLEN], gw[INET6_ADDRSTRLEN];
+	char hwaddr[HWADDR_LEN * 3], ssid[IF_SSIDLEN * 3];
+	struct rt *rt;
+	unsigned int metric;
+	time_t expires;
+	int i, prefix_len;
+#ifdef INET
+	const struct dhcp_state *state;
+#endif
+#ifdef IPV4LL
+	const struct ipv4ll_state *istate;
+#endif
+#ifdef INET6
+	const struct ra *rap;
+#endif
+#ifdef DHCP6
+	const struct dhcp6_state *state6;
+#endif
+
+	sb->sb_offset = snapshot_offset(&sb->sb_now);
+	sb->sb_expires[0] = sb->sb_expires[1] = SNAPSHOT_NONE;
+	snapshot_printf(sb, SNAPSHOT_MAGIC "\n");
+	if (ifp->hwlen != 0)
+		snapshot_printf(sb, "hwaddr %s\n", hwaddr_ntoa(ifp->hwaddr,
+		    ifp->hwlen, hwaddr, sizeof(hwaddr)));
+	if (ifp->ssid_len != 0)
+		snapshot_printf(sb, "ssid %s\n",
+		    hwaddr_ntoa(ifp->ssid, ifp->ssid_len, ssid, sizeof(ssid)));
+
+#ifdef INET
+	state = D_CSTATE(ifp);
+	if (state != NULL && state->addr != NULL &&
+	    state->added & STATE_ADDED &&
+	    !(state->added & (STATE_FAKE | STATE_EXPIRED)))
+	{
+		if (state->lease.leasetime == DHCP_INFINITE_LIFETIME)
+			expires = 0;
+		else
+			expires = state->bound.tv_sec +
+			    (time_t)state->lease.leasetime;
+		snapshot_addaddr(sb, AF_INET, &state->addr->addr,
+		    inet_ntocidr(state->addr->mask), expires, "dhcp");
+	}
+#endif
+#ifdef IPV4LL
+	istate = IPV4LL_CSTATE(ifp);
+	if (istate != NULL && istate->addr != NULL)
+		snapshot_addaddr(sb, AF_INET, &istate->addr->addr,
+		    inet_ntocidr(istate->addr->mask), 0, "ipv4ll");
+#endif
+#ifdef INET6
+	if (ctx->ra_routers != NULL) {
+		TAILQ_FOREACH(rap, ctx->ra_routers, next) {
+			if (rap->iface == ifp)
+				snapshot_addaddrs6(sb, &rap->addrs, "ra");
+		}
+	}
+#endif
+#ifdef DHCP6
+	state6 = D6_CSTATE(ifp);
+	if (state6 != NULL)
+		snapshot_addaddrs6(sb, &state6->addrs, "dhcp6");
+#endif
+
+	RB_TREE_FOREACH(rt, &ctx->routes) {
+		if (rt->rt_ifp != ifp || rt->rt_dflags & RTDF_FAKE)
+			continue;
+		if ((i = snapshot_afidx(rt->rt_dest.sa_family)) == -1)
+			continue;
+		if ((expires = sb->sb_expires[i]) == SNAPSHOT_NONE)
+			continue;
+		if (rt->rt_gateway.sa_family == AF_UNSPEC)
+			strlcpy(gw, "-", sizeof(gw));
+		else if (rt->rt_gateway.sa_family != rt->rt_dest.sa_family ||
+		    sa_addrtop(&rt->rt_gateway, gw, sizeof(gw)) == NULL)
+			continue;
+		if (sa_addrtop(&rt->rt_dest, buf, sizeof(buf)) == NULL ||
+		    (prefix_len = sa_toprefix(&rt->rt_netmask)) == -1)
+			continue;
+#ifdef HAVE_ROUTE_METRIC
+		metric = rt->rt_metric;
+#else
+		metric = 0;
+#endif
+		snapshot_printf(sb, "route %s %s/%d %s %u %u 0x%x %lld\n",
+		    i == 0 ? "inet" : "inet6", buf, prefix_len, gw,
+		    metric, rt->rt_mtu, rt->rt_dflags & (unsigned int)~RTDF_ADOPTED,
+		    expires == 0 ? 0LL : (long long)(expires + sb->sb_offset));
+	}
+}
+
+/* FNV-1a, only to tell if there is anything new to write. */
+static uint32_t
+snapshot_hash(const char *buf, size_t len)
+{
+	uint32_t h = 2166136261U;
+
+	while (len-- != 0) {
+		h ^= (uint8_t)*buf++;
+		h *= 16777619U;
+	}
+	return h == 0 ? 1 : h;
+}
+
+void
+snapshot_write(struct interface *ifp)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct snapshot_buf sb = { .sb_buf = NULL };
+	char file[PATH_MAX];
+	uint32_t hash;
+
+	if (!ctx->warmstart)
+		return;
+	if ((sb.sb_buf = malloc(SNAPSHOT_BUFLEN)) == NULL) {
+		logerr(__func__);
+		return;
+	}
+	snapshot_build(ifp, &sb);
+	if (sb.sb_full) {
+		logerrx("%s: too much to snapshot", ifp->name);
+		goto out;
+	}
+	if (sb.sb_naddrs == 0) {
+		snapshot_unlink(ifp);
+		goto out;
+	}
+
+	hash = snapshot_hash(sb.sb_buf, sb.sb_len);
+	if (hash == ifp->snapshot_hash)
+		goto out;
+	snprintf(file, sizeof(file), SNAPSHOTFILE, ifp->name);
+	if (dhcp_writefile(ctx, file, 0640, sb.sb_buf, sb.sb_len) == -1)
+		logerr("%s: %s", __func__, file);
+	else
+		ifp->snapshot_hash = hash;
+
+out:
+	free(sb.sb_buf);
+}
+
+void
+snapshot_unlink(struct interface *ifp)
+{
+	char file[PATH_MAX];
+
+	if (ifp->snapshot_hash == 0)
+		return;
+	snprintf(file, sizeof(file), SNAPSHOTFILE, ifp->name);
+	if (dhcp_unlink(ifp->ctx, file) == -1 && errno != ENOENT)
+		logerr("%s: %s", __func__, file);
+	ifp->snapshot_hash = 0;
+}
+
+static void
+snapshot_writeall(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct interface *ifp;
+
+	ctx->snapshot_queued = false;
+	/* What is left once we start to exit is written by
+	 * stop_all_interfaces(). */
+	if (ctx->options & DHCPCD_EXITING)
+		return;
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		if (ifp->active)
+			snapshot_write(ifp);
+	}
+}
+
+void
+snapshot_queue(struct dhcpcd_ctx *ctx)
+{
+
+	if (!ctx->warmstart || ctx->snapshot_queued ||
+	    ctx->options & DHCPCD_EXITING)
+		return;
+	if (eloop_timeout_add_sec(ctx->eloop, SNAPSHOT_DELAY,
+	    snapshot_writeall, ctx) == -1)
+		logerr(__func__);
+	else
+		ctx->snapshot_queued = true;
+}
+
+/* Parses address/prefix_len. */
+static int
+snapshot_addr(char *s, int af, void *addr, int *prefix_len)
+{
+	char *p;
+	int e;
+
+	if (s == NULL || (p = strchr(s, '/')) == NULL)
+		return -1;
+	*p++ = '\0';
+	if (inet_pton(af, s, addr) != 1)
+		return -1;
+	*prefix_len = (int)strtoi(p, NULL, 10, 0,
+	    af == AF_INET ? 32 : 128, &e);
+	return e == 0 ? 0 : -1;
+}
+
+/* Parses a wall clock expiry into a monotonic one.
+ * Returns -1 if it has already expired. */
+static int
+snapshot_expires(const char *s, const struct snapshot_buf *sb, time_t *hold)
+{
+	long long expires;
+	char *ep;
+
+	if (s == NULL)
+		return -1;
+	errno = 0;
+	expires = strtoll(s, &ep, 10);
+	if (errno != 0 || *ep != '\0' || expires < 0)
+		return -1;
+	if (expires == 0) {
+		*hold = 0;
+		return 0;
+	}
+	*hold = (time_t)expires - sb->sb_offset;
+	return *hold > sb->sb_now ? 0 : -1;
+}
+
+static bool
+snapshot_loadaddr(struct interface *ifp, struct snapshot *sn,
+    char *line, const struct snapshot_buf *sb)
+{
+	struct snapshot_addr *sna;
+	char *fam;
+	int af, prefix_len;
+	time_t hold;
+
+	fam = strsep(&line, " ");
+	if (fam == NULL)
+		return false;
+	if (strcmp(fam, "inet") == 0)
+		af = AF_INET;
+	else if (strcmp(fam, "inet6") == 0)
+		af = AF_INET6;
+	else
+		return false;
+	sna = &sn->sn_addrs[sn->sn_naddrs];
+	sna->sna_af = af;
+	if (snapshot_addr(strsep(&line, " "), af,
+	    sna->sna_addr, &prefix_len) == -1 ||
+	    snapshot_expires(strsep(&line, " "), sb, &hold) == -1)
+		return false;
+
+	switch (af) {
+#ifdef INET
+	case AF_INET:
+		if (ipv4_iffindaddr(ifp,
+		    (const struct in_addr *)(void *)sna->sna_addr, NULL) == NULL)
+			return false;
+		break;
+#endif
+#ifdef INET6
+	case AF_INET6:
+		if (ipv6_iffindaddr(ifp,
+		    (const struct in6_addr *)(void *)sna->sna_addr, 0) == NULL)
+			return false;
+		break;
+#endif
+	default:
+		return false;
+	}
+	sn->sn_naddrs++;
+	return true;
+}
+
+static bool
+snapshot_loadroute(struct interface *ifp, char *line,
+    const struct snapshot_buf *sb)
+{
+	struct rt *rt;
+	char *fam, *gw, *metric, *mtu, *dflags;
+	union {
+		struct in_addr in;
+		struct in6_addr in6;
+	} dest, gateway;
+	int af, prefix_len, e1, e2, e3;
+	time_t hold;
+	bool adopted;
+
+	fam = strsep(&line, " ");
+	if (fam == NULL)
+		return false;
+	if (strcmp(fam, "inet") == 0)
+		af = AF_INET;
+	else if (strcmp(fam, "inet6") == 0)
+		af = AF_INET6;
+	else
+		return false;
+	if (snapshot_addr(strsep(&line, " "), af, &dest, &prefix_len) == -1)
+		return false;
+	gw = strsep(&line, " ");
+	metric = strsep(&line, " ");
+	mtu = strsep(&line, " ");
+	dflags = strsep(&line, " ");
+	if (gw == NULL || metric == NULL || mtu == NULL || dflags == NULL)
+		return false;
+	if (strcmp(gw, "-") != 0 && inet_pton(af, gw, &gateway) != 1)
+		return false;
+	if (snapshot_expires(strsep(&line, " "), sb, &hold) == -1)
+		return false;
+
+	if ((rt = rt_new(ifp)) == NULL)
+		return false;
+	switch (af) {
+#ifdef INET
+	case AF_INET:
+		sa_in_init(&rt->rt_dest, &dest.in);
+		rt->rt_netmask.sa_family = AF_INET;
+		if (strcmp(gw, "-") != 0)
+			sa_in_init(&rt->rt_gateway, &gateway.in);
+		break;
+#endif
+#ifdef INET6
+	case AF_INET6:
+		sa_in6_init(&rt->rt_dest, &dest.in6);
+		rt->rt_netmask.sa_family = AF_INET6;
+		if (strcmp(gw, "-") != 0)
+			sa_in6_init(&rt->rt_gateway, &gateway.in6);
+		break;
+#endif
+	default:
+		rt_free(rt);
+		return false;
+	}
+	sa_fromprefix(&rt->rt_netmask, prefix_len);
+#ifdef HAVE_ROUTE_METRIC
+	rt->rt_metric = (unsigned int)strtou(metric, NULL, 10, 0, UINT_MAX, &e1);
+#else
+	e1 = 0;
+#endif
+	rt->rt_mtu = (unsigned int)strtou(mtu, NULL, 10, 0, UINT_MAX, &e2);
+	rt->rt_dflags = (unsigned int)strtou(dflags, NULL, 0, 0, UINT_MAX, &e3);
+	if (e1 != 0 || e2 != 0 || e3 != 0)
+		adopted = false;
+	else
+		adopted = rt_adopt(rt, hold);
+	rt_free(rt);
+	return adopted;
+}
+
+void
+snapshot_load(struct interface *ifp)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct snapshot_buf sb = { .sb_buf = NULL };
+	struct snapshot *sn;
+	char file[PATH_MAX], hwaddr[HWADDR_LEN * 3], ssid[IF_SSIDLEN * 3];
+	char *p, *line, *key;
+	size_t nlines, nroutes;
+	ssize_t len;
+	bool checked, changed;
+
+	if (!ctx->warmstart || ifp->snapshot != NULL)
+		return;
+
+	if ((sb.sb_buf = malloc(SNAPSHOT_BUFLEN)) == NULL) {
+		logerr(__func__);
+		return;
+	}
+	snprintf(file, sizeof(file), SNAPSHOTFILE, ifp->name);
+	len = dhcp_readfile(ctx, file, sb.sb_buf, SNAPSHOT_BUFLEN - 1);
+	if (len == -1) {
+		if (errno != ENOENT)
+			logerr("%s: %s", __func__, file);
+		len = 0;
+	} else
+		ifp->snapshot_hash = 1;	/* so it's removed if not needed */
+	sb.sb_buf[len] = '\0';
+
+	nlines = 0;
+	for (p = sb.sb_buf; (p = strchr(p, '\n')) != NULL; p++)
+		nlines++;
+	sn = calloc(1, sizeof(*sn) + nlines * sizeof(sn->sn_addrs[0]));
+	if (sn == NULL) {
+		logerr(__func__);
+		goto out;
+	}
+	ifp->snapshot = sn;
+
+	p = sb.sb_buf;
+	line = strsep(&p, "\n");
+	if (line == NULL || strcmp(line, SNAPSHOT_MAGIC) != 0) {
+		if (len != 0)
+			logwarnx("%s: %s: not a snapshot", ifp->name, file);
+		goto out;
+	}
+
+	sb.sb_offset = snapshot_offset(&sb.sb_now);
+	if (ifp->hwlen != 0)
+		hwaddr_ntoa(ifp->hwaddr, ifp->hwlen, hwaddr, sizeof(hwaddr));
+	else
+		*hwaddr = '\0';
+	if (ifp->ssid_len != 0)
+		hwaddr_ntoa(ifp->ssid, ifp->ssid_len, ssid, sizeof(ssid));
+	else
+		*ssid = '\0';
+	checked = changed = false;
+	nroutes = 0;
+	while ((line = strsep(&p, "\n")) != NULL) {
+		key = strsep(&line, " ");
+		/* A different hardware address or SSID is a different
+		 * network, so nothing from it can be ours. */
+		if (strcmp(key, "hwaddr") == 0) {
+			if (line == NULL || strcmp(line, hwaddr) != 0) {
+				changed = true;
+				break;
+			}
+			*hwaddr = '\0';
+			continue;
+		}
+		if (strcmp(key, "ssid") == 0) {
+			if (line == NULL || strcmp(line, ssid) != 0) {
+				changed = true;
+				break;
+			}
+			*ssid = '\0';
+			continue;
+		}
+		if (!checked) {
+			if (*hwaddr != '\0' || *ssid != '\0') {
+				changed = true;
+				break;
+			}
+			checked = true;
+		}
+		if (strcmp(key, "addr") == 0)
+			snapshot_loadaddr(ifp, sn, line, &sb);
+		else if (strcmp(key, "route") == 0) {
+			if (snapshot_loadroute(ifp, line, &sb))
+				nroutes++;
+		}
+	}
+
+	if (changed)
+		logdebugx("%s: the network changed, not adopting",
+		    ifp->name);
+	else if (sn->sn_naddrs != 0 || nroutes != 0)
+		loginfox("%s: adopting %zu address%s and %zu route%s"
+		    " from the last run", ifp->name,
+		    sn->sn_naddrs, sn->sn_naddrs == 1 ? "" : "es",
+		    nroutes, nroutes == 1 ? "" : "s");
+
+out:
+	free(sb.sb_buf);
+}
+
+/* What the last run left for ifp that is still on it. */
+bool
+snapshot_owned(const struct interface *ifp, int af, const void *addr)
+{
+	const struct snapshot *sn = ifp->snapshot;
+	const struct snapshot_addr *sna;
+	size_t i, len;
+
+	if (sn == NULL)
+		return false;
+	len = af == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+	for (i = 0; i < sn->sn_naddrs; i++) {
+		sna = &sn->sn_addrs[i];
+		if (sna->sna_af == af &&
+		    (addr == NULL || memcmp(sna->sna_addr, addr, len) == 0))
+			return true;
+	}
+	return false;
+}
+
+/* Once the protocol has decided, what's left shouldn't sway it again. */
+void
+snapshot_forget(struct interface *ifp, int af)
+{
+	struct snapshot *sn = ifp->snapshot;
+	size_t i, n;
+
+	if (sn == NULL)
+		return;
+	for (i = n = 0; i < sn->sn_naddrs; i++) {
+		if (sn->sn_addrs[i].sna_af != af)
+			sn->sn_addrs[n++] = sn->sn_addrs[i];
+	}
+	sn->sn_naddrs = n;
+}
+
+void
+snapshot_free(struct interface *ifp)
+{
+
+	free(ifp->snapshot);
+	ifp->snapshot = NULL;
+}
@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - shared benchmark fixtures
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <netinet/if_ether.h>
+
+#include <err.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcpcd.h"
+#include "eloop.h"
+#include "if.h"
+#include "if-options.h"
+#include "ipv4.h"
+#include "ipv6.h"
+#include "route.h"
+
+#include "bench.h"
+
+/* What dhcpcd_main() sets up before it looks at any interface.
+ * The option definitions and global options are read from
+ * ctx->cffile, or /dev/null if that is not set. */
+void
+bench_ctx_init(struct dhcpcd_ctx *ctx)
+{
+	struct if_options *ifo;
+
+	if (ctx->cffile == NULL)
+		ctx->cffile = "/dev/null";
+	ctx->options = DHCPCD_TEST;
+	TAILQ_INIT(&ctx->optmasks);
+	TAILQ_INIT(&ctx->control_fds);
+	TAILQ_INIT(&ctx->script_jobs);
+	ctx->pf_inet_fd = ctx->link_fd = ctx->control_fd = -1;
+	clock_gettime(CLOCK_MONOTONIC, &ctx->started);
+	if ((ctx->eloop = eloop_new()) == NULL)
+		err(EXIT_FAILURE, "eloop_new");
+	if ((ctx->ifaces = malloc(sizeof(*ctx->ifaces))) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	TAILQ_INIT(ctx->ifaces);
+
+	rt_init(ctx);
+#ifdef INET
+	pool_init(&ctx->ia4_pool, "ipv4_addr", sizeof(struct ipv4_addr));
+	lpm_init(&ctx->ipv4_lpm, "ipv4_lpm", 32,
+	    offsetof(struct ipv4_addr, lpm));
+#endif
+#ifdef INET6
+	pool_init(&ctx->ia6_pool, "ipv6_addr", sizeof(struct ipv6_addr));
+	lpm_init(&ctx->ipv6_lpm, "ipv6_lpm", 128,
+	    offsetof(struct ipv6_addr, lpm));
+	if (ipv6_init(ctx) == -1)
+		err(EXIT_FAILURE, "ipv6_init");
+#endif
+	if_ctxinit(ctx);
+
+	if ((ifo = read_config(ctx, NULL, NULL, NULL)) == NULL)
+		errx(EXIT_FAILURE, "read_config");
+	ctx->options |= ifo->options;
+	free_options(ctx, ifo);
+}
+
+/* An ethernet interface that is up with a carrier, given the options
+ * configure_interface1() would give it and added to ctx. */
+struct interface *
+bench_if_new(struct dhcpcd_ctx *ctx, const char *name, unsigned int index,
+    const uint8_t *hwaddr)
+{
+	struct interface *ifp;
+	struct if_options *ifo;
+
+	if ((ifp = calloc(1, sizeof(*ifp))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	ifp->ctx = ctx;
+	strlcpy(ifp->name, name, sizeof(ifp->name));
+	ifp->index = index;
+	ifp->flags = IFF_UP | IFF_BROADCAST | IFF_MULTICAST | IFF_RUNNING;
+	ifp->hwtype = ARPHRD_ETHER;
+	ifp->hwlen = ETHER_ADDR_LEN;
+	memcpy(ifp->hwaddr, hwaddr, ETHER_ADDR_LEN);
+	ifp->carrier = LINK_UP;
+	ifp->active = IF_ACTIVE_USER;
+
+	ifo = read_config(ctx, ifp->name, NULL, NULL);
+	if (ifo == NULL)
+		errx(EXIT_FAILURE, "%s: read_config", ifp->name);
+	ifo->options &= ~DHCPCD_ARP;
+	memcpy(ifo->iaid, ifp->hwaddr + ifp->hwlen - sizeof(ifo->iaid),
+	    sizeof(ifo->iaid));
+	ifo->options |= DHCPCD_IAID;
+	ifp->options = ifo;
+
+	TAILQ_INSERT_TAIL(ctx->ifaces, ifp, next);
+	if_indexctx(ifp);
+	return ifp;
+}
@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - benchmark latency samples
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+
+#define	NSEC_PER_SEC		1000000000ULL
+
+unsigned long long
+bench_now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return (unsigned long long)ts.tv_sec * NSEC_PER_SEC +
+	    (unsigned long long)ts.tv_nsec;
+}
+
+void
+bench_lat_add(struct bench_latency *st, unsigned long long ns)
+{
+	unsigned long long *nns;
+	size_t nsize;
+
+	if (st->len == st->size) {
+		nsize = st->size == 0 ? 1024 : st->size * 2;
+		nns = realloc(st->ns, nsize * sizeof(*nns));
+		if (nns == NULL)
+			err(EXIT_FAILURE, "realloc");
+		st->ns = nns;
+		st->size = nsize;
+	}
+	st->ns[st->len++] = ns;
+}
+
+static int
+bench_lat_cmp(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Ready for reading percentiles straight out of ns. */
+void
+bench_lat_sort(struct bench_latency *st)
+{
+
+	qsort(st->ns, st->len, sizeof(*st->ns), bench_lat_cmp);
+}
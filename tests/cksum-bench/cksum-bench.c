@@ -0,0 +1,184 @@
+/*
+ * in_cksum benchmark
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cksum.h"
+
+#ifndef __arraycount
+#define __arraycount(__x)	(sizeof(__x) / sizeof(__x[0]))
+#endif
+
+/* Largest buffer checked, plus room to misalign it. */
+#define	BUF_MAX		2048
+#define	BUF_ALIGN	8
+/* Number of random buffers checked against the reference. */
+#define	CHECKS		100000
+
+/* Typical BOOTP, minimum IP MTU and Ethernet MTU sizes. */
+static const size_t sizes[] = { 300, 576, 1500 };
+
+/* The simple 16-bit word sum in_cksum used to be. */
+static uint16_t
+ref_cksum(const void *data, size_t len, uint32_t *isum)
+{
+	const uint8_t *p = data;
+	uint32_t sum = isum != NULL ? *isum : 0;
+	uint16_t w;
+
+	for (; len > 1; len -= sizeof(w), p += sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		sum += w;
+	}
+	if (len == 1) {
+		uint8_t b[2] = { *p, 0 };
+
+		memcpy(&w, b, sizeof(w));
+		sum += w;
+	}
+
+	if (isum != NULL)
+		*isum = sum;
+
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+static void
+fill(uint8_t *buf, size_t len)
+{
+
+	while (len-- != 0)
+		*buf++ = (uint8_t)random();
+}
+
+static void
+check(void)
+{
+	uint8_t buf[BUF_MAX + BUF_ALIGN];
+	size_t i, len, off, split;
+	uint32_t isum, rsum;
+	uint16_t c, r, w, nw;
+
+	for (i = 0; i < CHECKS; i++) {
+		len = (size_t)random() % BUF_MAX;
+		off = (size_t)random() % BUF_ALIGN;
+		fill(buf + off, len);
+
+		c = in_cksum(buf + off, len, NULL);
+		r = ref_cksum(buf + off, len, NULL);
+		if (c != r)
+			errx(EXIT_FAILURE, "len %zu off %zu: 0x%04x != 0x%04x",
+			    len, off, c, r);
+
+		/* Chain two buffers through isum, as the UDP pseudo
+		 * header is. */
+		split = len == 0 ? 0 : ((size_t)random() % len) & ~(size_t)1;
+		isum = rsum = 0;
+		in_cksum(buf + off, split, &isum);
+		c = in_cksum(buf + off + split, len - split, &isum);
+		ref_cksum(buf + off, split, &rsum);
+		r = ref_cksum(buf + off + split, len - split, &rsum);
+		if (c != r)
+			errx(EXIT_FAILURE, "len %zu split %zu: 0x%04x != 0x%04x",
+			    len, split, c, r);
+
+		/* Patch one word and compare against a full sum. */
+		if (len < sizeof(w) * 2)
+			continue;
+		split = ((size_t)random() % (len - 1)) & ~(size_t)1;
+		memcpy(&w, buf + off + split, sizeof(w));
+		nw = (uint16_t)random();
+		memcpy(buf + off + split, &nw, sizeof(nw));
+		c = in_cksum_update(r, w, nw);
+		r = ref_cksum(buf + off, len, NULL);
+		/* 0x0000 and 0xffff are both zero in one's complement. */
+		if (c != r && !(c == 0xffff && r == 0) &&
+		    !(c == 0 && r == 0xffff))
+			errx(EXIT_FAILURE, "len %zu update %zu: 0x%04x != 0x%04x",
+			    len, split, c, r);
+	}
+	printf("checked %d buffers\n", CHECKS);
+}
+
+static double
+bench(uint16_t (*fn)(const void *, size_t, uint32_t *),
+    const uint8_t *buf, size_t len, unsigned long runs)
+{
+	struct timespec start, end;
+	volatile uint16_t sink = 0;
+	unsigned long i;
+	double secs;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	for (i = 0; i < runs; i++)
+		sink ^= fn(buf, len, NULL);
+	if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	(void)sink;
+
+	secs = (double)(end.tv_sec - start.tv_sec) +
+	    (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	return (double)len * (double)runs / secs / 1e6;
+}
+
+int
+main(int argc, char **argv)
+{
+	uint8_t buf[BUF_MAX];
+	unsigned long runs = 1000000;
+	size_t i;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "r:")) != -1) {
+		switch (ch) {
+		case 'r':
+			runs = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-r runs]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	srandom((unsigned int)time(NULL));
+	check();
+
+	fill(buf, sizeof(buf));
+	for (i = 0; i < __arraycount(sizes); i++)
+		printf("%4zu bytes: in_cksum %8.1f MB/s, reference %8.1f MB/s\n",
+		    sizes[i], bench(in_cksum, buf, sizes[i], runs),
+		    bench(ref_cksum, buf, sizes[i], runs));
+
+	exit(EXIT_SUCCESS);
+}
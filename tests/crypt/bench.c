@@ -0,0 +1,212 @@
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Time the digests dhcpcd uses at DHCP message sizes so changes to
+ * compat/crypt and auth.c can be compared against a baseline.
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "test.h"
+
+#if defined(HAVE_MD5_H) && !defined(DEPGEN)
+#include <md5.h>
+#endif
+#ifdef SHA2_H
+#include SHA2_H
+#endif
+#ifdef HAVE_HMAC_H
+#include <hmac.h>
+#endif
+
+#ifdef AUTH
+#include "auth.h"
+#include "dhcp6.h"
+#include "dhcpcd.h"
+
+#define AUTH_OFFSET	100
+#define AUTH_LEN	(1 + 1 + 1 + 8 + 4 + 16)
+#endif
+
+#ifndef __arraycount
+#define __arraycount(__x)	(sizeof(__x) / sizeof(__x[0]))
+#endif
+
+/* BOOTP minimum, the IPv4 minimum MTU, something between and Ethernet */
+static const size_t bench_sizes[] = { 300, 576, 1024, 1500 };
+
+#define BENCH_MAX	1500
+
+static uint8_t bench_buf[BENCH_MAX];
+static const uint8_t bench_key[16] = {
+	0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b,
+	0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b,
+};
+
+#ifdef AUTH
+static struct dhcpcd_ctx bench_ctx;
+static struct auth bench_auth = {
+	.options = DHCPCD_AUTH_SEND,
+	.protocol = AUTH_PROTO_DELAYED,
+	.algorithm = AUTH_ALG_HMAC_MD5,
+	.rdm = AUTH_RDM_MONOTONIC,
+};
+static struct token bench_token = {
+	.secretid = 42,
+	.key_len = sizeof(bench_key),
+};
+static struct authstate bench_state;
+#endif
+
+static void
+md5_run(size_t len)
+{
+	MD5_CTX ctx;
+	uint8_t digest[16];
+
+	MD5Init(&ctx);
+	MD5Update(&ctx, bench_buf, (unsigned int)len);
+	MD5Final(digest, &ctx);
+}
+
+static void
+hmac_run(size_t len)
+{
+	uint8_t digest[16];
+
+	hmac("md5", bench_key, sizeof(bench_key), bench_buf, len,
+	    digest, sizeof(digest));
+}
+
+#ifdef AUTH
+static void
+encode_run(size_t len)
+{
+
+	if (dhcp_auth_encode(&bench_ctx, &bench_auth, &bench_token,
+	    bench_buf, len, 6, DHCP6_REQUEST,
+	    bench_buf + AUTH_OFFSET, AUTH_LEN) != 0)
+		errx(EXIT_FAILURE, "dhcp_auth_encode");
+}
+
+static void
+validate_run(size_t len)
+{
+
+	/* Don't trip replay detection */
+	bench_state.replay = 0;
+	if (dhcp_auth_validate(&bench_state, &bench_auth, bench_buf, len,
+	    6, DHCP6_REPLY, bench_buf + AUTH_OFFSET, AUTH_LEN) != &bench_token)
+		errx(EXIT_FAILURE, "dhcp_auth_validate");
+}
+#endif
+
+static void
+sha256_run(size_t len)
+{
+	SHA256_CTX ctx;
+	uint8_t digest[32];
+
+	SHA256_Init(&ctx);
+	SHA256_Update(&ctx, bench_buf, len);
+	SHA256_Final(digest, &ctx);
+}
+
+/* setup, if given, is called untimed for each size first. */
+static void
+bench(const char *name, void (*setup)(size_t), void (*fn)(size_t),
+    unsigned long runs)
+{
+	struct timespec start, end;
+	unsigned long i;
+	size_t j, len;
+	double ns;
+
+	for (j = 0; j < __arraycount(bench_sizes); j++) {
+		len = bench_sizes[j];
+		if (setup != NULL)
+			setup(len);
+		if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+			err(EXIT_FAILURE, "clock_gettime");
+		for (i = 0; i < runs; i++)
+			fn(len);
+		if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+			err(EXIT_FAILURE, "clock_gettime");
+		ns = ((double)(end.tv_sec - start.tv_sec) * 1e9 +
+		    (double)(end.tv_nsec - start.tv_nsec)) / (double)runs;
+		printf("%-18s %5zu bytes %8.0f ns/call %8.1f MB/s\n",
+		    name, len, ns, (double)len * 1e3 / ns);
+	}
+}
+
+int
+bench_crypt(unsigned long runs)
+{
+	size_t i;
+#ifdef SHA256_HAVE_SELECT
+	const char *best;
+	char name[32];
+#endif
+
+	for (i = 0; i < sizeof(bench_buf); i++)
+		bench_buf[i] = (uint8_t)i;
+
+	bench("md5", NULL, md5_run, runs);
+	bench("hmac-md5", NULL, hmac_run, runs);
+#ifdef AUTH
+	bench_token.key = UNCONST(bench_key);
+	TAILQ_INIT(&bench_auth.tokens);
+	TAILQ_INSERT_TAIL(&bench_auth.tokens, &bench_token, next);
+	bench("auth encode", NULL, encode_run, runs);
+	bench("auth validate", encode_run, validate_run, runs);
+	free(bench_token.hmac);
+	bench_token.hmac = NULL;
+	/* Just the copy made of the token */
+	dhcp_auth_reset(&bench_state);
+#endif
+
+#ifdef SHA256_HAVE_SELECT
+	best = SHA256_Select(NULL);
+	for (i = 0; i < sha256_nimpls; i++) {
+		if (SHA256_Select(sha256_impls[i]) == NULL)
+			continue;
+		snprintf(name, sizeof(name), "sha256 %s", sha256_impls[i]);
+		bench(name, NULL, sha256_run, runs);
+	}
+	SHA256_Select(best);
+#else
+	bench("sha256", NULL, sha256_run, runs);
+#endif
+	return 0;
+}
@@ -25,14 +25,43 @@
  * SUCH DAMAGE.
  */
 
+#include <err.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 #include "test.h"
 
-int main(void)
+int main(int argc, char **argv)
 {
-	int r = 0;
+	int c, r = 0;
+	unsigned long runs = 0;
+
+	while ((c = getopt(argc, argv, "br:")) != -1) {
+		switch (c) {
+		case 'b':
+			if (runs == 0)
+				runs = 100000;
+			break;
+		case 'r':
+			runs = strtoul(optarg, NULL, 10);
+			if (runs == 0)
+				errx(EXIT_FAILURE, "invalid runs `%s'", optarg);
+			break;
+		default:
+			errx(EXIT_FAILURE, "usage: %s [-b] [-r runs]", argv[0]);
+		}
+	}
+
+	/* Benchmark rather than test */
+	if (runs != 0)
+		return bench_crypt(runs);
 
 	if (test_hmac_md5())
 		r = -1;
+	if (test_sha256())
+		r = -1;
+	if (test_auth_hmac())
+		r = -1;
 
 	return r;
 }
@@ -27,6 +27,14 @@
 
 #ifndef TEST_H
 
+#include <stddef.h>
+
+extern const char *const sha256_impls[];
+extern const size_t sha256_nimpls;
+
 int test_hmac_md5(void);
+int test_auth_hmac(void);
+int test_sha256(void);
+int bench_crypt(unsigned long);
 
 #endif
@@ -0,0 +1,140 @@
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* Check DHCP authentication signs and validates messages like hmac(). */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "test.h"
+
+#ifdef HAVE_HMAC_H
+#include <hmac.h>
+#endif
+
+#ifdef AUTH
+#include "auth.h"
+#include "dhcp6.h"
+#include "dhcpcd.h"
+
+#define MSG_LEN		548
+#define AUTH_OFFSET	100
+#define AUTH_LEN	(1 + 1 + 1 + 8 + 4 + 16)
+#define MAC_OFFSET	(AUTH_OFFSET + AUTH_LEN - 16)
+
+#ifdef PRIVSEP
+#include "privsep-root.h"
+
+/* Not called as the context is not privsep. */
+int
+ps_root_getauthrdm(__unused struct dhcpcd_ctx *ctx, __unused uint64_t *rdm)
+{
+
+	return -1;
+}
+#endif
+
+static struct dhcpcd_ctx ctx;
+
+static int
+auth_hmac_test(size_t key_len)
+{
+	struct auth auth = {
+		.options = DHCPCD_AUTH_SEND,
+		.protocol = AUTH_PROTO_DELAYED,
+		.algorithm = AUTH_ALG_HMAC_MD5,
+		.rdm = AUTH_RDM_MONOTONIC,
+	};
+	struct authstate state = { .replay = 0 };
+	struct token *t;
+	uint8_t m[MSG_LEN], mm[MSG_LEN], digest[16];
+	size_t j;
+
+	printf("HMAC MD5 %zu byte key:\t", key_len);
+	if ((t = calloc(1, sizeof(*t))) == NULL ||
+	    (t->key = malloc(key_len)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	t->secretid = 42;
+	t->key_len = key_len;
+	for (j = 0; j < key_len; j++)
+		t->key[j] = (uint8_t)(j * 7 + 1);
+	TAILQ_INIT(&auth.tokens);
+	TAILQ_INSERT_TAIL(&auth.tokens, t, next);
+
+	for (j = 0; j < sizeof(m); j++)
+		m[j] = (uint8_t)j;
+
+	/* The MAC written must be the one hmac() gives */
+	if (dhcp_auth_encode(&ctx, &auth, t, m, sizeof(m), 6, DHCP6_REQUEST,
+	    m + AUTH_OFFSET, AUTH_LEN) != 0)
+	{
+		fprintf(stderr, "FAILED! dhcp_auth_encode\n");
+		return -1;
+	}
+	memcpy(mm, m, sizeof(mm));
+	memset(mm + MAC_OFFSET, 0, 16);
+	hmac("md5", t->key, t->key_len, mm, sizeof(mm), digest, sizeof(digest));
+	if (memcmp(m + MAC_OFFSET, digest, sizeof(digest)) != 0) {
+		fprintf(stderr, "FAILED! MAC does not match hmac()\n");
+		return -1;
+	}
+	if (dhcp_auth_validate(&state, &auth, m, sizeof(m), 6, DHCP6_REPLY,
+	    m + AUTH_OFFSET, AUTH_LEN) != t)
+	{
+		fprintf(stderr, "FAILED! dhcp_auth_validate\n");
+		return -1;
+	}
+	m[MSG_LEN - 1] ^= 1;
+	if (dhcp_auth_validate(&state, &auth, m, sizeof(m), 6, DHCP6_REPLY,
+	    m + AUTH_OFFSET, AUTH_LEN) != NULL)
+	{
+		fprintf(stderr, "FAILED! altered message validated\n");
+		return -1;
+	}
+	printf("ok\n");
+
+	dhcp_auth_reset(&state);
+	dhcp_auth_token_free(t);
+	return 0;
+}
+#endif
+
+int test_auth_hmac(void)
+{
+
+#ifdef AUTH
+	printf("\nStarting DHCP authentication HMAC tests...\n\n");
+	if (auth_hmac_test(16) == -1 || auth_hmac_test(100) == -1)
+		return -1;
+	printf("\nAll tests pass.\n");
+#endif
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Check each SHA-256 implementation this CPU supports against the
+ * FIPS 180-2 test vectors.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "test.h"
+
+#ifdef SHA2_H
+#include SHA2_H
+#endif
+
+
+/* The implementations compat/crypt/sha256.c may have. */
+const char *const sha256_impls[] = { "portable", "sha-ni", "armv8" };
+const size_t sha256_nimpls = sizeof(sha256_impls) / sizeof(sha256_impls[0]);
+
+static const struct sha256_test {
+	const char *text;
+	size_t repeat;
+	uint8_t digest[32];
+} sha256_tests[] = {
+	{ "abc", 1, {
+	    0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea,
+	    0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+	    0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+	    0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+	} },
+	{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1, {
+	    0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8,
+	    0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+	    0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67,
+	    0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1,
+	} },
+	{ "aaaaaaaaaa", 100000, {
+	    0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92,
+	    0x81, 0xa1, 0xc7, 0xe2, 0x84, 0xd7, 0x3e, 0x67,
+	    0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e,
+	    0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0,
+	} },
+};
+
+static int
+sha256_test(const char *name)
+{
+	const struct sha256_test *t;
+	SHA256_CTX ctx;
+	uint8_t digest[32];
+	size_t i, j;
+
+	for (i = 0; i < sizeof(sha256_tests) / sizeof(sha256_tests[0]); i++) {
+		t = &sha256_tests[i];
+		printf("SHA256 %s Test %zu:\t", name, i + 1);
+		SHA256_Init(&ctx);
+		for (j = 0; j < t->repeat; j++)
+			SHA256_Update(&ctx, t->text, strlen(t->text));
+		SHA256_Final(digest, &ctx);
+		if (memcmp(digest, t->digest, sizeof(digest)) != 0) {
+			printf("FAILED!\n");
+			return -1;
+		}
+		printf("ok\n");
+	}
+	return 0;
+}
+
+int test_sha256(void)
+{
+	size_t i;
+	const char *best;
+
+	printf("\nStarting FIPS 180-2 SHA256 tests...\n\n");
+#ifdef SHA256_HAVE_SELECT
+	best = SHA256_Select(NULL);
+	for (i = 0; i < sha256_nimpls; i++) {
+		if (SHA256_Select(sha256_impls[i]) == NULL)
+			continue;
+		if (sha256_test(sha256_impls[i]) == -1)
+			return -1;
+	}
+	SHA256_Select(best);
+#else
+	/* The system SHA256 is used */
+	(void)i;
+	best = "system";
+	if (sha256_test(best) == -1)
+		return -1;
+#endif
+	printf("\nAll tests pass using %s.\n", best);
+	return 0;
+}
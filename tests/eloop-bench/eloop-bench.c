@@ -29,13 +29,18 @@
 
 #include <err.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "eloop.h"
 
+#include "bench.h"
+
 #ifndef timespecsub
 #define timespecsub(tsp, usp, vsp)                                      \
         do {                                                            \
@@ -48,15 +53,170 @@
         } while (/* CONSTCOND */ 0)
 #endif
 
+#ifndef __arraycount
+#define __arraycount(__x)	(sizeof(__x) / sizeof(__x[0]))
+#endif
+#ifndef __unused
+#define __unused		__attribute__((__unused__))
+#endif
+
+/* Timeouts are scheduled randomly up to this many milliseconds away. */
+#define	TIMER_MAX_MSEC	10
+/* In mixed mode, raise a signal after this many writes. */
+#define	SIGNAL_EVERY	10
+
+enum mode {
+	MODE_PIPE,
+	MODE_TIMER,
+	MODE_CHURN,
+	MODE_MIXED,
+};
+
+static const char * const mode_names[] = {
+	"pipe",
+	"timer",
+	"churn",
+	"mixed",
+};
+
 struct pipe {
 	int fd[2];
 };
 
+struct timer {
+	bool pending;
+};
+
 static size_t good, bad, writes, fired;
 static size_t npipes = 100, nwrites = 100, nactive = 1;
+static enum mode mode = MODE_PIPE;
 static struct pipe *pipes;
+static struct timer *timers;
+static size_t npending;
+static bool sig_pending;
+static struct timespec sig_ts;
 static struct eloop *e;
 
+static struct bench_latency lat_timer = { .name = "timer" };
+static struct bench_latency lat_churn = { .name = "churn" };
+static struct bench_latency lat_signal = { .name = "signal" };
+
+/* The time since ts. */
+static void
+lat_add(struct bench_latency *st, const struct timespec *ts)
+{
+
+	bench_lat_add(st, bench_now_ns() -
+	    ((unsigned long long)ts->tv_sec * NSEC_PER_SEC +
+	    (unsigned long long)ts->tv_nsec));
+}
+
+static void
+lat_print(struct bench_latency *st, const struct timespec *elapsed)
+{
+	double secs;
+
+	if (st->len == 0)
+		return;
+
+	bench_lat_sort(st);
+	secs = (double)elapsed->tv_sec + (double)elapsed->tv_nsec / 1e9;
+	printf("%s: %zu ops, %.0f ops/sec, p50 %llu ns, p99 %llu ns\n",
+	    st->name, st->len, secs > 0 ? (double)st->len / secs : 0,
+	    st->ns[st->len / 2], st->ns[(st->len * 99) / 100]);
+}
+
+static void
+check_done(void)
+{
+
+	if (writes != 0 || fired != good || sig_pending)
+		return;
+	if (mode == MODE_TIMER && npending != 0)
+		return;
+	eloop_exit(e, bad == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static void timer_cb(void *);
+
+static void
+timer_schedule(struct timer *t)
+{
+	struct timespec ts;
+
+	if (!t->pending) {
+		t->pending = true;
+		npending++;
+	}
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	if (eloop_timeout_add_msec(e, (unsigned long)random() % TIMER_MAX_MSEC,
+	    timer_cb, t) == -1)
+	{
+		warn("%s: eloop_timeout_add_msec", __func__);
+		bad++;
+	}
+	lat_add(&lat_timer, &ts);
+}
+
+static void
+timer_cb(void *arg)
+{
+	struct timer *t = arg;
+
+	t->pending = false;
+	npending--;
+
+	if (mode != MODE_TIMER)
+		return;
+
+	/* Keep this timer going and move another one about. */
+	if (writes != 0) {
+		writes--;
+		timer_schedule(t);
+	}
+	if (writes != 0) {
+		writes--;
+		timer_schedule(&timers[(size_t)random() % npipes]);
+	}
+	check_done();
+}
+
+static void read_cb(void *);
+
+static void
+churn(void)
+{
+	struct pipe *p = &pipes[(size_t)random() % npipes];
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	if (eloop_event_delete(e, p->fd[0]) == -1) {
+		warn("%s: eloop_event_delete", __func__);
+		bad++;
+	}
+	if (eloop_event_add(e, p->fd[0], read_cb, p) == -1) {
+		warn("%s: eloop_event_add", __func__);
+		bad++;
+	}
+	lat_add(&lat_churn, &ts);
+}
+
+static void
+signal_cb(int sig, __unused void *arg)
+{
+
+	if (sig != SIGUSR1 || !sig_pending) {
+		bad++;
+		return;
+	}
+	lat_add(&lat_signal, &sig_ts);
+	sig_pending = false;
+	check_done();
+}
+
 static void
 read_cb(void *arg)
 {
@@ -69,6 +229,19 @@ read_cb(void *arg)
 	} else
 		good++;
 
+	if (mode == MODE_CHURN || mode == MODE_MIXED)
+		churn();
+	if (mode == MODE_MIXED) {
+		timer_schedule(&timers[(size_t)random() % npipes]);
+		if (writes % SIGNAL_EVERY == 0 && !sig_pending) {
+			sig_pending = true;
+			if (clock_gettime(CLOCK_MONOTONIC, &sig_ts) == -1)
+				err(EXIT_FAILURE, "clock_gettime");
+			if (kill(getpid(), SIGUSR1) == -1)
+				err(EXIT_FAILURE, "kill");
+		}
+	}
+
 	if (writes != 0) {
 		writes--;
 		if (write(p->fd[1], "e", 1) != 1) {
@@ -78,15 +251,11 @@ read_cb(void *arg)
 			fired++;
 	}
 
-	if (writes == 0 && fired == good) {
-		//printf("fired %zu, good %zu, bad %zu\n", fired, good, bad);
-		eloop_exit(e, good == fired && bad == 0 ?
-		    EXIT_SUCCESS : EXIT_FAILURE);
-	}
+	check_done();
 }
 
 static int
-runone(struct timespec *t)
+runone(struct timespec *t, sigset_t *sigmask)
 {
 	size_t i;
 	struct pipe *p;
@@ -96,16 +265,24 @@ runone(struct timespec *t)
 	writes = nwrites;
 	fired = good = 0;
 
-	for (i = 0, p = pipes; i < nactive; i++, p++) {
-		if (write(p->fd[1], "e", 1) != 1)
-			err(EXIT_FAILURE, "send");
-		writes--;
-		fired++;
-	}
-
 	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
 		err(EXIT_FAILURE, "clock_gettime");
-	result = eloop_start(e, NULL);
+
+	if (mode == MODE_TIMER) {
+		for (i = 0; i < npipes; i++)
+			timer_schedule(&timers[i]);
+	} else {
+		for (i = 0, p = pipes; i < nactive; i++, p++) {
+			if (write(p->fd[1], "e", 1) != 1)
+				err(EXIT_FAILURE, "send");
+			writes--;
+			fired++;
+		}
+	}
+
+	/* The last run will have called eloop_exit. */
+	eloop_enter(e);
+	result = eloop_start(e, sigmask);
 	if (clock_gettime(CLOCK_MONOTONIC, &te) == -1)
 		err(EXIT_FAILURE, "clock_gettime");
 
@@ -119,13 +296,24 @@ main(int argc, char **argv)
 	int c, result, exit_code;
 	size_t i, nruns = 25;
 	struct pipe *p;
-	struct timespec ts, te, t;
+	struct timespec ts, te, t, elapsed;
+	const int sigs[] = { SIGUSR1 };
+	sigset_t oldset, *sigmask;
 
-	while ((c = getopt(argc, argv, "a:n:r:w:")) != -1) {
+	while ((c = getopt(argc, argv, "a:m:n:r:w:")) != -1) {
 		switch (c) {
 		case 'a':
 			nactive = (size_t)atoi(optarg);
 			break;
+		case 'm':
+			for (i = 0; i < __arraycount(mode_names); i++) {
+				if (strcmp(optarg, mode_names[i]) == 0)
+					break;
+			}
+			if (i == __arraycount(mode_names))
+				errx(EXIT_FAILURE, "unknown mode `%s'", optarg);
+			mode = (enum mode)i;
+			break;
 		case 'n':
 			npipes = (size_t)atoi(optarg);
 			break;
@@ -146,12 +334,29 @@ main(int argc, char **argv)
 	if ((e = eloop_new()) == NULL)
 		err(EXIT_FAILURE, "eloop_init");
 
+	if (npipes == 0)
+		errx(EXIT_FAILURE, "need at least one pipe");
 	if (nactive > npipes)
 		nactive = npipes;
 
+	/* Same sequence each time so backends can be compared. */
+	srandom(1);
+
 	pipes = calloc(npipes, sizeof(*p));
 	if (pipes == NULL)
 		err(EXIT_FAILURE, "malloc");
+	timers = calloc(npipes, sizeof(*timers));
+	if (timers == NULL)
+		err(EXIT_FAILURE, "malloc");
+
+	if (mode == MODE_MIXED) {
+		eloop_signal_set_cb(e, sigs, __arraycount(sigs),
+		    signal_cb, NULL);
+		if (eloop_signal_mask(e, &oldset) == -1)
+			err(EXIT_FAILURE, "eloop_signal_mask");
+		sigmask = &oldset;
+	} else
+		sigmask = NULL;
 
 	for (i = 0, p = pipes; i < npipes; i++, p++) {
 		if (pipe2(p->fd, O_CLOEXEC | O_NONBLOCK) == -1)
@@ -160,20 +365,37 @@ main(int argc, char **argv)
 			err(EXIT_FAILURE, "eloop_event_add");
 	}
 
-	printf("active = %zu, pipes = %zu, runs = %zu, writes = %zu\n",
-	    nactive, npipes, nruns, nwrites);
+	printf("mode = %s, active = %zu, pipes = %zu, runs = %zu, "
+	    "writes = %zu\n",
+	    mode_names[mode], nactive, npipes, nruns, nwrites);
 
 	exit_code = EXIT_SUCCESS;
+	elapsed.tv_sec = 0;
+	elapsed.tv_nsec = 0;
 	for (i = 0; i < nruns; i++) {
-		result = runone(&t);
+		result = runone(&t, sigmask);
 		if (result != EXIT_SUCCESS)
 			exit_code = result;
 		printf("run %zu took %lld.%.9ld seconds, result %d\n",
 		    i + 1, (long long)t.tv_sec, t.tv_nsec, result);
+		elapsed.tv_sec += t.tv_sec;
+		elapsed.tv_nsec += t.tv_nsec;
+		if (elapsed.tv_nsec >= NSEC_PER_SEC) {
+			elapsed.tv_sec++;
+			elapsed.tv_nsec -= NSEC_PER_SEC;
+		}
 	}
 
+	lat_print(&lat_timer, &elapsed);
+	lat_print(&lat_churn, &elapsed);
+	lat_print(&lat_signal, &elapsed);
+
 	eloop_free(e);
 	free(pipes);
+	free(timers);
+	free(lat_timer.ns);
+	free(lat_churn.ns);
+	free(lat_signal.ns);
 
 	if (clock_gettime(CLOCK_MONOTONIC, &te) == -1)
 		err(EXIT_FAILURE, "clock_gettime");
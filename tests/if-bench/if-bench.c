@@ -0,0 +1,317 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - interface walk and lookup benchmark
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <err.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "dhcpcd.h"
+#include "if-options.h"
+
+/* struct interface as it was before its fields were ordered by use. */
+struct flat_interface {
+	struct dhcpcd_ctx *ctx;
+	TAILQ_ENTRY(flat_interface) next;
+	char name[IF_NAMESIZE];
+	unsigned int index;
+	unsigned int active;
+	unsigned int flags;
+	uint16_t hwtype;
+	unsigned char hwaddr[HWADDR_LEN];
+	uint8_t hwlen;
+	unsigned short vlanid;
+	unsigned int metric;
+	int carrier;
+	bool wireless;
+	uint8_t ssid[IF_SSIDLEN];
+	unsigned int ssid_len;
+
+	char profile[PROFILE_LEN];
+	struct if_options *options;
+	void *if_data[IF_DATA_MAX];
+	struct arena arena;
+
+	rb_node_t index_tree;
+	unsigned int index_key;
+	rb_node_t name_tree;
+	bool name_indexed;
+
+	struct snapshot *snapshot;
+	uint32_t snapshot_hash;
+
+	uint32_t phases[PHASE_MAX];
+};
+TAILQ_HEAD(flat_head, flat_interface);
+
+/* Bigger than any last level cache we are likely to run on. */
+#define	EVICT_SIZE	(64 * 1024 * 1024)
+
+static unsigned int nifaces = 10000;
+static unsigned long runs = 50;
+static unsigned int *order;		/* list and lookup order */
+static struct if_options ifo;
+static uint8_t *evict;
+static volatile unsigned long sink;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* Leave none of the interfaces in the cache, as after handling
+ * a packet for something else. */
+static void
+evict_cache(void)
+{
+	size_t i;
+
+	for (i = 0; i < EVICT_SIZE; i += 64)
+		evict[i]++;
+}
+
+static void
+shuffle(unsigned int *a, unsigned int n)
+{
+	unsigned int i, j, t;
+
+	for (i = n - 1; i > 0; i--) {
+		j = (unsigned int)random() % (i + 1);
+		t = a[i];
+		a[i] = a[j];
+		a[j] = t;
+	}
+}
+
+/*
+ * The same walk and lookup for both layouts.
+ * The walk is the common shape of one over ctx->ifaces: skip the
+ * inactive, then look at a protocol state and the options.
+ * The lookup is finding an interface by index and dispatching a
+ * packet to its DHCP state.
+ */
+#define	IF_COMPARE(T, name)						      \
+static int								      \
+name##_cmpnodes(__unused void *c, const void *n1, const void *n2)	      \
+{									      \
+	const struct T *i1 = n1, *i2 = n2;				      \
+									      \
+	if (i1->index_key == i2->index_key)				      \
+		return 0;						      \
+	return i1->index_key < i2->index_key ? -1 : 1;			      \
+}									      \
+									      \
+static int								      \
+name##_cmpkey(__unused void *c, const void *n, const void *key)	      \
+{									      \
+	const struct T *ifp = n;					      \
+	unsigned int idx = *(const unsigned int *)key;			      \
+									      \
+	if (ifp->index_key == idx)					      \
+		return 0;						      \
+	return ifp->index_key < idx ? -1 : 1;				      \
+}									      \
+									      \
+static const rb_tree_ops_t name##_ops = {				      \
+	.rbto_compare_nodes = name##_cmpnodes,				      \
+	.rbto_compare_key = name##_cmpkey,				      \
+	.rbto_node_offset = offsetof(struct T, index_tree),		      \
+	.rbto_context = NULL						      \
+};
+
+#define	IF_BENCH(T, H, name)						      \
+IF_COMPARE(T, name)							      \
+									      \
+static struct H name##_head;						      \
+static rb_tree_t name##_tree;						      \
+									      \
+/* Interfaces come and go, so the list is not in address order.	      \
+ * The states they point to are never dereferenced. */			      \
+static void								      \
+name##_init(void)							      \
+{									      \
+	struct T **ifps;						      \
+	unsigned int i;							      \
+									      \
+	TAILQ_INIT(&name##_head);					      \
+	rb_tree_init(&name##_tree, &name##_ops);			      \
+	if ((ifps = calloc(nifaces, sizeof(*ifps))) == NULL)		      \
+		err(EXIT_FAILURE, "calloc");				      \
+	for (i = 0; i < nifaces; i++) {					      \
+		if ((ifps[i] = calloc(1, sizeof(**ifps))) == NULL)	      \
+			err(EXIT_FAILURE, "calloc");			      \
+		ifps[i]->index = ifps[i]->index_key = i + 1;		      \
+		ifps[i]->active = i % 4 == 0 ? 0 : IF_ACTIVE_USER;	      \
+		ifps[i]->options = &ifo;				      \
+		ifps[i]->if_data[IF_DATA_DHCP] = i % 3 == 0 ? NULL : &ifo;   \
+		rb_tree_insert_node(&name##_tree, ifps[i]);		      \
+	}								      \
+	for (i = 0; i < nifaces; i++)					      \
+		TAILQ_INSERT_TAIL(&name##_head, ifps[order[i]], next);	      \
+	free(ifps);							      \
+}									      \
+									      \
+static void								      \
+name##_free(void)							      \
+{									      \
+	struct T *ifp;							      \
+									      \
+	while ((ifp = TAILQ_FIRST(&name##_head)) != NULL) {		      \
+		TAILQ_REMOVE(&name##_head, ifp, next);			      \
+		free(ifp);						      \
+	}								      \
+}									      \
+									      \
+static double								      \
+name##_walk(void)							      \
+{									      \
+	const struct T *ifp;						      \
+	unsigned long n = 0;						      \
+	double start = now();						      \
+									      \
+	TAILQ_FOREACH(ifp, &name##_head, next) {			      \
+		if (!ifp->active)					      \
+			continue;					      \
+		if (ifp->if_data[IF_DATA_DHCP] != NULL &&		      \
+		    ifp->options->options & DHCPCD_DHCP)		      \
+			n++;						      \
+	}								      \
+	sink += n;							      \
+	return now() - start;						      \
+}									      \
+									      \
+static double								      \
+name##_lookup(void)							      \
+{									      \
+	const struct T *ifp;						      \
+	unsigned int i, idx;						      \
+	unsigned long n = 0;						      \
+	double start = now();						      \
+									      \
+	for (i = 0; i < nifaces; i++) {					      \
+		idx = order[i] + 1;					      \
+		ifp = rb_tree_find_node(&name##_tree, &idx);		      \
+		if (ifp != NULL && ifp->active && ifp->flags == 0 &&	      \
+		    ifp->if_data[IF_DATA_DHCP] != NULL &&		      \
+		    ifp->options->options & DHCPCD_DHCP)		      \
+			n++;						      \
+	}								      \
+	sink += n;							      \
+	return now() - start;						      \
+}
+
+IF_BENCH(interface, if_head, iface)
+IF_BENCH(flat_interface, flat_head, flat)
+
+enum { COLD_WALK, WARM_WALK, COLD_LOOKUP, WARM_LOOKUP, NTIMES };
+
+static const char *names[NTIMES] = {
+	"cold walk", "warm walk", "cold lookup", "warm lookup",
+};
+
+/* Each layout in turn, so neither is favoured by what ran before. */
+static void
+bench(double (*walk)(void), double (*lookup)(void), double *t)
+{
+
+	evict_cache();
+	t[COLD_WALK] += walk();
+	t[WARM_WALK] += walk();
+	evict_cache();
+	t[COLD_LOOKUP] += lookup();
+	t[WARM_LOOKUP] += lookup();
+}
+
+int
+main(int argc, char **argv)
+{
+	double t[NTIMES] = { 0 }, ft[NTIMES] = { 0 };
+	unsigned long r;
+	unsigned int i;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "i:r:")) != -1) {
+		switch (ch) {
+		case 'i':
+			nifaces = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			runs = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i interfaces] [-r runs]\n",
+			    argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (nifaces == 0 || runs == 0)
+		errx(EXIT_FAILURE, "interfaces and runs must be positive");
+
+	if ((evict = calloc(1, EVICT_SIZE)) == NULL ||
+	    (order = calloc(nifaces, sizeof(*order))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	for (i = 0; i < nifaces; i++)
+		order[i] = i;
+	srandom(1);
+	shuffle(order, nifaces);
+	ifo.options = DHCPCD_DHCP;
+
+	iface_init();
+	flat_init();
+	for (r = 0; r < runs; r++) {
+		bench(iface_walk, iface_lookup, t);
+		bench(flat_walk, flat_lookup, ft);
+	}
+
+	printf("%u interfaces of %zu bytes, %zu before\n", nifaces,
+	    sizeof(struct interface), sizeof(struct flat_interface));
+	for (i = 0; i < NTIMES; i++)
+		printf("%-12s %6.1f ns per interface, %6.1f before\n",
+		    names[i],
+		    t[i] / (double)runs / (double)nifaces,
+		    ft[i] / (double)runs / (double)nifaces);
+
+	iface_free();
+	flat_free();
+	free(order);
+	free(evict);
+	return EXIT_SUCCESS;
+}
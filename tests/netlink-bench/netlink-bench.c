@@ -0,0 +1,1200 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - netlink event storm benchmark
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <linux/filter.h>
+#include <linux/if_addr.h>
+#include <linux/if_link.h>
+#include <linux/neighbour.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <netinet/if_ether.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcpcd.h"
+#include "eloop.h"
+#include "if.h"
+#include "if-options.h"
+#include "ipv6.h"
+#include "logerr.h"
+#include "route.h"
+
+#include "bench.h"
+
+/*
+ * The whole of dhcpcd is linked in, but the link socket it reads is a
+ * pipe with a made up kernel behind it.
+ * recvmsg, read, setsockopt and getsockopt are wrapped with ld --wrap,
+ * so for the link socket dhcpcd reads the messages queued here, the
+ * filter it attaches is run over each and the receive buffer fills
+ * and overflows as the kernel's does.
+ * if_discover and reading /proc/net/if_inet6 are wrapped too, so
+ * learning the interfaces again after an overflow and checking IPv6
+ * addresses see the interfaces and addresses made up here.
+ * Messages are generated from an eloop timeout and read by the same
+ * calls dhcpcd_handlelink() makes, so what dhcpcd does with them,
+ * its own timeouts included, runs just as it would.
+ */
+
+#ifndef IFF_LOWER_UP
+#define	IFF_LOWER_UP		0x10000
+#endif
+/* From linux/if.h, which net/if.h can't be included with. */
+#ifndef IF_OPER_UP
+#define	IF_OPER_DOWN		2
+#define	IF_OPER_UP		6
+#endif
+#ifndef INFINITE_LIFETIME
+#define	INFINITE_LIFETIME	0xffffffffU
+#endif
+#ifndef RTPROT_BGP
+#define	RTPROT_BGP		186
+#endif
+
+/* net.core.rmem_default and rmem_max as most systems have them. */
+#define	RMEM_DEFAULT		212992
+/* The smallest receive buffer the kernel allows, near enough. */
+#define	SOCK_MIN_RCVBUF		2304
+/* What an sk_buff and its shared info cost on top of the data. */
+#define	SKB_OVERHEAD		256
+#define	SKB_SHINFO		320
+
+#define	KMSG_MAX		2048	/* biggest message made up */
+#define	ADDRS_MAX		32	/* addresses in a kif bitmap */
+#define	IF_INDEX_BASE		100000	/* well clear of real interfaces */
+#define	IF_INDEX_FOREIGN	200000	/* interfaces dhcpcd doesn't know */
+#define	DAEMON_PID		4242	/* a routing daemon */
+#define	LINK_AFSPEC_LEN		768	/* per family config in a link */
+#define	GEN_MSEC		1	/* how often messages are made */
+#define	OVERFLOWS_SHOWN		16
+
+/* One notification waiting in the socket. */
+struct kmsg {
+	unsigned long long queued;	/* ns, when the kernel sent it */
+	size_t len;
+	size_t truesize;		/* what it is charged to rmem */
+	unsigned int kind;
+	union {
+		struct nlmsghdr nlm;
+		uint8_t buf[KMSG_MAX];
+	} u;
+};
+
+/* The link socket as the kernel holds it. */
+struct ksock {
+	int fd[2];			/* readable while anything is */
+	bool readable;
+	struct kmsg *q;
+	size_t head, len, size;
+	size_t rmem;
+	int rcvbuf;			/* doubled, as the kernel keeps it */
+	int err;			/* reported before what is queued */
+	bool congested;			/* dropping until emptied */
+	struct sock_filter *filter;
+	unsigned short filter_len;
+};
+
+/* What the kernel knows of an interface. */
+struct kif {
+	unsigned int index;
+	char name[IF_NAMESIZE];
+	uint8_t hwaddr[ETHER_ADDR_LEN];
+	bool carrier;
+	uint32_t addr4, addr6, routes;	/* which of them are there */
+};
+
+struct kind {
+	const char *name;
+	void (*gen)(struct kif *);
+	unsigned int weight;
+	unsigned long long sent, filtered, dropped, read;
+	unsigned long long busy;	/* ns spent on those read */
+};
+
+struct overflow {
+	unsigned long long at;
+	int rcvbuf, rcvbuf_next;
+	size_t queued, rmem;
+	unsigned long long drained;
+	unsigned long long took;
+};
+
+ssize_t __real_recvmsg(int, struct msghdr *, int);
+ssize_t __real_read(int, void *, size_t);
+int __real_setsockopt(int, int, int, const void *, socklen_t);
+int __real_getsockopt(int, int, int, void *, socklen_t *);
+ssize_t __real_dhcp_readfile(struct dhcpcd_ctx *, const char *,
+    void *, size_t);
+
+ssize_t __wrap_recvmsg(int, struct msghdr *, int);
+ssize_t __wrap_read(int, void *, size_t);
+int __wrap_setsockopt(int, int, int, const void *, socklen_t);
+int __wrap_getsockopt(int, int, int, void *, socklen_t *);
+ssize_t __wrap_dhcp_readfile(struct dhcpcd_ctx *, const char *,
+    void *, size_t);
+struct if_head *__wrap_if_discover(struct dhcpcd_ctx *, struct ifaddrs **,
+    int, char * const *);
+
+static void gen_addr4(struct kif *);
+static void gen_addr6(struct kif *);
+static void gen_route(struct kif *);
+static void gen_daemon(struct kif *);
+static void gen_neigh(struct kif *);
+static void gen_arp(struct kif *);
+static void gen_link(struct kif *);
+static void gen_foreign(struct kif *);
+
+static struct kind kinds[] = {
+	{ .name = "addr4",	.gen = gen_addr4,	.weight = 2 },
+	{ .name = "addr6",	.gen = gen_addr6,	.weight = 2 },
+	{ .name = "route",	.gen = gen_route,	.weight = 2 },
+	{ .name = "daemon",	.gen = gen_daemon,	.weight = 4 },
+	{ .name = "neigh",	.gen = gen_neigh,	.weight = 2 },
+	{ .name = "arp",	.gen = gen_arp,		.weight = 2 },
+	{ .name = "link",	.gen = gen_link,	.weight = 1 },
+	{ .name = "foreign",	.gen = gen_foreign,	.weight = 1 },
+};
+
+static struct dhcpcd_ctx ctx;
+static struct ksock sk = { .fd = { -1, -1 }, .rcvbuf = RMEM_DEFAULT * 2 };
+static struct kif *kifs;
+static unsigned int nifaces = 64;
+static unsigned int naddrs = 2;
+static unsigned long rate = 50000;
+static unsigned long burst = 1;
+static unsigned long duration = 1000;
+static int rmem_max = RMEM_DEFAULT;
+static bool privileged = true;
+
+/* The message being made up. */
+static struct kmsg kmsg;
+
+static unsigned long long started, nbursts;
+static bool generating;
+static struct bench_latency latency;
+static unsigned long long busy, ndrained;
+static struct overflow *overflows;
+static size_t noverflows;
+
+/* Which message was read last and when, to account its handling. */
+static struct kind *reading;
+static unsigned long long reading_at;
+
+/* /proc/net/if_inet6 as it would read now. */
+static char *proc_inet6;
+static size_t proc_inet6_len;
+static bool proc_inet6_stale = true;
+
+/* Charge the time since the last read to what it read. */
+static void
+account(unsigned long long t)
+{
+
+	if (reading != NULL) {
+		reading->busy += t - reading_at;
+		reading = NULL;
+	}
+}
+
+/*
+ * The kernel socket.
+ */
+
+/* The pipe holds a byte while there is something to read. */
+static void
+ksock_wake(void)
+{
+	bool readable = sk.len != 0 || sk.err != 0;
+	char c = 'k';
+
+	if (readable == sk.readable)
+		return;
+	if (readable) {
+		if (write(sk.fd[1], &c, sizeof(c)) != sizeof(c))
+			err(EXIT_FAILURE, "%s: write", __func__);
+	} else {
+		if (__real_read(sk.fd[0], &c, sizeof(c)) != sizeof(c))
+			err(EXIT_FAILURE, "%s: read", __func__);
+	}
+	sk.readable = readable;
+}
+
+/* As sk_filter() runs a classic BPF program over a message.
+ * Just what dhcpcd's link filter needs is understood. */
+static unsigned int
+ksock_filter(const uint8_t *p, size_t len)
+{
+	const struct sock_filter *f;
+	uint32_t a = 0;
+	size_t pc;
+
+	if (sk.filter == NULL)
+		return (unsigned int)len;
+
+	for (pc = 0; pc < sk.filter_len; pc++) {
+		f = &sk.filter[pc];
+		switch (f->code) {
+		case BPF_LD + BPF_W + BPF_ABS:
+			if (f->k + 4 > len)
+				return 0;
+			a = (uint32_t)p[f->k] << 24 |
+			    (uint32_t)p[f->k + 1] << 16 |
+			    (uint32_t)p[f->k + 2] << 8 | p[f->k + 3];
+			break;
+		case BPF_LD + BPF_H + BPF_ABS:
+			if (f->k + 2 > len)
+				return 0;
+			a = (uint32_t)p[f->k] << 8 | p[f->k + 1];
+			break;
+		case BPF_LD + BPF_B + BPF_ABS:
+			if (f->k + 1 > len)
+				return 0;
+			a = p[f->k];
+			break;
+		case BPF_JMP + BPF_JA:
+			pc += f->k;
+			break;
+		case BPF_JMP + BPF_JEQ + BPF_K:
+			pc += a == f->k ? f->jt : f->jf;
+			break;
+		case BPF_RET + BPF_K:
+			return f->k;
+		default:
+			errx(EXIT_FAILURE, "%s: instruction 0x%x at %zu",
+			    __func__, f->code, pc);
+		}
+	}
+	return 0;
+}
+
+/* Data is allocated in power of two sizes with the shared info at the
+ * end, as __alloc_skb() has it. */
+static size_t
+ksock_truesize(size_t len)
+{
+	size_t size = ((len + 63) & ~(size_t)63) + SKB_SHINFO, alloc;
+
+	for (alloc = 512; alloc < size; alloc <<= 1)
+		;
+	return alloc + SKB_OVERHEAD;
+}
+
+/*
+ * Send kmsg to the socket as netlink_broadcast() would.
+ * A message is queued so long as what is queued is still within the
+ * buffer, so the last one can go over.
+ * Once one is dropped the socket reports ENOBUFS and drops the rest
+ * until everything queued has been read.
+ */
+static void
+ksock_send(void)
+{
+	struct kind *k = &kinds[kmsg.kind];
+	struct kmsg *q;
+	unsigned int snap;
+	size_t i, n;
+
+	k->sent++;
+	kmsg.len = kmsg.u.nlm.nlmsg_len;
+	kmsg.truesize = ksock_truesize(kmsg.len);
+	snap = ksock_filter(kmsg.u.buf, kmsg.len);
+	if (snap == 0) {
+		k->filtered++;
+		return;
+	}
+	if (snap < kmsg.len)
+		kmsg.len = snap;
+
+	if (sk.rmem > (size_t)sk.rcvbuf || sk.congested) {
+		k->dropped++;
+		if (!sk.congested) {
+			sk.congested = true;
+			sk.err = ENOBUFS;
+			ksock_wake();
+		}
+		return;
+	}
+
+	if (sk.len == sk.size) {
+		n = sk.size == 0 ? 1024 : sk.size * 2;
+		if ((q = malloc(n * sizeof(*q))) == NULL)
+			err(EXIT_FAILURE, "malloc");
+		for (i = 0; i < sk.len; i++)
+			memcpy(&q[i], &sk.q[(sk.head + i) % sk.size],
+			    sizeof(*q));
+		free(sk.q);
+		sk.q = q;
+		sk.head = 0;
+		sk.size = n;
+	}
+	q = &sk.q[(sk.head + sk.len) % sk.size];
+	memcpy(q, &kmsg, offsetof(struct kmsg, u) + kmsg.len);
+	sk.len++;
+	sk.rmem += kmsg.truesize;
+	ksock_wake();
+}
+
+/* netlink_recvmsg(), one message each time. */
+static ssize_t
+ksock_recv(void *buf, size_t len, struct msghdr *msg)
+{
+	struct kmsg *m;
+	struct sockaddr_nl *nladdr;
+	unsigned long long t;
+	size_t n;
+
+	t = bench_now_ns();
+	account(t);
+	if (sk.err != 0) {
+		errno = sk.err;
+		sk.err = 0;
+		ksock_wake();
+		return -1;
+	}
+	if (sk.len == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	m = &sk.q[sk.head];
+	n = MIN(m->len, len);
+	memcpy(buf, m->u.buf, n);
+	if (msg != NULL) {
+		if (msg->msg_name != NULL &&
+		    msg->msg_namelen >= sizeof(*nladdr))
+		{
+			nladdr = msg->msg_name;
+			memset(nladdr, 0, sizeof(*nladdr));
+			nladdr->nl_family = AF_NETLINK;
+			msg->msg_namelen = sizeof(*nladdr);
+		}
+		msg->msg_controllen = 0;
+		msg->msg_flags = n < m->len ? MSG_TRUNC : 0;
+		bench_lat_add(&latency, t - m->queued);
+		reading = &kinds[m->kind];
+		reading->read++;
+		reading_at = t;
+	} else
+		ndrained++;
+
+	sk.head = (sk.head + 1) % sk.size;
+	sk.len--;
+	sk.rmem -= m->truesize;
+	if (sk.len == 0)
+		sk.congested = false;
+	ksock_wake();
+	return (ssize_t)n;
+}
+
+ssize_t
+__wrap_recvmsg(int fd, struct msghdr *msg, int flags)
+{
+
+	if (fd != sk.fd[0])
+		return __real_recvmsg(fd, msg, flags);
+	if (msg->msg_iovlen == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return ksock_recv(msg->msg_iov[0].iov_base,
+	    msg->msg_iov[0].iov_len, msg);
+}
+
+ssize_t
+__wrap_read(int fd, void *buf, size_t len)
+{
+
+	if (fd != sk.fd[0])
+		return __real_read(fd, buf, len);
+	return ksock_recv(buf, len, NULL);
+}
+
+int
+__wrap_setsockopt(int fd, int level, int name, const void *val,
+    socklen_t len)
+{
+	const struct sock_fprog *fprog;
+	int v;
+
+	if (fd != sk.fd[0])
+		return __real_setsockopt(fd, level, name, val, len);
+	/* Netlink options make no difference here. */
+	if (level != SOL_SOCKET)
+		return 0;
+
+	switch (name) {
+	case SO_RCVBUFFORCE:
+		if (!privileged) {
+			errno = EPERM;
+			return -1;
+		}
+		/* FALLTHROUGH */
+	case SO_RCVBUF:
+		if (len < sizeof(v)) {
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(&v, val, sizeof(v));
+		if (name == SO_RCVBUF && v > rmem_max)
+			v = rmem_max;
+		if (v < 0 || v > INT_MAX / 2)
+			v = v < 0 ? 0 : INT_MAX / 2;
+		sk.rcvbuf = MAX(v * 2, SOCK_MIN_RCVBUF);
+		return 0;
+	case SO_ATTACH_FILTER:
+		if (len < sizeof(*fprog)) {
+			errno = EINVAL;
+			return -1;
+		}
+		fprog = val;
+		free(sk.filter);
+		sk.filter = malloc(fprog->len * sizeof(*sk.filter));
+		if (sk.filter == NULL)
+			return -1;
+		memcpy(sk.filter, fprog->filter,
+		    fprog->len * sizeof(*sk.filter));
+		sk.filter_len = fprog->len;
+		return 0;
+	case SO_DETACH_FILTER:
+		free(sk.filter);
+		sk.filter = NULL;
+		sk.filter_len = 0;
+		return 0;
+	}
+	return 0;
+}
+
+int
+__wrap_getsockopt(int fd, int level, int name, void *val, socklen_t *len)
+{
+
+	if (fd != sk.fd[0])
+		return __real_getsockopt(fd, level, name, val, len);
+	if (level != SOL_SOCKET || name != SO_RCVBUF || *len < sizeof(int)) {
+		errno = ENOPROTOOPT;
+		return -1;
+	}
+	memcpy(val, &sk.rcvbuf, sizeof(sk.rcvbuf));
+	*len = sizeof(sk.rcvbuf);
+	return 0;
+}
+
+/*
+ * What the kernel reports of the interfaces.
+ */
+
+static void
+proc_inet6_add(char **p, const uint8_t *a, unsigned int index,
+    unsigned int prefix, unsigned int scope, unsigned int flags,
+    const char *name)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		*p += sprintf(*p, "%.2x", a[i]);
+	*p += sprintf(*p, " %.2x %.2x %.2x %.2x %8s\n",
+	    index, prefix, scope, flags, name);
+}
+
+static void
+addr6_make(uint8_t *a, const struct kif *kif, unsigned int k)
+{
+	unsigned int i = kif->index - IF_INDEX_BASE;
+
+	memset(a, 0, 16);
+	a[0] = 0xfd;
+	a[6] = (uint8_t)(i >> 8);
+	a[7] = (uint8_t)i;
+	a[15] = (uint8_t)(k + 1);
+}
+
+static void
+ll6_make(uint8_t *a, const struct kif *kif)
+{
+
+	memset(a, 0, 16);
+	a[0] = 0xfe;
+	a[1] = 0x80;
+	a[8] = kif->hwaddr[0] ^ 0x02;
+	a[9] = kif->hwaddr[1];
+	a[10] = kif->hwaddr[2];
+	a[11] = 0xff;
+	a[12] = 0xfe;
+	a[13] = kif->hwaddr[3];
+	a[14] = kif->hwaddr[4];
+	a[15] = kif->hwaddr[5];
+}
+
+/* Each interface has its link-local address and those made up. */
+static void
+proc_inet6_make(void)
+{
+	struct kif *kif;
+	uint8_t a[16];
+	unsigned int i, k;
+	size_t size;
+	char *p;
+
+	/* A line is 32 hex digits and up to 28 more. */
+	size = (size_t)nifaces * (naddrs + 1) * 64 + 1;
+	if (proc_inet6 == NULL && (proc_inet6 = malloc(size)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	p = proc_inet6;
+	for (i = 0; i < nifaces; i++) {
+		kif = &kifs[i];
+		ll6_make(a, kif);
+		proc_inet6_add(&p, a, kif->index, 64, 0x20, IFA_F_PERMANENT,
+		    kif->name);
+		for (k = 0; k < naddrs; k++) {
+			if (!(kif->addr6 & (1U << k)))
+				continue;
+			addr6_make(a, kif, k);
+			proc_inet6_add(&p, a, kif->index, 64, 0,
+			    IFA_F_PERMANENT, kif->name);
+		}
+	}
+	proc_inet6_len = (size_t)(p - proc_inet6);
+	proc_inet6_stale = false;
+}
+
+ssize_t
+__wrap_dhcp_readfile(struct dhcpcd_ctx *c, const char *file,
+    void *data, size_t len)
+{
+
+	if (strcmp(file, "/proc/net/if_inet6") != 0)
+		return __real_dhcp_readfile(c, file, data, len);
+	if (proc_inet6_stale)
+		proc_inet6_make();
+	len = MIN(len, proc_inet6_len);
+	memcpy(data, proc_inet6, len);
+	return (ssize_t)len;
+}
+
+/* The interfaces as they are now, without addresses. */
+struct if_head *
+__wrap_if_discover(struct dhcpcd_ctx *c, struct ifaddrs **ifaddrs,
+    __unused int argc, __unused char * const *argv)
+{
+	struct if_head *ifs;
+	struct interface *ifp;
+	struct kif *kif;
+	unsigned int i;
+
+	*ifaddrs = NULL;
+	if ((ifs = malloc(sizeof(*ifs))) == NULL)
+		return NULL;
+	TAILQ_INIT(ifs);
+	for (i = 0; i < nifaces; i++) {
+		kif = &kifs[i];
+		if ((ifp = calloc(1, sizeof(*ifp))) == NULL)
+			err(EXIT_FAILURE, "calloc");
+		ifp->ctx = c;
+		strlcpy(ifp->name, kif->name, sizeof(ifp->name));
+		ifp->index = kif->index;
+		ifp->flags = IFF_UP | IFF_BROADCAST | IFF_MULTICAST;
+		if (kif->carrier)
+			ifp->flags |= IFF_RUNNING;
+		ifp->hwtype = ARPHRD_ETHER;
+		ifp->hwlen = ETHER_ADDR_LEN;
+		memcpy(ifp->hwaddr, kif->hwaddr, ETHER_ADDR_LEN);
+		ifp->carrier = kif->carrier ? LINK_UP : LINK_DOWN;
+		ifp->active = IF_ACTIVE_USER;
+		TAILQ_INSERT_TAIL(ifs, ifp, next);
+	}
+	return ifs;
+}
+
+/*
+ * Made up notifications, as the kernel words them.
+ */
+
+static void *
+nl_start(uint16_t type, size_t len, uint32_t pid)
+{
+
+	memset(&kmsg.u, 0, NLMSG_SPACE(len));
+	kmsg.u.nlm.nlmsg_len = (uint32_t)NLMSG_LENGTH(len);
+	kmsg.u.nlm.nlmsg_type = type;
+	kmsg.u.nlm.nlmsg_pid = pid;
+	return NLMSG_DATA(&kmsg.u.nlm);
+}
+
+static void
+nl_attr(uint16_t type, const void *data, size_t len)
+{
+	struct nlmsghdr *nlm = &kmsg.u.nlm;
+	struct rtattr *rta;
+
+	rta = (void *)((char *)nlm + NLMSG_ALIGN(nlm->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = (unsigned short)RTA_LENGTH(len);
+	if (data != NULL)
+		memcpy(RTA_DATA(rta), data, len);
+	else
+		memset(RTA_DATA(rta), 0, len);
+	nlm->nlmsg_len = NLMSG_ALIGN(nlm->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+static void
+nl_attr32(uint16_t type, uint32_t v)
+{
+
+	nl_attr(type, &v, sizeof(v));
+}
+
+static void
+nl_attr8(uint16_t type, uint8_t v)
+{
+
+	nl_attr(type, &v, sizeof(v));
+}
+
+/* 10.x.y.k+1/24, where x.y is the interface. */
+static uint32_t
+addr4_make(const struct kif *kif, unsigned int k)
+{
+	unsigned int i = kif->index - IF_INDEX_BASE;
+
+	return htonl(0x0a000000U | (i & 0xffff) << 8 | (k + 1));
+}
+
+/* Each message adds an address which isn't there, else deletes it. */
+static bool
+toggle(uint32_t *bits, unsigned int k)
+{
+
+	*bits ^= 1U << k;
+	return *bits & (1U << k);
+}
+
+static void
+gen_ifaddr4(unsigned int index, const char *name, uint32_t addr, bool add)
+{
+	struct ifaddrmsg *ifa;
+	struct ifa_cacheinfo ci = {
+		.ifa_prefered = INFINITE_LIFETIME,
+		.ifa_valid = INFINITE_LIFETIME,
+	};
+	char label[IF_NAMESIZE];
+	uint32_t brd = addr | htonl(0xff);
+
+	ifa = nl_start(add ? RTM_NEWADDR : RTM_DELADDR, sizeof(*ifa), 0);
+	ifa->ifa_family = AF_INET;
+	ifa->ifa_prefixlen = 24;
+	ifa->ifa_flags = IFA_F_PERMANENT;
+	ifa->ifa_index = index;
+	nl_attr(IFA_ADDRESS, &addr, sizeof(addr));
+	nl_attr(IFA_LOCAL, &addr, sizeof(addr));
+	nl_attr(IFA_BROADCAST, &brd, sizeof(brd));
+	strlcpy(label, name, sizeof(label));
+	nl_attr(IFA_LABEL, label, strlen(label) + 1);
+	nl_attr32(IFA_FLAGS, IFA_F_PERMANENT);
+	nl_attr(IFA_CACHEINFO, &ci, sizeof(ci));
+	ksock_send();
+}
+
+static void
+gen_addr4(struct kif *kif)
+{
+	unsigned int k = (unsigned int)random() % naddrs;
+	bool add = toggle(&kif->addr4, k);
+
+	gen_ifaddr4(kif->index, kif->name, addr4_make(kif, k), add);
+}
+
+static void
+gen_addr6(struct kif *kif)
+{
+	struct ifaddrmsg *ifa;
+	struct ifa_cacheinfo ci = {
+		.ifa_prefered = INFINITE_LIFETIME,
+		.ifa_valid = INFINITE_LIFETIME,
+	};
+	unsigned int k = (unsigned int)random() % naddrs;
+	bool add = toggle(&kif->addr6, k);
+	uint8_t a[16];
+
+	proc_inet6_stale = true;
+	addr6_make(a, kif, k);
+	ifa = nl_start(add ? RTM_NEWADDR : RTM_DELADDR, sizeof(*ifa), 0);
+	ifa->ifa_family = AF_INET6;
+	ifa->ifa_prefixlen = 64;
+	ifa->ifa_flags = IFA_F_PERMANENT;
+	ifa->ifa_index = kif->index;
+	nl_attr(IFA_ADDRESS, a, sizeof(a));
+	nl_attr(IFA_CACHEINFO, &ci, sizeof(ci));
+	nl_attr32(IFA_FLAGS, IFA_F_PERMANENT);
+	ksock_send();
+}
+
+static void
+gen_rt4(bool add, uint32_t pid, uint8_t protocol, uint8_t scope,
+    uint32_t dst, uint32_t gw, uint32_t src, const struct kif *kif)
+{
+	struct rtmsg *rtm;
+
+	rtm = nl_start(add ? RTM_NEWROUTE : RTM_DELROUTE, sizeof(*rtm), pid);
+	rtm->rtm_family = AF_INET;
+	rtm->rtm_dst_len = 24;
+	rtm->rtm_table = RT_TABLE_MAIN;
+	rtm->rtm_protocol = protocol;
+	rtm->rtm_scope = scope;
+	rtm->rtm_type = RTN_UNICAST;
+	nl_attr32(RTA_TABLE, RT_TABLE_MAIN);
+	nl_attr(RTA_DST, &dst, sizeof(dst));
+	if (gw != INADDR_ANY)
+		nl_attr(RTA_GATEWAY, &gw, sizeof(gw));
+	if (src != INADDR_ANY)
+		nl_attr(RTA_PREFSRC, &src, sizeof(src));
+	nl_attr32(RTA_PRIORITY, 20);
+	nl_attr32(RTA_OIF, kif->index);
+	ksock_send();
+}
+
+/* Prefix routes from addresses coming and going, 100.64/10. */
+static void
+gen_route(struct kif *kif)
+{
+	unsigned int i = kif->index - IF_INDEX_BASE;
+	unsigned int k = (unsigned int)random() % naddrs;
+	bool add = toggle(&kif->routes, k);
+	uint32_t dst;
+
+	dst = htonl(0x64400000U | ((i * ADDRS_MAX + k) & 0x3fff) << 8);
+	gen_rt4(add, 0, RTPROT_KERNEL, RT_SCOPE_LINK,
+	    dst, INADDR_ANY, addr4_make(kif, 0), kif);
+}
+
+/* A routing daemon churning its table, 198.18/15. */
+static void
+gen_daemon(struct kif *kif)
+{
+	uint32_t dst, gw;
+
+	dst = htonl(0xc6120000U | ((uint32_t)random() & 0x1ff) << 8);
+	gw = addr4_make(kif, 253);
+	gen_rt4(random() & 1, DAEMON_PID, RTPROT_BGP, RT_SCOPE_UNIVERSE,
+	    dst, gw, INADDR_ANY, kif);
+}
+
+static void
+gen_nd(const struct kif *kif, uint8_t family, const void *dst, size_t len)
+{
+	static const uint16_t states[] = {
+		NUD_REACHABLE, NUD_STALE, NUD_DELAY, NUD_PROBE, NUD_FAILED,
+	};
+	struct ndmsg *ndm;
+	struct nda_cacheinfo ci = { .ndm_refcnt = 1 };
+	uint8_t lladdr[ETHER_ADDR_LEN] = { 0x02, 0x00, 0x5e, 0xfe };
+	bool add = random() % 8 != 0;
+
+	lladdr[4] = (uint8_t)random();
+	lladdr[5] = (uint8_t)random();
+	ndm = nl_start(add ? RTM_NEWNEIGH : RTM_DELNEIGH, sizeof(*ndm), 0);
+	ndm->ndm_family = family;
+	ndm->ndm_ifindex = (int)kif->index;
+	ndm->ndm_state = states[(size_t)random() % __arraycount(states)];
+	ndm->ndm_type = RTN_UNICAST;
+	nl_attr(NDA_DST, dst, len);
+	nl_attr(NDA_LLADDR, lladdr, sizeof(lladdr));
+	nl_attr32(NDA_PROBES, 0);
+	nl_attr(NDA_CACHEINFO, &ci, sizeof(ci));
+	ksock_send();
+}
+
+/* Neighbours on the link, some of them routers. */
+static void
+gen_neigh(struct kif *kif)
+{
+	uint8_t a[16] = { 0xfe, 0x80 };
+
+	a[14] = (uint8_t)random();
+	a[15] = (uint8_t)random();
+	gen_nd(kif, AF_INET6, a, sizeof(a));
+}
+
+static void
+gen_arp(struct kif *kif)
+{
+	uint32_t a = addr4_make(kif, (unsigned int)random() % 200 + 20);
+
+	gen_nd(kif, AF_INET, &a, sizeof(a));
+}
+
+/* The carrier going and coming back. */
+static void
+gen_link(struct kif *kif)
+{
+	struct ifinfomsg *ifi;
+	struct rtnl_link_stats64 st64;
+	struct rtnl_link_stats st;
+	uint8_t brd[ETHER_ADDR_LEN];
+	char name[IF_NAMESIZE];
+
+	kif->carrier = !kif->carrier;
+	ifi = nl_start(RTM_NEWLINK, sizeof(*ifi), 0);
+	ifi->ifi_family = AF_UNSPEC;
+	ifi->ifi_type = ARPHRD_ETHER;
+	ifi->ifi_index = (int)kif->index;
+	ifi->ifi_flags = IFF_UP | IFF_BROADCAST | IFF_MULTICAST;
+	if (kif->carrier)
+		ifi->ifi_flags |= IFF_RUNNING | IFF_LOWER_UP;
+	ifi->ifi_change = IFF_RUNNING | IFF_LOWER_UP;
+	strlcpy(name, kif->name, sizeof(name));
+	nl_attr(IFLA_IFNAME, name, strlen(name) + 1);
+	nl_attr32(IFLA_TXQLEN, 1000);
+	nl_attr8(IFLA_OPERSTATE, kif->carrier ? IF_OPER_UP : IF_OPER_DOWN);
+	nl_attr8(IFLA_LINKMODE, 0);
+	nl_attr32(IFLA_MTU, 1500);
+	nl_attr(IFLA_ADDRESS, kif->hwaddr, sizeof(kif->hwaddr));
+	memset(brd, 0xff, sizeof(brd));
+	nl_attr(IFLA_BROADCAST, brd, sizeof(brd));
+	memset(&st64, 0, sizeof(st64));
+	nl_attr(IFLA_STATS64, &st64, sizeof(st64));
+	memset(&st, 0, sizeof(st));
+	nl_attr(IFLA_STATS, &st, sizeof(st));
+	nl_attr(IFLA_AF_SPEC, NULL, LINK_AFSPEC_LEN);
+	ksock_send();
+}
+
+/* Addresses on interfaces dhcpcd doesn't know, such as containers'. */
+static void
+gen_foreign(__unused struct kif *kif)
+{
+	unsigned int i = (unsigned int)random() % 1024;
+	char name[IF_NAMESIZE];
+
+	snprintf(name, sizeof(name), "veth%u", i);
+	gen_ifaddr4(IF_INDEX_FOREIGN + i, name,
+	    htonl(0xac100000U | i << 8 | 1), random() & 1);
+}
+
+/*
+ * The storm.
+ */
+
+static unsigned int weights;
+
+static void
+gen_one(unsigned long long queued)
+{
+	unsigned int w = (unsigned int)random() % weights, k;
+
+	for (k = 0; w >= kinds[k].weight; k++)
+		w -= kinds[k].weight;
+	kmsg.kind = k;
+	kmsg.queued = queued;
+	kinds[k].gen(&kifs[(size_t)random() % nifaces]);
+}
+
+static void
+check_done(void)
+{
+
+	if (!generating && sk.len == 0 && sk.err == 0)
+		eloop_exit(ctx.eloop, EXIT_SUCCESS);
+}
+
+/* Send the bursts due since last time, each when it should have been
+ * sent so time spent away from the loop counts against latency. */
+static void
+generate(__unused void *arg)
+{
+	unsigned long long t, due, b;
+	unsigned long i;
+
+	t = bench_now_ns() - started;
+	if (t > duration * NSEC_PER_MSEC)
+		t = duration * NSEC_PER_MSEC;
+	due = t * rate / burst / NSEC_PER_SEC + 1;
+	for (; nbursts < due; nbursts++) {
+		b = started + nbursts * burst * NSEC_PER_SEC / rate;
+		for (i = 0; i < burst; i++)
+			gen_one(b);
+	}
+
+	if (t == duration * NSEC_PER_MSEC) {
+		generating = false;
+		check_done();
+		return;
+	}
+	if (eloop_timeout_add_msec(ctx.eloop, GEN_MSEC, generate, NULL) == -1)
+		err(EXIT_FAILURE, "eloop_timeout_add_msec");
+}
+
+/* What dhcpcd_handlelink() does, timed. */
+static void
+handle_link(void *arg)
+{
+	struct dhcpcd_ctx *c = arg;
+	struct overflow *o;
+	unsigned long long t, drained;
+	int r;
+
+	t = bench_now_ns();
+	r = if_handlelink(c);
+	account(bench_now_ns());
+	busy += bench_now_ns() - t;
+	if (r == -1) {
+		if (errno == ENOBUFS || errno == ENOMEM) {
+			o = reallocarray(overflows, noverflows + 1,
+			    sizeof(*overflows));
+			if (o == NULL)
+				err(EXIT_FAILURE, "reallocarray");
+			overflows = o;
+			o = &overflows[noverflows++];
+			o->at = bench_now_ns() - started;
+			o->rcvbuf = sk.rcvbuf / 2;
+			o->queued = sk.len;
+			o->rmem = sk.rmem;
+			drained = ndrained;
+			t = bench_now_ns();
+			dhcpcd_linkoverflow(c);
+			o->took = bench_now_ns() - t;
+			busy += o->took;
+			o->drained = ndrained - drained;
+			o->rcvbuf_next = sk.rcvbuf / 2;
+		} else if (errno != ENOTSUP)
+			warn("if_handlelink");
+	}
+	check_done();
+}
+
+static void
+setup(void)
+{
+	struct kif *kif;
+	unsigned int i;
+
+	bench_ctx_init(&ctx);
+
+	/* The route socket is real, for dump requests and its pid. */
+	if (if_opensockets(&ctx) == -1)
+		err(EXIT_FAILURE, "if_opensockets");
+	close(ctx.link_fd);
+	if (pipe2(sk.fd, O_CLOEXEC | O_NONBLOCK) == -1)
+		err(EXIT_FAILURE, "pipe2");
+	ctx.link_fd = sk.fd[0];
+
+	if ((kifs = calloc(nifaces, sizeof(*kifs))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	for (i = 0; i < nifaces; i++) {
+		kif = &kifs[i];
+		kif->index = IF_INDEX_BASE + i;
+		snprintf(kif->name, sizeof(kif->name), "nb%u", i);
+		memcpy(kif->hwaddr, "\002\000\136\000", 4);
+		kif->hwaddr[4] = (uint8_t)(i >> 8);
+		kif->hwaddr[5] = (uint8_t)i;
+		kif->carrier = true;
+		bench_if_new(&ctx, kif->name, kif->index, kif->hwaddr);
+	}
+
+	/* As dhcpcd does once it has its interfaces. */
+	if (ctx.link_rcvbuf != 0 &&
+	    setsockopt(ctx.link_fd, SOL_SOCKET, SO_RCVBUFFORCE,
+	    &ctx.link_rcvbuf, sizeof(ctx.link_rcvbuf)) == -1 &&
+	    setsockopt(ctx.link_fd, SOL_SOCKET, SO_RCVBUF,
+	    &ctx.link_rcvbuf, sizeof(ctx.link_rcvbuf)) == -1)
+		err(EXIT_FAILURE, "setsockopt");
+	if (if_linkfilter(&ctx) == -1)
+		err(EXIT_FAILURE, "if_linkfilter");
+	if (eloop_event_add(ctx.eloop, ctx.link_fd, handle_link, &ctx) == -1)
+		err(EXIT_FAILURE, "eloop_event_add");
+}
+
+static void
+parse_mix(char *mix)
+{
+	char *p, *w;
+	size_t k;
+
+	for (k = 0; k < __arraycount(kinds); k++)
+		kinds[k].weight = 0;
+	while ((p = strsep(&mix, ",")) != NULL) {
+		if ((w = strchr(p, '=')) != NULL)
+			*w++ = '\0';
+		for (k = 0; k < __arraycount(kinds); k++) {
+			if (strcmp(kinds[k].name, p) == 0)
+				break;
+		}
+		if (k == __arraycount(kinds))
+			errx(EXIT_FAILURE, "%s: unknown message kind", p);
+		kinds[k].weight = w == NULL ? 1 :
+		    (unsigned int)strtoul(w, NULL, 0);
+	}
+}
+
+static void
+report(void)
+{
+	const struct kind *k;
+	const struct overflow *o;
+	unsigned long long sent = 0, filtered = 0, dropped = 0, nread = 0;
+	size_t i;
+
+	printf("%-8s %10s %10s %10s %10s %10s\n",
+	    "kind", "sent", "filtered", "dropped", "read", "us/msg");
+	for (i = 0; i < __arraycount(kinds); i++) {
+		k = &kinds[i];
+		if (k->sent == 0)
+			continue;
+		printf("%-8s %10llu %10llu %10llu %10llu %10.2f\n",
+		    k->name, k->sent, k->filtered, k->dropped, k->read,
+		    k->read == 0 ? 0.0 :
+		    (double)k->busy / (double)k->read / 1e3);
+		sent += k->sent;
+		filtered += k->filtered;
+		dropped += k->dropped;
+		nread += k->read;
+	}
+	printf("%-8s %10llu %10llu %10llu %10llu\n",
+	    "total", sent, filtered, dropped, nread);
+
+	printf("busy %.3f s, %.0f messages/s read", (double)busy / 1e9,
+	    busy == 0 ? 0.0 : (double)nread * 1e9 / (double)busy);
+	if (latency.len != 0) {
+		bench_lat_sort(&latency);
+		printf(", latency p50 %llu us, p99 %llu us, max %llu us",
+		    latency.ns[latency.len / 2] / 1000,
+		    latency.ns[(latency.len * 99) / 100] / 1000,
+		    latency.ns[latency.len - 1] / 1000);
+	}
+	printf("\n");
+
+	printf("%zu overflows, %llu messages drained\n",
+	    noverflows, ndrained);
+	for (i = 0; i < noverflows && i < OVERFLOWS_SHOWN; i++) {
+		o = &overflows[i];
+		printf("  at %8.3f ms: rcvbuf %d held %zu messages "
+		    "(%zu bytes), %llu drained,\n"
+		    "               relearned in %.3f ms, rcvbuf now %d\n",
+		    (double)o->at / 1e6, o->rcvbuf, o->queued, o->rmem,
+		    o->drained, (double)o->took / 1e6, o->rcvbuf_next);
+	}
+	if (noverflows > OVERFLOWS_SHOWN)
+		printf("  and %zu more\n", noverflows - OVERFLOWS_SHOWN);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int logopts = 0;
+	size_t k;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "B:a:b:f:i:M:m:r:t:Uv")) != -1) {
+		switch (ch) {
+		case 'B':
+			burst = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			naddrs = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			ctx.link_rcvbuf = (int)strtol(optarg, NULL, 0);
+			break;
+		case 'f':
+			ctx.cffile = optarg;
+			break;
+		case 'i':
+			nifaces = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			rmem_max = (int)strtol(optarg, NULL, 0);
+			break;
+		case 'm':
+			parse_mix(optarg);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'U':
+			privileged = false;
+			break;
+		case 'v':
+			logopts = LOGERR_ERR | LOGERR_DEBUG;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-Uv] [-a addresses] "
+			    "[-B burst] [-b rcvbuf] [-f config]\n"
+			    "\t[-i interfaces] [-M rmem_max] [-m mix] "
+			    "[-r rate] [-t msecs]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (nifaces == 0 || nifaces > 0xffff || rate == 0 || burst == 0)
+		errx(EXIT_FAILURE, "interfaces, rate and burst must be "
+		    "positive and interfaces below 65536");
+	if (naddrs == 0 || naddrs > ADDRS_MAX)
+		errx(EXIT_FAILURE, "addresses must be 1 to %d", ADDRS_MAX);
+	for (k = 0; k < __arraycount(kinds); k++)
+		weights += kinds[k].weight;
+	if (weights == 0)
+		errx(EXIT_FAILURE, "the mix is empty");
+
+	logsetopts(logopts);
+	srandom(1);
+	setup();
+
+	printf("%u interfaces, %u addresses each, %lu messages/s "
+	    "in bursts of %lu for %lu ms\n",
+	    nifaces, naddrs, rate, burst, duration);
+	printf("rcvbuf %d, rmem_max %d%s\n", sk.rcvbuf / 2, rmem_max,
+	    privileged ? "" : ", unprivileged");
+
+	generating = true;
+	started = bench_now_ns();
+	generate(NULL);
+	eloop_enter(ctx.eloop);
+	if (eloop_start(ctx.eloop, NULL) != EXIT_SUCCESS)
+		errx(EXIT_FAILURE, "eloop_start");
+	report();
+	return EXIT_SUCCESS;
+}
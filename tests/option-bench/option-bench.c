@@ -0,0 +1,497 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - option encode and decode benchmark
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <netinet/if_ether.h>
+
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "dhcp.h"
+#include "dhcp-common.h"
+#include "dhcpcd.h"
+#include "if-options.h"
+#include "logerr.h"
+#include "route.h"
+
+/* Sized as the larger option sets seen in the field. */
+#define	NAMES		32	/* domain search list */
+#define	ROUTES		64	/* classless static routes */
+#define	ENTERPRISE	4491	/* defined in option-bench.conf */
+
+static struct dhcpcd_ctx ctx;
+static struct interface *ifp;
+static unsigned long runs = 20000;
+
+static char names[NAMES][NS_MAXDNAME];
+/* Search lists, as sent plain and with RFC 1035 compression. */
+static uint8_t search[NAMES * 64], csearch[NAMES * 64];
+static size_t search_len, csearch_len;
+static uint8_t vendor_class[255];
+static uint8_t routes_opt[ROUTES * 8], vendor_opt[255], vivso_opt[255];
+static size_t routes_len, vendor_len, vivso_len;
+
+static union {
+	struct bootp bootp;
+	uint8_t buf[sizeof(struct bootp) + 2048];
+} msg;
+static size_t msg_len;
+static size_t msg_opts;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void
+report(const char *what, size_t n, const char *unit, double start)
+{
+	double t = now() - start;
+
+	printf("%-24s %4zu %-7s %9.1f ns/%s\n", what, n, unit,
+	    t * 1e9 / ((double)runs * (double)n), unit);
+}
+
+/* As dhcp_getoption in dhcp.c, which frames DHCP options. */
+static const uint8_t *
+getoption(struct dhcpcd_ctx *dctx,
+    size_t *os, unsigned int *code, size_t *len,
+    const uint8_t *od, size_t ol, struct dhcp_opt **oopt)
+{
+
+	if (od) {
+		if (ol < 2) {
+			errno = EINVAL;
+			return NULL;
+		}
+		*os = 2;
+		*code = (unsigned int)*od++;
+		*len = (size_t)*od++;
+		if (*len > ol - *os) {
+			errno = ERANGE;
+			return NULL;
+		}
+	}
+
+	*oopt = dhcp_optmap_find(&dctx->dhcp_optmap,
+	    dctx->dhcp_opts, dctx->dhcp_opts_len, *code);
+	return od;
+}
+
+static struct dhcp_opt *
+find_opt(unsigned int code)
+{
+	struct dhcp_opt *opt;
+
+	/* An option defined in the config overrides the built in one. */
+	opt = dhcp_optmap_find(&ifp->options->dhcp_overmap,
+	    ifp->options->dhcp_override, ifp->options->dhcp_override_len,
+	    code);
+	if (opt == NULL)
+		opt = dhcp_optmap_find(&ctx.dhcp_optmap,
+		    ctx.dhcp_opts, ctx.dhcp_opts_len, code);
+	if (opt == NULL)
+		errx(EXIT_FAILURE, "option %u is not defined", code);
+	return opt;
+}
+
+/* Add an option, split over as many as it needs, RFC 3396. */
+static void
+add_option(uint8_t code, const void *data, size_t len)
+{
+	const uint8_t *d = data;
+	uint8_t *p = msg.bootp.vend + msg_len;
+	size_t l;
+
+	do {
+		l = len > UINT8_MAX ? UINT8_MAX : len;
+		if (msg_len + 2 + l + 1 >
+		    sizeof(msg) - offsetof(struct bootp, vend))
+			errx(EXIT_FAILURE, "message too big");
+		*p++ = code;
+		*p++ = (uint8_t)l;
+		memcpy(p, d, l);
+		p += l;
+		d += l;
+		len -= l;
+		msg_len += 2 + l;
+	} while (len != 0);
+	*p = DHO_END;
+	msg_opts++;
+}
+
+static size_t
+add_sub(uint8_t *p, uint8_t code, const void *data, size_t len)
+{
+
+	p[0] = code;
+	p[1] = (uint8_t)len;
+	memcpy(p + 2, data, len);
+	return 2 + len;
+}
+
+static void
+build_names(void)
+{
+	uint8_t *p, *cp;
+	size_t i, l, suffix = 0;
+
+	p = search;
+	cp = csearch;
+	for (i = 0; i < NAMES; i++) {
+		snprintf(names[i], sizeof(names[i]),
+		    "eng%zu.site%zu.corp.example.com", i, i % 8);
+		l = encode_rfc1035(names[i], p);
+		p += l;
+
+		/* The first name is sent whole, the rest point to its
+		 * corp.example.com. */
+		if (i == 0) {
+			memcpy(cp, search, l);
+			suffix = 1 + (size_t)search[0] +
+			    1 + (size_t)search[1 + search[0]];
+			cp += l;
+			continue;
+		}
+		encode_rfc1035(names[i], cp);
+		l = 1 + (size_t)cp[0] + 1 + (size_t)cp[1 + cp[0]];
+		cp += l;
+		*cp++ = (uint8_t)(0xc0 | suffix >> 8);
+		*cp++ = (uint8_t)suffix;
+	}
+	search_len = (size_t)(p - search);
+	csearch_len = (size_t)(cp - csearch);
+
+	/* Printable and not, with some characters a shell would need
+	 * quoted. */
+	for (i = 0; i < sizeof(vendor_class); i++) {
+		if (i % 16 == 15)
+			vendor_class[i] =
+			    (uint8_t)"\"\\ '$\t;`"[i / 16 % 8];
+		else
+			vendor_class[i] = (uint8_t)('a' + i % 26);
+	}
+}
+
+/* A DHCP ACK with large option sets as a busy site might send. */
+static void
+build_message(void)
+{
+	struct bootp *bootp = &msg.bootp;
+	uint8_t servers[4 * sizeof(struct in_addr)], realm[NS_MAXDNAME], *p;
+	uint32_t u32, cookie = htonl(MAGIC_COOKIE);
+	struct in_addr a;
+	size_t i;
+
+	bootp->op = BOOTREPLY;
+	bootp->htype = ARPHRD_ETHER;
+	bootp->hlen = ETHER_ADDR_LEN;
+	bootp->yiaddr = htonl(0x0a010010);
+	memcpy(bootp->vend, &cookie, sizeof(cookie));
+	msg_len = sizeof(cookie);
+
+	for (i = 0; i < 4; i++) {
+		a.s_addr = htonl(0x0a000001 + (uint32_t)i);
+		memcpy(servers + i * sizeof(a), &a, sizeof(a));
+	}
+
+	add_option(DHO_MESSAGETYPE, (const uint8_t []){ DHCP_ACK }, 1);
+	add_option(DHO_SERVERID, servers, sizeof(a));
+	u32 = htonl(86400);
+	add_option(DHO_LEASETIME, &u32, sizeof(u32));
+	a.s_addr = htonl(0xffff0000);
+	add_option(DHO_SUBNETMASK, &a, sizeof(a));
+	add_option(DHO_ROUTER, servers, 2 * sizeof(a));
+	add_option(DHO_DNSSERVER, servers, sizeof(servers));
+	add_option(DHO_NTPSERVER, servers, sizeof(servers));
+	add_option(DHO_HOSTNAME, "client0016", 10);
+	add_option(DHO_DNSDOMAIN, "corp.example.com", 16);
+	add_option(DHO_DNSSEARCH, csearch, csearch_len);
+
+	/* 10.x.y.0/24 via 10.0.0.1 */
+	for (i = 0, p = routes_opt; i < ROUTES; i++) {
+		*p++ = 24;
+		*p++ = 10;
+		*p++ = (uint8_t)(i >> 4);
+		*p++ = (uint8_t)i;
+		memcpy(p, servers, sizeof(a));
+		p += sizeof(a);
+	}
+	routes_len = (size_t)(p - routes_opt);
+	add_option(DHO_CSR, routes_opt, routes_len);
+
+	/* Vendor specific sub-options as defined in option-bench.conf */
+	p = vendor_opt;
+	p += add_sub(p, 1, "bench appliance", 15);
+	p += add_sub(p, 2, servers, sizeof(servers));
+	u32 = htonl(300);
+	p += add_sub(p, 3, &u32, sizeof(u32));
+	p += add_sub(p, 4, realm, encode_rfc1035("corp.example.com", realm));
+	p += add_sub(p, 5, vendor_class, 32);
+	vendor_len = (size_t)(p - vendor_opt);
+	add_option(DHO_VENDOR, vendor_opt, vendor_len);
+
+	/* RFC 3925 with one enterprise. */
+	u32 = htonl(ENTERPRISE);
+	memcpy(vivso_opt, &u32, sizeof(u32));
+	p = vivso_opt + sizeof(u32) + 1;
+	p += add_sub(p, 1, servers + sizeof(a), sizeof(a));
+	p += add_sub(p, 2, realm, encode_rfc1035("corp.example.com", realm));
+	p += add_sub(p, 3, "modem 3.1", 9);
+	vivso_len = (size_t)(p - vivso_opt);
+	vivso_opt[sizeof(u32)] = (uint8_t)(vivso_len - sizeof(u32) - 1);
+	add_option(DHO_VIVSO, vivso_opt, vivso_len);
+
+	add_option(DHO_VENDORCLASSID, vendor_class, sizeof(vendor_class));
+
+	msg_len += offsetof(struct bootp, vend) + 1;
+}
+
+static void
+setup(const char *cffile)
+{
+	struct if_options *ifo;
+	struct dhcp_state *state;
+
+	ctx.cffile = cffile;
+	TAILQ_INIT(&ctx.optmasks);
+	TAILQ_INIT(&ctx.control_fds);
+	TAILQ_INIT(&ctx.script_jobs);
+	ctx.pf_inet_fd = ctx.link_fd = ctx.control_fd = -1;
+	if ((ctx.ifaces = malloc(sizeof(*ctx.ifaces))) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	TAILQ_INIT(ctx.ifaces);
+	rt_init(&ctx);
+
+	if ((ifo = read_config(&ctx, NULL, NULL, NULL)) == NULL)
+		errx(EXIT_FAILURE, "read_config");
+	free_options(&ctx, ifo);
+	/* The benches look options up directly, so load them all now. */
+	load_definitions(&ctx, DEFS_ALL);
+
+	if ((ifp = calloc(1, sizeof(*ifp))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	ifp->ctx = &ctx;
+	strlcpy(ifp->name, "ob0", sizeof(ifp->name));
+	ifp->index = 1;
+	ifp->hwtype = ARPHRD_ETHER;
+	ifp->hwlen = ETHER_ADDR_LEN;
+	if ((ifp->options = read_config(&ctx, ifp->name, NULL, NULL)) == NULL)
+		errx(EXIT_FAILURE, "%s: read_config", ifp->name);
+	TAILQ_INSERT_TAIL(ctx.ifaces, ifp, next);
+
+	if ((state = calloc(1, sizeof(*state))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	state->new = &msg.bootp;
+	state->new_len = msg_len;
+	state->added = STATE_ADDED;
+	ifp->if_data[IF_DATA_DHCP] = state;
+}
+
+static void
+bench_rfc1035(void)
+{
+	uint8_t buf[NS_MAXDNAME];
+	char out[NAMES * NS_MAXDNAME];
+	unsigned long r;
+	double start;
+	size_t i;
+
+	start = now();
+	for (r = 0; r < runs; r++) {
+		for (i = 0; i < NAMES; i++)
+			encode_rfc1035(names[i], buf);
+	}
+	report("encode_rfc1035", NAMES, "name", start);
+
+	start = now();
+	for (r = 0; r < runs; r++) {
+		if (decode_rfc1035(out, sizeof(out), search, search_len) == -1)
+			err(EXIT_FAILURE, "decode_rfc1035");
+	}
+	report("decode_rfc1035", NAMES, "name", start);
+
+	start = now();
+	for (r = 0; r < runs; r++) {
+		if (decode_rfc1035(out, sizeof(out),
+		    csearch, csearch_len) == -1)
+			err(EXIT_FAILURE, "decode_rfc1035");
+	}
+	report("decode_rfc1035 compress", NAMES, "name", start);
+}
+
+static void
+bench_print_string(void)
+{
+	char out[sizeof(vendor_class) * 4 + 1];
+	unsigned long r;
+	double start;
+
+	start = now();
+	for (r = 0; r < runs; r++)
+		print_string(out, sizeof(out), OT_STRING,
+		    vendor_class, sizeof(vendor_class));
+	report("print_string", 1, "option", start);
+
+	start = now();
+	for (r = 0; r < runs; r++)
+		print_string(out, sizeof(out), OT_ESCSTRING,
+		    vendor_class, sizeof(vendor_class));
+	report("print_string escape", 1, "option", start);
+}
+
+static void
+bench_routes(void)
+{
+	rb_tree_t routes;
+	unsigned long r;
+	double start;
+
+	rb_tree_init(&routes, &rt_compare_proto_ops);
+	start = now();
+	for (r = 0; r < runs; r++) {
+		if (dhcp_get_routes(&routes, ifp) == -1)
+			err(EXIT_FAILURE, "dhcp_get_routes");
+		rt_headclear(&routes, AF_UNSPEC);
+	}
+	report("decode_rfc3442_rt", ROUTES, "route", start);
+}
+
+static void
+bench_envoption(FILE *fp, const char *what, unsigned int code,
+    const uint8_t *data, size_t len)
+{
+	struct dhcp_opt *opt;
+	unsigned long r;
+	double start;
+
+	opt = code == ENTERPRISE ? vivso_find(code, ifp) : find_opt(code);
+	if (opt == NULL)
+		errx(EXIT_FAILURE, "%s is not defined", what);
+	start = now();
+	for (r = 0; r < runs; r++) {
+		rewind(fp);
+		dhcp_envoption(&ctx, fp, "new", ifp->name, opt, getoption,
+		    data, len);
+	}
+	report(what, 1, "option", start);
+}
+
+static void
+bench_env(FILE *fp)
+{
+	unsigned long r;
+	double start;
+
+	bench_envoption(fp, "domain_search", DHO_DNSSEARCH,
+	    csearch, csearch_len);
+	bench_envoption(fp, "classless_static_routes", DHO_CSR,
+	    routes_opt, routes_len);
+	bench_envoption(fp, "vendor_specific", DHO_VENDOR,
+	    vendor_opt, vendor_len);
+	bench_envoption(fp, "vivso", ENTERPRISE,
+	    vivso_opt + sizeof(uint32_t) + 1,
+	    vivso_len - sizeof(uint32_t) - 1);
+
+	start = now();
+	for (r = 0; r < runs; r++) {
+		rewind(fp);
+		if (dhcp_env(fp, "new", ifp, &msg.bootp, msg_len) == -1)
+			err(EXIT_FAILURE, "dhcp_env");
+	}
+	report("dhcp_env", msg_opts, "option", start);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *cffile = "option-bench.conf";
+	char *env = NULL;
+	size_t envlen = 0;
+	FILE *fp;
+	int ch;
+	bool print = false;
+
+	while ((ch = getopt(argc, argv, "f:pr:")) != -1) {
+		switch (ch) {
+		case 'f':
+			cffile = optarg;
+			break;
+		case 'p':
+			print = true;
+			break;
+		case 'r':
+			runs = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p] [-f config] [-r runs]\n",
+			    argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (runs == 0)
+		errx(EXIT_FAILURE, "runs must be positive");
+
+	logsetopts(0);
+	build_names();
+	build_message();
+	setup(cffile);
+
+	if ((fp = open_memstream(&env, &envlen)) == NULL)
+		err(EXIT_FAILURE, "open_memstream");
+	if (print) {
+		dhcp_env(fp, "new", ifp, &msg.bootp, msg_len);
+		fflush(fp);
+		for (size_t i = 0; i < envlen; i += strlen(env + i) + 1)
+			printf("%s\n", env + i);
+		return EXIT_SUCCESS;
+	}
+
+	printf("%lu runs\n", runs);
+	bench_rfc1035();
+	bench_print_string();
+	bench_routes();
+	bench_env(fp);
+	fclose(fp);
+	free(env);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,444 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - privilege separation benchmark
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <netinet/if_ether.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "cksum.h"
+#include "dhcp.h"
+#include "dhcpcd.h"
+#include "eloop.h"
+#include "logerr.h"
+#include "privsep.h"
+
+#ifndef __unused
+#define __unused		__attribute__((__unused__))
+#endif
+
+/* Probe every 10ms for up to 5 seconds. */
+#define	PROBE_TRIES	500
+
+enum state {
+	STATE_PROBE,	/* waiting for the BPF helpers to see a frame */
+	STATE_DRAIN,	/* letting the probes still in flight arrive */
+	STATE_RUN,
+	STATE_DONE,
+};
+
+static struct dhcpcd_ctx ctx;
+static struct interface sifp, rifp;
+static struct bootp_pkt frame;
+
+static enum state state;
+static unsigned long nframes = 10000, window = 64;
+static unsigned long sent, received, watched;
+static struct timespec run_start;
+
+static double
+elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)(now.tv_sec - start->tv_sec) * 1e9 +
+	    (double)(now.tv_nsec - start->tv_nsec);
+}
+
+static int
+bench_ioctl(const char *ifname, unsigned int calls)
+{
+	struct ifreq ifr;
+	struct timespec start;
+	unsigned int i;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < calls; i++) {
+		if (ps_root_ioctl(&ctx, SIOCGIFMTU, &ifr, sizeof(ifr)) == -1) {
+			logerr("%s: ps_root_ioctl", ifname);
+			return -1;
+		}
+	}
+	loginfox("%-8s %10.1f ns/call over %u calls",
+	    "ioctl", elapsed_ns(&start) / calls, calls);
+	return 0;
+}
+
+static void
+bench_setif(struct interface *ifp, const char *ifname)
+{
+#ifdef SIOCGIFHWADDR
+	struct ifreq ifr;
+	int s;
+
+	memset(ifp, 0, sizeof(*ifp));
+	ifp->ctx = &ctx;
+	strlcpy(ifp->name, ifname, sizeof(ifp->name));
+	if ((ifp->index = if_nametoindex(ifname)) == 0)
+		err(EXIT_FAILURE, "%s", ifname);
+
+	if ((s = socket(PF_INET, SOCK_DGRAM, 0)) == -1)
+		err(EXIT_FAILURE, "socket");
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
+	if (ioctl(s, SIOCGIFHWADDR, &ifr) == -1)
+		err(EXIT_FAILURE, "%s: SIOCGIFHWADDR", ifname);
+	close(s);
+
+	/* The BOOTP filter only knows Ethernet framing. */
+	if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER)
+		errx(EXIT_FAILURE, "%s: not Ethernet", ifname);
+	ifp->hwtype = ARPHRD_ETHER;
+	ifp->hwlen = ETHER_ADDR_LEN;
+	memcpy(ifp->hwaddr, ifr.ifr_hwaddr.sa_data, ifp->hwlen);
+#else
+	UNUSED(ifp);
+	errx(EXIT_FAILURE, "%s: cannot find the hardware address", ifname);
+#endif
+}
+
+/* A BOOTREPLY broadcast from a server, which the BOOTP filter
+ * accepts without needing to know a transaction. */
+static void
+bench_mkframe(void)
+{
+	struct ip *ip = &frame.ip;
+	struct udphdr *udp = &frame.udp;
+	struct bootp *bootp = &frame.bootp;
+
+	bootp->op = BOOTREPLY;
+	bootp->htype = (uint8_t)rifp.hwtype;
+	bootp->hlen = rifp.hwlen;
+	memcpy(bootp->chaddr, rifp.hwaddr, rifp.hwlen);
+
+	udp->uh_sport = htons(BOOTPS);
+	udp->uh_dport = htons(BOOTPC);
+	udp->uh_ulen = htons(sizeof(*udp) + sizeof(*bootp));
+
+	ip->ip_v = 4;
+	ip->ip_hl = sizeof(*ip) >> 2;
+	ip->ip_len = htons(sizeof(frame));
+	ip->ip_ttl = IPDEFTTL;
+	ip->ip_p = IPPROTO_UDP;
+	ip->ip_src.s_addr = htonl(INADDR_ANY);
+	ip->ip_dst.s_addr = htonl(INADDR_BROADCAST);
+	ip->ip_sum = in_cksum(ip, sizeof(*ip), NULL);
+}
+
+static void
+bench_sendframe(void)
+{
+
+	if (ps_bpf_sendbootp(&sifp, &frame, sizeof(frame)) == -1) {
+		logerr("ps_bpf_sendbootp");
+		eloop_exit(ctx.eloop, EXIT_FAILURE);
+		return;
+	}
+	sent++;
+}
+
+static void
+bench_finish(void)
+{
+	double ns = elapsed_ns(&run_start);
+
+	state = STATE_DONE;
+	loginfox("%-8s %10.0f frames/s, %lu of %lu lost",
+	    "bootp", (double)received * 1e9 / ns,
+	    sent - received, sent);
+	eloop_exit(ctx.eloop, EXIT_SUCCESS);
+}
+
+/* Keep window frames between the two BPF helpers. */
+static void
+bench_fill(void)
+{
+
+	while (state == STATE_RUN &&
+	    sent < nframes && sent - received < window)
+		bench_sendframe();
+}
+
+/* Lost frames never come back, so stop once nothing else arrives. */
+static void
+bench_watch(__unused void *arg)
+{
+
+	if (received == watched) {
+		bench_finish();
+		return;
+	}
+	watched = received;
+	eloop_timeout_add_sec(ctx.eloop, 1, bench_watch, NULL);
+}
+
+static void
+bench_run(__unused void *arg)
+{
+
+	state = STATE_RUN;
+	sent = received = watched = 0;
+	clock_gettime(CLOCK_MONOTONIC, &run_start);
+	eloop_timeout_add_sec(ctx.eloop, 1, bench_watch, NULL);
+	bench_fill();
+}
+
+static void
+bench_probe(__unused void *arg)
+{
+
+	if (sent == PROBE_TRIES) {
+		logerrx("no frame made it from %s to %s",
+		    sifp.name, rifp.name);
+		eloop_exit(ctx.eloop, EXIT_FAILURE);
+		return;
+	}
+	bench_sendframe();
+	eloop_timeout_add_msec(ctx.eloop, 10, bench_probe, NULL);
+}
+
+static ssize_t
+bench_dispatchcb(__unused void *arg, struct ps_msghdr *psm,
+    __unused struct msghdr *msg)
+{
+
+	/* A packet socket also sees what is sent on it. */
+	if (psm->ps_cmd != PS_BPF_BOOTP ||
+	    psm->ps_id.psi_ifindex != rifp.index)
+		return 0;
+
+	switch (state) {
+	case STATE_PROBE:
+		state = STATE_DRAIN;
+		eloop_timeout_delete(ctx.eloop, bench_probe, NULL);
+		eloop_timeout_add_msec(ctx.eloop, 100, bench_run, NULL);
+		break;
+	case STATE_RUN:
+		if (++received == nframes)
+			bench_finish();
+		else
+			bench_fill();
+		break;
+	default:
+		break;
+	}
+	return 1;
+}
+
+static void
+bench_dispatch(__unused void *arg)
+{
+
+	if (ps_recvpsmsg(&ctx, ctx.ps_data_fd, bench_dispatchcb, NULL) == -1)
+		logerr(__func__);
+}
+
+static void
+bench_signalcb(int sig, __unused void *arg)
+{
+
+	if (sig == SIGINT || sig == SIGTERM)
+		eloop_exit(ctx.eloop, EXIT_FAILURE);
+}
+
+static void
+bench_init(void)
+{
+
+	/* As dhcpcd does. */
+	ctx.control_fd = ctx.control_unpriv_fd = ctx.link_fd = -1;
+	ctx.pf_inet_fd = -1;
+#ifdef PF_LINK
+	ctx.pf_link_fd = -1;
+#endif
+	TAILQ_INIT(&ctx.control_fds);
+	TAILQ_INIT(&ctx.script_jobs);
+	ctx.fork_fd = -1;
+#ifdef PLUGIN_DEV
+	ctx.dev_fd = -1;
+#endif
+#ifdef INET
+	ctx.udp_rfd = ctx.udp_wfd = -1;
+#endif
+#if defined(INET6) && !defined(__sun)
+	ctx.nd_fd = -1;
+#endif
+#ifdef DHCP6
+	ctx.dhcp6_rfd = ctx.dhcp6_wfd = -1;
+#endif
+	ctx.ps_root_fd = ctx.ps_log_fd = ctx.ps_data_fd = -1;
+	ctx.ps_inet_fd = ctx.ps_control_fd = -1;
+
+	/* Only the privileged actioneer and BPF helpers are wanted. */
+	ctx.options = DHCPCD_MASTER | DHCPCD_TEST;
+
+	if ((ctx.eloop = eloop_new()) == NULL)
+		err(EXIT_FAILURE, "eloop_new");
+	eloop_signal_set_cb(ctx.eloop, dhcpcd_signals, dhcpcd_signals_len,
+	    bench_signalcb, &ctx);
+	if (eloop_signal_mask(ctx.eloop, &ctx.sigset) == -1)
+		err(EXIT_FAILURE, "eloop_signal_mask");
+}
+
+int
+main(int argc, char **argv, char **envp)
+{
+	const char *sendif = NULL, *recvif = NULL;
+	unsigned int calls = 10000;
+	bool sandbox = false;
+	int ch, exit_code = EXIT_SUCCESS;
+
+#ifdef SETPROCTITLE_H
+	setproctitle_init(argc, argv, envp);
+#else
+	UNUSED(envp);
+#endif
+
+	while ((ch = getopt(argc, argv, "c:f:I:i:psw:")) != -1) {
+		switch (ch) {
+		case 'c':
+			calls = (unsigned int)atoi(optarg);
+			break;
+		case 'f':
+			nframes = (unsigned long)atol(optarg);
+			break;
+		case 'I':
+			recvif = optarg;
+			break;
+		case 'i':
+			sendif = optarg;
+			break;
+		case 'p':
+			ctx.shared_bpf = true;
+			break;
+		case 's':
+			sandbox = true;
+			break;
+		case 'w':
+			window = (unsigned long)atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-ps] [-c calls] "
+			    "[-i sendif -I recvif] [-f frames] [-w window]\n",
+			    argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (calls == 0 || nframes == 0 || window == 0)
+		errx(EXIT_FAILURE, "need at least one call, frame and window");
+	if ((sendif == NULL) != (recvif == NULL))
+		errx(EXIT_FAILURE, "-i and -I go together");
+
+	if (geteuid() != 0) {
+		printf("not root, skipping\n");
+		return EXIT_SUCCESS;
+	}
+
+	logsetopts(LOGERR_ERR);
+	bench_init();
+	if (ps_init(&ctx) == -1) {
+		printf("no %s user, skipping\n", PRIVSEP_USER);
+		return EXIT_SUCCESS;
+	}
+	if (sendif != NULL) {
+		bench_setif(&sifp, sendif);
+		bench_setif(&rifp, recvif);
+		bench_mkframe();
+	}
+
+	switch (ps_start(&ctx)) {
+	case -1:
+		err(EXIT_FAILURE, "ps_start");
+	case 0:
+		/* The privileged actioneer or one of its helpers. */
+		exit_code = eloop_start(ctx.eloop, &ctx.sigset);
+		/* The results can still be queued when we are told to stop. */
+		if (ctx.ps_root_pid == getpid()) {
+			while (logreadfd(ctx.ps_log_fd) != -1)
+				;
+		}
+		return exit_code;
+	}
+
+	/* Like dhcpcd, the sandboxed master cannot write to a file,
+	 * so results are logged via the privileged actioneer. */
+	if (sandbox && ps_mastersandbox(&ctx, NULL) == -1)
+		goto exit_failure;
+	loginfox("master sandbox %s%s", sandbox ? "on" : "off",
+	    ctx.shared_bpf ? ", shared BPF" : "");
+
+	if (bench_ioctl(sendif != NULL ? sendif : "lo", calls) == -1)
+		goto exit_failure;
+
+	if (sendif != NULL) {
+		if (eloop_event_add(ctx.eloop, ctx.ps_data_fd,
+		    bench_dispatch, NULL) == -1)
+		{
+			logerr("eloop_event_add");
+			goto exit_failure;
+		}
+		if (ps_bpf_openbootp(&sifp) == -1 ||
+		    ps_bpf_openbootp(&rifp) == -1)
+		{
+			logerr("ps_bpf_openbootp");
+			goto exit_failure;
+		}
+		eloop_timeout_add_sec(ctx.eloop, 0, bench_probe, NULL);
+		exit_code = eloop_start(ctx.eloop, &ctx.sigset);
+	}
+	goto exit1;
+
+exit_failure:
+	exit_code = EXIT_FAILURE;
+
+exit1:
+	ps_root_stop(&ctx);
+	eloop_free(ctx.ps_eloop);
+	eloop_free(ctx.eloop);
+	return exit_code;
+}
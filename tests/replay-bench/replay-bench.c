@@ -0,0 +1,1240 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - packet replay benchmark
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <netinet/if_ether.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <netinet/udp.h>
+
+#include <dlfcn.h>
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "arena.h"
+#include "bpf.h"
+#include "cksum.h"
+#include "dhcp.h"
+#include "dhcp6.h"
+#include "dhcpcd.h"
+#include "eloop.h"
+#include "if.h"
+#include "if-options.h"
+#include "ipv6.h"
+#include "ipv6nd.h"
+#include "logerr.h"
+
+#include "bench.h"
+
+/*
+ * The whole of dhcpcd is linked in, but nothing here opens a socket.
+ * Frames from a capture are handed straight to the functions dhcpcd
+ * calls once it has read them.
+ * dhcpcd runs in test mode, as with -T, so a reply is parsed and
+ * acted on right up to the point of changing the system, and the
+ * interfaces given protocol states which expect the replies.
+ */
+
+#ifndef IPV6_VERSION
+#define	IPV6_VERSION		0x60
+#define	IPV6_VERSION_MASK	0xf0
+#endif
+
+#define	PCAP_MAGIC		0xa1b2c3d4
+#define	PCAP_NSEC_MAGIC		0xa1b23c4d
+#define	PCAP_SNAPLEN		65535
+#define	LINKTYPE_ETHERNET	1
+#define	LINKTYPE_LINUX_SLL	113
+#define	SLL_HDRLEN		16
+
+struct pcap_hdr {
+	uint32_t magic;
+	uint16_t major;
+	uint16_t minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t network;
+};
+
+struct pcap_rec {
+	uint32_t sec;
+	uint32_t usec;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+enum kind {
+#ifdef INET
+	KIND_DHCP,
+#endif
+#ifdef DHCP6
+	KIND_DHCP6,
+#endif
+#ifdef INET6
+	KIND_RA,
+#endif
+	KIND_MAX,
+};
+
+static const char *kind_names[] = {
+#ifdef INET
+	"dhcp",
+#endif
+#ifdef DHCP6
+	"dhcp6",
+#endif
+#ifdef INET6
+	"ra",
+#endif
+};
+
+#ifdef INET6
+union cmsgbuf {
+	struct cmsghdr hdr;
+	uint8_t buf[CMSG_SPACE(sizeof(struct in6_pktinfo)) +
+	    CMSG_SPACE(sizeof(int))];
+};
+#endif
+
+struct record {
+	struct interface *ifp;
+	uint8_t *data;		/* Ethernet frame for DHCP else the payload */
+	size_t len;
+#ifdef INET6
+	struct sockaddr_in6 from;
+	struct iovec iov;
+	struct msghdr msg;
+	union cmsgbuf cmsg;
+#endif
+};
+
+struct records {
+	struct record *recs;
+	size_t len;
+	size_t size;
+};
+
+static struct dhcpcd_ctx ctx;
+static struct interface **ifaces;
+static unsigned int nifaces = 16;
+static unsigned long passes = 2000;
+static struct records records[KIND_MAX];
+static size_t skipped;
+
+/* Where each frame is read into, as a BPF or socket read would.
+ * The frame starts two bytes in to align the IP header. */
+static union {
+	uint32_t align;
+	uint8_t buf[2 + PCAP_SNAPLEN];
+} rbuf;
+
+static const uint8_t server_hwaddr[ETHER_ADDR_LEN] = {
+	0x02, 0x00, 0x5e, 0xff, 0x00, 0x01
+};
+
+/*
+ * Count the allocations dhcpcd makes.
+ * The real functions are found on first use; dlsym itself may
+ * allocate, which is served from a small static area.
+ */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static unsigned long long nallocs;
+static bool resolving;
+static char bootstrap[4096];
+static size_t bootstrap_used;
+
+static void *
+bootstrap_alloc(size_t size)
+{
+	void *p;
+
+	size = (size + 15) & ~(size_t)15;
+	if (size > sizeof(bootstrap) - bootstrap_used)
+		return NULL;
+	p = bootstrap + bootstrap_used;
+	bootstrap_used += size;
+	return p;
+}
+
+static bool
+is_bootstrap(const void *p)
+{
+
+	return (const char *)p >= bootstrap &&
+	    (const char *)p < bootstrap + sizeof(bootstrap);
+}
+
+static void
+resolve_alloc(void)
+{
+
+	resolving = true;
+	*(void **)&real_malloc = dlsym(RTLD_NEXT, "malloc");
+	*(void **)&real_calloc = dlsym(RTLD_NEXT, "calloc");
+	*(void **)&real_realloc = dlsym(RTLD_NEXT, "realloc");
+	*(void **)&real_free = dlsym(RTLD_NEXT, "free");
+	resolving = false;
+	if (real_malloc == NULL || real_calloc == NULL ||
+	    real_realloc == NULL || real_free == NULL)
+		abort();
+}
+
+void *
+malloc(size_t size)
+{
+
+	if (real_malloc == NULL) {
+		if (resolving)
+			return bootstrap_alloc(size);
+		resolve_alloc();
+	}
+	nallocs++;
+	return real_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+
+	if (real_calloc == NULL) {
+		/* Static memory is already zeroed. */
+		if (resolving)
+			return nmemb != 0 && size > SIZE_MAX / nmemb ?
+			    NULL : bootstrap_alloc(nmemb * size);
+		resolve_alloc();
+	}
+	nallocs++;
+	return real_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	void *p;
+
+	if (real_realloc == NULL) {
+		if (resolving)
+			return NULL;
+		resolve_alloc();
+	}
+	nallocs++;
+	if (!is_bootstrap(ptr))
+		return real_realloc(ptr, size);
+	/* Nothing from bootstrap is bigger than what is left of it. */
+	if ((p = real_malloc(size)) != NULL)
+		memcpy(p, ptr, MIN(size, sizeof(bootstrap) -
+		    (size_t)((char *)ptr - bootstrap)));
+	return p;
+}
+
+void
+free(void *ptr)
+{
+
+	if (ptr == NULL || is_bootstrap(ptr))
+		return;
+	if (real_free == NULL)
+		resolve_alloc();
+	real_free(ptr);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint32_t
+bswap32(uint32_t v)
+{
+
+	return (v >> 24) | ((v >> 8) & 0xff00) |
+	    ((v << 8) & 0xff0000) | (v << 24);
+}
+
+static struct record *
+record_new(enum kind kind)
+{
+	struct records *r = &records[kind];
+	struct record *rec;
+
+	if (r->len == r->size) {
+		size_t size = r->size == 0 ? 64 : r->size * 2;
+
+		rec = reallocarray(r->recs, size, sizeof(*rec));
+		if (rec == NULL)
+			err(EXIT_FAILURE, "reallocarray");
+		r->recs = rec;
+		r->size = size;
+	}
+	rec = &r->recs[r->len];
+	memset(rec, 0, sizeof(*rec));
+	/* Each kind is dealt out over the interfaces in turn. */
+	rec->ifp = ifaces[r->len % nifaces];
+	r->len++;
+	return rec;
+}
+
+/* The UDP or ICMPv6 checksum with the pseudo header first. */
+static uint16_t
+l4_cksum(const void *ph, size_t phlen, const void *l4, size_t l4len)
+{
+	uint32_t csum = 0;
+	uint16_t sum;
+
+	in_cksum(ph, phlen, &csum);
+	sum = in_cksum(l4, l4len, &csum);
+	return sum == 0 ? 0xffff : sum;
+}
+
+#ifdef INET
+static void
+udp4_cksum(const struct ip *ip, uint8_t *udpp, size_t ulen)
+{
+	struct {
+		struct in_addr src;
+		struct in_addr dst;
+		uint8_t zero;
+		uint8_t p;
+		uint16_t len;
+	} ph = {
+		.src = ip->ip_src,
+		.dst = ip->ip_dst,
+		.p = IPPROTO_UDP,
+		.len = htons((uint16_t)ulen),
+	};
+	uint16_t sum = 0;
+
+	memcpy(udpp + offsetof(struct udphdr, uh_sum), &sum, sizeof(sum));
+	sum = l4_cksum(&ph, sizeof(ph), udpp, ulen);
+	memcpy(udpp + offsetof(struct udphdr, uh_sum), &sum, sizeof(sum));
+}
+
+/* Aim a DHCP reply at its interface by its xid and hardware address. */
+static void
+load_dhcp(const uint8_t *l3, size_t len)
+{
+	struct ip ip;
+	struct udphdr udp;
+	struct record *rec;
+	const struct dhcp_state *state;
+	struct ether_header eh;
+	uint8_t *bootp, *udpp;
+	size_t hl, iplen, ulen;
+	uint32_t xid;
+
+	memcpy(&ip, l3, sizeof(ip));
+	hl = (size_t)ip.ip_hl * 4;
+	iplen = ntohs(ip.ip_len);
+	if (hl < sizeof(ip) || iplen > len || iplen < hl + sizeof(udp)) {
+		skipped++;
+		return;
+	}
+	memcpy(&udp, l3 + hl, sizeof(udp));
+	ulen = ntohs(udp.uh_ulen);
+	if (ulen < sizeof(udp) + offsetof(struct bootp, vend) ||
+	    ulen > iplen - hl)
+	{
+		skipped++;
+		return;
+	}
+
+	rec = record_new(KIND_DHCP);
+	rec->len = sizeof(eh) + iplen;
+	if ((rec->data = malloc(rec->len)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	memcpy(eh.ether_dhost, rec->ifp->hwaddr, sizeof(eh.ether_dhost));
+	memcpy(eh.ether_shost, server_hwaddr, sizeof(eh.ether_shost));
+	eh.ether_type = htons(ETHERTYPE_IP);
+	memcpy(rec->data, &eh, sizeof(eh));
+	memcpy(rec->data + sizeof(eh), l3, iplen);
+
+	state = D_CSTATE(rec->ifp);
+	udpp = rec->data + sizeof(eh) + hl;
+	bootp = udpp + sizeof(udp);
+	xid = htonl(state->xid);
+	memcpy(bootp + offsetof(struct bootp, xid), &xid, sizeof(xid));
+	memset(bootp + offsetof(struct bootp, chaddr), 0,
+	    sizeof(((struct bootp *)NULL)->chaddr));
+	memcpy(bootp + offsetof(struct bootp, chaddr),
+	    rec->ifp->hwaddr, rec->ifp->hwlen);
+	if (udp.uh_sum != 0)
+		udp4_cksum(&ip, udpp, ulen);
+}
+#endif
+
+#ifdef INET6
+static void
+record_msg(struct record *rec, const struct ip6_hdr *ip6)
+{
+	struct cmsghdr *cm;
+	struct in6_pktinfo pi = { .ipi6_ifindex = rec->ifp->index };
+	int hlim = ip6->ip6_hlim;
+
+	rec->from.sin6_family = AF_INET6;
+	rec->from.sin6_addr = ip6->ip6_src;
+	rec->from.sin6_scope_id = rec->ifp->index;
+	pi.ipi6_addr = ip6->ip6_dst;
+
+	rec->iov.iov_base = rbuf.buf;
+	rec->iov.iov_len = rec->len;
+	rec->msg.msg_name = &rec->from;
+	rec->msg.msg_namelen = sizeof(rec->from);
+	rec->msg.msg_iov = &rec->iov;
+	rec->msg.msg_iovlen = 1;
+	rec->msg.msg_control = rec->cmsg.buf;
+	rec->msg.msg_controllen = sizeof(rec->cmsg.buf);
+
+	cm = CMSG_FIRSTHDR(&rec->msg);
+	cm->cmsg_level = IPPROTO_IPV6;
+	cm->cmsg_type = IPV6_PKTINFO;
+	cm->cmsg_len = CMSG_LEN(sizeof(pi));
+	memcpy(CMSG_DATA(cm), &pi, sizeof(pi));
+	cm = CMSG_NXTHDR(&rec->msg, cm);
+	cm->cmsg_level = IPPROTO_IPV6;
+	cm->cmsg_type = IPV6_HOPLIMIT;
+	cm->cmsg_len = CMSG_LEN(sizeof(hlim));
+	memcpy(CMSG_DATA(cm), &hlim, sizeof(hlim));
+}
+
+#ifdef DHCP6
+/* Aim a DHCPv6 reply at its interface by giving it our client ID,
+ * the transaction we expect and our IAID. */
+static void
+load_dhcp6(const struct ip6_hdr *ip6, const uint8_t *m, size_t len)
+{
+	struct record *rec;
+	const struct dhcp6_state *state;
+	const struct if_options *ifo;
+	const uint8_t *o, *end;
+	uint8_t *p;
+	uint16_t code, olen;
+
+	if (len < 4) {
+		skipped++;
+		return;
+	}
+
+	rec = record_new(KIND_DHCP6);
+	if ((rec->data = malloc(len + ctx.duid_len + 4)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	state = D6_CSTATE(rec->ifp);
+	ifo = rec->ifp->options;
+	p = rec->data;
+	*p++ = *m;
+	memcpy(p, (const uint8_t *)state->send + 1, 3);
+	p += 3;
+
+	end = m + len;
+	for (o = m + 4; o + 4 <= end; o += 4 + olen) {
+		code = (uint16_t)(o[0] << 8 | o[1]);
+		olen = (uint16_t)(o[2] << 8 | o[3]);
+		if (olen > end - o - 4)
+			break;
+		if (code == D6_OPTION_CLIENTID) {
+			*p++ = o[0];
+			*p++ = o[1];
+			*p++ = (uint8_t)(ctx.duid_len >> 8);
+			*p++ = (uint8_t)ctx.duid_len;
+			memcpy(p, ctx.duid, ctx.duid_len);
+			p += ctx.duid_len;
+			continue;
+		}
+		memcpy(p, o, 4 + (size_t)olen);
+		if ((code == D6_OPTION_IA_NA || code == D6_OPTION_IA_TA ||
+		    code == D6_OPTION_IA_PD) && olen >= sizeof(ifo->iaid))
+			memcpy(p + 4, ifo->iaid, sizeof(ifo->iaid));
+		p += 4 + olen;
+	}
+	rec->len = (size_t)(p - rec->data);
+	record_msg(rec, ip6);
+}
+#endif
+
+static void
+load_ra(const struct ip6_hdr *ip6, const uint8_t *m, size_t len)
+{
+	struct record *rec;
+
+	rec = record_new(KIND_RA);
+	rec->len = len;
+	if ((rec->data = malloc(len)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	memcpy(rec->data, m, len);
+	record_msg(rec, ip6);
+}
+
+static void
+load_ip6(const uint8_t *l3, size_t len)
+{
+	struct ip6_hdr ip6;
+	struct udphdr udp;
+	size_t plen;
+
+	memcpy(&ip6, l3, sizeof(ip6));
+	plen = ntohs(ip6.ip6_plen);
+	if ((ip6.ip6_vfc & IPV6_VERSION_MASK) != IPV6_VERSION ||
+	    plen > len - sizeof(ip6))
+		goto skip;
+	l3 += sizeof(ip6);
+
+	switch (ip6.ip6_nxt) {
+#ifdef DHCP6
+	case IPPROTO_UDP:
+		if (plen < sizeof(udp))
+			goto skip;
+		memcpy(&udp, l3, sizeof(udp));
+		if (udp.uh_dport != htons(DHCP6_CLIENT_PORT) ||
+		    ntohs(udp.uh_ulen) < sizeof(udp) ||
+		    ntohs(udp.uh_ulen) > plen)
+			goto skip;
+		load_dhcp6(&ip6, l3 + sizeof(udp),
+		    ntohs(udp.uh_ulen) - sizeof(udp));
+		return;
+#endif
+	case IPPROTO_ICMPV6:
+		if (plen < sizeof(struct nd_router_advert) ||
+		    l3[0] != ND_ROUTER_ADVERT)
+			goto skip;
+		load_ra(&ip6, l3, plen);
+		return;
+	}
+
+skip:
+	skipped++;
+}
+#endif
+
+static void
+load_frame(const uint8_t *l3, size_t len, uint16_t type)
+{
+
+	/* One VLAN tag is stripped. */
+	if (type == ETHERTYPE_VLAN && len >= 4) {
+		type = (uint16_t)(l3[2] << 8 | l3[3]);
+		l3 += 4;
+		len -= 4;
+	}
+
+	switch (type) {
+#ifdef INET
+	case ETHERTYPE_IP:
+		if (len < sizeof(struct ip))
+			break;
+		load_dhcp(l3, len);
+		return;
+#endif
+#ifdef INET6
+	case ETHERTYPE_IPV6:
+		if (len < sizeof(struct ip6_hdr))
+			break;
+		load_ip6(l3, len);
+		return;
+#endif
+	}
+	skipped++;
+}
+
+static void
+load_pcap(const uint8_t *cap, size_t caplen)
+{
+	struct pcap_hdr ph;
+	struct pcap_rec pr;
+	const uint8_t *p, *end;
+	bool swap;
+	size_t l2;
+	uint32_t network;
+
+	if (caplen < sizeof(ph))
+		errx(EXIT_FAILURE, "capture too short");
+	memcpy(&ph, cap, sizeof(ph));
+	if (ph.magic == PCAP_MAGIC || ph.magic == PCAP_NSEC_MAGIC)
+		swap = false;
+	else if (ph.magic == bswap32(PCAP_MAGIC) ||
+	    ph.magic == bswap32(PCAP_NSEC_MAGIC))
+		swap = true;
+	else
+		errx(EXIT_FAILURE, "not a pcap capture");
+	network = swap ? bswap32(ph.network) : ph.network;
+	switch (network) {
+	case LINKTYPE_ETHERNET:
+		l2 = sizeof(struct ether_header);
+		break;
+	case LINKTYPE_LINUX_SLL:
+		l2 = SLL_HDRLEN;
+		break;
+	default:
+		errx(EXIT_FAILURE, "unsupported link type %u", network);
+	}
+
+	end = cap + caplen;
+	for (p = cap + sizeof(ph); p + sizeof(pr) <= end;) {
+		memcpy(&pr, p, sizeof(pr));
+		p += sizeof(pr);
+		if (swap) {
+			pr.caplen = bswap32(pr.caplen);
+			pr.len = bswap32(pr.len);
+		}
+		if (pr.caplen > end - p)
+			break;
+		/* Truncated frames cannot be checked. */
+		if (pr.caplen != pr.len || pr.caplen < l2 ||
+		    pr.caplen > PCAP_SNAPLEN)
+			skipped++;
+		else
+			load_frame(p + l2, pr.caplen - l2,
+			    (uint16_t)(p[l2 - 2] << 8 | p[l2 - 1]));
+		p += pr.caplen;
+	}
+}
+
+/*
+ * The built in capture holds for each interface a DHCP OFFER,
+ * a DHCPv6 REPLY to a REQUEST and a Router Advertisement,
+ * written as a server and router on the link would send them.
+ */
+struct capture {
+	uint8_t *buf;
+	size_t len;
+	size_t size;
+};
+
+static uint8_t *
+capture_add(struct capture *c, size_t len)
+{
+	struct pcap_rec pr = {
+		.caplen = (uint32_t)len,
+		.len = (uint32_t)len,
+	};
+	uint8_t *p;
+
+	if (c->size - c->len < sizeof(pr) + len) {
+		size_t size = c->size == 0 ? 4096 : c->size * 2;
+
+		while (size - c->len < sizeof(pr) + len)
+			size *= 2;
+		if ((p = realloc(c->buf, size)) == NULL)
+			err(EXIT_FAILURE, "realloc");
+		c->buf = p;
+		c->size = size;
+	}
+	p = c->buf + c->len;
+	memcpy(p, &pr, sizeof(pr));
+	c->len += sizeof(pr) + len;
+	return p + sizeof(pr);
+}
+
+static uint8_t *
+add_ether(uint8_t *p, const uint8_t *dst, uint16_t type)
+{
+	struct ether_header eh;
+
+	memcpy(eh.ether_dhost, dst, sizeof(eh.ether_dhost));
+	memcpy(eh.ether_shost, server_hwaddr, sizeof(eh.ether_shost));
+	eh.ether_type = htons(type);
+	memcpy(p, &eh, sizeof(eh));
+	return p + sizeof(eh);
+}
+
+static uint8_t *
+add_opt(uint8_t *p, uint8_t code, const void *data, uint8_t len)
+{
+
+	*p++ = code;
+	*p++ = len;
+	memcpy(p, data, len);
+	return p + len;
+}
+
+#ifdef INET
+static void
+build_dhcp(struct capture *c, const struct interface *ifp, unsigned int i)
+{
+	struct bootp_pkt pkt;
+	struct bootp *bootp = &pkt.bootp;
+	uint8_t *p, type = DHCP_OFFER;
+	uint32_t cookie = htonl(MAGIC_COOKIE), lt = htonl(3600);
+	struct in_addr server = { .s_addr = htonl(0x0a000001) };
+	struct in_addr mask = { .s_addr = htonl(0xffff0000) };
+	struct in_addr dns[2] = {
+		{ .s_addr = htonl(0x0a000002) },
+		{ .s_addr = htonl(0x0a000003) },
+	};
+	static const uint8_t bcast[ETHER_ADDR_LEN] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+	};
+
+	memset(&pkt, 0, sizeof(pkt));
+	bootp->op = BOOTREPLY;
+	bootp->htype = (uint8_t)ifp->hwtype;
+	bootp->hlen = ifp->hwlen;
+	bootp->xid = htonl(D_CSTATE(ifp)->xid);
+	bootp->yiaddr = htonl(0x0a010000 | (i + 10));
+	bootp->siaddr = server.s_addr;
+	memcpy(bootp->chaddr, ifp->hwaddr, ifp->hwlen);
+	memcpy(bootp->vend, &cookie, sizeof(cookie));
+	p = bootp->vend + sizeof(cookie);
+	p = add_opt(p, DHO_MESSAGETYPE, &type, sizeof(type));
+	p = add_opt(p, DHO_SERVERID, &server, sizeof(server));
+	p = add_opt(p, DHO_LEASETIME, &lt, sizeof(lt));
+	p = add_opt(p, DHO_SUBNETMASK, &mask, sizeof(mask));
+	p = add_opt(p, DHO_ROUTER, &server, sizeof(server));
+	p = add_opt(p, DHO_DNSSERVER, dns, sizeof(dns));
+	p = add_opt(p, DHO_DNSDOMAIN, "example.org", 11);
+	*p = DHO_END;
+
+	pkt.udp.uh_sport = htons(BOOTPS);
+	pkt.udp.uh_dport = htons(BOOTPC);
+	pkt.udp.uh_ulen = htons(sizeof(pkt.udp) + sizeof(*bootp));
+	pkt.ip.ip_v = IPVERSION;
+	pkt.ip.ip_hl = sizeof(pkt.ip) >> 2;
+	pkt.ip.ip_len = htons(sizeof(pkt));
+	pkt.ip.ip_ttl = IPDEFTTL;
+	pkt.ip.ip_p = IPPROTO_UDP;
+	pkt.ip.ip_src = server;
+	pkt.ip.ip_dst.s_addr = htonl(INADDR_BROADCAST);
+	pkt.ip.ip_sum = in_cksum(&pkt.ip, sizeof(pkt.ip), NULL);
+	udp4_cksum(&pkt.ip, (uint8_t *)&pkt.udp,
+	    sizeof(pkt.udp) + sizeof(*bootp));
+
+	p = capture_add(c, sizeof(struct ether_header) + sizeof(pkt));
+	p = add_ether(p, bcast, ETHERTYPE_IP);
+	memcpy(p, &pkt, sizeof(pkt));
+}
+#endif
+
+#ifdef INET6
+static const struct in6_addr router_ll = {
+	.s6_addr = { 0xfe, 0x80, [15] = 0x01 }
+};
+
+static void
+ip6_linklocal(struct in6_addr *addr, const struct interface *ifp)
+{
+
+	/* Modified EUI-64 from the hardware address. */
+	memset(addr, 0, sizeof(*addr));
+	addr->s6_addr[0] = 0xfe;
+	addr->s6_addr[1] = 0x80;
+	addr->s6_addr[8] = ifp->hwaddr[0] ^ 0x02;
+	addr->s6_addr[9] = ifp->hwaddr[1];
+	addr->s6_addr[10] = ifp->hwaddr[2];
+	addr->s6_addr[11] = 0xff;
+	addr->s6_addr[12] = 0xfe;
+	addr->s6_addr[13] = ifp->hwaddr[3];
+	addr->s6_addr[14] = ifp->hwaddr[4];
+	addr->s6_addr[15] = ifp->hwaddr[5];
+}
+
+/* Write the IPv6 header in front of an upper layer of len bytes
+ * at p + sizeof(struct ip6_hdr) and fill in its checksum at csum. */
+static void
+add_ip6(uint8_t *p, const struct in6_addr *dst, uint8_t nxt, uint8_t hlim,
+    size_t len, size_t csum)
+{
+	struct ip6_hdr ip6 = {
+		.ip6_src = router_ll,
+		.ip6_dst = *dst,
+	};
+	struct {
+		struct in6_addr src;
+		struct in6_addr dst;
+		uint32_t len;
+		uint8_t zero[3];
+		uint8_t nxt;
+	} ph = {
+		.src = ip6.ip6_src,
+		.dst = ip6.ip6_dst,
+		.len = htonl((uint32_t)len),
+		.nxt = nxt,
+	};
+	uint16_t sum;
+
+	/* The version and lengths share a union, so
+	 * they cannot be designated initialisers. */
+	ip6.ip6_flow = 0;
+	ip6.ip6_vfc = IPV6_VERSION;
+	ip6.ip6_plen = htons((uint16_t)len);
+	ip6.ip6_nxt = nxt;
+	ip6.ip6_hlim = hlim;
+	memcpy(p, &ip6, sizeof(ip6));
+	p += sizeof(ip6);
+	sum = l4_cksum(&ph, sizeof(ph), p, len);
+	memcpy(p + csum, &sum, sizeof(sum));
+}
+
+static uint8_t *
+add_opt6(uint8_t *p, uint16_t code, const void *data, uint16_t len)
+{
+	uint16_t n;
+
+	n = htons(code);
+	memcpy(p, &n, sizeof(n));
+	n = htons(len);
+	memcpy(p + 2, &n, sizeof(n));
+	if (data != NULL)
+		memcpy(p + 4, data, len);
+	return p + 4 + len;
+}
+
+#ifdef DHCP6
+static void
+build_dhcp6(struct capture *c, const struct interface *ifp, unsigned int i)
+{
+	uint8_t msg[256], ia[12 + 4 + 16 + 8], *p, *f;
+	uint8_t serverid[4 + ETHER_ADDR_LEN] = { 0, 3, 0, 1 };
+	struct in6_addr dst, addr = { .s6_addr = { 0x20, 0x01, 0x0d, 0xb8 } };
+	struct in6_addr dns = { .s6_addr = { 0x20, 0x01, 0x0d, 0xb8,
+	    [14] = 0x00, [15] = 0x53 } };
+	uint32_t v;
+	struct udphdr udp;
+	size_t mlen;
+
+	memcpy(serverid + 4, server_hwaddr, ETHER_ADDR_LEN);
+
+	/* IA_NA with T1, T2 and one address. */
+	memcpy(ia, ifp->options->iaid, 4);
+	v = htonl(1800);
+	memcpy(ia + 4, &v, sizeof(v));
+	v = htonl(2880);
+	memcpy(ia + 8, &v, sizeof(v));
+	addr.s6_addr[6] = (uint8_t)(i >> 8);
+	addr.s6_addr[7] = (uint8_t)i;
+	addr.s6_addr[15] = 0x10;
+	p = add_opt6(ia + 12, D6_OPTION_IA_ADDR, NULL, 16 + 8);
+	memcpy(p - 24, &addr, sizeof(addr));
+	v = htonl(3600);
+	memcpy(p - 8, &v, sizeof(v));
+	v = htonl(7200);
+	memcpy(p - 4, &v, sizeof(v));
+
+	p = msg;
+	*p++ = DHCP6_REPLY;
+	memcpy(p, (const uint8_t *)D6_CSTATE(ifp)->send + 1, 3);
+	p += 3;
+	p = add_opt6(p, D6_OPTION_CLIENTID, ctx.duid, (uint16_t)ctx.duid_len);
+	p = add_opt6(p, D6_OPTION_SERVERID, serverid, sizeof(serverid));
+	p = add_opt6(p, D6_OPTION_IA_NA, ia, sizeof(ia));
+	p = add_opt6(p, D6_OPTION_DNS_SERVERS, &dns, sizeof(dns));
+	p = add_opt6(p, D6_OPTION_DOMAIN_LIST, "\007example\003org", 13);
+	mlen = (size_t)(p - msg);
+
+	udp.uh_sport = htons(DHCP6_SERVER_PORT);
+	udp.uh_dport = htons(DHCP6_CLIENT_PORT);
+	udp.uh_ulen = htons((uint16_t)(sizeof(udp) + mlen));
+	udp.uh_sum = 0;
+
+	ip6_linklocal(&dst, ifp);
+	f = capture_add(c, sizeof(struct ether_header) +
+	    sizeof(struct ip6_hdr) + sizeof(udp) + mlen);
+	f = add_ether(f, ifp->hwaddr, ETHERTYPE_IPV6);
+	p = f + sizeof(struct ip6_hdr);
+	memcpy(p, &udp, sizeof(udp));
+	memcpy(p + sizeof(udp), msg, mlen);
+	add_ip6(f, &dst, IPPROTO_UDP, 64, sizeof(udp) + mlen,
+	    offsetof(struct udphdr, uh_sum));
+}
+#endif
+
+static void
+build_ra(struct capture *c, unsigned int i)
+{
+	struct nd_router_advert ra = {
+		.nd_ra_type = ND_ROUTER_ADVERT,
+		.nd_ra_curhoplimit = 64,
+		.nd_ra_router_lifetime = htons(1800),
+	};
+	struct nd_opt_prefix_info pi = {
+		.nd_opt_pi_type = ND_OPT_PREFIX_INFORMATION,
+		.nd_opt_pi_len = sizeof(pi) / 8,
+		.nd_opt_pi_prefix_len = 64,
+		.nd_opt_pi_flags_reserved =
+		    ND_OPT_PI_FLAG_ONLINK | ND_OPT_PI_FLAG_AUTO,
+		.nd_opt_pi_valid_time = htonl(86400),
+		.nd_opt_pi_preferred_time = htonl(14400),
+		.nd_opt_pi_prefix = { .s6_addr = { 0x20, 0x01, 0x0d, 0xb8,
+		    0x10, 0x00, (uint8_t)(i >> 8), (uint8_t)i } },
+	};
+	/* RDNSS, RFC 8106, with one server. */
+	uint8_t rdnss[8 + 16] = { 25, 3, 0, 0, 0, 0, 0x07, 0x08,
+	    0x20, 0x01, 0x0d, 0xb8, [22] = 0x00, [23] = 0x53 };
+	uint8_t slla[8] = { ND_OPT_SOURCE_LINKADDR, 1 };
+	static const struct in6_addr allnodes = {
+		.s6_addr = { 0xff, 0x02, [15] = 0x01 }
+	};
+	static const uint8_t allnodes_hw[ETHER_ADDR_LEN] = {
+		0x33, 0x33, 0x00, 0x00, 0x00, 0x01
+	};
+	size_t len = sizeof(ra) + sizeof(pi) + sizeof(rdnss) + sizeof(slla);
+	uint8_t *f, *p;
+
+	memcpy(slla + 2, server_hwaddr, ETHER_ADDR_LEN);
+	f = capture_add(c, sizeof(struct ether_header) +
+	    sizeof(struct ip6_hdr) + len);
+	f = add_ether(f, allnodes_hw, ETHERTYPE_IPV6);
+	p = f + sizeof(struct ip6_hdr);
+	memcpy(p, &ra, sizeof(ra));
+	p += sizeof(ra);
+	memcpy(p, &pi, sizeof(pi));
+	p += sizeof(pi);
+	memcpy(p, rdnss, sizeof(rdnss));
+	p += sizeof(rdnss);
+	memcpy(p, slla, sizeof(slla));
+	add_ip6(f, &allnodes, IPPROTO_ICMPV6, 255, len,
+	    offsetof(struct icmp6_hdr, icmp6_cksum));
+}
+#endif
+
+static void
+build_capture(struct capture *c)
+{
+	struct pcap_hdr ph = {
+		.magic = PCAP_MAGIC,
+		.major = 2,
+		.minor = 4,
+		.snaplen = PCAP_SNAPLEN,
+		.network = LINKTYPE_ETHERNET,
+	};
+	unsigned int i;
+
+	memset(c, 0, sizeof(*c));
+	capture_add(c, 0);
+	c->len = 0;
+	memcpy(c->buf, &ph, sizeof(ph));
+	c->len = sizeof(ph);
+	for (i = 0; i < nifaces; i++) {
+#ifdef INET
+		build_dhcp(c, ifaces[i], i);
+#endif
+#ifdef DHCP6
+		build_dhcp6(c, ifaces[i], i);
+#endif
+#ifdef INET6
+		build_ra(c, i);
+#endif
+	}
+}
+
+static void
+read_capture(struct capture *c, const char *file)
+{
+	FILE *fp;
+	uint8_t *p;
+	size_t n;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		err(EXIT_FAILURE, "%s", file);
+	memset(c, 0, sizeof(*c));
+	for (;;) {
+		if (c->size - c->len < 4096) {
+			c->size = c->size == 0 ? 65536 : c->size * 2;
+			if ((p = realloc(c->buf, c->size)) == NULL)
+				err(EXIT_FAILURE, "realloc");
+			c->buf = p;
+		}
+		n = fread(c->buf + c->len, 1, c->size - c->len, fp);
+		c->len += n;
+		if (n == 0)
+			break;
+	}
+	if (ferror(fp))
+		err(EXIT_FAILURE, "%s", file);
+	fclose(fp);
+}
+
+static void
+write_capture(const struct capture *c, const char *file)
+{
+	FILE *fp;
+
+	if ((fp = fopen(file, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", file);
+	if (fwrite(c->buf, 1, c->len, fp) != c->len || fclose(fp) == EOF)
+		err(EXIT_FAILURE, "%s", file);
+}
+
+/* Protocol states waiting for the replies in the capture. */
+static void
+setup_states(struct interface *ifp, unsigned int i)
+{
+#ifdef DHCP6
+	struct if_options *ifo = ifp->options;
+#endif
+#ifdef INET
+	static struct bpf *bpfs;
+	struct dhcp_state *state;
+#endif
+#ifdef INET6
+	struct ipv6_state *state6;
+	struct ipv6_addr *ia;
+	struct in6_addr ll;
+#endif
+#ifdef DHCP6
+	struct dhcp6_state *d6;
+	uint8_t *send;
+#endif
+
+#ifdef INET
+	if (bpfs == NULL && (bpfs = calloc(nifaces, sizeof(*bpfs))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	state = arena_get(&ifp->arena, sizeof(*state));
+	if (state == NULL)
+		err(EXIT_FAILURE, "arena_get");
+	ifp->if_data[IF_DATA_DHCP] = state;
+	state->ifp = ifp;
+	state->udp_rfd = -1;
+#ifdef ARPING
+	state->arping_index = -1;
+#endif
+	state->state = DHS_DISCOVER;
+	state->reason = "PREINIT";
+	bpfs[i].bpf_ifp = ifp;
+	bpfs[i].bpf_fd = -1;
+	state->bpf = &bpfs[i];
+	state->xid = state->xid_key = 0x5a000000 | i;
+	if (rb_tree_insert_node(&ctx.dhcp_xids, state) == state)
+		state->xid_indexed = true;
+#endif
+
+#ifdef INET6
+	state6 = arena_get(&ifp->arena, sizeof(*state6));
+	if (state6 == NULL)
+		err(EXIT_FAILURE, "arena_get");
+	ifp->if_data[IF_DATA_IPV6] = state6;
+	TAILQ_INIT(&state6->addrs);
+	TAILQ_INIT(&state6->ll_callbacks);
+	ip6_linklocal(&ll, ifp);
+	if ((ia = ipv6_newaddr(ifp, &ll, 64, 0)) == NULL)
+		err(EXIT_FAILURE, "ipv6_newaddr");
+	ia->addr_flags = 0;
+	ia->flags |= IPV6_AF_ADDED;
+	TAILQ_INSERT_TAIL(&state6->addrs, ia, next);
+
+	ifp->if_data[IF_DATA_IPV6ND] = arena_get(&ifp->arena,
+	    sizeof(struct rs_state));
+	if (ifp->if_data[IF_DATA_IPV6ND] == NULL)
+		err(EXIT_FAILURE, "arena_get");
+#endif
+
+#ifdef DHCP6
+	/* An IA_NA for the REQUEST to have been for. */
+	if (ifo->ia_len == 0 && ifo->options & DHCPCD_IPV6) {
+		if ((ifo->ia = calloc(1, sizeof(*ifo->ia))) == NULL)
+			err(EXIT_FAILURE, "calloc");
+		ifo->ia_len = 1;
+		ifo->ia->ia_type = D6_OPTION_IA_NA;
+		memcpy(ifo->ia->iaid, ifo->iaid, sizeof(ifo->iaid));
+	}
+
+	d6 = arena_get(&ifp->arena, sizeof(*d6));
+	if (d6 == NULL)
+		err(EXIT_FAILURE, "arena_get");
+	ifp->if_data[IF_DATA_DHCP6] = d6;
+	TAILQ_INIT(&d6->addrs);
+	d6->sol_max_rt = SOL_MAX_RT;
+	d6->inf_max_rt = INF_MAX_RT;
+	d6->state = DH6S_REQUEST;
+	/* The type and transaction of the REQUEST we sent. */
+	if ((send = calloc(1, 4)) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	send[0] = DHCP6_REQUEST;
+	send[1] = (uint8_t)(i >> 16);
+	send[2] = (uint8_t)(i >> 8);
+	send[3] = (uint8_t)i;
+	d6->send = (void *)send;
+	d6->send_len = 4;
+#endif
+}
+
+static void
+setup(void)
+{
+	struct interface *ifp;
+	unsigned int i;
+	char name[IF_NAMESIZE];
+	uint8_t hwaddr[ETHER_ADDR_LEN] = { 2, 0, 0x5e, 0 };
+
+	bench_ctx_init(&ctx);
+
+	/* DUID-LL from a made up address. */
+	ctx.duid_len = 4 + ETHER_ADDR_LEN;
+	if ((ctx.duid = malloc(ctx.duid_len)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	memcpy(ctx.duid, "\000\003\000\001\002\000\136\000\000\001",
+	    ctx.duid_len);
+
+	if ((ifaces = calloc(nifaces, sizeof(*ifaces))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	for (i = 0; i < nifaces; i++) {
+		snprintf(name, sizeof(name), "rb%u", i);
+		hwaddr[4] = (uint8_t)(i >> 8);
+		hwaddr[5] = (uint8_t)i;
+		/* Well clear of any real interface. */
+		ifp = bench_if_new(&ctx, name, 100000 + i, hwaddr);
+		setup_states(ifp, i);
+		ifaces[i] = ifp;
+	}
+}
+
+static void
+dispatch(enum kind kind, struct record *rec)
+{
+
+	memcpy(rbuf.buf + 2, rec->data, rec->len);
+	switch (kind) {
+#ifdef INET
+	case KIND_DHCP:
+		dhcp_packet(rec->ifp, rbuf.buf + 2, rec->len, 0, NULL);
+		break;
+#endif
+#ifdef DHCP6
+	case KIND_DHCP6:
+		rec->iov.iov_base = rbuf.buf + 2;
+		dhcp6_recvmsg(&ctx, &rec->msg, NULL);
+		break;
+#endif
+#ifdef INET6
+	case KIND_RA:
+		rec->iov.iov_base = rbuf.buf + 2;
+		ipv6nd_recvmsg(&ctx, &rec->msg);
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+/* One pass to build the state a reply leaves behind, then time
+ * the passes over what a repeated reply costs. */
+static void
+bench(enum kind kind)
+{
+	struct records *r = &records[kind];
+	unsigned long pass;
+	unsigned long long allocs;
+	double start, t;
+	size_t i;
+
+	if (r->len == 0)
+		return;
+
+	for (i = 0; i < r->len; i++)
+		dispatch(kind, &r->recs[i]);
+
+	allocs = nallocs;
+	start = now();
+	for (pass = 0; pass < passes; pass++) {
+		for (i = 0; i < r->len; i++)
+			dispatch(kind, &r->recs[i]);
+	}
+	t = now() - start;
+	allocs = nallocs - allocs;
+
+	printf("%-6s %6zu frames %10.0f packets/s %6.2f allocs/packet\n",
+	    kind_names[kind], r->len, (double)(r->len * passes) / t,
+	    (double)allocs / (double)(r->len * passes));
+}
+
+int
+main(int argc, char **argv)
+{
+	struct capture c;
+	const char *rfile = NULL, *wfile = NULL;
+	unsigned int logopts = 0;
+	int ch, k;
+
+	while ((ch = getopt(argc, argv, "c:f:i:r:vw:")) != -1) {
+		switch (ch) {
+		case 'c':
+			passes = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			ctx.cffile = optarg;
+			break;
+		case 'i':
+			nifaces = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rfile = optarg;
+			break;
+		case 'v':
+			logopts = LOGERR_ERR | LOGERR_DEBUG;
+			break;
+		case 'w':
+			wfile = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-v] [-c passes] "
+			    "[-f config] [-i interfaces]\n"
+			    "\t[-r capture] [-w capture]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (nifaces == 0 || passes == 0)
+		errx(EXIT_FAILURE, "passes and interfaces must be positive");
+
+	logsetopts(logopts);
+	setup();
+
+	if (rfile != NULL)
+		read_capture(&c, rfile);
+	else
+		build_capture(&c);
+	if (wfile != NULL)
+		write_capture(&c, wfile);
+	load_pcap(c.buf, c.len);
+	free(c.buf);
+
+	printf("%u interfaces, %lu passes", nifaces, passes);
+	if (skipped != 0)
+		printf(", %zu frames skipped", skipped);
+	printf("\n");
+	for (k = 0; k < KIND_MAX; k++)
+		bench((enum kind)k);
+	return EXIT_SUCCESS;
+}
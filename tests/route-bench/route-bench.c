@@ -0,0 +1,569 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - route build benchmark
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <err.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "dhcpcd.h"
+#include "eloop.h"
+#include "if.h"
+#include "ipv4.h"
+#include "ipv4ll.h"
+#include "ipv6.h"
+#include "logerr.h"
+#include "route.h"
+#include "sa.h"
+#include "snapshot.h"
+
+/*
+ * route.c is linked against this file, which stands in for both the
+ * routes the protocols want and the kernel routing table.
+ * Interface i wants a subnet route, a default route and nstatic
+ * RFC 3442 routes over IPv4, plus a default route and nra RA prefix
+ * routes over IPv6.
+ * Interface i has metric 200 + i, so on systems without route
+ * metrics only the first default route of each family is installed.
+ */
+
+static struct dhcpcd_ctx ctx;
+static struct interface *ifaces;
+static struct if_options *ifos;
+static unsigned int *gwgen;		/* bumped to change a gateway */
+static unsigned int nifaces = 16, nstatic = 32, nra = 8;
+
+static rb_tree_t kernel;
+static size_t kops, kmsgs, kdumps, errors;
+
+static int
+kernel_compare(__unused void *context, const void *node1, const void *node2)
+{
+	const struct rt *rt1 = node1, *rt2 = node2;
+	int c;
+
+	c = sa_cmp(&rt1->rt_dest, &rt2->rt_dest);
+	if (c != 0)
+		return c;
+	c = sa_cmp(&rt1->rt_netmask, &rt2->rt_netmask);
+#ifdef HAVE_ROUTE_METRIC
+	if (c == 0)
+		c = (int)(rt1->rt_metric - rt2->rt_metric);
+#endif
+	return c;
+}
+
+static const rb_tree_ops_t kernel_ops = {
+	.rbto_compare_nodes = kernel_compare,
+	.rbto_compare_key = kernel_compare,
+	.rbto_node_offset = offsetof(struct rt, rt_tree),
+	.rbto_context = NULL
+};
+
+static void
+kernel_clear(void)
+{
+	struct rt *rt;
+
+	while ((rt = RB_TREE_MIN(&kernel)) != NULL) {
+		rb_tree_remove_node(&kernel, rt);
+		free(rt);
+	}
+}
+
+static size_t
+kernel_count(int af)
+{
+	struct rt *rt;
+	size_t n = 0;
+
+	RB_TREE_FOREACH(rt, &kernel) {
+		if (rt->rt_dest.sa_family == af)
+			n++;
+	}
+	return n;
+}
+
+/* Like the kernel, refuse to add what exists or touch what doesn't. */
+static int
+kernel_route(unsigned char cmd, const struct rt *rt)
+{
+	struct rt *krt;
+
+	kops++;
+	krt = rb_tree_find_node(&kernel, rt);
+	switch (cmd) {
+	case RTM_ADD:
+		if (krt != NULL) {
+			errno = EEXIST;
+			return -1;
+		}
+		if ((krt = malloc(sizeof(*krt))) == NULL)
+			return -1;
+		memcpy(krt, rt, sizeof(*krt));
+		rb_tree_insert_node(&kernel, krt);
+		return 0;
+	case RTM_CHANGE:
+		if (krt == NULL) {
+			errno = ESRCH;
+			return -1;
+		}
+		rb_tree_remove_node(&kernel, krt);
+		memcpy(krt, rt, sizeof(*krt));
+		rb_tree_insert_node(&kernel, krt);
+		return 0;
+	case RTM_DELETE:
+		if (krt == NULL) {
+			errno = ESRCH;
+			return -1;
+		}
+		rb_tree_remove_node(&kernel, krt);
+		free(krt);
+		return 0;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+int
+if_route(unsigned char cmd, const struct rt *rt)
+{
+
+	kmsgs++;
+	return kernel_route(cmd, rt);
+}
+
+#ifdef HAVE_IF_ROUTES
+int
+if_routes(__unused struct dhcpcd_ctx *c, struct if_rtreq *reqs, size_t n)
+{
+	size_t i;
+	int failed = 0;
+
+	kmsgs++;
+	for (i = 0; i < n; i++) {
+		if (kernel_route(reqs[i].cmd, reqs[i].rt) == -1) {
+			reqs[i].error = errno;
+			failed++;
+		} else
+			reqs[i].error = 0;
+	}
+	return failed == 0 ? 0 : -1;
+}
+#endif
+
+int
+if_initrt(struct dhcpcd_ctx *c, rb_tree_t *kroutes, int af)
+{
+	struct rt *krt, *rt;
+
+	kdumps++;
+	RB_TREE_FOREACH(krt, &kernel) {
+		if (af != AF_UNSPEC && krt->rt_dest.sa_family != af)
+			continue;
+		if ((rt = rt_new0(c)) == NULL)
+			return -1;
+		memcpy(rt, krt, sizeof(*rt));
+		if (rb_tree_insert_node(kroutes, rt) != rt)
+			rt_free(rt);
+	}
+	return 0;
+}
+
+#ifdef BSD
+int
+if_missfilter(__unused struct interface *ifp, __unused struct sockaddr *sa)
+{
+
+	return 0;
+}
+
+int
+if_missfilter_apply(__unused struct dhcpcd_ctx *c)
+{
+
+	return 0;
+}
+#endif
+
+#if defined(IPV4LL) && defined(HAVE_ROUTE_METRIC)
+int
+ipv4ll_recvrt(__unused int cmd, __unused const struct rt *rt)
+{
+
+	return 0;
+}
+#endif
+
+void
+snapshot_queue(__unused struct dhcpcd_ctx *c)
+{
+}
+
+int
+eloop_q_timeout_add_sec_named(__unused struct eloop *e, __unused int q,
+    __unused unsigned int secs, __unused void (*cb)(void *),
+    __unused void *arg, __unused const char *name)
+{
+
+	return 0;
+}
+
+void
+log_infox(__unused const char *fmt, ...)
+{
+}
+
+void
+log_err(const char *fmt, ...)
+{
+	va_list va;
+
+	errors++;
+	va_start(va, fmt);
+	vfprintf(stderr, fmt, va);
+	va_end(va);
+	fprintf(stderr, ": %s\n", strerror(errno));
+}
+
+static struct rt *
+bench_rt4(struct interface *ifp, in_addr_t dest, in_addr_t mask,
+    in_addr_t gw)
+{
+	struct rt *rt;
+	struct in_addr in;
+
+	if ((rt = rt_new(ifp)) == NULL)
+		err(EXIT_FAILURE, "rt_new");
+	in.s_addr = htonl(dest);
+	sa_in_init(&rt->rt_dest, &in);
+	in.s_addr = htonl(mask);
+	sa_in_init(&rt->rt_netmask, &in);
+	if (gw == INADDR_ANY)
+		rt->rt_gateway.sa_family = AF_UNSPEC;
+	else {
+		in.s_addr = htonl(gw);
+		sa_in_init(&rt->rt_gateway, &in);
+	}
+	rt->rt_dflags |= RTDF_DHCP;
+	return rt;
+}
+
+bool
+inet_getroutes(struct dhcpcd_ctx *c, rb_tree_t *routes)
+{
+	struct interface *ifp;
+	in_addr_t net, gw;
+	unsigned int i, j;
+
+	for (i = 0; i < nifaces; i++) {
+		ifp = &ifaces[i];
+		/* 10.i.i.0/24 with the router at .1 or .2 */
+		net = 0x0a000000 | (i << 8);
+		gw = net | (1 + (gwgen[i] & 1));
+		rt_proto_add_ctx(routes, bench_rt4(ifp, net, 0xffffff00,
+		    INADDR_ANY), c);
+		rt_proto_add_ctx(routes, bench_rt4(ifp, 0, 0, gw), c);
+		/* Classless static routes from 11.0.0.0/8 */
+		for (j = 0; j < nstatic; j++)
+			rt_proto_add_ctx(routes, bench_rt4(ifp,
+			    0x0b000000 | ((i * nstatic + j) << 8),
+			    0xffffff00, gw), c);
+	}
+	return true;
+}
+
+static struct rt *
+bench_rt6(struct interface *ifp, unsigned int i, unsigned int j, bool def)
+{
+	struct rt *rt;
+	struct in6_addr in6;
+
+	if ((rt = rt_new(ifp)) == NULL)
+		err(EXIT_FAILURE, "rt_new");
+	memset(&in6, 0, sizeof(in6));
+	if (def) {
+		sa_in6_init(&rt->rt_dest, &in6);
+		sa_in6_init(&rt->rt_netmask, &in6);
+		in6.s6_addr[0] = 0xfe;
+		in6.s6_addr[1] = 0x80;
+		in6.s6_addr[15] = 1;
+		sa_in6_init(&rt->rt_gateway, &in6);
+	} else {
+		/* 2001:db8:i:j::/64 */
+		in6.s6_addr[0] = 0x20;
+		in6.s6_addr[1] = 0x01;
+		in6.s6_addr[2] = 0x0d;
+		in6.s6_addr[3] = 0xb8;
+		in6.s6_addr[4] = (uint8_t)(i >> 8);
+		in6.s6_addr[5] = (uint8_t)i;
+		in6.s6_addr[6] = (uint8_t)(j >> 8);
+		in6.s6_addr[7] = (uint8_t)j;
+		sa_in6_init(&rt->rt_dest, &in6);
+		memset(&in6, 0, sizeof(in6));
+		memset(&in6, 0xff, 8);
+		sa_in6_init(&rt->rt_netmask, &in6);
+		rt->rt_gateway.sa_family = AF_UNSPEC;
+	}
+	rt->rt_dflags |= RTDF_RA;
+	return rt;
+}
+
+bool
+inet6_getroutes(struct dhcpcd_ctx *c, rb_tree_t *routes)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < nifaces; i++) {
+		for (j = 0; j < nra; j++)
+			rt_proto_add_ctx(routes,
+			    bench_rt6(&ifaces[i], i, j, false), c);
+		rt_proto_add_ctx(routes, bench_rt6(&ifaces[i], i, 0, true), c);
+	}
+	return true;
+}
+
+static void
+setup(void)
+{
+	unsigned int i;
+
+	if (nifaces > 255 || nra > 65535 ||
+	    (unsigned long)nifaces * nstatic > 65536)
+		errx(EXIT_FAILURE, "too many interfaces or routes");
+
+	ifaces = calloc(nifaces, sizeof(*ifaces));
+	ifos = calloc(nifaces, sizeof(*ifos));
+	gwgen = calloc(nifaces, sizeof(*gwgen));
+	if (ifaces == NULL || ifos == NULL || gwgen == NULL)
+		err(EXIT_FAILURE, "calloc");
+
+	ctx.options = DHCPCD_GATEWAY;
+	rt_init(&ctx);
+	rb_tree_init(&kernel, &kernel_ops);
+	for (i = 0; i < nifaces; i++) {
+		ifos[i].options = DHCPCD_GATEWAY;
+		ifaces[i].ctx = &ctx;
+		ifaces[i].options = &ifos[i];
+		ifaces[i].active = IF_ACTIVE_USER;
+		ifaces[i].index = i + 1;
+		ifaces[i].metric = 200 + i;
+		snprintf(ifaces[i].name, sizeof(ifaces[i].name), "bench%u", i);
+	}
+}
+
+static void
+build(void)
+{
+
+	rt_build(&ctx, AF_INET);
+	rt_build(&ctx, AF_INET6);
+}
+
+/* Forget everything, as if dhcpcd had just started on an empty table. */
+static void
+reset(void)
+{
+
+	rt_headclear(&ctx.routes, AF_UNSPEC);
+	rt_kroutes_flush(&ctx, AF_UNSPEC);
+	kernel_clear();
+}
+
+static void
+check(const char *what)
+{
+#ifdef HAVE_ROUTE_METRIC
+	size_t defs = nifaces;
+#else
+	size_t defs = 1;
+#endif
+	size_t want4 = nifaces * (nstatic + 1) + defs;
+	size_t want6 = nifaces * nra + defs;
+	size_t got4 = kernel_count(AF_INET), got6 = kernel_count(AF_INET6);
+
+	if (errors != 0)
+		errx(EXIT_FAILURE, "%s: %zu errors", what, errors);
+	if (got4 != want4 || got6 != want6)
+		errx(EXIT_FAILURE, "%s: kernel has %zu/%zu routes, "
+		    "expected %zu/%zu", what, got4, got6, want4, want6);
+}
+
+static double
+elapsed_us(const struct timespec *start)
+{
+	struct timespec end;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return (double)(end.tv_sec - start->tv_sec) * 1e6 +
+	    (double)(end.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static void
+report(const char *what, double us, unsigned int runs)
+{
+
+	printf("%-8s %10.1f us/build %8.1f ops %6.1f msgs %5.1f dumps\n",
+	    what, us / runs, (double)kops / runs, (double)kmsgs / runs,
+	    (double)kdumps / runs);
+	kops = kmsgs = kdumps = 0;
+}
+
+static void
+bench_full(unsigned int runs)
+{
+	struct timespec start;
+	double us = 0;
+	unsigned int r;
+
+	for (r = 0; r < runs; r++) {
+		reset();
+		if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+			err(EXIT_FAILURE, "clock_gettime");
+		build();
+		us += elapsed_us(&start);
+		check("full");
+	}
+	report("full", us, runs);
+}
+
+static void
+bench_steady(unsigned int runs)
+{
+	struct timespec start;
+	unsigned int r;
+	double us;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	for (r = 0; r < runs; r++)
+		build();
+	us = elapsed_us(&start);
+	check("steady");
+	if (kops != 0)
+		errx(EXIT_FAILURE, "steady: %zu kernel ops", kops);
+	report("steady", us, runs);
+}
+
+/* One interface at a time gets a new router, as on a lease renewal. */
+static void
+bench_change(unsigned int runs)
+{
+	struct timespec start;
+	unsigned int r;
+	double us;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	for (r = 0; r < runs; r++) {
+		gwgen[r % nifaces]++;
+		rt_build(&ctx, AF_INET);
+	}
+	us = elapsed_us(&start);
+	check("change");
+	report("change", us, runs);
+}
+
+/* The cost of the rt_compare_os comparator, through lookups. */
+static void
+bench_lookup(unsigned int runs)
+{
+	struct timespec start;
+	struct rt *rt;
+	size_t n = 0;
+	unsigned int r;
+	double us;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	for (r = 0; r < runs; r++) {
+		RB_TREE_FOREACH(rt, &kernel) {
+			if (rb_tree_find_node(&ctx.routes, rt) == NULL)
+				errx(EXIT_FAILURE, "lookup: route not found");
+			n++;
+		}
+	}
+	us = elapsed_us(&start);
+	printf("%-8s %10.1f ns/find over %zu routes\n",
+	    "lookup", us * 1000 / (double)n, n / runs);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int runs = 100;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "i:k:m:r:")) != -1) {
+		switch (ch) {
+		case 'i':
+			nifaces = (unsigned int)atoi(optarg);
+			break;
+		case 'k':
+			nra = (unsigned int)atoi(optarg);
+			break;
+		case 'm':
+			nstatic = (unsigned int)atoi(optarg);
+			break;
+		case 'r':
+			runs = (unsigned int)atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i interfaces] "
+			    "[-m routes] [-k routes] [-r runs]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (nifaces == 0 || runs == 0)
+		errx(EXIT_FAILURE, "need at least one interface and run");
+
+	setup();
+	printf("%u interfaces, %u RFC 3442 and %u RA routes each\n",
+	    nifaces, nstatic, nra);
+	bench_full(runs);
+	bench_steady(runs);
+	bench_change(runs);
+	bench_lookup(runs);
+
+	reset();
+	rt_dispose(&ctx);
+	free(gwgen);
+	free(ifos);
+	free(ifaces);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,264 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - seccomp filter benchmark
+ * Copyright (c) 2006-2026 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Times system calls the sandboxed privsep processes make, first as
+ * they are and then in a child which has entered the seccomp filter
+ * that dhcpcd installs, to show what the filter adds to each.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <net/if.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcpcd.h"
+#include "privsep.h"
+
+#ifdef HAVE_SECCOMP
+#include <sys/epoll.h>
+
+static unsigned long ncalls = 200000;
+static int epoll_fd, sock_fd, null_fd, zero_fd, inet_fd;
+
+static void
+call_epoll_pwait(void)
+{
+	struct epoll_event ev;
+
+	epoll_pwait(epoll_fd, &ev, 1, 0, NULL);
+}
+
+static void
+call_recvmsg(void)
+{
+	char buf[64];
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	recvmsg(sock_fd, &msg, MSG_DONTWAIT);
+}
+
+static void
+call_writev(void)
+{
+	char buf[64] = { 0 };
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+
+	writev(null_fd, &iov, 1);
+}
+
+static void
+call_read(void)
+{
+	char buf[64];
+
+	read(zero_fd, buf, sizeof(buf));
+}
+
+static void
+call_getpid(void)
+{
+
+	/* libc may remember it rather than ask. */
+	syscall(SYS_getpid);
+}
+
+static void
+call_uname(void)
+{
+	struct utsname uts;
+
+	uname(&uts);
+}
+
+static void
+call_ioctl(void)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, "lo", sizeof(ifr.ifr_name));
+	ioctl(inet_fd, SIOCGIFMTU, &ifr);
+}
+
+static const struct call {
+	const char	*name;
+	void		(*fn)(void);
+} calls[] = {
+	{ "epoll_pwait",	call_epoll_pwait },
+	{ "recvmsg",		call_recvmsg },
+	{ "writev",		call_writev },
+	{ "read",		call_read },
+	{ "getpid",		call_getpid },
+	{ "uname",		call_uname },
+	{ "ioctl",		call_ioctl },
+};
+
+static double
+bench_call(const struct call *c)
+{
+	struct timespec start, end;
+	unsigned long i;
+
+	/* Warm up the caches and the kernel's view of the filter. */
+	for (i = 0; i < ncalls / 10; i++)
+		c->fn();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ncalls; i++)
+		c->fn();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return ((double)(end.tv_sec - start.tv_sec) * 1e9 +
+	    (double)(end.tv_nsec - start.tv_nsec)) / (double)ncalls;
+}
+
+static void
+bench_all(double *ns)
+{
+	size_t i;
+
+	for (i = 0; i < __arraycount(calls); i++)
+		ns[i] = bench_call(&calls[i]);
+}
+
+/* Returns -1 if the sandbox could not be entered. */
+static int
+bench_sandboxed(double *ns)
+{
+	int fds[2], status, serrno;
+	pid_t pid;
+	ssize_t len;
+
+	if (pipe(fds) == -1)
+		err(EXIT_FAILURE, "pipe");
+	pid = fork();
+	if (pid == -1)
+		err(EXIT_FAILURE, "fork");
+	if (pid == 0) {
+		close(fds[0]);
+		if (ps_seccomp_enter() == -1) {
+			serrno = errno;
+			write(fds[1], &serrno, sizeof(serrno));
+			_exit(EXIT_FAILURE);
+		}
+		bench_all(ns);
+		write(fds[1], ns, sizeof(*ns) * __arraycount(calls));
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+	len = read(fds[0], ns, sizeof(*ns) * __arraycount(calls));
+	close(fds[0]);
+	if (waitpid(pid, &status, 0) == -1)
+		err(EXIT_FAILURE, "waitpid");
+	if (WIFSIGNALED(status))
+		errx(EXIT_FAILURE, "sandboxed child killed by signal %d",
+		    WTERMSIG(status));
+	if (WEXITSTATUS(status) != EXIT_SUCCESS) {
+		if (len == sizeof(serrno)) {
+			memcpy(&serrno, ns, sizeof(serrno));
+			errno = serrno;
+		} else
+			errno = EIO;
+		return -1;
+	}
+	if (len != (ssize_t)(sizeof(*ns) * __arraycount(calls)))
+		errx(EXIT_FAILURE, "short read from sandboxed child");
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	double bare[__arraycount(calls)], boxed[__arraycount(calls)];
+	int ch, e, sv[2];
+	size_t i;
+
+	while ((ch = getopt(argc, argv, "c:")) != -1) {
+		switch (ch) {
+		case 'c':
+			ncalls = (unsigned long)strtou(optarg, NULL, 0,
+			    1, 100000000, &e);
+			if (e)
+				errx(EXIT_FAILURE, "invalid calls: %s", optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-c calls]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		err(EXIT_FAILURE, "epoll_create1");
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) == -1)
+		err(EXIT_FAILURE, "socketpair");
+	sock_fd = sv[0];
+	if ((null_fd = open("/dev/null", O_WRONLY)) == -1)
+		err(EXIT_FAILURE, "/dev/null");
+	if ((zero_fd = open("/dev/zero", O_RDONLY)) == -1)
+		err(EXIT_FAILURE, "/dev/zero");
+	if ((inet_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+		err(EXIT_FAILURE, "socket");
+
+	bench_all(bare);
+	if (bench_sandboxed(boxed) == -1) {
+		warn("ps_seccomp_enter");
+		printf("seccomp is not available, skipping\n");
+		return EXIT_SUCCESS;
+	}
+
+	printf("%-12s %12s %12s %12s\n", "call", "bare", "sandboxed", "filter");
+	for (i = 0; i < __arraycount(calls); i++)
+		printf("%-12s %9.1f ns %9.1f ns %+9.1f ns\n", calls[i].name,
+		    bare[i], boxed[i], boxed[i] - bare[i]);
+	printf("over %lu calls each\n", ncalls);
+	return EXIT_SUCCESS;
+}
+#else
+int
+main(void)
+{
+
+	printf("seccomp is not supported here, skipping\n");
+	return EXIT_SUCCESS;
+}
+#endif